@@ -0,0 +1,124 @@
+// ==================================================================================
+// Copyright (c) 2012 HiFi-LoFi
+//
+// This is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+// ==================================================================================
+
+#ifndef _FFTCONVOLVER_TWOSTAGEFFTCONVOLVER_H
+#define _FFTCONVOLVER_TWOSTAGEFFTCONVOLVER_H
+
+#include "FFTConvolver.h"
+#include "Utilities.h"
+
+
+namespace fftconvolver
+{
+
+/**
+* @class TwoStageFFTConvolver
+* @brief FFT convolver using two different block sizes
+*
+* The 2-stage convolver consists internally of 3 convolvers:
+*
+* - Head convolver: Used for the first part of the impulse response, uses
+*   the small head block size, so the per-call cost stays low
+*
+* - First tail convolver: Used for the next tail block of the impulse
+*   response, also uses the head block size but is only run once per
+*   completed head block
+*
+* - Second tail convolver: Used for the rest of the impulse response, uses the
+*   big tail block size and is run once per completed tail block. This is the
+*   expensive part, so it is kicked off through startBackgroundProcessing()
+*   and collected through waitForBackgroundProcessing(), which a subclass can
+*   override to run it in a separate thread.
+*
+* The input and output of process() may be the same buffer.
+*/
+class TwoStageFFTConvolver
+{
+public:
+  TwoStageFFTConvolver();
+  virtual ~TwoStageFFTConvolver();
+
+  /**
+  * @brief Initialization the convolver
+  * @param headBlockSize The head block size
+  * @param tailBlockSize the tail block size
+  * @param ir The impulse response
+  * @param irLen Length of the impulse response in samples
+  * @return true: Success - false: Failed
+  */
+  bool init(size_t headBlockSize, size_t tailBlockSize, const Sample* ir, size_t irLen);
+
+  /**
+  * @brief Convolves the the given input samples and immediately outputs the result
+  * @param input The input samples
+  * @param output The convolution result
+  * @param len Number of input/output samples
+  */
+  void process(const Sample* input, Sample* output, size_t len);
+
+  /**
+  * @brief Resets the convolver and discards the set impulse response
+  */
+  void reset();
+
+protected:
+  /**
+  * @brief Method called by the convolver if work for background processing is available
+  *
+  * The default implementation just calls doBackgroundProcessing() to perform the "bulk"
+  * convolution. However, if you want to perform the majority of work in some background
+  * thread, override this method and trigger the background work there.
+  */
+  virtual void startBackgroundProcessing();
+
+  /**
+  * @brief Called by the convolver if it's waiting for the background processing to finish
+  *
+  * The default implementation does nothing, because all work has already been done in
+  * startBackgroundProcessing(). If you perform the background work in a separate thread,
+  * block here until it has finished.
+  */
+  virtual void waitForBackgroundProcessing();
+
+  /**
+  * @brief Actually performs the background processing work
+  */
+  void doBackgroundProcessing();
+
+private:
+  size_t _headBlockSize;
+  size_t _tailBlockSize;
+  FFTConvolver _headConvolver;
+  FFTConvolver _tailConvolver0;
+  SampleBuffer _tailOutput0;
+  SampleBuffer _tailPrecalculated0;
+  FFTConvolver _tailConvolver;
+  SampleBuffer _tailOutput;
+  SampleBuffer _tailPrecalculated;
+  SampleBuffer _tailInput;
+  size_t _tailInputFill;
+  size_t _precalculatedPos;
+  SampleBuffer _backgroundProcessingInput;
+
+  // Prevent uncontrolled usage
+  TwoStageFFTConvolver(const TwoStageFFTConvolver&);
+  TwoStageFFTConvolver& operator=(const TwoStageFFTConvolver&);
+};
+
+} // End of namespace fftconvolver
+
+#endif // Header guard
@@ -1,23 +1,392 @@
 
 
+#include <atomic>
+#include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sndfile.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <vector>
 #include "convolver.h"
-#include "FFTConvolver.h"
+#include "TwoStageFFTConvolver.h"
 #include "Utilities.h"
 
 extern "C" void _warn(const char *filename, const int linenumber, const char *format, ...);
 extern "C" void _debug(const char *filename, const int linenumber, int level, const char *format, ...);
+extern "C" int mkpath(const char *path, mode_t mode);
 
 #define warn(...) _warn(__FILE__, __LINE__, __VA_ARGS__)
 #define debug(...) _debug(__FILE__, __LINE__, __VA_ARGS__)
 
-fftconvolver::FFTConvolver convolver_l;
-fftconvolver::FFTConvolver convolver_r;
+// The head of the impulse response is convolved inline, in partitions of about a packet.
+// The tail is convolved in much bigger partitions, a whole tail block at a time, on a
+// worker thread, so a long room-correction IR doesn't add to the work done per packet.
+#define CONVOLVER_HEAD_BLOCK_SIZE 352
+#define CONVOLVER_TAIL_BLOCK_SIZE 4096
 
-// always lock use this when accessing the playing conn value
-pthread_mutex_t convolver_lock = PTHREAD_MUTEX_INITIALIZER;
+// An impulse response is resampled to a session's output rate with a windowed sinc that has
+// this many zero crossings each side of its centre.
+#define CONVOLVER_RESAMPLE_ZEROS 32
 
+class ThreadedConvolver : public fftconvolver::TwoStageFFTConvolver {
+public:
+  ThreadedConvolver();
+  virtual ~ThreadedConvolver();
+
+  // wait for any tail work in progress, then load a new impulse response
+  bool load(const fftconvolver::Sample* ir, size_t irLen);
+
+protected:
+  virtual void startBackgroundProcessing();
+  virtual void waitForBackgroundProcessing();
+
+private:
+  static void* worker(void* arg);
+
+  pthread_t _thread;
+  bool _threadRunning;
+  pthread_mutex_t _mutex;
+  pthread_cond_t _cond;
+  bool _pending; // a tail block has been handed to the worker and isn't finished yet
+  bool _quit;
+};
+
+ThreadedConvolver::ThreadedConvolver() : _threadRunning(false), _pending(false), _quit(false) {
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_cond, NULL);
+}
+
+ThreadedConvolver::~ThreadedConvolver() {
+  if (_threadRunning) {
+    pthread_mutex_lock(&_mutex);
+    _quit = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_thread, NULL);
+  }
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_mutex);
+}
+
+bool ThreadedConvolver::load(const fftconvolver::Sample* ir, size_t irLen) {
+  waitForBackgroundProcessing();
+  return init(CONVOLVER_HEAD_BLOCK_SIZE, CONVOLVER_TAIL_BLOCK_SIZE, ir, irLen);
+}
+
+void* ThreadedConvolver::worker(void* arg) {
+  ThreadedConvolver* c = static_cast<ThreadedConvolver*>(arg);
+  pthread_mutex_lock(&c->_mutex);
+  while (!c->_quit) {
+    if (c->_pending) {
+      pthread_mutex_unlock(&c->_mutex);
+      c->doBackgroundProcessing();
+      pthread_mutex_lock(&c->_mutex);
+      c->_pending = false;
+      pthread_cond_broadcast(&c->_cond);
+    } else {
+      pthread_cond_wait(&c->_cond, &c->_mutex);
+    }
+  }
+  pthread_mutex_unlock(&c->_mutex);
+  return NULL;
+}
+
+void ThreadedConvolver::startBackgroundProcessing() {
+  if (!_threadRunning) {
+    if (pthread_create(&_thread, NULL, worker, this) == 0) {
+      _threadRunning = true;
+    } else {
+      warn("Could not create the convolution worker thread -- convolving the tail inline.");
+      doBackgroundProcessing();
+      return;
+    }
+  }
+  pthread_mutex_lock(&_mutex);
+  _pending = true;
+  pthread_cond_broadcast(&_cond);
+  pthread_mutex_unlock(&_mutex);
+}
+
+void ThreadedConvolver::waitForBackgroundProcessing() {
+  pthread_mutex_lock(&_mutex);
+  while (_pending)
+    pthread_cond_wait(&_cond, &_mutex);
+  pthread_mutex_unlock(&_mutex);
+}
+
+// A pair of convolvers, one per channel, for one impulse response.
+struct ConvolverPair {
+  ThreadedConvolver left;
+  ThreadedConvolver right;
+};
+
+// Optionally, the right channel is convolved on a persistent helper thread while the
+// player thread does the left. The handoff is a pair of counters: the player bumps
+// helper_requested for each packet and spins until helper_completed catches up.
+// The helper spins briefly for new work, then sleeps on helper_cond until woken.
+#define CONVOLVER_HELPER_SPINS 4096
+
+static std::atomic<bool> helper_wanted(false);
+
+// A session's convolver. The convolvers hold the history of the signal, so each session has a
+// pair of its own, built from the impulse response last loaded. When a new impulse response is
+// loaded, a new pair is built for every session off to the side and published by swapping the
+// session's current pair; the player thread never waits for an impulse response to be loaded.
+struct convolver {
+  std::atomic<ConvolverPair*> current;
+  // The pair the player thread is using right now, if any -- a hazard pointer.
+  // A replaced pair is only deleted once the player thread is no longer using it.
+  std::atomic<ConvolverPair*> in_use;
+  convolver* next; // in the list of sessions, under convolver_load_lock
+  unsigned int rate; // the session's output rate, which its impulse response is resampled to
+
+  bool helper_running; // only touched by the player thread
+  bool helper_quit;
+  pthread_t helper_thread;
+  pthread_mutex_t helper_mutex;
+  pthread_cond_t helper_cond;
+  std::atomic<unsigned int> helper_requested;
+  std::atomic<unsigned int> helper_completed;
+  std::atomic<bool> helper_sleeping;
+
+  // the job -- written by the player before bumping helper_requested
+  ConvolverPair* helper_pair;
+  float* helper_data;
+  int helper_length;
+};
+
+// serialises loaders, and the creation and destruction of sessions' convolvers, only -- it is
+// never taken on the processing path
+static pthread_mutex_t convolver_load_lock = PTHREAD_MUTEX_INITIALIZER;
+static convolver* convolvers = NULL;
+
+// the impulse response last loaded, at the rate it was recorded at, and a hash of it and the
+// rate, which identifies it in the cache
+static std::vector<float> convolver_ir_left, convolver_ir_right;
+static unsigned int convolver_ir_rate = 0;
+static uint64_t convolver_ir_hash = 0;
+
+// the impulse response at each output rate a session has asked for, from which sessions' pairs
+// are built. The rate it was loaded at is always the first.
+struct ResampledImpulseResponse {
+  unsigned int rate;
+  std::vector<float> left;
+  std::vector<float> right;
+};
+static std::vector<ResampledImpulseResponse> convolver_irs;
+
+// where resampled impulse responses are kept, so they're only resampled once; empty for none
+static std::string convolver_cache_directory;
+
+static uint64_t convolver_hash(uint64_t hash, const void* data, size_t length) {
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  size_t i;
+  for (i = 0; i < length; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL; // FNV-1a
+  }
+  return hash;
+}
+
+// a band-limited resampling of one channel, scaled so that its gain is unchanged -- at a higher
+// rate, the response is spread over more samples, each of which must contribute less
+static void convolver_resample(const std::vector<float>& in, unsigned int in_rate,
+                               std::vector<float>& out, unsigned int out_rate) {
+  const double step = (double)in_rate / out_rate; // in input samples per output sample
+  const double fc = step > 1.0 ? 1.0 / step : 1.0; // the cutoff, relative to the input's Nyquist
+  const double half_width = CONVOLVER_RESAMPLE_ZEROS / fc; // in input samples
+  const size_t out_length = (size_t)ceil(in.size() / step);
+  out.assign(out_length, 0.0f);
+  size_t n;
+  for (n = 0; n < out_length; n++) {
+    double t = n * step;
+    long first = (long)ceil(t - half_width);
+    long last = (long)floor(t + half_width);
+    if (first < 0)
+      first = 0;
+    if (last >= (long)in.size())
+      last = (long)in.size() - 1;
+    double sum = 0.0;
+    long k;
+    for (k = first; k <= last; k++) {
+      double x = t - k;
+      double sinc = x == 0.0 ? 1.0 : sin(M_PI * fc * x) / (M_PI * fc * x);
+      double window = 0.42 + 0.5 * cos(M_PI * x / half_width) + 0.08 * cos(2.0 * M_PI * x / half_width);
+      sum += in[k] * fc * sinc * window;
+    }
+    out[n] = sum * step;
+  }
+}
+
+// The cache holds a file for each impulse response and rate: a header, then the left channel,
+// then the right, as native floats.
+struct ConvolverCacheHeader {
+  char magic[4];
+  uint32_t rate;
+  uint32_t length;
+  uint32_t reserved;
+  uint64_t hash;
+};
+
+static std::string convolver_cache_path(unsigned int rate) {
+  char name[64];
+  snprintf(name, sizeof(name), "/%016llx-%u.ir", (unsigned long long)convolver_ir_hash, rate);
+  return convolver_cache_directory + name;
+}
+
+static bool convolver_cache_read(ResampledImpulseResponse& ir) {
+  if (convolver_cache_directory.empty())
+    return false;
+  std::string path = convolver_cache_path(ir.rate);
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == NULL)
+    return false;
+  bool ok = false;
+  ConvolverCacheHeader header;
+  if ((fread(&header, sizeof(header), 1, f) == 1) && (memcmp(header.magic, "SSIR", 4) == 0) &&
+      (header.rate == ir.rate) && (header.hash == convolver_ir_hash) && (header.length > 0)) {
+    ir.left.resize(header.length);
+    ir.right.resize(header.length);
+    ok = (fread(ir.left.data(), sizeof(float), header.length, f) == header.length) &&
+         (fread(ir.right.data(), sizeof(float), header.length, f) == header.length);
+  }
+  fclose(f);
+  if (ok)
+    debug(2, "convolver: impulse response at %u Hz read from \"%s\".", ir.rate, path.c_str());
+  else
+    warn("The cached impulse response \"%s\" can't be read and will be made again.", path.c_str());
+  return ok;
+}
+
+// written to a temporary file and renamed, so that a partial file is never read
+static void convolver_cache_write(const ResampledImpulseResponse& ir) {
+  if (convolver_cache_directory.empty())
+    return;
+  if (mkpath(convolver_cache_directory.c_str(), 0777) != 0) {
+    warn("Can't create the impulse response cache directory \"%s\".", convolver_cache_directory.c_str());
+    return;
+  }
+  std::string path = convolver_cache_path(ir.rate);
+  std::string temporary = path + ".tmp";
+  FILE* f = fopen(temporary.c_str(), "wb");
+  if (f == NULL) {
+    warn("Can't write the cached impulse response \"%s\".", temporary.c_str());
+    return;
+  }
+  ConvolverCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "SSIR", 4);
+  header.rate = ir.rate;
+  header.length = ir.left.size();
+  header.hash = convolver_ir_hash;
+  bool ok = (fwrite(&header, sizeof(header), 1, f) == 1) &&
+            (fwrite(ir.left.data(), sizeof(float), ir.left.size(), f) == ir.left.size()) &&
+            (fwrite(ir.right.data(), sizeof(float), ir.right.size(), f) == ir.right.size());
+  if ((fclose(f) != 0) || !ok || (rename(temporary.c_str(), path.c_str()) != 0)) {
+    warn("Can't write the cached impulse response \"%s\".", path.c_str());
+    remove(temporary.c_str());
+    return;
+  }
+  debug(2, "convolver: impulse response at %u Hz written to \"%s\".", ir.rate, path.c_str());
+}
+
+// called with convolver_load_lock held -- returns NULL if there's no impulse response
+static const ResampledImpulseResponse* convolver_ir_for_rate(unsigned int rate) {
+  if (convolver_irs.empty())
+    return NULL;
+  size_t i;
+  for (i = 0; i < convolver_irs.size(); i++)
+    if (convolver_irs[i].rate == rate)
+      return &convolver_irs[i];
+  ResampledImpulseResponse ir;
+  ir.rate = rate;
+  if (!convolver_cache_read(ir)) {
+    convolver_resample(convolver_ir_left, convolver_ir_rate, ir.left, rate);
+    convolver_resample(convolver_ir_right, convolver_ir_rate, ir.right, rate);
+    debug(1, "Impulse response resampled from %u Hz to %u Hz, giving %u samples.", convolver_ir_rate,
+          rate, (unsigned int)ir.left.size());
+    convolver_cache_write(ir);
+  }
+  convolver_irs.push_back(ir);
+  return &convolver_irs.back();
+}
+
+// called with convolver_load_lock held
+static ConvolverPair* convolver_build_pair(unsigned int rate) {
+  const ResampledImpulseResponse* ir = convolver_ir_for_rate(rate);
+  if (ir == NULL)
+    return NULL;
+  ConvolverPair* pair = new ConvolverPair;
+  pair->left.load(ir->left.data(), ir->left.size());
+  pair->right.load(ir->right.data(), ir->right.size());
+  return pair;
+}
+
+// called with convolver_load_lock held
+static void convolver_publish(convolver* c, ConvolverPair* pair) {
+  ConvolverPair* old = c->current.exchange(pair);
+  if (old) {
+    // the player thread holds a pair for at most one call of convolver_process()
+    const struct timespec one_ms = {0, 1000000};
+    while (c->in_use.load() == old)
+      nanosleep(&one_ms, NULL);
+    delete old;
+  }
+}
+
+int convolver_load(const float* left, const float* right, int length, unsigned int rate) {
+  if ((length <= 0) || (rate == 0))
+    return 0;
+  pthread_mutex_lock(&convolver_load_lock);
+  convolver_ir_left.assign(left, left + length);
+  convolver_ir_right.assign(right, right + length);
+  convolver_ir_rate = rate;
+  convolver_ir_hash = 0xcbf29ce484222325ULL;
+  convolver_ir_hash = convolver_hash(convolver_ir_hash, &rate, sizeof(rate));
+  convolver_ir_hash = convolver_hash(convolver_ir_hash, left, length * sizeof(float));
+  convolver_ir_hash = convolver_hash(convolver_ir_hash, right, length * sizeof(float));
+  convolver_irs.clear();
+  ResampledImpulseResponse ir;
+  ir.rate = rate;
+  ir.left = convolver_ir_left;
+  ir.right = convolver_ir_right;
+  convolver_irs.push_back(ir);
+  convolver* c;
+  for (c = convolvers; c != NULL; c = c->next)
+    convolver_publish(c, convolver_build_pair(c->rate));
+  pthread_mutex_unlock(&convolver_load_lock);
+  return 1;
+}
+
+void convolver_set_cache_directory(const char* directory) {
+  pthread_mutex_lock(&convolver_load_lock);
+  convolver_cache_directory = directory ? directory : "";
+  pthread_mutex_unlock(&convolver_load_lock);
+}
+
+convolver* convolver_create(unsigned int rate) {
+  convolver* c = new convolver;
+  c->in_use.store(nullptr);
+  c->rate = rate;
+  c->helper_running = false;
+  c->helper_quit = false;
+  pthread_mutex_init(&c->helper_mutex, NULL);
+  pthread_cond_init(&c->helper_cond, NULL);
+  c->helper_requested.store(0);
+  c->helper_completed.store(0);
+  c->helper_sleeping.store(false);
+  pthread_mutex_lock(&convolver_load_lock);
+  c->current.store(convolver_build_pair(rate));
+  c->next = convolvers;
+  convolvers = c;
+  pthread_mutex_unlock(&convolver_load_lock);
+  return c;
+}
 
 int convolver_init(const char* filename, int max_length) {
   int success = 0;
@@ -25,46 +394,38 @@ int convolver_init(const char* filename, int max_length) {
   if (filename) {
     SNDFILE* file = sf_open(filename, SFM_READ, &info);
     if (file) {
-  
-      if (info.samplerate == 44100)  {  
-        if ((info.channels == 1) || (info.channels == 2)) {
-          const size_t size = info.frames > max_length ? max_length : info.frames;
-          float buffer[size*info.channels];
-  
-          size_t l = sf_readf_float(file, buffer, size);
-          if (l != 0) {
-            pthread_mutex_lock(&convolver_lock);
-            convolver_l.reset(); // it is possible that init could be called more than once
-            convolver_r.reset(); // so it could be necessary to remove all previous settings
-  
-            if (info.channels == 1) {
-              convolver_l.init(352, buffer, size);
-              convolver_r.init(352, buffer, size);
-            } else {
-              // deinterleave
-              float buffer_l[size];
-              float buffer_r[size];
-    
-              unsigned int i;
-              for (i=0; i<size; ++i)
-              {
-                buffer_l[i] = buffer[2*i+0];
-                buffer_r[i] = buffer[2*i+1];
-              }
-    
-              convolver_l.init(352, buffer_l, size);
-              convolver_r.init(352, buffer_r, size);
-              
+      if (info.samplerate <= 0) {
+        warn("Impulse file \"%s\" has no sample rate.", filename);
+      } else if ((info.channels == 1) || (info.channels == 2)) {
+        const size_t size = info.frames > max_length ? max_length : info.frames;
+        std::vector<float> buffer(size * info.channels);
+
+        size_t l = sf_readf_float(file, buffer.data(), size);
+        if (l != 0) {
+          // it is possible that init could be called more than once --
+          // each session's new pair replaces its previous one once it is ready
+          if (info.channels == 1) {
+            convolver_load(buffer.data(), buffer.data(), size, info.samplerate);
+          } else {
+            // deinterleave
+            std::vector<float> buffer_l(size);
+            std::vector<float> buffer_r(size);
+
+            unsigned int i;
+            for (i=0; i<size; ++i)
+            {
+              buffer_l[i] = buffer[2*i+0];
+              buffer_r[i] = buffer[2*i+1];
             }
-            pthread_mutex_unlock(&convolver_lock);
-            success = 1;
+
+            convolver_load(buffer_l.data(), buffer_r.data(), size, info.samplerate);
           }
-          debug(1, "IR initialized from \"%s\" with %d channels and %d samples", filename, info.channels, size);
-        } else {
-          warn("Impulse file \"%s\" contains %d channels. Only 1 or 2 is supported.", filename, info.channels);
+          success = 1;
         }
+        debug(1, "IR initialized from \"%s\" with %d channels and %d samples at %d Hz", filename,
+              info.channels, size, info.samplerate);
       } else {
-        warn("Impulse file \"%s\" sample rate is %d Hz. Only 44100 Hz is supported", filename, info.samplerate);
+        warn("Impulse file \"%s\" contains %d channels. Only 1 or 2 is supported.", filename, info.channels);
       }
       sf_close(file);
     }
@@ -72,14 +433,103 @@ int convolver_init(const char* filename, int max_length) {
   return success;
 }
 
-void convolver_process_l(float* data, int length) {
-  pthread_mutex_lock(&convolver_lock);
-  convolver_l.process(data, data, length);
-  pthread_mutex_unlock(&convolver_lock);
+static void* convolver_helper(void* arg) {
+  convolver* c = static_cast<convolver*>(arg);
+  unsigned int done = 0;
+  while (1) {
+    int spins = 0;
+    while (c->helper_requested.load() == done && spins < CONVOLVER_HELPER_SPINS)
+      spins++;
+    if (c->helper_requested.load() == done) {
+      pthread_mutex_lock(&c->helper_mutex);
+      c->helper_sleeping.store(true);
+      while (c->helper_requested.load() == done && !c->helper_quit)
+        pthread_cond_wait(&c->helper_cond, &c->helper_mutex);
+      c->helper_sleeping.store(false);
+      bool quit = c->helper_quit;
+      pthread_mutex_unlock(&c->helper_mutex);
+      if (quit)
+        break;
+    }
+    done = c->helper_requested.load();
+    c->helper_pair->right.process(c->helper_data, c->helper_data, c->helper_length);
+    c->helper_completed.store(done);
+  }
+  return NULL;
+}
+
+void convolver_destroy(convolver* c) {
+  pthread_mutex_lock(&convolver_load_lock);
+  convolver** link = &convolvers;
+  while (*link != c)
+    link = &(*link)->next;
+  *link = c->next;
+  pthread_mutex_unlock(&convolver_load_lock);
+  if (c->helper_running) {
+    // it's idle -- the player isn't processing
+    pthread_mutex_lock(&c->helper_mutex);
+    c->helper_quit = true;
+    pthread_cond_signal(&c->helper_cond);
+    pthread_mutex_unlock(&c->helper_mutex);
+    pthread_join(c->helper_thread, NULL);
+  }
+  delete c->current.load();
+  pthread_cond_destroy(&c->helper_cond);
+  pthread_mutex_destroy(&c->helper_mutex);
+  delete c;
+}
+
+void convolver_set_parallel(int parallel) {
+  helper_wanted.store(parallel != 0);
 }
 
-void convolver_process_r(float* data, int length) {
-  pthread_mutex_lock(&convolver_lock);
-  convolver_r.process(data, data, length);
-  pthread_mutex_unlock(&convolver_lock);
+// tries to hand the right channel to the helper -- returns false if it has to be done inline
+static bool convolver_start_right(convolver* c, ConvolverPair* pair, float* right, int length) {
+  if (!helper_wanted.load())
+    return false;
+  if (!c->helper_running) {
+    // started lazily, from the player thread, so that it's created after any daemonising fork
+    if (pthread_create(&c->helper_thread, NULL, convolver_helper, c) != 0) {
+      warn("Could not create the convolution helper thread -- convolving both channels on the player thread.");
+      helper_wanted.store(false);
+      return false;
+    }
+    c->helper_running = true;
+  }
+  c->helper_pair = pair;
+  c->helper_data = right;
+  c->helper_length = length;
+  c->helper_requested.fetch_add(1);
+  if (c->helper_sleeping.load()) {
+    pthread_mutex_lock(&c->helper_mutex);
+    pthread_cond_signal(&c->helper_cond);
+    pthread_mutex_unlock(&c->helper_mutex);
+  }
+  return true;
+}
+
+static void convolver_finish_right(convolver* c) {
+  int spins = 0;
+  while (c->helper_completed.load() != c->helper_requested.load()) {
+    if (++spins > CONVOLVER_HELPER_SPINS)
+      sched_yield();
+  }
+}
+
+void convolver_process(convolver* c, float* left, float* right, int length) {
+  ConvolverPair* pair;
+  do {
+    pair = c->current.load();
+    c->in_use.store(pair);
+  } while (pair != c->current.load()); // it may have been replaced in the meantime
+  if (pair) {
+    if (convolver_start_right(c, pair, right, length)) {
+      pair->left.process(left, left, length);
+      convolver_finish_right(c);
+    } else {
+      pair->left.process(left, left, length);
+      pair->right.process(right, right, length);
+    }
+  }
+  c->in_use.store(nullptr);
 }
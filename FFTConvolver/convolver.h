@@ -4,11 +4,27 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
-  
+
+// a session's convolver -- the filter state is per session, the impulse response is shared
+typedef struct convolver convolver;
+
+// load an impulse response into every session's convolver, and those created afterwards. It may
+// be at any rate: each session's is resampled to the session's output rate
 int convolver_init(const char* file, int max_length);
-void convolver_process_l(float* data, int length);
-void convolver_process_r(float* data, int length);
-  
+// load an impulse response that's already in memory, one per channel, e.g. for the benchmarks
+int convolver_load(const float* left, const float* right, int length, unsigned int rate);
+// where impulse responses resampled to another rate are kept, so that each is only resampled
+// once -- NULL or "" for nowhere
+void convolver_set_cache_directory(const char* directory);
+// create one for a session at an output rate, with the impulse response last loaded, if any
+convolver* convolver_create(unsigned int rate);
+// from the session's thread, when it's no longer processing
+void convolver_destroy(convolver* c);
+// convolve a packet of planar stereo in place; lock-free, so safe against convolver_init()
+void convolver_process(convolver* c, float* left, float* right, int length);
+// if parallel is non-zero, convolver_process() does the right channel on a helper thread
+void convolver_set_parallel(int parallel);
+
 #ifdef __cplusplus
 }
 #endif
@@ -48,6 +48,7 @@
 
 enum am_state state;
 enum ps_state { ps_inactive, ps_active } player_state;
+static int active_players = 0; // one for each zone that's playing -- the player is active if any are
 
 int activity_monitor_running = 0;
 
@@ -120,7 +121,10 @@ void activity_monitor_signify_activity(int active)
     // this could be pthread_cancelled and they is likely to be cancellation points in the
     // hooked-on procedures
     pthread_cleanup_debug_mutex_lock(&activity_monitor_mutex, 10000, 1);
-    player_state = active == 0 ? ps_inactive : ps_active;
+    if (active) active_players++;
+    else if (active_players > 0) active_players--;
+
+    player_state = active_players == 0 ? ps_inactive : ps_active;
     // Now, although we could simply let the state machine in the activity monitor thread
     // look after eveything, we will change state here in two situations:
     // 1. If the state machine is am_inactive and the player is ps_active
@@ -0,0 +1,134 @@
+/*
+ * Adaptive latency. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The latency is brought down slowly while no packets are being lost, and put back up quickly
+// when they are -- see adaptive_latency.h.
+
+#include <string.h>
+
+#include "adaptive_latency.h"
+
+// the latency is brought down at half the drift controller's highest correction rate, so the
+// output keeps in step as it comes down, by dropping a frame every couple of thousand or so
+#define ADAPTIVE_LATENCY_REDUCTION_RATE 0.0005 // seconds per second
+
+// packets should arrive within this many times the smoothed jitter of when they're expected
+#define ADAPTIVE_LATENCY_JITTER_FACTOR 4
+
+// and this is kept in hand beyond that
+#define ADAPTIVE_LATENCY_MARGIN 0.05 // seconds
+
+// the first wait after a back-off, and the longest
+#define ADAPTIVE_LATENCY_FIRST_HOLD_TIME   30.0  // seconds
+#define ADAPTIVE_LATENCY_MAXIMUM_HOLD_TIME 600.0 // seconds
+
+// once packets have had to be recovered, wait this long before taking any more off
+#define ADAPTIVE_LATENCY_RECOVERY_HOLD_TIME 10.0 // seconds
+
+// an update later than this after the last one doesn't take anything off -- the session may have
+// been paused
+#define ADAPTIVE_LATENCY_MAXIMUM_INTERVAL 5.0 // seconds
+
+void adaptive_latency_init(adaptive_latency * adaptive, unsigned int sample_rate)
+{
+    memset(adaptive, 0, sizeof(*adaptive));
+    adaptive->sample_rate = sample_rate;
+    adaptive->hold_time = ADAPTIVE_LATENCY_FIRST_HOLD_TIME;
+}
+
+void adaptive_latency_note_arrival(adaptive_latency * adaptive, uint32_t timestamp,
+                                   uint64_t arrival_time)
+{
+    if (adaptive->previous_arrival_time != 0)
+    {
+        // the difference between how far apart they arrived and how far apart they were sent
+        int64_t sent_interval = (int64_t)(int32_t)(timestamp - adaptive->previous_timestamp) *
+                                1000000000 / adaptive->sample_rate;
+        int64_t transit_difference =
+            (int64_t)(arrival_time - adaptive->previous_arrival_time) - sent_interval;
+
+        if (transit_difference < 0) transit_difference = -transit_difference;
+
+        // a gap of more than a second is a pause or a flush, not jitter
+        if (transit_difference < 1000000000)
+        {
+            uint64_t jitter = __atomic_load_n(&adaptive->jitter, __ATOMIC_RELAXED);
+            jitter = jitter + ((int64_t)transit_difference - (int64_t)jitter) / 16;
+            __atomic_store_n(&adaptive->jitter, jitter, __ATOMIC_RELAXED);
+        }
+    }
+
+    adaptive->previous_arrival_time = arrival_time;
+    adaptive->previous_timestamp = timestamp;
+}
+
+uint32_t adaptive_latency_update(adaptive_latency * adaptive, uint32_t latency,
+                                 uint32_t minimum_latency, double headroom, uint64_t losses,
+                                 uint64_t recoveries, uint64_t time_now)
+{
+    double interval = 0.0;
+
+    if (adaptive->previous_update_time != 0)
+        interval = (time_now - adaptive->previous_update_time) * 0.000000001;
+
+    adaptive->previous_update_time = time_now;
+
+    if (losses != adaptive->losses)
+    {
+        adaptive->reduction = adaptive->reduction / 2;
+        adaptive->hold_until = time_now + (uint64_t)(adaptive->hold_time * 1000000000);
+        adaptive->hold_time = adaptive->hold_time * 2;
+
+        if (adaptive->hold_time > ADAPTIVE_LATENCY_MAXIMUM_HOLD_TIME)
+            adaptive->hold_time = ADAPTIVE_LATENCY_MAXIMUM_HOLD_TIME;
+    }
+    else if (recoveries != adaptive->recoveries)
+    {
+        uint64_t hold_until = time_now + (uint64_t)(ADAPTIVE_LATENCY_RECOVERY_HOLD_TIME * 1000000000);
+
+        if (hold_until > adaptive->hold_until) adaptive->hold_until = hold_until;
+    }
+    else if ((time_now >= adaptive->hold_until) && (interval > 0.0) &&
+             (interval <= ADAPTIVE_LATENCY_MAXIMUM_INTERVAL))
+    {
+        adaptive->reduction += (uint32_t)(ADAPTIVE_LATENCY_REDUCTION_RATE * interval * adaptive->sample_rate + 0.5);
+    }
+
+    adaptive->losses = losses;
+    adaptive->recoveries = recoveries;
+
+    // the floor moves with the jitter, and comes up at once if it has to
+    double jitter = __atomic_load_n(&adaptive->jitter, __ATOMIC_RELAXED) * 0.000000001;
+    uint32_t floor = (uint32_t)((headroom + ADAPTIVE_LATENCY_JITTER_FACTOR * jitter +
+                                 ADAPTIVE_LATENCY_MARGIN) * adaptive->sample_rate);
+
+    if (floor < minimum_latency) floor = minimum_latency;
+
+    if (floor >= latency) adaptive->reduction = 0;
+    else if (adaptive->reduction > latency - floor) adaptive->reduction = latency - floor;
+
+    return latency - adaptive->reduction;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+
+// Adaptive latency takes frames off the latency the sender asks for while the link is clean, a
+// little at a time so that the drift controller can take up each step by dropping frames, down to
+// the sender's minimum latency or the headroom the link needs, whichever is the greater. The
+// headroom allows for the arrival jitter, measured as in RFC 3550, and for the time it takes to
+// ask for a missing packet again and get it. If packets go missing or come too late to be played,
+// it backs off at once, giving back half of what it has taken, and waits before trying again,
+// twice as long each time. Packets that come late but in time, or that have to be asked for
+// again, hold it where it is.
+
+typedef struct adaptive_latency
+{
+    unsigned int sample_rate;        // of the input
+    uint64_t jitter;                 // the smoothed interarrival jitter, in nanoseconds
+    uint64_t previous_arrival_time;  // 0 if no packet has been seen yet
+    uint32_t previous_timestamp;
+    uint32_t reduction;              // the frames taken off the sender's latency
+    uint64_t losses, recoveries;     // the counts at the last update
+    uint64_t previous_update_time;   // 0 if there hasn't been an update yet
+    uint64_t hold_until;             // don't take any more off before this time
+    double hold_time;                // seconds to wait after the next back-off
+} adaptive_latency;
+
+void adaptive_latency_init(adaptive_latency * adaptive, unsigned int sample_rate);
+
+// note each audio packet as it arrives -- not resent ones -- with its RTP timestamp and the time
+// it arrived, in nanoseconds. It's called by the audio receiver, while the updates are done by
+// the control receiver
+void adaptive_latency_note_arrival(adaptive_latency * adaptive, uint32_t timestamp,
+                                   uint64_t arrival_time);
+
+// given the latency the sender asks for, in frames, the lowest latency it permits, or 0 if it
+// hasn't said, the seconds of headroom the player needs besides the jitter allowance (e.g. the
+// output buffer and the time to get a missing packet again), and the counts of packets lost
+// (missing or too late) and recovered (late or asked for again) so far, work out the latency to
+// use. Frames are taken off only if it's called again within a few seconds, as it is on each
+// sync packet.
+uint32_t adaptive_latency_update(adaptive_latency * adaptive, uint32_t latency,
+                                 uint32_t minimum_latency, double headroom, uint64_t losses,
+                                 uint64_t recoveries, uint64_t time_now);
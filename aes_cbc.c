@@ -0,0 +1,118 @@
+/*
+ * AES-CBC decryption of the audio stream. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// With OpenSSL, the EVP interface is used and the key is expanded once for the session -- only
+// the initialisation vector is reset for each packet.
+
+#include <string.h>
+
+#include "aes_cbc.h"
+#include "common.h"
+
+int aes_cbc_decryptor_init(aes_cbc_decryptor * d, const uint8_t key[16], const uint8_t iv[16])
+{
+    memcpy(d->iv, iv, sizeof(d->iv));
+#ifdef CONFIG_MBEDTLS
+    // mbedtls_aes_setkey_dec() picks up AES-NI or the ARMv8 Crypto Extensions by itself
+    // if the library was built with them
+    mbedtls_aes_init(&d->context);
+
+    if (mbedtls_aes_setkey_dec(&d->context, key, 128) != 0)
+    {
+        debug(1, "Can't set the AES decryption key.");
+        return -1;
+    }
+#endif
+#ifdef CONFIG_POLARSSL
+    memset(&d->context, 0, sizeof(aes_context));
+
+    if (aes_setkey_dec(&d->context, key, 128) != 0)
+    {
+        debug(1, "Can't set the AES decryption key.");
+        return -1;
+    }
+#endif
+#ifdef CONFIG_OPENSSL
+    d->context = EVP_CIPHER_CTX_new();
+
+    if (d->context == NULL)
+    {
+        debug(1, "Can't allocate an AES decryption context.");
+        return -1;
+    }
+
+    if (EVP_DecryptInit_ex(d->context, EVP_aes_128_cbc(), NULL, key, d->iv) != 1)
+    {
+        debug(1, "Can't set the AES decryption key.");
+        EVP_CIPHER_CTX_free(d->context);
+        d->context = NULL;
+        return -1;
+    }
+
+    // the packets are whole blocks with no padding -- any part block is sent in the clear
+    EVP_CIPHER_CTX_set_padding(d->context, 0);
+#endif
+    return 0;
+}
+
+void aes_cbc_decrypt(aes_cbc_decryptor * d, uint8_t * buf, size_t length)
+{
+#ifdef CONFIG_MBEDTLS
+    unsigned char iv[16];
+    memcpy(iv, d->iv, sizeof(iv));
+    mbedtls_aes_crypt_cbc(&d->context, MBEDTLS_AES_DECRYPT, length, iv, buf, buf);
+#endif
+#ifdef CONFIG_POLARSSL
+    unsigned char iv[16];
+    memcpy(iv, d->iv, sizeof(iv));
+    aes_crypt_cbc(&d->context, AES_DECRYPT, length, iv, buf, buf);
+#endif
+#ifdef CONFIG_OPENSSL
+    // restarting with just a new iv keeps the expanded key
+    int outlen = 0;
+
+    if ((EVP_DecryptInit_ex(d->context, NULL, NULL, NULL, d->iv) != 1) ||
+        (EVP_DecryptUpdate(d->context, buf, &outlen, buf, length) != 1) || ((size_t)outlen != length))
+        debug(1, "AES decryption of a %zu byte packet failed.", length);
+#endif
+}
+
+void aes_cbc_decryptor_free(aes_cbc_decryptor * d)
+{
+#ifdef CONFIG_MBEDTLS
+    mbedtls_aes_free(&d->context);
+#endif
+#ifdef CONFIG_POLARSSL
+    memset(&d->context, 0, sizeof(aes_context));
+#endif
+#ifdef CONFIG_OPENSSL
+    if (d->context)
+    {
+        EVP_CIPHER_CTX_free(d->context);
+        d->context = NULL;
+    }
+#endif
+}
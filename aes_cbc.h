@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+#ifdef CONFIG_MBEDTLS
+#include <mbedtls/aes.h>
+#endif
+
+#ifdef CONFIG_POLARSSL
+#include <polarssl/aes.h>
+#endif
+
+#ifdef CONFIG_OPENSSL
+#include <openssl/evp.h>
+#endif
+
+// AES-128-CBC decryption of AirPlay audio packets, with whichever library Shairport Sync
+// was built with. The key is expanded once, when the session starts, and each packet is
+// decrypted with the session's fixed initialisation vector.
+// Each library uses the processor's AES instructions, if it has them and was built to use
+// them -- AES-NI on x86 or the ARMv8 Cryptography Extensions.
+
+typedef struct aes_cbc_decryptor
+{
+    uint8_t iv[16];
+#ifdef CONFIG_MBEDTLS
+    mbedtls_aes_context context;
+#endif
+#ifdef CONFIG_POLARSSL
+    aes_context context;
+#endif
+#ifdef CONFIG_OPENSSL
+    EVP_CIPHER_CTX * context; // the key schedule is kept here, between packets
+#endif
+} aes_cbc_decryptor;
+
+// returns 0 on success
+int aes_cbc_decryptor_init(aes_cbc_decryptor * d, const uint8_t key[16], const uint8_t iv[16]);
+
+// decrypt length bytes of buf in place -- length must be a multiple of 16
+void aes_cbc_decrypt(aes_cbc_decryptor * d, uint8_t * buf, size_t length);
+
+void aes_cbc_decryptor_free(aes_cbc_decryptor * d);
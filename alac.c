@@ -42,6 +42,12 @@ static const int host_bigendian = 0;
 
 #include "alac.h"
 
+#if defined(__GNUC__)
+#define ALAC_ALWAYS_INLINE static inline __attribute__((always_inline))
+#else
+#define ALAC_ALWAYS_INLINE static inline
+#endif
+
 #define _Swap32(v)                                                                                 \
     do {                                                                                             \
         v = (((v) & 0x000000FF) << 0x18) | (((v) & 0x0000FF00) << 0x08) | (((v) & 0x00FF0000) >> 0x08) |     \
@@ -141,82 +147,81 @@ void alac_set_info(alac_file * alac, char * inputbuffer)
 
 /* stream reading */
 
-/* supports reading 1 to 16 bits, in big endian format */
-static uint32_t readbits_16(alac_file * alac, int bits)
-{
-    uint32_t result;
-    int new_accumulator;
-
-    result = (alac->input_buffer[0] << 16) | (alac->input_buffer[1] << 8) | (alac->input_buffer[2]);
+/* The stream is read through a 64-bit cache, most significant bit first.
+ * The top input_cache_bits bits of the cache are the next bits of the stream;
+ * it is topped up to at least 56 bits, eight bytes at a time where possible,
+ * so reads of up to 32 bits never have to touch the input more than once.
+ * Past the end of the input, the stream reads as zeros. */
 
-    /* shift left by the number of bits we've already read,
-     * so that the top 'n' bits of the 24 bits we read will
-     * be the return bits */
-    result = result << alac->input_buffer_bitaccumulator;
-
-    result = result & 0x00ffffff;
-
-    /* and then only want the top 'n' bits from that, where
-     * n is 'bits' */
-    result = result >> (24 - bits);
-
-    new_accumulator = (alac->input_buffer_bitaccumulator + bits);
+static inline uint64_t read64_be(const unsigned char * p)
+{
+    uint64_t v;
 
-    /* increase the buffer pointer if we've read over n bytes. */
-    alac->input_buffer += (new_accumulator >> 3);
+    memcpy(&v, p, sizeof(v));
+#if defined(__GNUC__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    v = __builtin_bswap64(v);
+#elif !defined(__GNUC__) || (__BYTE_ORDER__ != __ORDER_BIG_ENDIAN__)
+    {
+        const unsigned char * b = p;
+        int i;
 
-    /* and the remainder goes back into the bit accumulator */
-    alac->input_buffer_bitaccumulator = (new_accumulator & 7);
+        v = 0;
 
-    return result;
+        for (i = 0; i < 8; i++)
+            v = (v << 8) | b[i];
+    }
+#endif
+    return v;
 }
 
-/* supports reading 1 to 32 bits, in big endian format */
-static uint32_t readbits(alac_file * alac, int bits)
+static inline void refill(alac_file * alac)
 {
-    int32_t result = 0;
-
-    if (bits > 16)
+    if (alac->input_buffer_end - alac->input_buffer >= 8)
     {
-        bits -= 16;
-        result = readbits_16(alac, 16) << bits;
+        /* load eight bytes, keep the ones that fit and step past whole bytes only */
+        alac->input_cache |= read64_be(alac->input_buffer) >> alac->input_cache_bits;
+        alac->input_buffer += (63 - alac->input_cache_bits) >> 3;
+        alac->input_cache_bits |= 56;
     }
+    else
+    {
+        while (alac->input_cache_bits <= 56)
+        {
+            uint64_t byte = 0;
 
-    result |= readbits_16(alac, bits);
+            if (alac->input_buffer < alac->input_buffer_end) byte = *alac->input_buffer++;
 
-    return result;
+            alac->input_cache |= byte << (56 - alac->input_cache_bits);
+            alac->input_cache_bits += 8;
+        }
+    }
 }
 
-/* reads a single bit */
-static int readbit(alac_file * alac)
+/* look at the next 1 to 32 bits without consuming them */
+static inline uint32_t peekbits(alac_file * alac, int bits)
 {
-    int result;
-    int new_accumulator;
+    if (alac->input_cache_bits < bits) refill(alac);
 
-    result = alac->input_buffer[0];
-
-    result = result << alac->input_buffer_bitaccumulator;
-
-    result = result >> 7 & 1;
-
-    new_accumulator = (alac->input_buffer_bitaccumulator + 1);
-
-    alac->input_buffer += (new_accumulator / 8);
-
-    alac->input_buffer_bitaccumulator = (new_accumulator % 8);
+    return (uint32_t)(alac->input_cache >> (64 - bits));
+}
 
-    return result;
+static inline void skipbits(alac_file * alac, int bits)
+{
+    alac->input_cache <<= bits;
+    alac->input_cache_bits -= bits;
 }
 
-static void unreadbits(alac_file * alac, int bits)
+/* supports reading 0 to 32 bits, in big endian format */
+static inline uint32_t readbits(alac_file * alac, int bits)
 {
-    int new_accumulator = (alac->input_buffer_bitaccumulator - bits);
+    uint32_t result;
 
-    alac->input_buffer += (new_accumulator >> 3);
+    if (bits <= 0) return 0;
 
-    alac->input_buffer_bitaccumulator = (new_accumulator & 7);
+    result = peekbits(alac, bits);
+    skipbits(alac, bits);
 
-    if (alac->input_buffer_bitaccumulator < 0) alac->input_buffer_bitaccumulator *= -1;
+    return result;
 }
 
 /* various implementations of count_leading_zero:
@@ -248,7 +253,7 @@ static int count_leading_zeros(int32_t input)
  */
 static int count_leading_zeros(int input)
 {
-    return __builtin_clz(input);
+    return input ? __builtin_clz(input) : 32;
 }
 
 #elif defined(_MSC_VER) && defined(_M_IX86)
@@ -324,22 +329,39 @@ static int count_leading_zeros(int input)
 
 #endif /* if 0 */
 
+/* count, without consuming them, up to limit leading 1 bits -- limit must not exceed 32 */
+static inline int peekones(alac_file * alac, int limit)
+{
+    uint32_t inverted;
+
+    if (alac->input_cache_bits < limit) refill(alac);
+
+    inverted = ~(uint32_t)(alac->input_cache >> 32);
+
+    if (inverted == 0) return limit;
+
+    int ones = count_leading_zeros(inverted);
+
+    return ones < limit ? ones : limit;
+}
+
 #define RICE_THRESHOLD 8 // maximum number of bits for a rice prefix.
 
 static int32_t entropy_decode_value(alac_file * alac, int readSampleSize, int k,
                                     int rice_kmodifier_mask)
 {
-    int32_t x = 0; // decoded value
+    int32_t x; // decoded value
 
     // read x, number of 1s before 0 represent the rice value.
-    while (x <= RICE_THRESHOLD && readbit(alac))
-        x++;
+    // This is at most RICE_THRESHOLD + 1 ones; the 0 is only there if there are fewer.
+    x = peekones(alac, RICE_THRESHOLD + 1);
 
     if (x > RICE_THRESHOLD)
     {
         // read the number from the bit stream (raw value)
         int32_t value;
 
+        skipbits(alac, x);
         value = readbits(alac, readSampleSize);
 
         // mask value
@@ -349,15 +371,24 @@ static int32_t entropy_decode_value(alac_file * alac, int readSampleSize, int k,
     }
     else
     {
-        if (k != 1)
+        skipbits(alac, x + 1);
+
+        // with k of 1 there are no extra bits, and the value is just the count of ones. A k of 0
+        // only comes from a damaged header's rice_kmodifier -- it's taken the same way, rather than
+        // peeking 0 bits and skipping -1, so nothing is read out of step
+        if (k > 1)
         {
-            int extraBits = readbits(alac, k);
+            int extraBits = peekbits(alac, k);
 
             // x = x * (2^k - 1)
             x *= (((1 << k) - 1) & rice_kmodifier_mask);
 
-            if (extraBits > 1) x += extraBits - 1;
-            else unreadbits(alac, 1);
+            if (extraBits > 1)
+            {
+                x += extraBits - 1;
+                skipbits(alac, k);
+            }
+            else skipbits(alac, k - 1);
         }
     }
 
@@ -431,6 +462,77 @@ static void entropy_rice_decode(alac_file * alac, int32_t * outputBuffer, int ou
 
 #define SIGN_ONLY(v)               ((v < 0) ? (-1) : ((v > 0) ? (1) : (0)))
 
+/* the adaptive part of the fir decompression, after the warm-up samples.
+ * The prediction for each sample is a dot product over the previous predictor_coef_num
+ * samples -- kept apart from the sequential coefficient adaptation so it can be vectorised */
+ALAC_ALWAYS_INLINE void
+predictor_fir_adapt(const int32_t * error_buffer, int32_t * buffer_out, int output_size,
+                    int readsamplesize, int16_t * predictor_coef_table, const int predictor_coef_num,
+                    int predictor_quantitization)
+{
+    int i;
+
+    for (i = predictor_coef_num + 1; i < output_size; i++)
+    {
+        int j;
+        int sum = 0;
+        int outval;
+        int error_val = error_buffer[i];
+        const int32_t base = buffer_out[0];
+
+        for (j = 0; j < predictor_coef_num; j++)
+        {
+            sum += (buffer_out[predictor_coef_num - j] - base) * predictor_coef_table[j];
+        }
+
+        outval = (1 << (predictor_quantitization - 1)) + sum;
+        outval = outval >> predictor_quantitization;
+        outval = outval + base + error_val;
+        outval = SIGN_EXTENDED32(outval, readsamplesize);
+
+        buffer_out[predictor_coef_num + 1] = outval;
+
+        if (error_val > 0)
+        {
+            int predictor_num = predictor_coef_num - 1;
+
+            while (predictor_num >= 0 && error_val > 0)
+            {
+                int val = base - buffer_out[predictor_coef_num - predictor_num];
+                int sign = SIGN_ONLY(val);
+
+                predictor_coef_table[predictor_num] -= sign;
+
+                val *= sign; /* absolute value */
+
+                error_val -= ((val >> predictor_quantitization) * (predictor_coef_num - predictor_num));
+
+                predictor_num--;
+            }
+        }
+        else if (error_val < 0)
+        {
+            int predictor_num = predictor_coef_num - 1;
+
+            while (predictor_num >= 0 && error_val < 0)
+            {
+                int val = base - buffer_out[predictor_coef_num - predictor_num];
+                int sign = -SIGN_ONLY(val);
+
+                predictor_coef_table[predictor_num] -= sign;
+
+                val *= sign; /* neg value */
+
+                error_val -= ((val >> predictor_quantitization) * (predictor_coef_num - predictor_num));
+
+                predictor_num--;
+            }
+        }
+
+        buffer_out++;
+    }
+}
+
 static void predictor_decompress_fir_adapt(int32_t * error_buffer, int32_t * buffer_out,
                                            int output_size, int readsamplesize,
                                            int16_t * predictor_coef_table, int predictor_coef_num,
@@ -485,97 +587,29 @@ static void predictor_decompress_fir_adapt(int32_t * error_buffer, int32_t * buf
         }
     }
 
-#if 0
-
-    /* 4 and 8 are very common cases (the only ones i've seen). these
-     * should be unrolled and optimised
-     */
+    /* general case -- 4 and 8 are very common (the only ones i've seen), so they get
+     * their own copies with the order fixed, which the compiler can unroll and vectorise */
     if (predictor_coef_num == 4)
-    {
-        /* FIXME: optimised general case */
-        return;
-    }
-
-    if (predictor_coef_table == 8)
-    {
-        /* FIXME: optimised general case */
-        return;
-    }
-
-#endif
-
-    /* general case */
-    if (predictor_coef_num > 0)
-    {
-        for (i = predictor_coef_num + 1; i < output_size; i++)
-        {
-            int j;
-            int sum = 0;
-            int outval;
-            int error_val = error_buffer[i];
-
-            for (j = 0; j < predictor_coef_num; j++)
-            {
-                sum += (buffer_out[predictor_coef_num - j] - buffer_out[0]) * predictor_coef_table[j];
-            }
-
-            outval = (1 << (predictor_quantitization - 1)) + sum;
-            outval = outval >> predictor_quantitization;
-            outval = outval + buffer_out[0] + error_val;
-            outval = SIGN_EXTENDED32(outval, readsamplesize);
-
-            buffer_out[predictor_coef_num + 1] = outval;
-
-            if (error_val > 0)
-            {
-                int predictor_num = predictor_coef_num - 1;
-
-                while (predictor_num >= 0 && error_val > 0)
-                {
-                    int val = buffer_out[0] - buffer_out[predictor_coef_num - predictor_num];
-                    int sign = SIGN_ONLY(val);
-
-                    predictor_coef_table[predictor_num] -= sign;
-
-                    val *= sign; /* absolute value */
-
-                    error_val -= ((val >> predictor_quantitization) * (predictor_coef_num - predictor_num));
-
-                    predictor_num--;
-                }
-            }
-            else if (error_val < 0)
-            {
-                int predictor_num = predictor_coef_num - 1;
-
-                while (predictor_num >= 0 && error_val < 0)
-                {
-                    int val = buffer_out[0] - buffer_out[predictor_coef_num - predictor_num];
-                    int sign = -SIGN_ONLY(val);
-
-                    predictor_coef_table[predictor_num] -= sign;
-
-                    val *= sign; /* neg value */
-
-                    error_val -= ((val >> predictor_quantitization) * (predictor_coef_num - predictor_num));
-
-                    predictor_num--;
-                }
-            }
-
-            buffer_out++;
-        }
-    }
+        predictor_fir_adapt(error_buffer, buffer_out, output_size, readsamplesize, predictor_coef_table, 4,
+                            predictor_quantitization);
+    else if (predictor_coef_num == 8)
+        predictor_fir_adapt(error_buffer, buffer_out, output_size, readsamplesize, predictor_coef_table, 8,
+                            predictor_quantitization);
+    else if (predictor_coef_num > 0)
+        predictor_fir_adapt(error_buffer, buffer_out, output_size, readsamplesize, predictor_coef_table,
+                            predictor_coef_num, predictor_quantitization);
 }
 
-static void deinterlace_16(int32_t * buffer_a, int32_t * buffer_b, int16_t * buffer_out,
-                           int numchannels, int numsamples, uint8_t interlacing_shift,
-                           uint8_t interlacing_leftweight)
+/* the bodies of the deinterlacers are written with the number of channels as a parameter
+ * and instantiated for two channels, the usual case, where the stride is then fixed and the
+ * loops can be vectorised */
+
+ALAC_ALWAYS_INLINE void deinterlace_16_body(const int32_t * buffer_a, const int32_t * buffer_b,
+                                            int16_t * buffer_out, const int numchannels, int numsamples,
+                                            uint8_t interlacing_shift, uint8_t interlacing_leftweight)
 {
     int i;
 
-    if (numsamples <= 0) return;
-
     /* weighted interlacing */
     if (interlacing_leftweight)
     {
@@ -625,82 +659,90 @@ static void deinterlace_16(int32_t * buffer_a, int32_t * buffer_b, int16_t * buf
     }
 }
 
-static void deinterlace_24(int32_t * buffer_a, int32_t * buffer_b, int uncompressed_bytes,
-                           int32_t * uncompressed_bytes_buffer_a,
-                           int32_t * uncompressed_bytes_buffer_b, void * buffer_out, int numchannels,
-                           int numsamples, uint8_t interlacing_shift,
+static void deinterlace_16(int32_t * buffer_a, int32_t * buffer_b, int16_t * buffer_out,
+                           int numchannels, int numsamples, uint8_t interlacing_shift,
                            uint8_t interlacing_leftweight)
 {
-    int i;
-
     if (numsamples <= 0) return;
 
-    /* weighted interlacing */
-    if (interlacing_leftweight)
+    if (numchannels == 2)
+        deinterlace_16_body(buffer_a, buffer_b, buffer_out, 2, numsamples, interlacing_shift,
+                            interlacing_leftweight);
+    else
+        deinterlace_16_body(buffer_a, buffer_b, buffer_out, numchannels, numsamples, interlacing_shift,
+                            interlacing_leftweight);
+}
+
+ALAC_ALWAYS_INLINE void deinterlace_24_body(const int32_t * buffer_a, const int32_t * buffer_b,
+                                            int uncompressed_bytes,
+                                            const int32_t * uncompressed_bytes_buffer_a,
+                                            const int32_t * uncompressed_bytes_buffer_b,
+                                            uint8_t * buffer_out, const int numchannels, int numsamples,
+                                            uint8_t interlacing_shift, uint8_t interlacing_leftweight)
+{
+    int i;
+    const int uncompressed_shift = uncompressed_bytes * 8;
+    const uint32_t mask = uncompressed_bytes ? ~(0xFFFFFFFF << uncompressed_shift) : 0;
+
+    for (i = 0; i < numsamples; i++)
     {
-        for (i = 0; i < numsamples; i++)
+        int32_t left, right;
+
+        if (interlacing_leftweight) /* weighted interlacing */
         {
             int32_t difference, midright;
-            int32_t left;
-            int32_t right;
 
             midright = buffer_a[i];
             difference = buffer_b[i];
 
             right = midright - ((difference * interlacing_leftweight) >> interlacing_shift);
             left = right + difference;
-
-            if (uncompressed_bytes)
-            {
-                uint32_t mask = ~(0xFFFFFFFF << (uncompressed_bytes * 8));
-                left <<= (uncompressed_bytes * 8);
-                right <<= (uncompressed_bytes * 8);
-
-                left |= uncompressed_bytes_buffer_a[i] & mask;
-                right |= uncompressed_bytes_buffer_b[i] & mask;
-            }
-
-            ((uint8_t *)buffer_out)[i * numchannels * 3] = (left) & 0xFF;
-            ((uint8_t *)buffer_out)[i * numchannels * 3 + 1] = (left >> 8) & 0xFF;
-            ((uint8_t *)buffer_out)[i * numchannels * 3 + 2] = (left >> 16) & 0xFF;
-
-            ((uint8_t *)buffer_out)[i * numchannels * 3 + 3] = (right) & 0xFF;
-            ((uint8_t *)buffer_out)[i * numchannels * 3 + 4] = (right >> 8) & 0xFF;
-            ((uint8_t *)buffer_out)[i * numchannels * 3 + 5] = (right >> 16) & 0xFF;
         }
-
-        return;
-    }
-
-    /* otherwise basic interlacing took place */
-    for (i = 0; i < numsamples; i++)
-    {
-        int32_t left, right;
-
-        left = buffer_a[i];
-        right = buffer_b[i];
+        else /* otherwise basic interlacing took place */
+        {
+            left = buffer_a[i];
+            right = buffer_b[i];
+        }
 
         if (uncompressed_bytes)
         {
-            uint32_t mask = ~(0xFFFFFFFF << (uncompressed_bytes * 8));
-            left <<= (uncompressed_bytes * 8);
-            right <<= (uncompressed_bytes * 8);
+            left <<= uncompressed_shift;
+            right <<= uncompressed_shift;
 
             left |= uncompressed_bytes_buffer_a[i] & mask;
             right |= uncompressed_bytes_buffer_b[i] & mask;
         }
 
-        ((uint8_t *)buffer_out)[i * numchannels * 3] = (left) & 0xFF;
-        ((uint8_t *)buffer_out)[i * numchannels * 3 + 1] = (left >> 8) & 0xFF;
-        ((uint8_t *)buffer_out)[i * numchannels * 3 + 2] = (left >> 16) & 0xFF;
+        buffer_out[i * numchannels * 3] = (left) & 0xFF;
+        buffer_out[i * numchannels * 3 + 1] = (left >> 8) & 0xFF;
+        buffer_out[i * numchannels * 3 + 2] = (left >> 16) & 0xFF;
 
-        ((uint8_t *)buffer_out)[i * numchannels * 3 + 3] = (right) & 0xFF;
-        ((uint8_t *)buffer_out)[i * numchannels * 3 + 4] = (right >> 8) & 0xFF;
-        ((uint8_t *)buffer_out)[i * numchannels * 3 + 5] = (right >> 16) & 0xFF;
+        buffer_out[i * numchannels * 3 + 3] = (right) & 0xFF;
+        buffer_out[i * numchannels * 3 + 4] = (right >> 8) & 0xFF;
+        buffer_out[i * numchannels * 3 + 5] = (right >> 16) & 0xFF;
     }
 }
 
-void alac_decode_frame(alac_file * alac, unsigned char * inbuffer, void * outbuffer, int * outputsize)
+static void deinterlace_24(int32_t * buffer_a, int32_t * buffer_b, int uncompressed_bytes,
+                           int32_t * uncompressed_bytes_buffer_a,
+                           int32_t * uncompressed_bytes_buffer_b, void * buffer_out, int numchannels,
+                           int numsamples, uint8_t interlacing_shift,
+                           uint8_t interlacing_leftweight)
+{
+    if (numsamples <= 0) return;
+
+    if (numchannels == 2)
+        deinterlace_24_body(buffer_a, buffer_b, uncompressed_bytes, uncompressed_bytes_buffer_a,
+                            uncompressed_bytes_buffer_b, (uint8_t *)buffer_out, 2, numsamples,
+                            interlacing_shift, interlacing_leftweight);
+    else
+        deinterlace_24_body(buffer_a, buffer_b, uncompressed_bytes, uncompressed_bytes_buffer_a,
+                            uncompressed_bytes_buffer_b, (uint8_t *)buffer_out, numchannels, numsamples,
+                            interlacing_shift, interlacing_leftweight);
+}
+
+void alac_decode_frame(alac_file * alac, unsigned char * inbuffer, int inputsize, void * outbuffer,
+                       int * outputsize)
 {
     int outbuffer_allocation_size = *outputsize; // initial value
     int channels;
@@ -708,7 +750,9 @@ void alac_decode_frame(alac_file * alac, unsigned char * inbuffer, void * outbuf
 
     /* setup the stream */
     alac->input_buffer = inbuffer;
-    alac->input_buffer_bitaccumulator = 0;
+    alac->input_buffer_end = inbuffer + inputsize;
+    alac->input_cache = 0;
+    alac->input_cache_bits = 0;
 
     channels = readbits(alac, 3);
 
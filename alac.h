@@ -35,16 +35,19 @@
 typedef struct alac_file alac_file;
 
 alac_file * alac_create(int samplesize, int numchannels);
-void alac_decode_frame(alac_file * alac, unsigned char * inbuffer, void * outbuffer, int * outputsize);
+void alac_decode_frame(alac_file * alac, unsigned char * inbuffer, int inputsize, void * outbuffer,
+                       int * outputsize);
 void alac_set_info(alac_file * alac, char * inputbuffer);
 void alac_allocate_buffers(alac_file * alac);
 void alac_free(alac_file * alac);
 
 struct alac_file
 {
-    unsigned char * input_buffer;
-    int input_buffer_bitaccumulator; /* used so we can do arbitrary
-                                        bit reads */
+    const unsigned char * input_buffer; /* the next byte to go into the cache */
+    const unsigned char * input_buffer_end;
+    uint64_t input_cache;               /* the next input_cache_bits bits of the stream,
+                                           most significant bit first */
+    int input_cache_bits;
 
     int samplesize;
     int numchannels;
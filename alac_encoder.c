@@ -0,0 +1,271 @@
+/*
+ * A minimal ALAC encoder. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The decoder in alac.c run backwards, to make realistic input for the benchmarks and the
+// startup profile.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "alac.h"
+#include "alac_encoder.h"
+
+// the ALAC parameters AirPlay senders use, as in the fmtp of an ANNOUNCE
+#define ALAC_ENCODER_HISTORY_MULT    40
+#define ALAC_ENCODER_INITIAL_HISTORY 10
+#define ALAC_ENCODER_KMODIFIER       14
+#define ALAC_ENCODER_RICE_THRESHOLD  8 // see entropy_decode_value() in alac.c
+
+// the encoder's choices -- a fourth-order predictor and mid/side stereo, as iTunes uses
+#define ALAC_ENCODER_PREDICTOR_ORDER 4
+#define ALAC_ENCODER_QUANTISATION    9
+#define ALAC_ENCODER_RICE_MODIFIER   4
+#define ALAC_ENCODER_SAMPLE_SIZE     17 // 16 bits plus one for the side channel
+
+int32_t alac_encoder_fmtp[12] = { 96,
+                                  ALAC_ENCODER_FRAMES_PER_PACKET,
+                                  0,
+                                  16,
+                                  ALAC_ENCODER_HISTORY_MULT,
+                                  ALAC_ENCODER_INITIAL_HISTORY,
+                                  ALAC_ENCODER_KMODIFIER,
+                                  2,
+                                  255,
+                                  0,
+                                  0,
+                                  44100 };
+
+typedef struct
+{
+    uint8_t * data;
+    size_t bit;
+} alac_encoder_bits;
+
+static void alac_encoder_put_bits(alac_encoder_bits * b, uint32_t value, int bits)
+{
+    while (bits--)
+    {
+        if ((value >> bits) & 1) b->data[b->bit >> 3] |= 0x80 >> (b->bit & 7);
+
+        b->bit++;
+    }
+}
+
+static int alac_encoder_clz(uint32_t v)
+{
+    return v ? __builtin_clz(v) : 32;
+}
+
+static void alac_encoder_put_value(alac_encoder_bits * b, uint32_t x, int k, int sample_size, uint32_t mask)
+{
+    uint32_t m = (k == 1) ? 1 : (((1u << k) - 1) & mask);
+    uint32_t q = (m == 0) ? ALAC_ENCODER_RICE_THRESHOLD + 1 : x / m;
+
+    if (q > ALAC_ENCODER_RICE_THRESHOLD)
+    {
+        alac_encoder_put_bits(b, 0x1ff, ALAC_ENCODER_RICE_THRESHOLD + 1); // the escape
+        alac_encoder_put_bits(b, x, sample_size);
+        return;
+    }
+
+    alac_encoder_put_bits(b, (1u << (q + 1)) - 2, q + 1); // q ones and a zero
+
+    if (k != 1)
+    {
+        uint32_t r = x - q * m;
+
+        if (r == 0) alac_encoder_put_bits(b, 0, k - 1);
+        else alac_encoder_put_bits(b, r + 1, k);
+    }
+}
+
+static void alac_encoder_rice_encode(alac_encoder_bits * b, const int32_t * residuals, int n)
+{
+    int history = ALAC_ENCODER_INITIAL_HISTORY;
+    int history_mult = ALAC_ENCODER_RICE_MODIFIER * ALAC_ENCODER_HISTORY_MULT / 4;
+    int32_t sign_modifier = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        int32_t v = residuals[i];
+        int32_t d = v >= 0 ? 2 * v : -2 * v - 1; // the sign goes in the low bit
+        int k = 31 - ALAC_ENCODER_KMODIFIER - alac_encoder_clz((history >> 9) + 3);
+
+        if (k < 0) k += ALAC_ENCODER_KMODIFIER;
+        else k = ALAC_ENCODER_KMODIFIER;
+
+        alac_encoder_put_value(b, d - sign_modifier, k, ALAC_ENCODER_SAMPLE_SIZE, 0xffffffff);
+        sign_modifier = 0;
+
+        history += (d * history_mult) - ((history * history_mult) >> 9);
+
+        if (d > 0xffff) history = 0xffff;
+
+        if ((history < 128) && (i + 1 < n))
+        {
+            // a run of zeros -- the value after it, which isn't zero, is sent less one
+            int zeros = 0;
+
+            while ((i + 1 + zeros < n) && (residuals[i + 1 + zeros] == 0) && (zeros < 0xffff))
+                zeros++;
+
+            k = alac_encoder_clz(history) + ((history + 16) / 64) - 24;
+            alac_encoder_put_value(b, zeros, k, 16, (1 << ALAC_ENCODER_KMODIFIER) - 1);
+            i += zeros;
+            sign_modifier = 1;
+            history = 0;
+        }
+    }
+}
+
+// the residuals that predictor_decompress_fir_adapt() will turn back into samples, adapting its
+// coefficients exactly as it will
+static void alac_encoder_residuals(const int32_t * samples, int32_t * residuals, int n,
+                                 const int16_t * initial_coefficients)
+{
+    int16_t coefficients[ALAC_ENCODER_PREDICTOR_ORDER];
+    const int order = ALAC_ENCODER_PREDICTOR_ORDER;
+    const int q = ALAC_ENCODER_QUANTISATION;
+    int i, j;
+
+    memcpy(coefficients, initial_coefficients, sizeof(coefficients));
+
+    residuals[0] = samples[0];
+
+    for (i = 0; i < order; i++)
+        residuals[i + 1] = samples[i + 1] - samples[i];
+
+    for (i = order + 1; i < n; i++)
+    {
+        const int32_t * window = samples + i - order - 1; // the decoder's buffer_out
+        const int32_t base = window[0];
+        int sum = 0;
+
+        for (j = 0; j < order; j++)
+            sum += (window[order - j] - base) * coefficients[j];
+
+        int error_val = samples[i] - ((((1 << (q - 1)) + sum) >> q) + base);
+        residuals[i] = error_val;
+
+        int predictor_num = order - 1;
+
+        if (error_val > 0)
+        {
+            while ((predictor_num >= 0) && (error_val > 0))
+            {
+                int val = base - window[order - predictor_num];
+                int sign = (val < 0) ? -1 : ((val > 0) ? 1 : 0);
+
+                coefficients[predictor_num] -= sign;
+                val *= sign;
+                error_val -= ((val >> q) * (order - predictor_num));
+                predictor_num--;
+            }
+        }
+        else if (error_val < 0)
+        {
+            while ((predictor_num >= 0) && (error_val < 0))
+            {
+                int val = base - window[order - predictor_num];
+                int sign = (val < 0) ? 1 : ((val > 0) ? -1 : 0);
+
+                coefficients[predictor_num] -= sign;
+                val *= sign;
+                error_val -= ((val >> q) * (order - predictor_num));
+                predictor_num--;
+            }
+        }
+    }
+}
+
+int alac_encode_packet(const int16_t * frames, int n, uint8_t * packet)
+{
+    static const int16_t coefficients[ALAC_ENCODER_PREDICTOR_ORDER] = {
+        1 << ALAC_ENCODER_QUANTISATION, 0, 0, 0 }; // start by predicting the previous sample
+    int32_t mid[ALAC_ENCODER_FRAMES_PER_PACKET], side[ALAC_ENCODER_FRAMES_PER_PACKET];
+    int32_t residuals[2][ALAC_ENCODER_FRAMES_PER_PACKET];
+    alac_encoder_bits b = { packet, 0 };
+    int i, c;
+
+    // mid/side with an interlacing shift and left weight of 1 -- see deinterlace_16()
+    for (i = 0; i < n; i++)
+    {
+        side[i] = frames[i * 2] - frames[i * 2 + 1];
+        mid[i] = frames[i * 2 + 1] + (side[i] >> 1);
+    }
+
+    alac_encoder_residuals(mid, residuals[0], n, coefficients);
+    alac_encoder_residuals(side, residuals[1], n, coefficients);
+
+    memset(packet, 0, ALAC_ENCODER_MAXIMUM_PACKET);
+    alac_encoder_put_bits(&b, 1, 3);  // a channel pair element
+    alac_encoder_put_bits(&b, 0, 4);  // its instance
+    alac_encoder_put_bits(&b, 0, 12); // unused
+    alac_encoder_put_bits(&b, 0, 1);  // no frame count -- it's the fmtp's
+    alac_encoder_put_bits(&b, 0, 2);  // no uncompressed low bytes
+    alac_encoder_put_bits(&b, 0, 1);  // compressed
+    alac_encoder_put_bits(&b, 1, 8);  // interlacing shift
+    alac_encoder_put_bits(&b, 1, 8);  // interlacing left weight
+
+    for (c = 0; c < 2; c++)
+    {
+        alac_encoder_put_bits(&b, 0, 4); // adaptive FIR prediction
+        alac_encoder_put_bits(&b, ALAC_ENCODER_QUANTISATION, 4);
+        alac_encoder_put_bits(&b, ALAC_ENCODER_RICE_MODIFIER, 3);
+        alac_encoder_put_bits(&b, ALAC_ENCODER_PREDICTOR_ORDER, 5);
+
+        for (i = 0; i < ALAC_ENCODER_PREDICTOR_ORDER; i++)
+            alac_encoder_put_bits(&b, (uint16_t)coefficients[i], 16);
+    }
+
+    for (c = 0; c < 2; c++)
+        alac_encoder_rice_encode(&b, residuals[c], n);
+
+    alac_encoder_put_bits(&b, 7, 3); // the end of the frame
+    return (b.bit + 7) / 8;
+}
+
+alac_file * alac_encoder_create_decoder(void)
+{
+    alac_file * alac = alac_create(16, 2);
+
+    if (alac == NULL) return NULL;
+
+    alac->setinfo_max_samples_per_frame = ALAC_ENCODER_FRAMES_PER_PACKET;
+    alac->setinfo_7a = alac_encoder_fmtp[2];
+    alac->setinfo_sample_size = 16;
+    alac->setinfo_rice_historymult = alac_encoder_fmtp[4];
+    alac->setinfo_rice_initialhistory = alac_encoder_fmtp[5];
+    alac->setinfo_rice_kmodifier = alac_encoder_fmtp[6];
+    alac->setinfo_7f = alac_encoder_fmtp[7];
+    alac->setinfo_80 = alac_encoder_fmtp[8];
+    alac->setinfo_82 = alac_encoder_fmtp[9];
+    alac->setinfo_86 = alac_encoder_fmtp[10];
+    alac->setinfo_8a_rate = alac_encoder_fmtp[11];
+    alac_allocate_buffers(alac);
+    return alac;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "alac.h"
+
+// A minimal ALAC encoder, to make realistic input for the decoders -- see alac_encoder.c.
+// Its packets are 16-bit stereo, with the parameters AirPlay senders use.
+
+#define ALAC_ENCODER_FRAMES_PER_PACKET 352
+#define ALAC_ENCODER_MAXIMUM_PACKET (ALAC_ENCODER_FRAMES_PER_PACKET * 4 * 2) // room for an escaped packet
+
+extern int32_t alac_encoder_fmtp[12]; // the fmtp of the packets, e.g. for apple_alac_init()
+
+// encode n interleaved frames, no more than ALAC_ENCODER_FRAMES_PER_PACKET, into packet, which
+// must hold ALAC_ENCODER_MAXIMUM_PACKET bytes. Returns the packet's length.
+int alac_encode_packet(const int16_t * frames, int n, uint8_t * packet);
+
+// a decoder set up for the encoder's packets, or NULL if there's no memory -- alac_free() it
+alac_file * alac_encoder_create_decoder(void);
@@ -24,6 +24,7 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <new>
 #include <string.h>
 
 // these are headers for the ALAC decoder, utilities and endian utilities
@@ -39,46 +40,52 @@ typedef struct magicCookie {
   ALACAudioChannelLayout channelLayoutInfo; // seems to be unused
 } magicCookie;
 
-magicCookie cookie;
-ALACDecoder *theDecoder;
+// ALACDecoder::Init() allocates the decoder's mix, predictor and shift buffers, sized for the
+// frame length, so they're made once here and Decode() uses them without allocating
+struct apple_alac {
+  magicCookie cookie;
+  ALACDecoder decoder;
+  BitBuffer input; // pointed at each packet in turn
+};
 
-extern "C" int apple_alac_init(int32_t fmtp[12]) {
+extern "C" apple_alac *apple_alac_create(int32_t fmtp[12]) {
+  apple_alac *d = new (std::nothrow) apple_alac;
+  if (d == NULL)
+    return NULL;
 
-  memset(&cookie, 0, sizeof(magicCookie));
+  memset(&d->cookie, 0, sizeof(magicCookie));
 
   // create a magic cookie for the decoder from the fmtp information. It seems to be in the same
   // format as a simple magic cookie
 
-  cookie.config.frameLength = Swap32NtoB(352);
-  cookie.config.compatibleVersion = fmtp[2];         // should be zero, uint8_t
-  cookie.config.bitDepth = fmtp[3];                  // uint8_t expected to be 16
-  cookie.config.pb = fmtp[4];                        // uint8_t should be 40;
-  cookie.config.mb = fmtp[5];                        // uint8_t should be 10;
-  cookie.config.kb = fmtp[6];                        // uint8_t should be 14;
-  cookie.config.numChannels = fmtp[7];               // uint8_t expected to be 2
-  cookie.config.maxRun = Swap16NtoB(fmtp[8]);        // uint16_t expected to be 255
-  cookie.config.maxFrameBytes = Swap32NtoB(fmtp[9]); // uint32_t should be 0;
-  cookie.config.avgBitRate = Swap32NtoB(fmtp[10]);   // uint32_t should be 0;;
-  cookie.config.sampleRate = Swap32NtoB(fmtp[11]);   // uint32_t expected to be 44100;
+  d->cookie.config.frameLength = Swap32NtoB(352);
+  d->cookie.config.compatibleVersion = fmtp[2];         // should be zero, uint8_t
+  d->cookie.config.bitDepth = fmtp[3];                  // uint8_t expected to be 16
+  d->cookie.config.pb = fmtp[4];                        // uint8_t should be 40;
+  d->cookie.config.mb = fmtp[5];                        // uint8_t should be 10;
+  d->cookie.config.kb = fmtp[6];                        // uint8_t should be 14;
+  d->cookie.config.numChannels = fmtp[7];               // uint8_t expected to be 2
+  d->cookie.config.maxRun = Swap16NtoB(fmtp[8]);        // uint16_t expected to be 255
+  d->cookie.config.maxFrameBytes = Swap32NtoB(fmtp[9]); // uint32_t should be 0;
+  d->cookie.config.avgBitRate = Swap32NtoB(fmtp[10]);   // uint32_t should be 0;;
+  d->cookie.config.sampleRate = Swap32NtoB(fmtp[11]);   // uint32_t expected to be 44100;
 
-  theDecoder = new ALACDecoder;
-  theDecoder->Init(&cookie, sizeof(magicCookie));
+  if (d->decoder.Init(&d->cookie, sizeof(magicCookie)) != ALAC_noErr) {
+    delete d;
+    return NULL;
+  }
 
-  return 0;
+  return d;
 }
 
-extern "C" int apple_alac_decode_frame(unsigned char *sampleBuffer, uint32_t bufferLength,
-                                       unsigned char *dest, int *outsize) {
+extern "C" int apple_alac_decode(apple_alac *d, unsigned char *sampleBuffer,
+                                 uint32_t bufferLength, unsigned char *dest, int *outsize) {
   uint32_t numFrames = 0;
-  BitBuffer theInputBuffer;
-  BitBufferInit(&theInputBuffer, sampleBuffer, bufferLength);
-  theDecoder->Decode(&theInputBuffer, dest, Swap32BtoN(cookie.config.frameLength),
-                     cookie.config.numChannels, &numFrames);
+  BitBufferInit(&d->input, sampleBuffer, bufferLength);
+  int32_t status = d->decoder.Decode(&d->input, dest, Swap32BtoN(d->cookie.config.frameLength),
+                                     d->cookie.config.numChannels, &numFrames);
   *outsize = numFrames;
-  return 0;
+  return status;
 }
 
-extern "C" int apple_alac_terminate() {
-  delete (theDecoder);
-  return 0;
-}
+extern "C" void apple_alac_destroy(apple_alac *d) { delete d; }
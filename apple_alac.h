@@ -35,10 +35,16 @@
 #define EXTERNC
 #endif
 
-EXTERNC int apple_alac_init(int32_t fmtp[12]);
-EXTERNC int apple_alac_terminate();
-EXTERNC int apple_alac_decode_frame(unsigned char * sampleBuffer, uint32_t bufferLength,
-                                    unsigned char * dest, int * outsize);
+// a decoder for one session -- everything it needs to decode is allocated when it's created, so
+// that decoding allocates nothing, and separate sessions can decode at the same time
+typedef struct apple_alac apple_alac;
+
+// returns NULL if the decoder can't be made for the stream described by the fmtp
+EXTERNC apple_alac * apple_alac_create(int32_t fmtp[12]);
+EXTERNC void apple_alac_destroy(apple_alac * decoder);
+// outsize is set to the number of frames decoded
+EXTERNC int apple_alac_decode(apple_alac * decoder, unsigned char * sampleBuffer,
+                              uint32_t bufferLength, unsigned char * dest, int * outsize);
 
 #undef EXTERNC
 
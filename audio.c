@@ -28,8 +28,11 @@
 #include "audio.h"
 #include "common.h"
 #include "config.h"
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 
 #ifdef CONFIG_JACK
 extern audio_output audio_jack;
@@ -46,18 +49,27 @@ extern audio_output audio_soundio;
 #ifdef CONFIG_PA
 extern audio_output audio_pa;
 #endif
+#ifdef CONFIG_PW
+extern audio_output audio_pw;
+#endif
 #ifdef CONFIG_ALSA
 extern audio_output audio_alsa;
 #endif
 #ifdef CONFIG_DUMMY
 extern audio_output audio_dummy;
 #endif
+#ifdef CONFIG_FANOUT
+extern audio_output audio_fanout;
+#endif
 #ifdef CONFIG_PIPE
 extern audio_output audio_pipe;
 #endif
 #ifdef CONFIG_STDOUT
 extern audio_output audio_stdout;
 #endif
+#ifdef CONFIG_SHM
+extern audio_output audio_shm;
+#endif
 
 static audio_output * outputs[] = {
 #ifdef CONFIG_ALSA
@@ -66,6 +78,9 @@ static audio_output * outputs[] = {
 #ifdef CONFIG_SNDIO
     &audio_sndio,
 #endif
+#ifdef CONFIG_PW
+    &audio_pw,
+#endif
 #ifdef CONFIG_PA
     &audio_pa,
 #endif
@@ -84,8 +99,14 @@ static audio_output * outputs[] = {
 #ifdef CONFIG_STDOUT
     &audio_stdout,
 #endif
+#ifdef CONFIG_SHM
+    &audio_shm,
+#endif
 #ifdef CONFIG_DUMMY
     &audio_dummy,
+#endif
+#ifdef CONFIG_FANOUT
+    &audio_fanout,
 #endif
     NULL
 };
@@ -142,6 +163,29 @@ void parse_general_audio_options(void)
 
     if (config.cfg != NULL)
     {
+        /* Get the latency profile. It changes the back end's defaults, so it comes first, and
+         * any of the settings below can still override it */
+        if (config_lookup_string(config.cfg, "general.latency_profile", &str))
+        {
+            if (strcasecmp(str, "standard") == 0) config.latency_profile = LP_standard;
+            else if (strcasecmp(str, "low") == 0) config.latency_profile = LP_low;
+            else die("Invalid latency_profile option choice \"%s\". It should be \"standard\" or \"low\"",
+                     str);
+        }
+
+        if (config.latency_profile == LP_low)
+        {
+            // keep just enough in the output buffer to ride out scheduling delays on a quiet system
+            if (config.audio_backend_buffer_desired_length > 0.050)
+                config.audio_backend_buffer_desired_length = 0.050;
+
+            if (config.audio_backend_buffer_interpolation_threshold_in_seconds > 0.030)
+                config.audio_backend_buffer_interpolation_threshold_in_seconds = 0.030;
+
+            if (config.disable_standby_mode_silence_threshold > 0.020)
+                config.disable_standby_mode_silence_threshold = 0.020;
+        }
+
         /* Get the desired buffer size setting (deprecated). */
         if (config_lookup_int(config.cfg, "general.audio_backend_buffer_desired_length", &value))
         {
@@ -269,3 +313,263 @@ void parse_general_audio_options(void)
         }
     }
 }
+
+// the measurement, as in the ALSA backend, is of the frames played between the first and the latest
+// sample, and it starts once two seconds of frames have been sent
+static audio_output * measured_output = NULL;
+static audio_output rate_measuring_output;
+static uint64_t rm_frames_sent_for_playing;
+static uint64_t rm_play_count;
+static int rm_measurement_data_is_valid;
+static uint64_t rm_measurement_start_time;
+static uint64_t rm_frames_played_at_measurement_start_time;
+static uint64_t rm_measurement_time;
+static uint64_t rm_frames_played_at_measurement_time;
+
+static void rate_measurement_reset(void)
+{
+    rm_frames_sent_for_playing = 0;
+    rm_play_count = 0;
+    rm_measurement_data_is_valid = 0;
+}
+
+static void rate_measurement_note_frames(int samples)
+{
+    rm_frames_sent_for_playing += samples;
+    rm_play_count++;
+
+    if (((rm_measurement_data_is_valid == 0) && (rm_frames_sent_for_playing >= (uint64_t)(2 * config.output_rate))) ||
+        ((rm_measurement_data_is_valid != 0) && (rm_play_count % 32 == 0)))
+    {
+        long the_delay;
+
+        // the delay includes the frames just sent
+        if ((measured_output->delay(&the_delay) == 0) && (the_delay >= 0) &&
+            ((uint64_t)the_delay <= rm_frames_sent_for_playing))
+        {
+            rm_measurement_time = get_absolute_time_in_ns();
+            rm_frames_played_at_measurement_time = rm_frames_sent_for_playing - the_delay;
+
+            if (rm_measurement_data_is_valid == 0)
+            {
+                rm_measurement_start_time = rm_measurement_time;
+                rm_frames_played_at_measurement_start_time = rm_frames_played_at_measurement_time;
+                rm_measurement_data_is_valid = 1;
+            }
+        }
+    }
+}
+
+static void rate_measuring_start(int sample_rate, int sample_format)
+{
+    rate_measurement_reset();
+    measured_output->start(sample_rate, sample_format);
+}
+
+static int rate_measuring_play(void * buf, int samples)
+{
+    int response = measured_output->play(buf, samples);
+
+    if (response == 0) rate_measurement_note_frames(samples);
+
+    return response;
+}
+
+static int rate_measuring_commit_buffer(int samples)
+{
+    int response = measured_output->commit_buffer(samples);
+
+    if ((response == 0) && (samples != 0)) rate_measurement_note_frames(samples);
+
+    return response;
+}
+
+static void rate_measuring_flush(void)
+{
+    measured_output->flush();
+    rate_measurement_reset();
+}
+
+static void rate_measuring_stop(void)
+{
+    measured_output->stop();
+    rate_measurement_reset();
+}
+
+static int rate_measuring_rate_info(uint64_t * elapsed_time, uint64_t * frames_played)
+{
+    // elapsed_time is in nanoseconds
+    if ((rm_measurement_data_is_valid == 0) || (rm_measurement_time == rm_measurement_start_time))
+    {
+        *elapsed_time = 0;
+        *frames_played = 0;
+        return -1;
+    }
+
+    *elapsed_time = rm_measurement_time - rm_measurement_start_time;
+    *frames_played = rm_frames_played_at_measurement_time - rm_frames_played_at_measurement_start_time;
+    return 0;
+}
+
+audio_output * audio_output_with_rate_measurement(audio_output * output)
+{
+    if ((output->rate_info != NULL) || (output->delay == NULL)) return output;
+
+    measured_output = output;
+    rate_measuring_output = *output;
+    rate_measuring_output.start = &rate_measuring_start;
+    rate_measuring_output.play = &rate_measuring_play;
+
+    if (output->commit_buffer) rate_measuring_output.commit_buffer = &rate_measuring_commit_buffer;
+
+    if (output->flush) rate_measuring_output.flush = &rate_measuring_flush;
+
+    if (output->stop) rate_measuring_output.stop = &rate_measuring_stop;
+    rate_measuring_output.rate_info = &rate_measuring_rate_info;
+    rate_measurement_reset();
+    debug(1, "the output rate of the \"%s\" backend is measured from its delay.", output->name);
+    return &rate_measuring_output;
+}
+
+void audio_aggregator_init(audio_aggregator * aggregator, const char * stanza)
+{
+    int value;
+    double dvalue;
+    char setting[64];
+
+    aggregator->buffer = NULL;
+    aggregator->used = 0;
+    aggregator->threshold = 0;
+    aggregator->maximum_hold_time = 20000000; // 20 milliseconds
+    aggregator->first_time = 0;
+
+    if (config.cfg != NULL)
+    {
+        snprintf(setting, sizeof(setting), "%s.aggregation_bytes", stanza);
+
+        if (config_lookup_int(config.cfg, setting, &value))
+        {
+            if (value < 0) warn("Invalid %s setting \"%d\". It must not be negative -- no aggregation is done.",
+                                setting, value);
+            else aggregator->threshold = value;
+        }
+
+        snprintf(setting, sizeof(setting), "%s.aggregation_time", stanza);
+
+        if (config_lookup_float(config.cfg, setting, &dvalue))
+        {
+            if (dvalue < 0) warn("Invalid %s setting \"%f\". It must not be negative. The default of %f "
+                                 "seconds is used instead.", setting, dvalue,
+                                 aggregator->maximum_hold_time * 0.000000001);
+            else aggregator->maximum_hold_time = (uint64_t)(dvalue * 1000000000);
+        }
+    }
+
+    if (aggregator->threshold != 0)
+    {
+        aggregator->buffer = malloc(aggregator->threshold);
+
+        if (aggregator->buffer == NULL) die("Can't allocate an output aggregation buffer of %zu bytes.",
+                                            aggregator->threshold);
+
+        debug(1, "%s: output is aggregated into writes of %zu bytes, held for no longer than %f seconds.",
+              stanza, aggregator->threshold, aggregator->maximum_hold_time * 0.000000001);
+    }
+}
+
+static ssize_t writev_fully(int fd, struct iovec * iov, int iovcnt)
+{
+    ssize_t total = 0;
+
+    while (iovcnt > 0)
+    {
+        ssize_t rc = writev(fd, iov, iovcnt);
+
+        if (rc < 0)
+        {
+            if (errno == EINTR) continue;
+
+            return rc;
+        }
+
+        total += rc;
+
+        // step over what has been written
+        while ((iovcnt > 0) && ((size_t)rc >= iov->iov_len))
+        {
+            rc -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + rc;
+            iov->iov_len -= rc;
+        }
+    }
+
+    return total;
+}
+
+ssize_t audio_aggregator_write(audio_aggregator * aggregator, int fd, const void * buf, size_t size)
+{
+    if (aggregator->buffer == NULL) return write(fd, buf, size);
+
+    uint64_t time_now = get_absolute_time_in_ns();
+
+    if (aggregator->used == 0) aggregator->first_time = time_now;
+
+    if ((aggregator->used + size < aggregator->threshold) &&
+        (time_now - aggregator->first_time < aggregator->maximum_hold_time))
+    {
+        memcpy(aggregator->buffer + aggregator->used, buf, size);
+        aggregator->used += size;
+        return 0;
+    }
+
+    // write what's held together with this, which doesn't have to be copied
+    struct iovec iov[2];
+    int iovcnt = 0;
+
+    if (aggregator->used != 0)
+    {
+        iov[iovcnt].iov_base = aggregator->buffer;
+        iov[iovcnt].iov_len = aggregator->used;
+        iovcnt++;
+    }
+
+    iov[iovcnt].iov_base = (void *)buf;
+    iov[iovcnt].iov_len = size;
+    iovcnt++;
+    aggregator->used = 0;
+    return writev_fully(fd, iov, iovcnt);
+}
+
+ssize_t audio_aggregator_flush(audio_aggregator * aggregator, int fd)
+{
+    ssize_t rc = 0;
+
+    if ((aggregator->buffer != NULL) && (aggregator->used != 0))
+    {
+        struct iovec iov;
+        iov.iov_base = aggregator->buffer;
+        iov.iov_len = aggregator->used;
+        aggregator->used = 0;
+        rc = writev_fully(fd, &iov, 1);
+    }
+
+    return rc;
+}
+
+void audio_aggregator_discard(audio_aggregator * aggregator)
+{
+    aggregator->used = 0;
+}
+
+void audio_aggregator_free(audio_aggregator * aggregator)
+{
+    free(aggregator->buffer);
+    aggregator->buffer = NULL;
+    aggregator->used = 0;
+}
@@ -3,6 +3,7 @@
 
 #include <libconfig.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 typedef struct
 {
@@ -11,7 +12,7 @@ typedef struct
     int32_t maximum_volume_dB;
 } audio_parameters;
 
-typedef struct
+typedef struct audio_output
 {
     void (* help)(void);
     char * name;
@@ -27,6 +28,12 @@ typedef struct
 
     // block of samples
     int (* play)(void * buf, int samples);
+    // may be NULL. Otherwise, get_buffer offers a region of the output device's own buffer big
+    // enough for "samples" frames, in the output format, so that they can be written there directly
+    // rather than passed to play(). It returns 0 if it has, and then commit_buffer must be called,
+    // with the number of frames actually written (which may be 0), before anything else is called
+    int (* get_buffer)(void ** buf, int samples);
+    int (* commit_buffer)(int samples);
     void (* stop)(void);
 
     // may be null if no implemented
@@ -41,8 +48,10 @@ typedef struct
     // will change dynamically, so keep watching it. Implemented in ALSA only.
     // returns a negative error code if there's a problem
     int (* delay)(long * the_delay); // snd_pcm_sframes_t is a signed long
+    // may be NULL. Otherwise, use this to get the true rate of the DAC. If it's NULL and delay()
+    // isn't, audio_output_with_rate_measurement() supplies one
     int (* rate_info)(uint64_t * elapsed_time,
-                      uint64_t * frames_played); // use this to get the true rate of the DAC
+                      uint64_t * frames_played);
 
     // may be NULL, in which case soft volume is applied
     void (* volume)(double vol);
@@ -53,10 +62,54 @@ typedef struct
     // may be NULL, in which case software muting is used.
     // also, will return a 1 if it is actually using the mute facility, 0 otherwise
     int (* mute)(int do_mute);
+
+    // may be NULL. Otherwise, it's called just before each packet is passed to play() or
+    // commit_buffer(), with the RTP timestamp of the packet's first frame and the local time, in
+    // nanoseconds from get_absolute_time_in_ns(), at which that frame is due to be heard. If
+    // is_silence is set, the packet is silence standing in for a missing packet, and the timestamp
+    // and time mean nothing -- a timestamp of 0 is as valid as any other.
+    void (* timing)(uint32_t rtp_timestamp, uint64_t play_time, int is_silence);
+
+    // may be NULL. Otherwise, it makes another instance of the backend, with state of its own,
+    // reading its settings from the named section of the configuration file instead of the
+    // backend's own, so that another zone can use it. Its init() must be called before anything
+    // else. It returns NULL if no more instances can be made
+    struct audio_output * (* new_instance)(const char * section);
+
+    // may be NULL. Otherwise, it gives the output format and rate the backend is using -- which
+    // prepare() may have chosen -- so that they needn't be left in config
+    void (* output_format)(int * format, unsigned int * rate);
 } audio_output;
 
 audio_output * audio_get_output(const char * name);
 void audio_ls_outputs(void);
 void parse_general_audio_options(void);
 
+// If the output has a delay() but no rate_info() of its own, this returns a copy of it whose
+// play(), commit_buffer(), start(), flush() and stop() also keep count of the frames sent and,
+// from time to time, subtract the delay to get the frames played, so that rate_info() can be
+// offered. Otherwise it returns the output itself. Call it once the output has been initialised.
+audio_output * audio_output_with_rate_measurement(audio_output * output);
+
+// An aggregator collects the player's small writes -- a packet at a time -- so that a back end
+// writing to a file descriptor can pass them on with one writev() when enough bytes have
+// accumulated or when the oldest has been held for as long as it may be.
+typedef struct
+{
+    char * buffer;              // NULL if not aggregating
+    size_t used;
+    size_t threshold;           // bytes
+    uint64_t maximum_hold_time; // nanoseconds
+    uint64_t first_time;        // when what's held started accumulating
+} audio_aggregator;
+
+// set it up from the aggregation_bytes and aggregation_time settings in the stanza, if given
+void audio_aggregator_init(audio_aggregator * aggregator, const char * stanza);
+// hold or write size bytes, returning the number of bytes written, or -1 with errno set
+ssize_t audio_aggregator_write(audio_aggregator * aggregator, int fd, const void * buf, size_t size);
+// write anything held, e.g. at the end of play
+ssize_t audio_aggregator_flush(audio_aggregator * aggregator, int fd);
+void audio_aggregator_discard(audio_aggregator * aggregator);
+void audio_aggregator_free(audio_aggregator * aggregator);
+
 #endif //_AUDIO_H
@@ -28,9 +28,12 @@
 #define ALSA_PCM_NEW_HW_PARAMS_API
 
 #include <alsa/asoundlib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
 #include <memory.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -40,13 +43,16 @@
 #include "activity_monitor.h"
 #include "audio.h"
 #include "common.h"
+#include "process_block.h"
+#include "silence.h"
+#include "zone.h"
 
 enum alsa_backend_mode
 {
     abm_disconnected,
     abm_connected,
     abm_playing
-} alsa_backend_state; // under the control of alsa_mutex
+};
 
 typedef struct
 {
@@ -54,122 +60,319 @@ typedef struct
     int frame_size;
 } format_record;
 
-static void help(void);
-static int init(int argc, char * * argv);
-static void deinit(void);
-static void start(int i_sample_rate, int i_sample_format);
-static int play(void * buf, int samples);
-static void stop(void);
-static void flush(void);
-int delay(long * the_delay);
-int get_rate_information(uint64_t * elapsed_time, uint64_t * frames_played);
-void * alsa_buffer_monitor_thread_code(void * arg);
+// prepare() opens the device ahead of play, maybe as soon as a session is announced, so the buffer
+// monitor leaves it open for this long afterwards even if the DAC isn't to be kept busy
+#define ALSA_PREPARED_HOLD_TIME ((uint64_t)5000000000) // nanoseconds
+
+// the buffer monitor's silence, made when it's first needed and remade only if the output
+// format or the need for dither changes. It's played ALSA_MONITOR_SILENCE_FRAMES at a time
+// from a pool a few times bigger, so the dither doesn't repeat too quickly
+#define ALSA_MONITOR_SILENCE_FRAMES 1024
+#define ALSA_MONITOR_SILENCE_POOL_FRAMES (ALSA_MONITOR_SILENCE_FRAMES * 4)
+
+// The player doesn't write to the device itself. play() -- or get_buffer() and commit_buffer() --
+// put frames into a single-producer single-consumer ring, and the writer thread,
+// alsa_buffer_monitor_thread_code(), takes them out and writes them to the device as it makes
+// room, polling the device's descriptors. The writer thread owns the device -- it alone opens,
+// writes, recovers and closes it, and prepare() and flush() are requests to it -- so a device
+// that misbehaves can hold up the writer thread but not the player.
+// The head and tail count frames from the start and are only advanced by the player and the
+// writer thread respectively, so the fill is head - tail.
+#define ALSA_RING_FRAMES 16384 // must be a power of two
+#define ALSA_RING_MAXIMUM_FRAME_SIZE 8 // 32-bit stereo
+
+// the writer thread waits on the device's poll descriptors, if it's waiting for room, and on the
+// read end of this pipe, which is written to to wake it
+#define ALSA_WRITER_MAXIMUM_POLL_DESCRIPTORS 8
+// otherwise it waits until it's next needed -- to top up the silence, to close the device or to
+// check for a change in the keep_dac_busy setting -- but no longer than this
+#define ALSA_WRITER_MAXIMUM_WAIT_TIME ((uint64_t)250000000) // nanoseconds
+
+// the writer thread publishes the device's delay after everything it does, and delay() works from
+// that rather than asking the device. The sequence number is odd while it's being updated
+typedef struct
+{
+    uint64_t time;           // when the delay was measured
+    snd_pcm_sframes_t delay; // the device's delay then -- zero if it wasn't running
+    uint64_t ring_tail;      // the ring's tail then -- frames put in the ring since are in addition
+    int status;              // what delay_and_status() returned, or ENODEV if the device wasn't open
+} alsa_delay_snapshot;
 
-static void volume(double vol);
-void do_volume(double vol);
-int prepare(void);
-int do_play(void * buf, int samples);
-
-static void parameters(audio_parameters * info);
-int mute(int do_mute); // returns true if it actually is allowed to use the mute
-static double set_volume;
-static int output_method_signalled = 0; // for reporting whether it's using mmap or not
-int delay_type_notified = -1; // for controlling the reporting of whether the output device can do
-                              // precision delays (e.g. alsa->pulsaudio virtual devices can't)
-int use_monotonic_clock = 0;  // this value will be set when the hardware is initialised
-
-audio_output audio_alsa = {
-    .name       = "alsa",
-    .help       = &help,
-    .init       = &init,
-    .deinit     = &deinit,
-    .prepare    = &prepare,
-    .start      = &start,
-    .stop       = &stop,
-    .is_running = NULL,
-    .flush      = &flush,
-    .delay      = &delay,
-    .play       = &play,
-    .rate_info  = &get_rate_information,
-    .mute       = NULL,  // a function will be provided if it can, and is allowed to,
-                         // do hardware mute
-    .volume     = NULL,  // a function will be provided if it can do hardware volume
-    .parameters = NULL
-};                       // a function will be provided if it can do hardware volume
-
-static pthread_mutex_t alsa_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t alsa_mixer_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-pthread_t alsa_buffer_monitor_thread;
-
-// for deciding when to activate mute
-// there are two sources of requests to mute -- the backend itself, e.g. when it
-// is flushing
-// and the player, e.g. when volume goes down to -144, i.e. mute.
-
-// we may not be allowed to use hardware mute, so we must reflect that too.
-
-int mute_requested_externally = 0;
-int mute_requested_internally = 0;
-
-// for tracking how long the output device has stalled
-uint64_t stall_monitor_start_time;      // zero if not initialised / not started /
-                                // zeroed by flush
-long stall_monitor_frame_count; // set to delay at start of time, incremented by
-                                // any writes
-uint64_t stall_monitor_error_threshold; // if the time is longer than this, it's
-                                // an error
+// Each instance drives one device for one zone. The first is audio_alsa, reading its settings
+// from the "alsa" stanza; new_instance() makes others, each reading its settings from a stanza
+// of its own, for other zones. An instance's device, ring, writer thread and settings are its own.
+// There can be one for each zone, and ALSA_INSTANCE_LIST names them all.
+#define ALSA_MAXIMUM_INSTANCES ZONE_MAXIMUM
 
-static snd_output_t * output = NULL;
-int frame_size; // in bytes for interleaved stereo
+#if ALSA_MAXIMUM_INSTANCES != 16
+#error "ALSA_INSTANCE_LIST must name one instance for each zone."
+#endif
+
+#define ALSA_INSTANCE_LIST(X)                                                                      \
+    X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(9) X(10) X(11) X(12) X(13) X(14) X(15)
 
-int alsa_device_initialised; // boolean to ensure the initialisation is only
-                                // done once
+typedef struct alsa_instance alsa_instance;
+
+struct alsa_instance
+{
+    int index;              // 0 for audio_alsa
+    const char * stanza;    // where its settings are read from
+    char setting[96];       // for alsa_setting()
+    audio_output * backend; // the audio_output the player is given for it
+
+    // its settings -- what init() left in config -- so that playing doesn't depend on config,
+    // which has the first zone's
+    sps_format_t output_format;
+    int output_format_auto_requested;
+    unsigned int output_rate;
+    int output_rate_auto_requested;
+    int no_sync;
+    int no_mmap;
+    int alsa_use_hardware_mute;
+    double alsa_maximum_stall_time;
+    disable_standby_mode_type disable_standby_mode;
+    double disable_standby_mode_silence_threshold;
+    double disable_standby_mode_silence_scan_interval;
+    yna_type use_precision_timing;
+    double buffer_desired_length;
+    int keep_dac_busy;  // for instances other than the first, which follows config.keep_dac_busy
+    int session_active; // between start() and stop(), for a disable_standby_mode of "auto"
+
+    enum alsa_backend_mode alsa_backend_state; // changed only by the writer thread
+    double set_volume;
+    int output_method_signalled; // for reporting whether it's using mmap or not
+    int delay_type_notified; // for controlling the reporting of whether the output device can do
+                             // precision delays (e.g. alsa->pulsaudio virtual devices can't)
+    int use_monotonic_clock; // this value will be set when the hardware is initialised
+
+    pthread_mutex_t alsa_mixer_mutex;
+
+    pthread_t alsa_buffer_monitor_thread;
+
+    // for deciding when to activate mute
+    // there are two sources of requests to mute -- the backend itself, e.g. when it
+    // is flushing
+    // and the player, e.g. when volume goes down to -144, i.e. mute.
+
+    // we may not be allowed to use hardware mute, so we must reflect that too.
+
+    int mute_requested_externally;
+    int mute_requested_internally;
+
+    // for tracking how long the output device has stalled
+    uint64_t stall_monitor_start_time;      // zero if not initialised / not started /
+                                            // zeroed by flush
+    long stall_monitor_frame_count;         // set to delay at start of time, incremented by
+                                            // any writes
+    uint64_t stall_monitor_error_threshold; // if the time is longer than this, it's
+                                            // an error
+
+    int frame_size; // in bytes for interleaved stereo
+
+    int alsa_device_initialised; // boolean to ensure the initialisation is only
+                                 // done once
+
+    uint64_t alsa_prepared_time; // when prepare() was last called, or zero
+
+    yndk_type precision_delay_available_status; // initially, we don't know if the device can do
+                                                // precision delay
+
+    snd_pcm_t * alsa_handle;
+    snd_ctl_t * ctl;
+    snd_ctl_elem_id_t * elem_id;
+    snd_mixer_t * alsa_mix_handle;
+    snd_mixer_elem_t * alsa_mix_elem;
+    long alsa_mix_minv, alsa_mix_maxv;
+    long alsa_mix_mindb, alsa_mix_maxdb;
+
+    char * alsa_out_dev;
+    char * alsa_mix_dev;
+    char * alsa_mix_ctrl;
+    int alsa_mix_index;
+    int has_softvol;
+
+    int64_t dither_random_number_store;
+
+    silence_pool alsa_monitor_silence;
+
+    char * alsa_ring;
+    uint64_t alsa_ring_head;
+    uint64_t alsa_ring_tail;
+
+    int alsa_wake_pipe[2];
+    int alsa_writer_idle; // set while the writer thread is waiting for something to do
+
+    // requests to the writer thread -- each is numbered, and the requester waits until it's done
+    pthread_mutex_t alsa_request_mutex;
+    pthread_cond_t alsa_request_cv;
+    int alsa_flush_requested;
+    int alsa_flush_done;
+    int alsa_prepare_requested;
+    int alsa_prepare_done;
+    int alsa_prepare_result;
+
+    alsa_delay_snapshot alsa_snapshot;
+    unsigned int alsa_snapshot_sequence;
+
+    int volume_set_request; // set when an external request is made to set the volume.
+
+    int mixer_volume_setting_gives_mute; // set when it is discovered that
+                                         // particular mixer volume setting
+                                         // causes a mute.
+    long alsa_mix_mute;                  // setting the volume to this value mutes output, if
+                                         // mixer_volume_setting_gives_mute is true
+    int volume_based_mute_is_active; // set when muting is being done by a setting the volume to a
+                                     // magic value
 
-yndk_type precision_delay_available_status =
-    YNDK_DONT_KNOW; // initially, we don't know if the device can do precision delay
+    // use this to allow the use of snd_pcm_writei or snd_pcm_mmap_writei
+    snd_pcm_sframes_t (* alsa_pcm_write)(snd_pcm_t *, const void *, snd_pcm_uframes_t);
 
-snd_pcm_t * alsa_handle = NULL;
-static snd_pcm_hw_params_t * alsa_params = NULL;
-static snd_pcm_sw_params_t * alsa_swparams = NULL;
-static snd_ctl_t * ctl = NULL;
-static snd_ctl_elem_id_t * elem_id = NULL;
-static snd_mixer_t * alsa_mix_handle = NULL;
-static snd_mixer_elem_t * alsa_mix_elem = NULL;
-static snd_mixer_selem_id_t * alsa_mix_sid = NULL;
-static long alsa_mix_minv, alsa_mix_maxv;
-static long alsa_mix_mindb, alsa_mix_maxdb;
+    // use this to allow the use of standard or precision delay calculations, with standard the,
+    // uh, standard.
+    int (* delay_and_status)(alsa_instance * a, snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
+                             yndk_type * using_update_timestamps);
 
-static char * alsa_out_dev = "default";
-static char * alsa_mix_dev = NULL;
-static char * alsa_mix_ctrl = NULL;
-static int alsa_mix_index = 0;
-static int has_softvol = 0;
+    int alsa_characteristics_already_listed;
 
-int64_t dither_random_number_store = 0;
+    snd_pcm_uframes_t period_size_requested, buffer_size_requested;
+    int set_period_size_request, set_buffer_size_request;
 
-static int volume_set_request = 0; // set when an external request is made to set the volume.
+    uint64_t measurement_start_time;
+    uint64_t frames_played_at_measurement_start_time;
 
-int mixer_volume_setting_gives_mute = 0; // set when it is discovered that
-                                         // particular mixer volume setting
-                                         // causes a mute.
-long alsa_mix_mute;                      // setting the volume to this value mutes output, if
-                                         // mixer_volume_setting_gives_mute is true
-int volume_based_mute_is_active =
-    0; // set when muting is being done by a setting the volume to a magic value
+    uint64_t measurement_time;
+    uint64_t frames_played_at_measurement_time;
 
-// use this to allow the use of snd_pcm_writei or snd_pcm_mmap_writei
-snd_pcm_sframes_t (* alsa_pcm_write)(snd_pcm_t *, const void *, snd_pcm_uframes_t) = snd_pcm_writei;
+    uint64_t frames_sent_for_playing;
+    uint64_t frame_index;
+    int measurement_data_is_valid;
+};
 
-int precision_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
+static void help(void);
+static int init(alsa_instance * a, int argc, char * * argv);
+static void deinit(alsa_instance * a);
+static void start(alsa_instance * a, int i_sample_rate, int i_sample_format);
+static int play(alsa_instance * a, void * buf, int samples);
+static int get_buffer(alsa_instance * a, void ** buf, int samples);
+static int commit_buffer(alsa_instance * a, int samples);
+static void stop(alsa_instance * a);
+static void flush(alsa_instance * a);
+int delay(alsa_instance * a, long * the_delay);
+int get_rate_information(alsa_instance * a, uint64_t * elapsed_time, uint64_t * frames_played);
+void * alsa_buffer_monitor_thread_code(void * arg);
+
+static void volume(alsa_instance * a, double vol);
+void do_volume(alsa_instance * a, double vol);
+int prepare(alsa_instance * a);
+int do_play(alsa_instance * a, void * buf, int samples);
+
+static void parameters(alsa_instance * a, audio_parameters * info);
+int mute(alsa_instance * a, int do_mute); // returns true if it actually is allowed to use the mute
+static void output_format(alsa_instance * a, int * format, unsigned int * rate);
+static audio_output * new_instance(const char * section);
+
+int precision_delay_and_status(alsa_instance * a, snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
                                yndk_type * using_update_timestamps);
-int standard_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
+int standard_delay_and_status(alsa_instance * a, snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
                               yndk_type * using_update_timestamps);
 
-// use this to allow the use of standard or precision delay calculations, with standard the, uh,
-// standard.
-int (* delay_and_status)(snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
-                         yndk_type * using_update_timestamps) = standard_delay_and_status;
+#define ALSA_INSTANCE_DEFAULTS                                                                     \
+    {                                                                                              \
+        .stanza = "alsa", .delay_type_notified = -1,                                               \
+        .alsa_mixer_mutex = PTHREAD_MUTEX_INITIALIZER,                                             \
+        .precision_delay_available_status = YNDK_DONT_KNOW, .alsa_out_dev = "default",             \
+        .alsa_wake_pipe = { -1, -1 }, .alsa_request_mutex = PTHREAD_MUTEX_INITIALIZER,             \
+        .alsa_request_cv = PTHREAD_COND_INITIALIZER, .alsa_snapshot = { 0, 0, 0, ENODEV },         \
+        .alsa_pcm_write = snd_pcm_writei, .delay_and_status = standard_delay_and_status            \
+    }
+
+static alsa_instance alsa_instances[ALSA_MAXIMUM_INSTANCES] = {
+    [0 ... ALSA_MAXIMUM_INSTANCES - 1] = ALSA_INSTANCE_DEFAULTS
+};
+static int alsa_instance_count = 1;
+static pthread_mutex_t alsa_instance_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// the audio_output interface doesn't pass an instance, so each instance has a set of functions
+// of its own that pass it on
+#define ALSA_INSTANCE_FUNCTIONS(n)                                                                 \
+    static int init_##n(int argc, char * * argv) { return init(&alsa_instances[n], argc, argv); } \
+    static void deinit_##n(void) { deinit(&alsa_instances[n]); }                                   \
+    static int prepare_##n(void) { return prepare(&alsa_instances[n]); }                           \
+    static void start_##n(int sample_rate, int sample_format)                                     \
+    {                                                                                              \
+        start(&alsa_instances[n], sample_rate, sample_format);                                     \
+    }                                                                                              \
+    static int play_##n(void * buf, int samples) { return play(&alsa_instances[n], buf, samples); } \
+    static int get_buffer_##n(void ** buf, int samples)                                           \
+    {                                                                                              \
+        return get_buffer(&alsa_instances[n], buf, samples);                                       \
+    }                                                                                              \
+    static int commit_buffer_##n(int samples) { return commit_buffer(&alsa_instances[n], samples); } \
+    static void stop_##n(void) { stop(&alsa_instances[n]); }                                       \
+    static void flush_##n(void) { flush(&alsa_instances[n]); }                                     \
+    static int delay_##n(long * the_delay) { return delay(&alsa_instances[n], the_delay); }        \
+    static int rate_info_##n(uint64_t * elapsed_time, uint64_t * frames_played)                   \
+    {                                                                                              \
+        return get_rate_information(&alsa_instances[n], elapsed_time, frames_played);              \
+    }                                                                                              \
+    static void volume_##n(double vol) { volume(&alsa_instances[n], vol); }                        \
+    static void parameters_##n(audio_parameters * info) { parameters(&alsa_instances[n], info); } \
+    static int mute_##n(int do_mute) { return mute(&alsa_instances[n], do_mute); }                 \
+    static void output_format_##n(int * format, unsigned int * rate)                              \
+    {                                                                                              \
+        output_format(&alsa_instances[n], format, rate);                                           \
+    }
+
+// the mute, volume and parameters functions are only offered by prepare_mixer(), if the
+// instance can, and is allowed to, use them
+#define ALSA_INSTANCE_OUTPUT(n)                                                                    \
+    {                                                                                              \
+        .name = "alsa", .help = &help, .init = &init_##n, .deinit = &deinit_##n,                   \
+        .prepare = &prepare_##n, .start = &start_##n, .stop = &stop_##n, .is_running = NULL,       \
+        .flush = &flush_##n, .delay = &delay_##n, .play = &play_##n,                               \
+        .get_buffer = &get_buffer_##n, .commit_buffer = &commit_buffer_##n,                        \
+        .rate_info = &rate_info_##n, .mute = NULL, .volume = NULL, .parameters = NULL,             \
+        .new_instance = &new_instance, .output_format = &output_format_##n                         \
+    }
+
+ALSA_INSTANCE_LIST(ALSA_INSTANCE_FUNCTIONS)
+
+audio_output audio_alsa = ALSA_INSTANCE_OUTPUT(0);
+
+// what the player is given for the instances new_instance() makes -- the first's is audio_alsa
+#define ALSA_INSTANCE_OUTPUT_ENTRY(n) ALSA_INSTANCE_OUTPUT(n),
+#define ALSA_INSTANCE_MUTE_ENTRY(n) &mute_##n,
+#define ALSA_INSTANCE_VOLUME_ENTRY(n) &volume_##n,
+#define ALSA_INSTANCE_PARAMETERS_ENTRY(n) &parameters_##n,
+
+static audio_output alsa_instance_outputs[ALSA_MAXIMUM_INSTANCES] = {
+    ALSA_INSTANCE_LIST(ALSA_INSTANCE_OUTPUT_ENTRY)
+};
+
+// the hardware mixer's functions, for prepare_mixer() to offer
+static int (* const alsa_instance_mute[ALSA_MAXIMUM_INSTANCES])(int) = {
+    ALSA_INSTANCE_LIST(ALSA_INSTANCE_MUTE_ENTRY)
+};
+static void (* const alsa_instance_volume[ALSA_MAXIMUM_INSTANCES])(double) = {
+    ALSA_INSTANCE_LIST(ALSA_INSTANCE_VOLUME_ENTRY)
+};
+static void (* const alsa_instance_parameters[ALSA_MAXIMUM_INSTANCES])(audio_parameters *) = {
+    ALSA_INSTANCE_LIST(ALSA_INSTANCE_PARAMETERS_ENTRY)
+};
+
+static snd_output_t * output = NULL;
+
+// instances other than the first keep the DAC busy according to their own disable_standby_mode
+// setting, taking "auto" to mean while a session is playing through them. The first follows
+// config.keep_dac_busy, which the activity monitor and the D-Bus interface also change
+static int alsa_keep_dac_busy(alsa_instance * a)
+{
+    if (a->index == 0) return config.keep_dac_busy;
+
+    if (a->disable_standby_mode == disable_standby_auto) return a->session_active;
+
+    return a->keep_dac_busy;
+}
 
 // this will return true if the DAC can return precision delay information and false if not
 // if it is not yet known, it will test the output device to find out
@@ -179,13 +382,13 @@ int (* delay_and_status)(snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
 // If you want it to check again, set precision_delay_available_status to YNDK_DONT_KNOW
 // first.
 
-int precision_delay_available()
+int precision_delay_available(alsa_instance * a)
 {
-    if (precision_delay_available_status == YNDK_DONT_KNOW)
+    if (a->precision_delay_available_status == YNDK_DONT_KNOW)
     {
         // this is very crude -- if the device is a hardware device, then it's assumed the delay is
         // precise
-        const char * output_device_name = snd_pcm_name(alsa_handle);
+        const char * output_device_name = snd_pcm_name(a->alsa_handle);
         int is_a_real_hardware_device = (strstr(output_device_name, "hw:") == output_device_name);
 
         // The criteria as to whether precision delay is available
@@ -199,7 +402,7 @@ int precision_delay_available()
         // was able to use the (non-zero) update timestamps
 
         int frames_of_silence = 4410;
-        size_t size_of_silence_buffer = frames_of_silence * frame_size;
+        size_t size_of_silence_buffer = frames_of_silence * a->frame_size;
         void * silence = malloc(size_of_silence_buffer);
 
         if (silence == NULL)
@@ -213,20 +416,20 @@ int precision_delay_available()
             pthread_cleanup_push(malloc_cleanup, silence);
             int use_dither = 0;
 
-            if ((alsa_mix_ctrl == NULL) && (config.ignore_volume_control == 0) &&
+            if ((a->alsa_mix_ctrl == NULL) && (config.ignore_volume_control == 0) &&
                 (config.airplay_volume != 0.0)) use_dither = 1;
 
-            dither_random_number_store =
-                generate_zero_frames(silence, frames_of_silence, config.output_format,
+            a->dither_random_number_store =
+                generate_zero_frames(silence, frames_of_silence, a->output_format,
                                      use_dither, // i.e. with dither
-                                     dither_random_number_store);
-            do_play(silence, frames_of_silence);
+                                     a->dither_random_number_store);
+            do_play(a, silence, frames_of_silence);
             pthread_cleanup_pop(1);
             // now we can get the delay, and we'll note if it uses update timestamps
             yndk_type uses_update_timestamps;
             snd_pcm_state_t state;
             snd_pcm_sframes_t delay;
-            int ret = precision_delay_and_status(&state, &delay, &uses_update_timestamps);
+            int ret = precision_delay_and_status(a, &state, &delay, &uses_update_timestamps);
 
             // debug(3,"alsa: precision_delay_available asking for delay and status with a return status
             // of %d, a delay of %ld and a uses_update_timestamps of %d.", ret, delay,
@@ -235,7 +438,7 @@ int precision_delay_available()
             {
                 if ((uses_update_timestamps == YNDK_YES) && (is_a_real_hardware_device))
                 {
-                    precision_delay_available_status = YNDK_YES;
+                    a->precision_delay_available_status = YNDK_YES;
                     debug(2, "alsa: precision delay timing is available.");
                 }
                 else
@@ -250,32 +453,15 @@ int precision_delay_available()
                         debug(2, "alsa: precision delay timing is not available.");
                     }
 
-                    precision_delay_available_status = YNDK_NO;
+                    a->precision_delay_available_status = YNDK_NO;
                 }
             }
         }
     }
 
-    return (precision_delay_available_status == YNDK_YES);
+    return (a->precision_delay_available_status == YNDK_YES);
 }
 
-// static int play_number;
-// static int64_t accumulated_delay, accumulated_da_delay;
-int alsa_characteristics_already_listed = 0;
-
-static snd_pcm_uframes_t period_size_requested, buffer_size_requested;
-static int set_period_size_request, set_buffer_size_request;
-
-static uint64_t measurement_start_time;
-static uint64_t frames_played_at_measurement_start_time;
-
-static uint64_t measurement_time;
-static uint64_t frames_played_at_measurement_time;
-
-static uint64_t frames_sent_for_playing;
-static uint64_t frame_index;
-static int measurement_data_is_valid;
-
 static void help(void)
 {
     printf("    -d output-device    set the output device, default is \"default\".\n"
@@ -289,48 +475,56 @@ static void help(void)
     if (r != 0) debug(2, "error %d executing a script to list alsa hardware device names", r);
 }
 
+// the path of one of the instance's settings, e.g. "alsa.output_device", good until the next call
+static const char * alsa_setting(alsa_instance * a, const char * name)
+{
+    snprintf(a->setting, sizeof(a->setting), "%s.%s", a->stanza, name);
+    return a->setting;
+}
+
 void set_alsa_out_dev(char * dev)
 {
-    alsa_out_dev = dev;
+    alsa_instances[0].alsa_out_dev = dev;
 }
 
 // assuming pthread cancellation is disabled
-int open_mixer()
+int open_mixer(alsa_instance * a)
 {
     int response = 0;
 
-    if (alsa_mix_ctrl != NULL)
+    if (a->alsa_mix_ctrl != NULL)
     {
         debug(3, "Open Mixer");
         int ret = 0;
+        snd_mixer_selem_id_t * alsa_mix_sid;
         snd_mixer_selem_id_alloca(&alsa_mix_sid);
-        snd_mixer_selem_id_set_index(alsa_mix_sid, alsa_mix_index);
-        snd_mixer_selem_id_set_name(alsa_mix_sid, alsa_mix_ctrl);
+        snd_mixer_selem_id_set_index(alsa_mix_sid, a->alsa_mix_index);
+        snd_mixer_selem_id_set_name(alsa_mix_sid, a->alsa_mix_ctrl);
 
-        if ((snd_mixer_open(&alsa_mix_handle, 0)) < 0)
+        if ((snd_mixer_open(&a->alsa_mix_handle, 0)) < 0)
         {
             debug(1, "Failed to open mixer");
             response = -1;
         }
         else
         {
-            debug(3, "Mixer device name is \"%s\".", alsa_mix_dev);
+            debug(3, "Mixer device name is \"%s\".", a->alsa_mix_dev);
 
-            if ((snd_mixer_attach(alsa_mix_handle, alsa_mix_dev)) < 0)
+            if ((snd_mixer_attach(a->alsa_mix_handle, a->alsa_mix_dev)) < 0)
             {
                 debug(1, "Failed to attach mixer");
                 response = -2;
             }
             else
             {
-                if ((snd_mixer_selem_register(alsa_mix_handle, NULL, NULL)) < 0)
+                if ((snd_mixer_selem_register(a->alsa_mix_handle, NULL, NULL)) < 0)
                 {
                     debug(1, "Failed to register mixer element");
                     response = -3;
                 }
                 else
                 {
-                    ret = snd_mixer_load(alsa_mix_handle);
+                    ret = snd_mixer_load(a->alsa_mix_handle);
 
                     if (ret < 0)
                     {
@@ -339,12 +533,12 @@ int open_mixer()
                     }
                     else
                     {
-                        debug(3, "Mixer control is \"%s\",%d.", alsa_mix_ctrl, alsa_mix_index);
-                        alsa_mix_elem = snd_mixer_find_selem(alsa_mix_handle, alsa_mix_sid);
+                        debug(3, "Mixer control is \"%s\",%d.", a->alsa_mix_ctrl, a->alsa_mix_index);
+                        a->alsa_mix_elem = snd_mixer_find_selem(a->alsa_mix_handle, alsa_mix_sid);
 
-                        if (!alsa_mix_elem)
+                        if (!a->alsa_mix_elem)
                         {
-                            warn("failed to find mixer control \"%s\",%d.", alsa_mix_ctrl, alsa_mix_index);
+                            warn("failed to find mixer control \"%s\",%d.", a->alsa_mix_ctrl, a->alsa_mix_index);
                             response = -5;
                         }
                         else
@@ -361,12 +555,12 @@ int open_mixer()
 }
 
 // assuming pthread cancellation is disabled
-void close_mixer()
+void close_mixer(alsa_instance * a)
 {
-    if (alsa_mix_handle)
+    if (a->alsa_mix_handle)
     {
-        snd_mixer_close(alsa_mix_handle);
-        alsa_mix_handle = NULL;
+        snd_mixer_close(a->alsa_mix_handle);
+        a->alsa_mix_handle = NULL;
     }
 }
 
@@ -382,23 +576,23 @@ void do_snd_mixer_selem_set_playback_dB_all(snd_mixer_elem_t * mix_elem, double
     }
 }
 
-void actual_close_alsa_device()
+void actual_close_alsa_device(alsa_instance * a)
 {
     debug(1, "actual close");
 
-    if (alsa_handle)
+    if (a->alsa_handle)
     {
         int derr;
 
-        if ((derr = snd_pcm_hw_free(alsa_handle)))
+        if ((derr = snd_pcm_hw_free(a->alsa_handle)))
             debug(1,
                   "Error %d (\"%s\") freeing the output device hardware while "
                   "closing it.",
                   derr, snd_strerror(derr));
 
-        if ((derr = snd_pcm_close(alsa_handle))) debug(1, "Error %d (\"%s\") closing the output device.", derr, snd_strerror(derr));
+        if ((derr = snd_pcm_close(a->alsa_handle))) debug(1, "Error %d (\"%s\") closing the output device.", derr, snd_strerror(derr));
 
-        alsa_handle = NULL;
+        a->alsa_handle = NULL;
     }
 }
 
@@ -427,7 +621,7 @@ format_record fr[] = {
     { SND_PCM_FORMAT_S16_LE,  4 },      { SND_PCM_FORMAT_S16_BE,  4 },      { SND_PCM_FORMAT_S24,     8 },
     { SND_PCM_FORMAT_S24_LE,  8 },      { SND_PCM_FORMAT_S24_BE,  8 },      { SND_PCM_FORMAT_S24_3LE, 6 },
     { SND_PCM_FORMAT_S24_3BE, 6 },      { SND_PCM_FORMAT_S32,     8 },      { SND_PCM_FORMAT_S32_LE,  8 },
-    { SND_PCM_FORMAT_S32_BE,  8 },      { SND_PCM_FORMAT_UNKNOWN, 0 }, // auto
+    { SND_PCM_FORMAT_S32_BE,  8 },      { SND_PCM_FORMAT_FLOAT,   8 },      { SND_PCM_FORMAT_UNKNOWN, 0 }, // auto
     { SND_PCM_FORMAT_UNKNOWN, 0 }, // illegal
 };
 
@@ -454,7 +648,7 @@ sps_format_t auto_format_check_sequence[] = {
 // assuming pthread cancellation is disabled
 // if do_auto_setting is true and auto format or auto speed has been requested,
 // select the settings as appropriate and store them
-int actual_open_alsa_device(int do_auto_setup)
+int actual_open_alsa_device(alsa_instance * a, int do_auto_setup)
 {
     // the alsa mutex is already acquired when this is called
     const snd_pcm_uframes_t minimal_buffer_headroom =
@@ -477,111 +671,113 @@ int actual_open_alsa_device(int do_auto_setup)
     // ensure no calls are made to the alsa device enquiring about the buffer
     // length if
     // synchronisation is disabled.
-    if (config.no_sync != 0) audio_alsa.delay = NULL;
+    if (a->no_sync != 0) a->backend->delay = NULL;
 
     // ensure no calls are made to the alsa device enquiring about the buffer
     // length if
     // synchronisation is disabled.
-    if (config.no_sync != 0) audio_alsa.delay = NULL;
+    if (a->no_sync != 0) a->backend->delay = NULL;
 
-    ret = snd_pcm_open(&alsa_handle, alsa_out_dev, SND_PCM_STREAM_PLAYBACK, 0);
+    ret = snd_pcm_open(&a->alsa_handle, a->alsa_out_dev, SND_PCM_STREAM_PLAYBACK, 0);
 
     if (ret < 0)
     {
         if (ret == -ENOENT)
         {
-            warn("the alsa output_device \"%s\" can not be found.", alsa_out_dev);
+            warn("the alsa output_device \"%s\" can not be found.", a->alsa_out_dev);
         }
         else
         {
             char errorstring[1024];
             strerror_r(-ret, (char *)errorstring, sizeof(errorstring));
             warn("alsa: error %d (\"%s\") opening alsa device \"%s\".", ret, (char *)errorstring,
-                 alsa_out_dev);
+                 a->alsa_out_dev);
         }
 
         return ret;
     }
 
+    snd_pcm_hw_params_t * alsa_params;
+    snd_pcm_sw_params_t * alsa_swparams;
     snd_pcm_hw_params_alloca(&alsa_params);
     snd_pcm_sw_params_alloca(&alsa_swparams);
 
-    ret = snd_pcm_hw_params_any(alsa_handle, alsa_params);
+    ret = snd_pcm_hw_params_any(a->alsa_handle, alsa_params);
 
     if (ret < 0)
     {
         die("audio_alsa: Broken configuration for device \"%s\": no configurations "
             "available",
-            alsa_out_dev);
+            a->alsa_out_dev);
         return ret;
     }
 
-    if ((config.no_mmap == 0) &&
-        (snd_pcm_hw_params_set_access(alsa_handle, alsa_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) >=
+    if ((a->no_mmap == 0) &&
+        (snd_pcm_hw_params_set_access(a->alsa_handle, alsa_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) >=
          0))
     {
-        if (output_method_signalled == 0)
+        if (a->output_method_signalled == 0)
         {
             debug(3, "Output written using MMAP");
-            output_method_signalled = 1;
+            a->output_method_signalled = 1;
         }
 
         access = SND_PCM_ACCESS_MMAP_INTERLEAVED;
-        alsa_pcm_write = snd_pcm_mmap_writei;
+        a->alsa_pcm_write = snd_pcm_mmap_writei;
     }
     else
     {
-        if (output_method_signalled == 0)
+        if (a->output_method_signalled == 0)
         {
             debug(3, "Output written with RW");
-            output_method_signalled = 1;
+            a->output_method_signalled = 1;
         }
 
         access = SND_PCM_ACCESS_RW_INTERLEAVED;
-        alsa_pcm_write = snd_pcm_writei;
+        a->alsa_pcm_write = snd_pcm_writei;
     }
 
-    ret = snd_pcm_hw_params_set_access(alsa_handle, alsa_params, access);
+    ret = snd_pcm_hw_params_set_access(a->alsa_handle, alsa_params, access);
 
     if (ret < 0)
     {
-        warn("audio_alsa: Access type not available for device \"%s\": %s", alsa_out_dev,
+        warn("audio_alsa: Access type not available for device \"%s\": %s", a->alsa_out_dev,
              snd_strerror(ret));
         return ret;
     }
 
-    ret = snd_pcm_hw_params_set_channels(alsa_handle, alsa_params, 2);
+    ret = snd_pcm_hw_params_set_channels(a->alsa_handle, alsa_params, 2);
 
     if (ret < 0)
     {
-        warn("audio_alsa: Channels count (2) not available for device \"%s\": %s", alsa_out_dev,
+        warn("audio_alsa: Channels count (2) not available for device \"%s\": %s", a->alsa_out_dev,
              snd_strerror(ret));
         return ret;
     }
 
     snd_pcm_format_t sf;
 
-    if ((do_auto_setup == 0) || (config.output_format_auto_requested == 0)) // no auto format
+    if ((do_auto_setup == 0) || (a->output_format_auto_requested == 0)) // no auto format
     {
-        if ((config.output_format > SPS_FORMAT_UNKNOWN) && (config.output_format < SPS_FORMAT_AUTO))
+        if ((a->output_format > SPS_FORMAT_UNKNOWN) && (a->output_format < SPS_FORMAT_AUTO))
         {
-            sf = fr[config.output_format].alsa_code;
-            frame_size = fr[config.output_format].frame_size;
+            sf = fr[a->output_format].alsa_code;
+            a->frame_size = fr[a->output_format].frame_size;
         }
         else
         {
-            warn("alsa: unexpected output format %d. Set to S16_LE.", config.output_format);
-            config.output_format = SPS_FORMAT_S16_LE;
-            sf = fr[config.output_format].alsa_code;
-            frame_size = fr[config.output_format].frame_size;
+            warn("alsa: unexpected output format %d. Set to S16_LE.", a->output_format);
+            a->output_format = SPS_FORMAT_S16_LE;
+            sf = fr[a->output_format].alsa_code;
+            a->frame_size = fr[a->output_format].frame_size;
         }
 
-        ret = snd_pcm_hw_params_set_format(alsa_handle, alsa_params, sf);
+        ret = snd_pcm_hw_params_set_format(a->alsa_handle, alsa_params, sf);
 
         if (ret < 0)
         {
             warn("audio_alsa: Alsa sample format %d not available for device \"%s\": %s", sf,
-                 alsa_out_dev, snd_strerror(ret));
+                 a->alsa_out_dev, snd_strerror(ret));
             return ret;
         }
     }
@@ -599,8 +795,8 @@ int actual_open_alsa_device(int do_auto_setup)
         {
             trial_format = formats[i];
             sf = fr[trial_format].alsa_code;
-            frame_size = fr[trial_format].frame_size;
-            ret = snd_pcm_hw_params_set_format(alsa_handle, alsa_params, sf);
+            a->frame_size = fr[trial_format].frame_size;
+            ret = snd_pcm_hw_params_set_format(a->alsa_handle, alsa_params, sf);
 
             if (ret == 0) format_found = 1;
             else i++;
@@ -608,27 +804,27 @@ int actual_open_alsa_device(int do_auto_setup)
 
         if (ret == 0)
         {
-            config.output_format = trial_format;
+            a->output_format = trial_format;
             debug(1, "alsa: output format chosen is \"%s\".",
-                  sps_format_description_string(config.output_format));
+                  sps_format_description_string(a->output_format));
         }
         else
         {
             warn("audio_alsa: Could not automatically set the output format for device \"%s\": %s",
-                 alsa_out_dev, snd_strerror(ret));
+                 a->alsa_out_dev, snd_strerror(ret));
             return ret;
         }
     }
 
-    if ((do_auto_setup == 0) || (config.output_rate_auto_requested == 0)) // no auto format
+    if ((do_auto_setup == 0) || (a->output_rate_auto_requested == 0)) // no auto format
     {
         actual_sample_rate =
-            config.output_rate; // this is the requested rate -- it'll be changed to the actual rate
-        ret = snd_pcm_hw_params_set_rate_near(alsa_handle, alsa_params, &actual_sample_rate, &dir);
+            a->output_rate; // this is the requested rate -- it'll be changed to the actual rate
+        ret = snd_pcm_hw_params_set_rate_near(a->alsa_handle, alsa_params, &actual_sample_rate, &dir);
 
         if (ret < 0)
         {
-            warn("audio_alsa: Rate %iHz not available for playback: %s", config.output_rate,
+            warn("audio_alsa: Rate %iHz not available for playback: %s", a->output_rate,
                  snd_strerror(ret));
             return ret;
         }
@@ -647,7 +843,7 @@ int actual_open_alsa_device(int do_auto_setup)
         while ((i < number_of_speeds_to_try) && (speed_found == 0))
         {
             actual_sample_rate = speeds[i];
-            ret = snd_pcm_hw_params_set_rate_near(alsa_handle, alsa_params, &actual_sample_rate, &dir);
+            ret = snd_pcm_hw_params_set_rate_near(a->alsa_handle, alsa_params, &actual_sample_rate, &dir);
 
             if (ret == 0)
             {
@@ -663,26 +859,26 @@ int actual_open_alsa_device(int do_auto_setup)
 
         if (ret == 0)
         {
-            config.output_rate = actual_sample_rate;
-            debug(1, "alsa: output speed chosen is %d.", config.output_rate);
+            a->output_rate = actual_sample_rate;
+            debug(1, "alsa: output speed chosen is %d.", a->output_rate);
         }
         else
         {
             warn("audio_alsa: Could not automatically set the output rate for device \"%s\": %s",
-                 alsa_out_dev, snd_strerror(ret));
+                 a->alsa_out_dev, snd_strerror(ret));
             return ret;
         }
     }
 
-    if (set_period_size_request != 0)
+    if (a->set_period_size_request != 0)
     {
-        debug(1, "Attempting to set the period size to %lu", period_size_requested);
-        ret = snd_pcm_hw_params_set_period_size_near(alsa_handle, alsa_params, &period_size_requested,
+        debug(1, "Attempting to set the period size to %lu", a->period_size_requested);
+        ret = snd_pcm_hw_params_set_period_size_near(a->alsa_handle, alsa_params, &a->period_size_requested,
                                                      &dir);
 
         if (ret < 0)
         {
-            warn("audio_alsa: cannot set period size of %lu: %s", period_size_requested,
+            warn("audio_alsa: cannot set period size of %lu: %s", a->period_size_requested,
                  snd_strerror(ret));
             return ret;
         }
@@ -691,22 +887,22 @@ int actual_open_alsa_device(int do_auto_setup)
             snd_pcm_uframes_t actual_period_size;
             snd_pcm_hw_params_get_period_size(alsa_params, &actual_period_size, &dir);
 
-            if (actual_period_size != period_size_requested)
+            if (actual_period_size != a->period_size_requested)
                 inform("Actual period size set to a different value than requested. "
                        "Requested: %lu, actual "
                        "setting: %lu",
-                       period_size_requested, actual_period_size);
+                       a->period_size_requested, actual_period_size);
         }
     }
 
-    if (set_buffer_size_request != 0)
+    if (a->set_buffer_size_request != 0)
     {
-        debug(1, "Attempting to set the buffer size to %lu", buffer_size_requested);
-        ret = snd_pcm_hw_params_set_buffer_size_near(alsa_handle, alsa_params, &buffer_size_requested);
+        debug(1, "Attempting to set the buffer size to %lu", a->buffer_size_requested);
+        ret = snd_pcm_hw_params_set_buffer_size_near(a->alsa_handle, alsa_params, &a->buffer_size_requested);
 
         if (ret < 0)
         {
-            warn("audio_alsa: cannot set buffer size of %lu: %s", buffer_size_requested,
+            warn("audio_alsa: cannot set buffer size of %lu: %s", a->buffer_size_requested,
                  snd_strerror(ret));
             return ret;
         }
@@ -715,104 +911,104 @@ int actual_open_alsa_device(int do_auto_setup)
             snd_pcm_uframes_t actual_buffer_size;
             snd_pcm_hw_params_get_buffer_size(alsa_params, &actual_buffer_size);
 
-            if (actual_buffer_size != buffer_size_requested)
+            if (actual_buffer_size != a->buffer_size_requested)
                 inform("Actual period size set to a different value than requested. "
                        "Requested: %lu, actual "
                        "setting: %lu",
-                       buffer_size_requested, actual_buffer_size);
+                       a->buffer_size_requested, actual_buffer_size);
         }
     }
 
-    ret = snd_pcm_hw_params(alsa_handle, alsa_params);
+    ret = snd_pcm_hw_params(a->alsa_handle, alsa_params);
 
     if (ret < 0)
     {
-        warn("audio_alsa: Unable to set hw parameters for device \"%s\": %s.", alsa_out_dev,
+        warn("audio_alsa: Unable to set hw parameters for device \"%s\": %s.", a->alsa_out_dev,
              snd_strerror(ret));
         return ret;
     }
 
     // check parameters after attempting to set them
 
-    if (set_period_size_request != 0)
+    if (a->set_period_size_request != 0)
     {
         snd_pcm_uframes_t actual_period_size;
         snd_pcm_hw_params_get_period_size(alsa_params, &actual_period_size, &dir);
 
-        if (actual_period_size != period_size_requested)
+        if (actual_period_size != a->period_size_requested)
             inform("Actual period size set to a different value than requested. "
                    "Requested: %lu, actual "
                    "setting: %lu",
-                   period_size_requested, actual_period_size);
+                   a->period_size_requested, actual_period_size);
     }
 
-    if (set_buffer_size_request != 0)
+    if (a->set_buffer_size_request != 0)
     {
         snd_pcm_uframes_t actual_buffer_size;
         snd_pcm_hw_params_get_buffer_size(alsa_params, &actual_buffer_size);
 
-        if (actual_buffer_size != buffer_size_requested)
+        if (actual_buffer_size != a->buffer_size_requested)
             inform("Actual period size set to a different value than requested. "
                    "Requested: %lu, actual "
                    "setting: %lu",
-                   buffer_size_requested, actual_buffer_size);
+                   a->buffer_size_requested, actual_buffer_size);
     }
 
-    if (actual_sample_rate != config.output_rate)
+    if (actual_sample_rate != a->output_rate)
     {
-        warn("Can't set the D/A converter to sample rate %d.", config.output_rate);
+        warn("Can't set the D/A converter to sample rate %d.", a->output_rate);
         return -EINVAL;
     }
 
-    use_monotonic_clock = snd_pcm_hw_params_is_monotonic(alsa_params);
+    a->use_monotonic_clock = snd_pcm_hw_params_is_monotonic(alsa_params);
 
     ret = snd_pcm_hw_params_get_buffer_size(alsa_params, &actual_buffer_length);
 
     if (ret < 0)
     {
-        warn("audio_alsa: Unable to get hw buffer length for device \"%s\": %s.", alsa_out_dev,
+        warn("audio_alsa: Unable to get hw buffer length for device \"%s\": %s.", a->alsa_out_dev,
              snd_strerror(ret));
         return ret;
     }
 
-    ret = snd_pcm_sw_params_current(alsa_handle, alsa_swparams);
+    ret = snd_pcm_sw_params_current(a->alsa_handle, alsa_swparams);
 
     if (ret < 0)
     {
         warn("audio_alsa: Unable to get current sw parameters for device \"%s\": "
              "%s.",
-             alsa_out_dev, snd_strerror(ret));
+             a->alsa_out_dev, snd_strerror(ret));
         return ret;
     }
 
-    ret = snd_pcm_sw_params_set_tstamp_mode(alsa_handle, alsa_swparams, SND_PCM_TSTAMP_ENABLE);
+    ret = snd_pcm_sw_params_set_tstamp_mode(a->alsa_handle, alsa_swparams, SND_PCM_TSTAMP_ENABLE);
 
     if (ret < 0)
     {
-        warn("audio_alsa: Can't enable timestamp mode of device: \"%s\": %s.", alsa_out_dev,
+        warn("audio_alsa: Can't enable timestamp mode of device: \"%s\": %s.", a->alsa_out_dev,
              snd_strerror(ret));
         return ret;
     }
 
     /* write the sw parameters */
-    ret = snd_pcm_sw_params(alsa_handle, alsa_swparams);
+    ret = snd_pcm_sw_params(a->alsa_handle, alsa_swparams);
 
     if (ret < 0)
     {
-        warn("audio_alsa: Unable to set software parameters of device: \"%s\": %s.", alsa_out_dev,
+        warn("audio_alsa: Unable to set software parameters of device: \"%s\": %s.", a->alsa_out_dev,
              snd_strerror(ret));
         return ret;
     }
 
-    ret = snd_pcm_prepare(alsa_handle);
+    ret = snd_pcm_prepare(a->alsa_handle);
 
     if (ret < 0)
     {
-        warn("audio_alsa: Unable to prepare the device: \"%s\": %s.", alsa_out_dev, snd_strerror(ret));
+        warn("audio_alsa: Unable to prepare the device: \"%s\": %s.", a->alsa_out_dev, snd_strerror(ret));
         return ret;
     }
 
-    if (actual_buffer_length < config.audio_backend_buffer_desired_length + minimal_buffer_headroom)
+    if (actual_buffer_length < a->buffer_desired_length + minimal_buffer_headroom)
     {
         /*
            // the dac buffer is too small, so let's try to set it
@@ -840,22 +1036,22 @@ int actual_open_alsa_device(int do_auto_setup)
               "The alsa buffer is smaller (%lu bytes) than the desired backend "
               "buffer "
               "length (%ld) you have chosen.",
-              actual_buffer_length, config.audio_backend_buffer_desired_length);
+              actual_buffer_length, a->buffer_desired_length);
     }
 
-    if (config.use_precision_timing == YNA_YES) delay_and_status = precision_delay_and_status;
-    else if (config.use_precision_timing == YNA_AUTO)
+    if (a->use_precision_timing == YNA_YES) a->delay_and_status = precision_delay_and_status;
+    else if (a->use_precision_timing == YNA_AUTO)
     {
-        if (precision_delay_available())
+        if (precision_delay_available(a))
         {
-            delay_and_status = precision_delay_and_status;
+            a->delay_and_status = precision_delay_and_status;
             debug(2, "alsa: precision timing selected for \"auto\" mode");
         }
     }
 
-    if (alsa_characteristics_already_listed == 0)
+    if (a->alsa_characteristics_already_listed == 0)
     {
-        alsa_characteristics_already_listed = 1;
+        a->alsa_characteristics_already_listed = 1;
         int log_level = 2; // the level at which debug information should be output
                            //    int rc;
         snd_pcm_access_t access_type;
@@ -867,7 +1063,7 @@ int actual_open_alsa_device(int do_auto_setup)
         int dir;
         snd_pcm_uframes_t frames;
 
-        debug(log_level, "PCM handle name = '%s'", snd_pcm_name(alsa_handle));
+        debug(log_level, "PCM handle name = '%s'", snd_pcm_name(a->alsa_handle));
 
         //      ret = snd_pcm_hw_params_any(alsa_handle, alsa_params);
         //      if (ret < 0) {
@@ -1004,29 +1200,29 @@ int actual_open_alsa_device(int do_auto_setup)
     return 0;
 }
 
-int open_alsa_device(int do_auto_setup)
+int open_alsa_device(alsa_instance * a, int do_auto_setup)
 {
     int result;
     int oldState;
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
-    result = actual_open_alsa_device(do_auto_setup);
+    result = actual_open_alsa_device(a, do_auto_setup);
     pthread_setcancelstate(oldState, NULL);
     return result;
 }
 
-int prepare_mixer()
+int prepare_mixer(alsa_instance * a)
 {
     int response = 0;
 
     // do any alsa device initialisation (general case)
     // at present, this is only needed if a hardware mixer is being used
     // if there's a hardware mixer, it needs to be initialised before use
-    if (alsa_mix_ctrl == NULL)
+    if (a->alsa_mix_ctrl == NULL)
     {
-        audio_alsa.volume = NULL;
-        audio_alsa.parameters = NULL;
-        audio_alsa.mute = NULL;
+        a->backend->volume = NULL;
+        a->backend->parameters = NULL;
+        a->backend->mute = NULL;
     }
     else
     {
@@ -1034,83 +1230,83 @@ int prepare_mixer()
         int oldState;
         pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
 
-        if (alsa_mix_dev == NULL) alsa_mix_dev = alsa_out_dev;
+        if (a->alsa_mix_dev == NULL) a->alsa_mix_dev = a->alsa_out_dev;
 
         // Now, start trying to initialise the alsa device with the settings
         // obtained
-        pthread_cleanup_debug_mutex_lock(&alsa_mixer_mutex, 1000, 1);
+        pthread_cleanup_debug_mutex_lock(&a->alsa_mixer_mutex, 1000, 1);
 
-        if (open_mixer() == 1)
+        if (open_mixer(a) == 1)
         {
-            if (snd_mixer_selem_get_playback_volume_range(alsa_mix_elem, &alsa_mix_minv, &alsa_mix_maxv) <
+            if (snd_mixer_selem_get_playback_volume_range(a->alsa_mix_elem, &a->alsa_mix_minv, &a->alsa_mix_maxv) <
                 0) debug(1, "Can't read mixer's [linear] min and max volumes.");
             else
             {
-                if (snd_mixer_selem_get_playback_dB_range(alsa_mix_elem, &alsa_mix_mindb,
-                                                          &alsa_mix_maxdb) == 0)
+                if (snd_mixer_selem_get_playback_dB_range(a->alsa_mix_elem, &a->alsa_mix_mindb,
+                                                          &a->alsa_mix_maxdb) == 0)
                 {
-                    audio_alsa.volume = &volume; // insert the volume function now we
-                                                 // know it can do dB stuff
-                    audio_alsa.parameters = &parameters; // likewise the parameters stuff
+                    // insert the volume function now we know it can do dB stuff
+                    a->backend->volume = alsa_instance_volume[a->index];
+                    a->backend->parameters = alsa_instance_parameters[a->index]; // likewise the parameters stuff
 
-                    if (alsa_mix_mindb == SND_CTL_TLV_DB_GAIN_MUTE)
+                    if (a->alsa_mix_mindb == SND_CTL_TLV_DB_GAIN_MUTE)
                     {
                         // For instance, the Raspberry Pi does this
                         debug(1, "Lowest dB value is a mute");
-                        mixer_volume_setting_gives_mute = 1;
-                        alsa_mix_mute = SND_CTL_TLV_DB_GAIN_MUTE; // this may not be
+                        a->mixer_volume_setting_gives_mute = 1;
+                        a->alsa_mix_mute = SND_CTL_TLV_DB_GAIN_MUTE; // this may not be
 
                         // necessary -- it's
                         // always
                         // going to be SND_CTL_TLV_DB_GAIN_MUTE, right?
                         // debug(1, "Try minimum volume + 1 as lowest true attenuation
                         // value");
-                        if (snd_mixer_selem_ask_playback_vol_dB(alsa_mix_elem, alsa_mix_minv + 1,
-                                                                &alsa_mix_mindb) != 0) debug(1, "Can't get dB value corresponding to a minimum volume "
+                        if (snd_mixer_selem_ask_playback_vol_dB(a->alsa_mix_elem, a->alsa_mix_minv + 1,
+                                                                &a->alsa_mix_mindb) != 0) debug(1, "Can't get dB value corresponding to a minimum volume "
                                                                                              "+ 1.");
                     }
 
-                    debug(3, "Hardware mixer has dB volume from %f to %f.", (1.0 * alsa_mix_mindb) / 100.0,
-                          (1.0 * alsa_mix_maxdb) / 100.0);
+                    debug(3, "Hardware mixer has dB volume from %f to %f.", (1.0 * a->alsa_mix_mindb) / 100.0,
+                          (1.0 * a->alsa_mix_maxdb) / 100.0);
                 }
                 else
                 {
                     // use the linear scale and do the db conversion ourselves
                     warn("The hardware mixer specified -- \"%s\" -- does not have "
                          "a dB volume scale.",
-                         alsa_mix_ctrl);
+                         a->alsa_mix_ctrl);
 
-                    if (snd_ctl_open(&ctl, alsa_mix_dev, 0) < 0)
+                    if (snd_ctl_open(&a->ctl, a->alsa_mix_dev, 0) < 0)
                     {
-                        warn("Cannot open control \"%s\"", alsa_mix_dev);
+                        warn("Cannot open control \"%s\"", a->alsa_mix_dev);
                         response = -1;
                     }
 
-                    if (snd_ctl_elem_id_malloc(&elem_id) < 0)
+                    if (snd_ctl_elem_id_malloc(&a->elem_id) < 0)
                     {
-                        debug(1, "Cannot allocate memory for control \"%s\"", alsa_mix_dev);
-                        elem_id = NULL;
+                        debug(1, "Cannot allocate memory for control \"%s\"", a->alsa_mix_dev);
+                        a->elem_id = NULL;
                         response = -2;
                     }
                     else
                     {
-                        snd_ctl_elem_id_set_interface(elem_id, SND_CTL_ELEM_IFACE_MIXER);
-                        snd_ctl_elem_id_set_name(elem_id, alsa_mix_ctrl);
+                        snd_ctl_elem_id_set_interface(a->elem_id, SND_CTL_ELEM_IFACE_MIXER);
+                        snd_ctl_elem_id_set_name(a->elem_id, a->alsa_mix_ctrl);
 
-                        if (snd_ctl_get_dB_range(ctl, elem_id, &alsa_mix_mindb, &alsa_mix_maxdb) == 0)
+                        if (snd_ctl_get_dB_range(a->ctl, a->elem_id, &a->alsa_mix_mindb, &a->alsa_mix_maxdb) == 0)
                         {
                             debug(1,
                                   "alsa: hardware mixer \"%s\" selected, with dB volume "
                                   "from %f to %f.",
-                                  alsa_mix_ctrl, (1.0 * alsa_mix_mindb) / 100.0, (1.0 * alsa_mix_maxdb) / 100.0);
-                            has_softvol = 1;
-                            audio_alsa.volume = &volume; // insert the volume function now
-                                                         // we know it can do dB stuff
-                            audio_alsa.parameters = &parameters; // likewise the parameters stuff
+                                  a->alsa_mix_ctrl, (1.0 * a->alsa_mix_mindb) / 100.0, (1.0 * a->alsa_mix_maxdb) / 100.0);
+                            a->has_softvol = 1;
+                            // insert the volume function now we know it can do dB stuff
+                            a->backend->volume = alsa_instance_volume[a->index];
+                            a->backend->parameters = alsa_instance_parameters[a->index]; // likewise the parameters stuff
                         }
                         else
                         {
-                            debug(1, "Cannot get the dB range from the volume control \"%s\"", alsa_mix_ctrl);
+                            debug(1, "Cannot get the dB range from the volume control \"%s\"", a->alsa_mix_ctrl);
                         }
                     }
 
@@ -1133,12 +1329,12 @@ int prepare_mixer()
                 }
             }
 
-            if (((config.alsa_use_hardware_mute == 1) &&
-                 (snd_mixer_selem_has_playback_switch(alsa_mix_elem))) ||
-                mixer_volume_setting_gives_mute)
+            if (((a->alsa_use_hardware_mute == 1) &&
+                 (snd_mixer_selem_has_playback_switch(a->alsa_mix_elem))) ||
+                a->mixer_volume_setting_gives_mute)
             {
-                audio_alsa.mute = &mute; // insert the mute function now we know it
-                                         // can do muting stuff
+                // insert the mute function now we know it can do muting stuff
+                a->backend->mute = alsa_instance_mute[a->index];
                 // debug(1, "Has mixer and mute ability we will use.");
             }
             else
@@ -1146,10 +1342,10 @@ int prepare_mixer()
                 // debug(1, "Has mixer but not using hardware mute.");
             }
 
-            close_mixer();
+            close_mixer(a);
         }
 
-        debug_mutex_unlock(&alsa_mixer_mutex, 3); // release the mutex
+        debug_mutex_unlock(&a->alsa_mixer_mutex, 3); // release the mutex
         pthread_cleanup_pop(0);
         pthread_setcancelstate(oldState, NULL);
     }
@@ -1157,31 +1353,38 @@ int prepare_mixer()
     return response;
 }
 
-int alsa_device_init()
+int alsa_device_init(alsa_instance * a)
 {
-    return prepare_mixer();
+    return prepare_mixer(a);
 }
 
-static int init(int argc, char * * argv)
+static int init(alsa_instance * a, int argc, char * * argv)
 {
     // for debugging
-    snd_output_stdio_attach(&output, stdout, 0);
+    if (output == NULL) snd_output_stdio_attach(&output, stdout, 0);
 
     // debug(2,"audio_alsa init called.");
     int response = 0; // this will be what we return to the caller.
 
-    alsa_device_initialised = 0;
+    if (a->backend == NULL) a->backend = &audio_alsa; // new_instance() sets the others'
+
+    a->alsa_device_initialised = 0;
     const char * str;
     int value;
 
+    // another instance's settings are its own -- they mustn't be left in config for the first's
+    shairport_cfg saved_config;
+
+    if (a->index != 0) saved_config = config;
+
     // double dvalue;
 
     // set up default values first
 
-    alsa_backend_state = abm_disconnected; // startup state
+    a->alsa_backend_state = abm_disconnected; // startup state
     debug(2, "alsa: init() -- alsa_backend_state => abm_disconnected.");
-    set_period_size_request = 0;
-    set_buffer_size_request = 0;
+    a->set_period_size_request = 0;
+    a->set_buffer_size_request = 0;
     config.alsa_use_hardware_mute = 0; // don't use it by default
 
     config.audio_backend_latency_offset = 0;
@@ -1191,15 +1394,15 @@ static int init(int argc, char * * argv)
     config.alsa_maximum_stall_time = 0.200; // 200 milliseconds -- if it takes longer, it's a problem
     config.disable_standby_mode_silence_threshold =
         0.040; // start sending silent frames if the delay goes below this time
-    config.disable_standby_mode_silence_scan_interval = 0.004; // check silence threshold this often
+    config.disable_standby_mode_silence_scan_interval = 0.004; // check silence threshold no more often than this
 
-    stall_monitor_error_threshold =
+    a->stall_monitor_error_threshold =
         (uint64_t)1000000 * config.alsa_maximum_stall_time; // stall time max to microseconds;
-    stall_monitor_error_threshold = (stall_monitor_error_threshold << 32) / 1000000; // now in fp form
+    a->stall_monitor_error_threshold = (a->stall_monitor_error_threshold << 32) / 1000000; // now in fp form
     debug(1, "alsa: alsa_maximum_stall_time of %f sec.", config.alsa_maximum_stall_time);
 
-    stall_monitor_start_time = 0;
-    stall_monitor_frame_count = 0;
+    a->stall_monitor_start_time = 0;
+    a->stall_monitor_frame_count = 0;
 
     config.disable_standby_mode = disable_standby_off;
     config.keep_dac_busy = 0;
@@ -1217,14 +1420,14 @@ static int init(int argc, char * * argv)
         double dvalue;
 
         /* Get the Output Device Name. */
-        if (config_lookup_string(config.cfg, "alsa.output_device", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "output_device"), &str))
         {
-            alsa_out_dev = (char *)str;
+            a->alsa_out_dev = (char *)str;
         }
 
         /* Get the Mixer Type setting. */
 
-        if (config_lookup_string(config.cfg, "alsa.mixer_type", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "mixer_type"), &str))
         {
             inform("The alsa mixer_type setting is deprecated and has been ignored. "
                    "FYI, using the \"mixer_control_name\" setting automatically "
@@ -1232,25 +1435,25 @@ static int init(int argc, char * * argv)
         }
 
         /* Get the Mixer Device Name. */
-        if (config_lookup_string(config.cfg, "alsa.mixer_device", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "mixer_device"), &str))
         {
-            alsa_mix_dev = (char *)str;
+            a->alsa_mix_dev = (char *)str;
         }
 
         /* Get the Mixer Control Name. */
-        if (config_lookup_string(config.cfg, "alsa.mixer_control_name", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "mixer_control_name"), &str))
         {
-            alsa_mix_ctrl = (char *)str;
+            a->alsa_mix_ctrl = (char *)str;
         }
 
         // Get the Mixer Control Index
-        if (config_lookup_int(config.cfg, "alsa.mixer_control_index", &value))
+        if (config_lookup_int(config.cfg, alsa_setting(a, "mixer_control_index"), &value))
         {
-            alsa_mix_index = value;
+            a->alsa_mix_index = value;
         }
 
         /* Get the disable_synchronization setting. */
-        if (config_lookup_string(config.cfg, "alsa.disable_synchronization", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "disable_synchronization"), &str))
         {
             if (strcasecmp(str, "no") == 0) config.no_sync = 0;
             else if (strcasecmp(str, "yes") == 0) config.no_sync = 1;
@@ -1264,7 +1467,7 @@ static int init(int argc, char * * argv)
         }
 
         /* Get the mute_using_playback_switch setting. */
-        if (config_lookup_string(config.cfg, "alsa.mute_using_playback_switch", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "mute_using_playback_switch"), &str))
         {
             inform("The alsa \"mute_using_playback_switch\" setting is deprecated. "
                    "Please use the \"use_hardware_mute_if_available\" setting instead.");
@@ -1281,7 +1484,8 @@ static int init(int argc, char * * argv)
         }
 
         /* Get the use_hardware_mute_if_available setting. */
-        if (config_lookup_string(config.cfg, "alsa.use_hardware_mute_if_available", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "use_hardware_mute_if_available"),
+                                 &str))
         {
             if (strcasecmp(str, "no") == 0) config.alsa_use_hardware_mute = 0;
             else if (strcasecmp(str, "yes") == 0) config.alsa_use_hardware_mute = 1;
@@ -1295,7 +1499,7 @@ static int init(int argc, char * * argv)
         }
 
         /* Get the output format, using the same names as aplay does*/
-        if (config_lookup_string(config.cfg, "alsa.output_format", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "output_format"), &str))
         {
             int temp_output_format_auto_requested = config.output_format_auto_requested;
             config.output_format_auto_requested = 0; // assume a valid format will be given.
@@ -1311,6 +1515,7 @@ static int init(int argc, char * * argv)
             else if (strcasecmp(str, "S32") == 0) config.output_format = SPS_FORMAT_S32;
             else if (strcasecmp(str, "S32_LE") == 0) config.output_format = SPS_FORMAT_S32_LE;
             else if (strcasecmp(str, "S32_BE") == 0) config.output_format = SPS_FORMAT_S32_BE;
+            else if (strcasecmp(str, "F32") == 0) config.output_format = SPS_FORMAT_F32;
             else if (strcasecmp(str, "U8") == 0) config.output_format = SPS_FORMAT_U8;
             else if (strcasecmp(str, "S8") == 0) config.output_format = SPS_FORMAT_S8;
             else if (strcasecmp(str, "auto") == 0) config.output_format_auto_requested = 1;
@@ -1321,7 +1526,7 @@ static int init(int argc, char * * argv)
                 warn("Invalid output format \"%s\". It should be \"auto\", \"U8\", \"S8\", "
                      "\"S16\", \"S24\", \"S24_LE\", \"S24_BE\", "
                      "\"S24_3LE\", \"S24_3BE\" or "
-                     "\"S32\", \"S32_LE\", \"S32_BE\". It remains set to \"%s\".",
+                     "\"S32\", \"S32_LE\", \"S32_BE\" or \"F32\". It remains set to \"%s\".",
                      str,
                      config.output_format_auto_requested == 1
                  ? "auto"
@@ -1329,7 +1534,7 @@ static int init(int argc, char * * argv)
             }
         }
 
-        if (config_lookup_string(config.cfg, "alsa.output_rate", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "output_rate"), &str))
         {
             if (strcasecmp(str, "auto") == 0)
             {
@@ -1349,7 +1554,7 @@ static int init(int argc, char * * argv)
         }
 
         /* Get the output rate, which must be a multiple of 44,100*/
-        if (config_lookup_int(config.cfg, "alsa.output_rate", &value))
+        if (config_lookup_int(config.cfg, alsa_setting(a, "output_rate"), &value))
         {
             debug(1, "alsa output rate is %d frames per second", value);
             switch (value)
@@ -1376,7 +1581,7 @@ static int init(int argc, char * * argv)
         }
 
         /* Get the use_mmap_if_available setting. */
-        if (config_lookup_string(config.cfg, "alsa.use_mmap_if_available", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "use_mmap_if_available"), &str))
         {
             if (strcasecmp(str, "no") == 0) config.no_mmap = 1;
             else if (strcasecmp(str, "yes") == 0) config.no_mmap = 0;
@@ -1389,10 +1594,20 @@ static int init(int argc, char * * argv)
             }
         }
 
+        // the low latency profile asks for small periods and a buffer not much bigger than the
+        // desired length, unless they are set explicitly below
+        if (config.latency_profile == LP_low)
+        {
+            a->set_period_size_request = 1;
+            a->period_size_requested = 256;
+            a->set_buffer_size_request = 1;
+            a->buffer_size_requested = 4096;
+        }
+
         /* Get the optional period size value */
-        if (config_lookup_int(config.cfg, "alsa.period_size", &value))
+        if (config_lookup_int(config.cfg, alsa_setting(a, "period_size"), &value))
         {
-            set_period_size_request = 1;
+            a->set_period_size_request = 1;
             debug(1, "Value read for period size is %d.", value);
 
             if (value < 0)
@@ -1400,18 +1615,18 @@ static int init(int argc, char * * argv)
                 warn("Invalid alsa period size setting \"%d\". It "
                      "must be greater than 0. No setting is made.",
                      value);
-                set_period_size_request = 0;
+                a->set_period_size_request = 0;
             }
             else
             {
-                period_size_requested = value;
+                a->period_size_requested = value;
             }
         }
 
         /* Get the optional buffer size value */
-        if (config_lookup_int(config.cfg, "alsa.buffer_size", &value))
+        if (config_lookup_int(config.cfg, alsa_setting(a, "buffer_size"), &value))
         {
-            set_buffer_size_request = 1;
+            a->set_buffer_size_request = 1;
             debug(1, "Value read for buffer size is %d.", value);
 
             if (value < 0)
@@ -1419,16 +1634,16 @@ static int init(int argc, char * * argv)
                 warn("Invalid alsa buffer size setting \"%d\". It "
                      "must be greater than 0. No setting is made.",
                      value);
-                set_buffer_size_request = 0;
+                a->set_buffer_size_request = 0;
             }
             else
             {
-                buffer_size_requested = value;
+                a->buffer_size_requested = value;
             }
         }
 
         /* Get the optional alsa_maximum_stall_time setting. */
-        if (config_lookup_float(config.cfg, "alsa.maximum_stall_time", &dvalue))
+        if (config_lookup_float(config.cfg, alsa_setting(a, "maximum_stall_time"), &dvalue))
         {
             if (dvalue < 0.0)
             {
@@ -1443,7 +1658,8 @@ static int init(int argc, char * * argv)
         }
 
         /* Get the optional disable_standby_mode_silence_threshold setting. */
-        if (config_lookup_float(config.cfg, "alsa.disable_standby_mode_silence_threshold", &dvalue))
+        if (config_lookup_float(config.cfg, alsa_setting(a, "disable_standby_mode_silence_threshold"),
+                                &dvalue))
         {
             if (dvalue < 0.0)
             {
@@ -1458,7 +1674,7 @@ static int init(int argc, char * * argv)
         }
 
         /* Get the optional disable_standby_mode_silence_scan_interval setting. */
-        if (config_lookup_float(config.cfg, "alsa.disable_standby_mode_silence_scan_interval",
+        if (config_lookup_float(config.cfg, alsa_setting(a, "disable_standby_mode_silence_scan_interval"),
                                 &dvalue))
         {
             if (dvalue < 0.0)
@@ -1474,7 +1690,7 @@ static int init(int argc, char * * argv)
         }
 
         /* Get the optional disable_standby_mode setting. */
-        if (config_lookup_string(config.cfg, "alsa.disable_standby_mode", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "disable_standby_mode"), &str))
         {
             if ((strcasecmp(str, "no") == 0) || (strcasecmp(str, "off") == 0) ||
                 (strcasecmp(str, "never") == 0)) config.disable_standby_mode = disable_standby_off;
@@ -1494,7 +1710,7 @@ static int init(int argc, char * * argv)
             }
         }
 
-        if (config_lookup_string(config.cfg, "alsa.use_precision_timing", &str))
+        if (config_lookup_string(config.cfg, alsa_setting(a, "use_precision_timing"), &str))
         {
             if ((strcasecmp(str, "no") == 0) || (strcasecmp(str, "off") == 0) ||
                 (strcasecmp(str, "never") == 0)) config.use_precision_timing = YNA_NO;
@@ -1537,7 +1753,7 @@ static int init(int argc, char * * argv)
         switch (opt)
         {
             case 'd':
-                alsa_out_dev = optarg;
+                a->alsa_out_dev = optarg;
                 break;
 
             case 't':
@@ -1547,15 +1763,15 @@ static int init(int argc, char * * argv)
                 break;
 
             case 'm':
-                alsa_mix_dev = optarg;
+                a->alsa_mix_dev = optarg;
                 break;
 
             case 'c':
-                alsa_mix_ctrl = optarg;
+                a->alsa_mix_ctrl = optarg;
                 break;
 
             case 'i':
-                alsa_mix_index = strtol(optarg, NULL, 10);
+                a->alsa_mix_index = strtol(optarg, NULL, 10);
                 break;
 
             default:
@@ -1569,129 +1785,177 @@ static int init(int argc, char * * argv)
         warn("Invalid audio argument: \"%s\" -- ignored", argv[optind]);
     }
 
-    debug(1, "alsa: output device name is \"%s\".", alsa_out_dev);
+    debug(1, "alsa: output device name is \"%s\".", a->alsa_out_dev);
+
+    // the instance plays with what it's been given, rather than with what's in config
+    a->output_format = config.output_format;
+    a->output_format_auto_requested = config.output_format_auto_requested;
+    a->output_rate = config.output_rate;
+    a->output_rate_auto_requested = config.output_rate_auto_requested;
+    a->no_sync = config.no_sync;
+    a->no_mmap = config.no_mmap;
+    a->alsa_use_hardware_mute = config.alsa_use_hardware_mute;
+    a->alsa_maximum_stall_time = config.alsa_maximum_stall_time;
+    a->disable_standby_mode = config.disable_standby_mode;
+    a->disable_standby_mode_silence_threshold = config.disable_standby_mode_silence_threshold;
+    a->disable_standby_mode_silence_scan_interval = config.disable_standby_mode_silence_scan_interval;
+    a->use_precision_timing = config.use_precision_timing;
+    a->buffer_desired_length = config.audio_backend_buffer_desired_length;
+    a->keep_dac_busy = config.keep_dac_busy;
+
+    // the zone's output settings are taken from config when this returns, but not these
+    if (a->index != 0)
+    {
+        config.output_format_auto_requested = saved_config.output_format_auto_requested;
+        config.output_rate_auto_requested = saved_config.output_rate_auto_requested;
+        config.no_mmap = saved_config.no_mmap;
+        config.alsa_use_hardware_mute = saved_config.alsa_use_hardware_mute;
+        config.alsa_maximum_stall_time = saved_config.alsa_maximum_stall_time;
+        config.disable_standby_mode = saved_config.disable_standby_mode;
+        config.disable_standby_mode_silence_threshold =
+            saved_config.disable_standby_mode_silence_threshold;
+        config.disable_standby_mode_silence_scan_interval =
+            saved_config.disable_standby_mode_silence_scan_interval;
+        config.use_precision_timing = saved_config.use_precision_timing;
+        config.keep_dac_busy = saved_config.keep_dac_busy;
+    }
 
-    // so, now, if the option to keep the DAC running has been selected, start a
-    // thread to monitor the
+    // so, now, start the writer thread. It writes what's put in the ring to the device and,
+    // if the option to keep the DAC running has been selected, it monitors the
     // length of the queue
     // if the queue gets too short, stuff it with silence
 
-    pthread_create(&alsa_buffer_monitor_thread, NULL, &alsa_buffer_monitor_thread_code, NULL);
+    a->alsa_ring = malloc(ALSA_RING_FRAMES * ALSA_RING_MAXIMUM_FRAME_SIZE);
+
+    if (a->alsa_ring == NULL) die("alsa: can't allocate the output ring.");
+
+    if (pipe(a->alsa_wake_pipe) != 0) die("alsa: can't create the pipe to wake the writer thread.");
+
+    fcntl(a->alsa_wake_pipe[0], F_SETFL, fcntl(a->alsa_wake_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(a->alsa_wake_pipe[1], F_SETFL, fcntl(a->alsa_wake_pipe[1], F_GETFL) | O_NONBLOCK);
+
+    pthread_create(&a->alsa_buffer_monitor_thread, NULL, &alsa_buffer_monitor_thread_code, a);
 
     return response;
 }
 
-static void deinit(void)
+static void deinit(alsa_instance * a)
 {
     int oldState;
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
     // debug(2,"audio_alsa deinit called.");
-    stop();
+    stop(a);
     debug(2, "Cancel buffer monitor thread.");
-    pthread_cancel(alsa_buffer_monitor_thread);
+    pthread_cancel(a->alsa_buffer_monitor_thread);
     debug(3, "Join buffer monitor thread.");
-    pthread_join(alsa_buffer_monitor_thread, NULL);
+    pthread_join(a->alsa_buffer_monitor_thread, NULL);
+    silence_pool_free(&a->alsa_monitor_silence);
+    close(a->alsa_wake_pipe[0]);
+    close(a->alsa_wake_pipe[1]);
+    free(a->alsa_ring);
+    a->alsa_ring = NULL;
     pthread_setcancelstate(oldState, NULL);
 }
 
-int set_mute_state()
+int set_mute_state(alsa_instance * a)
 {
     int response = 1; // some problem expected, e.g. no mixer or not allowed to use it or disconnected
     int oldState;
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
-    pthread_cleanup_debug_mutex_lock(&alsa_mixer_mutex, 10000, 0);
+    pthread_cleanup_debug_mutex_lock(&a->alsa_mixer_mutex, 10000, 0);
 
-    if ((alsa_backend_state != abm_disconnected) && (config.alsa_use_hardware_mute == 1) &&
-        (open_mixer() == 1))
+    if ((a->alsa_backend_state != abm_disconnected) && (a->alsa_use_hardware_mute == 1) &&
+        (open_mixer(a) == 1))
     {
         response = 0; // okay if actually using the mute facility
         debug(2, "alsa: actually set_mute_state");
         int mute = 0;
 
-        if ((mute_requested_externally != 0) || (mute_requested_internally != 0)) mute = 1;
+        if ((a->mute_requested_externally != 0) || (a->mute_requested_internally != 0)) mute = 1;
 
         if (mute == 1)
         {
             debug(2, "alsa: hardware mute switched on");
 
-            if (snd_mixer_selem_has_playback_switch(alsa_mix_elem)) snd_mixer_selem_set_playback_switch_all(alsa_mix_elem, 0);
+            if (snd_mixer_selem_has_playback_switch(a->alsa_mix_elem)) snd_mixer_selem_set_playback_switch_all(a->alsa_mix_elem, 0);
             else
             {
-                volume_based_mute_is_active = 1;
-                do_snd_mixer_selem_set_playback_dB_all(alsa_mix_elem, alsa_mix_mute);
+                a->volume_based_mute_is_active = 1;
+                do_snd_mixer_selem_set_playback_dB_all(a->alsa_mix_elem, a->alsa_mix_mute);
             }
         }
         else
         {
             debug(2, "alsa: hardware mute switched off");
 
-            if (snd_mixer_selem_has_playback_switch(alsa_mix_elem)) snd_mixer_selem_set_playback_switch_all(alsa_mix_elem, 1);
+            if (snd_mixer_selem_has_playback_switch(a->alsa_mix_elem)) snd_mixer_selem_set_playback_switch_all(a->alsa_mix_elem, 1);
             else
             {
-                volume_based_mute_is_active = 0;
-                do_snd_mixer_selem_set_playback_dB_all(alsa_mix_elem, set_volume);
+                a->volume_based_mute_is_active = 0;
+                do_snd_mixer_selem_set_playback_dB_all(a->alsa_mix_elem, a->set_volume);
             }
         }
 
-        close_mixer();
+        close_mixer(a);
     }
 
-    debug_mutex_unlock(&alsa_mixer_mutex, 3); // release the mutex
+    debug_mutex_unlock(&a->alsa_mixer_mutex, 3); // release the mutex
     pthread_cleanup_pop(0);                 // release the mutex
     pthread_setcancelstate(oldState, NULL);
     return response;
 }
 
-static void start(__attribute__((unused)) int i_sample_rate,
+static void start(alsa_instance * a, __attribute__((unused)) int i_sample_rate,
                   __attribute__((unused)) int i_sample_format)
 {
     debug(3, "audio_alsa start called.");
 
-    frame_index = 0;
-    measurement_data_is_valid = 0;
+    a->session_active = 1;
+    a->frame_index = 0;
+    a->measurement_data_is_valid = 0;
 
-    stall_monitor_start_time = 0;
-    stall_monitor_frame_count = 0;
+    a->stall_monitor_start_time = 0;
+    a->stall_monitor_frame_count = 0;
 
-    if (alsa_device_initialised == 0)
+    if (a->alsa_device_initialised == 0)
     {
         debug(1, "alsa: start() calling alsa_device_init.");
-        alsa_device_init();
-        alsa_device_initialised = 1;
+        alsa_device_init(a);
+        a->alsa_device_initialised = 1;
     }
 }
 
-int standard_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
+int standard_delay_and_status(alsa_instance * a, snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
                               yndk_type * using_update_timestamps)
 {
     int ret = 0;
 
     if (using_update_timestamps) *using_update_timestamps = YNDK_NO;
 
-    *state = snd_pcm_state(alsa_handle);
+    *state = snd_pcm_state(a->alsa_handle);
 
     if ((*state == SND_PCM_STATE_RUNNING) || (*state == SND_PCM_STATE_DRAINING))
     {
-        ret = snd_pcm_delay(alsa_handle, delay);
+        ret = snd_pcm_delay(a->alsa_handle, delay);
     }
     else
     {
         // not running, thus no delay information, thus can't check for frame
         // rates
-        frame_index = 0; // we'll be starting over...
-        measurement_data_is_valid = 0;
+        a->frame_index = 0; // we'll be starting over...
+        a->measurement_data_is_valid = 0;
         *delay = 0;
     }
 
-    stall_monitor_start_time = 0; // zero if not initialised / not started / zeroed by flush
-    stall_monitor_frame_count = 0; // set to delay at start of time, incremented by any writes
+    a->stall_monitor_start_time = 0; // zero if not initialised / not started / zeroed by flush
+    a->stall_monitor_frame_count = 0; // set to delay at start of time, incremented by any writes
 
     return ret;
 }
 
-int precision_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
+int precision_delay_and_status(alsa_instance * a, snd_pcm_state_t * state, snd_pcm_sframes_t * delay,
                                yndk_type * using_update_timestamps)
 {
     snd_pcm_status_t * alsa_snd_pcm_status;
@@ -1703,7 +1967,7 @@ int precision_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * dela
     struct timespec tn;              // time now
     snd_htimestamp_t update_timestamp; // actually a struct timespec
 
-    int ret = snd_pcm_status(alsa_handle, alsa_snd_pcm_status);
+    int ret = snd_pcm_status(a->alsa_handle, alsa_snd_pcm_status);
 
     if (ret == 0)
     {
@@ -1745,25 +2009,25 @@ int precision_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * dela
             // user information
             if (update_timestamp_ns == 0)
             {
-                if (delay_type_notified != 1)
+                if (a->delay_type_notified != 1)
                 {
                     debug(2, "alsa: update timestamps unavailable");
-                    delay_type_notified = 1;
+                    a->delay_type_notified = 1;
                 }
             }
             else
             {
                 // diagnostic
-                if (delay_type_notified != 0)
+                if (a->delay_type_notified != 0)
                 {
                     debug(2, "alsa: update timestamps available");
-                    delay_type_notified = 0;
+                    a->delay_type_notified = 0;
                 }
             }
 
             if (update_timestamp_ns == 0)
             {
-                ret = snd_pcm_delay(alsa_handle, delay);
+                ret = snd_pcm_delay(a->alsa_handle, delay);
             }
             else
             {
@@ -1779,7 +2043,7 @@ int precision_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * dela
                  #endif
                  */
 
-                if (use_monotonic_clock) clock_gettime(CLOCK_MONOTONIC, &tn);
+                if (a->use_monotonic_clock) clock_gettime(CLOCK_MONOTONIC, &tn);
                 else clock_gettime(CLOCK_REALTIME, &tn);
 
                 // uint64_t time_now_ns = tn.tv_sec * (uint64_t)1000000000 + tn.tv_nsec;
@@ -1790,32 +2054,32 @@ int precision_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * dela
 
                 // see if it's stalled
 
-                if ((stall_monitor_start_time != 0) && (stall_monitor_frame_count == delay_temp))
+                if ((a->stall_monitor_start_time != 0) && (a->stall_monitor_frame_count == delay_temp))
                 {
                     // hasn't outputted anything since the last call to delay()
 
-                    if (((update_timestamp_ns - stall_monitor_start_time) > stall_monitor_error_threshold) ||
-                        ((time_now_ns - stall_monitor_start_time) > stall_monitor_error_threshold))
+                    if (((update_timestamp_ns - a->stall_monitor_start_time) > a->stall_monitor_error_threshold) ||
+                        ((time_now_ns - a->stall_monitor_start_time) > a->stall_monitor_error_threshold))
                     {
                         debug(2,
                               "DAC seems to have stalled with time_now_ns: %" PRIX64
                               ", update_timestamp_ns: %" PRIX64 ", stall_monitor_start_time %" PRIX64
                               ", stall_monitor_error_threshold %" PRIX64 ".",
-                              time_now_ns, update_timestamp_ns, stall_monitor_start_time,
-                              stall_monitor_error_threshold);
+                              time_now_ns, update_timestamp_ns, a->stall_monitor_start_time,
+                              a->stall_monitor_error_threshold);
                         debug(2,
                               "DAC seems to have stalled with time_now: %lx,%lx"
                               ", update_timestamp: %lx,%lx, stall_monitor_start_time %" PRIX64
                               ", stall_monitor_error_threshold %" PRIX64 ".",
                               tn.tv_sec, tn.tv_nsec, update_timestamp.tv_sec, update_timestamp.tv_nsec,
-                              stall_monitor_start_time, stall_monitor_error_threshold);
+                              a->stall_monitor_start_time, a->stall_monitor_error_threshold);
                         ret = sps_extra_code_output_stalled;
                     }
                 }
                 else
                 {
-                    stall_monitor_start_time = update_timestamp_ns;
-                    stall_monitor_frame_count = delay_temp;
+                    a->stall_monitor_start_time = update_timestamp_ns;
+                    a->stall_monitor_frame_count = delay_temp;
                 }
 
                 if (ret == 0)
@@ -1825,7 +2089,7 @@ int precision_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * dela
 //          uint64_t frames_played_since_last_interrupt =
 //              ((uint64_t)config.output_rate * delta) / 1000000000;
 
-                    uint64_t frames_played_since_last_interrupt = config.output_rate;
+                    uint64_t frames_played_since_last_interrupt = a->output_rate;
                     frames_played_since_last_interrupt = frames_played_since_last_interrupt * delta;
                     frames_played_since_last_interrupt = frames_played_since_last_interrupt / 1000000000;
 
@@ -1845,13 +2109,13 @@ int precision_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * dela
              // stall
         {
             *delay = 0;
-            stall_monitor_start_time = 0; // zero if not initialised / not started / zeroed by flush
-            stall_monitor_frame_count = 0; // set to delay at start of time, incremented by any writes
+            a->stall_monitor_start_time = 0; // zero if not initialised / not started / zeroed by flush
+            a->stall_monitor_frame_count = 0; // set to delay at start of time, incremented by any writes
 
             // not running, thus no delay information, thus can't check for frame
             // rates
-            frame_index = 0; // we'll be starting over...
-            measurement_data_is_valid = 0;
+            a->frame_index = 0; // we'll be starting over...
+            a->measurement_data_is_valid = 0;
         }
     }
     else
@@ -1862,7 +2126,35 @@ int precision_delay_and_status(snd_pcm_state_t * state, snd_pcm_sframes_t * dela
     return ret;
 }
 
-int delay(long * the_delay)
+// called by the writer thread after everything it does to the device
+static void alsa_snapshot_publish(alsa_instance * a)
+{
+    alsa_delay_snapshot snapshot;
+
+    snapshot.delay = 0;
+    snapshot.ring_tail = a->alsa_ring_tail;
+
+    if (a->alsa_handle == NULL)
+    {
+        snapshot.status = ENODEV;
+    }
+    else
+    {
+        snd_pcm_state_t state = SND_PCM_STATE_OPEN;
+        snapshot.status = a->delay_and_status(a, &state, &snapshot.delay, NULL);
+
+        if ((state != SND_PCM_STATE_RUNNING) && (state != SND_PCM_STATE_DRAINING)) snapshot.delay = 0;
+    }
+
+    snapshot.time = get_absolute_time_in_ns();
+
+    __atomic_store_n(&a->alsa_snapshot_sequence, a->alsa_snapshot_sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    a->alsa_snapshot = snapshot;
+    __atomic_store_n(&a->alsa_snapshot_sequence, a->alsa_snapshot_sequence + 1, __ATOMIC_RELEASE);
+}
+
+int delay(alsa_instance * a, long * the_delay)
 {
     // returns 0 if the device is in a valid state -- SND_PCM_STATE_RUNNING or
     // SND_PCM_STATE_PREPARED
@@ -1873,39 +2165,55 @@ int delay(long * the_delay)
     // the error code could be a Unix errno code or a snderror code, or
     // the sps_extra_code_output_stalled or the
     // sps_extra_code_output_state_cannot_make_ready codes
-    int ret = 0;
 
-    *the_delay = 0;
+    // this doesn't go near the device -- it works from the delay last published by the writer
+    // thread, less what has played since, plus what has been put in the ring since
+    alsa_delay_snapshot snapshot;
+    unsigned int sequence;
 
-    int oldState;
+    do
+    {
+        sequence = __atomic_load_n(&a->alsa_snapshot_sequence, __ATOMIC_ACQUIRE);
+        snapshot = a->alsa_snapshot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (((sequence & 1) != 0) ||
+             (sequence != __atomic_load_n(&a->alsa_snapshot_sequence, __ATOMIC_RELAXED)));
 
-    snd_pcm_state_t state;
-    snd_pcm_sframes_t my_delay = 0; // this initialisation is to silence a clang warning
+    *the_delay = 0;
 
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
-    pthread_cleanup_debug_mutex_lock(&alsa_mutex, 10000, 0);
+    if (snapshot.status == 0)
+    {
+        // the device's delay is zero if it isn't running yet, but what's in the ring must still be
+        // counted, as it's to be played before anything sent now
+        snd_pcm_sframes_t device_delay = 0;
 
-    if (alsa_handle == NULL) ret = ENODEV;
-    else ret = delay_and_status(&state, &my_delay, NULL);
+        if (snapshot.delay != 0)
+        {
+            uint64_t frames_played_since = get_absolute_time_in_ns() - snapshot.time;
+            frames_played_since = frames_played_since * a->output_rate;
+            frames_played_since = frames_played_since / 1000000000;
 
-    debug_mutex_unlock(&alsa_mutex, 0);
-    pthread_cleanup_pop(0);
-    pthread_setcancelstate(oldState, NULL);
+            device_delay = snapshot.delay - (snd_pcm_sframes_t)frames_played_since;
 
-    *the_delay = my_delay; // note: snd_pcm_sframes_t is a long
+            if (device_delay < 0) device_delay = 0;
+        }
 
-    return ret;
+        // note: snd_pcm_sframes_t is a long
+        *the_delay = device_delay + (long)(a->alsa_ring_head - snapshot.ring_tail);
+    }
+
+    return snapshot.status;
 }
 
-int get_rate_information(uint64_t * elapsed_time, uint64_t * frames_played)
+int get_rate_information(alsa_instance * a, uint64_t * elapsed_time, uint64_t * frames_played)
 {
     // elapsed_time is in nanoseconds
     int response = 0; // zero means okay
 
-    if (measurement_data_is_valid)
+    if (a->measurement_data_is_valid)
     {
-        *elapsed_time = measurement_time - measurement_start_time;
-        *frames_played = frames_played_at_measurement_time - frames_played_at_measurement_start_time;
+        *elapsed_time = a->measurement_time - a->measurement_start_time;
+        *frames_played = a->frames_played_at_measurement_time - a->frames_played_at_measurement_start_time;
     }
     else
     {
@@ -1917,9 +2225,44 @@ int get_rate_information(uint64_t * elapsed_time, uint64_t * frames_played)
     return response;
 }
 
-int do_play(void * buf, int samples)
+// keep track of what's been written, for the stall monitor and the rate measurements
+static void note_frames_written(alsa_instance * a, int samples, snd_pcm_sframes_t my_delay)
 {
-    // assuming the alsa_mutex has been acquired
+    a->stall_monitor_frame_count += samples;
+
+    if (a->frame_index == 0)
+    {
+        a->frames_sent_for_playing = samples;
+    }
+    else
+    {
+        a->frames_sent_for_playing += samples;
+    }
+
+    const uint64_t start_measurement_from_this_frame =
+        (2 * a->output_rate) / 352; // two seconds of frames
+
+    a->frame_index++;
+
+    if ((a->frame_index == start_measurement_from_this_frame) ||
+        ((a->frame_index > start_measurement_from_this_frame) && (a->frame_index % 32 == 0)))
+    {
+        a->measurement_time = get_absolute_time_in_ns();
+        a->frames_played_at_measurement_time = a->frames_sent_for_playing - my_delay - samples;
+
+        if (a->frame_index == start_measurement_from_this_frame)
+        {
+            // debug(1, "Start frame counting");
+            a->frames_played_at_measurement_start_time = a->frames_played_at_measurement_time;
+            a->measurement_start_time = a->measurement_time;
+            a->measurement_data_is_valid = 1;
+        }
+    }
+}
+
+int do_play(alsa_instance * a, void * buf, int samples)
+{
+    // assuming this is the writer thread
     // debug(3,"audio_alsa play called.");
     int oldState;
 
@@ -1927,7 +2270,7 @@ int do_play(void * buf, int samples)
 
     snd_pcm_state_t state;
     snd_pcm_sframes_t my_delay;
-    int ret = delay_and_status(&state, &my_delay, NULL);
+    int ret = a->delay_and_status(a, &state, &my_delay, NULL);
 
     if (ret == 0) // will be non-zero if an error or a stall
     {
@@ -1942,50 +2285,21 @@ int do_play(void * buf, int samples)
             }
 
             // debug(3, "write %d frames.", samples);
-            ret = alsa_pcm_write(alsa_handle, buf, samples);
+            ret = a->alsa_pcm_write(a->alsa_handle, buf, samples);
 
             if (ret == samples)
             {
-                stall_monitor_frame_count += samples;
-
-                if (frame_index == 0)
-                {
-                    frames_sent_for_playing = samples;
-                }
-                else
-                {
-                    frames_sent_for_playing += samples;
-                }
-
-                const uint64_t start_measurement_from_this_frame =
-                    (2 * config.output_rate) / 352; // two seconds of frames
-
-                frame_index++;
-
-                if ((frame_index == start_measurement_from_this_frame) ||
-                    ((frame_index > start_measurement_from_this_frame) && (frame_index % 32 == 0)))
-                {
-                    measurement_time = get_absolute_time_in_ns();
-                    frames_played_at_measurement_time = frames_sent_for_playing - my_delay - samples;
-
-                    if (frame_index == start_measurement_from_this_frame)
-                    {
-                        // debug(1, "Start frame counting");
-                        frames_played_at_measurement_start_time = frames_played_at_measurement_time;
-                        measurement_start_time = measurement_time;
-                        measurement_data_is_valid = 1;
-                    }
-                }
+                note_frames_written(a, samples, my_delay);
             }
             else
             {
-                frame_index = 0;
-                measurement_data_is_valid = 0;
+                a->frame_index = 0;
+                a->measurement_data_is_valid = 0;
 
                 if (ret == -EPIPE) /* underrun */
                 {
                     debug(1, "alsa: underrun while writing %d samples to alsa device.", samples);
-                    int tret = snd_pcm_recover(alsa_handle, ret, 1);
+                    int tret = snd_pcm_recover(a->alsa_handle, ret, 1);
 
                     if (tret < 0)
                     {
@@ -1997,7 +2311,7 @@ int do_play(void * buf, int samples)
                     debug(1, "alsa: suspended while writing %d samples to alsa device.", samples);
                     int tret;
 
-                    while ((tret = snd_pcm_resume(alsa_handle)) == -EAGAIN)
+                    while ((tret = snd_pcm_resume(a->alsa_handle)) == -EAGAIN)
                     {
                         sleep(1); /* wait until the suspend flag is released */
 
@@ -2026,41 +2340,41 @@ int do_play(void * buf, int samples)
               "alsa: device status returns fault status %d and SND_PCM_STATE_* "
               "%d  for play.",
               ret, state);
-        frame_index = 0;
-        measurement_data_is_valid = 0;
+        a->frame_index = 0;
+        a->measurement_data_is_valid = 0;
     }
 
     pthread_setcancelstate(oldState, NULL);
     return ret;
 }
 
-int do_open(int do_auto_setup)
+int do_open(alsa_instance * a, int do_auto_setup)
 {
     int ret = 0;
 
-    if (alsa_backend_state != abm_disconnected) debug(1, "alsa: do_open() -- opening the output device when it is already "
+    if (a->alsa_backend_state != abm_disconnected) debug(1, "alsa: do_open() -- opening the output device when it is already "
                                                       "connected");
 
-    if (alsa_handle == NULL)
+    if (a->alsa_handle == NULL)
     {
         // debug(1,"alsa: do_open() -- opening the output device");
-        ret = open_alsa_device(do_auto_setup);
+        ret = open_alsa_device(a, do_auto_setup);
 
         if (ret == 0)
         {
-            mute_requested_internally = 0;
+            a->mute_requested_internally = 0;
 
-            if (audio_alsa.volume) do_volume(set_volume);
+            if (a->backend->volume) do_volume(a, a->set_volume);
 
-            if (audio_alsa.mute)
+            if (a->backend->mute)
             {
                 debug(2, "do_open() set_mute_state");
-                set_mute_state(); // the mute_requested_externally flag will have been
+                set_mute_state(a); // the mute_requested_externally flag will have been
                                   // set accordingly
                 // do_mute(0); // complete unmute
             }
 
-            alsa_backend_state = abm_connected; // only do this if it really opened it.
+            a->alsa_backend_state = abm_connected; // only do this if it really opened it.
         }
     }
     else
@@ -2071,183 +2385,298 @@ int do_open(int do_auto_setup)
     return ret;
 }
 
-int do_close()
+int do_close(alsa_instance * a)
 {
-    if (alsa_backend_state == abm_disconnected) debug(1, "alsa: do_close() -- closing the output device when it is already "
+    if (a->alsa_backend_state == abm_disconnected) debug(1, "alsa: do_close() -- closing the output device when it is already "
                                                       "disconnected");
 
     int derr = 0;
 
-    if (alsa_handle)
+    if (a->alsa_handle)
     {
         // debug(1,"alsa: do_close() -- closing the output device");
-        if ((derr = snd_pcm_drop(alsa_handle))) debug(1, "Error %d (\"%s\") dropping output device.", derr, snd_strerror(derr));
+        if ((derr = snd_pcm_drop(a->alsa_handle))) debug(1, "Error %d (\"%s\") dropping output device.", derr, snd_strerror(derr));
 
         usleep(5000);
 
-        if ((derr = snd_pcm_hw_free(alsa_handle))) debug(1, "Error %d (\"%s\") freeing the output device hardware.", derr, snd_strerror(derr));
+        if ((derr = snd_pcm_hw_free(a->alsa_handle))) debug(1, "Error %d (\"%s\") freeing the output device hardware.", derr, snd_strerror(derr));
 
         // flush also closes the device
         debug(2, "alsa: do_close() -- closing alsa handle");
 
-        if ((derr = snd_pcm_close(alsa_handle))) debug(1, "Error %d (\"%s\") closing the output device.", derr, snd_strerror(derr));
+        if ((derr = snd_pcm_close(a->alsa_handle))) debug(1, "Error %d (\"%s\") closing the output device.", derr, snd_strerror(derr));
 
-        alsa_handle = NULL;
+        a->alsa_handle = NULL;
     }
     else
     {
         debug(1, "alsa: do_close() -- output device already closed.");
     }
 
-    alsa_backend_state = abm_disconnected;
+    a->alsa_backend_state = abm_disconnected;
     return derr;
 }
 
-int play(void * buf, int samples)
+static void alsa_writer_wake(alsa_instance * a)
 {
-    // play() will change the state of the alsa_backend_mode to abm_playing
-    // also, if the present alsa_backend_state is abm_disconnected, then first the
-    // DAC must be
-    // connected
+    char c = 0;
 
-    // debug(3,"audio_alsa play called.");
-    int ret = 0;
+    if ((write(a->alsa_wake_pipe[1], &c, 1) < 0) && (errno != EAGAIN))
+        debug(1, "alsa: error %d waking the writer thread.", errno);
+}
 
-    pthread_cleanup_debug_mutex_lock(&alsa_mutex, 50000, 0);
+// ask the writer thread to do something, and wait until it has
+static void alsa_writer_request(alsa_instance * a, int * requested, int * done)
+{
+    int oldState;
 
-    if (alsa_backend_state == abm_disconnected)
-    {
-        ret = do_open(0); // don't try to auto setup
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
+    pthread_mutex_lock(&a->alsa_request_mutex);
+    int request = ++(*requested);
+    alsa_writer_wake(a);
 
-        if (ret == 0) debug(2, "alsa: play() -- opened output device");
-    }
+    while ((*done - request) < 0) pthread_cond_wait(&a->alsa_request_cv, &a->alsa_request_mutex);
 
-    if (ret == 0)
+    pthread_mutex_unlock(&a->alsa_request_mutex);
+    pthread_setcancelstate(oldState, NULL);
+}
+
+// the frames at the head of the ring are ready -- hand them over to the writer thread
+static void alsa_ring_commit(alsa_instance * a, int samples)
+{
+    __atomic_store_n(&a->alsa_ring_head, a->alsa_ring_head + samples, __ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&a->alsa_writer_idle, 0, __ATOMIC_SEQ_CST)) alsa_writer_wake(a);
+}
+
+static uint64_t alsa_ring_space(alsa_instance * a)
+{
+    return ALSA_RING_FRAMES - (a->alsa_ring_head - __atomic_load_n(&a->alsa_ring_tail, __ATOMIC_ACQUIRE));
+}
+
+int play(alsa_instance * a, void * buf, int samples)
+{
+    // this just puts the frames in the ring. The writer thread will open the device if necessary,
+    // change the alsa_backend_mode to abm_playing and write them to it
+    int ret = 0;
+
+    if (samples > 0)
     {
-        if (alsa_backend_state != abm_playing)
+        if ((uint64_t)samples > alsa_ring_space(a))
         {
-            debug(2, "alsa: play() -- alsa_backend_state => abm_playing");
-            alsa_backend_state = abm_playing;
-
-            // mute_requested_internally = 0; // stop requesting a mute for backend's own
-            // reasons, which might have been a flush
-            // debug(2, "play() set_mute_state");
-            // set_mute_state(); // try to action the request and return a status
-            // do_mute(0); // unmute for backend's reason
+            debug(1, "alsa: the output ring is full -- %d frames dropped.", samples);
+            ret = -ENOSPC;
         }
+        else
+        {
+            size_t index = a->alsa_ring_head & (ALSA_RING_FRAMES - 1);
+            size_t first_part = ALSA_RING_FRAMES - index;
 
-        ret = do_play(buf, samples);
+            if (first_part > (size_t)samples) first_part = samples;
+
+            memcpy(a->alsa_ring + index * a->frame_size, buf, first_part * a->frame_size);
+
+            if (first_part < (size_t)samples) memcpy(a->alsa_ring, (char *)buf + first_part * a->frame_size,
+                                                     (samples - first_part) * a->frame_size);
+
+            alsa_ring_commit(a, samples);
+        }
     }
 
-    debug_mutex_unlock(&alsa_mutex, 0);
-    pthread_cleanup_pop(0); // release the mutex
     return ret;
 }
 
-int prepare(void)
+static int get_buffer(alsa_instance * a, void ** buf, int samples)
+{
+    // offer the space at the head of the ring, if there's room for the samples in one piece --
+    // the player formats its output straight into it and the writer thread copies it to the device
+    size_t index = a->alsa_ring_head & (ALSA_RING_FRAMES - 1);
+
+    if ((a->alsa_ring == NULL) || (a->frame_size == 0) || ((uint64_t)samples > alsa_ring_space(a)) ||
+        (index + samples > ALSA_RING_FRAMES)) return -1;
+
+    *buf = a->alsa_ring + index * a->frame_size;
+    return 0;
+}
+
+static int commit_buffer(alsa_instance * a, int samples)
+{
+    if (samples > 0) alsa_ring_commit(a, samples);
+
+    return 0;
+}
+
+int prepare(alsa_instance * a)
 {
     // this will leave the DAC open / connected.
+    // the writer thread opens it, if necessary, and this waits for it to be done
+    alsa_writer_request(a, &a->alsa_prepare_requested, &a->alsa_prepare_done);
+    return a->alsa_prepare_result;
+}
+
+static void flush(alsa_instance * a)
+{
+    // debug(2,"audio_alsa flush called.");
+    // the writer thread discards whatever is in the ring and stops playing
+    alsa_writer_request(a, &a->alsa_flush_requested, &a->alsa_flush_done);
+}
+
+// these are done by the writer thread
+
+static int writer_prepare(alsa_instance * a)
+{
     int ret = 0;
 
-    pthread_cleanup_debug_mutex_lock(&alsa_mutex, 50000, 0);
+    a->alsa_prepared_time = get_absolute_time_in_ns();
 
-    if (alsa_backend_state == abm_disconnected)
+    if (a->alsa_backend_state == abm_disconnected)
     {
-        if (alsa_device_initialised == 0)
+        if (a->alsa_device_initialised == 0)
         {
             // debug(1, "alsa: prepare() calling alsa_device_init.");
-            alsa_device_init();
-            alsa_device_initialised = 1;
+            alsa_device_init(a);
+            a->alsa_device_initialised = 1;
         }
 
-        ret = do_open(1); // do auto setup
+        ret = do_open(a, 1); // do auto setup
 
         if (ret == 0) debug(2, "alsa: prepare() -- opened output device");
     }
 
-    debug_mutex_unlock(&alsa_mutex, 0);
-    pthread_cleanup_pop(0); // release the mutex
     return ret;
 }
 
-static void flush(void)
+static void writer_flush(alsa_instance * a)
 {
-    // debug(2,"audio_alsa flush called.");
-    pthread_cleanup_debug_mutex_lock(&alsa_mutex, 10000, 1);
+    // the requester is waiting for this, so nothing is being added to the ring
+    __atomic_store_n(&a->alsa_ring_tail, __atomic_load_n(&a->alsa_ring_head, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
 
     // mute_requested_internally = 1; // request a mute for backend's reasons
     // debug(2, "flush() set_mute_state");
     // set_mute_state();
     // do_mute(1); // mute for backend's own reasons
-    if (alsa_backend_state != abm_disconnected) // must be playing or connected...
+    if (a->alsa_backend_state != abm_disconnected) // must be playing or connected...
     {
-        if (config.keep_dac_busy != 0)
+        if (alsa_keep_dac_busy(a) != 0)
         {
             debug(2, "alsa: flush() -- alsa_backend_state => abm_connected.");
-            alsa_backend_state = abm_connected;
+            a->alsa_backend_state = abm_connected;
         }
         else
         {
             debug(2, "alsa: flush() -- closing the output device");
-            do_close(); // will change the state to disconnected
+            do_close(a); // will change the state to disconnected
             debug(2, "alsa: flush() -- alsa_backend_state => abm_disconnected.");
         }
     }
     else debug(3, "alsa: flush() -- called on a disconnected alsa backend");
+}
 
-    debug_mutex_unlock(&alsa_mutex, 3);
-    pthread_cleanup_pop(0); // release the mutex
+static void writer_do_requests(alsa_instance * a)
+{
+    pthread_mutex_lock(&a->alsa_request_mutex);
+    int flush_requested = a->alsa_flush_requested;
+    int prepare_requested = a->alsa_prepare_requested;
+    pthread_mutex_unlock(&a->alsa_request_mutex);
+
+    if ((flush_requested != a->alsa_flush_done) || (prepare_requested != a->alsa_prepare_done))
+    {
+        int prepare_result = a->alsa_prepare_result;
+
+        if (flush_requested != a->alsa_flush_done) writer_flush(a);
+
+        if (prepare_requested != a->alsa_prepare_done) prepare_result = writer_prepare(a);
+
+        alsa_snapshot_publish(a); // so that the requester sees the new state of the device
+
+        pthread_mutex_lock(&a->alsa_request_mutex);
+        a->alsa_flush_done = flush_requested;
+        a->alsa_prepare_done = prepare_requested;
+        a->alsa_prepare_result = prepare_result;
+        pthread_cond_broadcast(&a->alsa_request_cv);
+        pthread_mutex_unlock(&a->alsa_request_mutex);
+    }
 }
 
-static void stop(void)
+static void stop(alsa_instance * a)
 {
     // debug(2,"audio_alsa stop called.");
-    flush(); // flush will also close the device if appropriate
+    a->session_active = 0;
+    flush(a); // flush will also close the device if appropriate
+}
+
+static void output_format(alsa_instance * a, int * format, unsigned int * rate)
+{
+    *format = a->output_format;
+    *rate = a->output_rate;
+}
+
+static audio_output * new_instance(const char * section)
+{
+    alsa_instance * a = NULL;
+
+    pthread_mutex_lock(&alsa_instance_lock);
+
+    if (alsa_instance_count < ALSA_MAXIMUM_INSTANCES)
+    {
+        a = &alsa_instances[alsa_instance_count];
+        a->index = alsa_instance_count;
+        a->stanza = strdup(section);
+        a->backend = &alsa_instance_outputs[alsa_instance_count];
+        alsa_instance_count++;
+    }
+
+    pthread_mutex_unlock(&alsa_instance_lock);
+
+    if (a == NULL) return NULL;
+
+    debug(2, "alsa: instance %d reads its settings from \"%s\".", a->index, a->stanza);
+    return a->backend;
 }
 
-static void parameters(audio_parameters * info)
+static void parameters(alsa_instance * a, audio_parameters * info)
 {
-    info->minimum_volume_dB = alsa_mix_mindb;
-    info->maximum_volume_dB = alsa_mix_maxdb;
+    info->minimum_volume_dB = a->alsa_mix_mindb;
+    info->maximum_volume_dB = a->alsa_mix_maxdb;
 }
 
-void do_volume(double vol)   // caller is assumed to have the alsa_mutex when
-                             // using this function
+void do_volume(alsa_instance * a, double vol)
 {
     debug(3, "Setting volume db to %f.", vol);
     int oldState;
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
-    set_volume = vol;
-    pthread_cleanup_debug_mutex_lock(&alsa_mixer_mutex, 1000, 1);
+    a->set_volume = vol;
+    pthread_cleanup_debug_mutex_lock(&a->alsa_mixer_mutex, 1000, 1);
 
-    if (volume_set_request && (open_mixer() == 1))
+    if (a->volume_set_request && (open_mixer(a) == 1))
     {
-        if (has_softvol)
+        if (a->has_softvol)
         {
-            if (ctl && elem_id)
+            if (a->ctl && a->elem_id)
             {
                 snd_ctl_elem_value_t * value;
                 long raw;
 
-                if (snd_ctl_convert_from_dB(ctl, elem_id, vol, &raw, 0) < 0) debug(1, "Failed converting dB gain to raw volume value for the "
+                if (snd_ctl_convert_from_dB(a->ctl, a->elem_id, vol, &raw, 0) < 0) debug(1, "Failed converting dB gain to raw volume value for the "
                                                                                    "software volume control.");
 
                 snd_ctl_elem_value_alloca(&value);
-                snd_ctl_elem_value_set_id(value, elem_id);
+                snd_ctl_elem_value_set_id(value, a->elem_id);
                 snd_ctl_elem_value_set_integer(value, 0, raw);
                 snd_ctl_elem_value_set_integer(value, 1, raw);
 
-                if (snd_ctl_elem_write(ctl, value) < 0) debug(1, "Failed to set playback dB volume for the software volume "
+                if (snd_ctl_elem_write(a->ctl, value) < 0) debug(1, "Failed to set playback dB volume for the software volume "
                                                               "control.");
             }
         }
         else
         {
-            if (volume_based_mute_is_active == 0)
+            if (a->volume_based_mute_is_active == 0)
             {
                 // debug(1,"Set alsa volume.");
-                do_snd_mixer_selem_set_playback_dB_all(alsa_mix_elem, vol);
+                do_snd_mixer_selem_set_playback_dB_all(a->alsa_mix_elem, vol);
             }
             else
             {
@@ -2255,19 +2684,19 @@ void do_volume(double vol)   // caller is assumed to have the alsa_mutex when
             }
         }
 
-        volume_set_request = 0; // any external request that has been made is now satisfied
-        close_mixer();
+        a->volume_set_request = 0; // any external request that has been made is now satisfied
+        close_mixer(a);
     }
 
-    debug_mutex_unlock(&alsa_mixer_mutex, 3);
+    debug_mutex_unlock(&a->alsa_mixer_mutex, 3);
     pthread_cleanup_pop(0); // release the mutex
     pthread_setcancelstate(oldState, NULL);
 }
 
-void volume(double vol)
+void volume(alsa_instance * a, double vol)
 {
-    volume_set_request = 1; // an external request has been made to set the volume
-    do_volume(vol);
+    a->volume_set_request = 1; // an external request has been made to set the volume
+    do_volume(a, vol);
 }
 
 /*
@@ -2289,13 +2718,13 @@ void volume(double vol)
    }
  */
 
-int mute(int mute_state_requested)                  // these would be for external reasons, not
+int mute(alsa_instance * a, int mute_state_requested)                  // these would be for external reasons, not
                                                     // because of the
                                                     // state of the backend.
 {
-    mute_requested_externally = mute_state_requested; // request a mute for external reasons
+    a->mute_requested_externally = mute_state_requested; // request a mute for external reasons
     debug(2, "mute(%d) set_mute_state", mute_state_requested);
-    return set_mute_state();
+    return set_mute_state(a);
 }
 
 /*
@@ -2305,65 +2734,210 @@ int mute(int mute_state_requested)                  // these would be for extern
    }
  */
 
-void * alsa_buffer_monitor_thread_code(__attribute__((unused)) void * arg)
+// how long the writer thread can wait, in milliseconds, if nothing wakes it sooner
+static int writer_wait_time(alsa_instance * a, int waiting_for_room, int filling_with_silence)
+{
+    int scan_interval_ms = (int)(a->disable_standby_mode_silence_scan_interval * 1000);
+
+    if (scan_interval_ms < 1) scan_interval_ms = 1;
+
+    uint64_t wait_time = ALSA_WRITER_MAXIMUM_WAIT_TIME; // nanoseconds
+
+    if ((waiting_for_room != 0) || (a->alsa_backend_state == abm_playing))
+    {
+        // keep an eye on the device, e.g. for stalls
+        wait_time = (uint64_t)scan_interval_ms * 1000000;
+    }
+    else if (a->alsa_backend_state == abm_connected)
+    {
+        if (filling_with_silence)
+        {
+            // wake when the output buffer should be down to the threshold
+            long frames_above_threshold =
+                a->alsa_snapshot.delay - (long)(a->disable_standby_mode_silence_threshold * a->output_rate);
+
+            if (frames_above_threshold > 0)
+            {
+                uint64_t time_above_threshold = frames_above_threshold;
+                time_above_threshold = time_above_threshold * 1000000000;
+                time_above_threshold = time_above_threshold / a->output_rate;
+
+                if (time_above_threshold < wait_time) wait_time = time_above_threshold;
+            }
+            else
+            {
+                wait_time = 0;
+            }
+        }
+        else if (a->alsa_prepared_time != 0)
+        {
+            // wake when the device can be closed
+            uint64_t time_held = get_absolute_time_in_ns() - a->alsa_prepared_time;
+
+            if (time_held < ALSA_PREPARED_HOLD_TIME)
+            {
+                if (ALSA_PREPARED_HOLD_TIME - time_held < wait_time) wait_time = ALSA_PREPARED_HOLD_TIME - time_held;
+            }
+            else
+            {
+                wait_time = 0;
+            }
+        }
+    }
+
+    int wait_time_ms = (int)((wait_time + 999999) / 1000000);
+
+    if (wait_time_ms < scan_interval_ms) wait_time_ms = scan_interval_ms; // but not too often
+
+    return wait_time_ms;
+}
+
+static int do_play_with_context(void * context, void * buf, int samples)
 {
+    return do_play((alsa_instance *)context, buf, samples);
+}
+
+void * alsa_buffer_monitor_thread_code(void * arg)
+{
+    alsa_instance * a = (alsa_instance *)arg;
+    // this is the writer thread. It writes what's in the ring to the device, carries out prepare()
+    // and flush() and, if the DAC is to be kept busy, fills it with silence when there's nothing
+    // else to play
+    set_thread_scheduling(TC_output);
     int frame_count = 0;
     int error_count = 0;
-    int error_detected = 0;
+    int silence_filling_disabled = 0; // if too many play errors occur early on, we will turn off the
+                                      // disable standby mode
     int okb = -1;
+    struct pollfd fds[ALSA_WRITER_MAXIMUM_POLL_DESCRIPTORS + 1]; // the wake pipe is first
 
-    while (error_detected ==
-           0) // if too many play errors occur early on, we will turn off the disable stanby mode
+    while (1)
     {
-        if (okb != config.keep_dac_busy)
+        if (okb != alsa_keep_dac_busy(a))
         {
-            debug(2, "keep_dac_busy is now \"%s\"", config.keep_dac_busy == 0 ? "no" : "yes");
-            okb = config.keep_dac_busy;
+            debug(2, "keep_dac_busy is now \"%s\"", alsa_keep_dac_busy(a) == 0 ? "no" : "yes");
+            okb = alsa_keep_dac_busy(a);
         }
 
-        if ((config.keep_dac_busy != 0) && (alsa_device_initialised == 0))
+        if ((alsa_keep_dac_busy(a) != 0) && (a->alsa_device_initialised == 0))
         {
             debug(2, "alsa: alsa_buffer_monitor_thread_code() calling "
                   "alsa_device_init.");
-            alsa_device_init();
-            alsa_device_initialised = 1;
+            alsa_device_init(a);
+            a->alsa_device_initialised = 1;
         }
 
-        int sleep_time_us = (int)(config.disable_standby_mode_silence_scan_interval * 1000000);
-        pthread_cleanup_debug_mutex_lock(&alsa_mutex, 200000, 0);
+        int wait = 1;            // wait before going round again
+        int number_of_pcm_fds = 0; // if waiting for room in the device
+
+        writer_do_requests(a);
+
+        uint64_t fill = __atomic_load_n(&a->alsa_ring_head, __ATOMIC_ACQUIRE) - a->alsa_ring_tail;
 
         // check possible state transitions here
-        if ((alsa_backend_state == abm_disconnected) && (config.keep_dac_busy != 0))
+        if ((a->alsa_backend_state == abm_disconnected) && (fill != 0))
+        {
+            if (do_open(a, 0) == 0) // don't try to auto setup
+            {
+                debug(2, "alsa: alsa_buffer_monitor_thread_code() -- opened output device to play");
+            }
+            else
+            {
+                debug(1, "alsa: can't open the output device -- %" PRIu64 " frames discarded.", fill);
+                __atomic_store_n(&a->alsa_ring_tail, a->alsa_ring_tail + fill, __ATOMIC_RELEASE);
+                fill = 0;
+            }
+        }
+        else if ((a->alsa_backend_state == abm_disconnected) && (alsa_keep_dac_busy(a) != 0))
         {
             // open the dac and move to abm_connected mode
-            if (do_open(1) == 0) // no automatic setup of rate and speed if necessary
+            if (do_open(a, 1) == 0) // no automatic setup of rate and speed if necessary
                 debug(2, "alsa: alsa_buffer_monitor_thread_code() -- output device opened; "
                       "alsa_backend_state => abm_connected");
         }
-        else if ((alsa_backend_state == abm_connected) && (config.keep_dac_busy == 0))
+        else if ((a->alsa_backend_state == abm_connected) && (fill == 0) && (alsa_keep_dac_busy(a) == 0) &&
+                 ((a->alsa_prepared_time == 0) ||
+                  (get_absolute_time_in_ns() - a->alsa_prepared_time > ALSA_PREPARED_HOLD_TIME)))
         {
-            stall_monitor_start_time = 0;
-            frame_index = 0;
-            measurement_data_is_valid = 0;
+            a->alsa_prepared_time = 0;
+            a->stall_monitor_start_time = 0;
+            a->frame_index = 0;
+            a->measurement_data_is_valid = 0;
             debug(2, "alsa: alsa_buffer_monitor_thread_code() -- closing the output "
                   "device");
-            do_close();
+            do_close(a);
             debug(2, "alsa: alsa_buffer_monitor_thread_code() -- alsa_backend_state "
                   "=> abm_disconnected");
         }
 
+        if ((fill != 0) && (a->alsa_backend_state != abm_disconnected))
+        {
+            if (a->alsa_backend_state != abm_playing)
+            {
+                debug(2, "alsa: alsa_buffer_monitor_thread_code() -- alsa_backend_state => abm_playing");
+                a->alsa_backend_state = abm_playing;
+                a->alsa_prepared_time = 0; // the device was wanted, and it's in use now
+            }
+
+            snd_pcm_sframes_t room = snd_pcm_avail_update(a->alsa_handle);
+
+            if (room < 0)
+            {
+                a->frame_index = 0;
+                a->measurement_data_is_valid = 0;
+                debug(1, "alsa: error %ld (\"%s\") checking for room in the output device.", room,
+                      snd_strerror(room));
+                int tret = snd_pcm_recover(a->alsa_handle, room, 1);
+
+                if (tret < 0)
+                {
+                    warn("alsa: can't recover the output device: %s -- %" PRIu64 " frames discarded.",
+                         snd_strerror(tret), fill);
+                    __atomic_store_n(&a->alsa_ring_tail, a->alsa_ring_tail + fill, __ATOMIC_RELEASE);
+                }
+                else
+                {
+                    wait = 0;
+                }
+            }
+            else if (room == 0)
+            {
+                // wait for the device to make room
+                number_of_pcm_fds =
+                    snd_pcm_poll_descriptors(a->alsa_handle, &fds[1], ALSA_WRITER_MAXIMUM_POLL_DESCRIPTORS);
+
+                if (number_of_pcm_fds < 0) number_of_pcm_fds = 0;
+            }
+            else
+            {
+                size_t index = a->alsa_ring_tail & (ALSA_RING_FRAMES - 1);
+                uint64_t frames = fill;
+
+                if (frames > (uint64_t)room) frames = room;
+
+                if (frames > ALSA_RING_FRAMES - index) frames = ALSA_RING_FRAMES - index;
+
+                int ret = do_play(a, a->alsa_ring + index * a->frame_size, (int)frames);
+
+                // frames that couldn't be written are dropped, as they always were
+                if ((ret > 0) && ((uint64_t)ret < frames)) frames = ret;
+
+                __atomic_store_n(&a->alsa_ring_tail, a->alsa_ring_tail + frames, __ATOMIC_RELEASE);
+                wait = 0; // see if there's any more
+            }
+        }
         // now, if the backend is not in the abm_disconnected state
         // and config.keep_dac_busy is true (at the present, this has to be the case
         // to be in the
         // abm_connected state in the first place...) then do the silence-filling
         // thing, if needed /* only if the output device is capable of precision delay */.
-        if ((alsa_backend_state != abm_disconnected) &&
-            (config.keep_dac_busy != 0) /* && precision_delay_available() */)
+        else if ((fill == 0) && (a->alsa_backend_state != abm_disconnected) &&
+                 (alsa_keep_dac_busy(a) != 0) && (silence_filling_disabled == 0) /* && precision_delay_available() */)
         {
             int reply;
             long buffer_size = 0;
             snd_pcm_state_t state;
-            reply = delay_and_status(&state, &buffer_size, NULL);
+            reply = a->delay_and_status(a, &state, &buffer_size, NULL);
 
             if (reply != 0)
             {
@@ -2375,37 +2949,31 @@ void * alsa_buffer_monitor_thread_code(__attribute__((unused)) void * arg)
             }
 
             long buffer_size_threshold =
-                (long)(config.disable_standby_mode_silence_threshold * config.output_rate);
-            size_t size_of_silence_buffer;
+                (long)(a->disable_standby_mode_silence_threshold * a->output_rate);
 
             if (buffer_size < buffer_size_threshold)
             {
-                int frames_of_silence = 1024;
-                size_of_silence_buffer = frames_of_silence * frame_size;
-                void * silence = malloc(size_of_silence_buffer);
+                int use_dither = 0;
+
+                if ((a->alsa_mix_ctrl == NULL) && (config.ignore_volume_control == 0) &&
+                    (config.airplay_volume != 0.0)) use_dither = 1;
 
-                if (silence == NULL)
+                if (silence_pool_prepare(&a->alsa_monitor_silence, ALSA_MONITOR_SILENCE_POOL_FRAMES,
+                                         process_block_writer_for_format(a->output_format), use_dither,
+                                         &a->dither_random_number_store) != 0)
                 {
                     warn("disable_standby_mode has been turned off because a memory allocation error "
                          "occurred.");
-                    error_detected = 1;
+                    silence_filling_disabled = 1;
                 }
                 else
                 {
-                    int ret;
-                    pthread_cleanup_push(malloc_cleanup, silence);
-                    int use_dither = 0;
-
-                    if ((alsa_mix_ctrl == NULL) && (config.ignore_volume_control == 0) &&
-                        (config.airplay_volume != 0.0)) use_dither = 1;
-
-                    dither_random_number_store =
-                        generate_zero_frames(silence, frames_of_silence, config.output_format,
-                                             use_dither, // i.e. with dither
-                                             dither_random_number_store);
-                    ret = do_play(silence, frames_of_silence);
+                    // top it up to a block of silence above the threshold, so that it'll be a
+                    // while before it needs more
+                    int silence_frames = (int)(buffer_size_threshold - buffer_size) + ALSA_MONITOR_SILENCE_FRAMES;
+                    int ret = silence_pool_play_with_context(&a->alsa_monitor_silence, silence_frames,
+                                                             &do_play_with_context, a);
                     frame_count++;
-                    pthread_cleanup_pop(1); // free malloced buffer
 
                     if (ret < 0)
                     {
@@ -2415,23 +2983,49 @@ void * alsa_buffer_monitor_thread_code(__attribute__((unused)) void * arg)
                         debug(2,
                               "alsa: alsa_buffer_monitor_thread_code error %d (\"%s\") writing %d samples "
                               "to alsa device -- %d errors in %d trials.",
-                              ret, (char *)errorstring, frames_of_silence, error_count, frame_count);
+                              ret, (char *)errorstring, silence_frames, error_count, frame_count);
 
                         if ((error_count > 40) && (frame_count < 100))
                         {
                             warn("disable_standby_mode has been turned off because too many underruns "
                                  "occurred. Is Shairport Sync outputting to a virtual device or running in a "
                                  "virtual machine?");
-                            error_detected = 1;
+                            silence_filling_disabled = 1;
                         }
                     }
                 }
             }
         }
 
-        debug_mutex_unlock(&alsa_mutex, 0);
-        pthread_cleanup_pop(0); // release the mutex
-        usleep(sleep_time_us); // has a cancellation point in it
+        alsa_snapshot_publish(a);
+
+        if (wait)
+        {
+            // anything put in the ring from now on will wake the writer
+            __atomic_store_n(&a->alsa_writer_idle, 1, __ATOMIC_SEQ_CST);
+
+            if ((number_of_pcm_fds == 0) &&
+                (__atomic_load_n(&a->alsa_ring_head, __ATOMIC_SEQ_CST) != a->alsa_ring_tail)) wait = 0;
+        }
+
+        if (wait)
+        {
+            fds[0].fd = a->alsa_wake_pipe[0];
+            fds[0].events = POLLIN;
+            int wait_time_ms =
+                writer_wait_time(a, number_of_pcm_fds, (alsa_keep_dac_busy(a) != 0) && (silence_filling_disabled == 0));
+
+            if ((poll(fds, number_of_pcm_fds + 1, wait_time_ms) > 0) && // has a cancellation point in it
+                (fds[0].revents & POLLIN))
+            {
+                char wakers[64];
+
+                while (read(a->alsa_wake_pipe[0], wakers, sizeof(wakers)) > 0)
+                    ;
+            }
+        }
+
+        __atomic_store_n(&a->alsa_writer_idle, 0, __ATOMIC_SEQ_CST);
     }
     pthread_exit(NULL);
 }
@@ -0,0 +1,560 @@
+/*
+ * Fan-out output driver. This file is part of Shairport Sync.
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The fan-out backend plays the player's output -- decoded, synchronised and processed once --
+// on several backends at the same time, e.g. a DAC and a pipe to a streaming server.
+// The first backend listed is the primary: the player synchronises to it, as it would if it
+// were the only backend, and it gets the player's blocks directly. Each of the others has a queue
+// and a writer thread, which plays every block when it's due -- that is, when the primary will
+// be playing it -- allowing for that backend's own delay, if it reports one, and for its
+// fanout_latency_offset_in_seconds setting.
+
+#include "audio.h"
+#include "common.h"
+#include "process_block.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FANOUT_MAXIMUM_BACKENDS 8
+#define FANOUT_QUEUE_BLOCKS     512 // packets -- about four seconds at 352 frames per packet
+
+typedef struct
+{
+    uint64_t due_time; // when the primary will play it, or 0 if that's not known
+    uint32_t rtp_timestamp; // as given to timing(), for backends that want it
+    uint64_t play_time;
+    int is_silence;
+    int frames;
+    size_t capacity;
+    char * data;
+} fanout_block;
+
+typedef struct
+{
+    audio_output * output;
+    sps_format_t format;           // the output format it was left with by its init()
+    int64_t latency_offset;        // nanoseconds, added to the time each block is due
+    int active;                    // whether it's being fed in this session -- used only by the player
+
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queue_cv;
+    fanout_block blocks[FANOUT_QUEUE_BLOCKS];
+    uint64_t head, tail;           // blocks in and out since the start
+    uint64_t generation;           // changed whenever the queue is discarded
+    uint64_t blocks_dropped;
+
+    pthread_mutex_t output_mutex;  // held while the writer thread is calling the backend
+    pthread_t writer_thread;
+} fanout_member;
+
+static fanout_member fanout_members[FANOUT_MAXIMUM_BACKENDS];
+static int fanout_member_count = 0;
+static audio_output * primary = NULL;
+static size_t fanout_bytes_per_frame;
+static uint32_t timing_rtp_timestamp; // from the latest call to timing()
+static uint64_t timing_play_time;
+static int timing_is_silence;
+
+extern audio_output audio_fanout;
+
+static void * fanout_writer_thread_code(void * arg)
+{
+    fanout_member * member = (fanout_member *)arg;
+    char * buffer = NULL;
+    size_t buffer_size = 0;
+
+    set_thread_scheduling(TC_output);
+
+    while (1)
+    {
+        int frames, is_silence;
+        uint32_t rtp_timestamp;
+        uint64_t due_time, block_play_time, generation;
+
+        pthread_mutex_lock(&member->queue_mutex);
+        pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&member->queue_mutex);
+
+        while (member->head == member->tail) pthread_cond_wait(&member->queue_cv, &member->queue_mutex); // a cancellation point
+
+        // copy the block out, so that the player can keep on queueing while it's waited for and played
+        fanout_block * block = &member->blocks[member->tail % FANOUT_QUEUE_BLOCKS];
+        size_t size = block->frames * fanout_bytes_per_frame;
+
+        if (size > buffer_size)
+        {
+            char * new_buffer = realloc(buffer, size);
+
+            if (new_buffer == NULL) die("fanout: can't allocate %zu bytes for a writer thread.", size);
+
+            buffer = new_buffer;
+            buffer_size = size;
+        }
+
+        memcpy(buffer, block->data, size);
+
+        frames = block->frames;
+        due_time = block->due_time;
+        rtp_timestamp = block->rtp_timestamp;
+        block_play_time = block->play_time;
+        is_silence = block->is_silence;
+        generation = member->generation;
+
+        member->tail++;
+        pthread_cleanup_pop(1); // unlock the queue
+
+        // when to send it to the backend for it to be heard when it's due
+        if (due_time != 0)
+        {
+            long backend_delay = 0;
+
+            // the backend is only called with output_mutex held, as flush() and stop() may call
+            // it at the same time
+            pthread_mutex_lock(&member->output_mutex);
+            pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&member->output_mutex);
+
+            if ((member->output->delay == NULL) || (member->output->delay(&backend_delay) != 0))
+                backend_delay = 0;
+
+            pthread_cleanup_pop(1);
+
+            int64_t play_time = (int64_t)due_time + member->latency_offset -
+                                (int64_t)((backend_delay * 1000000000LL) / config.output_rate);
+
+            pthread_mutex_lock(&member->queue_mutex);
+            pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&member->queue_mutex);
+
+            int rc = 0;
+
+            while ((rc != ETIMEDOUT) && (member->generation == generation) &&
+                   ((int64_t)get_absolute_time_in_ns() < play_time))
+            {
+#ifdef COMPILE_FOR_LINUX_AND_FREEBSD_AND_CYGWIN_AND_OPENBSD
+                struct timespec time_of_wakeup;
+                time_of_wakeup.tv_sec = play_time / 1000000000;
+                time_of_wakeup.tv_nsec = play_time % 1000000000;
+                rc = pthread_cond_timedwait(&member->queue_cv, &member->queue_mutex,
+                                            &time_of_wakeup); // a cancellation point
+#endif
+#ifdef COMPILE_FOR_OSX
+                int64_t wait_time = play_time - (int64_t)get_absolute_time_in_ns();
+                struct timespec time_to_wait;
+                time_to_wait.tv_sec = wait_time / 1000000000;
+                time_to_wait.tv_nsec = wait_time % 1000000000;
+                rc = pthread_cond_timedwait_relative_np(&member->queue_cv, &member->queue_mutex,
+                                                        &time_to_wait);
+#endif
+            }
+
+            if (member->generation != generation) frames = 0; // flushed while waiting
+
+            pthread_cleanup_pop(1); // unlock the queue
+        }
+
+        if (frames)
+        {
+            pthread_mutex_lock(&member->output_mutex);
+            pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&member->output_mutex);
+
+            // a flush discards the queue before it flushes the backend, which it can't do until
+            // this lets go of output_mutex -- so if the queue hasn't been discarded by now, the
+            // block is played before the flush, and otherwise it mustn't be played at all
+            pthread_mutex_lock(&member->queue_mutex);
+
+            if (member->generation != generation) frames = 0;
+
+            pthread_mutex_unlock(&member->queue_mutex);
+
+            if ((frames) && (member->output->timing))
+                member->output->timing(rtp_timestamp,
+                                       is_silence ? 0 : block_play_time + member->latency_offset,
+                                       is_silence);
+
+            if (frames) member->output->play(buffer, frames);
+            pthread_cleanup_pop(1);
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+// queue the frames for every other active backend
+static void fan_out(char * buf, int samples)
+{
+    uint64_t due_time = 0;
+    long primary_delay;
+
+    if ((primary->delay) && (primary->delay(&primary_delay) == 0))
+        due_time = get_absolute_time_in_ns() + (primary_delay * 1000000000LL) / config.output_rate;
+
+    int i;
+
+    for (i = 1; i < fanout_member_count; i++)
+    {
+        fanout_member * member = &fanout_members[i];
+
+        if (member->active == 0) continue;
+
+        size_t size = samples * fanout_bytes_per_frame;
+
+        // the slot at the head belongs to the player until the head moves past it
+        pthread_mutex_lock(&member->queue_mutex);
+        int full = (member->head - member->tail) >= FANOUT_QUEUE_BLOCKS;
+        pthread_mutex_unlock(&member->queue_mutex);
+
+        if (full)
+        {
+            if (member->blocks_dropped++ == 0)
+                debug(1, "fanout: backend \"%s\" isn't keeping up -- dropping blocks.", member->output->name);
+            continue;
+        }
+
+        fanout_block * block = &member->blocks[member->head % FANOUT_QUEUE_BLOCKS];
+
+        if (size > block->capacity)
+        {
+            char * new_data = realloc(block->data, size);
+
+            if (new_data == NULL) die("fanout: can't allocate %zu bytes for a block.", size);
+
+            block->data = new_data;
+            block->capacity = size;
+        }
+
+        memcpy(block->data, buf, size);
+        block->frames = samples;
+        block->due_time = due_time;
+        block->rtp_timestamp = timing_rtp_timestamp;
+        block->play_time = timing_play_time;
+        block->is_silence = timing_is_silence;
+
+        pthread_mutex_lock(&member->queue_mutex);
+        member->head++;
+        pthread_cond_signal(&member->queue_cv);
+        pthread_mutex_unlock(&member->queue_mutex);
+    }
+}
+
+static void discard_queues(void)
+{
+    int i;
+
+    for (i = 1; i < fanout_member_count; i++)
+    {
+        fanout_member * member = &fanout_members[i];
+        pthread_mutex_lock(&member->queue_mutex);
+        member->tail = member->head;
+        member->generation++;
+        pthread_cond_signal(&member->queue_cv); // wake it if it's waiting for a block to be due
+        pthread_mutex_unlock(&member->queue_mutex);
+    }
+}
+
+static int init(int argc, char * * argv)
+{
+    config_setting_t * backends = NULL;
+
+    if (config.cfg != NULL) backends = config_lookup(config.cfg, "fanout.backends");
+
+    if ((backends == NULL) || (config_setting_length(backends) == 0))
+        die("fanout: the fanout.backends setting must list the backends to play on, e.g. "
+            "backends = [\"alsa\", \"pipe\"];");
+
+    int count = config_setting_length(backends);
+
+    if (count > FANOUT_MAXIMUM_BACKENDS) die("fanout: at most %d backends can be used.", FANOUT_MAXIMUM_BACKENDS);
+
+    int i, j;
+
+    for (i = 0; i < count; i++)
+    {
+        const char * name = config_setting_get_string_elem(backends, i);
+
+        if (name == NULL) die("fanout: backend %d in fanout.backends is not a string.", i + 1);
+
+        audio_output * output = audio_get_output(name);
+
+        if (output == NULL) die("fanout: invalid audio backend \"%s\".", name);
+
+        if (output == &audio_fanout) die("fanout: the fanout backend can't be one of its own backends.");
+
+        for (j = 0; j < i; j++)
+            if (fanout_members[j].output == output) die("fanout: the \"%s\" backend is listed more than once.", name);
+
+        memset(&fanout_members[i], 0, sizeof(fanout_member));
+        fanout_members[i].output = output;
+    }
+
+    fanout_member_count = count;
+    primary = fanout_members[0].output;
+
+    // Each backend's init() sets the output format and the buffer settings it wants in config, so
+    // the others are done first, each starting from the defaults, and the primary last, leaving its
+    // settings in place for the player. Only the primary gets the command-line arguments
+    sps_format_t default_format = config.output_format;
+    int default_rate = config.output_rate;
+
+    for (i = count - 1; i >= 0; i--)
+    {
+        fanout_member * member = &fanout_members[i];
+
+        config.output_format = default_format;
+        config.output_rate = default_rate;
+
+        if (i == 0) member->output->init(argc, argv);
+        else member->output->init(0, argv);
+
+        member->format = config.output_format;
+
+        if (i != 0)
+        {
+            char setting[64];
+            double dvalue;
+            snprintf(setting, sizeof(setting), "%s.fanout_latency_offset_in_seconds", member->output->name);
+
+            if ((config.cfg != NULL) && (config_lookup_float(config.cfg, setting, &dvalue)))
+                member->latency_offset = (int64_t)(dvalue * 1000000000);
+
+            pthread_mutex_init(&member->queue_mutex, NULL);
+            pthread_mutex_init(&member->output_mutex, NULL);
+#ifdef COMPILE_FOR_LINUX_AND_FREEBSD_AND_CYGWIN_AND_OPENBSD
+            pthread_condattr_t attr;
+            pthread_condattr_init(&attr);
+            pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // can't do this in OS X, and don't need it.
+            pthread_cond_init(&member->queue_cv, &attr);
+            pthread_condattr_destroy(&attr);
+#endif
+#ifdef COMPILE_FOR_OSX
+            pthread_cond_init(&member->queue_cv, NULL);
+#endif
+        }
+    }
+
+    // the player synchronises to the primary, so offer only what it offers
+    audio_fanout.is_running = primary->is_running;
+    audio_fanout.delay = primary->delay;
+    audio_fanout.rate_info = primary->rate_info;
+
+    if (primary->delay == NULL)
+        warn("fanout: the primary backend \"%s\" can't report its delay, so the other backends "
+             "can't be synchronised with it.", primary->name);
+
+    if ((primary->volume) || (primary->mute))
+        inform("fanout: volume and mute are done in software for all the backends, rather than on "
+               "the \"%s\" backend.", primary->name);
+
+    for (i = 1; i < count; i++)
+        pthread_create(&fanout_members[i].writer_thread, NULL, &fanout_writer_thread_code,
+                       (void *)&fanout_members[i]);
+
+    for (i = 0; i < count; i++)
+        debug(1, "fanout: backend %d is \"%s\"%s.", i + 1, fanout_members[i].output->name,
+              i == 0 ? " (primary)" : "");
+
+    return 0;
+}
+
+static void deinit(void)
+{
+    int i;
+
+    for (i = 1; i < fanout_member_count; i++)
+    {
+        fanout_member * member = &fanout_members[i];
+        pthread_cancel(member->writer_thread);
+        pthread_join(member->writer_thread, NULL);
+
+        int k;
+
+        for (k = 0; k < FANOUT_QUEUE_BLOCKS; k++) free(member->blocks[k].data);
+
+        pthread_cond_destroy(&member->queue_cv);
+        pthread_mutex_destroy(&member->queue_mutex);
+        pthread_mutex_destroy(&member->output_mutex);
+    }
+
+    for (i = 0; i < fanout_member_count; i++)
+        if (fanout_members[i].output->deinit) fanout_members[i].output->deinit();
+
+    fanout_member_count = 0;
+}
+
+static int prepare(void)
+{
+    int response = 0;
+    int i;
+
+    for (i = fanout_member_count - 1; i >= 0; i--)
+        if (fanout_members[i].output->prepare)
+        {
+            int rc = fanout_members[i].output->prepare();
+
+            if (i == 0) response = rc;
+        }
+
+    return response;
+}
+
+static void start(int sample_rate, int sample_format)
+{
+    const process_block_writer * writer = process_block_writer_for_format(config.output_format);
+    fanout_bytes_per_frame = 2 * writer->bytes_per_sample;
+
+    primary->start(sample_rate, sample_format);
+
+    int i;
+
+    for (i = 1; i < fanout_member_count; i++)
+    {
+        fanout_member * member = &fanout_members[i];
+
+        // the primary may have settled on its format only when its device was opened
+        if (member->format != config.output_format)
+        {
+            warn("fanout: backend \"%s\" plays %s, but the output is %s -- it will not be used.",
+                 member->output->name, sps_format_description_string(member->format),
+                 sps_format_description_string(config.output_format));
+            member->active = 0;
+            continue;
+        }
+
+        pthread_mutex_lock(&member->output_mutex);
+        member->output->start(sample_rate, sample_format);
+        pthread_mutex_unlock(&member->output_mutex);
+        member->blocks_dropped = 0;
+        member->active = 1;
+    }
+}
+
+static void timing(uint32_t rtp_timestamp, uint64_t play_time, int is_silence)
+{
+    timing_rtp_timestamp = rtp_timestamp;
+    timing_play_time = play_time;
+    timing_is_silence = is_silence;
+
+    if (primary->timing) primary->timing(rtp_timestamp, play_time, is_silence);
+}
+
+static int play(void * buf, int samples)
+{
+    fan_out((char *)buf, samples);
+    return primary->play(buf, samples);
+}
+
+static void * primary_region = NULL;
+
+static int get_buffer(void * * buf, int samples)
+{
+    if (primary->get_buffer == NULL) return -1;
+
+    int response = primary->get_buffer(buf, samples);
+
+    if (response == 0) primary_region = *buf;
+
+    return response;
+}
+
+static int commit_buffer(int samples)
+{
+    // the player has written straight into the primary's buffer, so the others are fed from there
+    if (samples) fan_out((char *)primary_region, samples);
+
+    primary_region = NULL;
+    return primary->commit_buffer(samples);
+}
+
+static void flush(void)
+{
+    discard_queues();
+
+    int i;
+
+    for (i = 1; i < fanout_member_count; i++)
+    {
+        fanout_member * member = &fanout_members[i];
+
+        if ((member->active) && (member->output->flush))
+        {
+            pthread_mutex_lock(&member->output_mutex);
+            member->output->flush();
+            pthread_mutex_unlock(&member->output_mutex);
+        }
+    }
+
+    if (primary->flush) primary->flush();
+}
+
+static void stop(void)
+{
+    discard_queues();
+
+    int i;
+
+    for (i = 1; i < fanout_member_count; i++)
+    {
+        fanout_member * member = &fanout_members[i];
+
+        if (member->active)
+        {
+            pthread_mutex_lock(&member->output_mutex);
+            member->output->stop();
+            pthread_mutex_unlock(&member->output_mutex);
+            member->active = 0;
+
+            if (member->blocks_dropped)
+                debug(1, "fanout: %" PRIu64 " blocks were dropped for backend \"%s\" because it didn't keep up.",
+                      member->blocks_dropped, member->output->name);
+        }
+    }
+
+    primary->stop();
+}
+
+static void help(void)
+{
+    printf("    the backends are listed in the fanout.backends setting -- arguments are passed to the first.\n");
+}
+
+audio_output audio_fanout = { .name          = "fanout",
+                              .help          = &help,
+                              .init          = &init,
+                              .deinit        = &deinit,
+                              .prepare       = &prepare,
+                              .start         = &start,
+                              .stop          = &stop,
+                              .is_running    = NULL,
+                              .flush         = &flush,
+                              .delay         = NULL,
+                              .rate_info     = NULL,
+                              .play          = &play,
+                              .get_buffer    = &get_buffer,
+                              .commit_buffer = &commit_buffer,
+                              .volume        = NULL,
+                              .parameters    = NULL,
+                              .mute          = NULL,
+                              .timing        = &timing };
@@ -112,22 +112,11 @@ static soxr_quality_spec_t quality_spec;
 static soxr_io_spec_t io_spec;
 #endif /* ifdef CONFIG_SOXR */
 
-static inline sample_t sample_conv(short sample)
-{
-    // It sounds correct, but I don't understand it.
-    // Zero int needs to be zero float. Check.
-    // Plus 32767 int is 1.0. Check.
-    // Minus 32767 int is -0.99997. And here my brain shuts down.
-    // In my head, it should be 1.0, and we should tolerate an overflow
-    // at minus 32768. But I'm sure there's a textbook explanation somewhere.
-    return ((sample < 0) ? (-1.0 * sample / SHRT_MIN) : (1.0 * sample / SHRT_MAX));
-}
-
 static void deinterleave(const char * interleaved_input_buffer, sample_t * jack_output_buffer[],
                          jack_nframes_t offset, jack_nframes_t nframes)
 {
     jack_nframes_t f;
-    // We're dealing with 16bit audio here:
+    // We're dealing with interleaved float audio here:
     sample_t * ifp = (sample_t *)interleaved_input_buffer;
 
     // Zero-copy, we're working directly on the target and destination buffers,
@@ -255,6 +244,9 @@ int jack_init(__attribute__((unused)) int argc, __attribute__((unused)) char * *
 
     // Do the "general" audio  options. Note, these options are in the "general" stanza!
     parse_general_audio_options();
+
+    // JACK's samples are floats, so the player can format its output as them directly
+    config.output_format = SPS_FORMAT_F32;
 #ifdef CONFIG_SOXR
     config.jack_soxr_resample_quality = -1; // don't resample by default
 #endif
@@ -317,7 +309,7 @@ int jack_init(__attribute__((unused)) int argc, __attribute__((unused)) char * *
     if (config.jack_soxr_resample_quality >= SOXR_QQ)
     {
         quality_spec = soxr_quality_spec(config.jack_soxr_resample_quality, 0);
-        io_spec = soxr_io_spec(SOXR_INT16_I, SOXR_FLOAT32_I);
+        io_spec = soxr_io_spec(SOXR_FLOAT32_I, SOXR_FLOAT32_I);
     }
     else
 #endif
@@ -435,7 +427,7 @@ void jack_start(int i_sample_rate, __attribute__((unused)) int i_sample_format)
 {
     // Nothing to do, JACK client has already been set up at jack_init().
     // Also, we have no say over the sample rate or sample format of JACK,
-    // We convert the 16bit samples to float, and die if the sample rate is != 44k1 without soxr.
+    // The samples are already floats, and we die if the sample rate is != 44k1 without soxr.
 #ifdef CONFIG_SOXR
 
     if (config.jack_soxr_resample_quality >= SOXR_QQ)
@@ -497,13 +489,13 @@ int jack_delay(long * the_delay)
 int play(void * buf, int samples)
 {
     jack_ringbuffer_data_t v[2] = { 0 };
-    size_t i, j, c;
+    size_t i, j;
     jack_nframes_t thisbuf;
 
     // It's ok to lock here since we're not in the realtime callback:
     pthread_mutex_lock(&buffer_mutex);
     jack_ringbuffer_get_write_vector(jackbuf, v);
-    short * in = (short *)buf;
+    sample_t * in = (sample_t *)buf;
     sample_t * out;
 
     for (i = 0; i < 2; ++i)
@@ -532,17 +524,13 @@ int play(void * buf, int samples)
         else
         {
 #endif /* ifdef CONFIG_SOXR */
-        j = 0;
+        j = thisbuf;
 
-        for (j = 0; j < thisbuf && samples > 0; ++j)
-        {
-            for (c = 0; c < NPORTS; ++c)
-            {
-                out[j * NPORTS + c] = sample_conv(*in++);
-            }
+        if (j > (size_t)samples) j = samples;
 
-            --samples;
-        }
+        memcpy(out, in, j * jack_sample_size * NPORTS);
+        in += j * NPORTS;
+        samples -= j;
 
         jack_ringbuffer_write_advance(jackbuf, j * jack_sample_size * NPORTS);
 #ifdef CONFIG_SOXR
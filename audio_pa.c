@@ -37,13 +37,15 @@
 #include <unistd.h>
 
 // note -- these are hacked and hardwired into this code.
-#define FORMAT            PA_SAMPLE_S16NE
+// The player formats its output as floats, which is what PulseAudio mixes in anyway
+#define FORMAT            PA_SAMPLE_FLOAT32NE
 #define RATE              44100
+#define BYTES_PER_FRAME   (2 * 4) // two channels of 32-bit float
 
-// Four seconds buffer -- should be plenty
-#define buffer_allocation 44100 * 4 * 2 * 2
-
-static pthread_mutex_t buffer_mutex = PTHREAD_MUTEX_INITIALIZER;
+// the default stream buffer attributes, in seconds. A negative value leaves it to the server
+#define PA_DEFAULT_TLENGTH 0.1
+#define PA_DEFAULT_PREBUF  -1.0
+#define PA_DEFAULT_MINREQ  -1.0
 
 /*
    static struct {
@@ -57,14 +59,18 @@ pa_threaded_mainloop * mainloop;
 pa_mainloop_api * mainloop_api;
 pa_context * context;
 pa_stream * stream;
-char * audio_lmb, * audio_umb, * audio_toq, * audio_eoq;
-size_t audio_size = buffer_allocation;
-size_t audio_occupancy;
+
+// the region of the server's memory offered by get_buffer(), to be passed back by commit_buffer()
+static void * pa_write_region;
+static size_t pa_write_region_size;
+
+static double pa_tlength = PA_DEFAULT_TLENGTH;
+static double pa_prebuf = PA_DEFAULT_PREBUF;
+static double pa_minreq = PA_DEFAULT_MINREQ;
 
 void context_state_cb(pa_context * context, void * mainloop);
 void stream_state_cb(pa_stream * s, void * mainloop);
 void stream_success_cb(pa_stream * stream, int success, void * userdata);
-void stream_write_cb(pa_stream * stream, size_t requested_bytes, void * userdata);
 
 static int init(__attribute__((unused)) int argc, __attribute__((unused)) char * * argv)
 {
@@ -81,6 +87,8 @@ static int init(__attribute__((unused)) int argc, __attribute__((unused)) char *
     // do the "general" audio  options. Note, these options are in the "general" stanza!
     parse_general_audio_options();
 
+    config.output_format = SPS_FORMAT_F32;
+
     // now the specific options
     if (config.cfg != NULL)
     {
@@ -103,18 +111,19 @@ static int init(__attribute__((unused)) int argc, __attribute__((unused)) char *
         {
             config.pa_sink = (char *)str;
         }
-    }
-
-    // finish collecting settings
-
-    // allocate space for the audio buffer
-    audio_lmb = malloc(audio_size);
 
-    if (audio_lmb == NULL) die("Can't allocate %d bytes for pulseaudio buffer.", audio_size);
+        /* Get the stream buffer attributes. */
+        config_lookup_float(config.cfg, "pa.tlength", &pa_tlength);
+        config_lookup_float(config.cfg, "pa.prebuf", &pa_prebuf);
+        config_lookup_float(config.cfg, "pa.minreq", &pa_minreq);
 
-    audio_toq = audio_eoq = audio_lmb;
-    audio_umb = audio_lmb + audio_size;
-    audio_occupancy = 0;
+        if ((pa_tlength >= 0) && (pa_prebuf > pa_tlength))
+        {
+            warn("pa.prebuf of %f seconds is longer than pa.tlength of %f seconds -- it has been "
+                 "reduced to pa.tlength.", pa_prebuf, pa_tlength);
+            pa_prebuf = pa_tlength;
+        }
+    }
 
     // Get a mainloop and its context
     mainloop = pa_threaded_mainloop_new();
@@ -165,13 +174,17 @@ static void deinit(void)
     // debug(1, "pa deinit done");
 }
 
-static void start(__attribute__((unused)) int sample_rate,
-                  __attribute__((unused)) int sample_format)
+// a buffer attribute in bytes from its length in seconds
+static uint32_t pa_attribute_length(double seconds)
 {
-    uint32_t buffer_size_in_bytes = (uint32_t)2 * 2 * RATE * 0.1; // hard wired in here
+    if (seconds < 0) return (uint32_t)-1; // the server's choice
 
-    // debug(1, "pa_buffer size is %u bytes.", buffer_size_in_bytes);
+    return (uint32_t)(seconds * RATE) * BYTES_PER_FRAME;
+}
 
+static void start(__attribute__((unused)) int sample_rate,
+                  __attribute__((unused)) int sample_format)
+{
     pa_threaded_mainloop_lock(mainloop);
     // Create a playback stream
     pa_sample_spec sample_specifications;
@@ -186,16 +199,17 @@ static void start(__attribute__((unused)) int sample_rate,
 
     stream = pa_stream_new(context, "Playback", &sample_specifications, &map);
     pa_stream_set_state_callback(stream, stream_state_cb, mainloop);
-    pa_stream_set_write_callback(stream, stream_write_cb, mainloop);
     //    pa_stream_set_latency_update_callback(stream, stream_latency_cb, mainloop);
 
-    // recommended settings, i.e. server uses sensible values
+    // with PA_STREAM_ADJUST_LATENCY, tlength is the overall latency asked of the server, and
+    // the sink's own buffer is sized to suit it. Playback starts, after a flush or an underrun
+    // too, when prebuf bytes are in the stream
     pa_buffer_attr buffer_attr;
 
     buffer_attr.maxlength = (uint32_t)-1;
-    buffer_attr.tlength = buffer_size_in_bytes;
-    buffer_attr.prebuf = (uint32_t)0;
-    buffer_attr.minreq = (uint32_t)-1;
+    buffer_attr.tlength = pa_attribute_length(pa_tlength);
+    buffer_attr.prebuf = pa_attribute_length(pa_prebuf);
+    buffer_attr.minreq = pa_attribute_length(pa_minreq);
 
     // Settings copied as per the chromium browser source
     pa_stream_flags_t stream_flags;
@@ -237,46 +251,113 @@ static void start(__attribute__((unused)) int sample_rate,
         pa_threaded_mainloop_wait(mainloop);
     }
 
+    const pa_buffer_attr * actual_attr = pa_stream_get_buffer_attr(stream);
+
+    if (actual_attr)
+        debug(2, "pa stream buffer attributes: tlength %u, prebuf %u, minreq %u bytes.",
+              actual_attr->tlength, actual_attr->prebuf, actual_attr->minreq);
+
     pa_threaded_mainloop_unlock(mainloop);
 }
 
+// the caller must hold the mainloop lock
+static void uncork_if_corked(void)
+{
+    if (pa_stream_is_corked(stream) == 1)
+    {
+        // debug(1,"Uncorked");
+        pa_stream_cork(stream, 0, stream_success_cb, mainloop);
+    }
+}
+
 static int play(void * buf, int samples)
 {
     // debug(1,"pa_play of %d samples.",samples);
-    // copy the samples into the queue
-    size_t bytes_to_transfer = samples * 2 * 2;
-    size_t space_to_end_of_buffer = audio_umb - audio_eoq;
+    int reply = 0;
+    size_t bytes_to_transfer = samples * BYTES_PER_FRAME;
+
+    pa_threaded_mainloop_lock(mainloop);
 
-    if (space_to_end_of_buffer >= bytes_to_transfer)
+    // the server copies the samples into its own memory
+    if (pa_stream_write(stream, buf, bytes_to_transfer, NULL, 0LL, PA_SEEK_RELATIVE) != 0)
     {
-        memcpy(audio_eoq, buf, bytes_to_transfer);
-        audio_occupancy += bytes_to_transfer;
-        pthread_mutex_lock(&buffer_mutex);
-        audio_eoq += bytes_to_transfer;
-        pthread_mutex_unlock(&buffer_mutex);
+        debug(1, "pa_stream_write error: \"%s\".", pa_strerror(pa_context_errno(context)));
+        reply = -EIO;
     }
     else
     {
-        memcpy(audio_eoq, buf, space_to_end_of_buffer);
-        buf += space_to_end_of_buffer;
-        memcpy(audio_lmb, buf, bytes_to_transfer - space_to_end_of_buffer);
-        pthread_mutex_lock(&buffer_mutex);
-        audio_occupancy += bytes_to_transfer;
-        pthread_mutex_unlock(&buffer_mutex);
-        audio_eoq = audio_lmb + bytes_to_transfer - space_to_end_of_buffer;
+        uncork_if_corked();
     }
 
-    if ((audio_occupancy >= 11025 * 2 * 2) && (pa_stream_is_corked(stream)))
+    pa_threaded_mainloop_unlock(mainloop);
+    return reply;
+}
+
+// offer a region of the server's memory (shared with it, if possible), so that the player can
+// format its output straight into it
+static int get_buffer(void ** buf, int samples)
+{
+    int reply = -1;
+    size_t bytes_wanted = samples * BYTES_PER_FRAME;
+    size_t bytes_offered = bytes_wanted;
+    void * region = NULL;
+
+    pa_threaded_mainloop_lock(mainloop);
+
+    if (pa_stream_begin_write(stream, &region, &bytes_offered) == 0)
     {
-        // debug(1,"Uncorked");
-        pa_threaded_mainloop_lock(mainloop);
-        pa_stream_cork(stream, 0, stream_success_cb, mainloop);
-        pa_threaded_mainloop_unlock(mainloop);
+        if ((region != NULL) && (bytes_offered >= bytes_wanted))
+        {
+            pa_write_region = region;
+            pa_write_region_size = bytes_offered;
+            *buf = region;
+            reply = 0;
+        }
+        else
+        {
+            // the memory block is too small for the packet -- let play() do it
+            pa_stream_cancel_write(stream);
+        }
     }
 
-    return 0;
+    // the region stays with the stream until it's written or cancelled. Only this thread does either,
+    // so the lock needn't be held while the player fills it
+    pa_threaded_mainloop_unlock(mainloop);
+    return reply;
+}
+
+static int commit_buffer(int samples)
+{
+    int reply = 0;
+    size_t bytes_to_transfer = samples * BYTES_PER_FRAME;
+
+    if (bytes_to_transfer > pa_write_region_size) die("pa commit_buffer overran the region offered.");
+
+    pa_threaded_mainloop_lock(mainloop);
+
+    if (bytes_to_transfer == 0)
+    {
+        pa_stream_cancel_write(stream);
+    }
+    else if (pa_stream_write(stream, pa_write_region, bytes_to_transfer, NULL, 0LL,
+                             PA_SEEK_RELATIVE) != 0)
+    {
+        debug(1, "pa_stream_write error: \"%s\".", pa_strerror(pa_context_errno(context)));
+        reply = -EIO;
+    }
+    else
+    {
+        uncork_if_corked();
+    }
+
+    pa_threaded_mainloop_unlock(mainloop);
+    pa_write_region = NULL;
+    pa_write_region_size = 0;
+    return reply;
 }
 
+// the delay is the stream's own latency -- the audio written to the server but not yet played,
+// plus the sink's latency -- interpolated from the last timing update
 int pa_delay(long * the_delay)
 {
     long result = 0;
@@ -289,7 +370,7 @@ int pa_delay(long * the_delay)
 
     pa_threaded_mainloop_unlock(mainloop);
 
-    if (gl == PA_ERR_NODATA)
+    if (gl == -PA_ERR_NODATA)
     {
         // debug(1, "No latency data yet.");
         reply = -ENODEV;
@@ -301,7 +382,9 @@ int pa_delay(long * the_delay)
     }
     else
     {
-        result = (audio_occupancy / (2 * 2)) + (latency * 44100) / 1000000;
+        // a negative latency means the read index is ahead of the write index -- an underrun
+        if (negative == 0) result = (long)((latency * RATE) / 1000000);
+
         reply = 0;
     }
 
@@ -322,9 +405,6 @@ void flush(void)
     }
 
     pa_threaded_mainloop_unlock(mainloop);
-    audio_toq = audio_eoq = audio_lmb;
-    audio_umb = audio_lmb + audio_size;
-    audio_occupancy = 0;
 }
 
 static void stop(void)
@@ -339,13 +419,11 @@ static void stop(void)
         pa_stream_cork(stream, 1, stream_success_cb, mainloop);
     }
 
-    pa_threaded_mainloop_unlock(mainloop);
-    audio_toq = audio_eoq = audio_lmb;
-    audio_umb = audio_lmb + audio_size;
-    audio_occupancy = 0;
-
     // debug(1,"pa stop");
     pa_stream_disconnect(stream);
+    pa_stream_unref(stream);
+    stream = NULL;
+    pa_threaded_mainloop_unlock(mainloop);
 }
 
 audio_output audio_pa = { .name       = "pa",
@@ -359,6 +437,8 @@ audio_output audio_pa = { .name       = "pa",
                           .flush      = &flush,
                           .delay      = &pa_delay,
                           .play       = &play,
+                          .get_buffer    = &get_buffer,
+                          .commit_buffer = &commit_buffer,
                           .volume     = NULL,
                           .parameters = NULL,
                           .mute       = NULL };
@@ -373,134 +453,6 @@ void stream_state_cb(__attribute__((unused)) pa_stream * s, void * mainloop)
     pa_threaded_mainloop_signal(mainloop, 0);
 }
 
-void stream_write_cb(pa_stream * stream, size_t requested_bytes,
-                     __attribute__((unused)) void * userdata)
-{
-    /*
-       // play with timing information
-       const struct pa_timing_info *ti = pa_stream_get_timing_info(stream);
-       if ((ti == NULL) || (ti->write_index_corrupt)) {
-        debug(2, "Timing info invalid");
-       } else {
-        struct timeval time_now;
-
-        pa_gettimeofday(&time_now);
-
-        uint64_t time_now_fp = ((uint64_t)time_now.tv_sec << 32) +
-                               ((uint64_t)time_now.tv_usec << 32) / 1000000; // types okay
-        uint64_t time_of_ti_fp = ((uint64_t)(ti->timestamp.tv_sec) << 32) +
-                                 ((uint64_t)(ti->timestamp.tv_usec) << 32) / 1000000; // types okay
-
-        if (time_now_fp >= time_of_ti_fp) {
-          uint64_t estimate_age = ((time_now_fp - time_of_ti_fp) * 1000000) >> 32;
-          uint64_t bytes_in_buffer = ti->write_index - ti->read_index;
-          pa_usec_t microseconds_to_write_buffer = (bytes_in_buffer * 1000000) / (44100 * 2 * 2);
-          pa_usec_t ea = (pa_usec_t)estimate_age;
-          pa_usec_t pa_latency = ti->sink_usec + ti->transport_usec + microseconds_to_write_buffer;
-          pa_usec_t estimated_latency = pa_latency - estimate_age;
-          // debug(1,"Estimated latency is %d microseconds.",estimated_latency);
-
-       //    } else {
-       //      debug(1, "Time now is earlier than time of timing information");
-        }
-       }
-     */
-    int bytes_to_transfer = requested_bytes;
-    int bytes_transferred = 0;
-    uint8_t * buffer = NULL;
-
-    while ((bytes_to_transfer > 0) && (audio_occupancy > 0))
-    {
-        size_t bytes_we_can_transfer = bytes_to_transfer;
-
-        if (audio_occupancy < bytes_we_can_transfer)
-        {
-            // debug(1, "Underflow? We have %d bytes but we are asked for %d bytes", audio_occupancy,
-            //      bytes_we_can_transfer);
-            pa_stream_cork(stream, 1, stream_success_cb, mainloop);
-            // debug(1, "Corked");
-            bytes_we_can_transfer = audio_occupancy;
-        }
-
-        // bytes we can transfer will never be greater than the bytes available
-
-        pa_stream_begin_write(stream, (void * *)&buffer, &bytes_we_can_transfer);
-
-        if (bytes_we_can_transfer <= (size_t)(audio_umb - audio_toq))
-        {
-            // the bytes are all in a row in the audo buffer
-            memcpy(buffer, audio_toq, bytes_we_can_transfer);
-            audio_toq += bytes_we_can_transfer;
-            // lock
-            pthread_mutex_lock(&buffer_mutex);
-            audio_occupancy -= bytes_we_can_transfer;
-            pthread_mutex_unlock(&buffer_mutex);
-            // unlock
-            pa_stream_write(stream, buffer, bytes_we_can_transfer, NULL, 0LL, PA_SEEK_RELATIVE);
-            bytes_transferred += bytes_we_can_transfer;
-        }
-        else
-        {
-            // the bytes are in two places in the audio buffer
-            size_t first_portion_to_write = audio_umb - audio_toq;
-
-            if (first_portion_to_write != 0) memcpy(buffer, audio_toq, first_portion_to_write);
-
-            uint8_t * new_buffer = buffer + first_portion_to_write;
-            memcpy(new_buffer, audio_lmb, bytes_we_can_transfer - first_portion_to_write);
-            pa_stream_write(stream, buffer, bytes_we_can_transfer, NULL, 0LL, PA_SEEK_RELATIVE);
-            bytes_transferred += bytes_we_can_transfer;
-            audio_toq = audio_lmb + bytes_we_can_transfer - first_portion_to_write;
-            // lock
-            pthread_mutex_lock(&buffer_mutex);
-            audio_occupancy -= bytes_we_can_transfer;
-            pthread_mutex_unlock(&buffer_mutex);
-            // unlock
-        }
-
-        bytes_to_transfer -= bytes_we_can_transfer;
-        // debug(1,"audio_toq is %llx",audio_toq);
-    }
-
-    // debug(1,"<<<Frames requested %d, written to pa: %d, corked status:
-    // %d.",requested_bytes/4,bytes_transferred/4,pa_stream_is_corked(stream));
-}
-
-void alt_stream_write_cb(pa_stream * stream, size_t requested_bytes,
-                         __attribute__((unused)) void * userdata)
-{
-    // debug(1, "***Bytes requested bytes %d.", requested_bytes);
-    size_t bytes_remaining = requested_bytes;
-
-    while (bytes_remaining > 0)
-    {
-        uint8_t * buffer = NULL;
-        size_t bytes_to_fill = 44100;
-        size_t i;
-
-        if (bytes_to_fill > bytes_remaining) bytes_to_fill = bytes_remaining;
-
-        pa_stream_begin_write(stream, (void * *)&buffer, &bytes_to_fill);
-
-        if (buffer)
-        {
-            for (i = 0; i < bytes_to_fill; i += 2)
-            {
-                buffer[i] = (i % 100) * 40 / 100 + 44;
-                buffer[i + 1] = (i % 100) * 40 / 100 + 44;
-            }
-        }
-        else
-        {
-            die("buffer not allocated in alt_stream_write_cb.");
-        }
-
-        pa_stream_write(stream, buffer, bytes_to_fill, NULL, 0LL, PA_SEEK_RELATIVE);
-
-        bytes_remaining -= bytes_to_fill;
-    }
-}
-
 void stream_success_cb(__attribute__((unused)) pa_stream * stream,
                        __attribute__((unused)) int       success,
                        __attribute__((unused)) void      * userdata)
@@ -33,6 +33,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <memory.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -44,6 +45,34 @@ static int fd = -1;
 char * pipename = NULL;
 char * default_pipe_name = "/tmp/shairport-sync-audio";
 
+// If a queue_length is given, play() doesn't write to the pipe itself -- it puts the frames in a
+// bounded queue and a writer thread writes them to the pipe. A reader that falls behind then holds
+// up the writer thread rather than the player, and when the queue is full, frames are dropped
+// according to the queue_overflow setting.
+#define PIPE_WRITE_CHUNK 16384 // bytes -- the most the writer thread takes from the queue at a time
+
+typedef enum
+{
+    PIPE_DROP_OLDEST,
+    PIPE_DROP_NEWEST
+} pipe_overflow_policy;
+
+static double pipe_queue_length = 0.0; // seconds -- zero means there's no queue
+static pipe_overflow_policy pipe_queue_overflow = PIPE_DROP_OLDEST;
+
+static pthread_mutex_t pipe_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pipe_queue_cv = PTHREAD_COND_INITIALIZER;
+static char * pipe_queue = NULL;
+static size_t pipe_queue_size; // bytes, a whole number of frames
+static uint64_t pipe_queue_head, pipe_queue_tail; // bytes in and out since the start
+static uint64_t pipe_frames_dropped = 0;
+static int pipe_dropping = 0; // set while frames are being dropped, so that it's reported only once
+static char * pipe_write_buffer = NULL;
+static pthread_t pipe_writer_thread;
+
+// without a queue, the player's packets can be written in batches instead
+static audio_aggregator pipe_aggregator;
+
 static void start(__attribute__((unused)) int sample_rate,
                   __attribute__((unused)) int sample_format)
 {
@@ -68,7 +97,7 @@ static void start(__attribute__((unused)) int sample_rate,
     }
 }
 
-static int play(void * buf, int samples)
+static void write_to_pipe(void * buf, size_t size)
 {
     // if the file is not open, try to open it.
     char errorstring[1024];
@@ -82,7 +111,7 @@ static int play(void * buf, int samples)
     if (fd > 0)
     {
         // int rc = non_blocking_write(fd, buf, samples * 4);
-        int rc = write(fd, buf, samples * 4);
+        int rc = audio_aggregator_write(&pipe_aggregator, fd, buf, size);
 
         if ((rc < 0) && (errno != EPIPE))
         {
@@ -91,13 +120,122 @@ static int play(void * buf, int samples)
                   pipename, errorstring);
         }
     }
+}
+
+static void * pipe_writer_thread_code(__attribute__((unused)) void * arg)
+{
+    set_thread_scheduling(TC_output);
+
+    while (1)
+    {
+        size_t size;
+
+        pthread_mutex_lock(&pipe_queue_mutex);
+        pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&pipe_queue_mutex);
+
+        while (pipe_queue_head == pipe_queue_tail) pthread_cond_wait(&pipe_queue_cv, &pipe_queue_mutex); // a cancellation point
+
+        // copy out a chunk, so that the player can drop the oldest frames while it's being written
+        size_t index = pipe_queue_tail % pipe_queue_size;
+        size = pipe_queue_head - pipe_queue_tail;
+
+        if (size > PIPE_WRITE_CHUNK) size = PIPE_WRITE_CHUNK;
+
+        if (size > pipe_queue_size - index) size = pipe_queue_size - index;
+
+        memcpy(pipe_write_buffer, pipe_queue + index, size);
+        pipe_queue_tail += size;
+        pthread_cleanup_pop(1); // unlock the queue
+
+        write_to_pipe(pipe_write_buffer, size); // this can block, and has cancellation points
+    }
+
+    pthread_exit(NULL);
+}
+
+static void queue_for_pipe(char * buf, size_t size)
+{
+    size_t frames_dropped = 0;
+
+    pthread_mutex_lock(&pipe_queue_mutex);
+    size_t space = pipe_queue_size - (pipe_queue_head - pipe_queue_tail);
+
+    if (size > space)
+    {
+        if (pipe_queue_overflow == PIPE_DROP_OLDEST)
+        {
+            if (size > pipe_queue_size)
+            {
+                // only the newest of these will fit at all
+                frames_dropped += (size - pipe_queue_size) / 4;
+                buf += size - pipe_queue_size;
+                size = pipe_queue_size;
+            }
+
+            frames_dropped += (size - space) / 4;
+            pipe_queue_tail += size - space;
+        }
+        else
+        {
+            frames_dropped += (size - space) / 4;
+            size = space;
+        }
+    }
+
+    size_t index = pipe_queue_head % pipe_queue_size;
+    size_t first_part = pipe_queue_size - index;
+
+    if (first_part > size) first_part = size;
+
+    memcpy(pipe_queue + index, buf, first_part);
+
+    if (first_part < size) memcpy(pipe_queue, buf + first_part, size - first_part);
+
+    pipe_queue_head += size;
+    pipe_frames_dropped += frames_dropped;
+    pthread_cond_signal(&pipe_queue_cv);
+    pthread_mutex_unlock(&pipe_queue_mutex);
+
+    if ((frames_dropped != 0) && (pipe_dropping == 0))
+    {
+        debug(1, "pipe: the reader isn't keeping up -- dropping frames, %" PRIu64 " so far.",
+              pipe_frames_dropped);
+        pipe_dropping = 1;
+    }
+    else if ((frames_dropped == 0) && (pipe_dropping != 0))
+    {
+        pipe_dropping = 0;
+    }
+}
+
+static int play(void * buf, int samples)
+{
+    if (pipe_queue != NULL) queue_for_pipe((char *)buf, samples * 4);
+    else write_to_pipe(buf, samples * 4);
 
     return 0;
 }
 
+static void flush(void)
+{
+    // anything still queued or held is out of date
+    audio_aggregator_discard(&pipe_aggregator);
+
+    if (pipe_queue != NULL)
+    {
+        pthread_mutex_lock(&pipe_queue_mutex);
+        pipe_queue_tail = pipe_queue_head;
+        pthread_mutex_unlock(&pipe_queue_mutex);
+    }
+}
+
 static void stop(void)
 {
     // Don't close the pipe just because a play session has stopped.
+    if (fd > 0) audio_aggregator_flush(&pipe_aggregator, fd);
+
+    if (pipe_frames_dropped != 0) debug(1, "pipe: %" PRIu64 " frames have been dropped because the reader didn't keep up.",
+                                        pipe_frames_dropped);
 }
 
 static int init(int argc, char * * argv)
@@ -124,6 +262,24 @@ static int init(int argc, char * * argv)
         {
             pipename = (char *)str;
         }
+
+        /* Get the optional queue length and what to do when the queue overflows. */
+        double dvalue;
+
+        if (config_lookup_float(config.cfg, "pipe.queue_length", &dvalue))
+        {
+            if (dvalue < 0) warn("Invalid pipe queue_length setting \"%f\". It must not be negative. The "
+                                 "default of %f seconds is used instead.", dvalue, pipe_queue_length);
+            else pipe_queue_length = dvalue;
+        }
+
+        if (config_lookup_string(config.cfg, "pipe.queue_overflow", &str))
+        {
+            if (strcasecmp(str, "drop_oldest") == 0) pipe_queue_overflow = PIPE_DROP_OLDEST;
+            else if (strcasecmp(str, "drop_newest") == 0) pipe_queue_overflow = PIPE_DROP_NEWEST;
+            else warn("Invalid pipe queue_overflow setting \"%s\". It should be \"drop_oldest\" or "
+                      "\"drop_newest\". It is set to \"drop_oldest\".", str);
+        }
     }
 
     if (argc > 1) die("too many command-line arguments to pipe");
@@ -143,12 +299,50 @@ static int init(int argc, char * * argv)
 
     debug(1, "audio pipe name is \"%s\"", pipename);
 
+    if (pipe_queue_length > 0.0)
+    {
+        pipe_queue_size = (size_t)(pipe_queue_length * config.output_rate) * 4;
+
+        if (pipe_queue_size < PIPE_WRITE_CHUNK) pipe_queue_size = PIPE_WRITE_CHUNK;
+
+        pipe_queue = malloc(pipe_queue_size);
+        pipe_write_buffer = malloc(PIPE_WRITE_CHUNK);
+
+        if ((pipe_queue == NULL) || (pipe_write_buffer == NULL)) die("Can't allocate the audio pipe queue.");
+
+        pipe_queue_head = 0;
+        pipe_queue_tail = 0;
+        pthread_create(&pipe_writer_thread, NULL, &pipe_writer_thread_code, NULL);
+        debug(1, "audio pipe queue is %f seconds, dropping the %s frames when it overflows.",
+              pipe_queue_length, pipe_queue_overflow == PIPE_DROP_OLDEST ? "oldest" : "newest");
+    }
+    else
+    {
+        audio_aggregator_init(&pipe_aggregator, "pipe");
+    }
+
     return 0;
 }
 
 static void deinit(void)
 {
-    if (fd > 0) close(fd);
+    if (pipe_queue != NULL)
+    {
+        pthread_cancel(pipe_writer_thread);
+        pthread_join(pipe_writer_thread, NULL);
+        free(pipe_queue);
+        pipe_queue = NULL;
+        free(pipe_write_buffer);
+        pipe_write_buffer = NULL;
+    }
+
+    if (fd > 0)
+    {
+        audio_aggregator_flush(&pipe_aggregator, fd);
+        close(fd);
+    }
+
+    audio_aggregator_free(&pipe_aggregator);
 }
 
 static void help(void)
@@ -164,7 +358,7 @@ audio_output audio_pipe = { .name       = "pipe",
                             .start      = &start,
                             .stop       = &stop,
                             .is_running = NULL,
-                            .flush      = NULL,
+                            .flush      = &flush,
                             .delay      = NULL,
                             .play       = &play,
                             .volume     = NULL,
@@ -0,0 +1,482 @@
+/*
+ * PipeWire Backend. This file is part of Shairport Sync.
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "audio.h"
+#include "common.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <pipewire/pipewire.h>
+#include <spa/param/audio/format-utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// as with the PulseAudio backend, these are hardwired.
+// The player formats its output as floats, which is what PipeWire mixes in anyway
+#define RATE            44100
+#define CHANNELS        2
+#define BYTES_PER_FRAME (CHANNELS * 4) // two channels of 32-bit float
+
+// PipeWire pulls audio a quantum at a time, in its process callback, so the player's output
+// waits in a ring until it's asked for. It must be a power of two
+#define PW_RING_FRAMES 32768 // about three quarters of a second
+
+// the ring, from which the process callback fills the stream's buffers.
+// The player is the only writer of pw_ring_head and the process callback is the only writer of
+// pw_ring_tail, except in flush(), which holds the thread loop lock to keep the callback out.
+// Both are frame counts, so the fill is head - tail
+static char * pw_ring;
+static uint64_t pw_ring_head;
+static uint64_t pw_ring_tail;
+
+static struct pw_thread_loop * pw_loop;
+static struct pw_stream * pw_stream_p;
+
+// what the process callback last found -- protected by the thread loop lock
+static int pw_snapshot_valid;
+static uint64_t pw_snapshot_time;      // when it was taken
+static uint64_t pw_snapshot_delay;     // frames queued to the stream and not yet played then
+static uint64_t pw_snapshot_ring_tail; // the ring's tail then
+
+// for rate_info(), as in the ALSA backend -- also protected by the thread loop lock
+static uint64_t frames_sent_for_playing;
+static uint64_t frame_index;
+static int measurement_data_is_valid;
+static uint64_t measurement_start_time;
+static uint64_t frames_played_at_measurement_start_time;
+static uint64_t measurement_time;
+static uint64_t frames_played_at_measurement_time;
+
+static uint64_t pw_frames_of_silence; // written because the ring was empty
+
+static int pw_stream_active; // whether the player has set the stream going -- used only by the player
+
+// the frames in the stream, not yet played, from the stream's own timing information
+static uint64_t stream_delay(void)
+{
+    struct pw_time stream_time;
+    int64_t frames = 0;
+
+    if ((pw_stream_get_time_n(pw_stream_p, &stream_time, sizeof(stream_time)) == 0) &&
+        (stream_time.rate.denom != 0))
+    {
+        // the delay to the device is in ticks of the graph clock, which may run at a different rate
+        frames = (stream_time.delay * RATE * (int64_t)stream_time.rate.num) / stream_time.rate.denom;
+        frames += stream_time.buffered; // held in the resampler
+        frames += stream_time.queued / BYTES_PER_FRAME;
+
+        if (frames < 0) frames = 0;
+    }
+
+    return (uint64_t)frames;
+}
+
+// the process callback asks for a quantum at a time, rather than for a packet at a time as
+// the ALSA backend is given them, so the measurements start after two seconds of frames
+static void note_frames_written(uint64_t frames, uint64_t delay_after_writing)
+{
+    frames_sent_for_playing += frames;
+    frame_index++;
+
+    if (((measurement_data_is_valid == 0) && (frames_sent_for_playing >= 2 * RATE)) ||
+        ((measurement_data_is_valid != 0) && (frame_index % 32 == 0)))
+    {
+        measurement_time = get_absolute_time_in_ns();
+        frames_played_at_measurement_time = frames_sent_for_playing - delay_after_writing;
+
+        if (measurement_data_is_valid == 0)
+        {
+            frames_played_at_measurement_start_time = frames_played_at_measurement_time;
+            measurement_start_time = measurement_time;
+            measurement_data_is_valid = 1;
+        }
+    }
+}
+
+// called on the thread loop, with its lock held, whenever the graph wants a buffer of audio.
+// The frames are copied from the ring straight into the stream's buffer, which is shared with
+// the server, making up any shortfall with silence
+static void on_process(__attribute__((unused)) void * userdata)
+{
+    struct pw_buffer * b = pw_stream_dequeue_buffer(pw_stream_p);
+
+    if (b == NULL)
+    {
+        debug(3, "pw: out of buffers.");
+        return;
+    }
+
+    struct spa_data * d = &b->buffer->datas[0];
+    char * dst = d->data;
+
+    if (dst == NULL) return;
+
+    uint64_t frames = d->maxsize / BYTES_PER_FRAME;
+
+    if ((b->requested != 0) && (b->requested < frames)) frames = b->requested;
+
+    uint64_t delay_before_writing = stream_delay();
+
+    uint64_t head = __atomic_load_n(&pw_ring_head, __ATOMIC_ACQUIRE);
+    uint64_t fill = head - pw_ring_tail;
+    uint64_t frames_from_ring = fill < frames ? fill : frames;
+    uint64_t frames_done = 0;
+
+    while (frames_done < frames_from_ring)
+    {
+        uint64_t offset = (pw_ring_tail + frames_done) & (PW_RING_FRAMES - 1);
+        uint64_t run = PW_RING_FRAMES - offset;
+
+        if (run > frames_from_ring - frames_done) run = frames_from_ring - frames_done;
+
+        memcpy(dst + frames_done * BYTES_PER_FRAME, pw_ring + offset * BYTES_PER_FRAME,
+               run * BYTES_PER_FRAME);
+        frames_done += run;
+    }
+
+    __atomic_store_n(&pw_ring_tail, pw_ring_tail + frames_from_ring, __ATOMIC_RELEASE);
+
+    if (frames_from_ring < frames)
+    {
+        // keep the stream going -- its timing stays good and the player can tell it's short
+        memset(dst + frames_from_ring * BYTES_PER_FRAME, 0, (frames - frames_from_ring) * BYTES_PER_FRAME);
+        pw_frames_of_silence += frames - frames_from_ring;
+    }
+
+    d->chunk->offset = 0;
+    d->chunk->stride = BYTES_PER_FRAME;
+    d->chunk->size = frames * BYTES_PER_FRAME;
+    b->size = frames; // for the stream's time info -- in frames, as advised for audio
+
+    pw_stream_queue_buffer(pw_stream_p, b);
+
+    pw_snapshot_time = get_absolute_time_in_ns();
+    pw_snapshot_delay = delay_before_writing + frames;
+    pw_snapshot_ring_tail = pw_ring_tail;
+    pw_snapshot_valid = 1;
+
+    note_frames_written(frames, pw_snapshot_delay);
+}
+
+static void on_state_changed(__attribute__((unused)) void * userdata,
+                             enum pw_stream_state old, enum pw_stream_state state,
+                             const char * error)
+{
+    debug(2, "pw: stream state changed from \"%s\" to \"%s\".", pw_stream_state_as_string(old),
+          pw_stream_state_as_string(state));
+
+    if (state == PW_STREAM_STATE_ERROR) warn("pw: stream error: \"%s\".", error ? error : "unknown");
+
+    pw_thread_loop_signal(pw_loop, 0);
+}
+
+static const struct pw_stream_events stream_events = {
+    PW_VERSION_STREAM_EVENTS,
+    .state_changed = on_state_changed,
+    .process = on_process,
+};
+
+static int init(int argc, char * * argv)
+{
+    // set up default values first
+    config.audio_backend_buffer_desired_length = 0.35;
+    config.audio_backend_buffer_interpolation_threshold_in_seconds =
+        0.02; // below this, soxr interpolation will not occur -- it'll be basic interpolation
+              // instead.
+
+    config.audio_backend_latency_offset = 0;
+
+    // get settings from settings file
+
+    // do the "general" audio  options. Note, these options are in the "general" stanza!
+    parse_general_audio_options();
+
+    config.output_format = SPS_FORMAT_F32;
+
+    // now the specific options
+    if (config.cfg != NULL)
+    {
+        const char * str;
+
+        /* Get the Application Name. */
+        if (config_lookup_string(config.cfg, "pw.application_name", &str))
+        {
+            config.pw_application_name = (char *)str;
+        }
+
+        /* Get the PipeWire sink name. */
+        if (config_lookup_string(config.cfg, "pw.sink", &str))
+        {
+            config.pw_sink = (char *)str;
+        }
+    }
+
+    pw_ring = malloc(PW_RING_FRAMES * BYTES_PER_FRAME);
+
+    if (pw_ring == NULL) die("Can't allocate %d bytes for the pipewire ring.", PW_RING_FRAMES * BYTES_PER_FRAME);
+
+    pw_init(&argc, &argv);
+
+    pw_loop = pw_thread_loop_new("shairport-sync-pw", NULL);
+
+    if (pw_loop == NULL) die("could not create a pipewire thread loop.");
+
+    const char * application_name = config.pw_application_name ? config.pw_application_name : "Shairport Sync";
+    struct pw_properties * props =
+        pw_properties_new(PW_KEY_MEDIA_TYPE, "Audio", PW_KEY_MEDIA_CATEGORY, "Playback",
+                          PW_KEY_MEDIA_ROLE, "Music", PW_KEY_APP_NAME, application_name,
+                          PW_KEY_NODE_NAME, application_name, NULL);
+
+    // PW_KEY_TARGET_OBJECT arrived in PipeWire 0.3.64 -- before that, the target is the node's
+    if (config.pw_sink)
+#ifdef PW_KEY_TARGET_OBJECT
+        pw_properties_set(props, PW_KEY_TARGET_OBJECT, config.pw_sink);
+#else
+        pw_properties_set(props, PW_KEY_NODE_TARGET, config.pw_sink);
+#endif
+
+    pw_stream_p = pw_stream_new_simple(pw_thread_loop_get_loop(pw_loop), "Playback", props,
+                                       &stream_events, NULL);
+
+    if (pw_stream_p == NULL) die("could not create a pipewire stream.");
+
+    if (pw_thread_loop_start(pw_loop) != 0) die("could not start the pipewire thread loop.");
+
+    return 0;
+}
+
+static void deinit(void)
+{
+    pw_thread_loop_stop(pw_loop);
+    pw_stream_destroy(pw_stream_p);
+    pw_thread_loop_destroy(pw_loop);
+    pw_deinit();
+    free(pw_ring);
+    pw_ring = NULL;
+}
+
+// the caller must hold the thread loop lock
+static void reset_ring_and_measurements(void)
+{
+    __atomic_store_n(&pw_ring_tail, __atomic_load_n(&pw_ring_head, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+    pw_snapshot_valid = 0;
+    frames_sent_for_playing = 0;
+    frame_index = 0;
+    measurement_data_is_valid = 0;
+}
+
+static void start(__attribute__((unused)) int sample_rate,
+                  __attribute__((unused)) int sample_format)
+{
+    uint8_t buffer[1024];
+    struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+    const struct spa_pod * params[1];
+
+    params[0] = spa_format_audio_raw_build(
+        &b, SPA_PARAM_EnumFormat,
+        &SPA_AUDIO_INFO_RAW_INIT(.format = SPA_AUDIO_FORMAT_F32, .channels = CHANNELS, .rate = RATE,
+                                 .position = { SPA_AUDIO_CHANNEL_FL, SPA_AUDIO_CHANNEL_FR }));
+
+    pw_thread_loop_lock(pw_loop);
+    reset_ring_and_measurements();
+    pw_frames_of_silence = 0;
+
+    // the stream isn't started until there's something to play
+    if (pw_stream_connect(pw_stream_p, PW_DIRECTION_OUTPUT, PW_ID_ANY,
+                          PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_MAP_BUFFERS |
+                              PW_STREAM_FLAG_INACTIVE,
+                          params, 1) != 0)
+        die("could not connect the pipewire playback stream.");
+
+    // Wait for the stream to be ready
+    for (;;)
+    {
+        const char * error = NULL;
+        enum pw_stream_state state = pw_stream_get_state(pw_stream_p, &error);
+
+        if (state == PW_STREAM_STATE_ERROR)
+            die("the pipewire stream failed while waiting for it to become ready -- the error "
+                "message is \"%s\".", error ? error : "unknown");
+
+        if (state == PW_STREAM_STATE_PAUSED || state == PW_STREAM_STATE_STREAMING) break;
+
+        pw_thread_loop_wait(pw_loop);
+    }
+
+    pw_thread_loop_unlock(pw_loop);
+}
+
+static void activate_if_inactive(void)
+{
+    if (pw_stream_active == 0)
+    {
+        pw_thread_loop_lock(pw_loop);
+        pw_stream_set_active(pw_stream_p, true);
+        pw_thread_loop_unlock(pw_loop);
+        pw_stream_active = 1;
+    }
+}
+
+static int play(void * buf, int samples)
+{
+    uint64_t tail = __atomic_load_n(&pw_ring_tail, __ATOMIC_ACQUIRE);
+
+    if (pw_ring_head + samples - tail > PW_RING_FRAMES)
+    {
+        debug(1, "pw: the ring is full -- %d frames dropped.", samples);
+        return -ENOSPC;
+    }
+
+    int frames_done = 0;
+
+    while (frames_done < samples)
+    {
+        uint64_t offset = (pw_ring_head + frames_done) & (PW_RING_FRAMES - 1);
+        uint64_t run = PW_RING_FRAMES - offset;
+
+        if (run > (uint64_t)(samples - frames_done)) run = samples - frames_done;
+
+        memcpy(pw_ring + offset * BYTES_PER_FRAME, (char *)buf + frames_done * BYTES_PER_FRAME,
+               run * BYTES_PER_FRAME);
+        frames_done += run;
+    }
+
+    __atomic_store_n(&pw_ring_head, pw_ring_head + samples, __ATOMIC_RELEASE);
+    activate_if_inactive();
+    return 0;
+}
+
+// offer the contiguous room at the head of the ring, so that the player can format into it directly
+static int get_buffer(void * * buf, int samples)
+{
+    uint64_t tail = __atomic_load_n(&pw_ring_tail, __ATOMIC_ACQUIRE);
+    uint64_t offset = pw_ring_head & (PW_RING_FRAMES - 1);
+
+    if ((pw_ring_head + samples - tail > PW_RING_FRAMES) ||
+        (offset + samples > PW_RING_FRAMES))
+        return -1;
+
+    *buf = pw_ring + offset * BYTES_PER_FRAME;
+    return 0;
+}
+
+static int commit_buffer(int samples)
+{
+    if (samples)
+    {
+        __atomic_store_n(&pw_ring_head, pw_ring_head + samples, __ATOMIC_RELEASE);
+        activate_if_inactive();
+    }
+
+    return 0;
+}
+
+// the frames queued to the stream and not yet played when the process callback last ran, less
+// those played since, plus what's waiting in the ring
+static int delay(long * the_delay)
+{
+    int reply = -ENODEV;
+
+    pw_thread_loop_lock(pw_loop);
+
+    if (pw_snapshot_valid)
+    {
+        uint64_t frames_played_since =
+            ((get_absolute_time_in_ns() - pw_snapshot_time) * RATE) / 1000000000;
+        uint64_t stream_frames =
+            pw_snapshot_delay > frames_played_since ? pw_snapshot_delay - frames_played_since : 0;
+
+        *the_delay = (long)(stream_frames + (__atomic_load_n(&pw_ring_head, __ATOMIC_ACQUIRE) - pw_snapshot_ring_tail));
+        reply = 0;
+    }
+
+    pw_thread_loop_unlock(pw_loop);
+    return reply;
+}
+
+static int get_rate_information(uint64_t * elapsed_time, uint64_t * frames_played)
+{
+    // elapsed_time is in nanoseconds
+    int response = 0; // zero means okay
+
+    pw_thread_loop_lock(pw_loop);
+
+    if (measurement_data_is_valid)
+    {
+        *elapsed_time = measurement_time - measurement_start_time;
+        *frames_played = frames_played_at_measurement_time - frames_played_at_measurement_start_time;
+    }
+    else
+    {
+        *elapsed_time = 0;
+        *frames_played = 0;
+        response = -1;
+    }
+
+    pw_thread_loop_unlock(pw_loop);
+    return response;
+}
+
+static void flush(void)
+{
+    pw_thread_loop_lock(pw_loop);
+    pw_stream_set_active(pw_stream_p, false);
+    pw_stream_flush(pw_stream_p, false);
+    reset_ring_and_measurements();
+    pw_thread_loop_unlock(pw_loop);
+    pw_stream_active = 0;
+}
+
+static void stop(void)
+{
+    pw_thread_loop_lock(pw_loop);
+    pw_stream_disconnect(pw_stream_p);
+    reset_ring_and_measurements();
+    pw_thread_loop_unlock(pw_loop);
+    pw_stream_active = 0;
+
+    if (pw_frames_of_silence)
+        debug(2, "pw: %" PRIu64 " frames of silence were played because the ring was empty.",
+              pw_frames_of_silence);
+}
+
+audio_output audio_pw = { .name          = "pw",
+                          .help          = NULL,
+                          .init          = &init,
+                          .deinit        = &deinit,
+                          .prepare       = NULL,
+                          .start         = &start,
+                          .stop          = &stop,
+                          .is_running    = NULL,
+                          .flush         = &flush,
+                          .delay         = &delay,
+                          .rate_info     = &get_rate_information,
+                          .play          = &play,
+                          .get_buffer    = &get_buffer,
+                          .commit_buffer = &commit_buffer,
+                          .volume        = NULL,
+                          .parameters    = NULL,
+                          .mute          = NULL };
@@ -0,0 +1,311 @@
+/*
+ * Shared memory ring output driver. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The segment's layout is in audio_shm.h. The writer never waits for a reader, so a reader
+// that falls a ring behind just loses frames.
+
+#include "audio.h"
+#include "audio_shm.h"
+#include "common.h"
+#include "process_block.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_HEADER_SIZE        4096 // bytes -- the ring starts on a page of its own
+#define SHM_MAXIMUM_FRAME_SIZE 8    // bytes -- stereo S32 or F32
+
+static char * shm_name = NULL;
+static char * default_shm_name = "/shairport-sync-audio";
+static double shm_buffer_length = 2.0; // seconds, at the output rate the ring is made for
+
+static int shm_fd = -1;
+static size_t shm_size = 0;
+static shm_ring_header * header = NULL;
+static char * ring = NULL;
+
+// the timing of the packet that's about to be played, from timing()
+static int timing_pending = 0;
+static uint32_t pending_rtp_timestamp;
+static uint64_t pending_play_time;
+static int pending_silence;
+
+// there's only ever one writer -- the player, or a fanout writer thread -- so it never waits
+static void header_write_begin(void)
+{
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void header_write_end(void)
+{
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+}
+
+static void start(int sample_rate, int sample_format)
+{
+    const process_block_writer * writer = process_block_writer_for_format(sample_format);
+
+    header_write_begin();
+    header->generation++;
+    header->rate = sample_rate;
+    header->format = sample_format;
+    header->bytes_per_frame = writer ? writer->bytes_per_sample * 2 : 4;
+    header->frames = header->data_size / header->bytes_per_frame;
+    header->playing = 1;
+    header->rtp_timestamp = 0;
+    header->silence = 0;
+    header->timing_index = header->write_index;
+    header->play_time = 0;
+    header_write_end();
+
+    timing_pending = 0;
+}
+
+static void timing(uint32_t rtp_timestamp, uint64_t play_time, int is_silence)
+{
+    pending_rtp_timestamp = rtp_timestamp;
+    pending_play_time = play_time;
+    pending_silence = is_silence;
+    timing_pending = 1;
+}
+
+// readers check the reserved index after taking any frames, so it must be moved on before
+// the oldest frames in the ring are overwritten
+static void reserve(int samples)
+{
+    __atomic_store_n(&header->reserved_index, header->write_index + samples, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static void publish(int samples)
+{
+    header_write_begin();
+
+    if (timing_pending)
+    {
+        header->timing_index = header->write_index;
+        header->rtp_timestamp = pending_rtp_timestamp;
+        header->play_time = pending_play_time;
+        header->silence = pending_silence;
+        timing_pending = 0;
+    }
+
+    header->write_index += samples;
+    header_write_end();
+}
+
+static int play(void * buf, int samples)
+{
+    if (samples <= 0) return 0;
+
+    size_t bytes_per_frame = header->bytes_per_frame;
+    size_t frames = header->frames;
+
+    // only the newest of them will fit, if there are more than the ring holds
+    if ((size_t)samples > frames)
+    {
+        buf = (char *)buf + (samples - frames) * bytes_per_frame;
+        samples = frames;
+    }
+
+    size_t position = header->write_index % frames;
+    size_t first_part = frames - position;
+
+    if (first_part > (size_t)samples) first_part = samples;
+
+    reserve(samples);
+    memcpy(ring + position * bytes_per_frame, buf, first_part * bytes_per_frame);
+
+    if (first_part < (size_t)samples)
+        memcpy(ring, (char *)buf + first_part * bytes_per_frame,
+               (samples - first_part) * bytes_per_frame);
+
+    publish(samples);
+    return 0;
+}
+
+// the player can write straight into the ring if there's room for the packet before it wraps
+static int get_buffer(void * * buf, int samples)
+{
+    size_t position = header->write_index % header->frames;
+
+    if (position + samples > header->frames) return -1;
+
+    reserve(samples);
+    *buf = ring + position * header->bytes_per_frame;
+    return 0;
+}
+
+static int commit_buffer(int samples)
+{
+    if (samples) publish(samples);
+    else reserve(0);
+
+    return 0;
+}
+
+static void flush(void)
+{
+    header_write_begin();
+    header->generation++;
+    header->rtp_timestamp = 0;
+    header->silence = 0;
+    header->timing_index = header->write_index;
+    header->play_time = 0;
+    header_write_end();
+
+    timing_pending = 0;
+}
+
+static void stop(void)
+{
+    header_write_begin();
+    header->playing = 0;
+    header_write_end();
+}
+
+static int init(int argc, char * * argv)
+{
+    // set up default values first
+
+    config.audio_backend_buffer_desired_length = 1.0;
+    config.audio_backend_latency_offset = 0;
+
+    // do the "general" audio  options. Note, these options are in the "general" stanza!
+    parse_general_audio_options();
+
+    if (config.cfg != NULL)
+    {
+        const char * str;
+        double dvalue;
+
+        if (config_lookup_string(config.cfg, "shm.name", &str)) shm_name = (char *)str;
+
+        if (config_lookup_float(config.cfg, "shm.buffer_length_in_seconds", &dvalue))
+        {
+            if ((dvalue < 0.1) || (dvalue > 60.0))
+                warn("Invalid shm buffer_length_in_seconds setting \"%f\". It must be between 0.1 and "
+                     "60. The default of %f seconds is used instead.", dvalue, shm_buffer_length);
+            else shm_buffer_length = dvalue;
+        }
+    }
+
+    if (argc > 1) die("too many command-line arguments to shm");
+
+    if (argc == 1) shm_name = argv[0]; // command line argument has priority
+
+    if (shm_name == NULL) shm_name = default_shm_name;
+
+    if (shm_name[0] != '/') die("The shm name \"%s\" must start with a \"/\".", shm_name);
+
+    size_t data_size = (size_t)(shm_buffer_length * config.output_rate) * SHM_MAXIMUM_FRAME_SIZE;
+    shm_size = SHM_HEADER_SIZE + data_size;
+
+    // a segment left by an earlier run may be mapped by readers still -- it's made afresh, and
+    // they see the new one when they next open it
+    shm_unlink(shm_name);
+    shm_fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    if (shm_fd < 0)
+    {
+        char errorstring[1024];
+        strerror_r(errno, (char *)errorstring, sizeof(errorstring));
+        die("Could not create the shared memory segment \"%s\": \"%s\".", shm_name, errorstring);
+    }
+
+    fchmod(shm_fd, 0644); // whatever the umask, so that any local reader can map it
+
+    if (ftruncate(shm_fd, shm_size) != 0) die("Could not size the shared memory segment \"%s\".", shm_name);
+
+    void * segment = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+
+    if (segment == MAP_FAILED) die("Could not map the shared memory segment \"%s\".", shm_name);
+
+    header = (shm_ring_header *)segment;
+    ring = (char *)segment + SHM_HEADER_SIZE;
+
+    memset(header, 0, sizeof(shm_ring_header));
+    header->header_size = SHM_HEADER_SIZE;
+    header->data_size = data_size;
+    header->version = SHM_RING_VERSION;
+    // with a format, so that the ring is usable before the first session starts
+    header->rate = config.output_rate;
+    header->format = SPS_FORMAT_S16_LE;
+    header->bytes_per_frame = 4;
+    header->frames = data_size / 4;
+    __atomic_store_n(&header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE); // last, so it's all there
+
+    debug(1, "shm: the audio ring is in \"%s\", with room for %f seconds.", shm_name,
+          shm_buffer_length);
+    return 0;
+}
+
+static void deinit(void)
+{
+    if (header != NULL)
+    {
+        munmap(header, shm_size);
+        header = NULL;
+        ring = NULL;
+    }
+
+    if (shm_fd >= 0)
+    {
+        close(shm_fd);
+        shm_fd = -1;
+        shm_unlink(shm_name);
+    }
+}
+
+static void help(void)
+{
+    printf("    specify the name of the shared memory segment to write to, e.g. \"/shairport-sync-audio\".\n");
+}
+
+audio_output audio_shm = { .name          = "shm",
+                           .help          = &help,
+                           .init          = &init,
+                           .deinit        = &deinit,
+                           .prepare       = NULL,
+                           .start         = &start,
+                           .stop          = &stop,
+                           .is_running    = NULL,
+                           .flush         = &flush,
+                           .delay         = NULL,
+                           .rate_info     = NULL,
+                           .play          = &play,
+                           .get_buffer    = &get_buffer,
+                           .commit_buffer = &commit_buffer,
+                           .volume        = NULL,
+                           .parameters    = NULL,
+                           .mute          = NULL,
+                           .timing        = &timing };
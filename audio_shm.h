@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+// The layout of the shared memory segment the "shm" backend plays into, for readers.
+//
+// The segment -- opened with shm_open() by the name in the shm.name setting and mapped read-only
+// -- starts with this header and is followed, header_size bytes in, by a ring of data_size bytes
+// of interleaved stereo frames in the output format. Frame n, counting from when the segment was
+// created, is at offset (n % frames) * bytes_per_frame in the ring. The writer never waits for a
+// reader, so any number of readers can take the frames where they lie, without copying them
+// through the kernel, at their own pace; one that falls more than a ring behind has lost frames.
+//
+// The fields from rate on are written under a seqlock: take a copy of them between two reads of
+// sequence that give the same even number. Frames from write_index - frames up to write_index are
+// in the ring, but while a packet is being written, frames below reserved_index - frames are
+// being overwritten -- so after reading any frames, check that reserved_index, read afterwards,
+// is no more than frames beyond the first of them.
+//
+// The timing fields relate the frames to the sender: the frame at timing_index has the RTP
+// timestamp rtp_timestamp and is due to be heard at play_time, in nanoseconds on CLOCK_MONOTONIC
+// (mach_absolute_time() on macOS). Frame n is due at play_time + (n - timing_index) * 10^9 / rate.
+// generation changes at the start of each session and at each flush, after which the frames are
+// not continuous with those before.
+
+#define SHM_RING_MAGIC   0x52534853 // "SHSR" in memory on a little-endian machine
+#define SHM_RING_VERSION 1
+
+typedef struct
+{
+    // set when the segment is created
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size; // the ring starts this many bytes into the segment
+    uint32_t data_size;   // the ring's size in bytes
+
+    uint32_t sequence;       // odd while the fields below it are being written
+    uint32_t generation;     // changed when the frames stop being continuous
+    uint32_t rate;           // frames per second
+    uint32_t format;         // an sps_format_t, see common.h, e.g. 4 for S16_LE
+    uint32_t bytes_per_frame;
+    uint32_t frames;         // the ring's capacity, in frames
+    uint32_t playing;        // non-zero while a session is playing
+    uint32_t rtp_timestamp;  // of the frame at timing_index, unless silence is set
+    uint32_t silence;        // non-zero if the latest packet is silence standing in for a missing one
+    uint32_t unused;         // zero
+    uint64_t write_index;    // the frames written since the segment was created
+    uint64_t timing_index;   // the write index of the first frame of the latest packet
+    uint64_t play_time;      // when that frame is due to be heard, or 0 if that isn't known
+
+    uint64_t reserved_index; // not under the seqlock: the write index once the packet being
+                             // written has been added
+} shm_ring_header;
@@ -105,6 +105,8 @@ static int init(__attribute__((unused)) int argc, __attribute__((unused)) char *
     // do the "general" audio  options. Note, these options are in the "general" stanza!
     parse_general_audio_options();
 
+    config.output_format = SPS_FORMAT_F32;
+
     // get the specific settings
 
     soundio = soundio_create();
@@ -160,7 +162,7 @@ static void start(int sample_rate, int sample_format)
     // soundio_device_sort_channel_layouts(device);
 
     outstream = soundio_outstream_create(device);
-    outstream->format = SoundIoFormatS16NE;
+    outstream->format = SoundIoFormatFloat32NE; // the player formats its output as floats
     outstream->sample_rate = sample_rate;
     outstream->layout.channel_count = 2;
     outstream->write_callback = write_callback;
@@ -37,6 +37,7 @@
 #include <unistd.h>
 
 static int fd = -1;
+static audio_aggregator aggregator; // the packets are written in batches if this is set up
 
 static void start(__attribute__((unused)) int sample_rate,
                   __attribute__((unused)) int sample_format)
@@ -48,7 +49,7 @@ static int play(void * buf, int samples)
 {
     char errorstring[1024];
     int warned = 0;
-    int rc = write(fd, buf, samples * 4);
+    int rc = audio_aggregator_write(&aggregator, fd, buf, samples * 4);
 
     if ((rc < 0) && (warned == 0))
     {
@@ -62,7 +63,14 @@ static int play(void * buf, int samples)
 
 static void stop(void)
 {
-    // Do nothing when play stops
+    // write anything being held, but otherwise do nothing when play stops
+    audio_aggregator_flush(&aggregator, fd);
+}
+
+static void flush(void)
+{
+    // anything being held is out of date
+    audio_aggregator_discard(&aggregator);
 }
 
 static int init(__attribute__((unused)) int argc, __attribute__((unused)) char * * argv)
@@ -74,12 +82,15 @@ static int init(__attribute__((unused)) int argc, __attribute__((unused)) char *
     // get settings from settings file
     // do the "general" audio  options. Note, these options are in the "general" stanza!
     parse_general_audio_options();
+    audio_aggregator_init(&aggregator, "stdout");
     return 0;
 }
 
 static void deinit(void)
 {
     // don't close stdout
+    audio_aggregator_flush(&aggregator, STDOUT_FILENO);
+    audio_aggregator_free(&aggregator);
 }
 
 audio_output audio_stdout = { .name       = "stdout",
@@ -90,7 +101,7 @@ audio_output audio_stdout = { .name       = "stdout",
                               .start      = &start,
                               .stop       = &stop,
                               .is_running = NULL,
-                              .flush      = NULL,
+                              .flush      = &flush,
                               .delay      = NULL,
                               .play       = &play,
                               .volume     = NULL,
@@ -0,0 +1,526 @@
+/*
+ * Micro-benchmarks of the audio path's kernels. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Each kernel runs on the same synthetic input for a few short trials, and the best trial --
+// the one least disturbed by anything else on the machine -- is reported.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "alac.h"
+#include "alac_encoder.h"
+#include "bench.h"
+#include "common.h"
+#include "loudness.h"
+#include "player.h"
+#include "polyphase.h"
+#include "process_block.h"
+#include "zone.h"
+
+#ifdef CONFIG_APPLE_ALAC
+#include "apple_alac.h"
+#endif
+
+#ifdef CONFIG_CONVOLUTION
+#include <FFTConvolver/convolver.h>
+#endif
+
+#define BENCH_FRAMES_PER_PACKET 352
+#define BENCH_PACKETS           64
+#define BENCH_FRAMES            (BENCH_FRAMES_PER_PACKET * BENCH_PACKETS)
+#define BENCH_TRIALS            5
+#define BENCH_TRIAL_NS          ((uint64_t)200000000) // each trial runs for at least this long
+#define BENCH_STUFF_ROOM        8 // frames an interpolator may add to a packet
+
+typedef void (* bench_function)(void * arg);
+
+// the fixed input, in the forms the kernels take
+static int16_t bench_signal[BENCH_FRAMES * 2];
+static int32_t bench_signal_32[BENCH_FRAMES * 2];
+static float bench_left[BENCH_FRAMES], bench_right[BENCH_FRAMES];
+
+static uint8_t bench_alac_packets[BENCH_PACKETS][ALAC_ENCODER_MAXIMUM_PACKET];
+static int bench_alac_packet_length[BENCH_PACKETS];
+
+static const char * bench_filter = NULL;
+static int bench_cycles_fd = -1;
+
+static void bench_cycles_open(void)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // this thread, on any CPU
+    bench_cycles_fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+
+    if (bench_cycles_fd < 0)
+        printf("The CPU cycle counter can't be read, e.g. because of "
+               "/proc/sys/kernel/perf_event_paranoid -- only times are given.\n");
+}
+
+static uint64_t bench_cycles_now(void)
+{
+    uint64_t cycles = 0;
+
+    if ((bench_cycles_fd >= 0) && (read(bench_cycles_fd, &cycles, sizeof(cycles)) != sizeof(cycles)))
+        cycles = 0;
+
+    return cycles;
+}
+
+// run f, which processes frames frames each time, and report the best of the trials
+static void bench_run(const char * name, bench_function f, void * arg, uint64_t frames)
+{
+    if ((bench_filter) && (strstr(name, bench_filter) == NULL)) return;
+
+    double best_ns_per_frame = 0.0, best_cycles_per_sample = 0.0;
+    int trial;
+
+    f(arg); // warm the caches up and let anything allocated on first use be allocated
+
+    for (trial = 0; trial < BENCH_TRIALS; trial++)
+    {
+        uint64_t calls = 0;
+        uint64_t start_cycles = bench_cycles_now();
+        uint64_t start_time = get_absolute_time_in_ns();
+        uint64_t elapsed;
+
+        do
+        {
+            f(arg);
+            calls++;
+            elapsed = get_absolute_time_in_ns() - start_time;
+        }
+        while (elapsed < BENCH_TRIAL_NS);
+
+        double ns_per_frame = (1.0 * elapsed) / (calls * frames);
+        double cycles_per_sample = (1.0 * (bench_cycles_now() - start_cycles)) / (calls * frames * 2);
+
+        if ((trial == 0) || (ns_per_frame < best_ns_per_frame)) best_ns_per_frame = ns_per_frame;
+
+        if ((trial == 0) || (cycles_per_sample < best_cycles_per_sample))
+            best_cycles_per_sample = cycles_per_sample;
+    }
+
+    if (bench_cycles_fd >= 0)
+        printf("%-44s %10.2f ns/frame %10.2f cycles/sample\n", name, best_ns_per_frame,
+               best_cycles_per_sample);
+    else printf("%-44s %10.2f ns/frame\n", name, best_ns_per_frame);
+}
+
+// a few tones and some noise, a little different in each channel, at a realistic level
+static void bench_make_signal(void)
+{
+    uint32_t noise = 12345;
+    int i;
+
+    for (i = 0; i < BENCH_FRAMES; i++)
+    {
+        double t = i / 44100.0;
+        double n[2];
+        int c;
+
+        for (c = 0; c < 2; c++)
+        {
+            noise = noise * 1664525 + 1013904223; // a fixed LCG, so the input never changes
+            n[c] = (noise >> 8) * (2.0 / 16777216.0) - 1.0;
+        }
+
+        double l = 0.30 * sin(2 * M_PI * 220 * t) + 0.15 * sin(2 * M_PI * 1760 * t + 0.3) + 0.05 * n[0];
+        double r = 0.25 * sin(2 * M_PI * 330 * t) + 0.15 * sin(2 * M_PI * 1760 * t) + 0.05 * n[1];
+
+        bench_signal[i * 2] = (int16_t)(l * 32767);
+        bench_signal[i * 2 + 1] = (int16_t)(r * 32767);
+        bench_signal_32[i * 2] = bench_signal[i * 2] * 65536;
+        bench_signal_32[i * 2 + 1] = bench_signal[i * 2 + 1] * 65536;
+        bench_left[i] = bench_signal[i * 2] * (1.0f / 32768);
+        bench_right[i] = bench_signal[i * 2 + 1] * (1.0f / 32768);
+    }
+}
+
+static void bench_alac_encode(void)
+{
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+        bench_alac_packet_length[p] = alac_encode_packet(
+            bench_signal + p * BENCH_FRAMES_PER_PACKET * 2, BENCH_FRAMES_PER_PACKET,
+            bench_alac_packets[p]);
+}
+
+typedef struct
+{
+    alac_file * alac;
+#ifdef CONFIG_APPLE_ALAC
+    apple_alac * apple;
+#endif
+    int16_t output[BENCH_FRAMES * 2];
+} bench_alac_state;
+
+static void bench_alac_decode(void * arg)
+{
+    bench_alac_state * state = (bench_alac_state *)arg;
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+    {
+        int outsize = BENCH_FRAMES_PER_PACKET * 4;
+        alac_decode_frame(state->alac, bench_alac_packets[p], bench_alac_packet_length[p],
+                          state->output + p * BENCH_FRAMES_PER_PACKET * 2, &outsize);
+    }
+}
+
+#ifdef CONFIG_APPLE_ALAC
+static void bench_apple_alac_decode(void * arg)
+{
+    bench_alac_state * state = (bench_alac_state *)arg;
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+    {
+        int outsize = BENCH_FRAMES_PER_PACKET * 4;
+        apple_alac_decode(state->apple, bench_alac_packets[p], bench_alac_packet_length[p],
+                          (unsigned char *)(state->output + p * BENCH_FRAMES_PER_PACKET * 2),
+                          &outsize);
+    }
+}
+#endif
+
+static void bench_alac(void)
+{
+    bench_alac_state * state = calloc(1, sizeof(bench_alac_state));
+
+    if (state == NULL) die("Can't allocate memory for the ALAC benchmark.");
+
+    state->alac = alac_encoder_create_decoder();
+
+    if (state->alac == NULL) die("Can't create an ALAC decoder for the benchmark.");
+
+    // a decoder that gets the input wrong isn't worth timing
+    bench_alac_decode(state);
+
+    if (memcmp(state->output, bench_signal, sizeof(bench_signal)) != 0)
+        die("alac_decode_frame() doesn't decode the benchmark's input correctly.");
+
+    bench_run("alac_decode_frame", bench_alac_decode, state, BENCH_FRAMES);
+    alac_free(state->alac);
+
+#ifdef CONFIG_APPLE_ALAC
+    state->apple = apple_alac_create(alac_encoder_fmtp);
+
+    if (state->apple == NULL) die("Can't create an Apple ALAC decoder for the benchmark.");
+
+    memset(state->output, 0, sizeof(state->output));
+    bench_apple_alac_decode(state);
+
+    if (memcmp(state->output, bench_signal, sizeof(bench_signal)) != 0)
+        warn("apple_alac_decode() doesn't decode the benchmark's input correctly -- not timed.");
+    else bench_run("apple_alac_decode", bench_apple_alac_decode, state, BENCH_FRAMES);
+
+    apple_alac_destroy(state->apple);
+#endif
+
+    free(state);
+}
+
+// the interpolators, writing S16 as most outputs want, with a frame added, none, and one taken
+// away in turn; or, for polyphase, at ratios that do the same
+
+typedef struct
+{
+    rtsp_conn_info * conn;
+    int32_t input[(BENCH_FRAMES_PER_PACKET + BENCH_STUFF_ROOM) * 2];
+    int32_t scratch[(BENCH_FRAMES_PER_PACKET + BENCH_STUFF_ROOM) * 2];
+    char output[(BENCH_FRAMES_PER_PACKET + BENCH_STUFF_ROOM) * 8];
+} bench_stuff_state;
+
+// the interpolators may change the input, e.g. to interpolate, so each packet is copied first
+static int32_t * bench_stuff_input(bench_stuff_state * state, int p)
+{
+    memcpy(state->input, bench_signal_32 + p * BENCH_FRAMES_PER_PACKET * 2,
+           BENCH_FRAMES_PER_PACKET * 2 * sizeof(int32_t));
+    return state->input;
+}
+
+static void bench_stuff_basic(void * arg)
+{
+    bench_stuff_state * state = (bench_stuff_state *)arg;
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+        stuff_buffer_basic_32(bench_stuff_input(state, p), BENCH_FRAMES_PER_PACKET, state->output,
+                              (p % 3) - 1, 1, state->conn);
+}
+
+static void bench_stuff_polyphase(void * arg)
+{
+    bench_stuff_state * state = (bench_stuff_state *)arg;
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+        stuff_buffer_polyphase_32(bench_stuff_input(state, p), state->scratch,
+                                  BENCH_FRAMES_PER_PACKET, state->output,
+                                  (BENCH_FRAMES_PER_PACKET + (p % 3) - 1.0) / BENCH_FRAMES_PER_PACKET,
+                                  1, state->conn);
+}
+
+#ifdef CONFIG_SOXR
+static void bench_stuff_soxr(void * arg)
+{
+    bench_stuff_state * state = (bench_stuff_state *)arg;
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+        stuff_buffer_soxr_32(bench_stuff_input(state, p), state->scratch, BENCH_FRAMES_PER_PACKET,
+                             state->output, (p % 3) - 1, 1, state->conn);
+}
+#endif
+
+static void bench_stuffing(void)
+{
+    bench_stuff_state * state = calloc(1, sizeof(bench_stuff_state));
+
+    if (state == NULL) die("Can't allocate memory for the interpolation benchmarks.");
+
+    state->conn = calloc(1, sizeof(rtsp_conn_info));
+
+    if (state->conn == NULL) die("Can't allocate memory for the interpolation benchmarks.");
+
+    zone bench_zone; // there's no output, but the soxr governor needs to know the rate
+    memset(&bench_zone, 0, sizeof(bench_zone));
+    bench_zone.output_rate = 44100;
+    state->conn->zone = &bench_zone;
+    state->conn->output_writer = process_block_writer_for_format(SPS_FORMAT_S16);
+    state->conn->dsp.volume = 0x10000;
+    state->conn->max_frame_size_change = BENCH_STUFF_ROOM;
+    polyphase_init(&state->conn->polyphase);
+    srand(1); // the basic interpolator picks the frame to add or take away at random
+
+    bench_run("stuff_buffer_basic_32", bench_stuff_basic, state, BENCH_FRAMES);
+    bench_run("stuff_buffer_polyphase_32", bench_stuff_polyphase, state, BENCH_FRAMES);
+#ifdef CONFIG_SOXR
+    bench_run("stuff_buffer_soxr_32", bench_stuff_soxr, state, BENCH_FRAMES);
+
+    if (state->conn->soxr) soxr_delete(state->conn->soxr);
+#endif
+
+    free(state->conn);
+    free(state);
+}
+
+// the block kernel, for each output format, attenuated and dithered as on most sessions
+
+typedef struct
+{
+    const process_block_writer * writer;
+    int64_t previous_random_number;
+    char output[BENCH_FRAMES_PER_PACKET * 8];
+} bench_process_block_state;
+
+static void bench_process_block(void * arg)
+{
+    bench_process_block_state * state = (bench_process_block_state *)arg;
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+        process_block_32(bench_signal_32 + p * BENCH_FRAMES_PER_PACKET * 2,
+                         BENCH_FRAMES_PER_PACKET * 2, state->output, state->writer, 0x8000, 1,
+                         &state->previous_random_number);
+}
+
+static void bench_process_blocks(void)
+{
+    bench_process_block_state state;
+    sps_format_t format;
+
+    memset(&state, 0, sizeof(state));
+
+    for (format = SPS_FORMAT_S8; format < SPS_FORMAT_AUTO; format++)
+    {
+        char name[64];
+
+        snprintf(name, sizeof(name), "process_block_32 %s", sps_format_description_string(format));
+        state.writer = process_block_writer_for_format(format);
+        bench_run(name, bench_process_block, &state, BENCH_FRAMES);
+    }
+}
+
+// the loudness filter, a sample at a time and a block at a time
+
+typedef struct
+{
+    loudness_processor l, r;
+    float left[BENCH_FRAMES_PER_PACKET], right[BENCH_FRAMES_PER_PACKET];
+} bench_loudness_state;
+
+static void bench_loudness_sample(void * arg)
+{
+    bench_loudness_state * state = (bench_loudness_state *)arg;
+    int p, i;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+    {
+        const float * left = bench_left + p * BENCH_FRAMES_PER_PACKET;
+        const float * right = bench_right + p * BENCH_FRAMES_PER_PACKET;
+
+        for (i = 0; i < BENCH_FRAMES_PER_PACKET; i++)
+        {
+            state->left[i] = loudness_process(&state->l, left[i]);
+            state->right[i] = loudness_process(&state->r, right[i]);
+        }
+    }
+}
+
+static void bench_loudness_block(void * arg)
+{
+    bench_loudness_state * state = (bench_loudness_state *)arg;
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+    {
+        memcpy(state->left, bench_left + p * BENCH_FRAMES_PER_PACKET, sizeof(state->left));
+        memcpy(state->right, bench_right + p * BENCH_FRAMES_PER_PACKET, sizeof(state->right));
+        loudness_process_block(&state->l, &state->r, state->left, state->right,
+                               BENCH_FRAMES_PER_PACKET);
+    }
+}
+
+static void bench_loudness(void)
+{
+    bench_loudness_state state;
+
+    memset(&state, 0, sizeof(state));
+    config.loudness_reference_volume_db = -20;
+    loudness_set_coefficients(&state.l, -40, 44100); // well below the reference, so there's some boost
+    loudness_copy_coefficients(&state.r, &state.l);
+
+    bench_run("loudness_process", bench_loudness_sample, &state, BENCH_FRAMES);
+    bench_run("loudness_process_block", bench_loudness_block, &state, BENCH_FRAMES);
+}
+
+#ifdef CONFIG_CONVOLUTION
+// the convolver, with impulse responses from a short speaker correction to a long room correction
+
+static const int bench_ir_lengths[] = { 256, 1024, 4096, 16384, 65536 };
+
+typedef struct
+{
+    convolver * convolver;
+    float left[BENCH_FRAMES_PER_PACKET], right[BENCH_FRAMES_PER_PACKET];
+} bench_convolver_state;
+
+static void bench_convolver(void * arg)
+{
+    bench_convolver_state * state = (bench_convolver_state *)arg;
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+    {
+        memcpy(state->left, bench_left + p * BENCH_FRAMES_PER_PACKET, sizeof(state->left));
+        memcpy(state->right, bench_right + p * BENCH_FRAMES_PER_PACKET, sizeof(state->right));
+        convolver_process(state->convolver, state->left, state->right, BENCH_FRAMES_PER_PACKET);
+    }
+}
+
+static void bench_convolvers(void)
+{
+    bench_convolver_state state;
+    unsigned int i;
+
+    convolver_set_parallel(0);
+    state.convolver = convolver_create(44100);
+
+    for (i = 0; i < sizeof(bench_ir_lengths) / sizeof(bench_ir_lengths[0]); i++)
+    {
+        int length = bench_ir_lengths[i];
+        float * ir = malloc(length * sizeof(float));
+        char name[64];
+        int j;
+
+        if (ir == NULL) die("Can't allocate memory for the convolver benchmark.");
+
+        // a decaying, alternating impulse response -- its shape doesn't matter to the time taken
+        for (j = 0; j < length; j++)
+            ir[j] = ((j & 1) ? -0.5f : 0.5f) * expf(-8.0f * j / length);
+
+        convolver_load(ir, ir, length, 44100);
+        free(ir);
+
+        snprintf(name, sizeof(name), "convolver_process %d taps", length);
+        bench_run(name, bench_convolver, &state, BENCH_FRAMES);
+    }
+
+    convolver_destroy(state.convolver);
+}
+#endif
+
+int bench_main(int argc, char * * argv)
+{
+    log_to_stderr();
+
+    if (argc > 1) bench_filter = argv[1];
+
+    bench_cycles_open();
+    bench_make_signal();
+    bench_alac_encode();
+
+    long compressed_bytes = 0;
+    int p;
+
+    for (p = 0; p < BENCH_PACKETS; p++)
+        compressed_bytes += bench_alac_packet_length[p];
+
+    printf("Input: %d packets of %d stereo frames, ALAC-encoded to %.0f%% of their size.\n",
+           BENCH_PACKETS, BENCH_FRAMES_PER_PACKET, (100.0 * compressed_bytes) / sizeof(bench_signal));
+
+    bench_alac();
+    bench_stuffing();
+    bench_process_blocks();
+    bench_loudness();
+#ifdef CONFIG_CONVOLUTION
+    bench_convolvers();
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// run the micro-benchmarks of the audio path's kernels on fixed inputs and print, for each, the
+// time per frame and the cycles per sample. If a name is given, only benchmarks whose names
+// contain it are run. Returns an exit code.
+int bench_main(int argc, char * * argv);
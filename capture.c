@@ -0,0 +1,270 @@
+/*
+ * Session capture. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The receivers only copy each datagram into a buffer -- a thread of its own writes it to the
+// file, in the format described in capture.h, so a slow disk can't hold them up.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "common.h"
+
+#define CAPTURE_BUFFER_SIZE (1024 * 1024) // about six seconds of audio, with room to spare
+#define CAPTURE_WRITE_CHUNK (64 * 1024)
+
+struct capture_session
+{
+    FILE * file;
+    char * path;
+    pthread_t writer_thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cv;
+    uint8_t * buffer;
+    uint64_t head, tail; // bytes in and out since the start
+    int stopping;        // set when the writer is to write what's left and finish
+    int write_failed;
+    uint64_t datagrams, datagrams_dropped;
+};
+
+static void capture_put_u32(uint8_t * p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void * capture_writer_thread_code(void * arg)
+{
+    capture_session * session = (capture_session *)arg;
+
+    pthread_mutex_lock(&session->mutex);
+
+    while (1)
+    {
+        while ((session->head == session->tail) && (session->stopping == 0))
+            pthread_cond_wait(&session->cv, &session->mutex);
+
+        if (session->head == session->tail) break; // stopping, and nothing left
+
+        // the receivers only add to the buffer past the head, so the chunk can be written from
+        // where it is, without the lock
+        size_t index = session->tail % CAPTURE_BUFFER_SIZE;
+        size_t size = session->head - session->tail;
+
+        if (size > CAPTURE_WRITE_CHUNK) size = CAPTURE_WRITE_CHUNK;
+
+        if (size > CAPTURE_BUFFER_SIZE - index) size = CAPTURE_BUFFER_SIZE - index;
+
+        pthread_mutex_unlock(&session->mutex);
+
+        int failed = (session->write_failed == 0) &&
+                     (fwrite(session->buffer + index, 1, size, session->file) != size);
+
+        if (failed)
+        {
+            char errorstring[1024];
+            strerror_r(errno, (char *)errorstring, sizeof(errorstring));
+            warn("Error writing the capture \"%s\": \"%s\". Nothing more will be captured to it.",
+                 session->path, errorstring);
+        }
+
+        pthread_mutex_lock(&session->mutex);
+
+        if (failed) session->write_failed = 1;
+
+        session->tail += size;
+    }
+
+    pthread_mutex_unlock(&session->mutex);
+    pthread_exit(NULL);
+}
+
+capture_session * capture_start(const char * directory, int connection_number, const char * sdp,
+                                size_t sdp_length)
+{
+    capture_session * session = calloc(1, sizeof(capture_session));
+
+    if (session == NULL)
+    {
+        warn("Can't allocate memory to capture connection %d.", connection_number);
+        return NULL;
+    }
+
+    // e.g. shairport-sync-20201115-183002-3.cap, for connection 3
+    char timestamp[32];
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", &local);
+
+    size_t path_size = strlen(directory) + 64;
+    session->path = malloc(path_size);
+    session->buffer = malloc(CAPTURE_BUFFER_SIZE);
+
+    if ((session->path == NULL) || (session->buffer == NULL))
+    {
+        warn("Can't allocate memory to capture connection %d.", connection_number);
+        goto error;
+    }
+
+    snprintf(session->path, path_size, "%s/shairport-sync-%s-%d.cap", directory, timestamp,
+             connection_number);
+
+    session->file = fopen(session->path, "wb");
+
+    if (session->file == NULL)
+    {
+        char errorstring[1024];
+        strerror_r(errno, (char *)errorstring, sizeof(errorstring));
+        warn("Can't create the capture \"%s\": \"%s\".", session->path, errorstring);
+        goto error;
+    }
+
+    // the header is written here, before anything else can be buffered
+    uint8_t length[4];
+    capture_put_u32(length, sdp_length);
+
+    if ((fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LENGTH, session->file) != CAPTURE_MAGIC_LENGTH) ||
+        (fwrite(length, 1, sizeof(length), session->file) != sizeof(length)) ||
+        (fwrite(sdp, 1, sdp_length, session->file) != sdp_length))
+    {
+        warn("Can't write the header of the capture \"%s\".", session->path);
+        goto error;
+    }
+
+    pthread_mutex_init(&session->mutex, NULL);
+    pthread_cond_init(&session->cv, NULL);
+
+    if (pthread_create(&session->writer_thread, NULL, &capture_writer_thread_code, session) != 0)
+    {
+        warn("Can't start the writer for the capture \"%s\".", session->path);
+        pthread_cond_destroy(&session->cv);
+        pthread_mutex_destroy(&session->mutex);
+        goto error;
+    }
+
+    inform("Connection %d is being captured to \"%s\".", connection_number, session->path);
+    return session;
+
+error:
+
+    if (session->file) fclose(session->file);
+
+    free(session->buffer);
+    free(session->path);
+    free(session);
+    return NULL;
+}
+
+void capture_datagram(capture_session * session, capture_source source, const uint8_t * datagram,
+                      size_t length, uint64_t arrival_time)
+{
+    uint8_t header[CAPTURE_RECORD_HEADER_LENGTH];
+
+    if (length > 0xffff) return; // can't happen with UDP over IPv4 or IPv6 without jumbograms
+
+    header[0] = source;
+    header[1] = 0;
+    header[2] = length >> 8;
+    header[3] = length;
+    capture_put_u32(header + 4, arrival_time >> 32);
+    capture_put_u32(header + 8, arrival_time);
+
+    size_t size = CAPTURE_RECORD_HEADER_LENGTH + length;
+
+    pthread_mutex_lock(&session->mutex);
+
+    session->datagrams++;
+
+    if (size > CAPTURE_BUFFER_SIZE - (session->head - session->tail))
+    {
+        // a record is left out whole, so that the file can still be read
+        session->datagrams_dropped++;
+    }
+    else
+    {
+        size_t index = session->head % CAPTURE_BUFFER_SIZE;
+        size_t first_part;
+
+        first_part = CAPTURE_BUFFER_SIZE - index;
+
+        if (first_part >= CAPTURE_RECORD_HEADER_LENGTH)
+        {
+            memcpy(session->buffer + index, header, CAPTURE_RECORD_HEADER_LENGTH);
+        }
+        else
+        {
+            memcpy(session->buffer + index, header, first_part);
+            memcpy(session->buffer, header + first_part, CAPTURE_RECORD_HEADER_LENGTH - first_part);
+        }
+
+        index = (index + CAPTURE_RECORD_HEADER_LENGTH) % CAPTURE_BUFFER_SIZE;
+        first_part = CAPTURE_BUFFER_SIZE - index;
+
+        if (first_part > length) first_part = length;
+
+        memcpy(session->buffer + index, datagram, first_part);
+
+        if (first_part < length) memcpy(session->buffer, datagram + first_part, length - first_part);
+
+        session->head += size;
+        pthread_cond_signal(&session->cv);
+    }
+
+    pthread_mutex_unlock(&session->mutex);
+}
+
+void capture_stop(capture_session * session)
+{
+    pthread_mutex_lock(&session->mutex);
+    session->stopping = 1;
+    pthread_cond_signal(&session->cv);
+    pthread_mutex_unlock(&session->mutex);
+
+    pthread_join(session->writer_thread, NULL);
+
+    if (session->datagrams_dropped)
+        warn("%" PRIu64 " of the %" PRIu64 " datagrams received were left out of the capture \"%s\" "
+             "because it couldn't be written quickly enough.",
+             session->datagrams_dropped, session->datagrams, session->path);
+    else
+        debug(1, "%" PRIu64 " datagrams captured to \"%s\".", session->datagrams, session->path);
+
+    if (fclose(session->file) != 0) warn("Error closing the capture \"%s\".", session->path);
+
+    pthread_cond_destroy(&session->cv);
+    pthread_mutex_destroy(&session->mutex);
+    free(session->buffer);
+    free(session->path);
+    free(session);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The native session capture format.
+// A capture file starts with a header:
+//   8 bytes -- CAPTURE_MAGIC
+//   4 bytes -- the length of the session description that follows, big-endian
+//   n bytes -- the session description, i.e. the ANNOUNCE's SDP, which carries the fmtp and
+//              the AES key (encrypted with the AirPort Express key, as the sender sent it) and IV
+// Then each datagram received has a record:
+//   1 byte  -- the source, one of the capture_source values
+//   1 byte  -- reserved, zero
+//   2 bytes -- the length of the datagram, big-endian
+//   8 bytes -- its arrival time, from get_absolute_time_in_ns(), big-endian
+//   n bytes -- the datagram
+
+#define CAPTURE_MAGIC                "SSCAPT01"
+#define CAPTURE_MAGIC_LENGTH         8
+#define CAPTURE_RECORD_HEADER_LENGTH 12
+
+typedef enum
+{
+    capture_source_audio = 1,
+    capture_source_control = 2,
+    capture_source_timing = 3,
+} capture_source;
+
+typedef struct capture_session capture_session;
+
+// start capturing a session into a new file in directory, with the ANNOUNCE's SDP as the header.
+// Returns NULL, having warned, if the file can't be made.
+capture_session * capture_start(const char * directory, int connection_number, const char * sdp,
+                                size_t sdp_length);
+
+// record a datagram. It's copied into a buffer that a background thread writes out, so this never
+// waits for the file. If the buffer is full, the datagram is left out and counted.
+void capture_datagram(capture_session * session, capture_source source, const uint8_t * datagram,
+                      size_t length, uint64_t arrival_time);
+
+// write out what's buffered, close the file and free the session
+void capture_stop(capture_session * session);
@@ -0,0 +1,195 @@
+/*
+ * A model of the remote clock. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The lowest aged dispersion is tracked with a queue of candidates and the fit is kept as
+// running sums, so each timing exchange costs the same however long the history is.
+
+#include <math.h>
+#include <string.h>
+
+#include "clock_model.h"
+
+// approximate number of exchanges to let the system settle down -- 60 seconds at first
+#define clock_model_settling_exchanges 20
+// number of points to have for calculating a valid drift
+#define clock_model_sample_point_minimum 8
+
+static int ring_index(int i)
+{
+    return i & (clock_model_history - 1);
+}
+
+void clock_model_init(clock_model * model, double dispersion_aging)
+{
+    memset(model, 0, sizeof(*model));
+    model->newest = -1;
+    model->log_aging = log(dispersion_aging);
+}
+
+// add a sample to the fit, relative to the origin, using Welford's updates
+static void fit_add(clock_model * model, const clock_sample * sample)
+{
+    double x = (double)(sample->local_time - model->origin_local_time);
+    double y = (double)(int64_t)(sample->remote_time - model->origin_remote_time);
+
+    model->fit_count++;
+    double dx = x - model->mean_x;
+    double dy = y - model->mean_y;
+    model->mean_x += dx / model->fit_count;
+    model->mean_y += dy / model->fit_count;
+    model->cxx += dx * (x - model->mean_x);
+    model->cxy += dx * (y - model->mean_y);
+    model->cyy += dy * (y - model->mean_y);
+}
+
+// take a sample out of the fit -- the reverse of fit_add
+static void fit_remove(clock_model * model, const clock_sample * sample)
+{
+    if (model->fit_count <= 1)
+    {
+        // start again from nothing, which also throws away any accumulated rounding
+        model->fit_count = 0;
+        model->mean_x = model->mean_y = 0.0;
+        model->cxx = model->cxy = model->cyy = 0.0;
+        return;
+    }
+
+    double x = (double)(sample->local_time - model->origin_local_time);
+    double y = (double)(int64_t)(sample->remote_time - model->origin_remote_time);
+
+    double old_mean_x = model->mean_x;
+    double old_mean_y = model->mean_y;
+    model->mean_x = (model->fit_count * old_mean_x - x) / (model->fit_count - 1);
+    model->mean_y = (model->fit_count * old_mean_y - y) / (model->fit_count - 1);
+    model->fit_count--;
+    model->cxx -= (x - model->mean_x) * (x - old_mean_x);
+    model->cxy -= (x - model->mean_x) * (y - old_mean_y);
+    model->cyy -= (y - model->mean_y) * (y - old_mean_y);
+}
+
+void clock_model_add(clock_model * model, uint64_t local_time, uint64_t remote_time,
+                     uint64_t dispersion)
+{
+    if (model->count == 0)
+    {
+        model->origin_local_time = local_time;
+        model->origin_remote_time = remote_time;
+    }
+
+    int slot = ring_index(model->newest + 1);
+
+    if (model->count == clock_model_history)
+    {
+        // the oldest sample leaves the history -- if it's still a candidate, it's the first
+        clock_sample * oldest = &model->samples[slot];
+
+        if (oldest->in_fit) fit_remove(model, oldest);
+
+        if ((model->candidate_count) && (model->candidates[model->first_candidate] == slot))
+        {
+            model->first_candidate = ring_index(model->first_candidate + 1);
+            model->candidate_count--;
+        }
+    }
+    else
+    {
+        model->count++;
+    }
+
+    clock_sample * sample = &model->samples[slot];
+    sample->local_time = local_time;
+    sample->remote_time = remote_time;
+    sample->dispersion = dispersion;
+    sample->sequence_number = model->sequence_number++;
+    sample->dispersion_key =
+        (dispersion ? log((double)dispersion) : -HUGE_VAL) - sample->sequence_number * model->log_aging;
+    sample->chosen = 0;
+    sample->in_fit = 0;
+    model->newest = slot;
+
+    // older candidates with no lower an aged dispersion can never be the lowest again --
+    // on a tie, the newer sample is preferred
+    while ((model->candidate_count) &&
+           (model->samples[model->candidates[ring_index(model->first_candidate + model->candidate_count - 1)]]
+                .dispersion_key >= sample->dispersion_key))
+        model->candidate_count--;
+
+    model->candidates[ring_index(model->first_candidate + model->candidate_count)] = slot;
+    model->candidate_count++;
+
+    // the first candidate has the lowest aged dispersion -- record that it's been chosen and
+    // fit it, once the system has had time to settle
+    clock_sample * chosen = &model->samples[model->candidates[model->first_candidate]];
+    chosen->chosen = 1;
+
+    if ((chosen->in_fit == 0) && (chosen->sequence_number > clock_model_settling_exchanges))
+    {
+        fit_add(model, chosen);
+        chosen->in_fit = 1;
+    }
+}
+
+int clock_model_estimate(const clock_model * model, clock_estimate * estimate)
+{
+    memset(estimate, 0, sizeof(*estimate));
+
+    if (model->count == 0) return 0;
+
+    estimate->gradient_sample_count = model->fit_count;
+
+    if (model->fit_count > clock_model_sample_point_minimum)
+    {
+        // the line of best fit passes through the means
+        estimate->measurement_time = model->origin_local_time + (int64_t)llround(model->mean_x);
+        estimate->local_to_remote_time_difference =
+            model->origin_remote_time - model->origin_local_time +
+            (int64_t)llround(model->mean_y - model->mean_x);
+
+        if (model->cxx > 0.0)
+        {
+            estimate->gradient = model->cxy / model->cxx;
+
+            double residual_variance =
+                (model->cyy - model->cxy * estimate->gradient) / (model->fit_count - 2);
+
+            if (residual_variance > 0.0)
+            {
+                estimate->difference_error = sqrt(residual_variance / model->fit_count);
+                estimate->gradient_error = sqrt(residual_variance / model->cxx);
+            }
+        }
+    }
+    else
+    {
+        // use the sample with the lowest aged dispersion, which is good to half its return time
+        const clock_sample * chosen = &model->samples[model->candidates[model->first_candidate]];
+        estimate->measurement_time = chosen->local_time;
+        estimate->local_to_remote_time_difference = chosen->remote_time - chosen->local_time;
+        estimate->difference_error = chosen->dispersion / 2.0;
+    }
+
+    return 1;
+}
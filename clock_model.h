@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+
+// A clock model relates the local clock to the remote clock from timing exchanges.
+// Each exchange gives a sample -- a local time, the corresponding remote time and the
+// dispersion, i.e. the return time, which bounds the error of the sample.
+// The history of samples is a ring; dispersions "age" as samples get older, and at each
+// exchange the sample with the lowest aged dispersion is chosen. The chosen samples are kept
+// in a running least-squares fit, added and removed as they enter and leave the history,
+// so an update is O(1) rather than a rescan of the history.
+
+#define clock_model_history_power_of_two 7
+#define clock_model_history                                                                        \
+    (1 << clock_model_history_power_of_two) // 2^7 is 128. At 1 per three seconds, approximately
+                                            // six minutes of records
+
+typedef struct clock_sample
+{
+    uint64_t local_time;
+    uint64_t remote_time;
+    uint64_t dispersion;
+    double dispersion_key; // log(dispersion) less its aging to date, so that keys don't change
+    int sequence_number;
+    int chosen;
+    int in_fit;
+} clock_sample;
+
+typedef struct clock_model
+{
+    clock_sample samples[clock_model_history]; // a ring
+    int newest;
+    int count;
+    int sequence_number;
+    double log_aging; // the log of the factor by which dispersions age at each exchange
+
+    // the indices of the candidates for the lowest aged dispersion, oldest first, with their
+    // keys increasing -- the first is the lowest
+    int candidates[clock_model_history];
+    int first_candidate;
+    int candidate_count;
+
+    // the running fit of the chosen samples, relative to the first sample
+    uint64_t origin_local_time;
+    uint64_t origin_remote_time;
+    int fit_count;
+    double mean_x, mean_y;
+    double cxx, cxy, cyy; // co-moments
+} clock_model;
+
+typedef struct clock_estimate
+{
+    // add this to the local time to get the remote time modulo 2^64
+    uint64_t local_to_remote_time_difference;
+    uint64_t measurement_time; // the local time at which the difference is as given
+    // the remote interval per local interval -- 1.0 if there's no drift.
+    // It's 0.0 if there aren't enough samples to estimate it yet
+    double gradient;
+    int gradient_sample_count;
+    // one standard error of the difference and of the gradient, or 0 if not known
+    double difference_error; // nanoseconds
+    double gradient_error;
+} clock_estimate;
+
+// dispersions age by a factor of dispersion_aging at every exchange
+void clock_model_init(clock_model * model, double dispersion_aging);
+
+// add the sample from a timing exchange and update the estimate
+void clock_model_add(clock_model * model, uint64_t local_time, uint64_t remote_time,
+                     uint64_t dispersion);
+
+// the estimate from the samples so far -- returns 0 if there are none
+int clock_model_estimate(const clock_model * model, clock_estimate * estimate);
@@ -26,7 +26,12 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for pthread_setaffinity_np
+#endif
+
 #include "common.h"
+#include "process_block.h"
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -34,6 +39,7 @@
 #include <memory.h>
 #include <poll.h>
 #include <popt.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -101,7 +107,8 @@ pthread_mutex_t the_conn_lock = PTHREAD_MUTEX_INITIALIZER;
 
 const char * sps_format_description_string_array[] = {
     "unknown", "S8",       "U8",      "S16",      "S16_LE", "S16_BE", "S24",  "S24_LE",
-    "S24_BE",  "S24_3LE",  "S24_3BE", "S32",      "S32_LE", "S32_BE", "auto", "invalid"
+    "S24_BE",  "S24_3LE",  "S24_3BE", "S32",      "S32_LE", "S32_BE", "F32",  "auto",
+    "invalid"
 };
 
 const char * sps_format_description_string(sps_format_t format)
@@ -261,6 +268,169 @@ void log_to_syslog()
 #endif
 }
 
+// The log queue. When it's on, a message is formatted on the calling thread as before, but is
+// then copied into a slot of a bounded queue and written by a logger thread of its own, so that
+// a slow syslog daemon or a full log pipe never holds up the thread that logged it. Any thread
+// can log, so the queue is a multi-producer, single-consumer ring in which each slot carries a
+// sequence number telling the producers and the consumer whose turn it is. If the queue is
+// full, the message is dropped and counted; nothing ever waits for the logger.
+
+#define LOG_QUEUE_SLOTS 256 // a power of two
+#define LOG_QUEUE_MESSAGE_SIZE 1024
+
+typedef struct
+{
+    uint64_t sequence;
+    int prio;
+    char message[LOG_QUEUE_MESSAGE_SIZE];
+} log_queue_slot;
+
+static log_queue_slot * log_queue;
+static uint64_t log_queue_enqueue_position, log_queue_dequeue_position;
+static uint64_t log_queue_dropped;
+static int log_queue_active = 0;
+static pthread_t log_queue_thread;
+static pthread_mutex_t log_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_queue_cv = PTHREAD_COND_INITIALIZER;
+
+// returns 0 if the message had to be dropped
+static int log_queue_put(int prio, const char * message)
+{
+    uint64_t position = __atomic_load_n(&log_queue_enqueue_position, __ATOMIC_RELAXED);
+    log_queue_slot * slot;
+
+    while (1)
+    {
+        slot = &log_queue[position & (LOG_QUEUE_SLOTS - 1)];
+        int64_t difference =
+            (int64_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - position);
+
+        if (difference == 0)
+        {
+            if (__atomic_compare_exchange_n(&log_queue_enqueue_position, &position, position + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+            // position has been updated to the current one
+        }
+        else if (difference < 0)
+        {
+            __atomic_fetch_add(&log_queue_dropped, 1, __ATOMIC_RELAXED);
+            return 0; // full
+        }
+        else
+        {
+            position = __atomic_load_n(&log_queue_enqueue_position, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->prio = prio;
+    strncpy(slot->message, message, LOG_QUEUE_MESSAGE_SIZE - 1);
+    slot->message[LOG_QUEUE_MESSAGE_SIZE - 1] = '\0';
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+
+    // this doesn't take the mutex, so a wakeup can be missed -- the logger looks anyway, soon
+    pthread_cond_signal(&log_queue_cv);
+    return 1;
+}
+
+static void * log_queue_thread_code(__attribute__((unused)) void * arg)
+{
+    uint64_t dropped_reported = 0;
+
+    while (1)
+    {
+        log_queue_slot * slot = &log_queue[log_queue_dequeue_position & (LOG_QUEUE_SLOTS - 1)];
+
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) == log_queue_dequeue_position + 1)
+        {
+            sps_log(slot->prio, "%s", slot->message);
+            __atomic_store_n(&slot->sequence, log_queue_dequeue_position + LOG_QUEUE_SLOTS,
+                             __ATOMIC_RELEASE);
+            __atomic_store_n(&log_queue_dequeue_position, log_queue_dequeue_position + 1,
+                             __ATOMIC_RELEASE);
+        }
+        else
+        {
+            uint64_t dropped = __atomic_load_n(&log_queue_dropped, __ATOMIC_RELAXED);
+
+            if (dropped != dropped_reported)
+            {
+                sps_log(LOG_WARNING,
+                        "warning: %" PRIu64 " log messages were dropped because the log queue was full.",
+                        dropped - dropped_reported);
+                dropped_reported = dropped;
+            }
+
+            struct timespec time_to_wait;
+            clock_gettime(CLOCK_REALTIME, &time_to_wait);
+            time_to_wait.tv_nsec += 100000000; // 0.1 seconds
+            if (time_to_wait.tv_nsec >= 1000000000)
+            {
+                time_to_wait.tv_sec++;
+                time_to_wait.tv_nsec -= 1000000000;
+            }
+
+            pthread_mutex_lock(&log_queue_mutex);
+            pthread_cond_timedwait(&log_queue_cv, &log_queue_mutex, &time_to_wait);
+            pthread_mutex_unlock(&log_queue_mutex);
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+// wait a little while for the logger to write what's been queued
+static void log_queue_drain(void)
+{
+    int i;
+
+    if (log_queue_active == 0) return;
+
+    for (i = 0; i < 1000; i++)
+    {
+        if (__atomic_load_n(&log_queue_dequeue_position, __ATOMIC_ACQUIRE) ==
+            __atomic_load_n(&log_queue_enqueue_position, __ATOMIC_RELAXED))
+            break;
+
+        pthread_cond_signal(&log_queue_cv);
+        usleep(1000);
+    }
+}
+
+void log_queue_start()
+{
+    uint64_t i;
+
+    log_queue = malloc(LOG_QUEUE_SLOTS * sizeof(log_queue_slot));
+
+    if (log_queue == NULL)
+    {
+        warn("Can't allocate memory for the log queue -- messages will be written directly.");
+        return;
+    }
+
+    for (i = 0; i < LOG_QUEUE_SLOTS; i++) log_queue[i].sequence = i;
+
+    if (pthread_create(&log_queue_thread, NULL, &log_queue_thread_code, NULL) != 0)
+    {
+        warn("Can't start the logger thread -- messages will be written directly.");
+        free(log_queue);
+        log_queue = NULL;
+        return;
+    }
+
+    pthread_detach(log_queue_thread);
+    __atomic_store_n(&log_queue_active, 1, __ATOMIC_RELEASE);
+    atexit(log_queue_drain);
+}
+
+static void log_message(int prio, const char * message)
+{
+    if ((__atomic_load_n(&log_queue_active, __ATOMIC_ACQUIRE) == 0) || (prio == LOG_ERR))
+        sps_log(prio, "%s", message);
+    else log_queue_put(prio, message);
+}
+
 shairport_cfg config;
 
 // accessors for multi-thread-access fields in the conn structure
@@ -394,7 +564,8 @@ void _die(const char * filename, const int linenumber, const char * format, ...)
     va_start(args, format);
     vsnprintf(s, sizeof(b) - (s - b), format, args);
     va_end(args);
-    sps_log(LOG_ERR, "%s", b);
+    log_queue_drain(); // so that the fatal error comes last
+    log_message(LOG_ERR, b);
     pthread_setcancelstate(oldState, NULL);
     emergency_exit = 1;
     exit(EXIT_FAILURE);
@@ -433,7 +604,7 @@ void _warn(const char * filename, const int linenumber, const char * format, ...
     va_start(args, format);
     vsnprintf(s, sizeof(b) - (s - b), format, args);
     va_end(args);
-    sps_log(LOG_WARNING, "%s", b);
+    log_message(LOG_WARNING, b);
     pthread_setcancelstate(oldState, NULL);
 }
 
@@ -462,7 +633,7 @@ void _debug(const char * filename, const int linenumber, int level, const char *
     va_start(args, format);
     vsnprintf(s, sizeof(b) - (s - b), format, args);
     va_end(args);
-    sps_log(LOG_DEBUG, "%s", b);
+    log_message(LOG_DEBUG, b);
     pthread_setcancelstate(oldState, NULL);
 }
 
@@ -498,7 +669,7 @@ void _inform(const char * filename, const int linenumber, const char * format, .
     va_start(args, format);
     vsnprintf(s, sizeof(b) - (s - b), format, args);
     va_end(args);
-    sps_log(LOG_INFO, "%s", b);
+    log_message(LOG_INFO, b);
     pthread_setcancelstate(oldState, NULL);
 }
 
@@ -1536,6 +1707,99 @@ int64_t r64i()
     return (ranval(&rx) >> 1);
 }
 
+const char * thread_class_names[TC_number_of_classes] = {"player", "rtp", "output", "metadata"};
+
+#ifdef __linux__
+// parse a CPU list like "0,2-3" into a CPU set -- returns 0 if it's good
+static int parse_cpu_list(const char * list, cpu_set_t * cpus)
+{
+    CPU_ZERO(cpus);
+    const char * p = list;
+
+    while (*p)
+    {
+        char * end;
+        long first = strtol(p, &end, 10);
+
+        if ((end == p) || (first < 0) || (first >= CPU_SETSIZE)) return -1;
+
+        long last = first;
+        p = end;
+
+        if (*p == '-')
+        {
+            p++;
+            last = strtol(p, &end, 10);
+
+            if ((end == p) || (last < first) || (last >= CPU_SETSIZE)) return -1;
+
+            p = end;
+        }
+
+        long cpu;
+
+        for (cpu = first; cpu <= last; cpu++) CPU_SET(cpu, cpus);
+
+        if (*p == ',') p++;
+        else if (*p != '\0') return -1;
+    }
+
+    return 0;
+}
+#endif
+
+void set_thread_scheduling(thread_class tc)
+{
+    thread_scheduling_t * ts = &config.thread_scheduling[tc];
+
+    if (ts->policy != TP_other)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = ts->priority;
+        int policy = ts->policy == TP_fifo ? SCHED_FIFO : SCHED_RR;
+        int rc = pthread_setschedparam(pthread_self(), policy, &param);
+
+        if (rc)
+        {
+            char em[1024];
+            strerror_r(rc, em, sizeof(em));
+            warn("Can't give a %s thread the real-time priority %d: \"%s\". It may need the CAP_SYS_NICE "
+                 "capability or a higher RLIMIT_RTPRIO.",
+                 thread_class_names[tc], ts->priority, em);
+        }
+        else
+        {
+            debug(2, "%s thread given the real-time priority %d.", thread_class_names[tc], ts->priority);
+        }
+    }
+
+    if (ts->cpus)
+    {
+#ifdef __linux__
+        cpu_set_t cpus;
+
+        if (parse_cpu_list(ts->cpus, &cpus) == 0)
+        {
+            int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+            if (rc)
+            {
+                char em[1024];
+                strerror_r(rc, em, sizeof(em));
+                warn("Can't run a %s thread on CPUs \"%s\": \"%s\".", thread_class_names[tc], ts->cpus, em);
+            }
+        }
+        else
+        {
+            warn("Invalid CPU list \"%s\" for %s threads.", ts->cpus, thread_class_names[tc]);
+        }
+#else
+        debug(1, "CPU affinity for %s threads is only supported on Linux.", thread_class_names[tc]);
+#endif
+    }
+}
+
 uint32_t nctohl(const uint8_t * p)  // read 4 characters from *p and do ntohl on them
 // this is to avoid possible aliasing violations
 {
@@ -1806,12 +2070,18 @@ char * get_version_string()
 #ifdef CONFIG_PA
         strcat(version_string, "-pa");
 #endif
+#ifdef CONFIG_PW
+        strcat(version_string, "-pw");
+#endif
 #ifdef CONFIG_SOUNDIO
         strcat(version_string, "-soundio");
 #endif
 #ifdef CONFIG_DUMMY
         strcat(version_string, "-dummy");
 #endif
+#ifdef CONFIG_FANOUT
+        strcat(version_string, "-fanout");
+#endif
 #ifdef CONFIG_STDOUT
         strcat(version_string, "-stdout");
 #endif
@@ -1863,166 +2133,13 @@ int64_t generate_zero_frames(char * outp, size_t number_of_frames, sps_format_t
     // http://www.ece.rochester.edu/courses/ECE472/resources/Papers/Lipshitz_1992.pdf
     // by Lipshitz, Wannamaker and Vanderkooy, 1992.
 
-    int64_t dither_mask = 0;
-
-    switch (format)
-    {
-        case SPS_FORMAT_S32:
-        case SPS_FORMAT_S32_LE:
-        case SPS_FORMAT_S32_BE:
-            dither_mask = (int64_t)1 << (64 - 32);
-            break;
-
-        case SPS_FORMAT_S24:
-        case SPS_FORMAT_S24_LE:
-        case SPS_FORMAT_S24_BE:
-        case SPS_FORMAT_S24_3LE:
-        case SPS_FORMAT_S24_3BE:
-            dither_mask = (int64_t)1 << (64 - 24);
-            break;
-
-        case SPS_FORMAT_S16:
-        case SPS_FORMAT_S16_LE:
-        case SPS_FORMAT_S16_BE:
-            dither_mask = (int64_t)1 << (64 - 16);
-            break;
-
-        case SPS_FORMAT_S8:
-        case SPS_FORMAT_U8:
-            dither_mask = (int64_t)1 << (64 - 8);
-            break;
-
-        case SPS_FORMAT_UNKNOWN:
-            die("Unexpected SPS_FORMAT_UNKNOWN while calculating dither mask.");
-            break;
-
-        case SPS_FORMAT_AUTO:
-            die("Unexpected SPS_FORMAT_AUTO while calculating dither mask.");
-            break;
-
-        case SPS_FORMAT_INVALID:
-            die("Unexpected SPS_FORMAT_INVALID while calculating dither mask.");
-            break;
-    }
-    dither_mask -= 1;
-
+    // the dither itself is made a block at a time, and packed by the writer for the format,
+    // which dies if the format can't be written
     int64_t previous_random_number = random_number_in;
-    char * p = outp;
-    size_t sample_number;
-
-    r64_lock; // the random number generator is not thread safe, so we need to lock it while using it
-
-    for (sample_number = 0; sample_number < number_of_frames * 2; sample_number++)
-    {
-        int64_t hyper_sample = 0;
-        int64_t r = r64i();
-
-        int64_t tpdf = (r & dither_mask) - (previous_random_number & dither_mask);
-
-        // add dither if permitted -- no need to check for clipping, as the sample is, uh, zero
-
-        if (with_dither != 0) hyper_sample += tpdf;
-
-        // move the result to the desired position in the int64_t
-        char * op = p;
-        int sample_length; // this is the length of the sample
-
-        switch (format)
-        {
-            case SPS_FORMAT_S32:
-                hyper_sample >>= (64 - 32);
-                *(int32_t *)op = hyper_sample;
-                sample_length = 4;
-                break;
-
-            case SPS_FORMAT_S32_LE:
-                *op++ = (uint8_t)(hyper_sample >> (64 - 32)); // 32 bits, ls byte
-                *op++ = (uint8_t)(hyper_sample >> (64 - 32 + 8)); // 32 bits, less significant middle byte
-                *op++ = (uint8_t)(hyper_sample >> (64 - 32 + 16)); // 32 bits, more significant middle byte
-                *op = (uint8_t)(hyper_sample >> (64 - 32 + 24)); // 32 bits, ms byte
-                sample_length = 4;
-                break;
-
-            case SPS_FORMAT_S32_BE:
-                *op++ = (uint8_t)(hyper_sample >> (64 - 32 + 24)); // 32 bits, ms byte
-                *op++ = (uint8_t)(hyper_sample >> (64 - 32 + 16)); // 32 bits, more significant middle byte
-                *op++ = (uint8_t)(hyper_sample >> (64 - 32 + 8)); // 32 bits, less significant middle byte
-                *op = (uint8_t)(hyper_sample >> (64 - 32)); // 32 bits, ls byte
-                sample_length = 4;
-                break;
-
-            case SPS_FORMAT_S24_3LE:
-                *op++ = (uint8_t)(hyper_sample >> (64 - 24)); // 24 bits, ls byte
-                *op++ = (uint8_t)(hyper_sample >> (64 - 24 + 8)); // 24 bits, middle byte
-                *op = (uint8_t)(hyper_sample >> (64 - 24 + 16)); // 24 bits, ms byte
-                sample_length = 3;
-                break;
-
-            case SPS_FORMAT_S24_3BE:
-                *op++ = (uint8_t)(hyper_sample >> (64 - 24 + 16)); // 24 bits, ms byte
-                *op++ = (uint8_t)(hyper_sample >> (64 - 24 + 8)); // 24 bits, middle byte
-                *op = (uint8_t)(hyper_sample >> (64 - 24)); // 24 bits, ls byte
-                sample_length = 3;
-                break;
-
-            case SPS_FORMAT_S24:
-                hyper_sample >>= (64 - 24);
-                *(int32_t *)op = hyper_sample;
-                sample_length = 4;
-                break;
-
-            case SPS_FORMAT_S24_LE:
-                *op++ = (uint8_t)(hyper_sample >> (64 - 24)); // 24 bits, ls byte
-                *op++ = (uint8_t)(hyper_sample >> (64 - 24 + 8)); // 24 bits, middle byte
-                *op++ = (uint8_t)(hyper_sample >> (64 - 24 + 16)); // 24 bits, ms byte
-                *op = 0;
-                sample_length = 4;
-                break;
-
-            case SPS_FORMAT_S24_BE:
-                *op++ = 0;
-                *op++ = (uint8_t)(hyper_sample >> (64 - 24 + 16)); // 24 bits, ms byte
-                *op++ = (uint8_t)(hyper_sample >> (64 - 24 + 8)); // 24 bits, middle byte
-                *op = (uint8_t)(hyper_sample >> (64 - 24)); // 24 bits, ls byte
-                sample_length = 4;
-                break;
-
-            case SPS_FORMAT_S16_LE:
-                *op++ = (uint8_t)(hyper_sample >> (64 - 16));
-                *op++ = (uint8_t)(hyper_sample >> (64 - 16 + 8)); // 16 bits, ms byte
-                sample_length = 2;
-                break;
 
-            case SPS_FORMAT_S16_BE:
-                *op++ = (uint8_t)(hyper_sample >> (64 - 16 + 8)); // 16 bits, ms byte
-                *op = (uint8_t)(hyper_sample >> (64 - 16));
-                sample_length = 2;
-                break;
-
-            case SPS_FORMAT_S16:
-                *(int16_t *)op = (int16_t)(hyper_sample >> (64 - 16));
-                sample_length = 2;
-                break;
-
-            case SPS_FORMAT_S8:
-                *op = (int8_t)(hyper_sample >> (64 - 8));
-                sample_length = 1;
-                break;
-
-            case SPS_FORMAT_U8:
-                *op = 128 + (uint8_t)(hyper_sample >> (64 - 8));
-                sample_length = 1;
-                break;
-
-            default:
-                sample_length = 0; // stop a compiler warning
-                die("Unexpected SPS_FORMAT_* with index %d while outputting silence", format);
-        }
-        p += sample_length;
-        previous_random_number = r;
-    }
+    process_block_silence(number_of_frames * 2, outp, process_block_writer_for_format(format),
+                          with_dither, &previous_random_number);
 
-    r64_unlock;
     return previous_random_number;
 }
 
@@ -51,9 +51,46 @@ typedef enum
 {
     ST_basic = 0, // straight deletion or insertion of a frame in a 352-frame packet
     ST_soxr,    // use libsoxr to make a 352 frame packet one frame longer or shorter
-    ST_auto,    // use soxr if compiled for it and if the soxr_index is low enough
+    ST_auto,    // use soxr if compiled for it and if the soxr_index is low enough, polyphase otherwise
+    ST_polyphase, // use the built-in cubic resampler to stretch or squeeze each packet a little
 } stuffing_type;
 
+typedef enum
+{
+    DC_pi = 0,    // spread corrections out evenly with a proportional-integral controller
+    DC_threshold, // correct whenever the sync error exceeds a randomised threshold
+} drift_correction_type;
+
+// each kind of thread can be given its own scheduling policy, priority and CPUs
+typedef enum
+{
+    TC_player = 0, // a session's player thread
+    TC_rtp,        // a session's RTP receiver -- audio, control and timing
+    TC_output,     // threads belonging to the output back end, e.g. the ALSA buffer monitor
+    TC_metadata,   // metadata, MQTT and D-Bus threads
+    TC_number_of_classes
+} thread_class;
+
+typedef enum
+{
+    TP_other = 0, // normal time-sharing
+    TP_fifo,
+    TP_rr,
+} thread_policy_type;
+
+typedef struct
+{
+    thread_policy_type policy;
+    int priority; // 1 to 99, for TP_fifo and TP_rr
+    char * cpus;  // a CPU list, e.g. "0,2-3", or NULL for any CPU
+} thread_scheduling_t;
+
+typedef enum
+{
+    LP_standard = 0, // the output back end's own buffering
+    LP_low,          // small output buffers and a short prefill, for the smallest usable latency
+} latency_profile_type;
+
 typedef enum
 {
     ST_stereo = 0,
@@ -101,6 +138,7 @@ typedef enum
     SPS_FORMAT_S32,
     SPS_FORMAT_S32_LE,
     SPS_FORMAT_S32_BE,
+    SPS_FORMAT_F32, // 32-bit float, native endianness, full scale is -1.0 to +1.0
     SPS_FORMAT_AUTO,
     SPS_FORMAT_INVALID,
 } sps_format_t;
@@ -133,12 +171,19 @@ typedef struct
 
     char * pa_sink; // the name (or id) of the sink that Shairport Sync will play on.
 #endif
+#ifdef CONFIG_PW
+    char * pw_application_name; // the name under which Shairport Sync's stream shows up in PipeWire.
+                                // Defaults to "Shairport Sync".
+    char * pw_sink; // the name (or serial number) of the sink that Shairport Sync will play on.
+#endif
 #ifdef CONFIG_METADATA
     int metadata_enabled;
     char * metadata_pipename;
     char * metadata_sockaddr;
     int metadata_sockport;
     size_t metadata_sockmsglength;
+    int metadata_socket_pack_items;   // pack small items together into one datagram
+    int metadata_socket_maximum_rate; // in kilobytes per second, zero for no limit
     int get_coverart;
 #endif
 #ifdef CONFIG_MQTT
@@ -156,6 +201,8 @@ typedef struct
     int mqtt_publish_parsed;
     int mqtt_publish_cover;
     int mqtt_enable_remote;
+    int mqtt_publish_asynchronously; // coalesce state topics and publish them from a separate thread
+    double mqtt_publish_interval;    // in seconds -- the coalescing window
 #endif
     uint8_t hw_addr[6];
     int port;
@@ -169,6 +216,7 @@ typedef struct
     double resyncthreshold; // if it get's out of whack my more than this number of seconds, resync.
                  // Zero means never
                  // resync.
+    int adaptive_latency; // take frames off the sender's latency while no packets are being lost
     int allow_session_interruption;
     int timeout; // while in play mode, exit if no packets of audio come in for more than this number
                  // of seconds . Zero means never exit.
@@ -179,6 +227,7 @@ typedef struct
     char * mdns_name;
     mdns_backend * mdns;
     int buffer_start_fill;
+    int packet_buffer_size; // the number of packets each session's buffer holds -- a power of two
     uint32_t userSuppliedLatency; // overrides all other latencies -- use with caution
     uint32_t fixedLatencyOffset; // add this to all automatic latencies supplied to get the actual
                                  // total latency
@@ -193,6 +242,7 @@ typedef struct
 
     int log_fd;                    // file descriptor of the file or pipe to log stuff to.
     char * log_file_path;          // path to file or pipe to log to, if any
+    int log_asynchronously;        // queue messages for a logger thread, rather than write them
     int logOutputLevel;            // log output level
     int debugger_show_elapsed_time; // in the debug message, display the time since startup
     int debugger_show_relative_time; // in the debug message, display the time since the last one
@@ -204,9 +254,14 @@ typedef struct
     int cmd_blocking, cmd_start_returns_output;
     double tolerance; // allow this much drift before attempting to correct it
     stuffing_type packet_stuffing;
+    drift_correction_type drift_correction;
     int soxr_delay_index;
     int soxr_delay_threshold; // the soxr delay must be less or equal to this for soxr interpolation
                     // to be enabled under the auto setting
+    double soxr_cpu_budget; // if soxr takes more than this fraction of a packet's time, stop using it
+    double pipeline_cpu_budget; // warn if the audio path takes more than this fraction of a packet's
+                                // time at startup, 0.0 for no check
+    int pipeline_degrade; // if it does, fall back to cheaper interpolation rather than just warn
     int decoders_supported;
     int use_apple_decoder; // set to 1 if you want to use the apple decoder instead of the original by
                     // David Hammerton
@@ -217,6 +272,7 @@ typedef struct
                     // default “_raop._tcp.”.
     char * interface;  // a string containg the interface name, or NULL if nothing specified
     int interface_index; // only valid if the interface string is non-NULL
+    latency_profile_type latency_profile;
     double audio_backend_buffer_desired_length; // this will be the length in seconds of the
                     // audio backend buffer -- the DAC buffer for ALSA
     double audio_backend_buffer_interpolation_threshold_in_seconds; // below this, soxr interpolation
@@ -254,6 +310,8 @@ typedef struct
     char * convolution_ir_file;
     float convolution_gain;
     int convolution_max_length;
+    int convolution_parallel; // convolve the right channel on a helper thread
+    char * convolution_ir_cache_dir; // for impulse responses resampled to the output rate
 #endif
 
     int loudness;
@@ -273,6 +331,8 @@ typedef struct
 
 #ifdef CONFIG_METADATA_HUB
     char * cover_art_cache_dir;
+    int cover_art_cache_maximum_files;
+    size_t cover_art_cache_maximum_size; // bytes
     int retain_coverart;
 
     int scan_interval_when_active; // number of seconds between DACP server scans when playing
@@ -284,9 +344,15 @@ typedef struct
     int scan_max_inactive_count;   // number of scans to do before stopping if not made active again
                                    // (about 15 minutes worth)
 #endif
+    thread_scheduling_t thread_scheduling[TC_number_of_classes];
+    int lock_memory; // mlockall everything, so that real-time threads aren't held up by paging
     int disable_resend_requests; // set this to stop resend request being made for missing packets
     double diagnostic_drop_packet_fraction; // pseudo randomly drop this fraction of packets, for
                                    // debugging. Currently audio packets only...
+    char * capture_directory; // if set, each play session's datagrams are recorded in a file here
+    int metrics_port;         // if set, live metrics are served over HTTP on this port
+    char * metrics_address;   // the address to serve them on -- all of them if NULL
+    char * trace_file;        // if set, the audio path's trace records are written here
 #ifdef CONFIG_JACK
     char * jack_client_name;
     char * jack_autoconnect_pattern;
@@ -304,6 +370,12 @@ typedef struct
 double get_config_airplay_volume();
 void set_config_airplay_volume(double v);
 
+// the names used in the configuration file for the thread classes, e.g. "player"
+extern const char * thread_class_names[TC_number_of_classes];
+
+// apply the configured scheduling to the calling thread -- call it when the thread starts
+void set_thread_scheduling(thread_class tc);
+
 uint32_t nctohl(const uint8_t * p); // read 4 characters from *p and do ntohl on them
 uint16_t nctohs(const uint8_t * p); // read 2 characters from *p and do ntohs on them
 
@@ -313,6 +385,7 @@ void log_to_stderr(); // call this to direct logging to stderr;
 void log_to_stdout(); // call this to direct logging to stdout;
 void log_to_syslog(); // call this to direct logging to the system log;
 void log_to_file();   // call this to direct logging to a file or (pre-existing) pipe;
+void log_queue_start(); // call this to have messages written by a logger thread of their own
 
 // true if Shairport Sync is supposed to be sending output to the output device, false otherwise
 
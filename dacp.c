@@ -73,6 +73,7 @@ struct HttpResponse
     ssize_t malloced_size; // this will be its allocated size
     ssize_t size;        // the current size of the content
     int code;
+    int connection_close; // set if the connection can't be used for another request
 };
 
 void * response_realloc(__attribute__((unused)) void * opaque, void * ptr, int size)
@@ -110,11 +111,15 @@ void response_body(void * opaque, const char * data, int size)
     response->size += size;
 }
 
-static void
-response_header(__attribute__((unused)) void * opaque, __attribute__((unused)) const char * ckey,
-                __attribute__((unused)) int nkey, __attribute__((unused)) const char * cvalue,
-                __attribute__((unused)) int nvalue)   /* example doesn't care about headers */
+static void response_header(void * opaque, const char * ckey, int nkey, const char * cvalue,
+                            int nvalue)
 {
+    struct HttpResponse * response = (struct HttpResponse *)opaque;
+
+    // the only header of interest is one saying the server will close the connection
+    if ((nkey == 10) && (strncasecmp(ckey, "Connection", 10) == 0) && (nvalue == 5) &&
+        (strncasecmp(cvalue, "close", 5) == 0))
+        response->connection_close = 1;
 }
 
 static void response_code(void * opaque, int code)
@@ -137,14 +142,6 @@ static pthread_mutex_t dacp_conversation_lock;
 static pthread_mutex_t dacp_server_information_lock;
 static pthread_cond_t dacp_server_information_cv;
 
-void addrinfo_cleanup(void * arg)
-{
-    // debug(1, "addrinfo cleanup called.");
-    struct addrinfo * * info = (struct addrinfo * *)arg;
-
-    freeaddrinfo(*info);
-}
-
 void mutex_lock_cleanup(void * arg)
 {
     pthread_mutex_t * m = (pthread_mutex_t *)arg;
@@ -168,254 +165,372 @@ void http_cleanup(void * arg)
     http_free(rt);
 }
 
-int dacp_send_command(const char * command, char * * body, ssize_t * bodysize)
+// A connection to the DACP server is kept open from one request to the next (HTTP/1.1
+// keep-alive), and the address it was made to is cached, so that the monitor's polling and the
+// remote control commands don't each cost an address lookup and a TCP handshake.
+// It is reopened if the server or port changes, if the server closes it, or after an error.
+// A connection must only be used by one thread at a time.
+typedef struct
 {
-    int result;
+    int fd;                       // -1 when not connected
+    struct addrinfo * address;    // the result of resolving address_key, or NULL
+    char address_key[1040];       // "server:port"
+    suseconds_t receive_timeout;  // in microseconds
+} dacp_connection;
 
-    // debug(1,"dacp_send_command: command is: \"%s\".",command);
+static dacp_connection dacp_command_connection = { -1, NULL, "", 500000 };
 
-    if (dacp_server.port == 0)
+static void dacp_connection_close(dacp_connection * c, int abort)
+{
+    if (c->fd != -1)
     {
-        // debug(3, "No DACP port specified yet");
-        result = 490; // no port specified
+        if (abort)
+        {
+            struct linger so_linger;
+            so_linger.l_onoff = 1; // "true"
+            so_linger.l_linger = 0;
+
+            if (setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &so_linger, sizeof so_linger))
+                debug(1, "Could not set the dacp socket to abort on closing.");
+        }
+
+        // debug(2, "dacp_send_command: close socket %d.", c->fd);
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static void dacp_connection_cleanup(void * arg)
+{
+    // if cancelled during an exchange, the state of the connection is unknown, so drop it
+    dacp_connection_close((dacp_connection *)arg, 1);
+}
+
+// make sure the cached address is for the current DACP server, returning 0 or 498
+static int dacp_connection_resolve(dacp_connection * c)
+{
+    char server[1024], key[sizeof(c->address_key)], portstring[10];
+
+    if (dacp_server.connection_family == AF_INET6)
+    {
+        snprintf(server, sizeof(server), "%s%%%u", dacp_server.ip_string, dacp_server.scope_id);
     }
     else
     {
-        // will malloc space for the body or set it to NULL -- the caller should free it.
+        strcpy(server, dacp_server.ip_string);
+    }
 
-        // Using some custom HTTP-like return codes
-        //  498 Bad Address information for the DACP server
-        //  497 Can't establish a socket to the DACP server
-        //  496 Can't connect to the DACP server
-        //  495 Error receiving response
-        //  494 This client is already busy
-        //  493 Client failed to send a message
-        //  492 Argument out of range
-        //  491 Client refused connection
-        //  490 No port specified
+    snprintf(portstring, sizeof(portstring), "%u", dacp_server.port);
+    snprintf(key, sizeof(key), "%s:%s", server, portstring);
 
-        struct addrinfo hints, * res;
-        int sockfd;
+    if ((c->address) && (strcmp(key, c->address_key) == 0)) return 0;
 
-        struct HttpResponse response;
-        response.body = NULL;
-        response.malloced_size = 0;
-        response.size = 0;
-        response.code = 0;
+    // it's a different server or port, so the connection, if any, is to the wrong place
+    dacp_connection_close(c, 0);
 
-        char portstring[10], server[1024], message[1024];
-        memset(&portstring, 0, sizeof(portstring));
+    if (c->address)
+    {
+        freeaddrinfo(c->address);
+        c->address = NULL;
+    }
 
-        if (dacp_server.connection_family == AF_INET6)
-        {
-            snprintf(server, sizeof(server), "%s%%%u", dacp_server.ip_string, dacp_server.scope_id);
-        }
-        else
-        {
-            strcpy(server, dacp_server.ip_string);
-        }
+    struct addrinfo hints, * res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    // debug(1, "DACP port string is \"%s:%s\".", server, portstring);
+
+    int ires = getaddrinfo(server, portstring, &hints, &res);
+
+    if (ires)
+    {
+        // debug(1,"Error %d \"%s\" at getaddrinfo.",ires,gai_strerror(ires));
+        return 498; // Bad Address information for the DACP server
+    }
+
+    c->address = res;
+    strcpy(c->address_key, key);
+    return 0;
+}
+
+// open a connection to the cached address, returning 0, 497, 496 or 491
+static int dacp_connection_open(dacp_connection * c)
+{
+    int result = 0;
+    int sockfd = socket(c->address->ai_family, c->address->ai_socktype, c->address->ai_protocol);
+
+    if (sockfd == -1)
+    {
+        // debug(1, "DACP socket could not be created -- error %d:
+        // \"%s\".",errno,strerror(errno));
+        return 497; // Can't establish a socket to the DACP server
+    }
 
-        snprintf(portstring, sizeof(portstring), "%u", dacp_server.port);
+    pthread_cleanup_push(connect_cleanup, (void *)&sockfd);
+    // debug(2, "dacp_send_command: open socket %d.",sockfd);
 
-        // first, load up address structs with getaddrinfo():
+    // This is for limiting the time to be spent waiting for a response.
 
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_STREAM;
+    struct timeval tv;
+    tv.tv_sec = c->receive_timeout / 1000000;
+    tv.tv_usec = c->receive_timeout % 1000000;
 
-        // debug(1, "DACP port string is \"%s:%s\".", server, portstring);
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof tv) == -1) debug(1, "dacp_send_command: error %d setting receive timeout.", errno);
+
+    tv.tv_sec = 0;
+    tv.tv_usec = 500000;
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv, sizeof tv) == -1) debug(1, "dacp_send_command: error %d setting send timeout.", errno);
+
+    // connect!
+    // debug(1, "DACP socket created.");
+    if (connect(sockfd, c->address->ai_addr, c->address->ai_addrlen) < 0)
+    {
+        // debug(1, "dacp_send_command: connect failed with errno %d.", errno);
+        if (errno == ECONNREFUSED) result = 491;  // DACP server doesn't want to talk anymore...
+        else result = 496;                        // Can't connect to the DACP server
+    }
+
+    pthread_cleanup_pop(result != 0); // close the socket if the connection failed
+
+    if (result == 0) c->fd = sockfd;
+
+    return result;
+}
+
+// Send the request on the open connection and read the response into *response.
+// Returns 0 on success, 493 or 495 on failure, or -1 if the connection turned out to have been
+// closed by the server before anything was received, in which case it's worth trying again on a
+// new connection.
+static int dacp_connection_exchange(dacp_connection * c, const char * message,
+                                    struct HttpResponse * response)
+{
+    int result = 0;
 
-        int ires = getaddrinfo(server, portstring, &hints, &res);
+    response->body = NULL;
+    response->malloced_size = 0;
+    response->size = 0;
+    response->code = 0;
+    response->connection_close = 0;
 
-        if (ires)
+    ssize_t wresp = send(c->fd, message, strlen(message), 0);
+
+    if (wresp == -1)
+    {
+        char errorstring[1024];
+        strerror_r(errno, (char *)errorstring, sizeof(errorstring));
+        debug(2, "dacp_send_command: write error %d: \"%s\".", errno, (char *)errorstring);
+
+        if ((errno == EPIPE) || (errno == ECONNRESET)) return -1;
+    }
+
+    if (wresp != (ssize_t)strlen(message))
+    {
+        // debug(1, "dacp_send_command: send failed.");
+        return 493; // Client failed to send a message
+    }
+
+    response->body = malloc(2048); // it can resize this if necessary
+    response->malloced_size = 2048;
+    pthread_cleanup_push(malloc_cleanup, response->body);
+
+    struct http_roundtripper rt;
+    http_init(&rt, responseFuncs, response);
+    pthread_cleanup_push(http_cleanup, &rt);
+
+    int needmore = 1;
+    ssize_t received = 0;
+    char buffer[8192];
+    memset(buffer, 0, sizeof(buffer));
+
+    while (needmore && (result == 0))
+    {
+        const char * data = buffer;
+
+        ssize_t ndata = recv(c->fd, buffer, sizeof(buffer), 0);
+
+        // debug(3, "Received %d bytes: \"%s\".", ndata, buffer);
+        if (ndata <= 0)
         {
-            // debug(1,"Error %d \"%s\" at getaddrinfo.",ires,gai_strerror(ires));
-            response.code = 498; // Bad Address information for the DACP server
+            int receive_errno = errno;
+
+            if (ndata == -1)
+            {
+                char errorstring[1024];
+                strerror_r(receive_errno, (char *)errorstring, sizeof(errorstring));
+                debug(2, "dacp_send_command: receiving error %d: \"%s\".", receive_errno,
+                      (char *)errorstring);
+            }
+
+            if ((received == 0) && ((ndata == 0) || (receive_errno == ECONNRESET)))
+                result = -1; // closed by the server while idle
+            else result = 495; // Error receiving response
         }
         else
         {
-            uint64_t start_time = get_absolute_time_in_ns();
-            pthread_cleanup_push(addrinfo_cleanup, (void *)&res);
-            // only do this one at a time -- not sure it is necessary, but better safe than sorry
+            received += ndata;
 
-            int mutex_reply = sps_pthread_mutex_timedlock(&dacp_conversation_lock, 2000000, command, 1);
-
-            // int mutex_reply = pthread_mutex_lock(&dacp_conversation_lock);
-            if (mutex_reply == 0)
+            while (needmore && ndata)
             {
-                pthread_cleanup_push(mutex_lock_cleanup, (void *)&dacp_conversation_lock);
+                int read;
+                needmore = http_data(&rt, data, ndata, &read);
+                ndata -= read;
+                data += read;
+            }
 
-                // make a socket:
-                sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+            // we never have more than one request outstanding, so anything more is unexpected
+            if (ndata) response->connection_close = 1;
+        }
+    }
 
-                if (sockfd == -1)
-                {
-                    // debug(1, "DACP socket could not be created -- error %d:
-                    // \"%s\".",errno,strerror(errno));
-                    response.code = 497; // Can't establish a socket to the DACP server
-                }
-                else
-                {
-                    pthread_cleanup_push(connect_cleanup, (void *)&sockfd);
-                    // debug(2, "dacp_send_command: open socket %d.",sockfd);
+    if ((result == 0) && (http_iserror(&rt)))
+    {
+        debug(3, "dacp_send_command: error parsing data.");
+        response->connection_close = 1;
+        result = 495;
+    }
 
-                    // This is for limiting the time to be spent waiting for a response.
+    // debug(1,"Size of response body is %d",response->size);
+    pthread_cleanup_pop(1); // this should call http_cleanup
+    // http_free(&rt);
+    pthread_cleanup_pop(
+        0); // this should *not* free the malloced buffer -- just pop the malloc cleanup
 
-                    struct timeval tv;
-                    tv.tv_sec = 0;
-                    tv.tv_usec = 500000;
+    if (result != 0)
+    {
+        free(response->body);
+        response->body = NULL;
+        response->malloced_size = 0;
+        response->size = 0;
+    }
 
-                    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof tv) == -1) debug(1, "dacp_send_command: error %d setting receive timeout.", errno);
+    return result;
+}
 
-                    if (setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (const char *)&tv, sizeof tv) == -1) debug(1, "dacp_send_command: error %d setting send timeout.", errno);
+// send the command on the connection, (re)making it as necessary -- returns the HTTP response
+// code or one of the custom ones listed in dacp_send_command()
+static int dacp_connection_request(dacp_connection * c, const char * command,
+                                   struct HttpResponse * response)
+{
+    char message[1024];
+    int result = dacp_connection_resolve(c);
 
-                    // connect!
-                    // debug(1, "DACP socket created.");
-                    if (connect(sockfd, res->ai_addr, res->ai_addrlen) < 0)
-                    {
-                        // debug(1, "dacp_send_command: connect failed with errno %d.", errno);
-                        if (errno == ECONNREFUSED) response.code = 491;  // DACP server doesn't want to talk anymore...
-                        else response.code = 496;                        // Can't connect to the DACP server
-                    }
-                    else
-                    {
-                        // debug(1,"DACP connect succeeded.");
+    if (result == 0)
+    {
+        snprintf(message, sizeof(message),
+                 "GET /ctrl-int/1/%s HTTP/1.1\r\nHost: %s:%u\r\nActive-Remote: %s\r\n\r\n", command,
+                 dacp_server.ip_string, dacp_server.port, dacp_server.active_remote_id);
 
-                        snprintf(message, sizeof(message),
-                                 "GET /ctrl-int/1/%s HTTP/1.1\r\nHost: %s:%u\r\nActive-Remote: %s\r\n\r\n",
-                                 command, dacp_server.ip_string, dacp_server.port,
-                                 dacp_server.active_remote_id);
+        // Send command
+        debug(3, "dacp_send_command: \"%s\".", command);
 
-                        // Send command
-                        debug(3, "dacp_send_command: \"%s\".", command);
-                        ssize_t wresp = send(sockfd, message, strlen(message), 0);
+        pthread_cleanup_push(dacp_connection_cleanup, (void *)c);
 
-                        if (wresp == -1)
-                        {
-                            char errorstring[1024];
-                            strerror_r(errno, (char *)errorstring, sizeof(errorstring));
-                            debug(2, "dacp_send_command: write error %d: \"%s\".", errno, (char *)errorstring);
-                            struct linger so_linger;
-                            so_linger.l_onoff = 1; // "true"
-                            so_linger.l_linger = 0;
-                            int err = setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &so_linger, sizeof so_linger);
-
-                            if (err) debug(1, "Could not set the dacp socket to abort due to a write error on closing.");
-                        }
+        int attempt;
 
-                        if (wresp != (ssize_t)strlen(message))
-                        {
-                            // debug(1, "dacp_send_command: send failed.");
-                            response.code = 493; // Client failed to send a message
-                        }
-                        else
-                        {
-                            response.body = malloc(2048); // it can resize this if necessary
-                            response.malloced_size = 2048;
-                            pthread_cleanup_push(malloc_cleanup, response.body);
+        for (attempt = 0; attempt < 2; attempt++)
+        {
+            int reused = (c->fd != -1);
 
-                            struct http_roundtripper rt;
-                            http_init(&rt, responseFuncs, &response);
-                            pthread_cleanup_push(http_cleanup, &rt);
+            result = 0;
 
-                            int needmore = 1;
-                            int looperror = 0;
-                            char buffer[8192];
-                            memset(buffer, 0, sizeof(buffer));
+            if (reused == 0) result = dacp_connection_open(c);
 
-                            while (needmore && !looperror)
-                            {
-                                const char * data = buffer;
+            if (result == 0) result = dacp_connection_exchange(c, message, response);
 
-                                if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof tv) == -1) debug(1, "dacp_send_command: error %d setting receive timeout.", errno);
+            if (result == 0)
+            {
+                result = response->code;
 
-                                ssize_t ndata = recv(sockfd, buffer, sizeof(buffer), 0);
+                if (response->connection_close) dacp_connection_close(c, 0);
 
-                                // debug(3, "Received %d bytes: \"%s\".", ndata, buffer);
-                                if (ndata <= 0)
-                                {
-                                    if (ndata == -1)
-                                    {
-                                        char errorstring[1024];
-                                        strerror_r(errno, (char *)errorstring, sizeof(errorstring));
-                                        debug(2, "dacp_send_command: receiving error %d: \"%s\".", errno,
-                                              (char *)errorstring);
-                                        struct linger so_linger;
-                                        so_linger.l_onoff = 1; // "true"
-                                        so_linger.l_linger = 0;
-                                        int err =
-                                            setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &so_linger, sizeof so_linger);
-
-                                        if (err)
-                                            debug(
-                                                1,
-                                                "Could not set the dacp socket to abort due to a read error on closing.");
-                                    }
-
-                                    free(response.body);
-                                    response.body = NULL;
-                                    response.malloced_size = 0;
-                                    response.size = 0;
-                                    response.code = 495; // Error receiving response
-                                    looperror = 1;
-                                }
+                break;
+            }
 
-                                while (needmore && ndata && !looperror)
-                                {
-                                    int read;
-                                    needmore = http_data(&rt, data, ndata, &read);
-                                    ndata -= read;
-                                    data += read;
-                                }
-                            }
+            dacp_connection_close(c, result != -1);
 
-                            if (http_iserror(&rt))
-                            {
-                                debug(3, "dacp_send_command: error parsing data.");
-                                free(response.body);
-                                response.body = NULL;
-                                response.malloced_size = 0;
-                                response.size = 0;
-                            }
+            if (result == -1)
+            {
+                result = 495; // Error receiving response
 
-                            // debug(1,"Size of response body is %d",response.size);
-                            pthread_cleanup_pop(1); // this should call http_cleanup
-                            // http_free(&rt);
-                            pthread_cleanup_pop(
-                                0); // this should *not* free the malloced buffer -- just pop the malloc cleanup
-                        }
-                    }
+                // a kept-alive connection may simply have been closed by the server -- try a new one
+                if (reused) debug(3, "dacp_send_command: reconnecting to send \"%s\".", command);
+                else break;
+            }
+            else break;
+        }
 
-                    pthread_cleanup_pop(1); // this should close the socket
-                                            // close(sockfd);
-                                            // debug(1,"DACP socket closed.");
-                }
+        pthread_cleanup_pop(0);
+    }
 
-                pthread_cleanup_pop(1); // this should unlock the dacp_conversation_lock);
-                // pthread_mutex_unlock(&dacp_conversation_lock);
-                // debug(1,"Sent command\"%s\" with a response body of size %d.",command,response.size);
-                // debug(1,"dacp_conversation_lock released.");
-            }
-            else
-            {
-                debug(3,
-                      "dacp_send_command: could not acquire a lock on the dacp transmit/receive section "
-                      "when attempting to "
-                      "send the command \"%s\". Possible timeout?",
-                      command);
-                response.code = 494; // This client is already busy
-            }
+    return result;
+}
+
+int dacp_send_command(const char * command, char * * body, ssize_t * bodysize)
+{
+    int result;
+
+    // debug(1,"dacp_send_command: command is: \"%s\".",command);
 
-            pthread_cleanup_pop(1); // this should free the addrinfo
-            // freeaddrinfo(res);
-            uint64_t et = get_absolute_time_in_ns() - start_time; // this will be in nanoseconds
-            debug(3, "dacp_send_command: %f seconds, response code %d, command \"%s\".",
-                  (1.0 * et) / 1000000000, response.code, command);
+    if (dacp_server.port == 0)
+    {
+        // debug(3, "No DACP port specified yet");
+        result = 490; // no port specified
+    }
+    else
+    {
+        // will malloc space for the body or set it to NULL -- the caller should free it.
+
+        // Using some custom HTTP-like return codes
+        //  498 Bad Address information for the DACP server
+        //  497 Can't establish a socket to the DACP server
+        //  496 Can't connect to the DACP server
+        //  495 Error receiving response
+        //  494 This client is already busy
+        //  493 Client failed to send a message
+        //  492 Argument out of range
+        //  491 Client refused connection
+        //  490 No port specified
+
+        struct HttpResponse response;
+        response.body = NULL;
+        response.malloced_size = 0;
+        response.size = 0;
+        response.code = 0;
+        response.connection_close = 0;
+
+        uint64_t start_time = get_absolute_time_in_ns();
+
+        // only do this one at a time -- the connection can only carry one conversation at a time
+        int mutex_reply = sps_pthread_mutex_timedlock(&dacp_conversation_lock, 2000000, command, 1);
+
+        // int mutex_reply = pthread_mutex_lock(&dacp_conversation_lock);
+        if (mutex_reply == 0)
+        {
+            pthread_cleanup_push(mutex_lock_cleanup, (void *)&dacp_conversation_lock);
+            result = dacp_connection_request(&dacp_command_connection, command, &response);
+            pthread_cleanup_pop(1); // this should unlock the dacp_conversation_lock);
+            // pthread_mutex_unlock(&dacp_conversation_lock);
+            // debug(1,"Sent command\"%s\" with a response body of size %d.",command,response.size);
+            // debug(1,"dacp_conversation_lock released.");
+        }
+        else
+        {
+            debug(3,
+                  "dacp_send_command: could not acquire a lock on the dacp transmit/receive section "
+                  "when attempting to "
+                  "send the command \"%s\". Possible timeout?",
+                  command);
+            result = 494; // This client is already busy
         }
 
+        uint64_t et = get_absolute_time_in_ns() - start_time; // this will be in nanoseconds
+        debug(3, "dacp_send_command: %f seconds, response code %d, command \"%s\".",
+              (1.0 * et) / 1000000000, result, command);
+
         *body = response.body;
         *bodysize = response.size;
-        result = response.code;
     }
 
     return result;
@@ -528,7 +643,7 @@ void set_dacp_server_information(rtsp_conn_info * conn)
     else dacp_server.active_remote_id = NULL;
 
     debug(3, "set_dacp_server_information set active-remote id to %s.", dacp_server.active_remote_id);
-    pthread_cond_signal(&dacp_server_information_cv);
+    pthread_cond_broadcast(&dacp_server_information_cv); // the monitor and status threads may be waiting
     debug_mutex_unlock(&dacp_server_information_lock, 3);
 }
 
@@ -568,10 +683,317 @@ void dacp_monitor_port_update_callback(char * dacp_id, uint16_t port)
         }
     }
 
-    pthread_cond_signal(&dacp_server_information_cv);
+    pthread_cond_broadcast(&dacp_server_information_cv); // the monitor and status threads may be waiting
     debug_mutex_unlock(&dacp_server_information_lock, 3);
 }
 
+// parse the response to a playstatusupdate request into the metadata hub, picking up the
+// revision number to use for the next request
+static void dacp_process_playstatusupdate(char * response, ssize_t le, int32_t * revision_number)
+{
+    int32_t item_size;
+    char * sp = response;
+
+    if (le >= 8)
+    {
+        // here start looking for the contents of the status update
+        if (dacp_tlv_crawl(&sp, &item_size) == 'cmst') // status
+        // here, we know that we are receiving playerstatusupdates, so set a flag
+        {
+            metadata_hub_modify_prolog();
+            // debug(1, "playstatusupdate release track metadata");
+            // metadata_hub_reset_track_metadata();
+            // metadata_store.playerstatusupdates_are_received = 1;
+            sp -= item_size; // drop down into the array -- don't skip over it
+            le -= 8;
+
+            // char typestring[5];
+            // we need to acquire the metadata data structure and possibly update it
+            while (le >= 8)
+            {
+                uint32_t type = dacp_tlv_crawl(&sp, &item_size);
+                le -= item_size + 8;
+                char * t;
+                // char u;
+                // char *st;
+                int32_t r;
+                uint32_t ui;
+                // uint64_t v;
+                // int i;
+
+                switch (type)
+                {
+                    case 'cmsr': // revision number
+                        t = sp - item_size;
+                        *revision_number = ntohl(*(uint32_t *)(t));
+                        // debug(1,"New revision number received: %d", revision_number);
+                        break;
+
+                    case 'caps': // play status
+                        t = sp - item_size;
+                        r = *(unsigned char *)(t);
+                        switch (r)
+                        {
+                            case 2:
+
+                                if (metadata_store.play_status != PS_STOPPED)
+                                {
+                                    metadata_store.play_status = PS_STOPPED;
+                                    debug(2, "Play status is \"stopped\".");
+                                }
+
+                                break;
+
+                            case 3:
+
+                                if (metadata_store.play_status != PS_PAUSED)
+                                {
+                                    metadata_store.play_status = PS_PAUSED;
+                                    debug(2, "Play status is \"paused\".");
+                                }
+
+                                break;
+
+                            case 4:
+
+                                if (metadata_store.play_status != PS_PLAYING)
+                                {
+                                    metadata_store.play_status = PS_PLAYING;
+                                    debug(2, "Play status changed to \"playing\".");
+                                }
+
+                                break;
+
+                            default:
+                                debug(1, "Unrecognised play status %d received.", r);
+                                break;
+                        }
+                        break;
+
+                    case 'cash': // shuffle status
+                        t = sp - item_size;
+                        r = *(unsigned char *)(t);
+                        switch (r)
+                        {
+                            case 0:
+
+                                if (metadata_store.shuffle_status != SS_OFF)
+                                {
+                                    metadata_store.shuffle_status = SS_OFF;
+                                    debug(2, "Shuffle status is \"off\".");
+                                }
+
+                                break;
+
+                            case 1:
+
+                                if (metadata_store.shuffle_status != SS_ON)
+                                {
+                                    metadata_store.shuffle_status = SS_ON;
+                                    debug(2, "Shuffle status is \"on\".");
+                                }
+
+                                break;
+
+                            default:
+                                debug(1, "Unrecognised shuffle status %d received.", r);
+                                break;
+                        }
+                        break;
+
+                    case 'carp': // repeat status
+                        t = sp - item_size;
+                        r = *(unsigned char *)(t);
+                        switch (r)
+                        {
+                            case 0:
+
+                                if (metadata_store.repeat_status != RS_OFF)
+                                {
+                                    metadata_store.repeat_status = RS_OFF;
+                                    debug(2, "Repeat status is \"none\".");
+                                }
+
+                                break;
+
+                            case 1:
+
+                                if (metadata_store.repeat_status != RS_ONE)
+                                {
+                                    metadata_store.repeat_status = RS_ONE;
+                                    debug(2, "Repeat status is \"one\".");
+                                }
+
+                                break;
+
+                            case 2:
+
+                                if (metadata_store.repeat_status != RS_ALL)
+                                {
+                                    metadata_store.repeat_status = RS_ALL;
+                                    debug(2, "Repeat status is \"all\".");
+                                }
+
+                                break;
+
+                            default:
+                                debug(1, "Unrecognised repeat status %d received.", r);
+                                break;
+                        }
+                        break;
+
+                    case 'cann': // track name
+                        debug(2, "DACP Track Name seen");
+
+                        if (string_update_with_size(&metadata_store.track_name,
+                                                    &metadata_store.track_name_changed, sp - item_size,
+                                                    item_size))
+                        {
+                            debug(2, "DACP Track Name set to: \"%s\"", metadata_store.track_name);
+                        }
+
+                        break;
+
+                    case 'cana': // artist name
+                        debug(2, "DACP Artist Name seen");
+
+                        if (string_update_with_size(&metadata_store.artist_name,
+                                                    &metadata_store.artist_name_changed, sp - item_size,
+                                                    item_size))
+                        {
+                            debug(2, "DACP Artist Name set to: \"%s\"", metadata_store.artist_name);
+                        }
+
+                        break;
+
+                    case 'canl': // album name
+                        debug(2, "DACP Album Name seen");
+
+                        if (string_update_with_size(&metadata_store.album_name,
+                                                    &metadata_store.album_name_changed, sp - item_size,
+                                                    item_size))
+                        {
+                            debug(2, "DACP Album Name set to: \"%s\"", metadata_store.album_name);
+                        }
+
+                        break;
+
+                    case 'cang': // genre
+                        debug(2, "DACP Genre seen");
+
+                        if (string_update_with_size(&metadata_store.genre, &metadata_store.genre_changed,
+                                                    sp - item_size, item_size))
+                        {
+                            debug(2, "DACP Genre set to: \"%s\"", metadata_store.genre);
+                        }
+
+                        break;
+
+                    case 'canp': // nowplaying 4 ids: dbid, plid, playlistItem, itemid (from mellowware
+                                 // see reference above)
+                        debug(2, "DACP Composite ID seen");
+
+                        if (memcmp(metadata_store.item_composite_id, sp - item_size,
+                                   sizeof(metadata_store.item_composite_id)) != 0)
+                        {
+                            memcpy(metadata_store.item_composite_id, sp - item_size,
+                                   sizeof(metadata_store.item_composite_id));
+                            char st[33];
+                            char * pt = st;
+                            int it;
+
+                            for (it = 0; it < 16; it++)
+                            {
+                                snprintf(pt, 3, "%02X", metadata_store.item_composite_id[it]);
+                                pt += 2;
+                            }
+
+                            *pt = 0;
+                            debug(2, "Item composite ID changed to 0x%s.", st);
+                            metadata_store.item_composite_id_changed = 1;
+                        }
+
+                        break;
+
+                    case 'astm':
+                        t = sp - item_size;
+                        ui = ntohl(*(uint32_t *)(t));
+                        debug(2, "DACP Song Time seen: \"%u\" of length %u.", ui, item_size);
+
+                        if (ui != metadata_store.songtime_in_milliseconds)
+                        {
+                            metadata_store.songtime_in_milliseconds = ui;
+                            metadata_store.songtime_in_milliseconds_changed = 1;
+                            debug(2, "DACP Song Time set to: \"%u\"",
+                                  metadata_store.songtime_in_milliseconds);
+                        }
+
+                        break;
+
+                    /*
+                                case 'mstt':
+                                case 'cant':
+                                case 'cast':
+                                case 'cmmk':
+                                case 'caas':
+                                case 'caar':
+                                  t = sp - item_size;
+                                  r = ntohl(*(uint32_t *)(t));
+                                  printf("    %d", r);
+                                  printf("    (0x");
+                                  t = sp - item_size;
+                                  for (i = 0; i < item_size; i++) {
+                                    printf("%02x", *t & 0xff);
+                                    t++;
+                                  }
+                                  printf(")");
+                                  break;
+                                case 'asai':
+                                  t = sp - item_size;
+                                  s = ntohl(*(uint32_t *)(t));
+                                  s = s << 32;
+                                  t += 4;
+                                  v = (ntohl(*(uint32_t *)(t))) & 0xffffffff;
+                                  s += v;
+                                  printf("    %lu", s);
+                                  printf("    (0x");
+                                  t = sp - item_size;
+                                  for (i = 0; i < item_size; i++) {
+                                    printf("%02x", *t & 0xff);
+                                    t++;
+                                  }
+                                  printf(")");
+                                  break;
+                     */
+                    default:
+                        /*
+                           printf("    0x");
+                           t = sp - item_size;
+                           for (i = 0; i < item_size; i++) {
+                            printf("%02x", *t & 0xff);
+                            t++;
+                           }
+                         */
+                        break;
+                }
+                // printf("\n");
+            }
+
+            // finished possibly writing to the metadata hub
+            metadata_hub_modify_epilog(
+                1); // should really see if this can be made responsive to changes
+        }
+        else
+        {
+            debug(1, "Status Update not found.\n");
+        }
+    }
+    else
+    {
+        debug(1, "Can't find any content in playerstatusupdate request");
+    }
+}
+
 void dacp_monitor_thread_code_cleanup(__attribute__((unused)) void * arg)
 {
     // debug(1, "dacp_monitor_thread_code_cleanup called.");
@@ -581,11 +1003,9 @@ void dacp_monitor_thread_code_cleanup(__attribute__((unused)) void * arg)
 void * dacp_monitor_thread_code(__attribute__((unused)) void * na)
 {
     int scan_index = 0;
-    int always_use_revision_number_1 = 0;
     // char server_reply[10000];
     // debug(1, "DACP monitor thread started.");
     // wait until we get a valid port number to begin monitoring it
-    int32_t revision_number = 1;
     int bad_result_count = 0;
     int idle_scan_count = 0;
 
@@ -656,9 +1076,6 @@ void * dacp_monitor_thread_code(__attribute__((unused)) void * na)
             }
         }
 
-        always_use_revision_number_1 =
-            dacp_server.always_use_revision_number_1; // set this while access is locked
-
         result = dacp_get_volume(&the_volume); // just want the http code
         pthread_cleanup_pop(1);
 
@@ -763,341 +1180,9 @@ void * dacp_monitor_thread_code(__attribute__((unused)) void * na)
                 if (diff) metadata_store.speaker_volume = the_volume;
 
                 metadata_hub_modify_epilog(diff);
-
-                ssize_t le;
-                char * response = NULL;
-                int32_t item_size;
-                char command[1024] = "";
-
-                if (always_use_revision_number_1 != 0) // for forked-daapd
-                    revision_number = 1;
-
-                snprintf(command, sizeof(command) - 1, "playstatusupdate?revision-number=%d",
-                         revision_number);
-                // debug(1,"dacp_monitor_thread_code: command: \"%s\"",command);
-                result = dacp_send_command(command, &response, &le);
-
-                // debug(1,"Response to \"%s\" is %d.",command,result);
-                // remember: unless the revision_number you pass in is 1,
-                // response will be 200 only if there's something new to report.
-                if (result == 200)
-                {
-                    // if (0) {
-                    char * sp = response;
-
-                    if (le >= 8)
-                    {
-                        // here start looking for the contents of the status update
-                        if (dacp_tlv_crawl(&sp, &item_size) == 'cmst') // status
-                        // here, we know that we are receiving playerstatusupdates, so set a flag
-                        {
-                            metadata_hub_modify_prolog();
-                            // debug(1, "playstatusupdate release track metadata");
-                            // metadata_hub_reset_track_metadata();
-                            // metadata_store.playerstatusupdates_are_received = 1;
-                            sp -= item_size; // drop down into the array -- don't skip over it
-                            le -= 8;
-
-                            // char typestring[5];
-                            // we need to acquire the metadata data structure and possibly update it
-                            while (le >= 8)
-                            {
-                                uint32_t type = dacp_tlv_crawl(&sp, &item_size);
-                                le -= item_size + 8;
-                                char * t;
-                                // char u;
-                                // char *st;
-                                int32_t r;
-                                uint32_t ui;
-                                // uint64_t v;
-                                // int i;
-
-                                switch (type)
-                                {
-                                    case 'cmsr': // revision number
-                                        t = sp - item_size;
-                                        revision_number = ntohl(*(uint32_t *)(t));
-                                        // debug(1,"New revision number received: %d", revision_number);
-                                        break;
-
-                                    case 'caps': // play status
-                                        t = sp - item_size;
-                                        r = *(unsigned char *)(t);
-                                        switch (r)
-                                        {
-                                            case 2:
-
-                                                if (metadata_store.play_status != PS_STOPPED)
-                                                {
-                                                    metadata_store.play_status = PS_STOPPED;
-                                                    debug(2, "Play status is \"stopped\".");
-                                                }
-
-                                                break;
-
-                                            case 3:
-
-                                                if (metadata_store.play_status != PS_PAUSED)
-                                                {
-                                                    metadata_store.play_status = PS_PAUSED;
-                                                    debug(2, "Play status is \"paused\".");
-                                                }
-
-                                                break;
-
-                                            case 4:
-
-                                                if (metadata_store.play_status != PS_PLAYING)
-                                                {
-                                                    metadata_store.play_status = PS_PLAYING;
-                                                    debug(2, "Play status changed to \"playing\".");
-                                                }
-
-                                                break;
-
-                                            default:
-                                                debug(1, "Unrecognised play status %d received.", r);
-                                                break;
-                                        }
-                                        break;
-
-                                    case 'cash': // shuffle status
-                                        t = sp - item_size;
-                                        r = *(unsigned char *)(t);
-                                        switch (r)
-                                        {
-                                            case 0:
-
-                                                if (metadata_store.shuffle_status != SS_OFF)
-                                                {
-                                                    metadata_store.shuffle_status = SS_OFF;
-                                                    debug(2, "Shuffle status is \"off\".");
-                                                }
-
-                                                break;
-
-                                            case 1:
-
-                                                if (metadata_store.shuffle_status != SS_ON)
-                                                {
-                                                    metadata_store.shuffle_status = SS_ON;
-                                                    debug(2, "Shuffle status is \"on\".");
-                                                }
-
-                                                break;
-
-                                            default:
-                                                debug(1, "Unrecognised shuffle status %d received.", r);
-                                                break;
-                                        }
-                                        break;
-
-                                    case 'carp': // repeat status
-                                        t = sp - item_size;
-                                        r = *(unsigned char *)(t);
-                                        switch (r)
-                                        {
-                                            case 0:
-
-                                                if (metadata_store.repeat_status != RS_OFF)
-                                                {
-                                                    metadata_store.repeat_status = RS_OFF;
-                                                    debug(2, "Repeat status is \"none\".");
-                                                }
-
-                                                break;
-
-                                            case 1:
-
-                                                if (metadata_store.repeat_status != RS_ONE)
-                                                {
-                                                    metadata_store.repeat_status = RS_ONE;
-                                                    debug(2, "Repeat status is \"one\".");
-                                                }
-
-                                                break;
-
-                                            case 2:
-
-                                                if (metadata_store.repeat_status != RS_ALL)
-                                                {
-                                                    metadata_store.repeat_status = RS_ALL;
-                                                    debug(2, "Repeat status is \"all\".");
-                                                }
-
-                                                break;
-
-                                            default:
-                                                debug(1, "Unrecognised repeat status %d received.", r);
-                                                break;
-                                        }
-                                        break;
-
-                                    case 'cann': // track name
-                                        debug(2, "DACP Track Name seen");
-
-                                        if (string_update_with_size(&metadata_store.track_name,
-                                                                    &metadata_store.track_name_changed, sp - item_size,
-                                                                    item_size))
-                                        {
-                                            debug(2, "DACP Track Name set to: \"%s\"", metadata_store.track_name);
-                                        }
-
-                                        break;
-
-                                    case 'cana': // artist name
-                                        debug(2, "DACP Artist Name seen");
-
-                                        if (string_update_with_size(&metadata_store.artist_name,
-                                                                    &metadata_store.artist_name_changed, sp - item_size,
-                                                                    item_size))
-                                        {
-                                            debug(2, "DACP Artist Name set to: \"%s\"", metadata_store.artist_name);
-                                        }
-
-                                        break;
-
-                                    case 'canl': // album name
-                                        debug(2, "DACP Album Name seen");
-
-                                        if (string_update_with_size(&metadata_store.album_name,
-                                                                    &metadata_store.album_name_changed, sp - item_size,
-                                                                    item_size))
-                                        {
-                                            debug(2, "DACP Album Name set to: \"%s\"", metadata_store.album_name);
-                                        }
-
-                                        break;
-
-                                    case 'cang': // genre
-                                        debug(2, "DACP Genre seen");
-
-                                        if (string_update_with_size(&metadata_store.genre, &metadata_store.genre_changed,
-                                                                    sp - item_size, item_size))
-                                        {
-                                            debug(2, "DACP Genre set to: \"%s\"", metadata_store.genre);
-                                        }
-
-                                        break;
-
-                                    case 'canp': // nowplaying 4 ids: dbid, plid, playlistItem, itemid (from mellowware
-                                                 // see reference above)
-                                        debug(2, "DACP Composite ID seen");
-
-                                        if (memcmp(metadata_store.item_composite_id, sp - item_size,
-                                                   sizeof(metadata_store.item_composite_id)) != 0)
-                                        {
-                                            memcpy(metadata_store.item_composite_id, sp - item_size,
-                                                   sizeof(metadata_store.item_composite_id));
-                                            char st[33];
-                                            char * pt = st;
-                                            int it;
-
-                                            for (it = 0; it < 16; it++)
-                                            {
-                                                snprintf(pt, 3, "%02X", metadata_store.item_composite_id[it]);
-                                                pt += 2;
-                                            }
-
-                                            *pt = 0;
-                                            debug(2, "Item composite ID changed to 0x%s.", st);
-                                            metadata_store.item_composite_id_changed = 1;
-                                        }
-
-                                        break;
-
-                                    case 'astm':
-                                        t = sp - item_size;
-                                        ui = ntohl(*(uint32_t *)(t));
-                                        debug(2, "DACP Song Time seen: \"%u\" of length %u.", ui, item_size);
-
-                                        if (ui != metadata_store.songtime_in_milliseconds)
-                                        {
-                                            metadata_store.songtime_in_milliseconds = ui;
-                                            metadata_store.songtime_in_milliseconds_changed = 1;
-                                            debug(2, "DACP Song Time set to: \"%u\"",
-                                                  metadata_store.songtime_in_milliseconds);
-                                        }
-
-                                        break;
-
-                                    /*
-                                                case 'mstt':
-                                                case 'cant':
-                                                case 'cast':
-                                                case 'cmmk':
-                                                case 'caas':
-                                                case 'caar':
-                                                  t = sp - item_size;
-                                                  r = ntohl(*(uint32_t *)(t));
-                                                  printf("    %d", r);
-                                                  printf("    (0x");
-                                                  t = sp - item_size;
-                                                  for (i = 0; i < item_size; i++) {
-                                                    printf("%02x", *t & 0xff);
-                                                    t++;
-                                                  }
-                                                  printf(")");
-                                                  break;
-                                                case 'asai':
-                                                  t = sp - item_size;
-                                                  s = ntohl(*(uint32_t *)(t));
-                                                  s = s << 32;
-                                                  t += 4;
-                                                  v = (ntohl(*(uint32_t *)(t))) & 0xffffffff;
-                                                  s += v;
-                                                  printf("    %lu", s);
-                                                  printf("    (0x");
-                                                  t = sp - item_size;
-                                                  for (i = 0; i < item_size; i++) {
-                                                    printf("%02x", *t & 0xff);
-                                                    t++;
-                                                  }
-                                                  printf(")");
-                                                  break;
-                                     */
-                                    default:
-                                        /*
-                                           printf("    0x");
-                                           t = sp - item_size;
-                                           for (i = 0; i < item_size; i++) {
-                                            printf("%02x", *t & 0xff);
-                                            t++;
-                                           }
-                                         */
-                                        break;
-                                }
-                                // printf("\n");
-                            }
-
-                            // finished possibly writing to the metadata hub
-                            metadata_hub_modify_epilog(
-                                1); // should really see if this can be made responsive to changes
-                        }
-                        else
-                        {
-                            debug(1, "Status Update not found.\n");
-                        }
-                    }
-                    else
-                    {
-                        debug(1, "Can't find any content in playerstatusupdate request");
-                    }
-                } /* else {
-                     if (result != 403)
-                     debug(1, "Unexpected response %d to playerstatusupdate request", result);
-                     } */
-
-                if (response)
-                {
-                    free(response);
-                    response = NULL;
-                }
-
-                ;
             }
 
-            ;
+            // the play status is followed separately -- see dacp_status_thread_code()
 
             /*
                strcpy(command,"nowplayingartwork?mw=320&mh=320");
@@ -1127,6 +1212,124 @@ void * dacp_monitor_thread_code(__attribute__((unused)) void * na)
     pthread_exit(NULL);
 }
 
+// The play status is followed by a thread of its own, by means of revision-numbered
+// playstatusupdate requests on a connection of its own. A client that supports it holds each
+// request until there is a change to report (a "long poll"), so changes arrive as they happen.
+// A client that doesn't replies at once -- with a 403 if nothing has changed -- and is polled at
+// the scan interval, as before.
+
+#define DACP_STATUS_LONG_POLL_TIMEOUT_US 60000000
+
+static pthread_t dacp_status_thread;
+static dacp_connection dacp_status_connection = { -1, NULL, "", DACP_STATUS_LONG_POLL_TIMEOUT_US };
+
+// wait, with the dacp_server_information_lock held, for the DACP server information to change or
+// for the time to pass
+static int dacp_server_information_wait(uint64_t time_to_wait_for_wakeup_ns)
+{
+#ifdef COMPILE_FOR_LINUX_AND_FREEBSD_AND_CYGWIN_AND_OPENBSD
+    uint64_t time_of_wakeup_ns = get_absolute_time_in_ns() + time_to_wait_for_wakeup_ns;
+    uint64_t sec = time_of_wakeup_ns / 1000000000;
+    uint64_t nsec = time_of_wakeup_ns % 1000000000;
+#endif
+#ifdef COMPILE_FOR_OSX
+    uint64_t sec = time_to_wait_for_wakeup_ns / 1000000000;
+    uint64_t nsec = time_to_wait_for_wakeup_ns % 1000000000;
+#endif
+
+    struct timespec time_to_wait;
+    time_to_wait.tv_sec = sec;
+    time_to_wait.tv_nsec = nsec;
+
+#ifdef COMPILE_FOR_LINUX_AND_FREEBSD_AND_CYGWIN_AND_OPENBSD
+    return pthread_cond_timedwait(&dacp_server_information_cv, &dacp_server_information_lock,
+                                  &time_to_wait); // this is a pthread cancellation point
+#endif
+#ifdef COMPILE_FOR_OSX
+    return pthread_cond_timedwait_relative_np(&dacp_server_information_cv,
+                                              &dacp_server_information_lock, &time_to_wait);
+#endif
+}
+
+void * dacp_status_thread_code(__attribute__((unused)) void * na)
+{
+    int32_t revision_number = 1;
+    char dacp_id[sizeof(dacp_server.dacp_id)] = "";
+
+    while (1)
+    {
+        int always_use_revision_number_1;
+        int result;
+
+        sps_pthread_mutex_timedlock(
+            &dacp_server_information_lock, 500000,
+            "dacp_status_thread_code couldn't get DACP server information lock in 0.5 second!.", 2);
+        pthread_cleanup_push(dacp_monitor_thread_code_cleanup, NULL);
+
+        // wait for the monitor to find a DACP server that can report its status -- its finding
+        // isn't signalled, so look again every second
+        while ((dacp_server.scan_enable == 0) || (dacp_server.port == 0) ||
+               (metadata_store.advanced_dacp_server_active == 0))
+            dacp_server_information_wait(1000000000);
+
+        if (strcmp(dacp_id, dacp_server.dacp_id) != 0)
+        {
+            // a different client, so start again from the beginning
+            memcpy(dacp_id, dacp_server.dacp_id, sizeof(dacp_id));
+            revision_number = 1;
+        }
+
+        always_use_revision_number_1 =
+            dacp_server.always_use_revision_number_1; // set this while access is locked
+        pthread_cleanup_pop(1);
+
+        if (always_use_revision_number_1 != 0) // for forked-daapd
+            revision_number = 1;
+
+        char command[1024] = "";
+        snprintf(command, sizeof(command) - 1, "playstatusupdate?revision-number=%d", revision_number);
+
+        struct HttpResponse response;
+        response.body = NULL;
+        response.malloced_size = 0;
+        response.size = 0;
+        response.code = 0;
+        response.connection_close = 0;
+
+        int32_t requested_revision_number = revision_number;
+        uint64_t start_time = get_absolute_time_in_ns();
+        // debug(1,"dacp_status_thread_code: command: \"%s\"",command);
+        result = dacp_connection_request(&dacp_status_connection, command, &response);
+        uint64_t et = get_absolute_time_in_ns() - start_time;
+
+        // debug(1,"Response to \"%s\" is %d.",command,result);
+        // remember: unless the revision_number you pass in is 1,
+        // response will be 200 only if there's something new to report.
+        pthread_cleanup_push(malloc_cleanup, response.body);
+
+        if (result == 200)
+            dacp_process_playstatusupdate(response.body, response.size, &revision_number);
+        else if (result != 403)
+            revision_number = 1; // something went wrong, so get the whole status next time
+
+        pthread_cleanup_pop(1);
+
+        // If the request was held by the client, or brought news of a change, ask for the next
+        // change straight away; otherwise the client isn't long polling, so wait a while.
+        int held = (et > 1000000000);
+        int advanced = (result == 200) && (always_use_revision_number_1 == 0) &&
+            (revision_number != requested_revision_number);
+
+        if ((held == 0) && (advanced == 0))
+        {
+            if (metadata_store.player_thread_active) sleep(config.scan_interval_when_active);
+            else sleep(config.scan_interval_when_inactive);
+        }
+    }
+    debug(1, "DACP status thread exiting -- should never happen.");
+    pthread_exit(NULL);
+}
+
 void dacp_monitor_start()
 {
     int rc;
@@ -1193,6 +1396,7 @@ void dacp_monitor_start()
     memset(&dacp_server, 0, sizeof(dacp_server_record));
 
     pthread_create(&dacp_monitor_thread, NULL, dacp_monitor_thread_code, NULL);
+    pthread_create(&dacp_status_thread, NULL, dacp_status_thread_code, NULL);
     dacp_monitor_initialised = 1;
 }
 
@@ -1201,6 +1405,8 @@ void dacp_monitor_stop()
     if (dacp_monitor_initialised) // only if it's been started and initialised
     {
         debug(2, "dacp_monitor_stop");
+        pthread_cancel(dacp_status_thread);
+        pthread_join(dacp_status_thread, NULL);
         pthread_cancel(dacp_monitor_thread);
         pthread_join(dacp_monitor_thread, NULL);
         pthread_mutex_destroy(&dacp_server_information_lock);
@@ -1214,6 +1420,22 @@ void dacp_monitor_stop()
             free(dacp_server.active_remote_id);
             dacp_server.active_remote_id = NULL;
         }
+
+        dacp_connection_close(&dacp_command_connection, 0);
+
+        if (dacp_command_connection.address)
+        {
+            freeaddrinfo(dacp_command_connection.address);
+            dacp_command_connection.address = NULL;
+        }
+
+        dacp_connection_close(&dacp_status_connection, 0);
+
+        if (dacp_status_connection.address)
+        {
+            freeaddrinfo(dacp_status_connection.address);
+            dacp_status_connection.address = NULL;
+        }
     }
 }
 
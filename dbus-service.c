@@ -38,7 +38,9 @@
 #include "rtp.h"
 
 #include "dacp.h"
+#include "latency_histogram.h"
 #include "metadata_hub.h"
+#include "pipeline_profile.h"
 
 #include "dbus-service.h"
 
@@ -63,37 +65,49 @@ void dbus_metadata_watcher(struct metadata_bundle * argc, __attribute__((unused)
 
     const char * th;
 
-    shairport_sync_advanced_remote_control_set_volume(shairportSyncAdvancedRemoteControlSkeleton,
-                                                      argc->speaker_volume);
+    // only the properties whose fields have changed are set, so that a batch of changes
+    // results in as few PropertiesChanged signals as possible
 
-    shairport_sync_remote_control_set_airplay_volume(shairportSyncRemoteControlSkeleton,
-                                                     argc->airplay_volume);
+    if (argc->changed_fields & MF_SPEAKER_VOLUME)
+        shairport_sync_advanced_remote_control_set_volume(shairportSyncAdvancedRemoteControlSkeleton,
+                                                          argc->speaker_volume);
 
-    shairport_sync_remote_control_set_client(shairportSyncRemoteControlSkeleton, argc->client_ip);
+    if (argc->changed_fields & MF_AIRPLAY_VOLUME)
+        shairport_sync_remote_control_set_airplay_volume(shairportSyncRemoteControlSkeleton,
+                                                         argc->airplay_volume);
+
+    if (argc->changed_fields & MF_CLIENT_IP)
+        shairport_sync_remote_control_set_client(shairportSyncRemoteControlSkeleton, argc->client_ip);
 
     // although it's a DACP server, the server is in fact, part of the the AirPlay "client" (their
     // term).
-    if (argc->dacp_server_active)
-    {
-        shairport_sync_remote_control_set_available(shairportSyncRemoteControlSkeleton, TRUE);
-    }
-    else
+    if (argc->changed_fields & MF_DACP_SERVER_ACTIVE)
     {
-        shairport_sync_remote_control_set_available(shairportSyncRemoteControlSkeleton, FALSE);
+        if (argc->dacp_server_active)
+        {
+            shairport_sync_remote_control_set_available(shairportSyncRemoteControlSkeleton, TRUE);
+        }
+        else
+        {
+            shairport_sync_remote_control_set_available(shairportSyncRemoteControlSkeleton, FALSE);
+        }
     }
 
-    if (argc->advanced_dacp_server_active)
+    if (argc->changed_fields & MF_ADVANCED_DACP_SERVER_ACTIVE)
     {
-        shairport_sync_advanced_remote_control_set_available(shairportSyncAdvancedRemoteControlSkeleton,
-                                                             TRUE);
-    }
-    else
-    {
-        shairport_sync_advanced_remote_control_set_available(shairportSyncAdvancedRemoteControlSkeleton,
-                                                             FALSE);
+        if (argc->advanced_dacp_server_active)
+        {
+            shairport_sync_advanced_remote_control_set_available(
+                shairportSyncAdvancedRemoteControlSkeleton, TRUE);
+        }
+        else
+        {
+            shairport_sync_advanced_remote_control_set_available(
+                shairportSyncAdvancedRemoteControlSkeleton, FALSE);
+        }
     }
 
-    if (argc->progress_string)
+    if ((argc->changed_fields & MF_PROGRESS_STRING) && (argc->progress_string))
     {
         // debug(1, "Check progress string");
         th = shairport_sync_remote_control_get_progress_string(shairportSyncRemoteControlSkeleton);
@@ -106,124 +120,139 @@ void dbus_metadata_watcher(struct metadata_bundle * argc, __attribute__((unused)
         }
     }
 
-    switch (argc->player_state)
+    if (argc->changed_fields & MF_PLAYER_STATE)
     {
-        case PS_NOT_AVAILABLE:
-            shairport_sync_remote_control_set_player_state(shairportSyncRemoteControlSkeleton,
-                                                           "Not Available");
-            break;
+        switch (argc->player_state)
+        {
+            case PS_NOT_AVAILABLE:
+                shairport_sync_remote_control_set_player_state(shairportSyncRemoteControlSkeleton,
+                                                               "Not Available");
+                break;
 
-        case PS_STOPPED:
-            shairport_sync_remote_control_set_player_state(shairportSyncRemoteControlSkeleton, "Stopped");
-            break;
+            case PS_STOPPED:
+                shairport_sync_remote_control_set_player_state(shairportSyncRemoteControlSkeleton, "Stopped");
+                break;
 
-        case PS_PAUSED:
-            shairport_sync_remote_control_set_player_state(shairportSyncRemoteControlSkeleton, "Paused");
-            break;
+            case PS_PAUSED:
+                shairport_sync_remote_control_set_player_state(shairportSyncRemoteControlSkeleton, "Paused");
+                break;
 
-        case PS_PLAYING:
-            shairport_sync_remote_control_set_player_state(shairportSyncRemoteControlSkeleton, "Playing");
-            break;
+            case PS_PLAYING:
+                shairport_sync_remote_control_set_player_state(shairportSyncRemoteControlSkeleton, "Playing");
+                break;
 
-        default:
-            debug(1, "This should never happen.");
+            default:
+                debug(1, "This should never happen.");
+        }
     }
 
-    switch (argc->play_status)
+    if (argc->changed_fields & MF_PLAY_STATUS)
     {
-        case PS_NOT_AVAILABLE:
-            strcpy(response, "Not Available");
-            break;
+        switch (argc->play_status)
+        {
+            case PS_NOT_AVAILABLE:
+                strcpy(response, "Not Available");
+                break;
 
-        case PS_STOPPED:
-            strcpy(response, "Stopped");
-            break;
+            case PS_STOPPED:
+                strcpy(response, "Stopped");
+                break;
 
-        case PS_PAUSED:
-            strcpy(response, "Paused");
-            break;
+            case PS_PAUSED:
+                strcpy(response, "Paused");
+                break;
 
-        case PS_PLAYING:
-            strcpy(response, "Playing");
-            break;
+            case PS_PLAYING:
+                strcpy(response, "Playing");
+                break;
 
-        default:
-            debug(1, "This should never happen.");
-    }
+            default:
+                debug(1, "This should never happen.");
+        }
 
-    th = shairport_sync_advanced_remote_control_get_playback_status(
-        shairportSyncAdvancedRemoteControlSkeleton);
+        th = shairport_sync_advanced_remote_control_get_playback_status(
+            shairportSyncAdvancedRemoteControlSkeleton);
 
-    // only set this if it's different
-    if ((th == NULL) || (strcasecmp(th, response) != 0))
-    {
-        debug(3, "Playback Status should be changed");
-        shairport_sync_advanced_remote_control_set_playback_status(
-            shairportSyncAdvancedRemoteControlSkeleton, response);
+        // only set this if it's different
+        if ((th == NULL) || (strcasecmp(th, response) != 0))
+        {
+            debug(3, "Playback Status should be changed");
+            shairport_sync_advanced_remote_control_set_playback_status(
+                shairportSyncAdvancedRemoteControlSkeleton, response);
+        }
     }
 
-    switch (argc->repeat_status)
+    if (argc->changed_fields & MF_REPEAT_STATUS)
     {
-        case RS_NOT_AVAILABLE:
-            strcpy(response, "Not Available");
-            break;
+        switch (argc->repeat_status)
+        {
+            case RS_NOT_AVAILABLE:
+                strcpy(response, "Not Available");
+                break;
 
-        case RS_OFF:
-            strcpy(response, "Off");
-            break;
+            case RS_OFF:
+                strcpy(response, "Off");
+                break;
 
-        case RS_ONE:
-            strcpy(response, "One");
-            break;
+            case RS_ONE:
+                strcpy(response, "One");
+                break;
 
-        case RS_ALL:
-            strcpy(response, "All");
-            break;
+            case RS_ALL:
+                strcpy(response, "All");
+                break;
 
-        default:
-            debug(1, "This should never happen.");
-    }
-    th = shairport_sync_advanced_remote_control_get_loop_status(
-        shairportSyncAdvancedRemoteControlSkeleton);
+            default:
+                debug(1, "This should never happen.");
+        }
+        th = shairport_sync_advanced_remote_control_get_loop_status(
+            shairportSyncAdvancedRemoteControlSkeleton);
 
-    // only set this if it's different
-    if ((th == NULL) || (strcasecmp(th, response) != 0))
-    {
-        debug(3, "Loop Status should be changed");
-        shairport_sync_advanced_remote_control_set_loop_status(
-            shairportSyncAdvancedRemoteControlSkeleton, response);
+        // only set this if it's different
+        if ((th == NULL) || (strcasecmp(th, response) != 0))
+        {
+            debug(3, "Loop Status should be changed");
+            shairport_sync_advanced_remote_control_set_loop_status(
+                shairportSyncAdvancedRemoteControlSkeleton, response);
+        }
     }
 
-    switch (argc->shuffle_status)
+    if (argc->changed_fields & MF_SHUFFLE_STATUS)
     {
-        case SS_NOT_AVAILABLE:
-            new_status = FALSE;
-            break;
+        switch (argc->shuffle_status)
+        {
+            case SS_NOT_AVAILABLE:
+                new_status = FALSE;
+                break;
 
-        case SS_OFF:
-            new_status = FALSE;
-            break;
+            case SS_OFF:
+                new_status = FALSE;
+                break;
 
-        case SS_ON:
-            new_status = TRUE;
-            break;
+            case SS_ON:
+                new_status = TRUE;
+                break;
 
-        default:
-            new_status = FALSE;
-            debug(1, "Unknown shuffle status -- this should never happen.");
-    }
+            default:
+                new_status = FALSE;
+                debug(1, "Unknown shuffle status -- this should never happen.");
+        }
 
-    current_status = shairport_sync_advanced_remote_control_get_shuffle(
-        shairportSyncAdvancedRemoteControlSkeleton);
+        current_status = shairport_sync_advanced_remote_control_get_shuffle(
+            shairportSyncAdvancedRemoteControlSkeleton);
 
-    // only set this if it's different
-    if (current_status != new_status)
-    {
-        debug(3, "Shuffle State should be changed");
-        shairport_sync_advanced_remote_control_set_shuffle(shairportSyncAdvancedRemoteControlSkeleton,
-                                                           new_status);
+        // only set this if it's different
+        if (current_status != new_status)
+        {
+            debug(3, "Shuffle State should be changed");
+            shairport_sync_advanced_remote_control_set_shuffle(shairportSyncAdvancedRemoteControlSkeleton,
+                                                               new_status);
+        }
     }
 
+    // the metadata is a single property, and is only rebuilt if any of its fields has changed
+    if ((argc->changed_fields & MF_TRACK_METADATA) == 0) return;
+
     // Build the metadata array
     debug(2, "Build metadata");
     GVariantBuilder * dict_builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
@@ -508,6 +537,56 @@ gboolean notify_statistics_callback(ShairportSyncDiagnostics         * skeleton,
     return TRUE;
 }
 
+gboolean notify_latency_histograms_callback(ShairportSyncDiagnostics         * skeleton,
+                                            __attribute__((unused)) gpointer user_data)
+{
+    if (shairport_sync_diagnostics_get_latency_histograms(skeleton))
+    {
+        debug(1, ">> start recording latency histograms");
+        latency_histograms_enabled = 1;
+    }
+    else
+    {
+        debug(1, ">> stop recording latency histograms");
+        latency_histograms_enabled = 0;
+    }
+
+    return TRUE;
+}
+
+static gboolean on_handle_get_latency_histograms(ShairportSyncDiagnostics * skeleton,
+                                                 GDBusMethodInvocation * invocation,
+                                                 __attribute__((unused)) gpointer user_data)
+{
+    char * histograms = latency_histograms_as_string();
+
+    shairport_sync_diagnostics_complete_get_latency_histograms(skeleton, invocation,
+                                                               histograms ? histograms : "");
+    free(histograms);
+    return TRUE;
+}
+
+static gboolean on_handle_reset_latency_histograms(ShairportSyncDiagnostics * skeleton,
+                                                   GDBusMethodInvocation * invocation,
+                                                   __attribute__((unused)) gpointer user_data)
+{
+    latency_histograms_reset();
+    shairport_sync_diagnostics_complete_reset_latency_histograms(skeleton, invocation);
+    return TRUE;
+}
+
+static gboolean on_handle_get_pipeline_profile(ShairportSyncDiagnostics * skeleton,
+                                               GDBusMethodInvocation * invocation,
+                                               __attribute__((unused)) gpointer user_data)
+{
+    char * profile = pipeline_profile_as_string();
+
+    shairport_sync_diagnostics_complete_get_pipeline_profile(skeleton, invocation,
+                                                             profile ? profile : "");
+    free(profile);
+    return TRUE;
+}
+
 gboolean notify_verbosity_callback(ShairportSyncDiagnostics         * skeleton,
                                    __attribute__((unused)) gpointer user_data)
 {
@@ -784,6 +863,7 @@ gboolean notify_interpolation_callback(ShairportSync                    * skelet
     if (strcasecmp(th, "basic") == 0) config.packet_stuffing = ST_basic;
     else if (strcasecmp(th, "soxr") == 0) config.packet_stuffing = ST_soxr;
     else if (strcasecmp(th, "auto") == 0) config.packet_stuffing = ST_auto;
+    else if (strcasecmp(th, "polyphase") == 0) config.packet_stuffing = ST_polyphase;
     else
     {
         warn("An unrecognised interpolation method: \"%s\" was requested via the D-Bus interface.", th);
@@ -801,6 +881,10 @@ gboolean notify_interpolation_callback(ShairportSync                    * skelet
                 shairport_sync_set_interpolation(skeleton, "auto");
                 break;
 
+            case ST_polyphase:
+                shairport_sync_set_interpolation(skeleton, "polyphase");
+                break;
+
             default:
                 debug(1, "This should never happen!");
                 shairport_sync_set_interpolation(skeleton, "basic");
@@ -811,13 +895,28 @@ gboolean notify_interpolation_callback(ShairportSync                    * skelet
 #else  /* ifdef CONFIG_SOXR */
 
     if (strcasecmp(th, "basic") == 0) config.packet_stuffing = ST_basic;
+    else if (strcasecmp(th, "auto") == 0) config.packet_stuffing = ST_auto;
+    else if (strcasecmp(th, "polyphase") == 0) config.packet_stuffing = ST_polyphase;
     else
     {
         warn("An unrecognised interpolation method: \"%s\" was requested via the D-Bus interface. "
              "(Possibly support for this method was not compiled "
              "into this version of Shairport Sync.)",
              th);
-        shairport_sync_set_interpolation(skeleton, "basic");
+        switch (config.packet_stuffing)
+        {
+            case ST_auto:
+                shairport_sync_set_interpolation(skeleton, "auto");
+                break;
+
+            case ST_polyphase:
+                shairport_sync_set_interpolation(skeleton, "polyphase");
+                break;
+
+            default:
+                shairport_sync_set_interpolation(skeleton, "basic");
+                break;
+        }
     }
 
 #endif /* ifdef CONFIG_SOXR */
@@ -1026,6 +1125,15 @@ static void on_dbus_name_acquired(GDBusConnection * connection, const gchar * na
     g_signal_connect(shairportSyncDiagnosticsSkeleton, "notify::file-and-line",
                      G_CALLBACK(notify_file_and_line_callback), NULL);
 
+    g_signal_connect(shairportSyncDiagnosticsSkeleton, "notify::latency-histograms",
+                     G_CALLBACK(notify_latency_histograms_callback), NULL);
+    g_signal_connect(shairportSyncDiagnosticsSkeleton, "handle-get-latency-histograms",
+                     G_CALLBACK(on_handle_get_latency_histograms), NULL);
+    g_signal_connect(shairportSyncDiagnosticsSkeleton, "handle-reset-latency-histograms",
+                     G_CALLBACK(on_handle_reset_latency_histograms), NULL);
+    g_signal_connect(shairportSyncDiagnosticsSkeleton, "handle-get-pipeline-profile",
+                     G_CALLBACK(on_handle_get_pipeline_profile), NULL);
+
     g_signal_connect(shairportSyncRemoteControlSkeleton, "handle-fast-forward",
                      G_CALLBACK(on_handle_fast_forward), NULL);
     g_signal_connect(shairportSyncRemoteControlSkeleton, "handle-rewind",
@@ -1126,6 +1234,11 @@ static void on_dbus_name_acquired(GDBusConnection * connection, const gchar * na
         shairport_sync_set_interpolation(SHAIRPORT_SYNC(shairportSyncSkeleton), "auto");
         debug(1, ">> interpolation set to \"auto\" (soxr support built in)");
     }
+    else if (config.packet_stuffing == ST_polyphase)
+    {
+        shairport_sync_set_interpolation(SHAIRPORT_SYNC(shairportSyncSkeleton), "polyphase");
+        debug(1, ">> interpolation set to \"polyphase\" (soxr support built in)");
+    }
     else
     {
         shairport_sync_set_interpolation(SHAIRPORT_SYNC(shairportSyncSkeleton), "soxr");
@@ -1144,6 +1257,11 @@ static void on_dbus_name_acquired(GDBusConnection * connection, const gchar * na
         shairport_sync_set_interpolation(SHAIRPORT_SYNC(shairportSyncSkeleton), "auto");
         debug(1, ">> interpolation set to \"auto\" (no soxr support)");
     }
+    else if (config.packet_stuffing == ST_polyphase)
+    {
+        shairport_sync_set_interpolation(SHAIRPORT_SYNC(shairportSyncSkeleton), "polyphase");
+        debug(1, ">> interpolation set to \"polyphase\" (no soxr support)");
+    }
 
 #endif /* ifdef CONFIG_SOXR */
 
@@ -1211,6 +1329,10 @@ static void on_dbus_name_acquired(GDBusConnection * connection, const gchar * na
         // debug(1, ">> statistics logging is on");
     }
 
+    shairport_sync_diagnostics_set_latency_histograms(
+        SHAIRPORT_SYNC_DIAGNOSTICS(shairportSyncDiagnosticsSkeleton),
+        latency_histograms_enabled ? TRUE : FALSE);
+
     if (config.debugger_show_elapsed_time == 0)
     {
         shairport_sync_diagnostics_set_elapsed_time(
@@ -0,0 +1,107 @@
+/*
+ * Block TPDF dither generator. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A block of TPDF noise is made at once from DITHER_LANES xorshift64 generators stepped together.
+
+#include <pthread.h>
+
+#include "common.h"
+#include "dither.h"
+
+// the lanes of the calling thread, seeded from the main generator the first time they're used
+static __thread uint64_t dither_lanes[DITHER_LANES];
+static __thread int dither_lanes_seeded = 0;
+
+static void dither_seed_lanes(void)
+{
+    int i;
+
+    r64_lock;
+
+    for (i = 0; i < DITHER_LANES; i++)
+    {
+        dither_lanes[i] = r64u();
+
+        if (dither_lanes[i] == 0) dither_lanes[i] = 1; // xorshift must never be zero
+    }
+
+    r64_unlock;
+    dither_lanes_seeded = 1;
+}
+
+// fill r[0..n-1] with random numbers, taking the lanes in turn
+static void dither_random_block(uint64_t * r, size_t n)
+{
+    uint64_t lanes[DITHER_LANES];
+    size_t i = 0;
+    int j;
+
+    for (j = 0; j < DITHER_LANES; j++) lanes[j] = dither_lanes[j];
+
+    for (; i + DITHER_LANES <= n; i += DITHER_LANES)
+    {
+        for (j = 0; j < DITHER_LANES; j++)
+        {
+            uint64_t x = lanes[j];
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            lanes[j] = x;
+            r[i + j] = x;
+        }
+    }
+
+    for (j = 0; i < n; i++, j++)
+    {
+        uint64_t x = lanes[j];
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        lanes[j] = x;
+        r[i] = x;
+    }
+
+    for (j = 0; j < DITHER_LANES; j++) dither_lanes[j] = lanes[j];
+}
+
+void dither_tpdf_block(int64_t * tpdf, size_t n, int64_t mask, int64_t * previous_random_number)
+{
+    size_t i;
+
+    if (n == 0) return;
+
+    if (dither_lanes_seeded == 0) dither_seed_lanes();
+
+    dither_random_block((uint64_t *)tpdf, n);
+
+    int64_t previous = *previous_random_number;
+    *previous_random_number = tpdf[n - 1];
+
+    // working from the end, each random number is still there when its successor needs it
+    for (i = n - 1; i > 0; i--) tpdf[i] = (tpdf[i] & mask) - (tpdf[i - 1] & mask);
+
+    tpdf[0] = (tpdf[0] & mask) - (previous & mask);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A block generator for TPDF dither.
+// The noise comes from a few independent xorshift generators, or lanes, used in rotation,
+// so filling a block has no serial dependency from one sample to the next and the
+// compiler can vectorise it. Each thread has its own lanes, so no locking is needed.
+
+#define DITHER_LANES 4
+
+// fill tpdf[0..n-1] with TPDF dither, i.e. (r[i] & mask) - (r[i-1] & mask), where the r[] are
+// uniformly distributed random numbers. r[-1] is taken from *previous_random_number
+// and the last r[] is left there, so the dither carries on from one block to the next.
+void dither_tpdf_block(int64_t * tpdf, size_t n, int64_t mask, int64_t * previous_random_number);
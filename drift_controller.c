@@ -0,0 +1,100 @@
+/*
+ * Drift correction. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A proportional-integral controller, fed forward with the measured drift, spreads the
+// corrections out at the rate they are needed -- see drift_controller.h.
+
+#include <string.h>
+
+#include "drift_controller.h"
+
+void drift_controller_init(drift_controller * controller, unsigned int sample_rate)
+{
+    memset(controller, 0, sizeof(*controller));
+    controller->sample_rate = sample_rate;
+    controller->proportional_time = 10.0;
+    controller->integral_time = 60.0;
+    controller->maximum_rate = 0.001; // keep the corrections below 1 in 1000 frames
+}
+
+void drift_controller_reset(drift_controller * controller)
+{
+    controller->integral = 0.0;
+    controller->owed = 0.0;
+    controller->rate = 0.0;
+}
+
+static double clamp(double value, double limit)
+{
+    if (value > limit) return limit;
+
+    if (value < -limit) return -limit;
+
+    return value;
+}
+
+int drift_controller_update(drift_controller * controller, int64_t sync_error, size_t frames,
+                            double feed_forward)
+{
+    int result = 0;
+    double interval = (1.0 * frames) / controller->sample_rate;
+    double scale = 1.0 / (controller->proportional_time * controller->sample_rate);
+
+    // a late output needs frames dropped, hence the minus signs
+    double proportional = -scale * sync_error;
+
+    controller->integral += sync_error * interval;
+
+    // don't let the integral wind up beyond what it could ever be allowed to correct
+    double integral_limit =
+        controller->maximum_rate * controller->proportional_time * controller->integral_time *
+        controller->sample_rate;
+    controller->integral = clamp(controller->integral, integral_limit);
+    double integral = -scale * controller->integral / controller->integral_time;
+
+    controller->rate =
+        clamp(clamp(feed_forward, controller->maximum_rate) + proportional + integral,
+              controller->maximum_rate);
+
+    controller->owed += controller->rate * frames;
+
+    // only one frame can be inserted or dropped at a time
+    if (controller->owed >= 1.0)
+    {
+        result = 1;
+        controller->owed -= 1.0;
+    }
+    else if (controller->owed <= -1.0)
+    {
+        result = -1;
+        controller->owed += 1.0;
+    }
+
+    // don't build up a backlog of frames that can't be corrected at one per call
+    controller->owed = clamp(controller->owed, 1.0);
+
+    return result;
+}
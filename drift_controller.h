@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A drift controller decides when to stuff or drop a frame to keep the output in sync.
+// It works out a correction rate, in frames per frame, from the expected drift between the
+// source and the DAC (the feed-forward) plus a proportional and an integral term in the
+// sync error, and accumulates it as the frames go by, asking for a correction each time
+// a whole frame is owed.
+// So a steady drift gets corrections spaced evenly at the drift rate, rather than in bursts
+// whenever the error crosses a threshold.
+
+typedef struct drift_controller
+{
+    unsigned int sample_rate;
+    double proportional_time; // seconds in which the proportional term alone would clear an error
+    double integral_time;     // seconds
+    double maximum_rate;      // the highest correction rate, in frames per frame
+    double integral;          // of the sync error over time, in frame-seconds
+    double owed;              // frames of correction accumulated but not yet made
+    double rate;              // the correction rate last worked out, in frames per frame
+} drift_controller;
+
+void drift_controller_init(drift_controller * controller, unsigned int sample_rate);
+
+// forget the history but keep the settings -- a new play session starts from here
+void drift_controller_reset(drift_controller * controller);
+
+// work out the correction for the next frames frames, given the current sync error in frames
+// (positive if the output is late) and the expected drift, in frames per frame
+// (positive if the DAC is consuming frames faster than the source is providing them).
+// It returns 1 to insert a frame, -1 to drop one or 0 to do nothing.
+int drift_controller_update(drift_controller * controller, int64_t sync_error, size_t frames,
+                            double feed_forward);
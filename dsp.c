@@ -0,0 +1,275 @@
+/*
+ * The DSP chain for loudness, convolution and software volume.
+ * This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "common.h"
+#include "dsp.h"
+#include "loudness.h"
+
+#ifdef CONFIG_CONVOLUTION
+#include <FFTConvolver/convolver.h>
+#endif
+
+void dsp_chain_init(dsp_chain * chain, size_t maximum_frames, unsigned int rate)
+{
+    chain->left = malloc(sizeof(float) * maximum_frames);
+    chain->right = malloc(sizeof(float) * maximum_frames);
+
+    if ((chain->left == NULL) || (chain->right == NULL)) die("Failed to allocate memory for the DSP buffers.");
+
+    chain->maximum_frames = maximum_frames;
+    chain->rate = rate;
+    chain->convolution_gain_db = 0.0;
+    chain->convolution_gain = 1.0;
+#ifdef CONFIG_CONVOLUTION
+    chain->convolver = convolver_create(rate);
+#else
+    chain->convolver = NULL;
+#endif
+
+    // the volume slot is left alone -- a volume may already have been published into it
+    chain->volume = 0x10000;
+    chain->volume_sequence_seen = 0;
+    chain->volume_taken = 0;
+    chain->loudness_sequence_seen = 0;
+    memset(&chain->loudness_l, 0, sizeof(loudness_processor));
+    loudness_set_coefficients(&chain->loudness_l, 0.0, rate);
+    chain->loudness_r = chain->loudness_l;
+}
+
+// The volume slot is a seqlock: the sequence number is odd while the slot is being written.
+// There is only ever one writer at a time -- player_volume_without_notification() holds
+// the volume control mutex -- so the writer never waits; the reader never waits either:
+// if it finds the slot being written, it just tries again on the next packet.
+
+void dsp_chain_set_volume(dsp_chain * chain, int32_t volume, const loudness_processor * loudness)
+{
+    dsp_volume_slot * slot = &chain->slot;
+    uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->volume = volume;
+
+    if (loudness)
+    {
+        slot->loudness = *loudness;
+        slot->loudness_sequence = sequence + 2;
+    }
+
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+// pick up a newly-published volume, if there is one, and return the volume to ramp to
+static int32_t dsp_chain_take_volume(dsp_chain * chain)
+{
+    dsp_volume_slot * slot = &chain->slot;
+    uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+    if ((sequence == chain->volume_sequence_seen) || (sequence & 1)) return chain->volume;
+
+    int32_t volume = slot->volume;
+    loudness_processor loudness = slot->loudness;
+    uint32_t loudness_sequence = slot->loudness_sequence;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence) return chain->volume; // try again next time
+
+    // only take the coefficients if they have been rewritten -- the filter state stays
+    if (loudness_sequence != chain->loudness_sequence_seen)
+    {
+        loudness_copy_coefficients(&chain->loudness_l, &loudness);
+        loudness_copy_coefficients(&chain->loudness_r, &loudness);
+        chain->loudness_sequence_seen = loudness_sequence;
+    }
+
+    chain->volume_sequence_seen = sequence;
+
+    // there's nothing to ramp from the first time
+    if (chain->volume_taken == 0)
+    {
+        chain->volume = volume;
+        chain->volume_taken = 1;
+    }
+
+    return volume;
+}
+
+void dsp_chain_free(dsp_chain * chain)
+{
+    free(chain->left);
+    chain->left = NULL;
+    free(chain->right);
+    chain->right = NULL;
+    chain->maximum_frames = 0;
+#ifdef CONFIG_CONVOLUTION
+
+    if (chain->convolver) convolver_destroy(chain->convolver);
+
+#endif
+    chain->convolver = NULL;
+}
+
+#ifdef CONFIG_CONVOLUTION
+// the convolution gain can be changed while playing, so check it, but only
+// recalculate the linear gain when it has actually changed
+static float dsp_chain_convolution_gain(dsp_chain * chain)
+{
+    if (config.convolution_gain != chain->convolution_gain_db)
+    {
+        chain->convolution_gain_db = config.convolution_gain;
+        chain->convolution_gain = pow(10.0, chain->convolution_gain_db / 20.0);
+    }
+
+    return chain->convolution_gain;
+}
+
+#endif
+
+static inline int32_t float_to_int32_clipped(float f)
+{
+    if (f >= 2147483648.0f) return INT32_MAX;
+    else if (f < -2147483648.0f) return INT32_MIN;
+    else return (int32_t)f;
+}
+
+// ramp the software volume from "from" to "to" over the packet, in place, in integers
+static void dsp_chain_ramp_volume(int32_t * buffer, size_t frames, int32_t from, int32_t to)
+{
+    int64_t step = (((int64_t)to - from) << 16) / (int64_t)frames; // per frame, in 16.32
+    int64_t v = (int64_t)from << 16;
+    size_t i;
+
+    for (i = 0; i < frames; i++)
+    {
+        v += step;
+        int64_t volume = v >> 16;
+        buffer[2 * i] = (int32_t)((buffer[2 * i] * volume) >> 16);
+        buffer[2 * i + 1] = (int32_t)((buffer[2 * i + 1] * volume) >> 16);
+    }
+}
+
+int dsp_chain_process(dsp_chain * chain, int32_t * buffer, size_t frames)
+{
+    // check the state of loudness and convolution flags here and don't change them for
+    // the packet
+
+    int do_loudness = config.loudness;
+    int convolution_is_enabled = 0;
+    int do_convolution = 0;
+
+#ifdef CONFIG_CONVOLUTION
+
+    // we will apply the convolution gain if convolution is enabled, even if there is no
+    // valid convolution happening
+    if (config.convolution) convolution_is_enabled = 1;
+
+    if ((config.convolution) && (config.convolver_valid)) do_convolution = 1;
+
+#endif
+
+    if (frames > chain->maximum_frames) die("DSP chain asked to process %zu frames, but can only take %zu.", frames, chain->maximum_frames);
+
+    // a change of software volume is ramped in over this packet
+    int32_t to = dsp_chain_take_volume(chain);
+    int32_t from = chain->volume;
+    chain->volume = to;
+
+    if ((do_loudness == 0) && (convolution_is_enabled == 0))
+    {
+        if ((from == to) || (frames == 0)) return 0;
+
+        dsp_chain_ramp_volume(buffer, frames, from, to);
+        return 1;
+    }
+
+    // All the stages are linear, so the software volume and the convolution gain can be
+    // applied together, on the way in.
+    // Volume must be applied here, ahead of the loudness filter, because the loudness filter
+    // will increase the signal level and it would saturate the int32_t otherwise
+    float gain = 1.0f / 65536.0f;
+
+#ifdef CONFIG_CONVOLUTION
+
+    if (convolution_is_enabled) gain *= dsp_chain_convolution_gain(chain);
+
+#endif
+
+    float * l = chain->left;
+    float * r = chain->right;
+    size_t i;
+
+    // Deinterleave and convert to float, once
+    if (from == to)
+    {
+        gain *= to;
+
+        for (i = 0; i < frames; i++)
+        {
+            l[i] = buffer[2 * i] * gain;
+            r[i] = buffer[2 * i + 1] * gain;
+        }
+    }
+    else
+    {
+        float v = from;
+        float step = ((float)to - from) / frames;
+
+        for (i = 0; i < frames; i++)
+        {
+            v += step;
+            l[i] = buffer[2 * i] * (v * gain);
+            r[i] = buffer[2 * i + 1] * (v * gain);
+        }
+    }
+
+#ifdef CONFIG_CONVOLUTION
+
+    if (do_convolution) convolver_process(chain->convolver, l, r, frames);
+
+#else
+    (void)do_convolution;
+#endif
+
+    if (do_loudness) loudness_process_block(&chain->loudness_l, &chain->loudness_r, l, r, frames);
+
+    // Interleave and convert back to int32_t, once
+    for (i = 0; i < frames; i++)
+    {
+        buffer[2 * i] = float_to_int32_clipped(l[i]);
+        buffer[2 * i + 1] = float_to_int32_clipped(r[i]);
+    }
+
+    return 1;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "loudness.h"
+
+struct convolver; // see FFTConvolver/convolver.h
+
+// The DSP chain takes a packet of interleaved 32-bit frames, converts it once to planar float,
+// applies the software volume and convolution gain, the convolution filter and the loudness
+// filter, in that order, and converts it back once, clipping as necessary.
+// The planar buffers are allocated when the session starts, not for every packet.
+
+// The software volume and the loudness filter coefficients are published to the chain by the
+// volume control thread through a slot, without locking; the chain picks up a new volume at
+// the start of a packet and ramps to it across that packet -- except for the first, which is
+// taken as it is, so that a session doesn't start with a ramp down from unity gain.
+
+typedef struct
+{
+    uint32_t sequence;          // odd while the slot is being written
+    int32_t volume;             // the software volume, a 16.16 fixed point quantity
+    uint32_t loudness_sequence; // the sequence number the coefficients were last written with
+    loudness_processor loudness; // the loudness filter coefficients -- its state is not used
+} dsp_volume_slot;
+
+typedef struct
+{
+    float * left;
+    float * right;
+    size_t maximum_frames;     // the capacity of each planar buffer
+    unsigned int rate;         // the frames per second it's run at -- the session's output rate
+    float convolution_gain_db; // the gain the linear value below was calculated for
+    float convolution_gain;
+    struct convolver * convolver; // the session's own, if convolution is built in
+
+    dsp_volume_slot slot;
+    uint32_t volume_sequence_seen;
+    int volume_taken; // 0 until the first published volume has been picked up
+    uint32_t loudness_sequence_seen;
+    int32_t volume; // the software volume in force at the end of the last packet
+    loudness_processor loudness_l, loudness_r;
+} dsp_chain;
+
+// the chain runs at the output rate, after any upsampling, so the loudness filter and the impulse
+// response are made for that rate
+void dsp_chain_init(dsp_chain * chain, size_t maximum_frames, unsigned int rate);
+void dsp_chain_free(dsp_chain * chain);
+
+// publish a new software volume and, unless loudness is NULL, new loudness filter coefficients,
+// made for chain->rate. Callers must be serialised -- this never blocks the player.
+void dsp_chain_set_volume(dsp_chain * chain, int32_t volume, const loudness_processor * loudness);
+
+// processes the interleaved stereo buffer in place if loudness or convolution is enabled,
+// or if the software volume is ramping to a new value.
+// returns 1 if the chain ran, in which case the software volume has been applied, 0 otherwise,
+// in which case chain->volume should be applied.
+int dsp_chain_process(dsp_chain * chain, int32_t * buffer, size_t frames);
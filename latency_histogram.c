@@ -0,0 +1,196 @@
+/*
+ * Latency histograms for the stages of the audio path. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Everything is updated with relaxed atomics, so the threads doing the work never wait for a
+// reader -- a snapshot taken meanwhile may be off by the odd count.
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "latency_histogram.h"
+
+typedef struct
+{
+    uint64_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t maximum_ns;
+} latency_histogram;
+
+int latency_histograms_enabled = 0;
+
+static latency_histogram latency_histograms[LH_stage_count];
+
+static const char * latency_stage_names[LH_stage_count] = {
+    "receive_to_store", "decode",          "buffer_residency", "frame_to_dsp",
+    "dsp",              "backend_write",   "dac_delay",
+};
+
+static inline int latency_histogram_bucket(uint64_t duration_ns)
+{
+    uint64_t us = duration_ns / 1000;
+
+    if (us == 0) return 0;
+
+    int bucket = 64 - __builtin_clzll(us); // 1 us is in bucket 1, 2-3 us in bucket 2, etc.
+
+    if (bucket >= LATENCY_HISTOGRAM_BUCKETS) bucket = LATENCY_HISTOGRAM_BUCKETS - 1;
+
+    return bucket;
+}
+
+void latency_histogram_record(latency_stage stage, uint64_t duration_ns)
+{
+    latency_histogram * h = &latency_histograms[stage];
+
+    __atomic_fetch_add(&h->buckets[latency_histogram_bucket(duration_ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total_ns, duration_ns, __ATOMIC_RELAXED);
+
+    uint64_t maximum = __atomic_load_n(&h->maximum_ns, __ATOMIC_RELAXED);
+
+    while ((duration_ns > maximum) &&
+           (!__atomic_compare_exchange_n(&h->maximum_ns, &maximum, duration_ns, 1, __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED)))
+        ;
+}
+
+uint64_t latency_histogram_time_now(void)
+{
+    if (latency_histograms_enabled == 0) return 0;
+
+    return get_absolute_time_in_ns();
+}
+
+uint64_t latency_histogram_record_since(latency_stage stage, uint64_t start)
+{
+    if (latency_histograms_enabled == 0) return 0;
+
+    uint64_t time_now = get_absolute_time_in_ns();
+
+    if ((start) && (time_now >= start)) latency_histogram_record(stage, time_now - start);
+
+    return time_now;
+}
+
+void latency_histograms_reset(void)
+{
+    int stage, bucket;
+
+    for (stage = 0; stage < LH_stage_count; stage++)
+    {
+        latency_histogram * h = &latency_histograms[stage];
+
+        for (bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; bucket++)
+            __atomic_store_n(&h->buckets[bucket], 0, __ATOMIC_RELAXED);
+
+        __atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->total_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->maximum_ns, 0, __ATOMIC_RELAXED);
+    }
+}
+
+const char * latency_stage_name(latency_stage stage)
+{
+    return latency_stage_names[stage];
+}
+
+void latency_histogram_summary(latency_stage stage, uint64_t * count, uint64_t * total_ns,
+                               uint64_t * maximum_ns)
+{
+    latency_histogram * h = &latency_histograms[stage];
+
+    *count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+    *total_ns = __atomic_load_n(&h->total_ns, __ATOMIC_RELAXED);
+    *maximum_ns = __atomic_load_n(&h->maximum_ns, __ATOMIC_RELAXED);
+}
+
+// like snprintf, but appends at *used, which keeps counting past the end of the buffer
+static void latency_histograms_append(char * buf, size_t size, size_t * used, const char * format,
+                                      ...)
+{
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(*used < size ? buf + *used : NULL, *used < size ? size - *used : 0, format,
+                      args);
+    va_end(args);
+
+    if (n > 0) *used += n;
+}
+
+size_t latency_histograms_format(char * buf, size_t size)
+{
+    size_t used = 0;
+    int stage, bucket;
+
+    if (size) buf[0] = '\0';
+
+    // the upper bound of each bucket, in microseconds -- the last has none
+    latency_histograms_append(buf, size, &used, "{\"enabled\":%s,\"bucket_limits_us\":[",
+                              latency_histograms_enabled ? "true" : "false");
+
+    for (bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS - 1; bucket++)
+        latency_histograms_append(buf, size, &used, "%s%" PRIu64, bucket ? "," : "",
+                                  (uint64_t)1 << bucket);
+
+    latency_histograms_append(buf, size, &used, "]");
+
+    for (stage = 0; stage < LH_stage_count; stage++)
+    {
+        latency_histogram * h = &latency_histograms[stage];
+        uint64_t count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+        uint64_t total_ns = __atomic_load_n(&h->total_ns, __ATOMIC_RELAXED);
+        uint64_t maximum_ns = __atomic_load_n(&h->maximum_ns, __ATOMIC_RELAXED);
+
+        latency_histograms_append(
+            buf, size, &used, ",\"%s\":{\"count\":%" PRIu64 ",\"mean_us\":%.1f,\"max_us\":%.1f,\"buckets\":[",
+            latency_stage_names[stage], count, count ? (total_ns * 0.001) / count : 0.0,
+            maximum_ns * 0.001);
+
+        for (bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; bucket++)
+            latency_histograms_append(buf, size, &used, "%s%" PRIu64, bucket ? "," : "",
+                                      __atomic_load_n(&h->buckets[bucket], __ATOMIC_RELAXED));
+
+        latency_histograms_append(buf, size, &used, "]}");
+    }
+
+    latency_histograms_append(buf, size, &used, "}");
+    return used;
+}
+
+char * latency_histograms_as_string(void)
+{
+    // leave room for counts that grow while it's being formatted
+    size_t size = latency_histograms_format(NULL, 0) + 256;
+    char * s = malloc(size);
+
+    if (s) latency_histograms_format(s, size);
+
+    return s;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-bucket histograms of how long each stage of the audio path takes.
+// Bucket 0 counts durations of under a microsecond; bucket n counts those from 2^(n-1) up to 2^n
+// microseconds, and the last bucket counts anything longer.
+// Recording is lock-free -- the counts are updated atomically, so that the receiver and player
+// threads can record while the histograms are read from elsewhere.
+
+#define LATENCY_HISTOGRAM_BUCKETS 32
+
+typedef enum
+{
+    LH_receive_to_store = 0, // datagram received to packet stored in the buffer
+    LH_decode,               // decrypting and decoding a packet
+    LH_buffer_residency,     // packet stored to packet taken by the player
+    LH_frame_to_dsp,         // packet taken by the player to the start of the DSP chain
+    LH_dsp,                  // DSP, volume, interpolation and stuffing
+    LH_backend_write,        // handing the frames to the backend
+    LH_dac_delay,            // the backend's reported delay, converted to time
+    LH_stage_count,
+} latency_stage;
+
+extern int latency_histograms_enabled; // set from diagnostics.latency_histograms
+
+void latency_histogram_record(latency_stage stage, uint64_t duration_ns);
+
+uint64_t latency_histogram_time_now(void); // returns 0 if the histograms are off
+
+// record the time since start (if start isn't 0) and return the time now, so that successive
+// stages can be chained. Returns 0, and records nothing, if the histograms are off.
+uint64_t latency_histogram_record_since(latency_stage stage, uint64_t start);
+
+void latency_histograms_reset(void);
+
+const char * latency_stage_name(latency_stage stage);
+
+// the count of a stage's durations, their total and the longest of them
+void latency_histogram_summary(latency_stage stage, uint64_t * count, uint64_t * total_ns,
+                               uint64_t * maximum_ns);
+
+// write the histograms as a JSON object into buf, returning the length it would have
+// had, excluding the terminating NUL, like snprintf
+size_t latency_histograms_format(char * buf, size_t size);
+
+// the same, in a buffer allocated with malloc -- free it afterwards
+char * latency_histograms_as_string(void);
@@ -0,0 +1,1215 @@
+/*
+ * A synthetic AirPlay 1 load generator. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Each stream is a minimal AirPlay 1 sender of an ALAC-encoded tone, with seeded random drops,
+// reordering and delays, so a run can be repeated.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <popt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#ifdef CONFIG_OPENSSL
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#endif
+
+#ifdef CONFIG_MBEDTLS
+#include <mbedtls/aes.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/pk.h>
+#endif
+
+#include "alac_encoder.h"
+
+#define LOADGEN_MAXIMUM_STREAMS   64
+#define LOADGEN_MAXIMUM_RECEIVERS 16
+#define LOADGEN_RATE              44100
+#define LOADGEN_PACKET_SIZE       (12 + ALAC_ENCODER_MAXIMUM_PACKET) // an RTP header and its payload
+#define LOADGEN_HISTORY           512  // packets kept to be sent again -- about four seconds
+#define LOADGEN_QUEUE             256  // packets waiting to be sent, delayed by jitter or reordering
+#define LOADGEN_MAXIMUM_JITTER    1000 // milliseconds -- the packets must still be in the history
+#define LOADGEN_RESPONSE_SIZE     4096
+
+// iTunes sets a sync packet's flags to 7, asking for this many frames to be added to the latency
+#define LOADGEN_SYNC_FLAGS           7
+#define LOADGEN_FIXED_LATENCY_OFFSET 11025
+
+// the receiver's public key, for sending it the AES key -- it's the public half of the key in
+// common.c
+#if defined(CONFIG_OPENSSL) || defined(CONFIG_MBEDTLS)
+static char loadgen_public_key[] =
+    "-----BEGIN PUBLIC KEY-----\n"
+    "MIIBIjANBgkqhkiG9w0BAQEFAAOCAQ8AMIIBCgKCAQEA59dE8qLieItsH1WgjrcF\n"
+    "RKj6eUWqi+bGLOX1HL3U3GhC/j0Qg90u3sG/1CUtwC5vOYvfDmFI6oSFXi5ELabW\n"
+    "JmT2dKHzBJKa3k9ok+8t9ucRqMd6DZHJ2YCCLlDRKSKv6kDqnw4UwPdpOMXziC/A\n"
+    "Mj3Z/lUVX1G7WSHCAWKf1zNS1eLvqr+boEjXuBOitnZ/bDzPHrTOZz0Dew0uowxf\n"
+    "/+sG+NCK3eQJVxqcaJ/vEHKIVd2M+5qL71yJQ+87X6oV3eaYvt3zWZYD6z5vYTcr\n"
+    "tij2VZ9Zmni/UAaHqn9JdsBWLUEpVviYnhimNVvYFZeCXg/IdTQ+x4IRdiXNv5hE\n"
+    "ewIDAQAB\n"
+    "-----END PUBLIC KEY-----\n";
+#endif
+
+typedef struct
+{
+    char * host;
+    char * port;
+} loadgen_receiver;
+
+// a packet waiting in the queue -- its contents are in the history
+typedef struct
+{
+    int in_use;
+    uint16_t seqno;
+    uint64_t send_time;
+} loadgen_queued_packet;
+
+typedef struct
+{
+    int index;
+    loadgen_receiver * receiver;
+    pthread_t thread;
+    unsigned short xsubi[3]; // its own random numbers, so that it does the same on each run
+
+    int rtsp_fd, audio_fd, control_fd, timing_fd;
+    struct sockaddr_storage audio_address, control_address;
+    socklen_t address_length;
+    char local_ip[INET6_ADDRSTRLEN], remote_ip[INET6_ADDRSTRLEN];
+    int cseq;
+    char url[128];
+    char response[LOADGEN_RESPONSE_SIZE]; // the headers of the latest RTSP response
+    char header_value[256];
+
+    uint32_t ssrc;
+    uint16_t first_seqno;
+    uint32_t first_timestamp;
+    uint64_t start_time;
+    uint64_t packets_made;
+    double frequency, phase;
+
+    uint8_t key[16], iv[16];
+#ifdef CONFIG_OPENSSL
+    EVP_CIPHER_CTX * cipher;
+#endif
+#ifdef CONFIG_MBEDTLS
+    mbedtls_aes_context cipher;
+#endif
+
+    uint8_t (* history)[LOADGEN_PACKET_SIZE];
+    uint16_t history_seqno[LOADGEN_HISTORY];
+    int history_length[LOADGEN_HISTORY]; // 0 if the slot is empty
+    loadgen_queued_packet queue[LOADGEN_QUEUE];
+
+    // read by the main thread for its reports -- they're only ever added to
+    uint64_t sent, lost, reordered, resend_requests, resend_requested_packets, resent, timing_replies;
+    int running;
+    const char * outcome; // why it stopped, or NULL if it ended as it should
+} loadgen_stream;
+
+static int loadgen_stream_count = 1;
+static double loadgen_duration = 0.0;
+static int loadgen_encrypt = 0;
+static double loadgen_loss = 0.0;
+static double loadgen_reorder = 0.0;
+static double loadgen_jitter = 0.0; // milliseconds
+static int loadgen_latency = 88200;
+static int loadgen_minimum_latency = 0;
+static double loadgen_frequency = 440.0;
+static double loadgen_ramp = 0.1;
+static double loadgen_report = 10.0;
+static int loadgen_seed = 1;
+
+static loadgen_receiver loadgen_receivers[LOADGEN_MAXIMUM_RECEIVERS];
+static int loadgen_receiver_count = 0;
+static loadgen_stream loadgen_streams[LOADGEN_MAXIMUM_STREAMS];
+
+static volatile sig_atomic_t loadgen_stop = 0;
+static uint64_t loadgen_end_time = 0; // 0 to run until interrupted
+
+static uint64_t loadgen_time_now(void)
+{
+    struct timespec tn;
+    clock_gettime(CLOCK_MONOTONIC, &tn);
+    return ((uint64_t)tn.tv_sec) * 1000000000 + tn.tv_nsec;
+}
+
+static void loadgen_put16(uint8_t * p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void loadgen_put32(uint8_t * p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+// the sender's clock, for the timing and sync packets, in NTP format -- any epoch will do
+static void loadgen_put_ntp(uint8_t * p, uint64_t time)
+{
+    loadgen_put32(p, time / 1000000000);
+    loadgen_put32(p + 4, ((time % 1000000000) << 32) / 1000000000);
+}
+
+// the frames and packets go at the real-time rate from the start of the stream
+static uint64_t loadgen_packet_time(loadgen_stream * s, uint64_t packet)
+{
+    return s->start_time +
+           (packet * ALAC_ENCODER_FRAMES_PER_PACKET * (uint64_t)1000000000) / LOADGEN_RATE;
+}
+
+static uint32_t loadgen_timestamp_now(loadgen_stream * s, uint64_t time_now)
+{
+    return s->first_timestamp + ((time_now - s->start_time) * LOADGEN_RATE) / 1000000000;
+}
+
+// base64 without the padding, as Apple's senders send it
+static void loadgen_base64(const uint8_t * data, size_t length, char * out)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i;
+
+    for (i = 0; i < length; i += 3)
+    {
+        uint32_t v = data[i] << 16;
+
+        if (i + 1 < length) v |= data[i + 1] << 8;
+
+        if (i + 2 < length) v |= data[i + 2];
+
+        *out++ = digits[(v >> 18) & 63];
+        *out++ = digits[(v >> 12) & 63];
+
+        if (i + 1 < length) *out++ = digits[(v >> 6) & 63];
+
+        if (i + 2 < length) *out++ = digits[v & 63];
+    }
+
+    *out = '\0';
+}
+
+// encrypt the AES key with the receiver's public key, RSA with OAEP padding, into out, which must
+// hold 256 bytes. Returns its length, or -1 if it can't be done
+static int loadgen_encrypt_key(loadgen_stream * s, uint8_t * out)
+{
+    int length = -1;
+#ifdef CONFIG_OPENSSL
+    BIO * bmem = BIO_new_mem_buf(loadgen_public_key, -1);
+    RSA * rsa = PEM_read_bio_RSA_PUBKEY(bmem, NULL, NULL, NULL);
+    BIO_free(bmem);
+
+    if (rsa)
+    {
+        length = RSA_public_encrypt(sizeof(s->key), s->key, out, rsa, RSA_PKCS1_OAEP_PADDING);
+        RSA_free(rsa);
+    }
+
+#endif
+#ifdef CONFIG_MBEDTLS
+    mbedtls_pk_context pkctx;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    const char * pers = "loadgen";
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&ctr_drbg);
+    mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char *)pers,
+                          strlen(pers));
+    mbedtls_pk_init(&pkctx);
+
+    if (mbedtls_pk_parse_public_key(&pkctx, (unsigned char *)loadgen_public_key,
+                                    sizeof(loadgen_public_key)) == 0)
+    {
+        mbedtls_rsa_context * trsa = mbedtls_pk_rsa(pkctx);
+        mbedtls_rsa_set_padding(trsa, MBEDTLS_RSA_PKCS_V21, MBEDTLS_MD_SHA1);
+
+        if (mbedtls_rsa_pkcs1_encrypt(trsa, mbedtls_ctr_drbg_random, &ctr_drbg, MBEDTLS_RSA_PUBLIC,
+                                      sizeof(s->key), s->key, out) == 0)
+            length = trsa->len;
+    }
+
+    mbedtls_pk_free(&pkctx);
+    mbedtls_ctr_drbg_free(&ctr_drbg);
+    mbedtls_entropy_free(&entropy);
+#endif
+#if !defined(CONFIG_OPENSSL) && !defined(CONFIG_MBEDTLS)
+    (void)s;
+    (void)out;
+#endif
+    return length;
+}
+
+static int loadgen_cipher_init(loadgen_stream * s)
+{
+#ifdef CONFIG_OPENSSL
+    s->cipher = EVP_CIPHER_CTX_new();
+
+    if ((s->cipher == NULL) || (EVP_EncryptInit_ex(s->cipher, EVP_aes_128_cbc(), NULL, s->key, s->iv) != 1))
+        return -1;
+
+    // the packets are whole blocks with no padding -- any part block is sent in the clear
+    EVP_CIPHER_CTX_set_padding(s->cipher, 0);
+    return 0;
+#elif defined(CONFIG_MBEDTLS)
+    mbedtls_aes_init(&s->cipher);
+    return mbedtls_aes_setkey_enc(&s->cipher, s->key, 128) == 0 ? 0 : -1;
+#else
+    (void)s;
+    return -1;
+#endif
+}
+
+static void loadgen_cipher_free(loadgen_stream * s)
+{
+#ifdef CONFIG_OPENSSL
+
+    if (s->cipher)
+    {
+        EVP_CIPHER_CTX_free(s->cipher);
+        s->cipher = NULL;
+    }
+
+#endif
+#ifdef CONFIG_MBEDTLS
+    mbedtls_aes_free(&s->cipher);
+#endif
+#if !defined(CONFIG_OPENSSL) && !defined(CONFIG_MBEDTLS)
+    (void)s;
+#endif
+}
+
+// each packet is encrypted afresh with the session's initialisation vector
+static void loadgen_encrypt_payload(loadgen_stream * s, uint8_t * buf, size_t length)
+{
+#ifdef CONFIG_OPENSSL
+    int outlen = 0;
+
+    if ((EVP_EncryptInit_ex(s->cipher, NULL, NULL, NULL, s->iv) != 1) ||
+        (EVP_EncryptUpdate(s->cipher, buf, &outlen, buf, length) != 1))
+        fprintf(stderr, "stream %d: AES encryption of a packet failed.\n", s->index + 1);
+
+#endif
+#ifdef CONFIG_MBEDTLS
+    unsigned char iv[16];
+    memcpy(iv, s->iv, sizeof(iv));
+    mbedtls_aes_crypt_cbc(&s->cipher, MBEDTLS_AES_ENCRYPT, length, iv, buf, buf);
+#endif
+#if !defined(CONFIG_OPENSSL) && !defined(CONFIG_MBEDTLS)
+    (void)s;
+    (void)buf;
+    (void)length;
+#endif
+}
+
+static int loadgen_write_all(int fd, const char * data, size_t length)
+{
+    while (length)
+    {
+        ssize_t n = write(fd, data, length);
+
+        if (n <= 0)
+        {
+            if ((n < 0) && (errno == EINTR)) continue;
+
+            return -1;
+        }
+
+        data += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+// the value of a header in the latest response, or NULL if it hasn't got it
+static char * loadgen_header(loadgen_stream * s, const char * name)
+{
+    char * line = strstr(s->response, "\r\n");
+    size_t name_length = strlen(name);
+
+    while ((line) && (line[2] != '\r') && (line[2] != '\0'))
+    {
+        line += 2;
+
+        if ((strncasecmp(line, name, name_length) == 0) && (line[name_length] == ':'))
+        {
+            char * value = line + name_length + 1;
+
+            while (*value == ' ') value++;
+
+            size_t length = strcspn(value, "\r\n");
+
+            if (length >= sizeof(s->header_value)) length = sizeof(s->header_value) - 1;
+
+            memcpy(s->header_value, value, length);
+            s->header_value[length] = '\0';
+            return s->header_value;
+        }
+
+        line = strstr(line, "\r\n");
+    }
+
+    return NULL;
+}
+
+// send an RTSP request and wait for the response. Returns its status code, or -1 if the
+// connection failed. The response's headers are kept for loadgen_header(); any content is read
+// and discarded
+static int loadgen_rtsp(loadgen_stream * s, const char * method, const char * headers,
+                        const char * content_type, const char * content)
+{
+    char request[4096];
+    int length;
+
+    if (content)
+        length = snprintf(request, sizeof(request),
+                          "%s %s RTSP/1.0\r\nCSeq: %d\r\n%sContent-Type: %s\r\nContent-Length: %zu\r\n"
+                          "User-Agent: shairport-sync-loadgen\r\n\r\n%s",
+                          method, s->url, ++s->cseq, headers ? headers : "", content_type,
+                          strlen(content), content);
+    else
+        length = snprintf(request, sizeof(request),
+                          "%s %s RTSP/1.0\r\nCSeq: %d\r\n%sUser-Agent: shairport-sync-loadgen\r\n\r\n",
+                          method, s->url, ++s->cseq, headers ? headers : "");
+
+    if ((length < 0) || ((size_t)length >= sizeof(request))) return -1;
+
+    if (loadgen_write_all(s->rtsp_fd, request, length) != 0) return -1;
+
+    // read up to the end of the headers
+    size_t received = 0;
+    char * end = NULL;
+
+    while (end == NULL)
+    {
+        if (received == sizeof(s->response) - 1) return -1;
+
+        ssize_t n = read(s->rtsp_fd, s->response + received, sizeof(s->response) - 1 - received);
+
+        if (n <= 0)
+        {
+            if ((n < 0) && (errno == EINTR)) continue;
+
+            return -1;
+        }
+
+        received += n;
+        s->response[received] = '\0';
+        end = strstr(s->response, "\r\n\r\n");
+    }
+
+    int code = -1;
+
+    if (sscanf(s->response, "RTSP/1.0 %d", &code) != 1) return -1;
+
+    // and skip the content
+    char * content_length = loadgen_header(s, "Content-Length");
+    size_t remaining = content_length ? (size_t)atoi(content_length) : 0;
+    size_t already = received - (end + 4 - s->response);
+
+    remaining = remaining > already ? remaining - already : 0;
+
+    while (remaining)
+    {
+        char discard[1024];
+        ssize_t n = read(s->rtsp_fd, discard, remaining < sizeof(discard) ? remaining : sizeof(discard));
+
+        if (n <= 0)
+        {
+            if ((n < 0) && (errno == EINTR)) continue;
+
+            return -1;
+        }
+
+        remaining -= n;
+    }
+
+    end[2] = '\0'; // keep the headers only
+    return code;
+}
+
+static int loadgen_udp_socket(int family, int * port)
+{
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    int fd = socket(family, SOCK_DGRAM, 0);
+
+    if (fd < 0) return -1;
+
+    memset(&address, 0, sizeof(address));
+    address.ss_family = family;
+    address_length = family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+
+    if ((bind(fd, (struct sockaddr *)&address, address_length) != 0) ||
+        (getsockname(fd, (struct sockaddr *)&address, &address_length) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+
+    if (family == AF_INET6) *port = ntohs(((struct sockaddr_in6 *)&address)->sin6_port);
+    else *port = ntohs(((struct sockaddr_in *)&address)->sin_port);
+
+    return fd;
+}
+
+static void loadgen_set_port(struct sockaddr_storage * address, int port)
+{
+    if (address->ss_family == AF_INET6) ((struct sockaddr_in6 *)address)->sin6_port = htons(port);
+    else ((struct sockaddr_in *)address)->sin_port = htons(port);
+}
+
+static int loadgen_transport_port(const char * transport, const char * name)
+{
+    const char * p = strstr(transport, name);
+
+    return p ? atoi(p + strlen(name)) : 0;
+}
+
+// connect and set up a session. Returns 0 if it's ready to stream
+static int loadgen_session_start(loadgen_stream * s)
+{
+    struct addrinfo hints, * info, * ai;
+    struct sockaddr_storage address;
+    socklen_t address_length;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(s->receiver->host, s->receiver->port, &hints, &info) != 0)
+    {
+        s->outcome = "the receiver's address could not be found";
+        return -1;
+    }
+
+    for (ai = info; ai; ai = ai->ai_next)
+    {
+        s->rtsp_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+        if (s->rtsp_fd < 0) continue;
+
+        if (connect(s->rtsp_fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+
+        close(s->rtsp_fd);
+        s->rtsp_fd = -1;
+    }
+
+    freeaddrinfo(info);
+
+    if (s->rtsp_fd < 0)
+    {
+        s->outcome = "could not connect to the receiver";
+        return -1;
+    }
+
+    // don't wait forever for a response
+    struct timeval timeout = { 5, 0 };
+    setsockopt(s->rtsp_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // the UDP packets go to the address the RTSP connection went to
+    address_length = sizeof(address);
+    getpeername(s->rtsp_fd, (struct sockaddr *)&address, &address_length);
+    s->audio_address = address;
+    s->control_address = address;
+    s->address_length = address_length;
+    getnameinfo((struct sockaddr *)&address, address_length, s->remote_ip, sizeof(s->remote_ip),
+                NULL, 0, NI_NUMERICHOST);
+
+    address_length = sizeof(address);
+    getsockname(s->rtsp_fd, (struct sockaddr *)&address, &address_length);
+    getnameinfo((struct sockaddr *)&address, address_length, s->local_ip, sizeof(s->local_ip), NULL,
+                0, NI_NUMERICHOST);
+
+    int control_port, timing_port, audio_port;
+    s->control_fd = loadgen_udp_socket(address.ss_family, &control_port);
+    s->timing_fd = loadgen_udp_socket(address.ss_family, &timing_port);
+    s->audio_fd = loadgen_udp_socket(address.ss_family, &audio_port);
+
+    if ((s->control_fd < 0) || (s->timing_fd < 0) || (s->audio_fd < 0))
+    {
+        s->outcome = "could not open the UDP sockets";
+        return -1;
+    }
+
+    snprintf(s->url, sizeof(s->url), "rtsp://%s/%" PRIu32, s->local_ip, s->ssrc);
+
+    if (loadgen_rtsp(s, "OPTIONS", NULL, NULL, NULL) != 200)
+    {
+        s->outcome = "OPTIONS failed";
+        return -1;
+    }
+
+    char sdp[2048], extra[1024] = "";
+    char v = address.ss_family == AF_INET6 ? '6' : '4';
+
+    if (loadgen_encrypt)
+    {
+        uint8_t encrypted_key[256];
+        char key_base64[360], iv_base64[32];
+        int key_length = loadgen_encrypt_key(s, encrypted_key);
+
+        if ((key_length <= 0) || (loadgen_cipher_init(s) != 0))
+        {
+            s->outcome = "could not set up the encryption";
+            return -1;
+        }
+
+        loadgen_base64(encrypted_key, key_length, key_base64);
+        loadgen_base64(s->iv, sizeof(s->iv), iv_base64);
+        snprintf(extra, sizeof(extra), "a=rsaaeskey:%s\r\na=aesiv:%s\r\n", key_base64, iv_base64);
+    }
+
+    if (loadgen_minimum_latency)
+    {
+        size_t used = strlen(extra);
+        snprintf(extra + used, sizeof(extra) - used, "a=min-latency:%d\r\n", loadgen_minimum_latency);
+    }
+
+    const int32_t * f = alac_encoder_fmtp;
+    snprintf(sdp, sizeof(sdp),
+             "v=0\r\no=iTunes %" PRIu32 " 0 IN IP%c %s\r\ns=iTunes\r\nc=IN IP%c %s\r\nt=0 0\r\n"
+             "m=audio 0 RTP/AVP 96\r\na=rtpmap:96 AppleLossless\r\n"
+             "a=fmtp:%d %d %d %d %d %d %d %d %d %d %d %d\r\n%s",
+             s->ssrc, v, s->local_ip, v, s->remote_ip, f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7],
+             f[8], f[9], f[10], f[11], extra);
+
+    int code = loadgen_rtsp(s, "ANNOUNCE", NULL, "application/sdp", sdp);
+
+    if (code != 200)
+    {
+        s->outcome = code == 453 ? "the receiver is busy with another session" : "ANNOUNCE failed";
+        return -1;
+    }
+
+    char headers[256];
+    snprintf(headers, sizeof(headers),
+             "Transport: RTP/AVP/UDP;unicast;interleaved=0-1;mode=record;control_port=%d;"
+             "timing_port=%d\r\n",
+             control_port, timing_port);
+
+    char * transport;
+
+    if ((loadgen_rtsp(s, "SETUP", headers, NULL, NULL) != 200) ||
+        ((transport = loadgen_header(s, "Transport")) == NULL))
+    {
+        s->outcome = "SETUP failed";
+        return -1;
+    }
+
+    int server_port = loadgen_transport_port(transport, "server_port=");
+    int server_control_port = loadgen_transport_port(transport, "control_port=");
+
+    if ((server_port == 0) || (server_control_port == 0))
+    {
+        s->outcome = "SETUP gave no ports";
+        return -1;
+    }
+
+    loadgen_set_port(&s->audio_address, server_port);
+    loadgen_set_port(&s->control_address, server_control_port);
+
+    snprintf(headers, sizeof(headers), "Range: npt=0-\r\nRTP-Info: seq=%u;rtptime=%" PRIu32 "\r\n",
+             s->first_seqno, s->first_timestamp);
+
+    if (loadgen_rtsp(s, "RECORD", headers, NULL, NULL) != 200)
+    {
+        s->outcome = "RECORD failed";
+        return -1;
+    }
+
+    if (loadgen_rtsp(s, "SET_PARAMETER", NULL, "text/parameters", "volume: -15.000000\r\n") != 200)
+    {
+        s->outcome = "SET_PARAMETER failed";
+        return -1;
+    }
+
+    // the streaming loop polls the connection only to notice if the receiver closes it
+    timeout.tv_sec = 0;
+    setsockopt(s->rtsp_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return 0;
+}
+
+static void loadgen_send_packet(loadgen_stream * s, uint16_t seqno)
+{
+    int slot = seqno % LOADGEN_HISTORY;
+
+    if ((s->history_length[slot]) && (s->history_seqno[slot] == seqno))
+    {
+        if (sendto(s->audio_fd, s->history[slot], s->history_length[slot], 0,
+                   (struct sockaddr *)&s->audio_address, s->address_length) > 0)
+            s->sent++;
+    }
+}
+
+static void loadgen_queue_packet(loadgen_stream * s, uint16_t seqno, uint64_t send_time)
+{
+    int i;
+
+    for (i = 0; i < LOADGEN_QUEUE; i++)
+    {
+        if (s->queue[i].in_use == 0)
+        {
+            s->queue[i].in_use = 1;
+            s->queue[i].seqno = seqno;
+            s->queue[i].send_time = send_time;
+            return;
+        }
+    }
+
+    loadgen_send_packet(s, seqno); // no room to hold it back
+}
+
+// make the next packet of the tone, keep it for resending, and send it, drop it or hold it back
+static void loadgen_make_packet(loadgen_stream * s)
+{
+    int16_t frames[ALAC_ENCODER_FRAMES_PER_PACKET * 2];
+    uint16_t seqno = s->first_seqno + (uint16_t)s->packets_made;
+    uint32_t timestamp = s->first_timestamp + (uint32_t)(s->packets_made * ALAC_ENCODER_FRAMES_PER_PACKET);
+    uint64_t due_time = loadgen_packet_time(s, s->packets_made);
+    int slot = seqno % LOADGEN_HISTORY;
+    int i;
+
+    for (i = 0; i < ALAC_ENCODER_FRAMES_PER_PACKET; i++)
+    {
+        int16_t sample = (int16_t)(8192.0 * sin(s->phase));
+        frames[i * 2] = sample;
+        frames[i * 2 + 1] = sample;
+        s->phase += 2.0 * M_PI * s->frequency / LOADGEN_RATE;
+
+        if (s->phase > 2.0 * M_PI) s->phase -= 2.0 * M_PI;
+    }
+
+    uint8_t * packet = s->history[slot];
+    packet[0] = 0x80;
+    packet[1] = s->packets_made == 0 ? 0xe0 : 0x60; // the marker bit on the first
+    loadgen_put16(packet + 2, seqno);
+    loadgen_put32(packet + 4, timestamp);
+    loadgen_put32(packet + 8, s->ssrc);
+
+    int length = alac_encode_packet(frames, ALAC_ENCODER_FRAMES_PER_PACKET, packet + 12);
+
+    if (loadgen_encrypt) loadgen_encrypt_payload(s, packet + 12, length & ~15);
+
+    s->history_seqno[slot] = seqno;
+    s->history_length[slot] = 12 + length;
+    s->packets_made++;
+
+    if (erand48(s->xsubi) < loadgen_loss)
+    {
+        s->lost++;
+        return;
+    }
+
+    uint64_t delay = 0;
+
+    if (loadgen_jitter > 0.0) delay = (uint64_t)(erand48(s->xsubi) * loadgen_jitter * 1000000);
+
+    // held back until the one after it has been sent
+    if (erand48(s->xsubi) < loadgen_reorder)
+    {
+        s->reordered++;
+        delay += loadgen_packet_time(s, 2) - loadgen_packet_time(s, 0) + (uint64_t)(loadgen_jitter * 1000000);
+    }
+
+    if (delay) loadgen_queue_packet(s, seqno, due_time + delay);
+    else loadgen_send_packet(s, seqno);
+}
+
+// send what's due from the queue and return when the next is due, or 0 if nothing is waiting
+static uint64_t loadgen_send_queued_packets(loadgen_stream * s, uint64_t time_now)
+{
+    uint64_t next = 0;
+    int i;
+
+    for (i = 0; i < LOADGEN_QUEUE; i++)
+    {
+        if (s->queue[i].in_use)
+        {
+            if (s->queue[i].send_time <= time_now)
+            {
+                loadgen_send_packet(s, s->queue[i].seqno);
+                s->queue[i].in_use = 0;
+            }
+            else if ((next == 0) || (s->queue[i].send_time < next))
+            {
+                next = s->queue[i].send_time;
+            }
+        }
+    }
+
+    return next;
+}
+
+static void loadgen_send_sync(loadgen_stream * s, uint64_t time_now, int first)
+{
+    uint8_t packet[20];
+    uint32_t timestamp = loadgen_timestamp_now(s, time_now);
+
+    packet[0] = first ? 0x90 : 0x80; // the extension bit on the first
+    packet[1] = 0xd4;
+    loadgen_put16(packet + 2, LOADGEN_SYNC_FLAGS);
+    loadgen_put32(packet + 4, timestamp - (loadgen_latency - LOADGEN_FIXED_LATENCY_OFFSET));
+    loadgen_put_ntp(packet + 8, time_now);
+    loadgen_put32(packet + 16, timestamp);
+    sendto(s->control_fd, packet, sizeof(packet), 0, (struct sockaddr *)&s->control_address,
+           s->address_length);
+}
+
+// answer a request to send packets again
+static void loadgen_control_receive(loadgen_stream * s)
+{
+    uint8_t request[2048];
+    ssize_t n = recv(s->control_fd, request, sizeof(request), 0);
+
+    if ((n < 8) || ((request[1] & 0x7f) != 0x55)) return;
+
+    uint16_t first = (request[4] << 8) | request[5];
+    uint16_t count = (request[6] << 8) | request[7];
+    int i;
+
+    s->resend_requests++;
+    s->resend_requested_packets += count;
+
+    for (i = 0; i < count; i++)
+    {
+        uint16_t seqno = first + i;
+        int slot = seqno % LOADGEN_HISTORY;
+
+        if ((s->history_length[slot] == 0) || (s->history_seqno[slot] != seqno)) continue;
+
+        if (erand48(s->xsubi) < loadgen_loss) continue; // lost again
+
+        uint8_t packet[4 + LOADGEN_PACKET_SIZE];
+        packet[0] = 0x80;
+        packet[1] = 0xd6;
+        loadgen_put16(packet + 2, 1);
+        memcpy(packet + 4, s->history[slot], s->history_length[slot]);
+
+        if (sendto(s->control_fd, packet, 4 + s->history_length[slot], 0,
+                   (struct sockaddr *)&s->control_address, s->address_length) > 0)
+            s->resent++;
+    }
+}
+
+// answer a timing request, from wherever it came
+static void loadgen_timing_receive(loadgen_stream * s)
+{
+    uint8_t request[128], reply[32];
+    struct sockaddr_storage from;
+    socklen_t from_length = sizeof(from);
+    ssize_t n = recvfrom(s->timing_fd, request, sizeof(request), 0, (struct sockaddr *)&from, &from_length);
+    uint64_t receive_time = loadgen_time_now();
+
+    if ((n < 32) || ((request[1] & 0x7f) != 0x52)) return;
+
+    memset(reply, 0, sizeof(reply));
+    reply[0] = 0x80;
+    reply[1] = 0xd3;
+    loadgen_put16(reply + 2, 7);
+    memcpy(reply + 8, request + 24, 8); // the origin is the request's transmit time
+    loadgen_put_ntp(reply + 16, receive_time);
+    loadgen_put_ntp(reply + 24, loadgen_time_now());
+
+    if (sendto(s->timing_fd, reply, sizeof(reply), 0, (struct sockaddr *)&from, from_length) > 0)
+        s->timing_replies++;
+}
+
+static void loadgen_stream_close(loadgen_stream * s)
+{
+    if (s->rtsp_fd >= 0) close(s->rtsp_fd);
+
+    if (s->audio_fd >= 0) close(s->audio_fd);
+
+    if (s->control_fd >= 0) close(s->control_fd);
+
+    if (s->timing_fd >= 0) close(s->timing_fd);
+
+    s->rtsp_fd = s->audio_fd = s->control_fd = s->timing_fd = -1;
+
+    if (loadgen_encrypt) loadgen_cipher_free(s);
+
+    free(s->history);
+    s->history = NULL;
+}
+
+static void * loadgen_stream_thread(void * arg)
+{
+    loadgen_stream * s = (loadgen_stream *)arg;
+
+    if (loadgen_session_start(s) != 0)
+    {
+        loadgen_stream_close(s);
+        s->running = 0;
+        return NULL;
+    }
+
+    s->start_time = loadgen_time_now();
+    uint64_t next_sync_time = s->start_time;
+    int first_sync = 1;
+
+    while ((loadgen_stop == 0) && (s->outcome == NULL))
+    {
+        uint64_t time_now = loadgen_time_now();
+
+        if ((loadgen_end_time) && (time_now >= loadgen_end_time)) break;
+
+        if (time_now >= next_sync_time)
+        {
+            loadgen_send_sync(s, time_now, first_sync);
+            first_sync = 0;
+            next_sync_time += 1000000000;
+        }
+
+        while (loadgen_packet_time(s, s->packets_made) <= time_now) loadgen_make_packet(s);
+
+        uint64_t next = loadgen_packet_time(s, s->packets_made);
+        uint64_t next_queued = loadgen_send_queued_packets(s, time_now);
+
+        if ((next_queued) && (next_queued < next)) next = next_queued;
+
+        if (next_sync_time < next) next = next_sync_time;
+
+        time_now = loadgen_time_now();
+        int timeout = next > time_now ? (int)((next - time_now + 999999) / 1000000) : 0;
+
+        struct pollfd fds[3] = { { s->control_fd, POLLIN, 0 },
+                                 { s->timing_fd, POLLIN, 0 },
+                                 { s->rtsp_fd, POLLIN, 0 } };
+
+        if (poll(fds, 3, timeout) > 0)
+        {
+            if (fds[0].revents & POLLIN) loadgen_control_receive(s);
+
+            if (fds[1].revents & POLLIN) loadgen_timing_receive(s);
+
+            if (fds[2].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                char discard[1024];
+                ssize_t n = read(s->rtsp_fd, discard, sizeof(discard));
+
+                if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EINTR)))
+                    s->outcome = "the receiver closed the connection";
+            }
+        }
+    }
+
+    if (s->outcome == NULL) loadgen_rtsp(s, "TEARDOWN", NULL, NULL, NULL);
+
+    loadgen_stream_close(s);
+    s->running = 0;
+    return NULL;
+}
+
+static void loadgen_signal_handler(__attribute__((unused)) int sig)
+{
+    loadgen_stop = 1;
+}
+
+// take "host", "host:port", "[address]:port", or an IPv6 address without a port
+static void loadgen_parse_receiver(const char * arg, loadgen_receiver * r)
+{
+    char * copy = strdup(arg);
+    char * colon;
+
+    if (copy == NULL)
+    {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    r->port = "5000";
+
+    if ((copy[0] == '[') && ((colon = strchr(copy, ']')) != NULL))
+    {
+        *colon = '\0';
+        r->host = copy + 1;
+
+        if (colon[1] == ':') r->port = colon + 2;
+    }
+    else if (((colon = strchr(copy, ':')) != NULL) && (strchr(colon + 1, ':') == NULL))
+    {
+        *colon = '\0';
+        r->host = copy;
+        r->port = colon + 1;
+    }
+    else
+    {
+        r->host = copy;
+    }
+}
+
+static void loadgen_print_totals(const char * title)
+{
+    uint64_t sent = 0, lost = 0, reordered = 0, requests = 0, requested = 0, resent = 0;
+    int running = 0;
+    int i;
+
+    for (i = 0; i < loadgen_stream_count; i++)
+    {
+        loadgen_stream * s = &loadgen_streams[i];
+        sent += s->sent;
+        lost += s->lost;
+        reordered += s->reordered;
+        requests += s->resend_requests;
+        requested += s->resend_requested_packets;
+        resent += s->resent;
+        running += s->running;
+    }
+
+    printf("%s: %d of %d streams running, %" PRIu64 " packets sent, %" PRIu64 " dropped, %" PRIu64
+           " reordered, %" PRIu64 " resend requests for %" PRIu64 " packets, %" PRIu64 " resent.\n",
+           title, running, loadgen_stream_count, sent, lost, reordered, requests, requested, resent);
+    fflush(stdout);
+}
+
+int main(int argc, char * argv[])
+{
+    signed char c;
+    poptContext optCon;
+    int i;
+
+    struct poptOption optionsTable[] = {
+        { "streams",         'n',  POPT_ARG_INT,    &loadgen_stream_count,    0,
+          "the number of streams to run, given to the receivers in turn (default 1)", "N" },
+        { "duration",        'd',  POPT_ARG_DOUBLE, &loadgen_duration,        0,
+          "stop after this many seconds (default: run until interrupted)", "SECONDS" },
+        { "encrypt",         'e',  POPT_ARG_NONE,   &loadgen_encrypt,         0,
+          "encrypt the audio with AES, sending the key with RSA, as iTunes does", NULL },
+        { "loss",            'l',  POPT_ARG_DOUBLE, &loadgen_loss,            0,
+          "the fraction of packets, and of packets sent again, to drop (default 0)", "FRACTION" },
+        { "reorder",         'o',  POPT_ARG_DOUBLE, &loadgen_reorder,         0,
+          "the fraction of packets to send after the one that follows them (default 0)", "FRACTION" },
+        { "jitter",          'j',  POPT_ARG_DOUBLE, &loadgen_jitter,          0,
+          "delay each packet by a random time of up to this many milliseconds (default 0)", "MS" },
+        { "latency",         'L',  POPT_ARG_INT,    &loadgen_latency,         0,
+          "the latency to ask for, in frames (default 88200)", "FRAMES" },
+        { "minimum-latency", '\0', POPT_ARG_INT,    &loadgen_minimum_latency, 0,
+          "the lowest latency to allow, sent as the ANNOUNCE's min-latency, in frames (default: none)",
+          "FRAMES" },
+        { "frequency",       'f',  POPT_ARG_DOUBLE, &loadgen_frequency,       0,
+          "the first stream's tone -- each of the next eleven is a semitone higher (default 440)", "HZ" },
+        { "ramp",            'r',  POPT_ARG_DOUBLE, &loadgen_ramp,            0,
+          "the time between starting one stream and the next (default 0.1)", "SECONDS" },
+        { "report",          'R',  POPT_ARG_DOUBLE, &loadgen_report,          0,
+          "print the totals this often, or only at the end if 0 (default 10)", "SECONDS" },
+        { "seed",            's',  POPT_ARG_INT,    &loadgen_seed,            0,
+          "the seed for the random impairments, so that a run can be repeated (default 1)", "N" },
+        POPT_AUTOHELP { NULL,              0,    0,               NULL,                     0,
+                        NULL, NULL }
+    };
+
+    optCon = poptGetContext(NULL, argc, (const char * *)argv, optionsTable, 0);
+    poptSetOtherOptionHelp(optCon, "[OPTION...] HOST[:PORT] [HOST[:PORT]...]");
+
+    while ((c = poptGetNextOpt(optCon)) >= 0)
+    {
+    }
+
+    if (c < -1)
+    {
+        /* an error occurred during option processing */
+        fprintf(stderr, "%s: %s\n", poptBadOption(optCon, POPT_BADOPTION_NOALIAS), poptStrerror(c));
+        return 1;
+    }
+
+    const char * arg;
+
+    while ((arg = poptGetArg(optCon)) != NULL)
+    {
+        if (loadgen_receiver_count == LOADGEN_MAXIMUM_RECEIVERS)
+        {
+            fprintf(stderr, "At most %d receivers can be given.\n", LOADGEN_MAXIMUM_RECEIVERS);
+            return 1;
+        }
+
+        loadgen_parse_receiver(arg, &loadgen_receivers[loadgen_receiver_count++]);
+    }
+
+    if (loadgen_receiver_count == 0)
+    {
+        poptPrintHelp(optCon, stderr, 0);
+        return 1;
+    }
+
+    poptFreeContext(optCon);
+
+    if ((loadgen_stream_count < 1) || (loadgen_stream_count > LOADGEN_MAXIMUM_STREAMS))
+    {
+        fprintf(stderr, "The number of streams must be from 1 to %d.\n", LOADGEN_MAXIMUM_STREAMS);
+        return 1;
+    }
+
+    if ((loadgen_loss < 0.0) || (loadgen_loss > 1.0) || (loadgen_reorder < 0.0) || (loadgen_reorder > 1.0))
+    {
+        fprintf(stderr, "The loss and reorder fractions must be from 0 to 1.\n");
+        return 1;
+    }
+
+    if ((loadgen_jitter < 0.0) || (loadgen_jitter > LOADGEN_MAXIMUM_JITTER))
+    {
+        fprintf(stderr, "The jitter must be from 0 to %d milliseconds.\n", LOADGEN_MAXIMUM_JITTER);
+        return 1;
+    }
+
+    if (loadgen_latency <= LOADGEN_FIXED_LATENCY_OFFSET)
+    {
+        fprintf(stderr, "The latency must be more than %d frames.\n", LOADGEN_FIXED_LATENCY_OFFSET);
+        return 1;
+    }
+
+#if !defined(CONFIG_OPENSSL) && !defined(CONFIG_MBEDTLS)
+
+    if (loadgen_encrypt)
+    {
+        fprintf(stderr, "Encryption needs Shairport Sync to be built with OpenSSL or mbed TLS.\n");
+        return 1;
+    }
+
+#endif
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, loadgen_signal_handler);
+    signal(SIGTERM, loadgen_signal_handler);
+
+    uint64_t start_time = loadgen_time_now();
+
+    if (loadgen_duration > 0.0) loadgen_end_time = start_time + (uint64_t)(loadgen_duration * 1000000000);
+
+    for (i = 0; i < loadgen_stream_count; i++)
+    {
+        loadgen_stream * s = &loadgen_streams[i];
+        int k;
+
+        s->index = i;
+        s->receiver = &loadgen_receivers[i % loadgen_receiver_count];
+        s->rtsp_fd = s->audio_fd = s->control_fd = s->timing_fd = -1;
+        s->xsubi[0] = 0x330e;
+        s->xsubi[1] = loadgen_seed;
+        s->xsubi[2] = i;
+        s->ssrc = (uint32_t)(erand48(s->xsubi) * 4294967295.0);
+        s->first_seqno = (uint16_t)(erand48(s->xsubi) * 65535.0);
+        s->first_timestamp = (uint32_t)(erand48(s->xsubi) * 4294967295.0);
+
+        for (k = 0; k < 16; k++)
+        {
+            s->key[k] = (uint8_t)(erand48(s->xsubi) * 256.0);
+            s->iv[k] = (uint8_t)(erand48(s->xsubi) * 256.0);
+        }
+
+        s->frequency = loadgen_frequency * pow(2.0, (i % 12) / 12.0);
+        s->history = malloc(sizeof(*s->history) * LOADGEN_HISTORY);
+
+        if (s->history == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            return 1;
+        }
+
+        s->running = 1;
+    }
+
+    for (i = 0; (i < loadgen_stream_count) && (loadgen_stop == 0); i++)
+    {
+        if (pthread_create(&loadgen_streams[i].thread, NULL, &loadgen_stream_thread, &loadgen_streams[i]) != 0)
+        {
+            fprintf(stderr, "Could not start stream %d.\n", i + 1);
+            return 1;
+        }
+
+        if ((loadgen_ramp > 0.0) && (i + 1 < loadgen_stream_count)) usleep((useconds_t)(loadgen_ramp * 1000000));
+    }
+
+    int started = i;
+    uint64_t next_report = start_time + (uint64_t)(loadgen_report * 1000000000);
+
+    while (loadgen_stop == 0)
+    {
+        int running = 0;
+
+        for (i = 0; i < started; i++) running += loadgen_streams[i].running;
+
+        if (running == 0) break;
+
+        uint64_t time_now = loadgen_time_now();
+
+        if ((loadgen_end_time) && (time_now >= loadgen_end_time)) break;
+
+        if ((loadgen_report > 0.0) && (time_now >= next_report))
+        {
+            char title[64];
+            snprintf(title, sizeof(title), "%.0f s", (time_now - start_time) * 0.000000001);
+            loadgen_print_totals(title);
+            next_report += (uint64_t)(loadgen_report * 1000000000);
+        }
+
+        usleep(100000);
+    }
+
+    loadgen_stop = 1;
+
+    for (i = 0; i < started; i++) pthread_join(loadgen_streams[i].thread, NULL);
+
+    int failures = 0;
+
+    for (i = 0; i < started; i++)
+    {
+        loadgen_stream * s = &loadgen_streams[i];
+        printf("stream %d to %s:%s: %" PRIu64 " packets sent, %" PRIu64 " dropped, %" PRIu64
+               " reordered, %" PRIu64 " resend requests for %" PRIu64 " packets, %" PRIu64
+               " resent, %" PRIu64 " timing replies%s%s.\n",
+               i + 1, s->receiver->host, s->receiver->port, s->sent, s->lost, s->reordered,
+               s->resend_requests, s->resend_requested_packets, s->resent, s->timing_replies,
+               s->outcome ? " -- " : "", s->outcome ? s->outcome : "");
+
+        if (s->outcome) failures++;
+    }
+
+    loadgen_print_totals("total");
+    return failures ? 1 : 0;
+}
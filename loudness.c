@@ -2,20 +2,27 @@
 #include "common.h"
 #include <math.h>
 
-loudness_processor loudness_r;
-loudness_processor loudness_l;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define LOUDNESS_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define LOUDNESS_NEON 1
+#endif
 
-void _loudness_set_volume(loudness_processor * p, float volume)
+void loudness_set_coefficients(loudness_processor * p, float volume, unsigned int rate)
 {
     float gain = -(volume - config.loudness_reference_volume_db) * 0.5;
 
     if (gain < 0) gain = 0;
 
+    debug(2, "Volume: %.1f dB - Loudness gain @10Hz: %.1f dB", volume, gain);
+
     float Fc = 10.0;
     float Q = 0.5;
 
     // Formula from http://www.earlevel.com/main/2011/01/02/biquad-formulas/
-    float Fs = 44100.0;
+    float Fs = rate;
 
     float K = tan(M_PI * Fc / Fs);
     float V = pow(10.0, gain / 20.0);
@@ -42,13 +49,145 @@ float loudness_process(loudness_processor * p, float i0)
     return o0;
 }
 
-void loudness_set_volume(float volume)
+#if defined(LOUDNESS_SSE2)
+
+// the left channel is in lane 0, the right channel in lane 1; lanes 2 and 3 are unused
+void loudness_process_block(loudness_processor * l, loudness_processor * r, float * left,
+                            float * right, size_t frames)
 {
-    float gain = -(volume - config.loudness_reference_volume_db) * 0.5;
+    const __m128 a0 = _mm_setr_ps(l->a0, r->a0, 0, 0);
+    const __m128 a1 = _mm_setr_ps(l->a1, r->a1, 0, 0);
+    const __m128 a2 = _mm_setr_ps(l->a2, r->a2, 0, 0);
+    const __m128 b1 = _mm_setr_ps(l->b1, r->b1, 0, 0);
+    const __m128 b2 = _mm_setr_ps(l->b2, r->b2, 0, 0);
+    __m128 i1 = _mm_setr_ps(l->i1, r->i1, 0, 0);
+    __m128 i2 = _mm_setr_ps(l->i2, r->i2, 0, 0);
+    __m128 o1 = _mm_setr_ps(l->o1, r->o1, 0, 0);
+    __m128 o2 = _mm_setr_ps(l->o2, r->o2, 0, 0);
+    size_t n;
 
-    if (gain < 0) gain = 0;
+    for (n = 0; n < frames; n++)
+    {
+        __m128 i0 = _mm_unpacklo_ps(_mm_load_ss(left + n), _mm_load_ss(right + n));
+        __m128 o0 = _mm_add_ps(_mm_mul_ps(a0, i0), _mm_mul_ps(a1, i1));
+        o0 = _mm_add_ps(o0, _mm_mul_ps(a2, i2));
+        o0 = _mm_sub_ps(o0, _mm_mul_ps(b1, o1));
+        o0 = _mm_sub_ps(o0, _mm_mul_ps(b2, o2));
+        o2 = o1;
+        o1 = o0;
+        i2 = i1;
+        i1 = i0;
+        _mm_store_ss(left + n, o0);
+        _mm_store_ss(right + n, _mm_shuffle_ps(o0, o0, _MM_SHUFFLE(1, 1, 1, 1)));
+    }
 
-    debug(2, "Volume: %.1f dB - Loudness gain @10Hz: %.1f dB", volume, gain);
-    _loudness_set_volume(&loudness_l, volume);
-    _loudness_set_volume(&loudness_r, volume);
+    float t[4];
+    _mm_storeu_ps(t, i1);
+    l->i1 = t[0];
+    r->i1 = t[1];
+    _mm_storeu_ps(t, i2);
+    l->i2 = t[0];
+    r->i2 = t[1];
+    _mm_storeu_ps(t, o1);
+    l->o1 = t[0];
+    r->o1 = t[1];
+    _mm_storeu_ps(t, o2);
+    l->o2 = t[0];
+    r->o2 = t[1];
+}
+
+#elif defined(LOUDNESS_NEON)
+
+// the left channel is in lane 0, the right channel in lane 1
+void loudness_process_block(loudness_processor * l, loudness_processor * r, float * left,
+                            float * right, size_t frames)
+{
+    float t[2];
+
+#define LOUDNESS_PAIR(field) (t[0] = l->field, t[1] = r->field, vld1_f32(t))
+    const float32x2_t a0 = LOUDNESS_PAIR(a0);
+    const float32x2_t a1 = LOUDNESS_PAIR(a1);
+    const float32x2_t a2 = LOUDNESS_PAIR(a2);
+    const float32x2_t b1 = LOUDNESS_PAIR(b1);
+    const float32x2_t b2 = LOUDNESS_PAIR(b2);
+    float32x2_t i1 = LOUDNESS_PAIR(i1);
+    float32x2_t i2 = LOUDNESS_PAIR(i2);
+    float32x2_t o1 = LOUDNESS_PAIR(o1);
+    float32x2_t o2 = LOUDNESS_PAIR(o2);
+#undef LOUDNESS_PAIR
+    size_t n;
+
+    for (n = 0; n < frames; n++)
+    {
+        float32x2_t i0 = vset_lane_f32(right[n], vdup_n_f32(left[n]), 1);
+        float32x2_t o0 = vadd_f32(vmul_f32(a0, i0), vmul_f32(a1, i1));
+        o0 = vadd_f32(o0, vmul_f32(a2, i2));
+        o0 = vsub_f32(o0, vmul_f32(b1, o1));
+        o0 = vsub_f32(o0, vmul_f32(b2, o2));
+        o2 = o1;
+        o1 = o0;
+        i2 = i1;
+        i1 = i0;
+        left[n] = vget_lane_f32(o0, 0);
+        right[n] = vget_lane_f32(o0, 1);
+    }
+
+#define LOUDNESS_UNPAIR(field, v) (vst1_f32(t, v), l->field = t[0], r->field = t[1])
+    LOUDNESS_UNPAIR(i1, i1);
+    LOUDNESS_UNPAIR(i2, i2);
+    LOUDNESS_UNPAIR(o1, o1);
+    LOUDNESS_UNPAIR(o2, o2);
+#undef LOUDNESS_UNPAIR
+}
+
+#else
+
+// the two channels are independent, so running them in the same loop lets the
+// two recursions overlap
+void loudness_process_block(loudness_processor * l, loudness_processor * r, float * left,
+                            float * right, size_t frames)
+{
+    float la0 = l->a0, la1 = l->a1, la2 = l->a2, lb1 = l->b1, lb2 = l->b2;
+    float ra0 = r->a0, ra1 = r->a1, ra2 = r->a2, rb1 = r->b1, rb2 = r->b2;
+    float li1 = l->i1, li2 = l->i2, lo1 = l->o1, lo2 = l->o2;
+    float ri1 = r->i1, ri2 = r->i2, ro1 = r->o1, ro2 = r->o2;
+    size_t n;
+
+    for (n = 0; n < frames; n++)
+    {
+        float li0 = left[n];
+        float ri0 = right[n];
+        float lo0 = la0 * li0 + la1 * li1 + la2 * li2 - lb1 * lo1 - lb2 * lo2;
+        float ro0 = ra0 * ri0 + ra1 * ri1 + ra2 * ri2 - rb1 * ro1 - rb2 * ro2;
+        lo2 = lo1;
+        lo1 = lo0;
+        li2 = li1;
+        li1 = li0;
+        ro2 = ro1;
+        ro1 = ro0;
+        ri2 = ri1;
+        ri1 = ri0;
+        left[n] = lo0;
+        right[n] = ro0;
+    }
+
+    l->i1 = li1;
+    l->i2 = li2;
+    l->o1 = lo1;
+    l->o2 = lo2;
+    r->i1 = ri1;
+    r->i2 = ri2;
+    r->o1 = ro1;
+    r->o2 = ro2;
+}
+
+#endif
+
+void loudness_copy_coefficients(loudness_processor * to, const loudness_processor * from)
+{
+    to->a0 = from->a0;
+    to->a1 = from->a1;
+    to->a2 = from->a2;
+    to->b1 = from->b1;
+    to->b2 = from->b2;
 }
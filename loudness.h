@@ -8,8 +8,15 @@ typedef struct
     float i1, i2, o1, o2;
 } loudness_processor;
 
-extern loudness_processor loudness_r;
-extern loudness_processor loudness_l;
-
-void loudness_set_volume(float volume);
+// set the filter coefficients for a volume in dB, at a rate in frames per second, leaving the
+// filter state alone
+void loudness_set_coefficients(loudness_processor * p, float volume, unsigned int rate);
+// copy just the coefficients from one filter to another, leaving the filter state alone
+void loudness_copy_coefficients(loudness_processor * to, const loudness_processor * from);
 float loudness_process(loudness_processor * p, float sample);
+
+// process a block of planar stereo -- left[] through l and right[] through r -- in place.
+// the filter state is kept in registers for the whole block, and where SIMD is available
+// the two channels are run side by side in a pair of lanes
+void loudness_process_block(loudness_processor * l, loudness_processor * r, float * left,
+                            float * right, size_t frames);
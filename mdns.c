@@ -32,6 +32,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "zone.h"
+
 #ifdef CONFIG_AVAHI
 extern mdns_backend mdns_avahi;
 #endif
@@ -64,20 +66,30 @@ static mdns_backend * mdns_backends[] = {
     NULL
 };
 
-void mdns_register(void)
+// the service is advertised as "HWADDR@name"
+static char * mdns_service_name_for(const zone * z)
 {
-    char * mdns_service_name = alloca(strlen(config.service_name) + 14);
+    char * mdns_service_name = malloc(strlen(z->name) + 14);
     char * p = mdns_service_name;
     int i;
 
+    if (mdns_service_name == NULL) die("Can't allocate space for the mDNS service name.");
+
     for (i = 0; i < 6; i++)
     {
-        snprintf(p, 3, "%02X", config.hw_addr[i]);
+        snprintf(p, 3, "%02X", z->hw_addr[i]);
         p += 2;
     }
 
     *p++ = '@';
-    strcpy(p, config.service_name);
+    strcpy(p, z->name);
+    return mdns_service_name;
+}
+
+void mdns_register(void)
+{
+    char * mdns_service_name = mdns_service_name_for(&zones[0]);
+    int i;
 
     mdns_backend * * b = NULL;
 
@@ -88,7 +100,7 @@ void mdns_register(void)
             if (strcmp((*b)->name, config.mdns_name) != 0) // Not the one we are looking for
                 continue;
 
-            int error = (*b)->mdns_register(mdns_service_name, config.port);
+            int error = (*b)->mdns_register(mdns_service_name, zones[0].port);
 
             if (error >= 0)
             {
@@ -104,7 +116,7 @@ void mdns_register(void)
     {
         for (b = mdns_backends; *b; b++)
         {
-            int error = (*b)->mdns_register(mdns_service_name, config.port);
+            int error = (*b)->mdns_register(mdns_service_name, zones[0].port);
 
             if (error >= 0)
             {
@@ -114,8 +126,21 @@ void mdns_register(void)
         }
     }
 
+    free(mdns_service_name);
+
     if (config.mdns == NULL) die("Could not establish mDNS advertisement!");
 
+    // the other zones are advertised by the backend the first zone's advertisement uses
+    for (i = 1; i < zone_count; i++)
+    {
+        mdns_service_name = mdns_service_name_for(&zones[i]);
+
+        if (config.mdns->mdns_register(mdns_service_name, zones[i].port) < 0)
+            warn("Could not establish mDNS advertisement for zone \"%s\".", zones[i].name);
+
+        free(mdns_service_name);
+    }
+
     mdns_dacp_monitor_start(); // create a dacp monitor thread
 }
 
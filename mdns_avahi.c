@@ -47,6 +47,8 @@
 #include <avahi-client/lookup.h>
 #include <avahi-common/alternative.h>
 
+#include "zone.h"
+
 #define check_avahi_response(debugLevelArg, veryUnLikelyArgumentName)                              \
     {                                                                                                \
         int rc = veryUnLikelyArgumentName;                                                             \
@@ -65,12 +67,20 @@ dacp_browser_struct private_dbs;
 // static AvahiServiceBrowser *sb = NULL;
 static AvahiClient * client = NULL;
 // static AvahiClient *service_client = NULL;
-static AvahiEntryGroup * group = NULL;
 static AvahiThreadedPoll * tpoll = NULL;
 // static AvahiThreadedPoll *service_poll = NULL;
 
-static char * service_name = NULL;
-static int port = 0;
+// one service for each zone, each with its own entry group, so that a name collision only
+// renames the service that has it
+typedef struct
+{
+    char * service_name;
+    int port;
+    AvahiEntryGroup * group;
+} avahi_service;
+
+static avahi_service services[ZONE_MAXIMUM];
+static int service_count = 0;
 
 static void resolve_callback(AvahiServiceResolver * r, AVAHI_GCC_UNUSED AvahiIfIndex interface,
                              AVAHI_GCC_UNUSED AvahiProtocol protocol, AvahiResolverEvent event,
@@ -194,17 +204,18 @@ static void browse_callback(AvahiServiceBrowser * b, AvahiIfIndex interface, Ava
     }
 }
 
-static void register_service(AvahiClient * c);
+static void register_service(AvahiClient * c, avahi_service * service);
 
-static void egroup_callback(AvahiEntryGroup * g, AvahiEntryGroupState state,
-                            AVAHI_GCC_UNUSED void * userdata)
+static void egroup_callback(AvahiEntryGroup * g, AvahiEntryGroupState state, void * userdata)
 {
+    avahi_service * service = &services[(intptr_t)userdata];
+
     // debug(1,"egroup_callback, state %d.", state);
     switch (state)
     {
         case AVAHI_ENTRY_GROUP_ESTABLISHED:
             /* The entry group has been established successfully */
-            debug(2, "avahi: service '%s' successfully added.", service_name);
+            debug(2, "avahi: service '%s' successfully added.", service->service_name);
             break;
 
         case AVAHI_ENTRY_GROUP_COLLISION: {
@@ -213,17 +224,17 @@ static void egroup_callback(AvahiEntryGroup * g, AvahiEntryGroupState state,
             /* A service name collision with a remote service
              * happened. Let's pick a new name */
             debug(2, "avahi name collision -- look for another");
-            n = avahi_alternative_service_name(service_name);
+            n = avahi_alternative_service_name(service->service_name);
 
-            if (service_name) avahi_free(service_name);
+            if (service->service_name) avahi_free(service->service_name);
             else debug(1, "avahi attempt to free a NULL service name");
 
-            service_name = n;
+            service->service_name = n;
 
-            debug(2, "avahi: service name collision, renaming service to '%s'", service_name);
+            debug(2, "avahi: service name collision, renaming service to '%s'", service->service_name);
 
             /* And recreate the services */
-            register_service(avahi_entry_group_get_client(g));
+            register_service(avahi_entry_group_get_client(g), service);
             break;
         }
 
@@ -233,11 +244,11 @@ static void egroup_callback(AvahiEntryGroup * g, AvahiEntryGroupState state,
             break;
 
         case AVAHI_ENTRY_GROUP_UNCOMMITED:
-            debug(2, "avahi: service '%s' group is not yet committed.", service_name);
+            debug(2, "avahi: service '%s' group is not yet committed.", service->service_name);
             break;
 
         case AVAHI_ENTRY_GROUP_REGISTERING:
-            debug(2, "avahi: service '%s' group is registering.", service_name);
+            debug(2, "avahi: service '%s' group is registering.", service->service_name);
             break;
 
         default:
@@ -246,15 +257,17 @@ static void egroup_callback(AvahiEntryGroup * g, AvahiEntryGroupState state,
     }
 }
 
-static void register_service(AvahiClient * c)
+static void register_service(AvahiClient * c, avahi_service * service)
 {
-    if (!group) group = avahi_entry_group_new(c, egroup_callback, NULL);
+    if (!service->group)
+        service->group =
+            avahi_entry_group_new(c, egroup_callback, (void *)(intptr_t)(service - services));
 
-    if (!group) debug(1, "avahi: avahi_entry_group_new failed");
+    if (!service->group) debug(1, "avahi: avahi_entry_group_new failed");
     else
     {
         // debug(2, "register_service -- go ahead and register.");
-        if (!avahi_entry_group_is_empty(group)) return;
+        if (!avahi_entry_group_is_empty(service->group)) return;
 
         int ret;
         AvahiIfIndex selected_interface;
@@ -266,8 +279,9 @@ static void register_service(AvahiClient * c)
 
         if (config.metadata_enabled)
         {
-            ret = avahi_entry_group_add_service(group, selected_interface, AVAHI_PROTO_UNSPEC, 0,
-                                                service_name, config.regtype, NULL, NULL, port,
+            ret = avahi_entry_group_add_service(service->group, selected_interface, AVAHI_PROTO_UNSPEC, 0,
+                                                service->service_name, config.regtype, NULL, NULL,
+                                                service->port,
                                                 MDNS_RECORD_WITH_METADATA, NULL);
 
             if (ret == 0) debug(2, "avahi: request to add \"%s\" service with metadata", config.regtype);
@@ -275,8 +289,9 @@ static void register_service(AvahiClient * c)
         else
         {
 #endif
-        ret = avahi_entry_group_add_service(group, selected_interface, AVAHI_PROTO_UNSPEC, 0,
-                                            service_name, config.regtype, NULL, NULL, port,
+        ret = avahi_entry_group_add_service(service->group, selected_interface, AVAHI_PROTO_UNSPEC, 0,
+                                            service->service_name, config.regtype, NULL, NULL,
+                                                service->port,
                                             MDNS_RECORD_WITHOUT_METADATA, NULL);
 
         if (ret == 0) debug(2, "avahi: request to add \"%s\" service without metadata", config.regtype);
@@ -289,7 +304,7 @@ static void register_service(AvahiClient * c)
         if (ret < 0) debug(1, "avahi: avahi_entry_group_add_service failed");
         else
         {
-            ret = avahi_entry_group_commit(group);
+            ret = avahi_entry_group_commit(service->group);
 
             if (ret < 0) debug(1, "avahi: avahi_entry_group_commit failed");
         }
@@ -301,17 +316,26 @@ static void client_callback(AvahiClient * c, AvahiClientState state,
 {
     // debug(1,"client_callback, state %d.", state);
     int err;
+    int i;
 
     switch (state)
     {
         case AVAHI_CLIENT_S_REGISTERING:
 
-            if (group) check_avahi_response(1, avahi_entry_group_reset(group));
+            for (i = 0; i < service_count; i++)
+            {
+                if (services[i].group)
+                    check_avahi_response(1, avahi_entry_group_reset(services[i].group));
+            }
 
             break;
 
         case AVAHI_CLIENT_S_RUNNING:
-            register_service(c);
+            for (i = 0; i < service_count; i++)
+            {
+                register_service(c, &services[i]);
+            }
+
             break;
 
         case AVAHI_CLIENT_FAILURE:
@@ -327,7 +351,11 @@ static void client_callback(AvahiClient * c, AvahiClientState state,
                 else debug(1, "Attempt to free NULL avahi client");
 
                 c = NULL;
-                group = NULL;
+
+                for (i = 0; i < service_count; i++)
+                {
+                    services[i].group = NULL;
+                }
 
                 if (!(client = avahi_client_new(avahi_threaded_poll_get(tpoll), AVAHI_CLIENT_NO_FAIL,
                                                 client_callback, userdata, &err)))
@@ -345,7 +373,8 @@ static void client_callback(AvahiClient * c, AvahiClientState state,
             break;
 
         case AVAHI_CLIENT_S_COLLISION:
-            debug(2, "avahi: state is AVAHI_CLIENT_S_COLLISION...needs a rename: %s", service_name);
+            debug(2, "avahi: state is AVAHI_CLIENT_S_COLLISION...needs a rename: %s",
+                  services[0].service_name);
             break;
 
         case AVAHI_CLIENT_CONNECTING:
@@ -361,8 +390,32 @@ static void client_callback(AvahiClient * c, AvahiClientState state,
 static int avahi_register(char * srvname, int srvport)
 {
     // debug(1, "avahi_register.");
-    service_name = strdup(srvname);
-    port = srvport;
+    if (service_count == ZONE_MAXIMUM)
+    {
+        warn("avahi: too many services");
+        return -1;
+    }
+
+    // if the client is already running, for another zone, add the service to it
+    if (tpoll)
+    {
+        avahi_threaded_poll_lock(tpoll);
+        services[service_count].service_name = strdup(srvname);
+        services[service_count].port = srvport;
+        services[service_count].group = NULL;
+        service_count++;
+
+        if ((client) && (avahi_client_get_state(client) == AVAHI_CLIENT_S_RUNNING))
+            register_service(client, &services[service_count - 1]);
+
+        avahi_threaded_poll_unlock(tpoll);
+        return 0;
+    }
+
+    services[0].service_name = strdup(srvname);
+    services[0].port = srvport;
+    services[0].group = NULL;
+    service_count = 1;
 
     int err;
 
@@ -416,14 +469,22 @@ static void avahi_unregister(void)
         debug(1, "No avahi threaded poll.");
     }
 
-    if (service_name)
+    int i;
+
+    for (i = 0; i < service_count; i++)
     {
-        debug(2, "avahi: free the service name.");
-        free(service_name);
+        if (services[i].service_name)
+        {
+            debug(2, "avahi: free the service name.");
+            free(services[i].service_name);
+        }
+        else debug(1, "avahi attempt to free NULL service name");
+
+        services[i].service_name = NULL;
+        services[i].group = NULL;
     }
-    else debug(1, "avahi attempt to free NULL service name");
 
-    service_name = NULL;
+    service_count = 0;
 }
 
 void avahi_dacp_monitor_start(void)
@@ -26,12 +26,14 @@
 
 #include "common.h"
 #include "mdns.h"
+#include "zone.h"
 #include <arpa/inet.h>
 #include <dns_sd.h>
 #include <stdlib.h>
 #include <string.h>
 
-static DNSServiceRef service;
+static DNSServiceRef services[ZONE_MAXIMUM]; // one for each zone
+static int service_count = 0;
 
 static int mdns_dns_sd_register(char * apname, int port)
 {
@@ -75,13 +77,24 @@ static int mdns_dns_sd_register(char * apname, int port)
         p = newp;
     }
 
+    if (service_count == ZONE_MAXIMUM)
+    {
+        warn("dns_sd: too many services");
+        free(buf);
+        return -1;
+    }
+
     DNSServiceErrorType error;
-    error = DNSServiceRegister(&service, 0, kDNSServiceInterfaceIndexAny, apname, config.regtype, "",
+    error = DNSServiceRegister(&services[service_count], 0, kDNSServiceInterfaceIndexAny, apname, config.regtype, "",
                                NULL, htons((uint16_t)port), length, buf, NULL, NULL);
 
     free(buf);
 
-    if (error == kDNSServiceErr_NoError) return 0;
+    if (error == kDNSServiceErr_NoError)
+    {
+        service_count++;
+        return 0;
+    }
     else
     {
         warn("dns-sd: DNSServiceRegister error %d", error);
@@ -91,11 +104,15 @@ static int mdns_dns_sd_register(char * apname, int port)
 
 static void mdns_dns_sd_unregister(void)
 {
-    if (service)
+    int i;
+
+    for (i = 0; i < service_count; i++)
     {
-        DNSServiceRefDeallocate(service);
-        service = NULL;
+        DNSServiceRefDeallocate(services[i]);
+        services[i] = NULL;
     }
+
+    service_count = 0;
 }
 
 mdns_backend mdns_dns_sd = { .name                     = "dns-sd",
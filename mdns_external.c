@@ -27,13 +27,25 @@
 
 #include "common.h"
 #include "mdns.h"
+#include "zone.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
-int mdns_pid = 0;
+int mdns_pid = 0; // the first of them
+
+// one child for each zone's advertisement
+static int mdns_pids[ZONE_MAXIMUM];
+static int mdns_pid_count = 0;
+
+static void add_mdns_child(int pid)
+{
+    if (mdns_pid_count == 0) mdns_pid = pid;
+
+    if (mdns_pid_count < ZONE_MAXIMUM) mdns_pids[mdns_pid_count++] = pid;
+}
 
 /*
  * Do a fork followed by a execvp, handling execvp errors correctly.
@@ -96,11 +108,11 @@ static int fork_execvp(const char * file, char * const argv[])
     return response;
 }
 
-static int mdns_external_avahi_register(char * apname, __attribute__((unused)) int port)
+static int mdns_external_avahi_register(char * apname, int port)
 {
     char mdns_port[6];
 
-    snprintf(mdns_port, sizeof(mdns_port), "%d", config.port);
+    snprintf(mdns_port, sizeof(mdns_port), "%d", port);
 
     char * argvwithoutmetadata[] = {
         NULL, apname, config.regtype, mdns_port, MDNS_RECORD_WITHOUT_METADATA, NULL
@@ -124,7 +136,7 @@ static int mdns_external_avahi_register(char * apname, __attribute__((unused)) i
 
     if (pid >= 0)
     {
-        mdns_pid = pid;
+        add_mdns_child(pid);
         return 0;
     }
     else warn("Calling %s failed !", argv[0]);
@@ -134,7 +146,7 @@ static int mdns_external_avahi_register(char * apname, __attribute__((unused)) i
 
     if (pid >= 0)
     {
-        mdns_pid = pid;
+        add_mdns_child(pid);
         return 0;
     }
     else warn("Calling %s failed !", argv[0]);
@@ -143,11 +155,11 @@ static int mdns_external_avahi_register(char * apname, __attribute__((unused)) i
     return -1;
 }
 
-static int mdns_external_dns_sd_register(char * apname, __attribute__((unused)) int port)
+static int mdns_external_dns_sd_register(char * apname, int port)
 {
     char mdns_port[6];
 
-    snprintf(mdns_port, sizeof(mdns_port), "%d", config.port);
+    snprintf(mdns_port, sizeof(mdns_port), "%d", port);
 
     char * argvwithoutmetadata[] = {
         NULL, apname, config.regtype, mdns_port, MDNS_RECORD_WITHOUT_METADATA, NULL
@@ -171,7 +183,7 @@ static int mdns_external_dns_sd_register(char * apname, __attribute__((unused))
 
     if (pid >= 0)
     {
-        mdns_pid = pid;
+        add_mdns_child(pid);
         return 0;
     }
     else warn("Calling %s failed !", argv[0]);
@@ -181,8 +193,14 @@ static int mdns_external_dns_sd_register(char * apname, __attribute__((unused))
 
 static void kill_mdns_child(void)
 {
-    if (mdns_pid) kill(mdns_pid, SIGTERM);
+    int i;
+
+    for (i = 0; i < mdns_pid_count; i++)
+    {
+        kill(mdns_pids[i], SIGTERM);
+    }
 
+    mdns_pid_count = 0;
     mdns_pid = 0;
 }
 
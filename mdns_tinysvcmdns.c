@@ -38,7 +38,8 @@
 
 static struct mdnsd * svr = NULL;
 
-static int mdns_tinysvcmdns_register(char * apname, int port)
+// start the responder and give it the host's addresses
+static int mdns_tinysvcmdns_start(void)
 {
     struct ifaddrs * ifalist;
     struct ifaddrs * ifa;
@@ -136,6 +137,14 @@ static int mdns_tinysvcmdns_register(char * apname, int port)
 
     freeifaddrs(ifa);
 
+    return 0;
+}
+
+static int mdns_tinysvcmdns_register(char * apname, int port)
+{
+    // it's started for the first service -- each zone's is added to the same responder
+    if ((svr == NULL) && (mdns_tinysvcmdns_start() < 0)) return -1;
+
     char * txtwithoutmetadata[] = { MDNS_RECORD_WITHOUT_METADATA, NULL };
 
 #ifdef CONFIG_METADATA
@@ -71,15 +71,56 @@ int string_update(char * * str, int * flag, char * s)
     else return string_update_with_size(str, flag, NULL, 0);
 }
 
+// the cover art cache's worker thread -- see metadata_write_image_file()
+static pthread_t cover_art_worker_thread;
+static int cover_art_worker_running = 0;
+static void * cover_art_worker_thread_function(void * arg);
+
+// watchers are run by the notifier thread, a short interval after the first of a burst of changes,
+// so that, for instance, the fields of a new track, which arrive one by one, go out as one update
+#define METADATA_HUB_COALESCING_INTERVAL_US 30000
+
+static pthread_t metadata_notifier_thread;
+static int metadata_notifier_running = 0;
+static pthread_mutex_t metadata_notifier_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t metadata_notifier_signal = PTHREAD_COND_INITIALIZER;
+static int metadata_notification_pending = 0;
+static void * metadata_notifier_thread_function(void * arg);
+
 void metadata_hub_init(void)
 {
     // debug(1, "Metadata bundle initialisation.");
     memset(&metadata_store, 0, sizeof(metadata_store));
+
+    if (strcmp(config.cover_art_cache_dir, "") != 0)
+    {
+        if (pthread_create(&cover_art_worker_thread, NULL, &cover_art_worker_thread_function, NULL) == 0)
+            cover_art_worker_running = 1;
+        else die("Failed to create the cover art worker thread!");
+    }
+
+    if (pthread_create(&metadata_notifier_thread, NULL, &metadata_notifier_thread_function, NULL) == 0)
+        metadata_notifier_running = 1;
+    else die("Failed to create the metadata hub notifier thread!");
+
     metadata_hub_initialised = 1;
 }
 
 void metadata_hub_stop(void)
 {
+    if (metadata_notifier_running)
+    {
+        pthread_cancel(metadata_notifier_thread);
+        pthread_join(metadata_notifier_thread, NULL);
+        metadata_notifier_running = 0;
+    }
+
+    if (cover_art_worker_running)
+    {
+        pthread_cancel(cover_art_worker_thread);
+        pthread_join(cover_art_worker_thread, NULL);
+        cover_art_worker_running = 0;
+    }
 }
 
 void add_metadata_watcher(metadata_watcher fn, void * userdata)
@@ -98,9 +139,125 @@ void add_metadata_watcher(metadata_watcher fn, void * userdata)
     }
 }
 
+// the fields that carry a _changed flag, and the bit each one sets in changed_fields
+static struct
+{
+    int * flag;
+    metadata_field_type field;
+} metadata_change_flags[] = {
+    {&metadata_store.client_ip_changed, MF_CLIENT_IP},
+    {&metadata_store.server_ip_changed, MF_SERVER_IP},
+    {&metadata_store.progress_string_changed, MF_PROGRESS_STRING},
+    {&metadata_store.cover_art_pathname_changed, MF_COVER_ART_PATHNAME},
+    {&metadata_store.item_id_changed, MF_ITEM_ID},
+    {&metadata_store.item_composite_id_changed, MF_ITEM_COMPOSITE_ID},
+    {&metadata_store.track_name_changed, MF_TRACK_NAME},
+    {&metadata_store.artist_name_changed, MF_ARTIST_NAME},
+    {&metadata_store.album_artist_name_changed, MF_ALBUM_ARTIST_NAME},
+    {&metadata_store.album_name_changed, MF_ALBUM_NAME},
+    {&metadata_store.genre_changed, MF_GENRE},
+    {&metadata_store.comment_changed, MF_COMMENT},
+    {&metadata_store.composer_changed, MF_COMPOSER},
+    {&metadata_store.file_kind_changed, MF_FILE_KIND},
+    {&metadata_store.song_description_changed, MF_SONG_DESCRIPTION},
+    {&metadata_store.song_album_artist_changed, MF_SONG_ALBUM_ARTIST},
+    {&metadata_store.sort_name_changed, MF_SORT_NAME},
+    {&metadata_store.sort_artist_changed, MF_SORT_ARTIST},
+    {&metadata_store.sort_album_changed, MF_SORT_ALBUM},
+    {&metadata_store.sort_composer_changed, MF_SORT_COMPOSER},
+    {&metadata_store.songtime_in_milliseconds_changed, MF_SONGTIME_IN_MILLISECONDS},
+};
+
+#define number_of_metadata_change_flags                                                            \
+    (sizeof(metadata_change_flags) / sizeof(metadata_change_flags[0]))
+
+// the fields that have no _changed flag, as they were when the watchers were last run
+static struct
+{
+    int dacp_server_active;
+    int advanced_dacp_server_active;
+    play_status_type play_status;
+    shuffle_status_type shuffle_status;
+    repeat_status_type repeat_status;
+    play_status_type player_state;
+    active_state_type active_state;
+    int speaker_volume;
+    double airplay_volume;
+} metadata_notified;
+
+// move the _changed flags into changed_fields, clearing them, so that a change isn't lost if a
+// later update sets the field back to the value it had before the watchers saw it
+static void metadata_hub_collect_changed_flags(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < number_of_metadata_change_flags; i++)
+    {
+        if (*metadata_change_flags[i].flag)
+        {
+            metadata_store.changed_fields |= metadata_change_flags[i].field;
+            *metadata_change_flags[i].flag = 0;
+        }
+    }
+}
+
+static void metadata_hub_collect_changed_state(void)
+{
+    if (metadata_notified.dacp_server_active != metadata_store.dacp_server_active)
+        metadata_store.changed_fields |= MF_DACP_SERVER_ACTIVE;
+
+    if (metadata_notified.advanced_dacp_server_active != metadata_store.advanced_dacp_server_active)
+        metadata_store.changed_fields |= MF_ADVANCED_DACP_SERVER_ACTIVE;
+
+    if (metadata_notified.play_status != metadata_store.play_status)
+        metadata_store.changed_fields |= MF_PLAY_STATUS;
+
+    if (metadata_notified.shuffle_status != metadata_store.shuffle_status)
+        metadata_store.changed_fields |= MF_SHUFFLE_STATUS;
+
+    if (metadata_notified.repeat_status != metadata_store.repeat_status)
+        metadata_store.changed_fields |= MF_REPEAT_STATUS;
+
+    if (metadata_notified.player_state != metadata_store.player_state)
+        metadata_store.changed_fields |= MF_PLAYER_STATE;
+
+    if (metadata_notified.active_state != metadata_store.active_state)
+        metadata_store.changed_fields |= MF_ACTIVE_STATE;
+
+    if (metadata_notified.speaker_volume != metadata_store.speaker_volume)
+        metadata_store.changed_fields |= MF_SPEAKER_VOLUME;
+
+    if (metadata_notified.airplay_volume != metadata_store.airplay_volume)
+        metadata_store.changed_fields |= MF_AIRPLAY_VOLUME;
+
+    metadata_notified.dacp_server_active = metadata_store.dacp_server_active;
+    metadata_notified.advanced_dacp_server_active = metadata_store.advanced_dacp_server_active;
+    metadata_notified.play_status = metadata_store.play_status;
+    metadata_notified.shuffle_status = metadata_store.shuffle_status;
+    metadata_notified.repeat_status = metadata_store.repeat_status;
+    metadata_notified.player_state = metadata_store.player_state;
+    metadata_notified.active_state = metadata_store.active_state;
+    metadata_notified.speaker_volume = metadata_store.speaker_volume;
+    metadata_notified.airplay_volume = metadata_store.airplay_volume;
+}
+
+// run with the metadata hub locked for writing
 void run_metadata_watchers(void)
 {
-    int i;
+    unsigned int i;
+
+    metadata_hub_collect_changed_flags();
+    metadata_hub_collect_changed_state();
+
+    if (metadata_store.changed_fields == 0) return;
+
+    // debug(1, "Running metadata watchers for changed fields 0x%08" PRIx32 ".",
+    //       metadata_store.changed_fields);
+
+    // the _changed flags are set for the duration of the call, for watchers that look at them
+    for (i = 0; i < number_of_metadata_change_flags; i++)
+        *metadata_change_flags[i].flag =
+            (metadata_store.changed_fields & metadata_change_flags[i].field) != 0;
 
     for (i = 0; i < number_of_watchers; i++)
     {
@@ -111,26 +268,41 @@ void run_metadata_watchers(void)
     }
 
     // turn off changed flags
-    metadata_store.cover_art_pathname_changed = 0;
-    metadata_store.client_ip_changed = 0;
-    metadata_store.server_ip_changed = 0;
-    metadata_store.progress_string_changed = 0;
-    metadata_store.item_id_changed = 0;
-    metadata_store.item_composite_id_changed = 0;
-    metadata_store.artist_name_changed = 0;
-    metadata_store.album_artist_name_changed = 0;
-    metadata_store.album_name_changed = 0;
-    metadata_store.track_name_changed = 0;
-    metadata_store.genre_changed = 0;
-    metadata_store.comment_changed = 0;
-    metadata_store.composer_changed = 0;
-    metadata_store.file_kind_changed = 0;
-    metadata_store.song_description_changed = 0;
-    metadata_store.song_album_artist_changed = 0;
-    metadata_store.sort_artist_changed = 0;
-    metadata_store.sort_album_changed = 0;
-    metadata_store.sort_composer_changed = 0;
-    metadata_store.songtime_in_milliseconds_changed = 0;
+    for (i = 0; i < number_of_metadata_change_flags; i++) *metadata_change_flags[i].flag = 0;
+    metadata_store.changed_fields = 0;
+}
+
+static void * metadata_notifier_thread_function(__attribute__((unused)) void * arg)
+{
+    set_thread_scheduling(TC_metadata);
+
+    while (1)
+    {
+        pthread_mutex_lock(&metadata_notifier_lock);
+        pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&metadata_notifier_lock);
+
+        while (metadata_notification_pending == 0)
+            pthread_cond_wait(&metadata_notifier_signal, &metadata_notifier_lock); // a cancellation point
+
+        pthread_cleanup_pop(1);
+
+        // give the rest of the burst time to arrive -- changes made from here until the hub is
+        // locked below go out with this notification
+        usleep(METADATA_HUB_COALESCING_INTERVAL_US); // a cancellation point
+
+        pthread_mutex_lock(&metadata_notifier_lock);
+        metadata_notification_pending = 0;
+        pthread_mutex_unlock(&metadata_notifier_lock);
+
+        int oldState;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
+        metadata_hub_modify_prolog();
+        run_metadata_watchers();
+        metadata_hub_modify_epilog(0);
+        pthread_setcancelstate(oldState, NULL);
+    }
+
+    pthread_exit(NULL);
 }
 
 void metadata_hub_unlock_hub_mutex_cleanup(__attribute__((unused)) void * arg)
@@ -179,9 +351,21 @@ void _metadata_hub_modify_epilog(int modified, const char * filename, const int
     metadata_store.dacp_server_has_been_active =
         metadata_store.dacp_server_active; // set the scanner_has_been_active now.
 
+    metadata_hub_collect_changed_flags();
+
     if (modified)
     {
-        run_metadata_watchers();
+        if (metadata_notifier_running)
+        {
+            pthread_mutex_lock(&metadata_notifier_lock);
+            metadata_notification_pending = 1;
+            pthread_cond_signal(&metadata_notifier_signal);
+            pthread_mutex_unlock(&metadata_notifier_lock);
+        }
+        else
+        {
+            run_metadata_watchers();
+        }
     }
 
     if (metadata_hub_re_lock_access_is_delayed)
@@ -222,14 +406,264 @@ void _metadata_hub_modify_epilog(int modified, const char * filename, const int
    pthread_rwlock_unlock(&metadata_hub_re_lock);
    }
  */
-char * metadata_write_image_file(const char * buf, int len)
+// The cover art cache. Images are named by the MD5 hash of their contents, so an image that's
+// already in the directory needn't be written again. The hub thread keeps a record of the files in
+// the directory, the least recently used of which are deleted when there are more than
+// cover_art_cache_maximum_files of them or they take up more than cover_art_cache_maximum_size,
+// unless retain_cover_art is set. Writing and deleting the files is done by a worker thread, so that
+// the hub thread isn't held up by slow storage; when an image has been written, the worker sets
+// it as the cover art, if it's still the latest.
+
+#define COVER_ART_PREFIX "cover-"
+
+typedef struct
+{
+    char name[48]; // COVER_ART_PREFIX, the hash in hex and the extension
+    size_t size;
+    uint64_t last_used;
+} cover_art_cache_entry;
+
+// these are used by the hub thread only
+static cover_art_cache_entry * cover_art_cache = NULL;
+static int cover_art_cache_capacity = 0;
+static int cover_art_cache_count = 0;
+static size_t cover_art_cache_bytes = 0;
+static uint64_t cover_art_cache_clock = 0;
+static int cover_art_cache_scanned = 0;
+
+typedef struct cover_art_job
+{
+    struct cover_art_job * next;
+    char * path;
+    char * data;      // NULL to delete the file
+    size_t length;
+    uint64_t picture; // the number of the picture it's for
+} cover_art_job;
+
+static pthread_mutex_t cover_art_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cover_art_job_added_signal = PTHREAD_COND_INITIALIZER;
+static cover_art_job * cover_art_jobs_head = NULL;
+static cover_art_job * cover_art_jobs_tail = NULL;
+static uint64_t cover_art_latest_picture = 0; // read by the worker, so accessed atomically
+
+static char * cover_art_path(const char * name)
+{
+    size_t pl = strlen(config.cover_art_cache_dir) + 1 + strlen(name) + 1;
+    char * path = malloc(pl);
+
+    if (path == NULL) die("Can't allocate memory for a cover art path.");
+
+    snprintf(path, pl, "%s/%s", config.cover_art_cache_dir, name);
+    return path;
+}
+
+static void cover_art_queue_job(char * path, const char * data, size_t length, uint64_t picture)
+{
+    cover_art_job * job = malloc(sizeof(cover_art_job));
+
+    if (job == NULL) die("Can't allocate a cover art job.");
+
+    job->next = NULL;
+    job->path = path;
+    job->data = data ? memdup(data, length) : NULL;
+    job->length = length;
+    job->picture = picture;
+
+    pthread_mutex_lock(&cover_art_job_lock);
+
+    if (cover_art_jobs_tail) cover_art_jobs_tail->next = job;
+    else cover_art_jobs_head = job;
+
+    cover_art_jobs_tail = job;
+    pthread_cond_signal(&cover_art_job_added_signal);
+    pthread_mutex_unlock(&cover_art_job_lock);
+}
+
+static void cover_art_do_job(cover_art_job * job)
+{
+    if (job->data == NULL)
+    {
+        if ((unlink(job->path) != 0) && (errno != ENOENT))
+            debug(1, "Error %d deleting cover art file \"%s\".", errno, job->path);
+
+        return;
+    }
+
+    mode_t oldumask = umask(000);
+    int result = mkpath(config.cover_art_cache_dir, 0777);
+    umask(oldumask);
+
+    if ((result != 0) && (result != -EEXIST))
+    {
+        debug(1, "Couldn't access or create the cover art cache directory \"%s\".",
+              config.cover_art_cache_dir);
+        return;
+    }
+
+    // write it under a temporary name, so that no one sees a partly-written file
+    size_t tl = strlen(job->path) + 5;
+    char * temporary_path = malloc(tl);
+
+    if (temporary_path == NULL) die("Can't allocate memory for a cover art path.");
+
+    snprintf(temporary_path, tl, "%s.tmp", job->path);
+    int cover_fd = open(temporary_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU | S_IRGRP | S_IROTH);
+    int written = 0;
+
+    if (cover_fd >= 0)
+    {
+        if (write(cover_fd, job->data, job->length) == (ssize_t)job->length) written = 1;
+
+        close(cover_fd);
+
+        if ((written) && (rename(temporary_path, job->path) != 0)) written = 0;
+
+        if (written == 0)
+        {
+            warn("Writing cover art file \"%s\" failed!", job->path);
+            unlink(temporary_path);
+        }
+    }
+    else
+    {
+        warn("Could not open file \"%s\" for writing cover art", temporary_path);
+    }
+
+    free(temporary_path);
+
+    if ((written) && (job->picture == __atomic_load_n(&cover_art_latest_picture, __ATOMIC_ACQUIRE)))
+    {
+        char uri[2048];
+        snprintf(uri, sizeof(uri), "file://%s", job->path);
+        metadata_hub_modify_prolog();
+        int changed = string_update(&metadata_store.cover_art_pathname,
+                                    &metadata_store.cover_art_pathname_changed, uri);
+        metadata_hub_modify_epilog(changed);
+    }
+}
+
+static void * cover_art_worker_thread_function(__attribute__((unused)) void * arg)
+{
+    set_thread_scheduling(TC_metadata);
+
+    while (1)
+    {
+        cover_art_job * job;
+
+        pthread_mutex_lock(&cover_art_job_lock);
+        pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&cover_art_job_lock);
+
+        while (cover_art_jobs_head == NULL)
+            pthread_cond_wait(&cover_art_job_added_signal, &cover_art_job_lock); // a cancellation point
+
+        job = cover_art_jobs_head;
+        cover_art_jobs_head = job->next;
+
+        if (cover_art_jobs_head == NULL) cover_art_jobs_tail = NULL;
+
+        pthread_cleanup_pop(1);
+
+        int oldState;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
+        cover_art_do_job(job);
+        free(job->path);
+        free(job->data);
+        free(job);
+        pthread_setcancelstate(oldState, NULL);
+    }
+
+    pthread_exit(NULL);
+}
+
+static void cover_art_cache_add(const char * name, size_t size, uint64_t last_used)
+{
+    if (cover_art_cache_count == cover_art_cache_capacity)
+    {
+        int new_capacity = cover_art_cache_capacity ? cover_art_cache_capacity * 2 : 16;
+        cover_art_cache_entry * new_cache =
+            realloc(cover_art_cache, new_capacity * sizeof(cover_art_cache_entry));
+
+        if (new_cache == NULL) die("Can't allocate memory for the cover art cache.");
+
+        cover_art_cache = new_cache;
+        cover_art_cache_capacity = new_capacity;
+    }
+
+    cover_art_cache_entry * entry = &cover_art_cache[cover_art_cache_count++];
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    entry->size = size;
+    entry->last_used = last_used;
+    cover_art_cache_bytes += size;
+}
+
+// take note of what's in the directory already, e.g. from before a restart, as the least recently used
+static void cover_art_cache_scan(void)
+{
+    DIR * d = opendir(config.cover_art_cache_dir);
+
+    if (d)
+    {
+        struct dirent * dir;
+        int dir_fd = dirfd(d);
+
+        while ((dir = readdir(d)) != NULL)
+        {
+            struct stat st;
+
+            if ((strncmp(dir->d_name, COVER_ART_PREFIX, strlen(COVER_ART_PREFIX)) == 0) &&
+                (strlen(dir->d_name) < sizeof(cover_art_cache[0].name)) &&
+                (fstatat(dir_fd, dir->d_name, &st, 0) == 0) && (S_ISREG(st.st_mode)))
+            {
+                size_t nl = strlen(dir->d_name);
+
+                if ((nl > 4) && (strcmp(dir->d_name + nl - 4, ".tmp") == 0))
+                    cover_art_queue_job(cover_art_path(dir->d_name), NULL, 0, 0); // left over
+                else cover_art_cache_add(dir->d_name, st.st_size, 0);
+            }
+        }
+
+        closedir(d);
+    }
+}
+
+// delete the least recently used files, other than the one at keep, to bring the cache within bounds
+static void cover_art_cache_evict(int keep)
+{
+    while ((cover_art_cache_count > 1) &&
+           ((cover_art_cache_count > config.cover_art_cache_maximum_files) ||
+            (cover_art_cache_bytes > config.cover_art_cache_maximum_size)))
+    {
+        int oldest = -1;
+        int i;
+
+        for (i = 0; i < cover_art_cache_count; i++)
+            if ((i != keep) && ((oldest == -1) || (cover_art_cache[i].last_used < cover_art_cache[oldest].last_used)))
+                oldest = i;
+
+        debug(2, "Evicting cover art file \"%s\".", cover_art_cache[oldest].name);
+        cover_art_queue_job(cover_art_path(cover_art_cache[oldest].name), NULL, 0, 0);
+        cover_art_cache_bytes -= cover_art_cache[oldest].size;
+
+        // the last entry fills the gap
+        cover_art_cache_count--;
+
+        if (keep == cover_art_cache_count) keep = oldest;
+
+        cover_art_cache[oldest] = cover_art_cache[cover_art_cache_count];
+    }
+}
+
+char * metadata_write_image_file(const char * buf, int len, int * pending)
 {
-    // warning -- this removes all files from the directory apart from this one, if it exists
     // it will return a path to the image file allocated with malloc.
     // free it if you don't need it.
+    // *pending is set if the file is yet to be written -- it will be set as the
+    // cover art when it has been
 
     char * path = NULL;                              // this will be what is returned
 
+    *pending = 0;
+
     if (strcmp(config.cover_art_cache_dir, "") != 0) // an empty string means do not write the file
     {
         uint8_t img_md5[16];
@@ -284,98 +718,44 @@ char * metadata_write_image_file(const char * buf, int len)
             ext = jpg;
         }
 
-        mode_t oldumask = umask(000);
-        int result = mkpath(config.cover_art_cache_dir, 0777);
-        umask(oldumask);
-
-        if ((result == 0) || (result == -EEXIST))
+        if (cover_art_cache_scanned == 0)
         {
-            // see if the file exists by opening it.
-            // if it exists, we're done
-            char * prefix = "cover-";
-
-            size_t pl = strlen(config.cover_art_cache_dir) + 1 + strlen(prefix) + strlen(img_md5_str) +
-                1 + strlen(ext);
+            cover_art_cache_scan();
+            cover_art_cache_scanned = 1;
+        }
 
-            path = malloc(pl + 1);
-            snprintf(path, pl + 1, "%s/%s%s.%s", config.cover_art_cache_dir, prefix, img_md5_str, ext);
-            int cover_fd = open(path, O_WRONLY | O_CREAT | O_EXCL, S_IRWXU | S_IRGRP | S_IROTH);
+        char name[sizeof(cover_art_cache[0].name)];
+        snprintf(name, sizeof(name), "%s%s.%s", COVER_ART_PREFIX, img_md5_str, ext);
+        path = cover_art_path(name);
 
-            if (cover_fd > 0)
-            {
-                // write the contents
-                if (write(cover_fd, buf, len) < len)
-                {
-                    warn("Writing cover art file \"%s\" failed!", path);
-                    free(path);
-                    path = NULL;
-                }
+        uint64_t picture = __atomic_add_fetch(&cover_art_latest_picture, 1, __ATOMIC_ACQ_REL);
+        int entry = -1;
 
-                close(cover_fd);
+        for (i = 0; i < cover_art_cache_count; i++)
+            if (strcmp(cover_art_cache[i].name, name) == 0) entry = i;
 
-                // now delete all other files, if requested
-                if (config.retain_coverart == 0)
-                {
-                    DIR * d;
-                    struct dirent * dir;
-                    d = opendir(config.cover_art_cache_dir);
+        // it may have been deleted by someone else, or not written successfully
+        if ((entry != -1) && (access(path, F_OK) != 0))
+        {
+            cover_art_cache_bytes -= cover_art_cache[entry].size;
+            cover_art_cache[entry] = cover_art_cache[--cover_art_cache_count];
+            entry = -1;
+        }
 
-                    if (d)
-                    {
-                        int fnl = strlen(prefix) + strlen(img_md5_str) + 1 + strlen(ext) + 1;
-
-                        char * full_filename = malloc(fnl);
-
-                        if (full_filename == NULL) die("Can't allocate memory at metadata_write_image_file.");
-
-                        memset(full_filename, 0, fnl);
-                        snprintf(full_filename, fnl, "%s%s.%s", prefix, img_md5_str, ext);
-                        int dir_fd = open(config.cover_art_cache_dir, O_DIRECTORY);
-
-                        if (dir_fd > 0)
-                        {
-                            while ((dir = readdir(d)) != NULL)
-                            {
-                                if (dir->d_type == DT_REG)
-                                {
-                                    if (strcmp(full_filename, dir->d_name) != 0)
-                                    {
-                                        if (unlinkat(dir_fd, dir->d_name, 0) != 0)
-                                        {
-                                            debug(1, "Error %d deleting cover art file \"%s\".", errno, dir->d_name);
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                        else
-                        {
-                            debug(1, "Can't open the directory for deletion.");
-                        }
-
-                        free(full_filename);
-                        closedir(d);
-                    }
-                }
-            }
-            else
-            {
-                //      if (errno == EEXIST)
-                //        debug(1, "Cover art file \"%s\" already exists!", path);
-                //      else {
-                if (errno != EEXIST)
-                {
-                    warn("Could not open file \"%s\" for writing cover art", path);
-                    free(path);
-                    path = NULL;
-                }
-            }
+        if (entry == -1)
+        {
+            cover_art_queue_job(strdup(path), buf, len, picture);
+            cover_art_cache_add(name, len, ++cover_art_cache_clock);
+            entry = cover_art_cache_count - 1;
+            *pending = 1;
         }
         else
         {
-            debug(1, "Couldn't access or create the cover art cache directory \"%s\".",
-                  config.cover_art_cache_dir);
+            // debug(1, "Cover art file \"%s\" already exists!", path);
+            cover_art_cache[entry].last_used = ++cover_art_cache_clock;
         }
+
+        if (config.retain_coverart == 0) cover_art_cache_evict(entry);
     }
 
     return path;
@@ -645,10 +1025,17 @@ void metadata_hub_process_metadata(uint32_t type, uint32_t code, char * data, ui
                 {
                     int oldState;
                     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState); // make this un-cancellable
-                    char * pathname = metadata_write_image_file(data, length);
-                    snprintf(uri, sizeof(uri), "file://%s", pathname);
+                    int pending;
+                    char * pathname = metadata_write_image_file(data, length, &pending);
+
+                    if (pathname == NULL) uri[0] = '\0';
+                    else snprintf(uri, sizeof(uri), "file://%s", pathname);
+
                     free(pathname);
                     pthread_setcancelstate(oldState, NULL);
+
+                    // it'll be set as the cover art when it's been written
+                    if (pending) break;
                 }
                 else
                 {
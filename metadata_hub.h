@@ -34,6 +34,46 @@ typedef enum
     RS_ALL,
 } repeat_status_type;
 
+// bits of metadata_bundle.changed_fields, one for each field a watcher may publish
+typedef enum
+{
+    MF_CLIENT_IP = 1 << 0,
+    MF_SERVER_IP = 1 << 1,
+    MF_PROGRESS_STRING = 1 << 2,
+    MF_DACP_SERVER_ACTIVE = 1 << 3,
+    MF_ADVANCED_DACP_SERVER_ACTIVE = 1 << 4,
+    MF_PLAY_STATUS = 1 << 5,
+    MF_SHUFFLE_STATUS = 1 << 6,
+    MF_REPEAT_STATUS = 1 << 7,
+    MF_COVER_ART_PATHNAME = 1 << 8,
+    MF_ITEM_ID = 1 << 9,
+    MF_ITEM_COMPOSITE_ID = 1 << 10,
+    MF_TRACK_NAME = 1 << 11,
+    MF_ARTIST_NAME = 1 << 12,
+    MF_ALBUM_ARTIST_NAME = 1 << 13,
+    MF_ALBUM_NAME = 1 << 14,
+    MF_GENRE = 1 << 15,
+    MF_COMMENT = 1 << 16,
+    MF_COMPOSER = 1 << 17,
+    MF_FILE_KIND = 1 << 18,
+    MF_SONG_DESCRIPTION = 1 << 19,
+    MF_SONG_ALBUM_ARTIST = 1 << 20,
+    MF_SORT_NAME = 1 << 21,
+    MF_SORT_ARTIST = 1 << 22,
+    MF_SORT_ALBUM = 1 << 23,
+    MF_SORT_COMPOSER = 1 << 24,
+    MF_SONGTIME_IN_MILLISECONDS = 1 << 25,
+    MF_PLAYER_STATE = 1 << 26,
+    MF_ACTIVE_STATE = 1 << 27,
+    MF_SPEAKER_VOLUME = 1 << 28,
+    MF_AIRPLAY_VOLUME = 1 << 29,
+} metadata_field_type;
+
+// the fields that go to make up the track metadata published by the D-Bus and MPRIS interfaces
+#define MF_TRACK_METADATA                                                                          \
+    (MF_COVER_ART_PATHNAME | MF_ITEM_ID | MF_TRACK_NAME | MF_ALBUM_NAME | MF_ARTIST_NAME |          \
+     MF_GENRE | MF_SONGTIME_IN_MILLISECONDS)
+
 int string_update(char * * str, int * changed, char * s);
 int int_update(int * receptacle, int * changed, int value);
 
@@ -135,6 +175,8 @@ typedef struct metadata_bundle
                         // speaker volume control
     double airplay_volume;
 
+    uint32_t changed_fields; // the MF_ bits of the fields changed since the watchers were last run
+
     metadata_watcher watchers[number_of_watchers]; // functions to call if the metadata is changed.
     void * watchers_data[number_of_watchers];    // their individual data
 } metadata_bundle;
@@ -149,8 +191,9 @@ void metadata_hub_process_metadata(uint32_t type, uint32_t code, char * data, ui
 void metadata_hub_reset_track_metadata(void);
 void metadata_hub_release_track_artwork(void);
 
-// these functions lock and unlock the read-write mutex on the metadata hub and run the watchers
-// afterwards
+// these functions lock and unlock the read-write mutex on the metadata hub and arrange for the
+// watchers to be run afterwards -- changes made within a short interval of one another are
+// delivered to the watchers together
 void _metadata_hub_modify_prolog(const char * filename, const int linenumber);
 void _metadata_hub_modify_epilog(
     int modified, const char * filename,
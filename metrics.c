@@ -0,0 +1,500 @@
+/*
+ * Live metrics over HTTP. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Each zone's snapshot is kept behind a seqlock, so neither the player nor the listener ever
+// waits for a lock. The listener answers one request at a time.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "zone.h"
+
+#define METRICS_REQUEST_SIZE 2048
+#define METRICS_RESPONSE_SIZE 65536
+#define METRICS_READ_ATTEMPTS 1000 // a writer is never in the middle of a snapshot for long
+
+int metrics_enabled = 0;
+
+typedef struct
+{
+    metrics_snapshot current;
+    uint32_t sequence; // odd while current is being written
+} metrics_slot;
+
+static metrics_slot metrics_slots[ZONE_MAXIMUM];
+
+static pthread_t metrics_thread;
+static int metrics_socket = -1;
+
+// there is normally only one player thread publishing in a zone, but an ending session's player
+// can overlap the next one's for a moment, so a writer claims the sequence number first
+static void metrics_write_begin(metrics_slot * slot)
+{
+    uint32_t sequence;
+
+    do
+    {
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+    } while ((sequence & 1) ||
+             (__atomic_compare_exchange_n(&slot->sequence, &sequence, sequence + 1, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED) == 0));
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void metrics_write_end(metrics_slot * slot)
+{
+    __atomic_store_n(&slot->sequence, __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELEASE);
+}
+
+void metrics_publish(int zone_index, const metrics_snapshot * snapshot)
+{
+    metrics_slot * slot = &metrics_slots[zone_index];
+
+    metrics_write_begin(slot);
+    slot->current = *snapshot;
+    metrics_write_end(slot);
+}
+
+void metrics_session_ended(int zone_index, int connection_number)
+{
+    metrics_slot * slot = &metrics_slots[zone_index];
+
+    metrics_write_begin(slot);
+
+    if (slot->current.connection_number == connection_number) slot->current.active = 0;
+
+    metrics_write_end(slot);
+}
+
+// returns 0 if a consistent snapshot couldn't be had
+static int metrics_read(metrics_slot * slot, metrics_snapshot * snapshot)
+{
+    int attempt;
+
+    for (attempt = 0; attempt < METRICS_READ_ATTEMPTS; attempt++)
+    {
+        uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+        if (sequence & 1) continue;
+
+        *snapshot = slot->current;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence) return 1;
+    }
+
+    return 0;
+}
+
+uint64_t metrics_thread_time_now(void)
+{
+    if (metrics_enabled == 0) return 0;
+
+    struct timespec tn;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tn);
+    return ((uint64_t)tn.tv_sec) * 1000000000 + tn.tv_nsec;
+}
+
+static int metrics_truncation_reported = 0; // only the listener thread appends
+
+// append to the response, leaving room for vsnprintf()'s NUL, which isn't part of the response
+static void metrics_append(char * buf, size_t * length, const char * format, ...)
+{
+    if (*length >= METRICS_RESPONSE_SIZE - 1) return;
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + *length, METRICS_RESPONSE_SIZE - *length, format, args);
+    va_end(args);
+
+    if (n > 0) *length += n;
+
+    if (*length > METRICS_RESPONSE_SIZE - 1)
+    {
+        *length = METRICS_RESPONSE_SIZE - 1;
+
+        if (metrics_truncation_reported == 0)
+        {
+            warn("The metrics don't fit in %d bytes and have been cut short.", METRICS_RESPONSE_SIZE);
+            metrics_truncation_reported = 1;
+        }
+    }
+}
+
+#define METRICS_HEADER(buf, length, name, type, help)                                           \
+    metrics_append(buf, length, "# HELP shairport_sync_" name " " help "\n"                     \
+                   "# TYPE shairport_sync_" name " " type "\n")
+
+// a zone label for each metric, if there's more than one zone, with the name escaped
+static void metrics_zone_label(char * label, size_t size, const char * name)
+{
+    size_t length = 0;
+
+    if (zone_count == 1)
+    {
+        label[0] = '\0';
+        return;
+    }
+
+    length += snprintf(label, size, "{zone=\"");
+
+    while ((*name) && (length + 4 < size))
+    {
+        if ((*name == '"') || (*name == '\\')) label[length++] = '\\';
+
+        label[length++] = *name++;
+    }
+
+    snprintf(label + length, size - length, "\"}");
+}
+
+#define METRICS_ZONES(buf, length, name, format, field)                                         \
+    for (z = 0; z < zone_count; z++)                                                            \
+        metrics_append(buf, length, "shairport_sync_" name "%s " format "\n", labels[z], s[z].field)
+
+// write the metrics in the Prometheus text format, returning their length
+static size_t metrics_format(char * buf)
+{
+    size_t length = 0;
+    metrics_snapshot s[ZONE_MAXIMUM];
+    char labels[ZONE_MAXIMUM][80];
+    int z;
+
+    for (z = 0; z < zone_count; z++)
+    {
+        if (metrics_read(&metrics_slots[z], &s[z]) == 0)
+        {
+            debug(1, "metrics: couldn't get a consistent snapshot of the session in zone \"%s\".",
+                  zones[z].name);
+            memset(&s[z], 0, sizeof(s[z]));
+        }
+
+        metrics_zone_label(labels[z], sizeof(labels[z]), zones[z].name);
+        s[z].active = s[z].active ? 1 : 0;
+    }
+
+    METRICS_HEADER(buf, &length, "session_active", "gauge", "Whether a session is playing.");
+    METRICS_ZONES(buf, &length, "session_active", "%d", active);
+
+    METRICS_HEADER(buf, &length, "buffer_occupancy_packets", "gauge",
+                   "Packets waiting in the player's buffer.");
+    METRICS_ZONES(buf, &length, "buffer_occupancy_packets", "%" PRId32, buffer_occupancy);
+
+    METRICS_HEADER(buf, &length, "sync_error_frames", "gauge",
+                   "How late the output is, in frames; negative if early.");
+    METRICS_ZONES(buf, &length, "sync_error_frames", "%" PRId64, sync_error);
+
+    METRICS_HEADER(buf, &length, "dac_delay_frames", "gauge",
+                   "Frames the backend reports are queued ahead of the DAC.");
+    METRICS_ZONES(buf, &length, "dac_delay_frames", "%" PRIu64, dac_delay);
+
+    METRICS_HEADER(buf, &length, "session_corrections_frames", "gauge",
+                   "Frames inserted less frames deleted to keep in sync, this session.");
+    METRICS_ZONES(buf, &length, "session_corrections_frames", "%" PRId64, session_corrections);
+
+    METRICS_HEADER(buf, &length, "corrections_frames_total", "counter",
+                   "Frames inserted or deleted to keep in sync, this session.");
+    METRICS_ZONES(buf, &length, "corrections_frames_total", "%" PRIu64, corrections);
+
+    METRICS_HEADER(buf, &length, "frames_played_total", "counter",
+                   "Frames sent to the backend, this session.");
+    METRICS_ZONES(buf, &length, "frames_played_total", "%" PRIu64, frames_played);
+
+    METRICS_HEADER(buf, &length, "missing_packets_total", "counter",
+                   "Packets never received, this session.");
+    METRICS_ZONES(buf, &length, "missing_packets_total", "%" PRIu64, missing_packets);
+
+    METRICS_HEADER(buf, &length, "late_packets_total", "counter",
+                   "Packets received after they were asked for again, this session.");
+    METRICS_ZONES(buf, &length, "late_packets_total", "%" PRIu64, late_packets);
+
+    METRICS_HEADER(buf, &length, "too_late_packets_total", "counter",
+                   "Packets received too late to be played, this session.");
+    METRICS_ZONES(buf, &length, "too_late_packets_total", "%" PRIu64, too_late_packets);
+
+    METRICS_HEADER(buf, &length, "resend_requests_total", "counter",
+                   "Packets asked for again, this session.");
+    METRICS_ZONES(buf, &length, "resend_requests_total", "%" PRIu64, resend_requests);
+
+    METRICS_HEADER(buf, &length, "input_frame_rate", "gauge",
+                   "Frames per second received from the source.");
+    METRICS_ZONES(buf, &length, "input_frame_rate", "%.3f", input_frame_rate);
+
+    METRICS_HEADER(buf, &length, "output_frame_rate", "gauge",
+                   "Frames per second taken by the DAC, or 0 if the backend can't tell.");
+    METRICS_ZONES(buf, &length, "output_frame_rate", "%.3f", output_frame_rate);
+
+    METRICS_HEADER(buf, &length, "dsp_cpu_seconds_total", "counter",
+                   "CPU time spent in the DSP chain and in stuffing, this session.");
+    METRICS_ZONES(buf, &length, "dsp_cpu_seconds_total", "%.6f", dsp_time_ns * 1.0E-9);
+
+    if (latency_histograms_enabled)
+    {
+        latency_stage stage;
+
+        METRICS_HEADER(buf, &length, "stage_latency_seconds", "summary",
+                       "Time taken by each stage of the audio path.");
+
+        for (stage = 0; stage < LH_stage_count; stage++)
+        {
+            uint64_t count, total_ns, maximum_ns;
+            latency_histogram_summary(stage, &count, &total_ns, &maximum_ns);
+            metrics_append(buf, &length,
+                           "shairport_sync_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n"
+                           "shairport_sync_stage_latency_seconds_count{stage=\"%s\"} %" PRIu64 "\n",
+                           latency_stage_name(stage), total_ns * 1.0E-9, latency_stage_name(stage),
+                           count);
+        }
+
+        METRICS_HEADER(buf, &length, "stage_latency_maximum_seconds", "gauge",
+                       "The longest time taken by each stage of the audio path.");
+
+        for (stage = 0; stage < LH_stage_count; stage++)
+        {
+            uint64_t count, total_ns, maximum_ns;
+            latency_histogram_summary(stage, &count, &total_ns, &maximum_ns);
+            metrics_append(buf, &length,
+                           "shairport_sync_stage_latency_maximum_seconds{stage=\"%s\"} %.9f\n",
+                           latency_stage_name(stage), maximum_ns * 1.0E-9);
+        }
+    }
+
+    return length;
+}
+
+static void metrics_send(int fd, const char * buf, size_t length)
+{
+    while (length)
+    {
+        ssize_t n = send(fd, buf, length, MSG_NOSIGNAL);
+
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+
+            debug(2, "metrics: error %d sending a response.", errno);
+            return;
+        }
+
+        buf += n;
+        length -= n;
+    }
+}
+
+static void metrics_send_status(int fd, const char * status)
+{
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n"
+                          "Connection: close\r\n\r\n%s\n",
+                          status, strlen(status) + 1, status);
+    metrics_send(fd, response, length);
+}
+
+static void metrics_handle_request(int fd)
+{
+    char request[METRICS_REQUEST_SIZE];
+    size_t length = 0;
+
+    // a scraper sends its request all at once, so there's no waiting about for a slow one
+    struct timeval timeout = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while (length < sizeof(request) - 1)
+    {
+        ssize_t n = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+
+            return;
+        }
+
+        if (n == 0) break;
+
+        length += n;
+        request[length] = '\0';
+
+        if (strstr(request, "\r\n\r\n")) break;
+    }
+
+    request[length] = '\0';
+
+    char method[16], target[256];
+
+    if (sscanf(request, "%15s %255s", method, target) != 2)
+    {
+        metrics_send_status(fd, "400 Bad Request");
+        return;
+    }
+
+    char * query = strchr(target, '?');
+
+    if (query) *query = '\0';
+
+    if ((strcmp(target, "/metrics") != 0) && (strcmp(target, "/") != 0))
+    {
+        metrics_send_status(fd, "404 Not Found");
+        return;
+    }
+
+    if (strcmp(method, "GET") != 0)
+    {
+        metrics_send_status(fd, "405 Method Not Allowed");
+        return;
+    }
+
+    char * body = malloc(METRICS_RESPONSE_SIZE);
+
+    if (body == NULL)
+    {
+        metrics_send_status(fd, "500 Internal Server Error");
+        return;
+    }
+
+    size_t body_length = metrics_format(body);
+
+    char header[256];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 200 OK\r\n"
+                                 "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                 "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                 body_length);
+    metrics_send(fd, header, header_length);
+    metrics_send(fd, body, body_length);
+    free(body);
+}
+
+static void * metrics_thread_code(__attribute__((unused)) void * arg)
+{
+    set_thread_scheduling(TC_metadata);
+
+    while (1)
+    {
+        int fd = accept(metrics_socket, NULL, NULL);
+
+        if (fd < 0)
+        {
+            if ((errno != EINTR) && (errno != ECONNABORTED))
+            {
+                int error = errno;
+                debug(1, "metrics: error %d accepting a connection.", error);
+                usleep(100000); // don't spin if something's badly wrong
+            }
+
+            continue;
+        }
+
+        metrics_handle_request(fd);
+        close(fd);
+    }
+
+    pthread_exit(NULL);
+}
+
+void metrics_start(const char * address, int port)
+{
+    struct addrinfo hints, *info, *p;
+    char service[8];
+    int ret;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    snprintf(service, sizeof(service), "%d", port);
+
+    ret = getaddrinfo(address, service, &hints, &info);
+
+    if (ret != 0)
+    {
+        warn("metrics: can't use the address \"%s\": \"%s\". The metrics listener won't run.",
+             address ? address : "", gai_strerror(ret));
+        return;
+    }
+
+    // the first address that works is used -- with no address given, that's all of them
+    for (p = info; p != NULL; p = p->ai_next)
+    {
+        int fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+
+        if (fd < 0) continue;
+
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+        if ((bind(fd, p->ai_addr, p->ai_addrlen) == 0) && (listen(fd, 4) == 0))
+        {
+            metrics_socket = fd;
+            break;
+        }
+
+        close(fd);
+    }
+
+    freeaddrinfo(info);
+
+    if (metrics_socket < 0)
+    {
+        char errorstring[1024];
+        strerror_r(errno, (char *)errorstring, sizeof(errorstring));
+        warn("metrics: can't listen on port %d: \"%s\". The metrics listener won't run.", port,
+             errorstring);
+        return;
+    }
+
+    metrics_enabled = 1;
+
+    if (pthread_create(&metrics_thread, NULL, &metrics_thread_code, NULL) != 0)
+    {
+        warn("metrics: can't start the listener thread.");
+        metrics_enabled = 0;
+        close(metrics_socket);
+        metrics_socket = -1;
+        return;
+    }
+
+    pthread_detach(metrics_thread);
+    inform("Metrics are served on port %d.", port);
+}
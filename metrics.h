@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+// A snapshot of the session playing in each zone, published by its player thread and served in
+// the Prometheus text format by a small HTTP listener, if diagnostics.metrics_port is set. If
+// there's more than one zone, each metric has a zone label.
+// Publishing and reading are both lock-free -- see metrics.c -- so a scrape never holds up
+// the player, and never takes the buffer's mutex.
+
+typedef struct
+{
+    int active;               // non-zero while a session is playing
+    int connection_number;
+    int32_t buffer_occupancy; // packets
+    int64_t sync_error;       // frames, positive if late
+    uint64_t dac_delay;       // frames
+    int64_t session_corrections;  // frames inserted less frames deleted, this session
+    uint64_t corrections;         // frames inserted plus frames deleted, this session
+    uint64_t frames_played;       // frames sent to the backend, this session
+    uint64_t missing_packets, late_packets, too_late_packets, resend_requests;
+    double input_frame_rate;  // measured, frames per second
+    double output_frame_rate; // measured at the backend, frames per second -- 0.0 if unknown
+    uint64_t dsp_time_ns;     // thread CPU time spent in the DSP chain and stuffing, this session
+} metrics_snapshot;
+
+extern int metrics_enabled; // set when the listener is running
+
+// to be called by the player thread -- the snapshot is copied
+void metrics_publish(int zone_index, const metrics_snapshot * snapshot);
+
+// mark the connection's session as ended, if it's the one last published in the zone
+void metrics_session_ended(int zone_index, int connection_number);
+
+// the calling thread's CPU time, or 0 if the metrics are off
+uint64_t metrics_thread_time_now(void);
+
+void metrics_start(const char * address, int port);
@@ -69,50 +69,59 @@ void mpris_metadata_watcher(struct metadata_bundle * argc, __attribute__((unused
     // debug(1, "MPRIS metadata watcher called");
     char response[100];
 
-    media_player2_player_set_volume(mprisPlayerPlayerSkeleton,
-                                    airplay_volume_to_mpris_volume(argc->airplay_volume));
-    switch (argc->repeat_status)
-    {
-        case RS_NOT_AVAILABLE:
-            strcpy(response, "Not Available");
-            break;
-
-        case RS_OFF:
-            strcpy(response, "None");
-            break;
+    // only the properties whose fields have changed are set
+    if (argc->changed_fields & MF_AIRPLAY_VOLUME)
+        media_player2_player_set_volume(mprisPlayerPlayerSkeleton,
+                                        airplay_volume_to_mpris_volume(argc->airplay_volume));
 
-        case RS_ONE:
-            strcpy(response, "Track");
-            break;
-
-        case RS_ALL:
-            strcpy(response, "Playlist");
-            break;
+    if (argc->changed_fields & MF_REPEAT_STATUS)
+    {
+        switch (argc->repeat_status)
+        {
+            case RS_NOT_AVAILABLE:
+                strcpy(response, "Not Available");
+                break;
+
+            case RS_OFF:
+                strcpy(response, "None");
+                break;
+
+            case RS_ONE:
+                strcpy(response, "Track");
+                break;
+
+            case RS_ALL:
+                strcpy(response, "Playlist");
+                break;
+        }
+
+        media_player2_player_set_loop_status(mprisPlayerPlayerSkeleton, response);
     }
 
-    media_player2_player_set_loop_status(mprisPlayerPlayerSkeleton, response);
-
-    switch (argc->player_state)
+    if (argc->changed_fields & MF_PLAYER_STATE)
     {
-        case PS_NOT_AVAILABLE:
-            strcpy(response, "Not Available");
-            break;
-
-        case PS_STOPPED:
-            strcpy(response, "Stopped");
-            break;
-
-        case PS_PAUSED:
-            strcpy(response, "Paused");
-            break;
-
-        case PS_PLAYING:
-            strcpy(response, "Playing");
-            break;
+        switch (argc->player_state)
+        {
+            case PS_NOT_AVAILABLE:
+                strcpy(response, "Not Available");
+                break;
+
+            case PS_STOPPED:
+                strcpy(response, "Stopped");
+                break;
+
+            case PS_PAUSED:
+                strcpy(response, "Paused");
+                break;
+
+            case PS_PLAYING:
+                strcpy(response, "Playing");
+                break;
+        }
+
+        media_player2_player_set_playback_status(mprisPlayerPlayerSkeleton, response);
     }
 
-    media_player2_player_set_playback_status(mprisPlayerPlayerSkeleton, response);
-
     /*
        switch (argc->shuffle_state) {
        case SS_NOT_AVAILABLE:
@@ -129,22 +138,25 @@ void mpris_metadata_watcher(struct metadata_bundle * argc, __attribute__((unused
        media_player2_player_set_shuffle_status(mprisPlayerPlayerSkeleton, response);
      */
 
-    switch (argc->shuffle_status)
+    if (argc->changed_fields & MF_SHUFFLE_STATUS)
     {
-        case SS_NOT_AVAILABLE:
-            media_player2_player_set_shuffle(mprisPlayerPlayerSkeleton, FALSE);
-            break;
-
-        case SS_OFF:
-            media_player2_player_set_shuffle(mprisPlayerPlayerSkeleton, FALSE);
-            break;
-
-        case SS_ON:
-            media_player2_player_set_shuffle(mprisPlayerPlayerSkeleton, TRUE);
-            break;
-
-        default:
-            debug(1, "This should never happen.");
+        switch (argc->shuffle_status)
+        {
+            case SS_NOT_AVAILABLE:
+                media_player2_player_set_shuffle(mprisPlayerPlayerSkeleton, FALSE);
+                break;
+
+            case SS_OFF:
+                media_player2_player_set_shuffle(mprisPlayerPlayerSkeleton, FALSE);
+                break;
+
+            case SS_ON:
+                media_player2_player_set_shuffle(mprisPlayerPlayerSkeleton, TRUE);
+                break;
+
+            default:
+                debug(1, "This should never happen.");
+        }
     }
 
     /*
@@ -180,6 +192,9 @@ void mpris_metadata_watcher(struct metadata_bundle * argc, __attribute__((unused
 
      */
 
+    // the metadata is a single property, and is only rebuilt if any of its fields has changed
+    if ((argc->changed_fields & MF_TRACK_METADATA) == 0) return;
+
     // Build the metadata array
     debug(2, "Build metadata");
     GVariantBuilder * dict_builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
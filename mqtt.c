@@ -1,6 +1,8 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "config.h"
 
@@ -11,6 +13,7 @@
 #include "rtp.h"
 
 #include "dacp.h"
+#include "latency_histogram.h"
 #include "mqtt.h"
 #include <mosquitto.h>
 
@@ -19,6 +22,31 @@ struct mosquitto * global_mosq = NULL;
 char * topic = NULL;
 int connected = 0;
 
+// In asynchronous mode, topics that carry a state, such as the volume or the progress string, are
+// not published as they arrive. Instead, the latest value for each is kept here and a publisher
+// thread sends it at most once per mqtt.publish_interval_in_seconds, so a burst of volume changes
+// results in a single message to the broker.
+
+#define MQTT_COALESCED_TOPICS 24
+
+typedef struct
+{
+    char * topic;
+    char * data;
+    uint32_t length;
+    int pending;
+} mqtt_coalesced_topic;
+
+static mqtt_coalesced_topic mqtt_coalesced_topics[MQTT_COALESCED_TOPICS];
+static int mqtt_coalesced_topics_pending = 0;
+static pthread_mutex_t mqtt_coalesced_topics_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mqtt_coalesced_topics_signal = PTHREAD_COND_INITIALIZER;
+static pthread_t mqtt_publisher_thread;
+
+// the hash of the cover art last published, which is retained by the broker
+static uint64_t mqtt_cover_hash = 0;
+static int mqtt_cover_published = 0;
+
 // mosquitto logging
 void _cb_log(__attribute__((unused)) struct mosquitto * mosq, __attribute__((unused)) void * userdata,
              int level, const char * str)
@@ -59,6 +87,26 @@ void on_message(__attribute__((unused)) struct mosquitto * mosq,
 
     debug(2, "[MQTT]: received Message on topic %s: %s\n", msg->topic, payload);
 
+    // latency histograms are published on request, in reply, on the "latency_histograms" topic
+    if (strcmp(payload, "latency_histograms") == 0)
+    {
+        char * histograms = latency_histograms_as_string();
+
+        if (histograms)
+        {
+            mqtt_publish("latency_histograms", histograms, strlen(histograms));
+            free(histograms);
+        }
+
+        return;
+    }
+
+    if (strcmp(payload, "latency_histograms_reset") == 0)
+    {
+        latency_histograms_reset();
+        return;
+    }
+
     // All recognized commands
     char * commands[] = { "command",    "beginff",       "beginrew",          "mutetoggle",   "nextitem",
                           "previtem",   "pause",         "playpause",         "play",         "stop",
@@ -103,8 +151,7 @@ void on_connect(struct mosquitto * mosq, __attribute__((unused)) void * userdata
     }
 }
 
-// helper function to publish under a topic and automatically append the main topic
-void mqtt_publish(char * topic, char * data, uint32_t length)
+static void mqtt_publish_with_retain(char * topic, char * data, uint32_t length, int retain)
 {
     char fulltopic[strlen(config.mqtt_topic) + strlen(topic) + 3];
 
@@ -114,7 +161,7 @@ void mqtt_publish(char * topic, char * data, uint32_t length)
 
     int rc;
 
-    if ((rc = mosquitto_publish(global_mosq, NULL, fulltopic, length, data, 0, 0)) !=
+    if ((rc = mosquitto_publish(global_mosq, NULL, fulltopic, length, data, 0, retain)) !=
         MOSQ_ERR_SUCCESS)
     {
         switch (rc)
@@ -130,6 +177,169 @@ void mqtt_publish(char * topic, char * data, uint32_t length)
     }
 }
 
+// helper function to publish under a topic and automatically append the main topic
+void mqtt_publish(char * topic, char * data, uint32_t length)
+{
+    mqtt_publish_with_retain(topic, data, length, 0);
+}
+
+// publish a topic that carries a state -- in asynchronous mode, only the latest value is sent
+static void mqtt_publish_latest(char * topic, char * data, uint32_t length)
+{
+    if (config.mqtt_publish_asynchronously == 0)
+    {
+        mqtt_publish(topic, data, length);
+        return;
+    }
+
+    int i, slot = -1;
+
+    pthread_mutex_lock(&mqtt_coalesced_topics_lock);
+
+    for (i = 0; i < MQTT_COALESCED_TOPICS; i++)
+    {
+        if (mqtt_coalesced_topics[i].topic == NULL)
+        {
+            if (slot == -1) slot = i;
+        }
+        else if (strcmp(mqtt_coalesced_topics[i].topic, topic) == 0)
+        {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot != -1)
+    {
+        mqtt_coalesced_topic * t = &mqtt_coalesced_topics[slot];
+
+        if (t->topic == NULL) t->topic = strdup(topic);
+
+        char * copy = malloc(length > 0 ? length : 1);
+
+        if ((t->topic) && (copy))
+        {
+            if (length) memcpy(copy, data, length);
+
+            free(t->data);
+            t->data = copy;
+            t->length = length;
+            t->pending = 1;
+            mqtt_coalesced_topics_pending = 1;
+            pthread_cond_signal(&mqtt_coalesced_topics_signal);
+        }
+        else
+        {
+            free(copy);
+            slot = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&mqtt_coalesced_topics_lock);
+
+    if (slot == -1)
+    {
+        debug(1, "[MQTT]: can't hold topic \"%s\" for later publication, so publishing it now.",
+              topic);
+        mqtt_publish(topic, data, length);
+    }
+}
+
+// publish the values waiting to be published -- call this with mqtt_coalesced_topics_lock held.
+// mosquitto_publish only queues the message for the mosquitto loop thread, so this is quick
+static void mqtt_publish_pending_topics(void)
+{
+    int i;
+
+    for (i = 0; i < MQTT_COALESCED_TOPICS; i++)
+    {
+        if (mqtt_coalesced_topics[i].pending)
+        {
+            mqtt_publish(mqtt_coalesced_topics[i].topic, mqtt_coalesced_topics[i].data,
+                         mqtt_coalesced_topics[i].length);
+            mqtt_coalesced_topics[i].pending = 0;
+        }
+    }
+
+    mqtt_coalesced_topics_pending = 0;
+}
+
+// publish a topic that marks an event, such as the start of play. In asynchronous mode, any
+// values still waiting to be published are published first, so that a subscriber sees the state
+// as it was when the event happened -- e.g. the new track's metadata before its play_start
+static void mqtt_publish_event(char * topic, char * data, uint32_t length)
+{
+    if (config.mqtt_publish_asynchronously == 0)
+    {
+        mqtt_publish(topic, data, length);
+        return;
+    }
+
+    pthread_mutex_lock(&mqtt_coalesced_topics_lock);
+
+    if (mqtt_coalesced_topics_pending) mqtt_publish_pending_topics();
+
+    mqtt_publish(topic, data, length);
+    pthread_mutex_unlock(&mqtt_coalesced_topics_lock);
+}
+
+static void * mqtt_publisher_thread_function(__attribute__((unused)) void * arg)
+{
+    set_thread_scheduling(TC_metadata);
+
+    while (1)
+    {
+        pthread_mutex_lock(&mqtt_coalesced_topics_lock);
+        pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&mqtt_coalesced_topics_lock);
+
+        while (mqtt_coalesced_topics_pending == 0)
+            pthread_cond_wait(&mqtt_coalesced_topics_signal,
+                              &mqtt_coalesced_topics_lock); // a cancellation point
+
+        pthread_cleanup_pop(1);
+
+        // let further values for the same topics replace the ones already waiting
+        usleep((useconds_t)(config.mqtt_publish_interval * 1000000)); // a cancellation point
+
+        pthread_mutex_lock(&mqtt_coalesced_topics_lock);
+        mqtt_publish_pending_topics(); // an event may have published them already
+        pthread_mutex_unlock(&mqtt_coalesced_topics_lock);
+    }
+
+    pthread_exit(NULL);
+}
+
+// in asynchronous mode, the cover art is published as a retained message, and only when it differs
+// from the one last published
+static void mqtt_publish_cover(char * data, uint32_t length)
+{
+    if (config.mqtt_publish_asynchronously == 0)
+    {
+        mqtt_publish("cover", data, length);
+        return;
+    }
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    uint32_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    if ((mqtt_cover_published) && (hash == mqtt_cover_hash))
+    {
+        debug(3, "[MQTT]: cover art unchanged, not publishing it again.");
+        return;
+    }
+
+    mqtt_cover_hash = hash;
+    mqtt_cover_published = 1;
+    mqtt_publish_with_retain("cover", data, length, 1);
+}
+
 // handler for incoming metadata
 void mqtt_process_metadata(uint32_t type, uint32_t code, char * data, uint32_t length)
 {
@@ -148,7 +358,10 @@ void mqtt_process_metadata(uint32_t type, uint32_t code, char * data, uint32_t l
         memcpy(topic, &val, 4);
         val = htonl(code);
         memcpy(topic + 5, &val, 4);
-        mqtt_publish(topic, data, length);
+
+        if ((type == 'ssnc') && ((code == 'pvol') || (code == 'prgr')))
+            mqtt_publish_latest(topic, data, length);
+        else mqtt_publish_event(topic, data, length);
     }
 
     if (config.mqtt_publish_parsed)
@@ -158,23 +371,23 @@ void mqtt_process_metadata(uint32_t type, uint32_t code, char * data, uint32_t l
             switch (code)
             {
                 case 'asar':
-                    mqtt_publish("artist", data, length);
+                    mqtt_publish_latest("artist", data, length);
                     break;
 
                 case 'asal':
-                    mqtt_publish("album", data, length);
+                    mqtt_publish_latest("album", data, length);
                     break;
 
                 case 'minm':
-                    mqtt_publish("title", data, length);
+                    mqtt_publish_latest("title", data, length);
                     break;
 
                 case 'asgn':
-                    mqtt_publish("genre", data, length);
+                    mqtt_publish_latest("genre", data, length);
                     break;
 
                 case 'asfm':
-                    mqtt_publish("format", data, length);
+                    mqtt_publish_latest("format", data, length);
                     break;
             }
         }
@@ -183,46 +396,50 @@ void mqtt_process_metadata(uint32_t type, uint32_t code, char * data, uint32_t l
             switch (code)
             {
                 case 'asal':
-                    mqtt_publish("songalbum", data, length);
+                    mqtt_publish_latest("songalbum", data, length);
                     break;
 
                 case 'pvol':
-                    mqtt_publish("volume", data, length);
+                    mqtt_publish_latest("volume", data, length);
                     break;
 
                 case 'clip':
-                    mqtt_publish("client_ip", data, length);
+                    mqtt_publish_latest("client_ip", data, length);
                     break;
 
                 case 'abeg':
-                    mqtt_publish("active_start", data, length);
+                    mqtt_publish_event("active_start", data, length);
                     break;
 
                 case 'aend':
-                    mqtt_publish("active_end", data, length);
+                    mqtt_publish_event("active_end", data, length);
                     break;
 
                 case 'pbeg':
-                    mqtt_publish("play_start", data, length);
+                    mqtt_publish_event("play_start", data, length);
                     break;
 
                 case 'pend':
-                    mqtt_publish("play_end", data, length);
+                    mqtt_publish_event("play_end", data, length);
                     break;
 
                 case 'pfls':
-                    mqtt_publish("play_flush", data, length);
+                    mqtt_publish_event("play_flush", data, length);
                     break;
 
                 case 'prsm':
-                    mqtt_publish("play_resume", data, length);
+                    mqtt_publish_event("play_resume", data, length);
+                    break;
+
+                case 'intp':
+                    mqtt_publish_latest("interpolation", data, length);
                     break;
 
                 case 'PICT':
 
                     if (config.mqtt_publish_cover)
                     {
-                        mqtt_publish("cover", data, length);
+                        mqtt_publish_cover(data, length);
                     }
 
                     break;
@@ -291,5 +508,11 @@ int initialise_mqtt()
         inform("[MQTT]: Could start MQTT Main loop");
     }
 
+    if (config.mqtt_publish_asynchronously)
+    {
+        if (pthread_create(&mqtt_publisher_thread, NULL, &mqtt_publisher_thread_function, NULL) != 0)
+            die("[MQTT]: Could not create the publisher thread");
+    }
+
     return 0;
 }
@@ -0,0 +1,419 @@
+/*
+ * The startup profile of the configured audio path. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The stages are timed in thread CPU time, on packets of the sessions' size, rate and format,
+// with dither on and the interpolator busy, so the figure is a conservative one.
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "alac.h"
+#include "alac_encoder.h"
+#include "common.h"
+#include "dsp.h"
+#include "loudness.h"
+#include "pipeline_profile.h"
+#include "player.h"
+#include "polyphase.h"
+#include "process_block.h"
+#include "zone.h"
+
+#ifdef CONFIG_APPLE_ALAC
+#include "apple_alac.h"
+#endif
+
+#define PIPELINE_PROFILE_PACKETS 16              // distinct packets of the signal, used in turn
+#define PIPELINE_PROFILE_STAGE_NS ((uint64_t)150000000) // CPU time to run each stage for
+#define PIPELINE_PROFILE_STUFF_ROOM 8            // frames an interpolator may add to a packet
+#define PIPELINE_PROFILE_REPORT_SIZE 1024
+
+typedef struct
+{
+    const char * decoder;
+    uint64_t decode_ns; // each figure is per packet
+    int dsp_loudness, dsp_convolution;
+    uint64_t dsp_ns;
+    const char * interpolation;
+    uint64_t interpolation_ns;
+    uint64_t total_ns, packet_ns;
+    const char * degraded_to; // the interpolation it had to fall back to, or NULL
+} pipeline_profile;
+
+static char * pipeline_profile_report = NULL; // written once, before any reader can ask for it
+
+typedef struct
+{
+    int frames; // per packet, at the output rate
+    int16_t signal[PIPELINE_PROFILE_PACKETS][ALAC_ENCODER_FRAMES_PER_PACKET * 2];
+    uint8_t alac_packets[PIPELINE_PROFILE_PACKETS][ALAC_ENCODER_MAXIMUM_PACKET];
+    int alac_packet_length[PIPELINE_PROFILE_PACKETS];
+    int32_t * input;   // a packet at the output rate, as the DSP chain gets it
+    int32_t * scratch; // for the interpolators
+    char * output;
+    rtsp_conn_info * conn;
+} pipeline_profile_state;
+
+typedef void (* pipeline_profile_stage)(pipeline_profile_state * state, int packet);
+
+static uint64_t pipeline_profile_cpu_time_now(void)
+{
+    struct timespec tn;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tn);
+    return ((uint64_t)tn.tv_sec) * 1000000000 + tn.tv_nsec;
+}
+
+// run a stage over and over, a packet at a time, and return its CPU time per packet
+static uint64_t pipeline_profile_time(pipeline_profile_stage stage, pipeline_profile_state * state)
+{
+    uint64_t packets = 0;
+
+    stage(state, 0); // the first call may set things up
+
+    uint64_t start_time = pipeline_profile_cpu_time_now();
+    uint64_t elapsed;
+
+    do
+    {
+        stage(state, packets % PIPELINE_PROFILE_PACKETS);
+        packets++;
+        elapsed = pipeline_profile_cpu_time_now() - start_time;
+    } while (elapsed < PIPELINE_PROFILE_STAGE_NS);
+
+    return elapsed / packets;
+}
+
+// a few tones and some noise, as in the benchmarks, at 44,100 frames per second
+static void pipeline_profile_make_signal(pipeline_profile_state * state)
+{
+    uint32_t noise = 12345;
+    int p, i;
+
+    for (p = 0; p < PIPELINE_PROFILE_PACKETS; p++)
+    {
+        for (i = 0; i < ALAC_ENCODER_FRAMES_PER_PACKET; i++)
+        {
+            double t = (p * ALAC_ENCODER_FRAMES_PER_PACKET + i) / 44100.0;
+            double n[2];
+            int c;
+
+            for (c = 0; c < 2; c++)
+            {
+                noise = noise * 1664525 + 1013904223;
+                n[c] = (noise >> 8) * (2.0 / 16777216.0) - 1.0;
+            }
+
+            double l = 0.30 * sin(2 * M_PI * 220 * t) + 0.15 * sin(2 * M_PI * 1760 * t) + 0.05 * n[0];
+            double r = 0.25 * sin(2 * M_PI * 330 * t) + 0.15 * sin(2 * M_PI * 1760 * t) + 0.05 * n[1];
+
+            state->signal[p][i * 2] = (int16_t)(l * 32767);
+            state->signal[p][i * 2 + 1] = (int16_t)(r * 32767);
+        }
+
+        state->alac_packet_length[p] =
+            alac_encode_packet(state->signal[p], ALAC_ENCODER_FRAMES_PER_PACKET, state->alac_packets[p]);
+    }
+}
+
+// a packet at the output rate -- each frame is repeated, which doesn't change the work done
+static void pipeline_profile_input(pipeline_profile_state * state, int packet)
+{
+    int ratio = state->frames / ALAC_ENCODER_FRAMES_PER_PACKET;
+    int i, j;
+
+    for (i = 0; i < ALAC_ENCODER_FRAMES_PER_PACKET; i++)
+        for (j = 0; j < ratio; j++)
+        {
+            state->input[(i * ratio + j) * 2] = state->signal[packet][i * 2] * 65536;
+            state->input[(i * ratio + j) * 2 + 1] = state->signal[packet][i * 2 + 1] * 65536;
+        }
+}
+
+static alac_file * pipeline_profile_alac;
+#ifdef CONFIG_APPLE_ALAC
+static apple_alac * pipeline_profile_apple_alac;
+#endif
+
+static void pipeline_profile_decode(pipeline_profile_state * state, int packet)
+{
+    int outsize = ALAC_ENCODER_FRAMES_PER_PACKET * 4;
+#ifdef CONFIG_APPLE_ALAC
+
+    if (config.use_apple_decoder)
+    {
+        apple_alac_decode(pipeline_profile_apple_alac, state->alac_packets[packet],
+                          state->alac_packet_length[packet], (unsigned char *)state->output,
+                          &outsize);
+        return;
+    }
+
+#endif
+    alac_decode_frame(pipeline_profile_alac, state->alac_packets[packet],
+                      state->alac_packet_length[packet], state->output, &outsize);
+}
+
+static dsp_chain pipeline_profile_dsp;
+
+static void pipeline_profile_dsp_chain(pipeline_profile_state * state, int packet)
+{
+    pipeline_profile_input(state, packet);
+    dsp_chain_process(&pipeline_profile_dsp, state->input, state->frames);
+}
+
+static void pipeline_profile_basic(pipeline_profile_state * state, int packet)
+{
+    pipeline_profile_input(state, packet);
+    stuff_buffer_basic_32(state->input, state->frames, state->output, (packet % 3) - 1, 1,
+                          state->conn);
+}
+
+static void pipeline_profile_polyphase(pipeline_profile_state * state, int packet)
+{
+    pipeline_profile_input(state, packet);
+    stuff_buffer_polyphase_32(state->input, state->scratch, state->frames, state->output,
+                              (state->frames + (packet % 3) - 1.0) / state->frames, 1, state->conn);
+}
+
+#ifdef CONFIG_SOXR
+static void pipeline_profile_soxr(pipeline_profile_state * state, int packet)
+{
+    pipeline_profile_input(state, packet);
+    stuff_buffer_soxr_32(state->input, state->scratch, state->frames, state->output,
+                         (packet % 3) - 1, 1, state->conn);
+}
+#endif
+
+static void pipeline_profile_format(const pipeline_profile * profile, sps_format_t format)
+{
+    char * report = malloc(PIPELINE_PROFILE_REPORT_SIZE);
+
+    if (report == NULL) return;
+
+    snprintf(report, PIPELINE_PROFILE_REPORT_SIZE,
+             "{\"output_rate\":%u,\"output_format\":\"%s\",\"packet_ns\":%" PRIu64 ","
+             "\"decode\":{\"decoder\":\"%s\",\"ns\":%" PRIu64 "},"
+             "\"dsp\":{\"loudness\":%s,\"convolution\":%s,\"ns\":%" PRIu64 "},"
+             "\"interpolation\":{\"method\":\"%s\",\"ns\":%" PRIu64 "},"
+             "\"total_ns\":%" PRIu64 ",\"budget_used\":%.4f,\"budget\":%.4f,\"degraded_to\":%s%s%s}",
+             config.output_rate, sps_format_description_string(format), profile->packet_ns,
+             profile->decoder, profile->decode_ns, profile->dsp_loudness ? "true" : "false",
+             profile->dsp_convolution ? "true" : "false", profile->dsp_ns, profile->interpolation,
+             profile->interpolation_ns, profile->total_ns,
+             (1.0 * profile->total_ns) / profile->packet_ns, config.pipeline_cpu_budget,
+             profile->degraded_to ? "\"" : "", profile->degraded_to ? profile->degraded_to : "null",
+             profile->degraded_to ? "\"" : "");
+
+    __atomic_store_n(&pipeline_profile_report, report, __ATOMIC_RELEASE);
+}
+
+void pipeline_profile_run(void)
+{
+    pipeline_profile profile;
+    pipeline_profile_state * state = calloc(1, sizeof(pipeline_profile_state));
+
+    memset(&profile, 0, sizeof(profile));
+
+    if (state == NULL) die("Can't allocate memory to profile the audio path.");
+
+    unsigned int output_rate = config.output_rate ? config.output_rate : 44100;
+    int ratio = output_rate / 44100;
+
+    if (ratio < 1) ratio = 1;
+
+    // the backend may not choose its format until it's opened; if so, assume the most work
+    sps_format_t format = config.output_format;
+
+    if ((format == SPS_FORMAT_UNKNOWN) || (format >= SPS_FORMAT_AUTO)) format = SPS_FORMAT_S32_LE;
+
+    state->frames = ALAC_ENCODER_FRAMES_PER_PACKET * ratio;
+    state->input = malloc((state->frames + PIPELINE_PROFILE_STUFF_ROOM) * 2 * sizeof(int32_t));
+    state->scratch = malloc((state->frames + PIPELINE_PROFILE_STUFF_ROOM) * 2 * sizeof(int32_t));
+    state->output = malloc((state->frames + PIPELINE_PROFILE_STUFF_ROOM) * 2 * sizeof(int32_t));
+    state->conn = calloc(1, sizeof(rtsp_conn_info));
+
+    if ((state->input == NULL) || (state->scratch == NULL) || (state->output == NULL) ||
+        (state->conn == NULL))
+        die("Can't allocate memory to profile the audio path.");
+
+    pipeline_profile_make_signal(state);
+    profile.packet_ns = (uint64_t)ALAC_ENCODER_FRAMES_PER_PACKET * 1000000000 / 44100;
+
+    // decoding
+#ifdef CONFIG_APPLE_ALAC
+
+    if (config.use_apple_decoder)
+    {
+        profile.decoder = "apple";
+        pipeline_profile_apple_alac = apple_alac_create(alac_encoder_fmtp);
+
+        if (pipeline_profile_apple_alac == NULL) die("Can't create an Apple ALAC decoder to profile.");
+
+        profile.decode_ns = pipeline_profile_time(pipeline_profile_decode, state);
+        apple_alac_destroy(pipeline_profile_apple_alac);
+        pipeline_profile_apple_alac = NULL;
+    }
+    else
+#endif
+    {
+        profile.decoder = "hammerton";
+        pipeline_profile_alac = alac_encoder_create_decoder();
+
+        if (pipeline_profile_alac == NULL) die("Can't create an ALAC decoder to profile.");
+
+        profile.decode_ns = pipeline_profile_time(pipeline_profile_decode, state);
+        alac_free(pipeline_profile_alac);
+    }
+
+    // the DSP chain, with loudness at a typical attenuation, so there's a boost to apply
+    profile.dsp_loudness = config.loudness;
+#ifdef CONFIG_CONVOLUTION
+    profile.dsp_convolution = (config.convolution) && (config.convolver_valid);
+#endif
+    dsp_chain_init(&pipeline_profile_dsp, state->frames + PIPELINE_PROFILE_STUFF_ROOM, output_rate);
+    loudness_processor loudness;
+    memset(&loudness, 0, sizeof(loudness));
+    loudness_set_coefficients(&loudness, config.loudness_reference_volume_db - 20, output_rate);
+    dsp_chain_set_volume(&pipeline_profile_dsp, 0x8000, &loudness);
+    profile.dsp_ns = pipeline_profile_time(pipeline_profile_dsp_chain, state);
+    dsp_chain_free(&pipeline_profile_dsp);
+
+    // interpolation and conversion to the output format, with dither, as in the first zone
+    state->conn->zone = &zones[0];
+    state->conn->output_writer = process_block_writer_for_format(format);
+    state->conn->dsp.volume = 0x8000;
+    state->conn->max_frame_size_change = PIPELINE_PROFILE_STUFF_ROOM;
+    polyphase_init(&state->conn->polyphase);
+
+    uint64_t basic_ns = pipeline_profile_time(pipeline_profile_basic, state);
+    uint64_t polyphase_ns = pipeline_profile_time(pipeline_profile_polyphase, state);
+
+    switch (config.packet_stuffing)
+    {
+    case ST_basic:
+        profile.interpolation = "basic";
+        profile.interpolation_ns = basic_ns;
+        break;
+
+    case ST_polyphase:
+        profile.interpolation = "polyphase";
+        profile.interpolation_ns = polyphase_ns;
+        break;
+
+    default: // soxr or auto
+        profile.interpolation = "polyphase";
+        profile.interpolation_ns = polyphase_ns;
+    }
+
+#ifdef CONFIG_SOXR
+    uint64_t soxr_ns = pipeline_profile_time(pipeline_profile_soxr, state);
+
+    if (state->conn->soxr) soxr_delete(state->conn->soxr);
+
+    // the delay index is the time, in milliseconds, soxr takes over two packets at 44,100
+    config.soxr_delay_index = (int)(0.9 + (2 * soxr_ns / ratio) / 1000000.0);
+    debug(2, "soxr_delay_index: %d.", config.soxr_delay_index);
+
+    if ((config.packet_stuffing == ST_soxr) ||
+        ((config.packet_stuffing == ST_auto) &&
+         (config.soxr_delay_index <= config.soxr_delay_threshold)))
+    {
+        profile.interpolation = "soxr";
+        profile.interpolation_ns = soxr_ns;
+    }
+
+    if ((config.packet_stuffing == ST_soxr) && (config.soxr_delay_index > config.soxr_delay_threshold))
+        inform("Note: this device may be too slow for \"soxr\" interpolation. Consider choosing the "
+               "\"basic\", \"polyphase\" or \"auto\" interpolation setting.");
+
+    if (config.packet_stuffing == ST_auto) debug(1, "\"%s\" interpolation has been chosen.", profile.interpolation);
+#endif
+
+    profile.total_ns = profile.decode_ns + profile.dsp_ns + profile.interpolation_ns;
+
+    // if it's over budget, the interpolation is the only thing that can be made cheaper without
+    // changing what's heard -- loudness and convolution are left as configured
+    double budget_ns = config.pipeline_cpu_budget * profile.packet_ns;
+
+    if ((config.pipeline_cpu_budget > 0.0) && (profile.total_ns > budget_ns) && (config.pipeline_degrade))
+    {
+        uint64_t fixed_ns = profile.decode_ns + profile.dsp_ns;
+
+        if ((strcmp(profile.interpolation, "soxr") == 0) && (fixed_ns + polyphase_ns <= budget_ns))
+        {
+            profile.degraded_to = "polyphase";
+            profile.interpolation_ns = polyphase_ns;
+        }
+        else if (strcmp(profile.interpolation, "basic") != 0)
+        {
+            profile.degraded_to = "basic";
+            profile.interpolation_ns = basic_ns;
+        }
+
+        if (profile.degraded_to)
+        {
+            config.packet_stuffing =
+                strcmp(profile.degraded_to, "basic") == 0 ? ST_basic : ST_polyphase;
+            profile.total_ns = fixed_ns + profile.interpolation_ns;
+        }
+    }
+
+    pipeline_profile_format(&profile, format);
+
+    inform("The audio path takes %.1f%% of each packet's %.2f ms to play: decode (%s) %.1f%%, DSP "
+           "%.1f%%, interpolation (%s) and output as %s %.1f%%.",
+           (100.0 * profile.total_ns) / profile.packet_ns, profile.packet_ns * 1.0E-6,
+           profile.decoder, (100.0 * profile.decode_ns) / profile.packet_ns,
+           (100.0 * profile.dsp_ns) / profile.packet_ns,
+           profile.degraded_to ? profile.degraded_to : profile.interpolation,
+           sps_format_description_string(format),
+           (100.0 * profile.interpolation_ns) / profile.packet_ns);
+
+    if (profile.degraded_to)
+        warn("The audio path was over its CPU budget of %.0f%% of each packet's time with \"%s\" "
+             "interpolation, so \"%s\" interpolation will be used instead.",
+             config.pipeline_cpu_budget * 100, profile.interpolation, profile.degraded_to);
+    else if ((config.pipeline_cpu_budget > 0.0) && (profile.total_ns > budget_ns))
+        warn("The audio path is over its CPU budget of %.0f%% of each packet's time. This device may "
+             "be too slow for this configuration -- expect underruns. Consider cheaper interpolation, "
+             "a shorter convolution impulse response or turning loudness off.",
+             config.pipeline_cpu_budget * 100);
+
+    free(state->conn);
+    free(state->output);
+    free(state->scratch);
+    free(state->input);
+    free(state);
+}
+
+char * pipeline_profile_as_string(void)
+{
+    char * report = __atomic_load_n(&pipeline_profile_report, __ATOMIC_ACQUIRE);
+
+    return report ? strdup(report) : NULL;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// The startup profile of the configured audio path. Each stage a packet goes through -- the
+// ALAC decoder in use, the DSP chain with the configured loudness and convolution settings and
+// impulse response, and the interpolation and conversion to the output format -- is run on a
+// synthetic signal for a fraction of a second, and its CPU time per packet is compared with the
+// time the packet takes to play. It also sets config.soxr_delay_index, which decides whether
+// "auto" interpolation uses soxr.
+
+// run it on the calling thread -- it must finish before any session starts, as it decides how
+// they interpolate. It warns, or degrades the interpolation, if the total goes over
+// config.pipeline_cpu_budget.
+void pipeline_profile_run(void);
+
+// the result as a JSON object, in a buffer allocated with malloc -- free it afterwards.
+// Returns NULL if the profile hasn't been run.
+char * pipeline_profile_as_string(void);
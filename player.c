@@ -46,27 +46,17 @@
 #include "config.h"
 
 #ifdef CONFIG_MBEDTLS
-#include <mbedtls/aes.h>
 #include <mbedtls/havege.h>
 #endif
 
 #ifdef CONFIG_POLARSSL
-#include <polarssl/aes.h>
 #include <polarssl/havege.h>
 #endif
 
-#ifdef CONFIG_OPENSSL
-#include <openssl/aes.h>
-#endif
-
 #ifdef CONFIG_SOXR
 #include <soxr.h>
 #endif
 
-#ifdef CONFIG_CONVOLUTION
-#include <FFTConvolver/convolver.h>
-#endif
-
 #ifdef CONFIG_METADATA_HUB
 #include "metadata_hub.h"
 #endif
@@ -78,6 +68,7 @@
 #include "common.h"
 #include "mdns.h"
 #include "player.h"
+#include "zone.h"
 #include "rtp.h"
 #include "rtsp.h"
 
@@ -87,9 +78,18 @@
 #include "apple_alac.h"
 #endif
 
+#include "dsp.h"
 #include "loudness.h"
+#include "process_block.h"
 
 #include "activity_monitor.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "trace.h"
+
+#ifdef CONFIG_DBUS_INTERFACE
+#include "dbus-service.h"
+#endif
 
 // make the first audio packet deliberately early to bias the sync error of
 // the very first packet, making the error more likely to be too early
@@ -99,16 +99,21 @@
 
 int64_t first_frame_early_bias = 8;
 
-// default buffer size
-// needs to be a power of 2 because of the way BUFIDX(seqno) works
-//#define BUFFER_FRAMES 512
 #define MAX_PACKET                      2048
 
 // DAC buffer occupancy stuff
 #define DAC_BUFFER_QUEUE_MINIMUM_LENGTH 2500
 
-// static abuf_t audio_buffer[BUFFER_FRAMES];
-#define BUFIDX(seqno) ((seq_t)(seqno) % BUFFER_FRAMES)
+// the longest the player sleeps without looking at the state of the output and for flush requests
+#define PLAYER_MAXIMUM_WAIT_TIME ((uint64_t)100000000) // nanoseconds
+
+// the polyphase resampler only follows the pi controller's rate once play has been going this long
+// -- until then the controller is still pulling in the starting error, not tracking the drift
+#define POLYPHASE_PI_RATE_SETTLING_TIME ((uint64_t)5000000000) // nanoseconds
+
+// the session's buffer size is a power of two, no bigger than 2^16, so this follows the
+// sequence numbers round
+#define BUFIDX(conn, seqno) ((seq_t)(seqno) & ((conn)->buffer_frames - 1))
 
 uint32_t modulo_32_offset(uint32_t from, uint32_t to)
 {
@@ -128,7 +133,9 @@ static void ab_resync(rtsp_conn_info * conn)
 {
     int i;
 
-    for (i = 0; i < BUFFER_FRAMES; i++)
+    memset(conn->ready_bits, 0, conn->buffer_frames / 8);
+
+    for (i = 0; i < (int)conn->buffer_frames; i++)
     {
         conn->audio_buffer[i].ready = 0;
         conn->audio_buffer[i].resend_request_number = 0;
@@ -138,11 +145,14 @@ static void ab_resync(rtsp_conn_info * conn)
             0; // this is either the time the packet was received or the time it was noticed the packet
                // was missing.
         conn->audio_buffer[i].sequence_number = 0;
+        conn->audio_buffer[i].packet_length = 0;
     }
 
     conn->ab_synced = 0;
     conn->last_seqno_read = -1;
     conn->ab_buffering = 1;
+    // the sync error's history is no guide to what comes after a flush or a resync
+    drift_controller_reset(&conn->drift);
 }
 
 // given starting and ending points as unsigned 16-bit integers running modulo 2^16, returns the
@@ -257,7 +267,7 @@ void unencrypted_packet_decode(unsigned char * packet, int length, short * dest,
     {
 #ifdef CONFIG_APPLE_ALAC
 
-        if (config.use_apple_decoder)
+        if ((config.use_apple_decoder) && (conn->apple_decoder_info))
         {
             if (conn->decoder_in_use != 1 << decoder_apple_alac)
             {
@@ -265,7 +275,8 @@ void unencrypted_packet_decode(unsigned char * packet, int length, short * dest,
                 conn->decoder_in_use = 1 << decoder_apple_alac;
             }
 
-            apple_alac_decode_frame(packet, length, (unsigned char *)dest, outsize);
+            apple_alac_decode(conn->apple_decoder_info, packet, length, (unsigned char *)dest,
+                              outsize);
             *outsize = *outsize * 4; // bring the size to bytes
         }
         else
@@ -277,7 +288,7 @@ void unencrypted_packet_decode(unsigned char * packet, int length, short * dest,
                 conn->decoder_in_use = 1 << decoder_hammerton;
             }
 
-            alac_decode_frame(conn->decoder_info, packet, (unsigned char *)dest, outsize);
+            alac_decode_frame(conn->decoder_info, packet, length, (unsigned char *)dest, outsize);
         }
     }
     else if (conn->stream.type == ast_uncompressed)
@@ -312,6 +323,9 @@ int audio_packet_decode(short * dest, int * destlen, uint8_t * buf, int len, rts
     // the incoming packet, the length of the incoming packet in bytes
     // destlen should contain the allowed max number of samples on entry
 
+    // the packet is decrypted where it lies, in its slot in the ring, and decoded from there
+    // straight into dest, the decoded part of the same slot -- so buf is overwritten
+
     if (len > MAX_PACKET)
     {
         warn("Incoming audio packet size is too large at %d; it should not exceed %d.", len,
@@ -319,37 +333,19 @@ int audio_packet_decode(short * dest, int * destlen, uint8_t * buf, int len, rts
         return -1;
     }
 
-    unsigned char packet[MAX_PACKET];
-
-    // unsigned char packetp[MAX_PACKET];
-    assert(len <= MAX_PACKET);
     int reply = 0;                                        // everything okay
     int outsize = conn->input_bytes_per_frame * (*destlen); // the size the output should be, in bytes
     int maximum_possible_outsize = outsize;
 
     if (conn->stream.encrypted)
     {
-        unsigned char iv[16];
-        int aeslen = len & ~0xf;
-        memcpy(iv, conn->stream.aesiv, sizeof(iv));
-#ifdef CONFIG_MBEDTLS
-        mbedtls_aes_crypt_cbc(&conn->dctx, MBEDTLS_AES_DECRYPT, aeslen, iv, buf, packet);
-#endif
-#ifdef CONFIG_POLARSSL
-        aes_crypt_cbc(&conn->dctx, AES_DECRYPT, aeslen, iv, buf, packet);
-#endif
-#ifdef CONFIG_OPENSSL
-        AES_cbc_encrypt(buf, packet, aeslen, &conn->aes, iv, AES_DECRYPT);
-#endif
-        memcpy(packet + aeslen, buf + aeslen, len - aeslen);
-        unencrypted_packet_decode(packet, len, dest, &outsize, maximum_possible_outsize, conn);
-    }
-    else
-    {
-        // not encrypted
-        unencrypted_packet_decode(buf, len, dest, &outsize, maximum_possible_outsize, conn);
+        // the tail of the packet that doesn't make up a whole AES block isn't encrypted,
+        // so it's already where it should be
+        aes_cbc_decrypt(&conn->decryptor, buf, len & ~0xf);
     }
 
+    unencrypted_packet_decode(buf, len, dest, &outsize, maximum_possible_outsize, conn);
+
     if (outsize > maximum_possible_outsize)
     {
         debug(2,
@@ -472,7 +468,16 @@ static int init_alac_decoder(int32_t fmtp[12], rtsp_conn_info * conn)
     alac_allocate_buffers(alac); // no pthread cancellation point in here
 
 #ifdef CONFIG_APPLE_ALAC
-    apple_alac_init(fmtp); // no pthread cancellation point in here
+    conn->apple_decoder_info = NULL;
+
+    if (config.use_apple_decoder)
+    {
+        conn->apple_decoder_info = apple_alac_create(fmtp); // no pthread cancellation point in here
+
+        if (conn->apple_decoder_info == NULL)
+            warn("Can't create an Apple ALAC decoder -- the Hammerton decoder will be used instead.");
+    }
+
 #endif
 
     return 0;
@@ -482,40 +487,177 @@ static void terminate_decoders(rtsp_conn_info * conn)
 {
     alac_free(conn->decoder_info);
 #ifdef CONFIG_APPLE_ALAC
-    apple_alac_terminate();
+
+    if (conn->apple_decoder_info)
+    {
+        apple_alac_destroy(conn->apple_decoder_info);
+        conn->apple_decoder_info = NULL;
+    }
+
 #endif
 }
 
-static void init_buffer(rtsp_conn_info * conn)
+// the decoded data for an entry in the audio buffer
+static inline signed short * abuf_data(rtsp_conn_info * conn, abuf_t * abuf)
 {
-    int i;
+    return (signed short *)(conn->audio_slab + (abuf - conn->audio_buffer) * conn->audio_slab_stride);
+}
+
+// the packet, as received, for an entry in the audio buffer
+static inline uint8_t * abuf_packet(rtsp_conn_info * conn, abuf_t * abuf)
+{
+    return (uint8_t *)abuf_data(conn, abuf) + conn->audio_slab_packet_offset;
+}
+
+// alongside the audio buffer is a bitmap with a bit for each entry, set when the entry is ready,
+// so that the resend scan can step over runs of packets that have arrived a word at a time.
+// Always mark an entry ready or not through this.
+static inline void abuf_set_ready(rtsp_conn_info * conn, abuf_t * abuf, int ready)
+{
+    unsigned int index = abuf - conn->audio_buffer;
+    uint64_t bit = (uint64_t)1 << (index & 63);
+
+    abuf->ready = ready;
 
-    for (i = 0; i < BUFFER_FRAMES; i++)
+    if (ready) conn->ready_bits[index >> 6] |= bit;
+    else conn->ready_bits[index >> 6] &= ~bit;
+}
+
+// the sequence number of the first entry from "from" up to but not including "to" that isn't
+// ready, or "to" if they are all ready. The buffer size is a multiple of 64, so a word of the
+// bitmap never spans the wrap of the buffer
+static seq_t ready_bits_next_missing(rtsp_conn_info * conn, seq_t from, seq_t to)
+{
+    unsigned int remaining = (seq_t)(to - from);
+    seq_t x = from;
+
+    while (remaining)
     {
-        conn->audio_buffer[i].data = malloc(conn->input_bytes_per_frame * conn->max_frames_per_packet);
+        unsigned int index = BUFIDX(conn, x);
+        unsigned int bit = index & 63;
+        unsigned int span = 64 - bit;
+        uint64_t missing = ~conn->ready_bits[index >> 6] >> bit;
+
+        if (missing)
+        {
+            unsigned int step = __builtin_ctzll(missing);
+
+            if (step < remaining) return x + step;
+            else return to;
+        }
+
+        if (span >= remaining) return to;
+
+        x += span;
+        remaining -= span;
     }
 
-    ab_resync(conn);
+    return to;
 }
 
-static void free_audio_buffers(rtsp_conn_info * conn)
+static void init_buffer(rtsp_conn_info * conn)
 {
-    int i;
+    conn->buffer_frames = config.packet_buffer_size;
+    conn->audio_buffer = calloc(conn->buffer_frames, sizeof(abuf_t));
+
+    if (conn->audio_buffer == NULL) die("Failed to allocate memory for the audio buffer bookkeeping.");
+
+    conn->ready_bits = calloc(conn->buffer_frames / 64, sizeof(uint64_t));
+
+    if (conn->ready_bits == NULL) die("Failed to allocate memory for the audio buffer bitmap.");
+
+    // one slab for the data of all the buffers, with each slot starting on a cache line.
+    // A slot holds the decoded data, followed by the packet as it arrived
+    size_t decoded_size = conn->input_bytes_per_frame * conn->max_frames_per_packet;
+    conn->audio_slab_packet_offset = (decoded_size + 63) & ~(size_t)63;
+    conn->audio_slab_stride = conn->audio_slab_packet_offset + ((MAX_PACKET + 63) & ~(size_t)63);
+
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (page_size <= 0) page_size = 4096;
+
+    void * slab = NULL;
 
-    for (i = 0; i < BUFFER_FRAMES; i++)
+    if (posix_memalign(&slab, page_size, conn->audio_slab_stride * conn->buffer_frames) != 0)
+        die("Failed to allocate memory for the audio buffers.");
+
+    conn->audio_slab = slab;
+
+    ab_resync(conn);
+}
+
+// decrypt and decode a packet taken from the buffer, if it hasn't been done already.
+// This is called by the player thread without the buffer lock -- the slot can't be reused
+// until the reader has moved on. If the packet is bad, it's played as a silent frame.
+static void abuf_decode(rtsp_conn_info * conn, abuf_t * abuf)
+{
+    if (abuf->packet_length)
     {
-        free(conn->audio_buffer[i].data);
+        uint64_t decode_start_time = latency_histogram_time_now();
+        int datalen = conn->max_frames_per_packet;
+
+        if (audio_packet_decode(abuf_data(conn, abuf), &datalen, abuf_packet(conn, abuf),
+                                abuf->packet_length, conn) == 0)
+        {
+            abuf->length = datalen;
+        }
+        else
+        {
+            debug(1, "Bad audio packet detected and discarded.");
+            abuf->status = 1 << 1; // bad packet, discarded
+            abuf->given_timestamp = 0; // a silent frame will be substituted
+        }
+
+        abuf->packet_length = 0;
+        latency_histogram_record_since(LH_decode, decode_start_time);
     }
 }
 
-int first_possibly_missing_frame = -1;
+static void free_audio_buffers(rtsp_conn_info * conn)
+{
+    free(conn->audio_slab);
+    conn->audio_slab = NULL;
+    free(conn->audio_buffer);
+    conn->audio_buffer = NULL;
+    free(conn->ready_bits);
+    conn->ready_bits = NULL;
+}
+
+// a slow resend or two mustn't push the resend deadline -- or the adaptive latency's headroom --
+// out for the rest of the session, so the smoothed response time halves for every
+// RESEND_RESPONSE_TIME_HALF_LIFE without a resend, and is never taken to be more than a quarter
+// of the latency
+#define RESEND_RESPONSE_TIME_HALF_LIFE ((uint64_t)10000000000) // nanoseconds
+#define RESEND_RESPONSE_TIME_LATENCY_FRACTION 4
 
-void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, int len,
-                       rtsp_conn_info * conn)
+uint64_t player_resend_response_time(rtsp_conn_info * conn, uint64_t time_now)
 {
-    debug_mutex_lock(&conn->ab_mutex, 30000, 0);
-    uint64_t time_now = get_absolute_time_in_ns();
+    uint64_t response_time = conn->resend_response_time;
+
+    if ((conn->resend_response_time_measured != 0) && (time_now > conn->resend_response_time_measured))
+    {
+        uint64_t halvings =
+            (time_now - conn->resend_response_time_measured) / RESEND_RESPONSE_TIME_HALF_LIFE;
 
+        if (halvings >= 64) response_time = 0;
+        else response_time = response_time >> halvings;
+    }
+
+    if (conn->input_rate != 0)
+    {
+        uint64_t limit = ((uint64_t)conn->latency * (uint64_t)1000000000) / conn->input_rate;
+        limit = limit / RESEND_RESPONSE_TIME_LATENCY_FRACTION;
+
+        if (response_time > limit) response_time = limit;
+    }
+
+    return response_time;
+}
+
+// store a packet in the buffer -- call this with ab_mutex held
+static void player_store_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, int len,
+                                rtsp_conn_info * conn, uint64_t time_now)
+{
     conn->packet_count++;
     conn->packet_count_since_flush++;
     conn->time_of_last_audio_packet = time_now;
@@ -551,7 +693,7 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, i
 
             conn->frames_inward_measurement_time = time_now;
             conn->frames_inward_frames_received_at_measurement_time = actual_timestamp;
-            abuf = conn->audio_buffer + BUFIDX(seqno);
+            abuf = conn->audio_buffer + BUFIDX(conn, seqno);
             conn->ab_write = SUCCESSOR(seqno); // move the write pointer to the next free space
         }
         else if (write_point_gap > 0)    // newer than expected
@@ -561,8 +703,8 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, i
 
             for (i = 0; i < write_point_gap; i++)
             {
-                abuf = conn->audio_buffer + BUFIDX(seq_sum(conn->ab_write, i));
-                abuf->ready = 0; // to be sure, to be sure
+                abuf = conn->audio_buffer + BUFIDX(conn, seq_sum(conn->ab_write, i));
+                abuf_set_ready(conn, abuf, 0); // to be sure, to be sure
                 abuf->resend_request_number = 0;
                 abuf->initialisation_time =
                     time_now;  // this represents when the packet was noticed to be missing
@@ -570,15 +712,16 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, i
                 abuf->resend_time = 0;
                 abuf->given_timestamp = 0;
                 abuf->sequence_number = 0;
+                abuf->packet_length = 0;
             }
 
-            abuf = conn->audio_buffer + BUFIDX(seqno);
+            abuf = conn->audio_buffer + BUFIDX(conn, seqno);
             conn->ab_write = SUCCESSOR(seqno);
         }
         else if (seq_diff(seqno, conn->ab_read) > 0) // older than expected but still not too late
         {
             conn->late_packets++;
-            abuf = conn->audio_buffer + BUFIDX(seqno);
+            abuf = conn->audio_buffer + BUFIDX(conn, seqno);
         }
         else // too late.
         {
@@ -587,32 +730,79 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, i
 
         if (abuf)
         {
-            int datalen = conn->max_frames_per_packet;
+            // if the packet was asked for again, note how long it took to come, smoothed, so that
+            // the resend scan knows when it's too late to ask
+            if ((abuf->resend_time != 0) && (abuf->ready == 0) && (time_now > abuf->resend_time))
+            {
+                uint64_t response_time = time_now - abuf->resend_time;
+                uint64_t smoothed_response_time = player_resend_response_time(conn, time_now);
+
+                if (smoothed_response_time == 0) conn->resend_response_time = response_time;
+                else
+                    conn->resend_response_time = (smoothed_response_time * 7 + response_time) / 8;
+
+                conn->resend_response_time_measured = time_now;
+                conn->resend_response_time = player_resend_response_time(conn, time_now);
+            }
+
             abuf->initialisation_time = time_now;
             abuf->resend_time = 0;
 
-            if (audio_packet_decode(abuf->data, &datalen, data, len, conn) == 0)
+            // the packet is just stored here -- it's decrypted and decoded by the player thread
+            // when it takes it out of the buffer, so that a slow decode doesn't hold up the
+            // receiver or the buffer lock, and a packet that is flushed never gets decoded at all
+            if ((len > 0) && (len <= MAX_PACKET))
             {
-                abuf->ready = 1;
+                memcpy(abuf_packet(conn, abuf), data, len);
+                abuf->packet_length = len;
+                abuf_set_ready(conn, abuf, 1);
                 abuf->status = 0; // signifying that it was received
-                abuf->length = datalen;
+                abuf->length = conn->max_frames_per_packet; // until it's decoded
                 abuf->given_timestamp = actual_timestamp;
                 abuf->sequence_number = seqno;
             }
             else
             {
-                debug(1, "Bad audio packet detected and discarded.");
-                abuf->ready = 0;
+                debug(1, "Audio packet of %d bytes discarded -- it should not exceed %d.", len, MAX_PACKET);
+                abuf->packet_length = 0;
+                abuf_set_ready(conn, abuf, 0);
                 abuf->status = 1 << 1; // bad packet, discarded
                 abuf->resend_request_number = 0;
                 abuf->given_timestamp = 0;
                 abuf->sequence_number = 0;
             }
         }
+    }
+}
 
-        int rc = pthread_cond_signal(&conn->flowcontrol);
+// the resend scheduler asks for at most this many ranges of missing packets in one scan. The scan
+// goes from the oldest packet to the newest, so the ranges are in order of their play deadlines,
+// and any missing packets beyond the last range are asked for at the next scan
+#define RESEND_MAXIMUM_RANGES 8
+// a gap of no more than this many packets that are still missing, but were asked for too
+// recently to be asked for again, is bridged to make one request rather than two
+#define RESEND_MAXIMUM_BRIDGE 4
+
+typedef struct resend_range
+{
+    seq_t first;
+    uint32_t count;
+} resend_range;
 
-        if (rc) debug(1, "Error signalling flowcontrol.");
+// wake the player and ask for any packets that are missing -- call this with ab_mutex held,
+// once for each batch of packets stored. It releases the lock while it sends resend requests
+static void player_check_for_missing_packets(rtsp_conn_info * conn, uint64_t time_now)
+{
+    if (conn->connection_state_to_output)
+    {
+        // only wake the player if it's waiting for a packet -- if it's waiting for the time to play
+        // one, it has a deadline of its own
+        if (conn->player_waiting_for_packet)
+        {
+            int rc = pthread_cond_signal(&conn->flowcontrol);
+
+            if (rc) debug(1, "Error signalling flowcontrol.");
+        }
 
         // resend checks
         {
@@ -620,41 +810,32 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, i
                 (uint64_t)(config.resend_control_first_check_time * (uint64_t)1000000000);
             uint64_t resend_repeat_interval =
                 (uint64_t)(config.resend_control_check_interval_time * (uint64_t)1000000000);
-            uint64_t minimum_remaining_time = (uint64_t)(
-                (config.resend_control_last_check_time + config.audio_backend_buffer_desired_length) *
-                (uint64_t)1000000000);
+            // a resent packet is no use unless it can arrive before it's due to be played, so allow
+            // for the time a resent packet has been taking to arrive as well
+            uint64_t minimum_remaining_time =
+                (uint64_t)((config.resend_control_last_check_time +
+                            conn->zone->audio_backend_buffer_desired_length) *
+                           (uint64_t)1000000000) +
+                player_resend_response_time(conn, time_now);
             uint64_t latency_time = (uint64_t)(conn->latency * (uint64_t)1000000000);
             latency_time = latency_time / (uint64_t)conn->input_rate;
 
-            int x; // this is the first frame to be checked
-
-            // if we detected a first empty frame before and if it's still in the buffer!
-            if ((first_possibly_missing_frame >= 0) &&
-                (position_in_modulo_uint16_t_buffer(first_possibly_missing_frame, conn->ab_read,
-                                                    conn->ab_write, NULL)))
-            {
-                x = first_possibly_missing_frame;
-            }
-            else
-            {
-                x = conn->ab_read;
-            }
-
-            first_possibly_missing_frame = -1; // has not been set
+            // the first frame to be checked -- the bitmap takes the scan straight to it
+            seq_t x = ready_bits_next_missing(conn, conn->ab_read, conn->ab_write);
 
-            int missing_frame_run_count = 0;
-            int start_of_missing_frame_run = -1;
-            int number_of_missing_frames = 0;
+            resend_range ranges[RESEND_MAXIMUM_RANGES];
+            int number_of_ranges = 0;
+            // the missing frames since the end of the last range that were asked for too recently,
+            // or -1 if anything else has been seen since then, so the range can't be extended
+            int bridge = -1;
 
             while (x != conn->ab_write)
             {
-                abuf_t * check_buf = conn->audio_buffer + BUFIDX(x);
+                abuf_t * check_buf = conn->audio_buffer + BUFIDX(conn, x);
 
                 if (!check_buf->ready)
                 {
-                    if (first_possibly_missing_frame < 0) first_possibly_missing_frame = x;
-
-                    number_of_missing_frames++;
+                    trace(TR_frame_missing, x, conn->ab_read, conn->ab_write, 0);
                     // debug(1, "frame %u's initialisation_time is 0x%" PRIx64 ", latency_time is 0x%"
                     // PRIx64 ", time_now is 0x%" PRIx64 ", minimum_remaining_time is 0x%" PRIx64 ".", x,
                     // check_buf->initialisation_time, latency_time, time_now, minimum_remaining_time);
@@ -678,21 +859,53 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, i
 
                     if ((!too_soon_after_last_request) && (!too_late) && (!too_early))
                     {
-                        if (start_of_missing_frame_run == -1)
+                        if ((bridge >= 0) && (bridge <= RESEND_MAXIMUM_BRIDGE))
                         {
-                            start_of_missing_frame_run = x;
-                            missing_frame_run_count = 1;
+                            // extend the last range over the bridge, asking again for the frames
+                            // in it, rather than start a new one
+                            resend_range * range = &ranges[number_of_ranges - 1];
+                            int i;
+
+                            for (i = 0; i < bridge; i++)
+                            {
+                                abuf_t * bridge_buf =
+                                    conn->audio_buffer + BUFIDX(conn, seq_sum(range->first, range->count + i));
+                                bridge_buf->resend_time = time_now;
+                                bridge_buf->resend_request_number++;
+                            }
+
+                            range->count += bridge + 1;
+                            bridge = 0;
+                        }
+                        else if (number_of_ranges < RESEND_MAXIMUM_RANGES)
+                        {
+                            ranges[number_of_ranges].first = x;
+                            ranges[number_of_ranges].count = 1;
+                            number_of_ranges++;
+                            bridge = 0;
                         }
                         else
                         {
-                            missing_frame_run_count++;
+                            // no room for another range this time -- leave it for the next scan
+                            bridge = -1;
                         }
 
-                        check_buf->resend_time = time_now; // setting the time to now because we are
-                                                           // definitely going to take action
-                        check_buf->resend_request_number++;
-                        debug(3, "Frame %d is missing with ab_read of %u and ab_write of %u.", x, conn->ab_read,
-                              conn->ab_write);
+                        if (bridge == 0)
+                        {
+                            check_buf->resend_time = time_now; // setting the time to now because we are
+                                                               // definitely going to take action
+                            check_buf->resend_request_number++;
+                            debug(3, "Frame %d is missing with ab_read of %u and ab_write of %u.", x,
+                                  conn->ab_read, conn->ab_write);
+                        }
+                    }
+                    else if ((too_soon_after_last_request) && (!too_late) && (bridge >= 0))
+                    {
+                        bridge++;
+                    }
+                    else
+                    {
+                        bridge = -1;
                     }
 
                     // if (too_late) {
@@ -700,37 +913,66 @@ void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, i
                     // }
                 }
 
-                // if (number_of_missing_frames != 0)
-                //  debug(1,"check with x = %u, ab_read = %u, ab_write = %u, first_possibly_missing_frame
-                //  = %d.", x, conn->ab_read, conn->ab_write, first_possibly_missing_frame);
-                x = (x + 1) & 0xffff;
+                // step over any frames that have arrived to the next missing one
+                seq_t next = SUCCESSOR(x);
+                x = ready_bits_next_missing(conn, next, conn->ab_write);
 
-                if (((check_buf->ready) || (x == conn->ab_write)) && (missing_frame_run_count > 0))
-                {
-                    // send a resend request
-                    if (missing_frame_run_count > 1) debug(3, "request resend of %d packets starting at seqno %u.", missing_frame_run_count,
-                                                           start_of_missing_frame_run);
+                if (x != next) bridge = -1;
+            }
 
-                    if (config.disable_resend_requests == 0)
-                    {
-                        debug_mutex_unlock(&conn->ab_mutex, 3);
-                        rtp_request_resend(start_of_missing_frame_run, missing_frame_run_count, conn);
-                        debug_mutex_lock(&conn->ab_mutex, 20000, 1);
-                        conn->resend_requests++;
-                    }
+            // send the resend requests, earliest deadline first, dropping the lock only once
+            if ((number_of_ranges > 0) && (config.disable_resend_requests == 0))
+            {
+                int i;
+                debug_mutex_unlock(&conn->ab_mutex, 3);
 
-                    start_of_missing_frame_run = -1;
-                    missing_frame_run_count = 0;
+                for (i = 0; i < number_of_ranges; i++)
+                {
+                    trace(TR_resend_request, ranges[i].first, ranges[i].count, 0, 0);
+                    rtp_request_resend(ranges[i].first, ranges[i].count, conn);
                 }
-            }
 
-            if (number_of_missing_frames == 0) first_possibly_missing_frame = conn->ab_write;
+                debug_mutex_lock(&conn->ab_mutex, 20000, 1);
+                conn->resend_requests += number_of_ranges;
+            }
         }
     }
+}
+
+void player_put_packets(const player_packet * packets, int count, rtsp_conn_info * conn)
+{
+    int i;
 
+    debug_mutex_lock(&conn->ab_mutex, 30000, 0);
+    uint64_t time_now = get_absolute_time_in_ns();
+
+    for (i = 0; i < count; i++)
+    {
+        if ((latency_histograms_enabled) && (packets[i].arrival_time) &&
+            (time_now >= packets[i].arrival_time))
+            latency_histogram_record(LH_receive_to_store, time_now - packets[i].arrival_time);
+
+        player_store_packet(packets[i].seqno, packets[i].timestamp, packets[i].data, packets[i].length,
+                            conn, time_now);
+    }
+
+    player_check_for_missing_packets(conn, time_now);
     debug_mutex_unlock(&conn->ab_mutex, 0);
 }
 
+void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, int len,
+                       rtsp_conn_info * conn)
+{
+    player_packet packet;
+
+    packet.seqno = seqno;
+    packet.timestamp = actual_timestamp;
+    packet.data = data;
+    packet.length = len;
+    packet.arrival_time = 0;
+    player_put_packets(&packet, 1, conn);
+}
+
 int32_t rand_in_range(int32_t exclusive_range_limit)
 {
     static uint32_t lcg_prev = 12345;
@@ -758,7 +1000,7 @@ int get_and_check_effective_latency(rtsp_conn_info * conn, uint32_t * effective_
 
         // keep about one second of buffers back
         if ((*effective_latency + latency_addition) <=
-            (conn->max_frames_per_packet * (BUFFER_FRAMES - config.minimum_free_buffer_headroom))) *effective_latency += latency_addition;
+            (conn->max_frames_per_packet * (conn->buffer_frames - config.minimum_free_buffer_headroom))) *effective_latency += latency_addition;
         else result = 1;
     }
     else
@@ -772,253 +1014,15 @@ int get_and_check_effective_latency(rtsp_conn_info * conn, uint32_t * effective_
     return result;
 }
 
-static inline void process_sample(int32_t sample, char * * outp, sps_format_t format, int volume,
-                                  int dither, rtsp_conn_info * conn)
+// play frames of silence from the session's pool. The session's dither decision can change from
+// packet to packet, and the pool is refilled when it does, so the silence matches the audio around it
+static int player_silence_play(rtsp_conn_info * conn, size_t frames)
 {
-    /*
-       {
-                  static int old_volume = 0;
-                  if (volume != old_volume) {
-                          debug(1,"Volume is now %d.",volume);
-                          old_volume = volume;
-                  }
-       }
-     */
-
-    int64_t hyper_sample = sample;
-    int result = 0;
-
-    if (config.loudness)
-    {
-        hyper_sample <<=
-            32; // Do not apply volume as it has already been done with the Loudness DSP filter
-    }
-    else
-    {
-        int64_t hyper_volume = (int64_t)volume << 16;
-        hyper_sample = hyper_sample * hyper_volume; // this is 64 bit bit multiplication -- we may need
-                                                    // to dither it down to its target resolution
-    }
-
-    // next, do dither, if necessary
-    if (dither)
-    {
-        // add a TPDF dither -- see
-        // http://educypedia.karadimov.info/library/DitherExplained.pdf
-        // and the discussion around https://www.hydrogenaud.io/forums/index.php?showtopic=16963&st=25
-
-        // I think, for a 32 --> 16 bits, the range of
-        // random numbers needs to be from -2^16 to 2^16, i.e. from -65536 to 65536 inclusive, not from
-        // -32768 to +32767
-
-        // Actually, what would be generated here is from -65535 to 65535, i.e. one less on the limits.
-
-        // See the original paper at
-        // http://www.ece.rochester.edu/courses/ECE472/resources/Papers/Lipshitz_1992.pdf
-        // by Lipshitz, Wannamaker and Vanderkooy, 1992.
-
-        int64_t dither_mask = 0;
-        switch (format)
-        {
-            case SPS_FORMAT_S32:
-            case SPS_FORMAT_S32_LE:
-            case SPS_FORMAT_S32_BE:
-                dither_mask = (int64_t)1 << (64 - 32);
-                break;
-
-            case SPS_FORMAT_S24:
-            case SPS_FORMAT_S24_LE:
-            case SPS_FORMAT_S24_BE:
-            case SPS_FORMAT_S24_3LE:
-            case SPS_FORMAT_S24_3BE:
-                dither_mask = (int64_t)1 << (64 - 24);
-                break;
-
-            case SPS_FORMAT_S16:
-            case SPS_FORMAT_S16_LE:
-            case SPS_FORMAT_S16_BE:
-                dither_mask = (int64_t)1 << (64 - 16);
-                break;
-
-            case SPS_FORMAT_S8:
-            case SPS_FORMAT_U8:
-                dither_mask = (int64_t)1 << (64 - 8);
-                break;
-
-            case SPS_FORMAT_UNKNOWN:
-                die("Unexpected SPS_FORMAT_UNKNOWN while calculating dither mask.");
-                break;
-
-            case SPS_FORMAT_AUTO:
-                die("Unexpected SPS_FORMAT_AUTO while calculating dither mask.");
-                break;
-
-            case SPS_FORMAT_INVALID:
-                die("Unexpected SPS_FORMAT_INVALID while calculating dither mask.");
-                break;
-        }
-        dither_mask -= 1;
-        int64_t r = r64i();
-
-        int64_t tpdf = (r & dither_mask) - (conn->previous_random_number & dither_mask);
-        conn->previous_random_number = r;
-
-        // add dither, allowing for clipping
-        if (tpdf >= 0)
-        {
-            if (INT64_MAX - tpdf >= hyper_sample) hyper_sample += tpdf;
-            else hyper_sample = INT64_MAX;
-        }
-        else
-        {
-            if (INT64_MIN - tpdf <= hyper_sample) hyper_sample += tpdf;
-            else hyper_sample = INT64_MIN;
-        }
-
-        // dither is complete here
-    }
-
-    // move the result to the desired position in the int64_t
-    char * op = *outp;
-    uint8_t byt;
-
-    switch (format)
-    {
-        case SPS_FORMAT_S32_LE:
-            hyper_sample >>= (64 - 32);
-            byt = (uint8_t)hyper_sample;
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 8);
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 16);
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 24);
-            *op++ = byt;
-            result = 4;
-            break;
-
-        case SPS_FORMAT_S32_BE:
-            hyper_sample >>= (64 - 32);
-            byt = (uint8_t)(hyper_sample >> 24);
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 16);
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 8);
-            *op++ = byt;
-            byt = (uint8_t)hyper_sample;
-            *op++ = byt;
-            result = 4;
-            break;
-
-        case SPS_FORMAT_S32:
-            hyper_sample >>= (64 - 32);
-            *(int32_t *)op = hyper_sample;
-            result = 4;
-            break;
-
-        case SPS_FORMAT_S24_3LE:
-            hyper_sample >>= (64 - 24);
-            byt = (uint8_t)hyper_sample;
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 8);
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 16);
-            *op++ = byt;
-            result = 3;
-            break;
-
-        case SPS_FORMAT_S24_3BE:
-            hyper_sample >>= (64 - 24);
-            byt = (uint8_t)(hyper_sample >> 16);
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 8);
-            *op++ = byt;
-            byt = (uint8_t)hyper_sample;
-            *op++ = byt;
-            result = 3;
-            break;
-
-        case SPS_FORMAT_S24_LE:
-            hyper_sample >>= (64 - 24);
-            byt = (uint8_t)hyper_sample;
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 8);
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 16);
-            *op++ = byt;
-            *op++ = 0;
-            result = 4;
-            break;
-
-        case SPS_FORMAT_S24_BE:
-            hyper_sample >>= (64 - 24);
-            *op++ = 0;
-            byt = (uint8_t)(hyper_sample >> 16);
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 8);
-            *op++ = byt;
-            byt = (uint8_t)hyper_sample;
-            *op++ = byt;
-            result = 4;
-            break;
-
-        case SPS_FORMAT_S24:
-            hyper_sample >>= (64 - 24);
-            *(int32_t *)op = hyper_sample;
-            result = 4;
-            break;
-
-        case SPS_FORMAT_S16_LE:
-            hyper_sample >>= (64 - 16);
-            byt = (uint8_t)hyper_sample;
-            *op++ = byt;
-            byt = (uint8_t)(hyper_sample >> 8);
-            *op++ = byt;
-            result = 2;
-            break;
-
-        case SPS_FORMAT_S16_BE:
-            hyper_sample >>= (64 - 16);
-            byt = (uint8_t)(hyper_sample >> 8);
-            *op++ = byt;
-            byt = (uint8_t)hyper_sample;
-            *op++ = byt;
-            result = 2;
-            break;
-
-        case SPS_FORMAT_S16:
-            hyper_sample >>= (64 - 16);
-            *(int16_t *)op = (int16_t)hyper_sample;
-            result = 2;
-            break;
-
-        case SPS_FORMAT_S8:
-            hyper_sample >>= (int8_t)(64 - 8);
-            *op = hyper_sample;
-            result = 1;
-            break;
-
-        case SPS_FORMAT_U8:
-            hyper_sample >>= (uint8_t)(64 - 8);
-            hyper_sample += 128;
-            *op = hyper_sample;
-            result = 1;
-            break;
-
-        case SPS_FORMAT_UNKNOWN:
-            die("Unexpected SPS_FORMAT_UNKNOWN while outputting samples");
-            break;
-
-        case SPS_FORMAT_AUTO:
-            die("Unexpected SPS_FORMAT_AUTO while outputting samples");
-            break;
-
-        case SPS_FORMAT_INVALID:
-            die("Unexpected SPS_FORMAT_INVALID while outputting samples");
-            break;
-    }
+    if (silence_pool_prepare(&conn->silence, conn->silence.frame_count, conn->output_writer,
+                             conn->enable_dither, &conn->previous_random_number) != 0)
+        return 0;
 
-    *outp += result;
+    return silence_pool_play(&conn->silence, frames, conn->zone->output->play);
 }
 
 void buffer_get_frame_cleanup_handler(void * arg)
@@ -1070,8 +1074,8 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
             }
         }
 
-        if (config.output->is_running)
-            if (config.output->is_running() != 0) // if the back end isn't running for any reason
+        if (conn->zone->output->is_running)
+            if (conn->zone->output->is_running() != 0) // if the back end isn't running for any reason
             {
                 debug(2, "request flush because back end is not running");
                 debug_mutex_lock(&conn->flush_mutex, 1000, 0);
@@ -1085,13 +1089,20 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
         if (conn->flush_requested == 1)
         {
             if (conn->flush_output_flushed == 0)
-                if (config.output->flush)
+                if (conn->zone->output->flush)
                 {
-                    config.output->flush(); // no cancellation points
+                    conn->zone->output->flush(); // no cancellation points
                     debug(2, "flush request: flush output device.");
                 }
 
             conn->flush_output_flushed = 1;
+
+#ifdef CONFIG_SOXR
+            // anything still inside the resampler belongs to the audio being flushed
+            if (conn->soxr) soxr_clear(conn->soxr);
+            conn->soxr_streaming = 0;
+#endif
+            polyphase_reset(&conn->polyphase);
         }
 
         // now check to see it the flush request is for frames in the buffer or not
@@ -1109,8 +1120,8 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
         {
             if ((conn->ab_synced) && ((conn->ab_write - conn->ab_read) > 0))
             {
-                abuf_t * firstPacket = conn->audio_buffer + BUFIDX(conn->ab_read);
-                abuf_t * lastPacket = conn->audio_buffer + BUFIDX(conn->ab_write - 1);
+                abuf_t * firstPacket = conn->audio_buffer + BUFIDX(conn, conn->ab_read);
+                abuf_t * lastPacket = conn->audio_buffer + BUFIDX(conn, conn->ab_write - 1);
 
                 if ((firstPacket != NULL) && (firstPacket->ready))
                 {
@@ -1210,7 +1221,7 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
 
         if (conn->ab_synced)
         {
-            curframe = conn->audio_buffer + BUFIDX(conn->ab_read);
+            curframe = conn->audio_buffer + BUFIDX(conn, conn->ab_read);
 
             if ((conn->ab_read != conn->ab_write) &&
                 (curframe->ready)) // it could be synced and empty, under
@@ -1220,7 +1231,7 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                 if (curframe->sequence_number != conn->ab_read)
                 {
                     // some kind of sync problem has occurred.
-                    if (BUFIDX(curframe->sequence_number) == BUFIDX(conn->ab_read))
+                    if (BUFIDX(conn, curframe->sequence_number) == BUFIDX(conn, conn->ab_read))
                     {
                         // it looks like aliasing has happened
                         // jump to the new incoming stuff...
@@ -1281,7 +1292,7 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                             uint32_t effective_latency = conn->latency;
 
                             get_and_check_effective_latency(conn, &effective_latency,
-                                                            config.audio_backend_latency_offset);
+                                                            conn->zone->audio_backend_latency_offset);
                             // we are ignoring the returned status because it will be captured on subsequent
                             // frames, below.
 
@@ -1308,7 +1319,7 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                     if (conn->first_packet_time_to_play != 0)
                     {
                         // Now that we know the timing of the first packet...
-                        if (config.output->delay)
+                        if (conn->zone->output->delay)
                         {
                             // and that the output device is capable of synchronization...
 
@@ -1322,7 +1333,7 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                             uint32_t effective_latency = conn->latency;
 
                             switch (get_and_check_effective_latency(conn, &effective_latency,
-                                                                    config.audio_backend_latency_offset))
+                                                                    conn->zone->audio_backend_latency_offset))
                             {
                                 case -1:
 
@@ -1333,8 +1344,8 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                                             "combined with an audio_backend_latency_offset of %f seconds, would make the "
                                             "overall latency negative. The audio_backend_latency_offset setting is "
                                             "ignored.",
-                                            conn->latency, config.audio_backend_latency_offset);
-                                        config.audio_backend_latency_offset = 0; // set it to zero
+                                            conn->latency, conn->zone->audio_backend_latency_offset);
+                                        conn->zone->audio_backend_latency_offset = 0; // set it to zero
                                         conn->unachievable_audio_backend_latency_offset_notified = 1;
                                     }
 
@@ -1348,8 +1359,8 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                                         warn("An audio_backend_latency_offset of %f seconds may exceed the frame "
                                              "buffering "
                                              "capacity -- the setting is ignored.",
-                                             config.audio_backend_latency_offset);
-                                        config.audio_backend_latency_offset = 0; // set it to zero;
+                                             conn->zone->audio_backend_latency_offset);
+                                        conn->zone->audio_backend_latency_offset = 0; // set it to zero;
                                         conn->unachievable_audio_backend_latency_offset_notified = 1;
                                     }
 
@@ -1387,34 +1398,37 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                                 // do some calculations
                                 int64_t lead_time = conn->first_packet_time_to_play - local_time_now;
 
-                                if ((config.audio_backend_silent_lead_in_time_auto == 1) ||
+                                if ((conn->zone->audio_backend_silent_lead_in_time_auto == 1) ||
                                     (lead_time <=
-                                     (int64_t)(config.audio_backend_silent_lead_in_time * (int64_t)1000000000)))
+                                     (int64_t)(conn->zone->audio_backend_silent_lead_in_time * (int64_t)1000000000)))
                                 {
                                     // debug(1, "Lead time: %" PRId64 " nanoseconds.", lead_time);
                                     int resp = 0;
                                     dac_delay = 0;
 
-                                    if (have_sent_prefiller_silence != 0) resp = config.output->delay(
+                                    if (have_sent_prefiller_silence != 0) resp = conn->zone->output->delay(
                                             &dac_delay); // we know the output device must have a delay function
 
                                     if (resp == 0)
                                     {
                                         int64_t gross_frame_gap =
-                                            ((conn->first_packet_time_to_play - local_time_now) * config.output_rate) /
+                                            ((conn->first_packet_time_to_play - local_time_now) * conn->zone->output_rate) /
                                             1000000000;
                                         int64_t exact_frame_gap = gross_frame_gap - dac_delay;
                                         int64_t frames_needed_to_maintain_desired_buffer =
-                                            (int64_t)(config.audio_backend_buffer_desired_length * config.output_rate) -
+                                            (int64_t)(conn->zone->audio_backend_buffer_desired_length * conn->zone->output_rate) -
                                             dac_delay;
                                         // below, remember that exact_frame_gap and
                                         // frames_needed_to_maintain_desired_buffer could both be negative
                                         int64_t fs = frames_needed_to_maintain_desired_buffer;
 
                                         // if there isn't enough time to have the desired buffer size
+                                        // top it up in small pieces -- a single packet's worth with the
+                                        // low latency profile, which is all a precise delay needs
                                         if (exact_frame_gap <= frames_needed_to_maintain_desired_buffer)
                                         {
-                                            fs = conn->max_frames_per_packet * 2;
+                                            if (config.latency_profile == LP_low) fs = conn->max_frames_per_packet;
+                                            else fs = conn->max_frames_per_packet * 2;
                                         }
 
                                         // if we are very close to the end of buffering, i.e. within two frame-lengths,
@@ -1430,24 +1444,11 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                                             conn->ab_buffering = 0;
                                         }
 
-                                        void * silence;
-
                                         if (fs > 0)
                                         {
-                                            silence = malloc(conn->output_bytes_per_frame * fs);
-
-                                            if (silence == NULL) debug(1, "Failed to allocate %d byte silence buffer.", fs);
-                                            else
-                                            {
-                                                // generate frames of silence with dither if necessary
-                                                conn->previous_random_number =
-                                                    generate_zero_frames(silence, fs, config.output_format,
-                                                                         conn->enable_dither, conn->previous_random_number);
-                                                config.output->play(silence, fs);
-                                                // debug(1, "Sent %" PRId64 " frames of silence", fs);
-                                                free(silence);
-                                                have_sent_prefiller_silence = 1;
-                                            }
+                                            player_silence_play(conn, fs);
+                                            // debug(1, "Sent %" PRId64 " frames of silence", fs);
+                                            have_sent_prefiller_silence = 1;
                                         }
                                     }
                                     else
@@ -1483,31 +1484,12 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                             // if the output device doesn't have a delay, we simply send the lead-in
                             int64_t lead_time =
                                 conn->first_packet_time_to_play - local_time_now; // negative if we are late
-                            void * silence;
-                            int64_t frame_gap = (lead_time * config.output_rate) / 1000000000;
+                            int64_t frame_gap = (lead_time * conn->zone->output_rate) / 1000000000;
 
                             // debug(1,"%d frames needed.",frame_gap);
-                            while (frame_gap > 0)
-                            {
-                                ssize_t fs = config.output_rate / 10;
-
-                                if (fs > frame_gap) fs = frame_gap;
+                            // this goes out in pieces of up to a tenth of a second -- the size of the pool
+                            if (frame_gap > 0) player_silence_play(conn, frame_gap);
 
-                                silence = malloc(conn->output_bytes_per_frame * fs);
-
-                                if (silence == NULL) debug(1, "Failed to allocate %d frame silence buffer.", fs);
-                                else
-                                {
-                                    // debug(1, "No delay function -- outputting %d frames of silence.", fs);
-                                    conn->previous_random_number =
-                                        generate_zero_frames(silence, fs, config.output_format, conn->enable_dither,
-                                                             conn->previous_random_number);
-                                    config.output->play(silence, fs);
-                                    free(silence);
-                                }
-
-                                frame_gap -= fs;
-                            }
                             conn->ab_buffering = 0;
                         }
                     }
@@ -1539,6 +1521,7 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
         // Note: the last three items are expressed in frames and must be converted to time.
 
         int do_wait = 0; // don't wait unless we can really prove we must
+        uint64_t time_of_next_frame = 0; // if waiting for the time to play a frame, that time
 
         if ((conn->ab_synced) && (curframe) && (curframe->ready) && (curframe->given_timestamp))
         {
@@ -1553,8 +1536,8 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                 uint32_t effective_latency = conn->latency;
 
                 switch (get_and_check_effective_latency(conn, &effective_latency,
-                                                        config.audio_backend_latency_offset -
-                                                        config.audio_backend_buffer_desired_length))
+                                                        conn->zone->audio_backend_latency_offset -
+                                                        conn->zone->audio_backend_buffer_desired_length))
                 {
                     case -1:
                         // this means that the latency is negative, i.e. the packet must be played before its
@@ -1574,8 +1557,8 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                                  "with an audio_backend_latency_offset of %f seconds an "
                                  "audio_backend_buffer_desired_length of %f seconds, would make the overall "
                                  "latency negative. No latency is used. Synchronisation may fail.",
-                                 conn->latency, config.audio_backend_latency_offset,
-                                 config.audio_backend_buffer_desired_length);
+                                 conn->latency, conn->zone->audio_backend_latency_offset,
+                                 conn->zone->audio_backend_buffer_desired_length);
                             conn->unachievable_audio_backend_latency_offset_notified = 1;
                         }
 
@@ -1590,7 +1573,7 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                             warn("Latency too long! An audio_backend_latency_offset of %f seconds combined with an "
                                  "audio_backend_buffer_desired_length of %f seconds  may exceed the frame "
                                  "buffering capacity.",
-                                 config.audio_backend_latency_offset, config.audio_backend_buffer_desired_length);
+                                 conn->zone->audio_backend_latency_offset, conn->zone->audio_backend_buffer_desired_length);
                             conn->unachievable_audio_backend_latency_offset_notified = 1;
                         }
 
@@ -1609,6 +1592,10 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
                 {
                     do_wait = 0;
                 }
+                else
+                {
+                    time_of_next_frame = time_to_play;
+                }
             }
         }
 
@@ -1631,10 +1618,32 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
 
         if (wait)
         {
-            uint64_t time_to_wait_for_wakeup_ns =
-                1000000000 / conn->input_rate; // this is time period of one frame
-            time_to_wait_for_wakeup_ns *= 2 * 352; // two full 352-frame packets
-            time_to_wait_for_wakeup_ns /= 3; // two thirds of a packet time
+            // Sleep until there's something to do rather than polling:
+            // while silence is being sent ahead of the first frame, every two thirds of a packet time,
+            // to keep the output topped up; while a frame is waiting to be played, until its time;
+            // and otherwise until the audio receiver signals that a packet has arrived.
+            // The wait is limited in any case, as changes in output state and flush requests
+            // are only checked here.
+            uint64_t time_to_wait_for_wakeup_ns;
+
+            if ((conn->ab_buffering) && (conn->first_packet_time_to_play != 0))
+            {
+                time_to_wait_for_wakeup_ns = 1000000000 / conn->input_rate; // this is time period of one frame
+                time_to_wait_for_wakeup_ns *= 2 * 352; // two full 352-frame packets
+                time_to_wait_for_wakeup_ns /= 3; // two thirds of a packet time
+            }
+            else if (time_of_next_frame != 0)
+            {
+                time_to_wait_for_wakeup_ns = time_of_next_frame - local_time_now;
+            }
+            else
+            {
+                conn->player_waiting_for_packet = 1;
+                time_to_wait_for_wakeup_ns = PLAYER_MAXIMUM_WAIT_TIME;
+            }
+
+            if (time_to_wait_for_wakeup_ns > PLAYER_MAXIMUM_WAIT_TIME)
+                time_to_wait_for_wakeup_ns = PLAYER_MAXIMUM_WAIT_TIME;
 
 #ifdef COMPILE_FOR_LINUX_AND_FREEBSD_AND_CYGWIN_AND_OPENBSD
             uint64_t time_of_wakeup_ns = local_time_now + time_to_wait_for_wakeup_ns;
@@ -1659,6 +1668,7 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
             time_to_wait.tv_nsec = nsec;
             pthread_cond_timedwait_relative_np(&conn->flowcontrol, &conn->ab_mutex, &time_to_wait);
 #endif
+            conn->player_waiting_for_packet = 0;
         }
     }
     while (wait);
@@ -1673,7 +1683,7 @@ static abuf_t * buffer_get_frame(rtsp_conn_info * conn)
             curframe->given_timestamp = 0; // indicate a silent frame should be substituted
         }
 
-        curframe->ready = 0;
+        abuf_set_ready(conn, curframe, 0);
     }
 
     conn->ab_read = SUCCESSOR(conn->ab_read);
@@ -1693,19 +1703,85 @@ static inline int32_t mean_32(int32_t a, int32_t b)
     return r;
 }
 
+// the volume to be applied by the block kernel -- if the DSP chain has run on the packet, the
+// volume has already been applied
+static inline int32_t output_volume(rtsp_conn_info * conn)
+{
+    if (conn->software_volume_applied) return 0x10000;
+    else return conn->dsp.volume;
+}
+
 // this takes an array of signed 32-bit integers and (a) removes or inserts a frame as specified in
 // stuff,
 // (b) multiplies each sample by the fixedvolume (a 16-bit quantity)
 // (c) dithers the result to the output size 32/24/16/8 bits
 // (d) outputs the result in the approprate format
 // formats accepted so far include U8, S8, S16, S24, S24_3LE, S24_3BE and S32
+// (b), (c) and (d) are done a block at a time by process_block_32()
 
 // stuff: 1 means add 1; 0 means do nothing; -1 means remove 1
-static int stuff_buffer_basic_32(int32_t * inptr, int length, sps_format_t l_output_format,
-                                 char * outptr, int stuff, int dither, rtsp_conn_info * conn)
+// where to format a packet's output -- straight into the output device's own buffer if it can offer
+// room for a whole packet, otherwise into outbuf. Pass it to output_buffer_play() afterwards
+static char * output_buffer_get(rtsp_conn_info * conn)
+{
+    void * region;
+    int frames = conn->max_frames_per_packet * conn->output_sample_ratio + conn->max_frame_size_change;
+
+    conn->output_direct = 0;
+
+    if ((conn->zone->output->get_buffer) && (conn->zone->output->get_buffer(&region, frames) == 0))
+    {
+        conn->output_direct = 1;
+        return (char *)region;
+    }
+
+    return conn->outbuf;
+}
+
+// tell the backend, if it wants to know, when the packet about to be played is due to be heard
+static void output_buffer_timing(rtsp_conn_info * conn, uint32_t timestamp, int is_silence)
+{
+    if (conn->zone->output->timing)
+    {
+        uint64_t play_time = 0;
+
+        // when the frame is due out of the DAC -- the player sends it to the backend earlier
+        if (is_silence == 0)
+        {
+            frame_to_local_time(timestamp + conn->latency, &play_time, conn); // this will go modulo 2^32
+            play_time += (int64_t)(conn->zone->audio_backend_latency_offset * 1000000000);
+        }
+        else
+        {
+            timestamp = 0;
+        }
+
+        conn->zone->output->timing(timestamp, play_time, is_silence);
+    }
+}
+
+// the timestamp is the RTP timestamp of the packet's first frame
+static void output_buffer_play(rtsp_conn_info * conn, char * buffer, int frames, uint32_t timestamp)
+{
+    output_buffer_timing(conn, timestamp, 0);
+
+    if (conn->output_direct)
+    {
+        conn->zone->output->commit_buffer(frames);
+        conn->output_direct = 0;
+    }
+    else if (frames)
+    {
+        conn->zone->output->play(buffer, frames);
+    }
+}
+
+int stuff_buffer_basic_32(int32_t * inptr, int length, char * outptr, int stuff, int dither,
+                          rtsp_conn_info * conn)
 {
     int tstuff = stuff;
     char * l_outptr = outptr;
+    int32_t volume = output_volume(conn);
 
     if ((stuff > 1) || (stuff < -1) || (length < 100))
     {
@@ -1713,7 +1789,6 @@ static int stuff_buffer_basic_32(int32_t * inptr, int length, sps_format_t l_out
         tstuff = 0; // if any of these conditions hold, don't stuff anything/
     }
 
-    int i;
     int stuffsamp = length;
 
     if (tstuff)
@@ -1721,13 +1796,10 @@ static int stuff_buffer_basic_32(int32_t * inptr, int length, sps_format_t l_out
         stuffsamp =
             (rand() % (length - 2)) + 1; // ensure there's always a sample before and after the item
 
-    for (i = 0; i < stuffsamp; i++) // the whole frame, if no stuffing
-    {
-        process_sample(*inptr++, &l_outptr, l_output_format, conn->fix_volume, dither, conn);
-        process_sample(*inptr++, &l_outptr, l_output_format, conn->fix_volume, dither, conn);
-    }
-
-    ;
+    // the whole frame, if no stuffing
+    l_outptr += process_block_32(inptr, stuffsamp * 2, l_outptr, conn->output_writer, volume, dither,
+                                 &conn->previous_random_number);
+    inptr += stuffsamp * 2;
 
     if (tstuff)
     {
@@ -1735,10 +1807,11 @@ static int stuff_buffer_basic_32(int32_t * inptr, int length, sps_format_t l_out
         {
             // debug(3, "+++++++++");
             // interpolate one sample
-            process_sample(mean_32(inptr[-2], inptr[0]), &l_outptr, l_output_format, conn->fix_volume,
-                           dither, conn);
-            process_sample(mean_32(inptr[-1], inptr[1]), &l_outptr, l_output_format, conn->fix_volume,
-                           dither, conn);
+            int32_t interpolated_frame[2];
+            interpolated_frame[0] = mean_32(inptr[-2], inptr[0]);
+            interpolated_frame[1] = mean_32(inptr[-1], inptr[1]);
+            l_outptr += process_block_32(interpolated_frame, 2, l_outptr, conn->output_writer, volume,
+                                         dither, &conn->previous_random_number);
         }
         else if (stuff == -1)
         {
@@ -1753,43 +1826,136 @@ static int stuff_buffer_basic_32(int32_t * inptr, int length, sps_format_t l_out
 
         if (tstuff < 0) remainder = remainder + tstuff; // don't run over the correct end of the output buffer
 
-        for (i = stuffsamp; i < remainder; i++)
-        {
-            process_sample(*inptr++, &l_outptr, l_output_format, conn->fix_volume, dither, conn);
-            process_sample(*inptr++, &l_outptr, l_output_format, conn->fix_volume, dither, conn);
-        }
+        process_block_32(inptr, (remainder - stuffsamp) * 2, l_outptr, conn->output_writer, volume, dither,
+                         &conn->previous_random_number);
     }
 
     conn->amountStuffed = tstuff;
     return length + tstuff;
 }
 
+// this takes an array of signed 32-bit integers and
+// (a) passes it through the session's polyphase resampler at ratio output frames per input frame,
+// (b) multiplies each sample by the fixedvolume (a 16-bit quantity)
+// (c) dithers the result to the output size 32/24/16/8 bits
+// (d) outputs the result in the approprate format
+// Successive packets must go through it without a break, or it must be reset with
+// polyphase_reset() in between. The number of frames returned is length * ratio, give or take
+// a frame, as the resampler carries its position on from packet to packet.
+int stuff_buffer_polyphase_32(int32_t * inptr, int32_t * scratchBuffer, int length, char * outptr,
+                              double ratio, int dither, rtsp_conn_info * conn)
+{
+    size_t odone = polyphase_process(&conn->polyphase, inptr, length, scratchBuffer, ratio,
+                                     length + conn->max_frame_size_change);
+
+    process_block_32(scratchBuffer, odone * 2, outptr, conn->output_writer, output_volume(conn),
+                     dither, &conn->previous_random_number);
+
+    conn->amountStuffed = (int)odone - length;
+    return odone;
+}
+
 #ifdef CONFIG_SOXR
+// The streaming resampler runs at a nominal ratio of 1. Each packet, its ratio is set with
+// soxr_set_io_ratio() to add or remove the frame asked for, slewing across the packet, so
+// the filter state carries on from packet to packet and there are no edges to patch up.
+// SOXR_STREAM_MAXIMUM_IO_RATIO is the most it will ever be asked to vary by.
+#define SOXR_STREAM_MAXIMUM_IO_RATIO 1.1
+
+// this is also used to time soxr at startup, so that the timing matches what the player does
+soxr_t soxr_stream_create(void)
+{
+    soxr_error_t error;
+    soxr_io_spec_t io_spec = soxr_io_spec(SOXR_INT32_I, SOXR_INT32_I);
+    soxr_quality_spec_t q_spec = soxr_quality_spec(SOXR_HQ, SOXR_VR);
+    soxr_t soxr = soxr_create(SOXR_STREAM_MAXIMUM_IO_RATIO, 1.0, 2, &error, &io_spec, &q_spec, NULL);
+
+    if (error) die("soxr error creating a streaming resampler: \"%s\".", soxr_strerror(error));
+
+    return soxr;
+}
+
 // this takes an array of signed 32-bit integers and
-// (a) uses libsoxr to
-// resample the array to have one more or one less frame, as specified in
-// stuff,
+// (a) passes it through the session's streaming libsoxr resampler, running at a ratio
+// that adds one frame or takes one frame away over the packet, as specified in stuff,
 // (b) multiplies each sample by the fixedvolume (a 16-bit quantity)
 // (c) dithers the result to the output size 32/24/16/8 bits
 // (d) outputs the result in the approprate format
 // formats accepted so far include U8, S8, S16, S24, S24_3LE, S24_3BE and S32
+// Once the stream is running, every packet must go through it, stuffed or not, until it is
+// drained with soxr_stream_drain() or cleared by a flush.
+// The number of frames returned can differ from length + stuff by a frame or so, since the
+// ratio slews across the packet.
+
 
-int32_t stat_n = 0;
-double stat_mean = 0.0;
-double stat_M2 = 0.0;
-double longest_soxr_execution_time = 0.0;
-int64_t packets_processed = 0;
+// the governor starts judging soxr after this many packets and smooths its load over about as many
+#define SOXR_GOVERNOR_PACKETS 64
+// how long to wait before trying soxr again after it first goes over budget, and at most
+#define SOXR_GOVERNOR_FIRST_RETRY_INTERVAL 30000000000
+#define SOXR_GOVERNOR_LONGEST_RETRY_INTERVAL 480000000000
 
-int stuff_buffer_soxr_32(int32_t * inptr, int32_t * scratchBuffer, int length,
-                         sps_format_t l_output_format, char * outptr, int stuff, int dither,
-                         rtsp_conn_info * conn)
+// tell anyone listening which interpolation the session is actually using
+static void announce_interpolation(const char * interpolation)
+{
+#ifdef CONFIG_METADATA
+    send_ssnc_metadata('intp', (char *)interpolation, strlen(interpolation), 1);
+#endif
+#ifdef CONFIG_DBUS_INTERFACE
+    if (dbus_service_is_running())
+        shairport_sync_set_active_interpolation(SHAIRPORT_SYNC(shairportSyncSkeleton), interpolation);
+#endif
+}
+
+static void soxr_governor_reset(rtsp_conn_info * conn)
+{
+    conn->soxr_load = 0.0;
+    conn->soxr_load_packets = 0;
+    conn->soxr_over_budget = 0;
+    conn->soxr_retry_time = 0;
+    conn->soxr_retry_interval = SOXR_GOVERNOR_FIRST_RETRY_INTERVAL;
+}
+
+// take in how long soxr took on a packet; if it's been taking too much of the packet's time,
+// set it aside for a while
+static void soxr_governor_update(rtsp_conn_info * conn, double execution_time, int length)
+{
+    if (config.soxr_cpu_budget <= 0.0) return;
+
+    double load = (execution_time * conn->zone->output_rate) / length;
+
+    conn->soxr_load_packets++;
+
+    if (conn->soxr_load_packets == 1) conn->soxr_load = load;
+    else conn->soxr_load += (load - conn->soxr_load) / SOXR_GOVERNOR_PACKETS;
+
+    if ((conn->soxr_load_packets >= SOXR_GOVERNOR_PACKETS) && (conn->soxr_load > config.soxr_cpu_budget))
+    {
+        warn("soxr is taking %.0f%% of each packet's time, more than the budget of %.0f%% -- "
+             "using \"polyphase\" interpolation for the next %" PRIu64 " seconds.",
+             conn->soxr_load * 100, config.soxr_cpu_budget * 100, conn->soxr_retry_interval / 1000000000);
+        conn->soxr_over_budget = 1;
+        conn->soxr_retry_time = get_absolute_time_in_ns() + conn->soxr_retry_interval;
+
+        if (conn->soxr_retry_interval < SOXR_GOVERNOR_LONGEST_RETRY_INTERVAL) conn->soxr_retry_interval *= 2;
+
+        announce_interpolation("polyphase");
+    }
+    else if (conn->soxr_load_packets == SOXR_GOVERNOR_PACKETS * 20)
+    {
+        // it's been within budget for long enough -- go back to retrying soon if it goes over again
+        conn->soxr_retry_interval = SOXR_GOVERNOR_FIRST_RETRY_INTERVAL;
+    }
+}
+
+int stuff_buffer_soxr_32(int32_t * inptr, int32_t * scratchBuffer, int length, char * outptr,
+                         int stuff, int dither, rtsp_conn_info * conn)
 {
     if (scratchBuffer == NULL)
     {
         die("soxr scratchBuffer not initialised.");
     }
 
-    packets_processed++;
+    conn->soxr_packets_processed++;
     int tstuff = stuff;
 
     if ((stuff > 1) || (stuff < -1) || (length < 100))
@@ -1798,114 +1964,102 @@ int stuff_buffer_soxr_32(int32_t * inptr, int32_t * scratchBuffer, int length,
         tstuff = 0; // if any of these conditions hold, don't stuff anything/
     }
 
-    if (tstuff)
-    {
-        // debug(1,"Stuff %d.",stuff);
+    if (conn->soxr == NULL) conn->soxr = soxr_stream_create();
 
-        soxr_io_spec_t io_spec;
-        io_spec.itype = SOXR_INT32_I;
-        io_spec.otype = SOXR_INT32_I;
-        io_spec.scale = 1.0; // this seems to crash if not = 1.0
-        io_spec.e = NULL;
-        io_spec.flags = 0;
+    uint64_t soxr_start_time = get_absolute_time_in_ns();
 
-        size_t odone;
+    soxr_error_t error =
+        soxr_set_io_ratio(conn->soxr, (double)length / (length + tstuff), length + tstuff);
 
-        uint64_t soxr_start_time = get_absolute_time_in_ns();
+    if (error) die("soxr error setting the io ratio: \"%s\".", soxr_strerror(error));
 
-        soxr_error_t error = soxr_oneshot(length, length + tstuff, 2, // Rates and # of chans.
-                                          inptr, length, NULL,    // Input.
-                                          scratchBuffer, length + tstuff, &odone, // Output.
-                                          &io_spec, // Input, output and transfer spec.
-                                          NULL, NULL); // Default configuration.
+    size_t idone, odone;
+    error = soxr_process(conn->soxr, inptr, length, &idone, scratchBuffer,
+                         length + conn->max_frame_size_change, &odone);
 
-        if (error) die("soxr error: %s\n", "error: %s\n", soxr_strerror(error));
+    if (error) die("soxr error: \"%s\".", soxr_strerror(error));
 
-        if (odone > (size_t)(length + 1)) die("odone = %u!\n", odone);
+    if (idone != (size_t)length) debug(1, "soxr took only %zu of %d frames.", idone, length);
 
-        // mean and variance calculations from "online_variance" algorithm at
-        // https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Online_algorithm
+    conn->soxr_streaming = 1;
 
-        double soxr_execution_time = (get_absolute_time_in_ns() - soxr_start_time) * 0.000000001;
+    // mean and variance calculations from "online_variance" algorithm at
+    // https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Online_algorithm
 
-        // debug(1,"soxr_execution_time_us: %10.1f",soxr_execution_time_us);
-        if (soxr_execution_time > longest_soxr_execution_time) longest_soxr_execution_time = soxr_execution_time;
+    double soxr_execution_time = (get_absolute_time_in_ns() - soxr_start_time) * 0.000000001;
 
-        stat_n += 1;
-        double stat_delta = soxr_execution_time - stat_mean;
-        stat_mean += stat_delta / stat_n;
-        stat_M2 += stat_delta * (soxr_execution_time - stat_mean);
+    // debug(1,"soxr_execution_time_us: %10.1f",soxr_execution_time_us);
+    if (soxr_execution_time > conn->soxr_longest_execution_time)
+        conn->soxr_longest_execution_time = soxr_execution_time;
 
-        int i;
-        int32_t * ip, * op;
-        ip = inptr;
-        op = scratchBuffer;
+    conn->soxr_stat_n += 1;
+    double stat_delta = soxr_execution_time - conn->soxr_stat_mean;
+    conn->soxr_stat_mean += stat_delta / conn->soxr_stat_n;
+    conn->soxr_stat_M2 += stat_delta * (soxr_execution_time - conn->soxr_stat_mean);
 
-        const int gpm = 5;
+    soxr_governor_update(conn, soxr_execution_time, length);
 
-        // keep the first (dpm) samples, to mitigate the Gibbs phenomenon
-        for (i = 0; i < gpm; i++)
-        {
-            *op++ = *ip++;
-            *op++ = *ip++;
-        }
+    // now, do the volume, dither and formatting processing
+    process_block_32(scratchBuffer, odone * 2, outptr, conn->output_writer, output_volume(conn),
+                     dither, &conn->previous_random_number);
 
-        // keep the last (dpm) samples, to mitigate the Gibbs phenomenon
+    if (conn->soxr_packets_processed % 1250 == 0)
+    {
+        debug(3,
+              "soxr_process execution time in seconds: mean, standard deviation and max "
+              "for %" PRId32 " packets in the last "
+              "1250 packets. %10.6f, %10.6f, %10.6f.",
+              conn->soxr_stat_n, conn->soxr_stat_mean,
+              conn->soxr_stat_n <= 1 ? 0.0 : sqrtf(conn->soxr_stat_M2 / (conn->soxr_stat_n - 1)),
+              conn->soxr_longest_execution_time);
+        conn->soxr_stat_n = 0;
+        conn->soxr_stat_mean = 0.0;
+        conn->soxr_stat_M2 = 0.0;
+        conn->soxr_longest_execution_time = 0.0;
+    }
 
-        // pointer arithmetic, baby -- it's da bomb.
-        op = scratchBuffer + (length + tstuff - gpm) * 2;
-        ip = inptr + (length - gpm) * 2;
+    conn->amountStuffed = tstuff;
+    return odone;
+}
 
-        for (i = 0; i < gpm; i++)
-        {
-            *op++ = *ip++;
-            *op++ = *ip++;
-        }
+// the number of frames held inside the streaming resampler -- they count as queued output
+static int64_t soxr_stream_delay(rtsp_conn_info * conn)
+{
+    if (conn->soxr_streaming == 0) return 0;
 
-        // now, do the volume, dither and formatting processing
-        ip = scratchBuffer;
-        char * l_outptr = outptr;
+    return (int64_t)(soxr_delay(conn->soxr) + 0.5);
+}
 
-        for (i = 0; i < length + tstuff; i++)
-        {
-            process_sample(*ip++, &l_outptr, l_output_format, conn->fix_volume, dither, conn);
-            process_sample(*ip++, &l_outptr, l_output_format, conn->fix_volume, dither, conn);
-        }
+// play out whatever is still inside the resampler and clear it, before leaving it
+static void soxr_stream_drain(rtsp_conn_info * conn)
+{
+    size_t odone;
 
-        ;
-    }
-    else   // the whole frame, if no stuffing
-    // now, do the volume, dither and formatting processing
+    do
     {
-        int32_t * ip = inptr;
-        char * l_outptr = outptr;
-        int i;
+        soxr_error_t error = soxr_process(conn->soxr, NULL, 0, NULL, conn->sbuf,
+                                          conn->max_frames_per_packet * conn->output_sample_ratio,
+                                          &odone);
+
+        if (error) die("soxr error draining the resampler: \"%s\".", soxr_strerror(error));
 
-        for (i = 0; i < length; i++)
+        if (odone)
         {
-            process_sample(*ip++, &l_outptr, l_output_format, conn->fix_volume, dither, conn);
-            process_sample(*ip++, &l_outptr, l_output_format, conn->fix_volume, dither, conn);
-        }
+            process_block_32(conn->sbuf, odone * 2, conn->outbuf, conn->output_writer,
+                             output_volume(conn), conn->enable_dither, &conn->previous_random_number);
 
-        ;
-    }
+            if (conn->software_mute_enabled)
+            {
+                generate_zero_frames(conn->outbuf, odone, conn->zone->output_format, conn->enable_dither,
+                                     conn->previous_random_number);
+            }
 
-    if (packets_processed % 1250 == 0)
-    {
-        debug(3,
-              "soxr_oneshot execution time in nanoseconds: mean, standard deviation and max "
-              "for %" PRId32 " interpolations in the last "
-              "1250 packets. %10.6f, %10.6f, %10.6f.",
-              stat_n, stat_mean, stat_n <= 1 ? 0.0 : sqrtf(stat_M2 / (stat_n - 1)),
-              longest_soxr_execution_time);
-        stat_n = 0;
-        stat_mean = 0.0;
-        stat_M2 = 0.0;
-        longest_soxr_execution_time = 0.0;
-    }
+            conn->zone->output->play(conn->outbuf, odone);
+        }
+    } while (odone);
 
-    conn->amountStuffed = tstuff;
-    return length + tstuff;
+    soxr_clear(conn->soxr);
+    conn->soxr_streaming = 0;
 }
 
 #endif /* ifdef CONFIG_SOXR */
@@ -1927,7 +2081,9 @@ void player_thread_cleanup_handler(void * arg)
     debug(3, "Connection %d: player thread main loop exit via player_thread_cleanup_handler.",
           conn->connection_number);
 
-    if (config.output->stop) config.output->stop();
+    if (conn->zone->output->stop) conn->zone->output->stop();
+
+    metrics_session_ended(conn->zone->index, conn->connection_number);
 
     if (config.statistics_requested)
     {
@@ -1951,22 +2107,11 @@ void player_thread_cleanup_handler(void * arg)
     mdns_dacp_monitor_set_id(NULL); // say we're not interested in following that DACP id any more
 #endif
 
-    debug(3, "Cancelling timing, control and audio threads...");
-    debug(3, "Cancel timing thread.");
-    pthread_cancel(conn->rtp_timing_thread);
-    debug(3, "Join timing thread.");
-    pthread_join(conn->rtp_timing_thread, NULL);
-    debug(3, "Timing thread terminated.");
-    debug(3, "Cancel control thread.");
-    pthread_cancel(conn->rtp_control_thread);
-    debug(3, "Join control thread.");
-    pthread_join(conn->rtp_control_thread, NULL);
-    debug(3, "Control thread terminated.");
-    debug(3, "Cancel audio thread.");
-    pthread_cancel(conn->rtp_audio_thread);
-    debug(3, "Join audio thread.");
-    pthread_join(conn->rtp_audio_thread, NULL);
-    debug(3, "Audio thread terminated.");
+    debug(3, "Cancel RTP receiver thread.");
+    pthread_cancel(conn->rtp_thread);
+    debug(3, "Join RTP receiver thread.");
+    pthread_join(conn->rtp_thread, NULL);
+    debug(3, "RTP receiver thread terminated.");
 
     if (conn->outbuf)
     {
@@ -1980,6 +2125,16 @@ void player_thread_cleanup_handler(void * arg)
         conn->sbuf = NULL;
     }
 
+#ifdef CONFIG_SOXR
+
+    if (conn->soxr)
+    {
+        soxr_delete(conn->soxr);
+        conn->soxr = NULL;
+    }
+
+#endif
+
     if (conn->tbuf)
     {
         free(conn->tbuf);
@@ -1992,6 +2147,11 @@ void player_thread_cleanup_handler(void * arg)
         conn->statistics = NULL;
     }
 
+    dsp_chain_free(&conn->dsp);
+    silence_pool_free(&conn->silence);
+
+    if (conn->stream.encrypted) aes_cbc_decryptor_free(&conn->decryptor);
+
     free_audio_buffers(conn);
 
     if (conn->stream.type == ast_apple_lossless) terminate_decoders(conn);
@@ -2005,6 +2165,7 @@ void * player_thread_func(void * arg)
 {
     rtsp_conn_info * conn = (rtsp_conn_info *)arg;
 
+    set_thread_scheduling(TC_player);
     // pthread_cleanup_push(player_thread_initial_cleanup_handler, arg);
     conn->packet_count = 0;
     conn->packet_count_since_flush = 0;
@@ -2034,29 +2195,16 @@ void * player_thread_func(void * arg)
     // This must be after init_alac_decoder
     init_buffer(conn); // will need a corresponding deallocation. No cancellation points in here
 
-    if (conn->stream.encrypted)
-    {
-#ifdef CONFIG_MBEDTLS
-        memset(&conn->dctx, 0, sizeof(mbedtls_aes_context));
-        mbedtls_aes_setkey_dec(&conn->dctx, conn->stream.aeskey, 128);
-#endif
-
-#ifdef CONFIG_POLARSSL
-        memset(&conn->dctx, 0, sizeof(aes_context));
-        aes_setkey_dec(&conn->dctx, conn->stream.aeskey, 128);
-#endif
-
-#ifdef CONFIG_OPENSSL
-        AES_set_decrypt_key(conn->stream.aeskey, 128, &conn->aes);
-#endif
-    }
+    if ((conn->stream.encrypted) &&
+        (aes_cbc_decryptor_init(&conn->decryptor, conn->stream.aeskey, conn->stream.aesiv) != 0))
+        die("Failed to set up the AES decryptor for the audio stream.");
 
     conn->timestamp_epoch = 0; // indicate that the next timestamp will be the first one.
     conn->maximum_timestamp_interval = conn->input_rate * 60; // actually there shouldn't be more than
                                                               // about 13 seconds of a gap between
                                                               // successive rtptimes, at worst
 
-    conn->output_sample_ratio = config.output_rate / conn->input_rate;
+    conn->output_sample_ratio = conn->zone->output_rate / conn->input_rate;
 
     //  debug(1, "Output sample ratio is %d.", conn->output_sample_ratio);
 
@@ -2065,33 +2213,14 @@ void * player_thread_func(void * arg)
                                        // rate, multiply it by the frame ratio.
                                        // but, on some occasions, more than one frame could be added
 
-    switch (config.output_format)
-    {
-        case SPS_FORMAT_S24_3LE:
-        case SPS_FORMAT_S24_3BE:
-            conn->output_bytes_per_frame = 6;
-            break;
-
-        case SPS_FORMAT_S24:
-        case SPS_FORMAT_S24_LE:
-        case SPS_FORMAT_S24_BE:
-            conn->output_bytes_per_frame = 8;
-            break;
-
-        case SPS_FORMAT_S32:
-        case SPS_FORMAT_S32_LE:
-        case SPS_FORMAT_S32_BE:
-            conn->output_bytes_per_frame = 8;
-            break;
-
-        default:
-            conn->output_bytes_per_frame = 4;
-    }
+    // choose the output writer once for the session -- this dies if the format can't be written
+    conn->output_writer = process_block_writer_for_format(conn->zone->output_format);
+    conn->output_bytes_per_frame = conn->output_writer->bytes_per_sample * 2;
 
     debug(3, "Output frame bytes is %d.", conn->output_bytes_per_frame);
 
     conn->dac_buffer_queue_minimum_length = (uint64_t)(
-        config.audio_backend_buffer_interpolation_threshold_in_seconds * config.output_rate);
+        conn->zone->audio_backend_buffer_interpolation_threshold_in_seconds * conn->zone->output_rate);
     debug(3, "dac_buffer_queue_minimum_length is %" PRIu64 " frames.",
           conn->dac_buffer_queue_minimum_length);
 
@@ -2101,12 +2230,12 @@ void * player_thread_func(void * arg)
     // check that there are enough buffers to accommodate the desired latency and the latency offset
 
     int maximum_latency =
-        conn->latency + (int)(config.audio_backend_latency_offset * config.output_rate);
+        conn->latency + (int)(conn->zone->audio_backend_latency_offset * conn->zone->output_rate);
 
-    if ((maximum_latency + (352 - 1)) / 352 + 10 > BUFFER_FRAMES)
+    if ((maximum_latency + (352 - 1)) / 352 + 10 > (int)conn->buffer_frames)
         die("Not enough buffers available for a total latency of %d frames. A maximum of %d 352-frame "
             "packets may be accommodated.",
-            maximum_latency, BUFFER_FRAMES);
+            maximum_latency, conn->buffer_frames);
 
     conn->connection_state_to_output = get_requested_connection_state_to_output();
 // this is about half a minute
@@ -2135,8 +2264,14 @@ void * player_thread_func(void * arg)
 
     conn->buffer_occupancy = 0;
 
+    // what's published for the metrics listener -- see metrics.h
+    metrics_snapshot session_metrics;
+    memset(&session_metrics, 0, sizeof(session_metrics));
+    session_metrics.active = 1;
+    session_metrics.connection_number = conn->connection_number;
+
     int play_samples = 0;
-    uint64_t current_delay;
+    uint64_t current_delay = 0;
     int play_number = 0;
     conn->play_number_after_flush = 0;
     //  int last_timestamp = 0; // for debugging only
@@ -2155,47 +2290,7 @@ void * player_thread_func(void * arg)
     signed short * inbuf;
     int inbuflength;
 
-    unsigned int output_bit_depth = 16; // default;
-
-    switch (config.output_format)
-    {
-        case SPS_FORMAT_S8:
-        case SPS_FORMAT_U8:
-            output_bit_depth = 8;
-            break;
-
-        case SPS_FORMAT_S16:
-        case SPS_FORMAT_S16_LE:
-        case SPS_FORMAT_S16_BE:
-            output_bit_depth = 16;
-            break;
-
-        case SPS_FORMAT_S24:
-        case SPS_FORMAT_S24_LE:
-        case SPS_FORMAT_S24_BE:
-        case SPS_FORMAT_S24_3LE:
-        case SPS_FORMAT_S24_3BE:
-            output_bit_depth = 24;
-            break;
-
-        case SPS_FORMAT_S32:
-        case SPS_FORMAT_S32_LE:
-        case SPS_FORMAT_S32_BE:
-            output_bit_depth = 32;
-            break;
-
-        case SPS_FORMAT_UNKNOWN:
-            die("Unknown format choosing output bit depth");
-            break;
-
-        case SPS_FORMAT_AUTO:
-            die("Invalid format -- SPS_FORMAT_AUTO -- choosing output bit depth");
-            break;
-
-        case SPS_FORMAT_INVALID:
-            die("Invalid format -- SPS_FORMAT_INVALID -- choosing output bit depth");
-            break;
-    }
+    unsigned int output_bit_depth = conn->output_writer->bits_per_sample;
 
     debug(3, "Output bit depth is %d.", output_bit_depth);
 
@@ -2205,16 +2300,16 @@ void * player_thread_func(void * arg)
               "depth");
     }
 
-    if (config.output->parameters == NULL)
+    if (conn->zone->output->parameters == NULL)
     {
         debug(3, "Dithering will be enabled because the output volume is being altered in software");
     }
 
-    if ((config.output->parameters == NULL) || (conn->input_bit_depth > output_bit_depth) ||
+    if ((conn->zone->output->parameters == NULL) || (conn->input_bit_depth > output_bit_depth) ||
         (config.playback_mode == ST_mono)) conn->enable_dither = 1;
 
     // remember, the output device may never have been initialised prior to this call
-    config.output->start(config.output_rate, config.output_format); // will need a corresponding stop
+    conn->zone->output->start(conn->zone->output_rate, conn->zone->output_format); // will need a corresponding stop
 
     // we need an intermediate "transition" buffer
 
@@ -2232,6 +2327,12 @@ void * player_thread_func(void * arg)
 
     if (conn->sbuf == NULL) die("Failed to allocate memory for the sbuf buffer.");
 
+#ifdef CONFIG_SOXR
+    conn->soxr = NULL; // the streaming resampler is created when it is first used
+    conn->soxr_streaming = 0;
+    soxr_governor_reset(conn);
+#endif
+
     // The size of these dependents on the number of frames, the size of each frame and the maximum
     // size change
     conn->outbuf = malloc(
@@ -2240,8 +2341,34 @@ void * player_thread_func(void * arg)
 
     if (conn->outbuf == NULL) die("Failed to allocate memory for an output buffer.");
 
+    dsp_chain_init(&conn->dsp,
+                   conn->max_frames_per_packet * conn->output_sample_ratio + conn->max_frame_size_change,
+                   conn->zone->output_rate);
+
+    // all the silence the session plays comes from here, so nothing has to be allocated or
+    // formatted for a gap or a sync adjustment -- make it a tenth of a second, the largest
+    // piece the prefill uses, and at least a packet
+    size_t silence_pool_frames = conn->zone->output_rate / 10;
+
+    if (silence_pool_frames < conn->max_frames_per_packet * conn->output_sample_ratio)
+        silence_pool_frames = conn->max_frames_per_packet * conn->output_sample_ratio;
+
+    drift_controller_init(&conn->drift, conn->zone->output_rate);
+    polyphase_init(&conn->polyphase);
+    conn->drift_feed_forward = 0.0;
+
+    silence_pool_init(&conn->silence);
+
+    if (silence_pool_prepare(&conn->silence, silence_pool_frames, conn->output_writer, conn->enable_dither,
+                             &conn->previous_random_number) != 0)
+        die("Failed to allocate memory for the silence pool.");
+
     conn->first_packet_timestamp = 0;
     conn->missing_packets = conn->late_packets = conn->too_late_packets = conn->resend_requests = 0;
+    conn->frames_played = 0;
+    conn->resend_response_time = 0;
+    conn->resend_response_time_measured = 0;
+    adaptive_latency_init(&conn->adaptive, conn->input_rate);
     int sync_error_out_of_bounds =
         0; // number of times in a row that there's been a serious sync error
 
@@ -2255,9 +2382,9 @@ void * player_thread_func(void * arg)
 
     if (config.statistics_requested)
     {
-        if ((config.output->delay))
+        if ((conn->zone->output->delay))
         {
-            if (config.no_sync == 0)
+            if (conn->zone->no_sync == 0)
             {
                 inform("sync error in milliseconds, "
                        "net correction in ppm, "
@@ -2310,10 +2437,8 @@ void * player_thread_func(void * arg)
         }
     }
 
-    // create and start the timing, control and audio receiver threads
-    pthread_create(&conn->rtp_audio_thread, NULL, &rtp_audio_receiver, (void *)conn);
-    pthread_create(&conn->rtp_control_thread, NULL, &rtp_control_receiver, (void *)conn);
-    pthread_create(&conn->rtp_timing_thread, NULL, &rtp_timing_receiver, (void *)conn);
+    // create and start the thread that receives the audio, control and timing packets
+    pthread_create(&conn->rtp_thread, NULL, &rtp_receiver, (void *)conn);
 
     pthread_cleanup_push(player_thread_cleanup_handler, arg); // undo what's been done so far
 
@@ -2343,7 +2468,16 @@ void * player_thread_func(void * arg)
         // guaranteed that they'll always be executed
         if (inframe)
         {
-            inbuf = inframe->data;
+            uint64_t frame_time = latency_histogram_time_now();
+
+            // how long a received packet waited in the buffer
+            if ((frame_time) && (inframe->given_timestamp != 0) && (inframe->status == 0) &&
+                (inframe->initialisation_time) && (frame_time >= inframe->initialisation_time))
+                latency_histogram_record(LH_buffer_residency, frame_time - inframe->initialisation_time);
+
+            if (inframe->given_timestamp != 0) abuf_decode(conn, inframe);
+
+            inbuf = abuf_data(conn, inframe);
             inbuflength = inframe->length;
 
             if (inbuf)
@@ -2363,23 +2497,8 @@ void * player_thread_func(void * arg)
                     conn->last_seqno_read =
                         SUCCESSOR(conn->last_seqno_read); // manage the packet out of sequence minder
 
-                    void * silence = malloc(conn->output_bytes_per_frame * conn->max_frames_per_packet *
-                                            conn->output_sample_ratio);
-
-                    if (silence == NULL)
-                    {
-                        debug(1, "Failed to allocate memory for a silent frame silence buffer.");
-                    }
-                    else
-                    {
-                        // the player may change the contents of the buffer, so it has to be zeroed each time;
-                        // might as well malloc and free it locally
-                        conn->previous_random_number = generate_zero_frames(
-                            silence, conn->max_frames_per_packet * conn->output_sample_ratio,
-                            config.output_format, conn->enable_dither, conn->previous_random_number);
-                        config.output->play(silence, conn->max_frames_per_packet * conn->output_sample_ratio);
-                        free(silence);
-                    }
+                    output_buffer_timing(conn, 0, 1);
+                    player_silence_play(conn, conn->max_frames_per_packet * conn->output_sample_ratio);
                 }
                 else if (conn->play_number_after_flush < 10)
                 {
@@ -2391,27 +2510,11 @@ void * player_thread_func(void * arg)
                        debug(1, "Play number %d, monotonic timestamp %llx, difference
                        %lld.",conn->play_number_after_flush,inframe->timestamp,difference);
                      */
-                    void * silence = malloc(conn->output_bytes_per_frame * conn->max_frames_per_packet *
-                                            conn->output_sample_ratio);
-
-                    if (silence == NULL)
-                    {
-                        debug(1, "Failed to allocate memory for a flush silence buffer.");
-                    }
-                    else
-                    {
-                        // the player may change the contents of the buffer, so it has to be zeroed each time;
-                        // might as well malloc and free it locally
-                        conn->previous_random_number = generate_zero_frames(
-                            silence, conn->max_frames_per_packet * conn->output_sample_ratio,
-                            config.output_format, conn->enable_dither, conn->previous_random_number);
-                        config.output->play(silence, conn->max_frames_per_packet * conn->output_sample_ratio);
-                        free(silence);
-                    }
+                    player_silence_play(conn, conn->max_frames_per_packet * conn->output_sample_ratio);
                 }
                 else
                 {
-                    if (((config.output->parameters == NULL) && (config.ignore_volume_control == 0) &&
+                    if (((conn->zone->output->parameters == NULL) && (config.ignore_volume_control == 0) &&
                          (config.airplay_volume != 0.0)) ||
                         (conn->input_bit_depth > output_bit_depth) || (config.playback_mode == ST_mono)) conn->enable_dither = 1;
                     else conn->enable_dither = 0;
@@ -2524,6 +2627,7 @@ void * player_thread_func(void * arg)
                     int64_t sync_error = 0;
 
                     int amount_to_stuff = 0;
+                    conn->software_volume_applied = 0; // until the DSP chain says otherwise
 
                     // check sequencing
                     if (conn->last_seqno_read == -1) conn->last_seqno_read =
@@ -2557,10 +2661,10 @@ void * player_thread_func(void * arg)
 
                     int resp = -1; // use this as a flag -- if negative, we can't rely on a real known delay
 
-                    if (config.output->delay)
+                    if (conn->zone->output->delay)
                     {
                         long l_delay;
-                        resp = config.output->delay(&l_delay);
+                        resp = conn->zone->output->delay(&l_delay);
 
                         if (resp == 0) // no error
                         {
@@ -2574,6 +2678,10 @@ void * player_thread_func(void * arg)
                                     0; // could get a negative value if there was underrun, but ignore it.
                             }
 
+                            if ((latency_histograms_enabled) && (conn->zone->output_rate))
+                                latency_histogram_record(LH_dac_delay,
+                                                         (current_delay * 1000000000) / conn->zone->output_rate);
+
                             if (current_delay < minimum_dac_queue_size)
                             {
                                 minimum_dac_queue_size = current_delay; // update for display later
@@ -2615,9 +2723,17 @@ void * player_thread_func(void * arg)
                         local_time_to_frame(local_time_now, &should_be_frame_32, conn);
                         // int64_t should_be_frame = ((int64_t)should_be_frame_32) * conn->output_sample_ratio;
 
+                        // frames held inside the streaming resampler are as good as queued in the DAC
+                        int64_t resampler_delay = 0;
+#ifdef CONFIG_SOXR
+                        resampler_delay = soxr_stream_delay(conn);
+#endif
+                        trace(TR_dac_delay, current_delay, resampler_delay, 0, 0);
+
                         int64_t delay =
                             int64_mod_difference(should_be_frame_32 * conn->output_sample_ratio,
-                                                 nt - current_delay, UINT32_MAX * conn->output_sample_ratio);
+                                                 nt - (current_delay + resampler_delay),
+                                                 UINT32_MAX * conn->output_sample_ratio);
 
                         // int64_t delay = should_be_frame - (nt - current_delay); // all int64_t
 
@@ -2628,8 +2744,8 @@ void * player_thread_func(void * arg)
 
                         sync_error =
                             delay - ((int64_t)conn->latency * conn->output_sample_ratio +
-                                     (int64_t)(config.audio_backend_latency_offset *
-                                               config.output_rate)); // int64_t from int64_t - int32_t, so okay
+                                     (int64_t)(conn->zone->audio_backend_latency_offset *
+                                               conn->zone->output_rate)); // int64_t from int64_t - int32_t, so okay
 
                         if (at_least_one_frame_seen_this_session == 0)
                         {
@@ -2654,37 +2770,18 @@ void * player_thread_func(void * arg)
                                   "first frame sync error (positive --> late): %" PRId64
                                   " frames, %.3f mS at %d frames per second output.",
                                   sync_error + first_frame_early_bias,
-                                  (1000.0 * (sync_error + first_frame_early_bias)) / config.output_rate,
-                                  config.output_rate);
+                                  (1000.0 * (sync_error + first_frame_early_bias)) / conn->zone->output_rate,
+                                  conn->zone->output_rate);
 
                             // if the packet is early, add the frames needed to put it in sync.
                             if (sync_error < 0)
                             {
                                 size_t final_adjustment_length_sized = -sync_error;
-                                char * final_adjustment_silence =
-                                    malloc(conn->output_bytes_per_frame * final_adjustment_length_sized);
-
-                                if (final_adjustment_silence)
-                                {
-                                    conn->previous_random_number = generate_zero_frames(
-                                        final_adjustment_silence, final_adjustment_length_sized, config.output_format,
-                                        conn->enable_dither, conn->previous_random_number);
-                                    int final_adjustment = -sync_error;
-                                    final_adjustment = final_adjustment - first_frame_early_bias;
-                                    debug(2,
-                                          "final sync adjustment: %" PRId64
-                                          " silent frames added with a bias of %" PRId64 " frames.",
-                                          -sync_error, first_frame_early_bias);
-                                    config.output->play(final_adjustment_silence, final_adjustment_length_sized);
-                                    free(final_adjustment_silence);
-                                }
-                                else
-                                {
-                                    warn("Failed to allocate memory for a final_adjustment_silence buffer of %d "
-                                         "frames for a "
-                                         "sync error of %d frames.",
-                                         final_adjustment_length_sized, sync_error);
-                                }
+                                debug(2,
+                                      "final sync adjustment: %" PRId64
+                                      " silent frames added with a bias of %" PRId64 " frames.",
+                                      -sync_error, first_frame_early_bias);
+                                player_silence_play(conn, final_adjustment_length_sized);
 
                                 sync_error = 0; // say the error was fixed!
                             }
@@ -2695,12 +2792,12 @@ void * player_thread_func(void * arg)
 
                         if (abs_sync_error < 0) abs_sync_error = -abs_sync_error;
 
-                        if ((config.no_sync == 0) && (inframe->given_timestamp != 0) &&
+                        if ((conn->zone->no_sync == 0) && (inframe->given_timestamp != 0) &&
                             (config.resyncthreshold > 0.0) &&
-                            (abs_sync_error > config.resyncthreshold * config.output_rate))
+                            (abs_sync_error > config.resyncthreshold * conn->zone->output_rate))
                         {
                             /*
-                               if (abs_sync_error > 3 * config.output_rate) {
+                               if (abs_sync_error > 3 * conn->zone->output_rate) {
 
                                warn("Very large sync error: %" PRId64 " frames, with should_be_frame: %" PRId64
                                    ",  nt: %" PRId64 ", current_delay: %" PRId64 ", given timestamp %" PRIX32
@@ -2722,9 +2819,10 @@ void * player_thread_func(void * arg)
                             //          "resyncing. Error: %lld.",
                             //        sync_error_out_of_bounds, sync_error);
                             sync_error_out_of_bounds = 0;
+                            drift_controller_reset(&conn->drift);
 
                             int64_t filler_length =
-                                (int64_t)(config.resyncthreshold * config.output_rate); // number of samples
+                                (int64_t)(config.resyncthreshold * conn->zone->output_rate); // number of samples
 
                             if ((sync_error > 0) && (sync_error > filler_length))
                             {
@@ -2750,24 +2848,8 @@ void * player_thread_func(void * arg)
                                 if (silence_length > (filler_length * 5)) silence_length = filler_length * 5;
 
                                 size_t silence_length_sized = silence_length;
-                                char * long_silence = malloc(conn->output_bytes_per_frame * silence_length_sized);
-
-                                if (long_silence)
-                                {
-                                    conn->previous_random_number =
-                                        generate_zero_frames(long_silence, silence_length_sized, config.output_format,
-                                                             conn->enable_dither, conn->previous_random_number);
-
-                                    debug(2, "Play a silence of %d frames.", silence_length_sized);
-                                    config.output->play(long_silence, silence_length_sized);
-                                    free(long_silence);
-                                }
-                                else
-                                {
-                                    warn("Failed to allocate memory for a long_silence buffer of %d frames for a "
-                                         "sync error of %d frames.",
-                                         silence_length_sized, sync_error);
-                                }
+                                debug(2, "Play a silence of %zu frames.", silence_length_sized);
+                                player_silence_play(conn, silence_length_sized);
 
                                 reset_input_flow_metrics(conn);
                             }
@@ -2777,24 +2859,30 @@ void * player_thread_func(void * arg)
                             /*
                                // before we finally commit to this frame, check its sequencing and timing
                                // require a certain error before bothering to fix it...
-                               if (sync_error > config.tolerance * config.output_rate) { // int64_t > int, okay
+                               if (sync_error > config.tolerance * conn->zone->output_rate) { // int64_t > int, okay
                                amount_to_stuff = -1;
                                }
-                               if (sync_error < -config.tolerance * config.output_rate) {
+                               if (sync_error < -config.tolerance * conn->zone->output_rate) {
                                amount_to_stuff = 1;
                                }
                              */
 
-                            if (amount_to_stuff == 0)
+                            if (config.drift_correction == DC_pi)
+                            {
+                                // spread the corrections out at the rate the drift and the error need
+                                amount_to_stuff = drift_controller_update(&conn->drift, sync_error, inbuflength,
+                                                                          conn->drift_feed_forward);
+                            }
+                            else if (amount_to_stuff == 0)
                             {
                                 // use a "V" shaped function to decide if stuffing should occur
                                 int64_t s = r64i();
                                 s = s >> 31;
-                                s = s * config.tolerance * config.output_rate;
-                                s = (s >> 32) + config.tolerance * config.output_rate; // should be a number from 0
+                                s = s * config.tolerance * conn->zone->output_rate;
+                                s = (s >> 32) + config.tolerance * conn->zone->output_rate; // should be a number from 0
 
                                 // to config.tolerance *
-                                // config.output_rate;
+                                // conn->zone->output_rate;
                                 if ((sync_error > 0) && (sync_error > s))
                                 {
                                     // debug(1,"Extra stuff -1");
@@ -2833,119 +2921,89 @@ void * player_thread_func(void * arg)
                                 }
                             }
 
-                            if (config.no_sync != 0) amount_to_stuff = 0;  // no stuffing if it's been disabled
-
-                            // Apply DSP here
+                            if (conn->zone->no_sync != 0) amount_to_stuff = 0;  // no stuffing if it's been disabled
 
-                            // check the state of loudness and convolution flags here and don't change them for
-                            // the frame
+                            // Apply DSP here -- if it runs, it applies the software volume too
 
-                            int do_loudness = config.loudness;
+                            uint64_t stage_time = latency_histogram_record_since(LH_frame_to_dsp, frame_time);
+                            uint64_t dsp_start_time = metrics_thread_time_now();
+                            conn->software_volume_applied =
+                                dsp_chain_process(&conn->dsp, (int32_t *)conn->tbuf, inbuflength);
 
-#ifdef CONFIG_CONVOLUTION
-                            int do_convolution = 0;
+                            // choose the interpolation for this packet
+                            stuffing_type stuffing = config.packet_stuffing;
 
-                            if ((config.convolution) && (config.convolver_valid)) do_convolution = 1;
-
-                            // we will apply the convolution gain if convolution is enabled, even if there is no
-                            // valid convolution happening
-
-                            int convolution_is_enabled = 0;
-
-                            if (config.convolution) convolution_is_enabled = 1;
-
-#endif
+#ifdef CONFIG_SOXR
 
-                            if (do_loudness
-#ifdef CONFIG_CONVOLUTION
-                                || convolution_is_enabled
-#endif
-                                )
+                            if (stuffing == ST_auto)
                             {
-                                int32_t * tbuf32 = (int32_t *)conn->tbuf;
-                                float fbuf_l[inbuflength];
-                                float fbuf_r[inbuflength];
-
-                                // Deinterleave, and convert to float
-                                int i;
+                                if (config.soxr_delay_index > config.soxr_delay_threshold)
+                                    stuffing = ST_polyphase; // the CPU is deemed too slow for soxr
+                                else stuffing = ST_soxr;
+                            }
 
-                                for (i = 0; i < inbuflength; ++i)
+                            if ((stuffing == ST_soxr) && (conn->soxr_over_budget))
+                            {
+                                if (local_time_now >= conn->soxr_retry_time)
                                 {
-                                    fbuf_l[i] = tbuf32[2 * i];
-                                    fbuf_r[i] = tbuf32[2 * i + 1];
+                                    debug(1, "Trying \"soxr\" interpolation again.");
+                                    conn->soxr_over_budget = 0;
+                                    conn->soxr_load_packets = 0;
+                                    announce_interpolation("soxr");
                                 }
-
-#ifdef CONFIG_CONVOLUTION
-
-                                // Apply convolution
-                                if (do_convolution)
+                                else
                                 {
-                                    convolver_process_l(fbuf_l, inbuflength);
-                                    convolver_process_r(fbuf_r, inbuflength);
+                                    stuffing = ST_polyphase; // it's been taking too long lately
                                 }
+                            }
 
-                                if (convolution_is_enabled)
-                                {
-                                    float gain = pow(10.0, config.convolution_gain / 20.0);
+                            if ((stuffing == ST_soxr) &&
+                                ((current_delay < conn->dac_buffer_queue_minimum_length) ||
+                                 (config.soxr_delay_index == 0))) // not computed yet
+                                stuffing = ST_basic;
 
-                                    for (i = 0; i < inbuflength; ++i)
-                                    {
-                                        fbuf_l[i] *= gain;
-                                        fbuf_r[i] *= gain;
-                                    }
-                                }
+                            if ((stuffing != ST_soxr) && (conn->soxr_streaming)) soxr_stream_drain(conn);
 
-#endif
+#else
 
-                                if (do_loudness)
-                                {
-                                    // Apply volume and loudness
-                                    // Volume must be applied here because the loudness filter will increase the
-                                    // signal level and it would saturate the int32_t otherwise
-                                    float gain = conn->fix_volume / 65536.0f;
-                                    // float gain_db = 20 * log10(gain);
-                                    // debug(1, "Applying soft volume dB: %f k: %f", gain_db, gain);
-
-                                    for (i = 0; i < inbuflength; ++i)
-                                    {
-                                        fbuf_l[i] = loudness_process(&loudness_l, fbuf_l[i] * gain);
-                                        fbuf_r[i] = loudness_process(&loudness_r, fbuf_r[i] * gain);
-                                    }
-                                }
+                            if (stuffing == ST_auto) stuffing = ST_polyphase;
 
-                                // Interleave and convert back to int32_t
-                                for (i = 0; i < inbuflength; ++i)
-                                {
-                                    tbuf32[2 * i] = fbuf_l[i];
-                                    tbuf32[2 * i + 1] = fbuf_r[i];
-                                }
-                            }
+#endif
 
-#ifdef CONFIG_SOXR
+                            // the polyphase resampler's stream is broken if a packet doesn't go through it
+                            if (stuffing != ST_polyphase) polyphase_reset(&conn->polyphase);
 
-                            if ((current_delay < conn->dac_buffer_queue_minimum_length) ||
-                                (config.packet_stuffing == ST_basic) ||
-                                (config.soxr_delay_index == 0) || // not computed yet
-                                ((config.packet_stuffing == ST_auto) &&
-                                 (config.soxr_delay_index >
-                                  config.soxr_delay_threshold)) // if the CPU is deemed too slow
-                                )
+                            char * outptr = output_buffer_get(conn);
+
+                            if (stuffing == ST_polyphase)
                             {
-#endif
-                            play_samples =
-                                stuff_buffer_basic_32((int32_t *)conn->tbuf, inbuflength, config.output_format,
-                                                      conn->outbuf, amount_to_stuff, conn->enable_dither, conn);
+                                // the pi controller's rate can be applied as it is; otherwise spread the
+                                // frame to be inserted or deleted over the packet
+                                double ratio = (1.0 * (inbuflength + amount_to_stuff)) / inbuflength;
+
+                                if ((config.drift_correction == DC_pi) && (conn->zone->no_sync == 0) &&
+                                    (conn->first_packet_time_to_play) &&
+                                    (local_time_now >= conn->first_packet_time_to_play + POLYPHASE_PI_RATE_SETTLING_TIME))
+                                    ratio = 1.0 + conn->drift.rate;
+
+                                play_samples = stuff_buffer_polyphase_32((int32_t *)conn->tbuf, (int32_t *)conn->sbuf,
+                                                                         inbuflength, outptr, ratio,
+                                                                         conn->enable_dither, conn);
+                            }
 #ifdef CONFIG_SOXR
-                        }
-                        else // soxr requested or auto requested with the index less or equal to the
-                             // threshold
-                        {
-                            play_samples = stuff_buffer_soxr_32((int32_t *)conn->tbuf, (int32_t *)conn->sbuf,
-                                                                inbuflength, config.output_format, conn->outbuf,
-                                                                amount_to_stuff, conn->enable_dither, conn);
-                        }
-
+                            else if (stuffing == ST_soxr)
+                            {
+                                play_samples = stuff_buffer_soxr_32((int32_t *)conn->tbuf, (int32_t *)conn->sbuf,
+                                                                    inbuflength, outptr, amount_to_stuff,
+                                                                    conn->enable_dither, conn);
+                            }
 #endif
+                            else
+                            {
+                                play_samples =
+                                    stuff_buffer_basic_32((int32_t *)conn->tbuf, inbuflength, outptr,
+                                                          amount_to_stuff, conn->enable_dither, conn);
+                            }
 
                             /*
                                {
@@ -2962,28 +3020,28 @@ void * player_thread_func(void * arg)
                                }
                              */
 
-                            if (conn->outbuf == NULL) debug(1, "NULL outbuf to play -- skipping it.");
-                            else
+                            if (play_samples == 0) debug(1, "play_samples==0 skipping it (1).");
+                            else if (conn->software_mute_enabled)
                             {
-                                if (play_samples == 0) debug(1, "play_samples==0 skipping it (1).");
-                                else
-                                {
-                                    if (conn->software_mute_enabled)
-                                    {
-                                        generate_zero_frames(conn->outbuf, play_samples, config.output_format,
-                                                             conn->enable_dither, conn->previous_random_number);
-                                    }
-
-                                    config.output->play(conn->outbuf, play_samples);
-                                }
+                                generate_zero_frames(outptr, play_samples, conn->zone->output_format,
+                                                     conn->enable_dither, conn->previous_random_number);
                             }
 
+                            if (dsp_start_time)
+                                session_metrics.dsp_time_ns += metrics_thread_time_now() - dsp_start_time;
+
+                            stage_time = latency_histogram_record_since(LH_dsp, stage_time);
+                            output_buffer_play(conn, outptr, play_samples, inframe->given_timestamp);
+                            latency_histogram_record_since(LH_backend_write, stage_time);
+                            session_metrics.frames_played += play_samples;
+                            conn->frames_played += play_samples;
+
                             // check for loss of sync
                             // timestamp of zero means an inserted silent frame in place of a missing frame
                             /*
-                               if ((config.no_sync == 0) && (inframe->timestamp != 0) &&
+                               if ((conn->zone->no_sync == 0) && (inframe->timestamp != 0) &&
                                 && (config.resyncthreshold > 0.0) &&
-                                (abs_sync_error > config.resyncthreshold * config.output_rate)) {
+                                (abs_sync_error > config.resyncthreshold * conn->zone->output_rate)) {
                                sync_error_out_of_bounds++;
                                // debug(1,"Sync error out of bounds: Error: %lld; previous error: %lld; DAC: %lld;
                                // timestamp: %llx, time now
@@ -3016,8 +3074,8 @@ void * player_thread_func(void * arg)
                                     // int64_t should_be_frame = ((int64_t)should_be_frame_32) *
                            conn->output_sample_ratio;
 
-                                    int32_t ilatency = (int32_t)((config.audio_backend_latency_offset -
-                           config.audio_backend_buffer_desired_length) * conn->input_rate) + conn->latency; if
+                                    int32_t ilatency = (int32_t)((conn->zone->audio_backend_latency_offset -
+                           conn->zone->audio_backend_buffer_desired_length) * conn->input_rate) + conn->latency; if
                            (ilatency < 0) debug(1,"incorrect latency %d.", ilatency);
 
                                     int32_t idelay = (int32_t)(should_be_frame_32 - inframe->given_timestamp);
@@ -3034,21 +3092,35 @@ void * player_thread_func(void * arg)
                             at_least_one_frame_seen_this_session = 1;
                         }
 
+                        // the DSP chain also picks up and ramps in any change of software volume
+                        uint64_t stage_time = latency_histogram_record_since(LH_frame_to_dsp, frame_time);
+                        uint64_t dsp_start_time = metrics_thread_time_now();
+                        conn->software_volume_applied =
+                            dsp_chain_process(&conn->dsp, (int32_t *)conn->tbuf, inbuflength);
+
+#ifdef CONFIG_SOXR
+                        if (conn->soxr_streaming) soxr_stream_drain(conn);
+#endif
+                        polyphase_reset(&conn->polyphase);
+                        char * outptr = output_buffer_get(conn);
                         play_samples =
-                            stuff_buffer_basic_32((int32_t *)conn->tbuf, inbuflength, config.output_format,
-                                                  conn->outbuf, 0, conn->enable_dither, conn);
+                            stuff_buffer_basic_32((int32_t *)conn->tbuf, inbuflength, outptr, 0,
+                                                  conn->enable_dither, conn);
 
-                        if (conn->outbuf == NULL) debug(1, "NULL outbuf to play -- skipping it.");
-                        else
+                        if (conn->software_mute_enabled)
                         {
-                            if (conn->software_mute_enabled)
-                            {
-                                generate_zero_frames(conn->outbuf, play_samples, config.output_format,
-                                                     conn->enable_dither, conn->previous_random_number);
-                            }
-
-                            config.output->play(conn->outbuf, play_samples); // remove the (short*)!
+                            generate_zero_frames(outptr, play_samples, conn->zone->output_format,
+                                                 conn->enable_dither, conn->previous_random_number);
                         }
+
+                        if (dsp_start_time)
+                            session_metrics.dsp_time_ns += metrics_thread_time_now() - dsp_start_time;
+
+                        stage_time = latency_histogram_record_since(LH_dsp, stage_time);
+                        output_buffer_play(conn, outptr, play_samples, inframe->given_timestamp);
+                        latency_histogram_record_since(LH_backend_write, stage_time);
+                        session_metrics.frames_played += play_samples;
+                        conn->frames_played += play_samples;
                     }
 
                     // mark the frame as finished
@@ -3075,7 +3147,7 @@ void * player_thread_func(void * arg)
                     // valid samples and the number of times sync wasn't checked due to non availability of a
                     // delay figure.
                     // for the present, stats are only updated when sync has been checked
-                    if (config.output->delay != NULL)
+                    if (conn->zone->output->delay != NULL)
                     {
                         if (number_of_statistics == trend_interval)
                         {
@@ -3115,10 +3187,30 @@ void * player_thread_func(void * arg)
 
                         tsum_of_corrections += conn->amountStuffed;
                         conn->session_corrections += conn->amountStuffed;
+                        session_metrics.corrections +=
+                            conn->amountStuffed > 0 ? conn->amountStuffed : -conn->amountStuffed;
 
                         newest_statistic = (newest_statistic + 1) % trend_interval;
                         number_of_statistics++;
                     }
+
+                    trace(TR_player_frame, inframe->sequence_number, conn->buffer_occupancy, sync_error,
+                          amount_to_stuff);
+
+                    if (metrics_enabled)
+                    {
+                        session_metrics.buffer_occupancy = conn->buffer_occupancy;
+                        session_metrics.sync_error = sync_error;
+                        session_metrics.dac_delay = current_delay;
+                        session_metrics.session_corrections = conn->session_corrections;
+                        session_metrics.missing_packets = conn->missing_packets;
+                        session_metrics.late_packets = conn->late_packets;
+                        session_metrics.too_late_packets = conn->too_late_packets;
+                        session_metrics.resend_requests = conn->resend_requests;
+                        session_metrics.input_frame_rate = conn->input_frame_rate;
+                        session_metrics.output_frame_rate = conn->frame_rate;
+                        metrics_publish(conn->zone->index, &session_metrics);
+                    }
                 }
 
                 if (play_number % print_interval == 0)
@@ -3143,11 +3235,11 @@ void * player_thread_func(void * arg)
                         conn->input_frame_rate = 0.0;
                     }
 
-                    if ((config.output->delay) && (config.no_sync == 0) && (config.output->rate_info))
+                    if ((conn->zone->output->delay) && (conn->zone->no_sync == 0) && (conn->zone->output->rate_info))
                     {
                         uint64_t elapsed_play_time, frames_played;
 
-                        if (config.output->rate_info(&elapsed_play_time, &frames_played) == 0) conn->frame_rate_status = 1;
+                        if (conn->zone->output->rate_info(&elapsed_play_time, &frames_played) == 0) conn->frame_rate_status = 1;
                         else conn->frame_rate_status = 0;
 
                         if (conn->frame_rate_status)
@@ -3160,6 +3252,17 @@ void * player_thread_func(void * arg)
                         {
                             conn->frame_rate = 0.0;
                         }
+
+                        // the drift the controller should expect -- the rate at which the DAC is taking
+                        // frames relative to the rate at which the source, timed on the local clock,
+                        // is providing them
+                        if ((conn->frame_rate_status) && (conn->frame_rate > 0.0) &&
+                            (conn->remote_frame_rate > 0.0) && (conn->local_to_remote_time_gradient > 0.0))
+                            conn->drift_feed_forward =
+                                conn->frame_rate / (conn->remote_frame_rate * conn->local_to_remote_time_gradient *
+                                                    conn->output_sample_ratio) -
+                                1.0;
+                        else conn->drift_feed_forward = 0.0;
                     }
 
                     // we can now calculate running averages for sync error (frames), corrections (ppm),
@@ -3175,9 +3278,9 @@ void * player_thread_func(void * arg)
                     {
                         if (at_least_one_frame_seen)
                         {
-                            if ((config.output->delay))
+                            if ((conn->zone->output->delay))
                             {
-                                if (config.no_sync == 0)
+                                if (conn->zone->no_sync == 0)
                                 {
                                     inform(
                                         "%*.2f," /* Sync error in milliseconds */
@@ -3197,7 +3300,7 @@ void * player_thread_func(void * arg)
                                         "%*.2f," /* source clock drift */
                                         "%*d,"   /* source clock drift sample count */
                                         "%*.2f", /* rough calculated correction in ppm */
-                                        10, 1000 * moving_average_sync_error / config.output_rate, 10,
+                                        10, 1000 * moving_average_sync_error / conn->zone->output_rate, 10,
                                         moving_average_correction * 1000000 / (352 * conn->output_sample_ratio), 10,
                                         moving_average_insertions_plus_deletions * 1000000 /
                                         (352 * conn->output_sample_ratio),
@@ -3230,7 +3333,7 @@ void * player_thread_func(void * arg)
                                            "%*.2f," /* source actual (average) frame rate */
                                            "%*.2f," /* source clock drift */
                                            "%*d",   /* source clock drift sample count */
-                                           10, 1000 * moving_average_sync_error / config.output_rate, 12, play_number,
+                                           10, 1000 * moving_average_sync_error / conn->zone->output_rate, 12, play_number,
                                            7, conn->missing_packets, 7, conn->late_packets, 7, conn->too_late_packets,
                                            7, conn->resend_requests, 7, minimum_dac_queue_size, 5,
                                            minimum_buffer_occupancy, 5, maximum_buffer_occupancy, 11,
@@ -3297,11 +3400,11 @@ void player_volume_without_notification(double airplay_volume, rtsp_conn_info *
     int32_t hw_max_db = 0, hw_min_db = 0; // zeroed to quieten an incorrect uninitialised warning
     int32_t sw_max_db = 0, sw_min_db = -9630;
 
-    if (config.output->parameters)
+    if (conn->zone->output->parameters)
     {
         volume_mode = vol_hw_only;
         audio_parameters audio_information;
-        config.output->parameters(&audio_information);
+        conn->zone->output->parameters(&audio_information);
         hw_max_db = audio_information.maximum_volume_dB;
         hw_min_db = audio_information.minimum_volume_dB;
 
@@ -3368,7 +3471,7 @@ void player_volume_without_notification(double airplay_volume, rtsp_conn_info *
     {
         if (airplay_volume == -144.0)
         {
-            if ((config.output->mute) && (config.output->mute(1) == 0))
+            if ((conn->zone->output->mute) && (conn->zone->output->mute(1) == 0))
                 debug(2,
                       "player_volume_without_notification: volume mode is %d, airplay_volume is %f, "
                       "hardware mute is enabled.",
@@ -3477,15 +3580,18 @@ void player_volume_without_notification(double airplay_volume, rtsp_conn_info *
                     break;
             }
 
-            if (((volume_mode == vol_hw_only) || (volume_mode == vol_both)) && (config.output->volume))
+            if (((volume_mode == vol_hw_only) || (volume_mode == vol_both)) && (conn->zone->output->volume))
             {
-                config.output->volume(hardware_attenuation); // otherwise set the output to the lowest value
+                conn->zone->output->volume(hardware_attenuation); // otherwise set the output to the lowest value
 
                 // debug(1,"Hardware attenuation set to %f for airplay volume of
                 // %f.",hardware_attenuation,airplay_volume);
                 if (volume_mode == vol_hw_only) conn->fix_volume = 0x10000;
             }
 
+            loudness_processor loudness;
+            int loudness_changed = 0;
+
             if ((volume_mode == vol_sw_only) || (volume_mode == vol_both))
             {
                 double temp_fix_volume = 65536.0 * pow(10, software_attenuation / 2000);
@@ -3495,9 +3601,15 @@ void player_volume_without_notification(double airplay_volume, rtsp_conn_info *
                 conn->fix_volume = temp_fix_volume;
 
                 // if (config.loudness)
-                loudness_set_volume(software_attenuation / 100);
+                loudness_set_coefficients(&loudness, software_attenuation / 100,
+                                          conn->zone->output_rate);
+                loudness_changed = 1;
             }
 
+            // hand the new software volume and loudness coefficients to the player, which ramps
+            // to them over its next packet -- this doesn't wait for the player
+            dsp_chain_set_volume(&conn->dsp, conn->fix_volume, loudness_changed ? &loudness : NULL);
+
             if (config.logOutputLevel)
             {
                 inform("Output Level set to: %.2f dB.", scaled_attenuation / 100.0);
@@ -3525,7 +3637,7 @@ void player_volume_without_notification(double airplay_volume, rtsp_conn_info *
             send_ssnc_metadata('pvol', dv, strlen(dv), 1);
 #endif
 
-            if (config.output->mute) config.output->mute(0);
+            if (conn->zone->output->mute) conn->zone->output->mute(0);
 
             conn->software_mute_enabled = 0;
 
@@ -3574,6 +3686,7 @@ void player_flush(uint32_t timestamp, rtsp_conn_info * conn)
 {
     debug(3, "player_flush");
     do_flush(timestamp, conn);
+    pthread_cond_signal(&conn->flowcontrol); // so that the player doesn't sleep through it
 #ifdef CONFIG_METADATA
     debug(2, "pfls");
     char numbuf[32];
@@ -3582,20 +3695,49 @@ void player_flush(uint32_t timestamp, rtsp_conn_info * conn)
 #endif
 }
 
+static void * player_prepare_thread_func(void * arg)
+{
+    zone * z = (zone *)arg;
+
+    set_thread_scheduling(TC_output);
+    zone_prepare_output(z);
+    return NULL;
+}
+
+void player_prepare(rtsp_conn_info * conn)
+{
+    // opening the output device can take hundreds of milliseconds, so start it in the background as
+    // soon as the session is announced. When player_play() prepares the device, it either finds it
+    // ready or waits for this to finish
+    if ((conn->zone->output) && (conn->zone->output->prepare))
+    {
+        pthread_t prepare_thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        if (pthread_create(&prepare_thread, &attr, player_prepare_thread_func, conn->zone) != 0)
+            debug(1, "Connection %d: can't create a thread to prepare the output device.",
+                  conn->connection_number);
+
+        pthread_attr_destroy(&attr);
+    }
+}
+
 int player_play(rtsp_conn_info * conn)
 {
     // need to use conn in place of stream below. Need to put the stream as a parameter to he
     if (conn->player_thread != NULL) die("Trying to create a second player thread for this RTSP session");
 
-    if (config.buffer_start_fill > BUFFER_FRAMES) die("specified buffer starting fill %d > buffer size %d", config.buffer_start_fill,
-                                                      BUFFER_FRAMES);
+    if (config.buffer_start_fill > config.packet_buffer_size) die("specified buffer starting fill %d > buffer size %d", config.buffer_start_fill,
+                                                                  config.packet_buffer_size);
 
     activity_monitor_signify_activity(
         1); // active, and should be before play's command hook, command_start()
     command_start();
 
     // call on the output device to prepare itself
-    if ((config.output) && (config.output->prepare)) config.output->prepare();
+    if ((conn->zone->output) && (conn->zone->output->prepare)) zone_prepare_output(conn->zone);
 
     pthread_t * pt = malloc(sizeof(pthread_t));
 
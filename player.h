@@ -8,50 +8,50 @@
 #include "definitions.h"
 
 #ifdef CONFIG_MBEDTLS
-#include <mbedtls/aes.h>
 #include <mbedtls/havege.h>
 #endif
 
 #ifdef CONFIG_POLARSSL
-#include <polarssl/aes.h>
 #include <polarssl/havege.h>
 #endif
 
-#ifdef CONFIG_OPENSSL
-#include <openssl/aes.h>
+#ifdef CONFIG_SOXR
+#include <soxr.h>
 #endif
 
+// common.h includes this file, by way of mdns.h, so none of the headers below may include common.h
+#include "adaptive_latency.h"
+#include "aes_cbc.h"
 #include "alac.h"
 #include "audio.h"
+#include "clock_model.h"
+#include "drift_controller.h"
+#include "dsp.h"
+#include "polyphase.h"
+#include "silence.h"
 
-#define time_ping_history_power_of_two 7
-#define time_ping_history                                                                          \
-    (1 << time_ping_history_power_of_two) // 2^7 is 128. At 1 per three seconds, approximately six
-                                          // minutes of records
-
-typedef struct time_ping_record
-{
-    uint64_t dispersion;
-    uint64_t local_time;
-    uint64_t remote_time;
-    int sequence_number;
-    int chosen;
-} time_ping_record;
+struct process_block_writer; // see process_block.h
+struct capture_session;       // see capture.h
+struct zone;                  // see zone.h
 
 typedef uint16_t seq_t;
 
-typedef struct audio_buffer_entry   // decoded audio packets
+// The bookkeeping for an audio packet. The data itself is not here -- it's in its slot in the
+// session's audio slab (see abuf_data() and abuf_packet() in player.c), so that the entries are
+// small and the resend scan, which only looks at the first few fields, walks them sequentially.
+// A packet is stored as it arrives and only decrypted and decoded when the player takes it.
+typedef struct audio_buffer_entry   // audio packets
 {
-    uint8_t ready;
-    uint8_t status; // flags
-    uint16_t resend_request_number;
-    signed short * data;
-    seq_t sequence_number;
     uint64_t initialisation_time; // the time the packet was added or the time it was noticed the
                                 // packet was missing
     uint64_t resend_time;       // time of last resend request or zero
+    uint16_t resend_request_number;
+    uint8_t ready;
+    uint8_t status; // flags
+    seq_t sequence_number;
     uint32_t given_timestamp;   // for debugging and checking
-    int length;                 // the length of the decoded data
+    uint16_t packet_length;     // the length of the stored packet, 0 once it has been decoded
+    uint16_t length;            // the number of frames -- nominal until the packet is decoded
 } abuf_t;
 
 typedef struct stats   // statistics for running averages
@@ -59,16 +59,16 @@ typedef struct stats   // statistics for running averages
     int64_t sync_error, correction, drift;
 } stats_t;
 
-// default buffer size
-// This needs to be a power of 2 because of the way BUFIDX(seqno) works.
+// default buffer size, in packets -- it can be changed with the general packet_buffer_size setting.
+// This needs to be a power of 2 because of the way BUFIDX(conn, seqno) works.
 // 512 is the minimum for normal operation -- it gives 512*352/44100 or just over 4 seconds of
 // buffers.
 // For at least 10 seconds, you need to go to 2048.
 // Resend requests will be spaced out evenly in the latency period, subject to a minimum interval of
 // about 0.25 seconds.
-// Each buffer occupies 352*4 bytes plus about, say, 64 bytes of overhead in various places, say
-// roughly 1,500 bytes per buffer.
-// Thus, 2048 buffers will occupy about 3 megabytes -- no big deal in a normal machine but maybe a
+// Each buffer occupies 352*4 bytes of decoded audio, 2048 bytes for the packet as it arrived and
+// 32 bytes of bookkeeping, say roughly 3,500 bytes per buffer.
+// Thus, 2048 buffers will occupy about 7 megabytes -- no big deal in a normal machine but maybe a
 // problem in an embedded device.
 
 #define BUFFER_FRAMES 1024
@@ -91,6 +91,7 @@ typedef struct
 typedef struct
 {
     int connection_number;   // for debug ID purposes, nothing else...
+    struct zone * zone;      // the zone it was made to, which has its output backend
     int resend_interval;     // this is really just for debugging
     char * UserAgent;        // free this on teardown
     int AirPlayVersion;      // zero if not an AirPlay session. Used to help calculate latency
@@ -114,13 +115,28 @@ typedef struct
     int unfixable_error_reported; // set when an unfixable error command has been executed.
 
     time_t playstart;
-    pthread_t thread, timer_requester, rtp_audio_thread, rtp_control_thread, rtp_timing_thread,
-              player_watchdog_thread;
+    pthread_t thread, rtp_thread, player_watchdog_thread;
 
     // buffers to delete on exit
     signed short * tbuf;
     int32_t * sbuf;
     char * outbuf;
+    int output_direct; // set while a packet is being formatted straight into the output device
+
+#ifdef CONFIG_SOXR
+    soxr_t soxr;        // the session's streaming resampler, created when it's first needed
+    int soxr_streaming; // true if audio has gone into the resampler since it was last cleared
+    // the soxr governor -- soxr is set aside if it takes too big a share of each packet's time
+    double soxr_load;            // the smoothed fraction of a packet's time that soxr takes
+    int soxr_load_packets;       // the number of packets that soxr_load has been smoothed over
+    int soxr_over_budget;        // while set, soxr isn't used
+    uint64_t soxr_retry_time;    // when to try soxr again
+    uint64_t soxr_retry_interval; // doubled each time soxr proves too slow again
+    // soxr's execution time statistics, for debugging
+    int32_t soxr_stat_n;
+    double soxr_stat_mean, soxr_stat_M2, soxr_longest_execution_time;
+    int64_t soxr_packets_processed;
+#endif
 
     // for generating running statistics...
 
@@ -130,6 +146,11 @@ typedef struct
     double frame_rate;
     int frame_rate_status;
 
+    drift_controller drift;    // decides when to stuff or drop a frame, if drift_correction is "pi"
+    polyphase_resampler polyphase; // for "polyphase" interpolation
+    double drift_feed_forward; // the drift expected from the measured rates, in frames per frame
+    adaptive_latency adaptive; // takes frames off the sender's latency, if adaptive_latency is on
+
     // for holding input rate information until printed out at the end of a session
 
     double input_frame_rate;
@@ -143,24 +164,42 @@ typedef struct
 
     // other stuff...
     pthread_t * player_thread;
-    abuf_t audio_buffer[BUFFER_FRAMES];
+    abuf_t * audio_buffer;     // buffer_frames entries, allocated when the session starts
+    uint64_t * ready_bits;     // a bit for each entry of audio_buffer, set when it's ready
+    unsigned int buffer_frames; // a power of two, from config.packet_buffer_size
+    char * audio_slab;        // the data for all of audio_buffer, in one page-aligned block
+    size_t audio_slab_stride; // the bytes between successive slots in the slab
+    size_t audio_slab_packet_offset; // where the stored packet is in a slot, after the decoded data
     unsigned int max_frames_per_packet, input_num_channels, input_bit_depth, input_rate;
     int input_bytes_per_frame, output_bytes_per_frame, output_sample_ratio;
+    const struct process_block_writer * output_writer; // chosen once per session for the output format
+    dsp_chain dsp;                // loudness, convolution and software volume, in float
+    silence_pool silence;         // preformatted silence for prefills, gaps and sync adjustments
+    int software_volume_applied;  // set if the DSP chain has already applied the volume to a packet
     int max_frame_size_change;
     int64_t previous_random_number;
     alac_file * decoder_info;
+#ifdef CONFIG_APPLE_ALAC
+    struct apple_alac * apple_decoder_info; // see apple_alac.h
+#endif
     uint64_t packet_count;
     uint64_t packet_count_since_flush;
+    struct capture_session * capture; // set if this session's datagrams are being recorded
     int connection_state_to_output;
     uint64_t first_packet_time_to_play;
     int64_t time_since_play_started; // nanoseconds
                                      // stats
     uint64_t missing_packets, late_packets, too_late_packets, resend_requests;
+    uint64_t frames_played; // frames passed to the backend
+    uint64_t resend_response_time; // smoothed time for a resent packet to arrive, nanoseconds --
+                                   // use player_resend_response_time() to read it
+    uint64_t resend_response_time_measured; // when it was last updated, or 0
     int decoder_in_use;
     // debug variables
     int32_t last_seqno_read;
     // mutexes and condition variables
     pthread_cond_t flowcontrol;
+    int player_waiting_for_packet; // set, with ab_mutex, while the player waits for a packet to arrive
     pthread_mutex_t ab_mutex, flush_mutex, volume_control_mutex;
     int fix_volume;
     uint32_t timestamp_epoch, last_timestamp,
@@ -174,17 +213,7 @@ typedef struct
     uint64_t time_of_last_audio_packet;
     seq_t ab_read, ab_write;
 
-#ifdef CONFIG_MBEDTLS
-    mbedtls_aes_context dctx;
-#endif
-
-#ifdef CONFIG_POLARSSL
-    aes_context dctx;
-#endif
-
-#ifdef CONFIG_OPENSSL
-    AES_KEY aes;
-#endif
+    aes_cbc_decryptor decryptor; // only set up if the stream is encrypted
 
     int amountStuffed;
 
@@ -236,8 +265,7 @@ typedef struct
     // debug variables
     int request_sent;
 
-    int time_ping_count;
-    struct time_ping_record time_pings[time_ping_history];
+    clock_model clock; // the timing exchanges so far and the fit of the remote clock to them
 
     uint64_t departure_time; // dangerous -- this assumes that there will never be two timing
                              // request in flight at the same time
@@ -252,6 +280,7 @@ typedef struct
     // add the following to the local time to get the remote time modulo 2^64
     uint64_t local_to_remote_time_difference; // used to switch between local and remote clocks
     uint64_t local_to_remote_time_difference_measurement_time; // when the above was calculated
+    double local_to_remote_time_difference_error; // one standard error of the difference, in ns
 
     int last_stuff_request;
 
@@ -280,14 +309,51 @@ typedef struct
 uint32_t modulo_32_offset(uint32_t from, uint32_t to);
 uint64_t modulo_64_offset(uint64_t from, uint64_t to);
 
+// start getting the output device ready for a session that's about to play
+void player_prepare(rtsp_conn_info * conn);
 int player_play(rtsp_conn_info * conn);
 int player_stop(rtsp_conn_info * conn);
 
 void player_volume(double f, rtsp_conn_info * conn);
 void player_volume_without_notification(double f, rtsp_conn_info * conn);
 void player_flush(uint32_t timestamp, rtsp_conn_info * conn);
+// the packet is copied into the buffer as it is -- it's decoded when the player takes it
 void player_put_packet(seq_t seqno, uint32_t actual_timestamp, uint8_t * data, int len,
                        rtsp_conn_info * conn);
+
+// a batch of packets is stored, and the buffer checked for missing packets, in one go
+typedef struct
+{
+    seq_t seqno;
+    uint32_t timestamp;
+    uint8_t * data;
+    int length;
+    uint64_t arrival_time; // when it was received, or 0 if that isn't known
+} player_packet;
+
+void player_put_packets(const player_packet * packets, int count, rtsp_conn_info * conn);
+
+// how long a resent packet can be expected to take to arrive, in nanoseconds -- the smoothed time
+// resends have been taking, decayed since the last and limited to a fraction of the latency
+uint64_t player_resend_response_time(rtsp_conn_info * conn, uint64_t time_now);
+#ifdef CONFIG_SOXR
+// create a streaming, variable-rate resampler for interleaved stereo int32_t -- dies on failure
+soxr_t soxr_stream_create(void);
+#endif
+
+// the interpolators take a packet of interleaved 32-bit frames and write it to outptr in the
+// session's output format, with a frame added or taken away (stuff is 1 or -1), or resampled at
+// ratio. They return the number of frames written. They're used by the player thread, and by
+// the benchmarks.
+int stuff_buffer_basic_32(int32_t * inptr, int length, char * outptr, int stuff, int dither,
+                          rtsp_conn_info * conn);
+int stuff_buffer_polyphase_32(int32_t * inptr, int32_t * scratchBuffer, int length, char * outptr,
+                              double ratio, int dither, rtsp_conn_info * conn);
+#ifdef CONFIG_SOXR
+int stuff_buffer_soxr_32(int32_t * inptr, int32_t * scratchBuffer, int length, char * outptr,
+                         int stuff, int dither, rtsp_conn_info * conn);
+#endif
+
 int64_t monotonic_timestamp(uint32_t       timestamp,
                             rtsp_conn_info * conn); // add an epoch to the timestamp. The monotonic
 // timestamp guaranteed to start between 2^32 2^33
@@ -0,0 +1,175 @@
+/*
+ * A cheap polyphase resampler. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A four-tap cubic interpolator, run as a bank of fixed-point fractional-delay filters, that
+// stretches or squeezes each packet by any amount.
+
+#include <pthread.h>
+#include <string.h>
+
+#include "polyphase.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define POLYPHASE_NEON 1
+#endif
+
+// the coefficients are Q30, so that the largest, 1.0, still fits
+#define POLYPHASE_COEFFICIENT_BITS 30
+
+static int32_t polyphase_bank[POLYPHASE_PHASES][4];
+static pthread_once_t polyphase_bank_once = PTHREAD_ONCE_INIT;
+
+// the Catmull-Rom weights of the frames at -1, 0, 1 and 2 for a point a fraction f past 0
+static void make_polyphase_bank(void)
+{
+    int phase, tap;
+
+    for (phase = 0; phase < POLYPHASE_PHASES; phase++)
+    {
+        double f = (1.0 * phase) / POLYPHASE_PHASES;
+        double f2 = f * f;
+        double f3 = f2 * f;
+        double weights[4];
+        weights[0] = 0.5 * (-f + 2 * f2 - f3);
+        weights[1] = 0.5 * (2 - 5 * f2 + 3 * f3);
+        weights[2] = 0.5 * (f + 4 * f2 - 3 * f3);
+        weights[3] = 0.5 * (-f2 + f3);
+
+        int32_t sum = 0;
+
+        for (tap = 0; tap < 4; tap++)
+        {
+            double w = weights[tap] * (1 << POLYPHASE_COEFFICIENT_BITS);
+            polyphase_bank[phase][tap] = (int32_t)(w < 0 ? w - 0.5 : w + 0.5);
+            sum += polyphase_bank[phase][tap];
+        }
+
+        // make each phase sum to exactly one, so that a constant passes through unchanged
+        polyphase_bank[phase][1] += (1 << POLYPHASE_COEFFICIENT_BITS) - sum;
+    }
+}
+
+void polyphase_init(polyphase_resampler * resampler)
+{
+    pthread_once(&polyphase_bank_once, make_polyphase_bank);
+    polyphase_reset(resampler);
+}
+
+void polyphase_reset(polyphase_resampler * resampler)
+{
+    memset(resampler->history, 0, sizeof(resampler->history));
+    resampler->position = 0;
+    resampler->primed = 0;
+}
+
+static inline int32_t saturate(int64_t value)
+{
+    if (value > INT32_MAX) return INT32_MAX;
+
+    if (value < INT32_MIN) return INT32_MIN;
+
+    return (int32_t)value;
+}
+
+// interpolate a stereo frame between window[2] and window[4], window pointing at the
+// interleaved frames -1, 0, 1 and 2
+static inline void interpolate_frame(const int32_t * window, const int32_t * c, int32_t * out)
+{
+#if defined(POLYPHASE_NEON)
+    int64x2_t acc = vmull_n_s32(vld1_s32(window), c[0]);
+    acc = vmlal_n_s32(acc, vld1_s32(window + 2), c[1]);
+    acc = vmlal_n_s32(acc, vld1_s32(window + 4), c[2]);
+    acc = vmlal_n_s32(acc, vld1_s32(window + 6), c[3]);
+    vst1_s32(out, vqrshrn_n_s64(acc, POLYPHASE_COEFFICIENT_BITS));
+#else
+    const int64_t round = (int64_t)1 << (POLYPHASE_COEFFICIENT_BITS - 1);
+    int64_t left = (int64_t)window[0] * c[0] + (int64_t)window[2] * c[1] +
+                   (int64_t)window[4] * c[2] + (int64_t)window[6] * c[3];
+    int64_t right = (int64_t)window[1] * c[0] + (int64_t)window[3] * c[1] +
+                    (int64_t)window[5] * c[2] + (int64_t)window[7] * c[3];
+    out[0] = saturate((left + round) >> POLYPHASE_COEFFICIENT_BITS);
+    out[1] = saturate((right + round) >> POLYPHASE_COEFFICIENT_BITS);
+#endif
+}
+
+size_t polyphase_process(polyphase_resampler * resampler, const int32_t * in, size_t frames,
+                         int32_t * out, double ratio, size_t maximum_output_frames)
+{
+    if (frames < POLYPHASE_HISTORY) return 0;
+
+    if (resampler->primed == 0)
+    {
+        // start the stream on the first frame, with the frames before it taken to be the same
+        int i;
+
+        for (i = 0; i < POLYPHASE_HISTORY; i++)
+        {
+            resampler->history[2 * i] = in[0];
+            resampler->history[2 * i + 1] = in[1];
+        }
+
+        resampler->position = (uint64_t)(POLYPHASE_HISTORY - 1) << 32;
+        resampler->primed = 1;
+    }
+
+    // the stream for this packet is the history followed by the packet. The window for the
+    // output frame at position p starts at frame (p >> 32), so the last usable position is at
+    // frame frames - 1; the frames after that wait in the history for the next packet.
+    // Windows that start in the history come from the join, the history and the first frames
+    // of the packet put together
+    int32_t join[(POLYPHASE_HISTORY * 2) * 2];
+    memcpy(join, resampler->history, sizeof(resampler->history));
+    memcpy(join + POLYPHASE_HISTORY * 2, in, sizeof(int32_t) * POLYPHASE_HISTORY * 2);
+
+    uint64_t step = (uint64_t)((1.0 / ratio) * 4294967296.0 + 0.5);
+    uint64_t position = resampler->position;
+    uint64_t end = (uint64_t)frames << 32;
+    size_t output_frames = 0;
+
+    while ((position < end) && (output_frames < maximum_output_frames))
+    {
+        size_t frame = position >> 32;
+        const int32_t * c =
+            polyphase_bank[(position >> (32 - POLYPHASE_PHASES_POWER_OF_TWO)) & (POLYPHASE_PHASES - 1)];
+        const int32_t * window;
+
+        if (frame < POLYPHASE_HISTORY) window = join + frame * 2;
+        else window = in + (frame - POLYPHASE_HISTORY) * 2;
+
+        interpolate_frame(window, c, out + output_frames * 2);
+        output_frames++;
+        position += step;
+    }
+
+    // if the output was cut short, the rest of the packet is dropped, rather than let the
+    // position fall further and further behind
+    if (position > end) resampler->position = position - end;
+    else resampler->position = 0;
+
+    memcpy(resampler->history, in + (frames - POLYPHASE_HISTORY) * 2, sizeof(resampler->history));
+    return output_frames;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A polyphase resampler is a cheap fractional-delay resampler for interleaved stereo int32_t.
+// It plays a stream of packets out at a ratio that can change from packet to packet, so that
+// drift can be corrected continuously instead of a frame at a time.
+// Each output frame is a cubic (Catmull-Rom) interpolation of the four input frames around it,
+// with the coefficients taken from a bank of POLYPHASE_PHASES precomputed fractional delays.
+// The position in the stream carries on from packet to packet, with the last frames of each
+// packet kept to start the next, so there are no edges.
+
+#define POLYPHASE_PHASES_POWER_OF_TWO 10
+#define POLYPHASE_PHASES (1 << POLYPHASE_PHASES_POWER_OF_TWO)
+#define POLYPHASE_HISTORY 3 // the frames carried from one packet to the next
+
+typedef struct polyphase_resampler
+{
+    int32_t history[POLYPHASE_HISTORY * 2];
+    uint64_t position; // of the next output frame, from the first history frame, in frames (Q32)
+    int primed;        // zero until the first packet has filled the history
+} polyphase_resampler;
+
+void polyphase_init(polyphase_resampler * resampler);
+
+// forget the stream -- the next packet starts a new one
+void polyphase_reset(polyphase_resampler * resampler);
+
+// resample frames frames from in to out at ratio output frames per input frame (close to 1),
+// writing no more than maximum_output_frames frames.
+// It returns the number of frames written, which is frames * ratio, give or take a frame,
+// as the position carries on across packets. frames must be at least POLYPHASE_HISTORY.
+size_t polyphase_process(polyphase_resampler * resampler, const int32_t * in, size_t frames,
+                         int32_t * out, double ratio, size_t maximum_output_frames);
@@ -0,0 +1,381 @@
+/*
+ * Block-based sample processing. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Volume, dither, clipping and formatting are done a block at a time: each sample is scaled,
+// dithered and cut to 32 bits, then the block is packed by a packer chosen once per format.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "common.h"
+#include "dither.h"
+#include "process_block.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PROCESS_BLOCK_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PROCESS_BLOCK_NEON 1
+#endif
+
+// the SIMD packers write native-endian words, so they can only stand in for the
+// explicitly little-endian formats on a little-endian host
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define PROCESS_BLOCK_HOST_IS_LITTLE_ENDIAN 1
+#endif
+
+// Pass 1, without dither.
+// The hyper sample is sample * (volume << 16), so its top 32 bits are (sample * volume) >> 16.
+// At unity volume that's just the sample itself.
+
+static void scale_block(const int32_t * inp, int32_t * hi, size_t n, int32_t volume)
+{
+    size_t i = 0;
+
+    if (volume == 0x10000)
+    {
+        memcpy(hi, inp, n * sizeof(int32_t));
+        return;
+    }
+
+#if defined(PROCESS_BLOCK_SSE2)
+    // SSE2 has only an unsigned 32 x 32 -> 64 multiply, so multiply as unsigned and correct
+    // for negative samples afterwards: for a negative sample the unsigned product is too big
+    // by volume << 32, i.e. by volume << 16 once it's been shifted down by 16.
+    // The volume is never negative, so no correction is needed for it.
+    const __m128i vol = _mm_set1_epi32(volume);
+    const __m128i correction = _mm_slli_epi32(vol, 16);
+    const __m128i low_words = _mm_set_epi32(0, -1, 0, -1);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i *)(inp + i));
+        __m128i p02 = _mm_srli_epi64(_mm_mul_epu32(s, vol), 16);
+        __m128i p13 = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(s, 32), vol), 16);
+        __m128i r = _mm_or_si128(_mm_and_si128(p02, low_words), _mm_slli_epi64(p13, 32));
+        r = _mm_sub_epi32(r, _mm_and_si128(_mm_srai_epi32(s, 31), correction));
+        _mm_storeu_si128((__m128i *)(hi + i), r);
+    }
+
+#elif defined(PROCESS_BLOCK_NEON)
+    const int32x2_t vol = vdup_n_s32(volume);
+
+    for (; i + 4 <= n; i += 4)
+    {
+        int32x4_t s = vld1q_s32(inp + i);
+        int32x2_t lo = vshrn_n_s64(vmull_s32(vget_low_s32(s), vol), 16);
+        int32x2_t hi2 = vshrn_n_s64(vmull_s32(vget_high_s32(s), vol), 16);
+        vst1q_s32(hi + i, vcombine_s32(lo, hi2));
+    }
+
+#endif
+
+    for (; i < n; i++) hi[i] = (int32_t)(((int64_t)inp[i] * volume) >> 16);
+}
+
+// Pass 1, with dither.
+// The dither for the block is made in one go, so there are no format decisions and no
+// random number generator calls in the loop.
+
+static void scale_and_dither_block(const int32_t * inp, int32_t * hi, size_t n, int32_t volume,
+                                   int64_t dither_mask, int64_t * previous_random_number)
+{
+    int64_t tpdf[PROCESS_BLOCK_CHUNK];
+    int64_t hyper_volume = (int64_t)volume << 16;
+    size_t i;
+
+    dither_tpdf_block(tpdf, n, dither_mask, previous_random_number);
+
+    for (i = 0; i < n; i++)
+    {
+        int64_t hyper_sample = inp[i] * hyper_volume; // 64 bit multiplication
+
+        // add dither, allowing for clipping
+        if (tpdf[i] >= 0)
+        {
+            if (INT64_MAX - tpdf[i] >= hyper_sample) hyper_sample += tpdf[i];
+            else hyper_sample = INT64_MAX;
+        }
+        else
+        {
+            if (INT64_MIN - tpdf[i] <= hyper_sample) hyper_sample += tpdf[i];
+            else hyper_sample = INT64_MIN;
+        }
+
+        hi[i] = (int32_t)(hyper_sample >> 32);
+    }
+}
+
+// Pass 1, for silence -- the sample is zero, so there is nothing to clip
+
+static void silence_block(int32_t * hi, size_t n, int dither, int64_t dither_mask,
+                          int64_t * previous_random_number)
+{
+    int64_t tpdf[PROCESS_BLOCK_CHUNK];
+    size_t i;
+
+    if (dither == 0)
+    {
+        memset(hi, 0, n * sizeof(int32_t));
+        return;
+    }
+
+    dither_tpdf_block(tpdf, n, dither_mask, previous_random_number);
+
+    for (i = 0; i < n; i++) hi[i] = (int32_t)(tpdf[i] >> 32);
+}
+
+// Pass 2 -- pack the top 32 bits of each hyper sample into the output format.
+// Shifting the top word right by (32 - bits) is the same as shifting the hyper sample
+// right by (64 - bits), which is how the per-sample code did it.
+
+// There is one packer per output format, chosen once per session, so there is no
+// format decision anywhere in the loop. The byte-oriented packers are all generated from
+// this macro; STORE writes one sample "w" to "op".
+
+#define DEFINE_PACKER(name, bytes_per_sample, STORE)                                               \
+    static size_t pack_##name(const int32_t * hi, size_t n, char * outp)                           \
+    {                                                                                              \
+        uint8_t * op = (uint8_t *)outp;                                                            \
+        size_t i;                                                                                  \
+        for (i = 0; i < n; i++)                                                                    \
+        {                                                                                          \
+            int32_t w = hi[i];                                                                     \
+            STORE;                                                                                 \
+            op += bytes_per_sample;                                                                \
+        }                                                                                          \
+        return n * bytes_per_sample;                                                               \
+    }
+
+DEFINE_PACKER(s32_be, 4, op[0] = (uint8_t)(w >> 24); op[1] = (uint8_t)(w >> 16);
+              op[2] = (uint8_t)(w >> 8); op[3] = (uint8_t)w)
+DEFINE_PACKER(s24_be, 4, op[0] = 0; op[1] = (uint8_t)(w >> 24); op[2] = (uint8_t)(w >> 16);
+              op[3] = (uint8_t)(w >> 8))
+DEFINE_PACKER(s24_3le, 3, op[0] = (uint8_t)(w >> 8); op[1] = (uint8_t)(w >> 16);
+              op[2] = (uint8_t)(w >> 24))
+DEFINE_PACKER(s24_3be, 3, op[0] = (uint8_t)(w >> 24); op[1] = (uint8_t)(w >> 16);
+              op[2] = (uint8_t)(w >> 8))
+DEFINE_PACKER(s16_be, 2, op[0] = (uint8_t)(w >> 24); op[1] = (uint8_t)(w >> 16))
+DEFINE_PACKER(s8, 1, op[0] = (uint8_t)(w >> 24))
+DEFINE_PACKER(u8, 1, op[0] = (uint8_t)((w >> 24) + 128))
+
+#ifdef PROCESS_BLOCK_HOST_IS_LITTLE_ENDIAN
+#define pack_s32_le pack_s32
+#define pack_s16_le pack_s16
+#else
+DEFINE_PACKER(s32_le, 4, op[0] = (uint8_t)w; op[1] = (uint8_t)(w >> 8); op[2] = (uint8_t)(w >> 16);
+              op[3] = (uint8_t)(w >> 24))
+DEFINE_PACKER(s16_le, 2, op[0] = (uint8_t)(w >> 16); op[1] = (uint8_t)(w >> 24))
+#endif
+
+// the native-word packers, with SIMD paths where available
+
+static size_t pack_s32(const int32_t * hi, size_t n, char * outp)
+{
+    memcpy(outp, hi, n * 4);
+    return n * 4;
+}
+
+static size_t pack_s24(const int32_t * hi, size_t n, char * outp)
+{
+    int32_t * wp = (int32_t *)outp;
+    size_t i = 0;
+#if defined(PROCESS_BLOCK_SSE2)
+
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128((__m128i *)(wp + i),
+                         _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(hi + i)), 8));
+
+#elif defined(PROCESS_BLOCK_NEON)
+
+    for (; i + 4 <= n; i += 4) vst1q_s32(wp + i, vshrq_n_s32(vld1q_s32(hi + i), 8));
+
+#endif
+
+    for (; i < n; i++) wp[i] = hi[i] >> 8;
+
+    return n * 4;
+}
+
+static size_t pack_s24_le(const int32_t * hi, size_t n, char * outp)
+{
+    uint8_t * op = (uint8_t *)outp;
+    size_t i = 0;
+#if defined(PROCESS_BLOCK_HOST_IS_LITTLE_ENDIAN) && defined(PROCESS_BLOCK_SSE2)
+    const __m128i low_24 = _mm_set1_epi32(0x00FFFFFF);
+
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_si128(
+            (__m128i *)(op + i * 4),
+            _mm_and_si128(_mm_srai_epi32(_mm_loadu_si128((const __m128i *)(hi + i)), 8), low_24));
+
+#elif defined(PROCESS_BLOCK_HOST_IS_LITTLE_ENDIAN) && defined(PROCESS_BLOCK_NEON)
+
+    for (; i + 4 <= n; i += 4)
+        vst1q_u32((uint32_t *)(op + i * 4), vshrq_n_u32(vreinterpretq_u32_s32(vld1q_s32(hi + i)), 8));
+
+#endif
+    op += i * 4;
+
+    for (; i < n; i++)
+    {
+        *op++ = (uint8_t)(hi[i] >> 8);
+        *op++ = (uint8_t)(hi[i] >> 16);
+        *op++ = (uint8_t)(hi[i] >> 24);
+        *op++ = 0;
+    }
+
+    return n * 4;
+}
+
+static size_t pack_s16(const int32_t * hi, size_t n, char * outp)
+{
+    int16_t * sp = (int16_t *)outp;
+    size_t i = 0;
+#if defined(PROCESS_BLOCK_SSE2)
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(hi + i)), 16);
+        __m128i b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(hi + i + 4)), 16);
+        _mm_storeu_si128((__m128i *)(sp + i), _mm_packs_epi32(a, b)); // no saturation can occur
+    }
+
+#elif defined(PROCESS_BLOCK_NEON)
+
+    for (; i + 4 <= n; i += 4) vst1_s16(sp + i, vshrn_n_s32(vld1q_s32(hi + i), 16));
+
+#endif
+
+    for (; i < n; i++) sp[i] = (int16_t)(hi[i] >> 16);
+
+    return n * 2;
+}
+
+static size_t pack_f32(const int32_t * hi, size_t n, char * outp)
+{
+    float * fp = (float *)outp;
+    const float scale = 1.0f / 2147483648.0f; // 2^31 is full scale
+    size_t i = 0;
+#if defined(PROCESS_BLOCK_SSE2)
+    const __m128 scale_4 = _mm_set1_ps(scale);
+
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(fp + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(hi + i))), scale_4));
+
+#elif defined(PROCESS_BLOCK_NEON)
+
+    for (; i + 4 <= n; i += 4) vst1q_f32(fp + i, vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(hi + i)), scale));
+
+#endif
+
+    for (; i < n; i++) fp[i] = (float)hi[i] * scale;
+
+    return n * 4;
+}
+
+// indexed by sps_format_t
+static const process_block_writer process_block_writers[] = {
+    [SPS_FORMAT_S8] = { SPS_FORMAT_S8, 8, 1, pack_s8 },
+    [SPS_FORMAT_U8] = { SPS_FORMAT_U8, 8, 1, pack_u8 },
+    [SPS_FORMAT_S16] = { SPS_FORMAT_S16, 16, 2, pack_s16 },
+    [SPS_FORMAT_S16_LE] = { SPS_FORMAT_S16_LE, 16, 2, pack_s16_le },
+    [SPS_FORMAT_S16_BE] = { SPS_FORMAT_S16_BE, 16, 2, pack_s16_be },
+    [SPS_FORMAT_S24] = { SPS_FORMAT_S24, 24, 4, pack_s24 },
+    [SPS_FORMAT_S24_LE] = { SPS_FORMAT_S24_LE, 24, 4, pack_s24_le },
+    [SPS_FORMAT_S24_BE] = { SPS_FORMAT_S24_BE, 24, 4, pack_s24_be },
+    [SPS_FORMAT_S24_3LE] = { SPS_FORMAT_S24_3LE, 24, 3, pack_s24_3le },
+    [SPS_FORMAT_S24_3BE] = { SPS_FORMAT_S24_3BE, 24, 3, pack_s24_3be },
+    [SPS_FORMAT_S32] = { SPS_FORMAT_S32, 32, 4, pack_s32 },
+    [SPS_FORMAT_S32_LE] = { SPS_FORMAT_S32_LE, 32, 4, pack_s32_le },
+    [SPS_FORMAT_S32_BE] = { SPS_FORMAT_S32_BE, 32, 4, pack_s32_be },
+    // a float has more than enough resolution for what's left of the dither to be insignificant
+    [SPS_FORMAT_F32] = { SPS_FORMAT_F32, 32, 4, pack_f32 },
+};
+
+const process_block_writer * process_block_writer_for_format(sps_format_t format)
+{
+    if ((format >= (sizeof(process_block_writers) / sizeof(process_block_writer))) ||
+        (process_block_writers[format].pack == NULL))
+        die("No output writer for format \"%s\".", sps_format_description_string(format));
+
+    return &process_block_writers[format];
+}
+
+size_t process_block_32(const int32_t * inp, size_t number_of_samples, char * outp,
+                        const process_block_writer * writer, int32_t volume, int dither,
+                        int64_t * previous_random_number)
+{
+    int32_t hi[PROCESS_BLOCK_CHUNK];
+
+    // the TPDF dither spans one least significant bit of the output resolution
+    int64_t dither_mask = ((int64_t)1 << (64 - writer->bits_per_sample)) - 1;
+
+    size_t bytes_written = 0;
+
+    while (number_of_samples)
+    {
+        size_t n = number_of_samples;
+
+        if (n > PROCESS_BLOCK_CHUNK) n = PROCESS_BLOCK_CHUNK;
+
+        if (dither) scale_and_dither_block(inp, hi, n, volume, dither_mask, previous_random_number);
+        else scale_block(inp, hi, n, volume);
+
+        bytes_written += writer->pack(hi, n, outp + bytes_written);
+        inp += n;
+        number_of_samples -= n;
+    }
+
+    return bytes_written;
+}
+
+size_t process_block_silence(size_t number_of_samples, char * outp,
+                             const process_block_writer * writer, int dither,
+                             int64_t * previous_random_number)
+{
+    int32_t hi[PROCESS_BLOCK_CHUNK];
+
+    int64_t dither_mask = ((int64_t)1 << (64 - writer->bits_per_sample)) - 1;
+
+    size_t bytes_written = 0;
+
+    while (number_of_samples)
+    {
+        size_t n = number_of_samples;
+
+        if (n > PROCESS_BLOCK_CHUNK) n = PROCESS_BLOCK_CHUNK;
+
+        silence_block(hi, n, dither, dither_mask, previous_random_number);
+        bytes_written += writer->pack(hi, n, outp + bytes_written);
+        number_of_samples -= n;
+    }
+
+    return bytes_written;
+}
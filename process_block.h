@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+// the number of samples the block kernel works on in one pass of its intermediate buffer
+#define PROCESS_BLOCK_CHUNK 704 // two 352-frame stereo packets
+
+// a writer packs the top 32 bits of each processed sample into one output format
+
+typedef size_t (* process_block_packer)(const int32_t * hi, size_t number_of_samples, char * outp);
+
+typedef struct process_block_writer
+{
+    sps_format_t format;
+    int bits_per_sample;  // the output resolution, which also sets the dither amplitude
+    int bytes_per_sample; // the space one sample occupies in the output
+    process_block_packer pack;
+} process_block_writer;
+
+// look up the writer for a format -- do it once, when the session starts
+// dies if the format can't be written, e.g. SPS_FORMAT_AUTO
+const process_block_writer * process_block_writer_for_format(sps_format_t format);
+
+// this takes an array of interleaved signed 32-bit samples and, for the whole block,
+// (a) multiplies each sample by the volume (a 16.16 fixed-point quantity, 0x10000 is unity),
+// (b) adds TPDF dither, if requested, allowing for clipping,
+// (c) reduces the result to the output size 32/24/16/8 bits and
+// (d) writes the result to outp using the writer for the output format.
+// The dither state is carried between calls in *previous_random_number.
+// It returns the number of bytes written.
+size_t process_block_32(const int32_t * inp, size_t number_of_samples, char * outp,
+                        const process_block_writer * writer, int32_t volume, int dither,
+                        int64_t * previous_random_number);
+
+// this writes number_of_samples samples of silence to outp using the writer for the output
+// format, with TPDF dither if requested, carrying the dither state in *previous_random_number.
+// It returns the number of bytes written.
+size_t process_block_silence(size_t number_of_samples, char * outp,
+                             const process_block_writer * writer, int dither,
+                             int64_t * previous_random_number);
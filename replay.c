@@ -0,0 +1,556 @@
+/*
+ * Replay a captured session through the player. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// The replay stands in for the sender's clock: a sync packet is taken to have been sent when the
+// replay reaches it, and the clock is run faster to replay faster than real time.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "common.h"
+#include "latency_histogram.h"
+#include "player.h"
+#include "replay.h"
+#include "rtp.h"
+#include "rtsp.h"
+#include "zone.h"
+
+#define REPLAY_FAST_SPEED             100.0 // how much faster the clock runs "as fast as possible"
+#define REPLAY_FAST_BUFFER_FILL       64    // and how many packets may be waiting in the buffer
+#define REPLAY_REMOTE_CLOCK_OFFSET_NS ((uint64_t)1000000000) // the remote clock is a second ahead
+#define REPLAY_DRAIN_TIMEOUT_NS       ((uint64_t)10000000000)
+#define REPLAY_MAXIMUM_DATAGRAM       65536
+
+#define PCAP_MAGIC             0xa1b2c3d4
+#define PCAP_MAGIC_NANOSECONDS 0xa1b23c4d
+
+#define PCAP_LINKTYPE_NULL     0
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_LINKTYPE_RAW      101
+#define PCAP_LINKTYPE_LINUX_SLL 113
+#define PCAP_LINKTYPE_IPV4     228
+#define PCAP_LINKTYPE_IPV6     229
+
+typedef struct
+{
+    FILE * file;
+    int is_pcap;
+    int pcap_swapped;     // the file was written on a machine of the other endianness
+    int pcap_nanoseconds; // the timestamps' fraction is in nanoseconds rather than microseconds
+    uint32_t pcap_linktype;
+    char * sdp;           // the session description from a native capture's header
+    uint32_t sdp_length;
+    uint8_t buffer[REPLAY_MAXIMUM_DATAGRAM + 256];
+} replay_source;
+
+typedef struct
+{
+    uint64_t audio_packets;
+    uint64_t resent_packets;
+    uint64_t sync_packets;
+    uint64_t timing_packets;
+    uint64_t other_packets;
+    uint64_t frames_fed; // frames in the audio packets given to the player
+} replay_counts;
+
+static uint32_t replay_read_u32(const uint8_t * p, int swapped)
+{
+    if (swapped) return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t replay_read_u64(const uint8_t * p)
+{
+    return ((uint64_t)replay_read_u32(p, 0) << 32) | replay_read_u32(p + 4, 0);
+}
+
+static int replay_open(replay_source * s, const char * path)
+{
+    uint8_t header[24];
+
+    s->file = fopen(path, "rb");
+
+    if (s->file == NULL) return -1;
+
+    if (fread(header, 1, CAPTURE_MAGIC_LENGTH, s->file) != CAPTURE_MAGIC_LENGTH) return -1;
+
+    if (memcmp(header, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH) == 0)
+    {
+        if (fread(header, 1, 4, s->file) != 4) return -1;
+
+        s->sdp_length = replay_read_u32(header, 0);
+
+        if (s->sdp_length > REPLAY_MAXIMUM_DATAGRAM) return -1;
+
+        s->sdp = malloc(s->sdp_length + 1);
+
+        if ((s->sdp == NULL) || (fread(s->sdp, 1, s->sdp_length, s->file) != s->sdp_length))
+            return -1;
+
+        s->sdp[s->sdp_length] = '\0';
+        return 0;
+    }
+
+    // otherwise, it had better be a pcap file -- the magic number in its own byte order
+    if (fread(header + CAPTURE_MAGIC_LENGTH, 1, 24 - CAPTURE_MAGIC_LENGTH, s->file) !=
+        24 - CAPTURE_MAGIC_LENGTH)
+        return -1;
+
+    uint32_t magic = replay_read_u32(header, 0);
+
+    if ((magic == PCAP_MAGIC) || (magic == PCAP_MAGIC_NANOSECONDS))
+    {
+        s->pcap_swapped = 0;
+    }
+    else
+    {
+        magic = replay_read_u32(header, 1);
+
+        if ((magic != PCAP_MAGIC) && (magic != PCAP_MAGIC_NANOSECONDS)) return -1;
+
+        s->pcap_swapped = 1;
+    }
+
+    s->is_pcap = 1;
+    s->pcap_nanoseconds = (magic == PCAP_MAGIC_NANOSECONDS);
+    s->pcap_linktype = replay_read_u32(header + 20, s->pcap_swapped) & 0xffff;
+    return 0;
+}
+
+// find the UDP payload in a captured frame, or return NULL
+static uint8_t * replay_pcap_udp_payload(replay_source * s, uint8_t * frame, size_t length,
+                                         size_t * payload_length)
+{
+    size_t offset = 0;
+    int ip_version = 0;
+
+    switch (s->pcap_linktype)
+    {
+        case PCAP_LINKTYPE_NULL:
+            offset = 4;
+            break;
+
+        case PCAP_LINKTYPE_ETHERNET:
+        {
+            offset = 12;
+
+            // skip any VLAN tags
+            while ((offset + 2 <= length) &&
+                   (((frame[offset] << 8) | frame[offset + 1]) == 0x8100))
+                offset += 4;
+
+            offset += 2;
+        }
+            break;
+
+        case PCAP_LINKTYPE_LINUX_SLL:
+            offset = 16;
+            break;
+
+        case PCAP_LINKTYPE_RAW:
+        case PCAP_LINKTYPE_IPV4:
+        case PCAP_LINKTYPE_IPV6:
+            offset = 0;
+            break;
+
+        default:
+            return NULL;
+    }
+
+    if (offset >= length) return NULL;
+
+    ip_version = frame[offset] >> 4;
+
+    if (ip_version == 4)
+    {
+        size_t header_length = (frame[offset] & 0x0f) * 4;
+
+        if ((offset + 20 > length) || (frame[offset + 9] != 17)) return NULL; // not UDP
+
+        // fragments aren't reassembled
+        if ((((frame[offset + 6] << 8) | frame[offset + 7]) & 0x3fff) != 0) return NULL;
+
+        offset += header_length;
+    }
+    else if (ip_version == 6)
+    {
+        // extension headers aren't followed
+        if ((offset + 40 > length) || (frame[offset + 6] != 17)) return NULL;
+
+        offset += 40;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    if (offset + 8 > length) return NULL;
+
+    size_t udp_length = (frame[offset + 4] << 8) | frame[offset + 5];
+
+    if ((udp_length < 8) || (offset + udp_length > length)) udp_length = length - offset;
+
+    *payload_length = udp_length - 8;
+    return frame + offset + 8;
+}
+
+// get the next datagram -- returns 1 if there is one, 0 at the end and -1 on error
+static int replay_next(replay_source * s, capture_source * source, uint64_t * arrival_time,
+                       uint8_t * * datagram, size_t * length)
+{
+    uint8_t header[16];
+
+    while (1)
+    {
+        if (s->is_pcap == 0)
+        {
+            size_t n = fread(header, 1, CAPTURE_RECORD_HEADER_LENGTH, s->file);
+
+            if (n == 0) return 0;
+
+            if (n != CAPTURE_RECORD_HEADER_LENGTH) return -1;
+
+            *source = header[0];
+            *length = (header[2] << 8) | header[3];
+            *arrival_time = replay_read_u64(header + 4);
+
+            if (fread(s->buffer, 1, *length, s->file) != *length) return -1;
+
+            *datagram = s->buffer;
+            return 1;
+        }
+        else
+        {
+            size_t n = fread(header, 1, 16, s->file);
+
+            if (n == 0) return 0;
+
+            if (n != 16) return -1;
+
+            uint64_t seconds = replay_read_u32(header, s->pcap_swapped);
+            uint64_t fraction = replay_read_u32(header + 4, s->pcap_swapped);
+            uint32_t captured_length = replay_read_u32(header + 8, s->pcap_swapped);
+
+            if (captured_length > sizeof(s->buffer)) return -1;
+
+            if (fread(s->buffer, 1, captured_length, s->file) != captured_length) return -1;
+
+            *arrival_time = seconds * 1000000000 + (s->pcap_nanoseconds ? fraction : fraction * 1000);
+            *datagram = replay_pcap_udp_payload(s, s->buffer, captured_length, length);
+
+            // a pcap capture has no sources, so they're worked out from the payload types --
+            // anything else, e.g. requests going the other way, is skipped
+            if ((*datagram) && (*length >= 4))
+            {
+                uint8_t type = (*datagram)[1] & ~0x80;
+
+                if (type == 0x60)
+                {
+                    *source = capture_source_audio;
+                    return 1;
+                }
+
+                if ((type == 0x54) || (type == 0x56))
+                {
+                    *source = capture_source_control;
+                    return 1;
+                }
+
+                if (type == 0x53)
+                {
+                    *source = capture_source_timing;
+                    return 1;
+                }
+            }
+        }
+    }
+}
+
+static char * replay_read_file(const char * path, int * length)
+{
+    FILE * f = fopen(path, "rb");
+
+    if (f == NULL) return NULL;
+
+    char * text = malloc(REPLAY_MAXIMUM_DATAGRAM + 1);
+
+    if (text)
+    {
+        *length = fread(text, 1, REPLAY_MAXIMUM_DATAGRAM, f);
+        text[*length] = '\0';
+    }
+
+    fclose(f);
+    return text;
+}
+
+static void replay_audio_packet(rtsp_conn_info * conn, uint8_t * packet, size_t length,
+                                replay_counts * counts)
+{
+    if (length < 12 + 16) return;
+
+    player_packet p;
+    p.seqno = nctohs(packet + 2);
+    p.timestamp = nctohl(packet + 4);
+    p.data = packet + 12;
+    p.length = length - 12;
+    p.arrival_time = latency_histogram_time_now();
+    player_put_packets(&p, 1, conn);
+    counts->frames_fed += conn->max_frames_per_packet;
+}
+
+// use a sync packet as the RTP receiver would, taking it to have been sent at remote_time
+static void replay_sync_packet(rtsp_conn_info * conn, uint8_t * packet, size_t length,
+                               uint64_t remote_time)
+{
+    if (length < 20) return;
+
+    rtp_sync_packet_process(conn, packet, remote_time);
+}
+
+static int replay_buffer_fill(rtsp_conn_info * conn)
+{
+    debug_mutex_lock(&conn->ab_mutex, 30000, 0);
+    int fill = conn->ab_synced ? (uint16_t)(conn->ab_write - conn->ab_read) : 0;
+    debug_mutex_unlock(&conn->ab_mutex, 0);
+    return fill;
+}
+
+static void replay_report(rtsp_conn_info * conn, replay_counts * counts, uint64_t elapsed_ns,
+                          struct rusage * usage_before)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    double elapsed = elapsed_ns * 0.000000001;
+    double user = (usage.ru_utime.tv_sec - usage_before->ru_utime.tv_sec) +
+        (usage.ru_utime.tv_usec - usage_before->ru_utime.tv_usec) * 0.000001;
+    double system = (usage.ru_stime.tv_sec - usage_before->ru_stime.tv_sec) +
+        (usage.ru_stime.tv_usec - usage_before->ru_stime.tv_usec) * 0.000001;
+    // what's measured is what reached the backend -- frames fed but dropped don't count
+    uint64_t frames = conn->frames_played;
+    unsigned int rate = conn->zone->output_rate ? conn->zone->output_rate : conn->input_rate;
+    double audio_seconds = rate ? (1.0 * frames) / rate : 0.0;
+
+    printf("packets: %" PRIu64 " audio, %" PRIu64 " resent, %" PRIu64 " sync, %" PRIu64
+           " timing (not used), %" PRIu64 " other.\n",
+           counts->audio_packets, counts->resent_packets, counts->sync_packets,
+           counts->timing_packets, counts->other_packets);
+    printf("missing packets: %" PRIu64 ", late: %" PRIu64 ", too late: %" PRIu64 ".\n",
+           conn->missing_packets, conn->late_packets, conn->too_late_packets);
+    printf("frames: %" PRIu64 " played, of %" PRIu64 " fed (%.1f seconds of audio) in %.3f seconds -- "
+           "%.0f frames per second, %.2f times real time.\n",
+           frames, counts->frames_fed, audio_seconds, elapsed, elapsed > 0.0 ? frames / elapsed : 0.0,
+           elapsed > 0.0 ? audio_seconds / elapsed : 0.0);
+    printf("cpu: %.3f seconds user, %.3f seconds system -- %.1f%% of one cpu.\n", user, system,
+           elapsed > 0.0 ? 100.0 * (user + system) / elapsed : 0.0);
+
+    // the stages that do the work on the player thread are, in effect, its cpu usage
+    int stage;
+
+    for (stage = 0; stage < LH_stage_count; stage++)
+    {
+        uint64_t count, total_ns, maximum_ns;
+        latency_histogram_summary(stage, &count, &total_ns, &maximum_ns);
+
+        if (count)
+            printf("%-16s %10" PRIu64 " times, total %10.3f ms, mean %9.1f us, max %9.1f us.\n",
+                   latency_stage_name(stage), count, total_ns * 0.000001,
+                   (total_ns * 0.001) / count, maximum_ns * 0.001);
+    }
+
+    char * histograms = latency_histograms_as_string();
+
+    if (histograms)
+    {
+        printf("%s\n", histograms);
+        free(histograms);
+    }
+}
+
+int replay_main(const char * capture_path, const char * sdp_path, double speed)
+{
+    replay_source * source = calloc(1, sizeof(replay_source));
+    replay_counts counts;
+    char * sdp = NULL;
+    int sdp_length = 0;
+
+    memset(&counts, 0, sizeof(counts));
+
+    if (source == NULL) die("Can't allocate memory for the replay.");
+
+    if (replay_open(source, capture_path) != 0)
+    {
+        warn("Can't read \"%s\" as a capture or a pcap file.", capture_path);
+        return EXIT_FAILURE;
+    }
+
+    if (source->sdp)
+    {
+        sdp = source->sdp;
+        sdp_length = source->sdp_length;
+    }
+    else if (sdp_path)
+    {
+        sdp = replay_read_file(sdp_path, &sdp_length);
+    }
+
+    if (sdp == NULL)
+    {
+        warn("A session description is needed to replay \"%s\" -- give one with --replay-sdp.",
+             capture_path);
+        return EXIT_FAILURE;
+    }
+
+    rtsp_conn_info * conn = calloc(1, sizeof(rtsp_conn_info));
+
+    if (conn == NULL) die("Can't allocate memory for the replay's session.");
+
+    conn->zone = &zones[0]; // it's played in the first zone
+    rtsp_conn_initialise_locks(conn);
+    rtp_initialise(conn);
+
+    if (pthread_mutex_init(&conn->watchdog_mutex, NULL))
+        die("Can't initialise the replay's watchdog_mutex.");
+
+    if (rtsp_parse_announce_sdp(conn, sdp, sdp_length) != 0)
+    {
+        warn("The session description of \"%s\" can't be used.", capture_path);
+        return EXIT_FAILURE;
+    }
+
+    // there's no one to ask to resend anything
+    config.disable_resend_requests = 1;
+    latency_histograms_enabled = 1;
+
+    double clock_speed = speed > 0.0 ? speed : REPLAY_FAST_SPEED;
+    uint64_t start_time = get_absolute_time_in_ns();
+    struct rusage usage_before;
+    getrusage(RUSAGE_SELF, &usage_before);
+
+    // the remote clock runs clock_speed times faster than the local one, starting now
+    conn->local_to_remote_time_difference = REPLAY_REMOTE_CLOCK_OFFSET_NS;
+    conn->local_to_remote_time_difference_measurement_time = start_time;
+    conn->local_to_remote_time_gradient = clock_speed;
+
+    conn->zone->playing_conn = conn;
+    player_play(conn);
+
+    capture_source kind;
+    uint64_t arrival_time, first_arrival_time = 0;
+    uint8_t * datagram;
+    size_t length;
+    int r;
+
+    while ((r = replay_next(source, &kind, &arrival_time, &datagram, &length)) == 1)
+    {
+        if (first_arrival_time == 0) first_arrival_time = arrival_time;
+
+        uint64_t offset = arrival_time > first_arrival_time ? arrival_time - first_arrival_time : 0;
+
+        if (speed > 0.0)
+        {
+            uint64_t due_time = start_time + (uint64_t)(offset / clock_speed);
+            uint64_t time_now = get_absolute_time_in_ns();
+
+            if (due_time > time_now) usleep((due_time - time_now) / 1000);
+        }
+        else
+        {
+            // don't get too far ahead of the player
+            while (replay_buffer_fill(conn) >= REPLAY_FAST_BUFFER_FILL)
+                usleep(1000);
+        }
+
+        if ((length >= 4) && (kind == capture_source_audio) && ((datagram[1] & ~0x80) == 0x60))
+        {
+            counts.audio_packets++;
+            replay_audio_packet(conn, datagram, length, &counts);
+        }
+        else if ((length >= 4) && (kind == capture_source_control) && (datagram[1] == 0xd4))
+        {
+            counts.sync_packets++;
+            replay_sync_packet(conn, datagram, length,
+                               start_time + REPLAY_REMOTE_CLOCK_OFFSET_NS + offset);
+        }
+        else if ((length >= 8) && (kind == capture_source_control) && (datagram[1] == 0xd6))
+        {
+            counts.resent_packets++;
+            replay_audio_packet(conn, datagram + 4, length - 4, &counts);
+        }
+        else if (kind == capture_source_timing)
+        {
+            counts.timing_packets++;
+        }
+        else
+        {
+            counts.other_packets++;
+        }
+    }
+
+    if (r < 0) warn("The capture \"%s\" is damaged or truncated -- replaying what was read.",
+                    capture_path);
+
+    // let the player play out what's in the buffer
+    uint64_t drain_start_time = get_absolute_time_in_ns();
+
+    while ((replay_buffer_fill(conn) > 0) &&
+           (get_absolute_time_in_ns() - drain_start_time < REPLAY_DRAIN_TIMEOUT_NS))
+        usleep(1000);
+
+    uint64_t elapsed = get_absolute_time_in_ns() - start_time;
+
+    player_stop(conn);
+    conn->zone->playing_conn = NULL;
+    replay_report(conn, &counts, elapsed, &usage_before);
+
+    // as fast as possible is only as fast as the player kept up -- if it dropped anything, the
+    // clock ran too fast for it and the figures above overstate what it can do
+    int result = EXIT_SUCCESS;
+
+    if ((speed <= 0.0) && (conn->missing_packets + conn->too_late_packets))
+    {
+        warn("The player couldn't keep up with the replay at %.0f times real time -- %" PRIu64
+             " packets were dropped. Give a slower --replay-speed.",
+             clock_speed, conn->missing_packets + conn->too_late_packets);
+        result = EXIT_FAILURE;
+    }
+
+    fclose(source->file);
+    free(source->sdp);
+
+    if (sdp != source->sdp) free(sdp);
+
+    free(source);
+    return result;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// replay a captured session -- a native capture or a pcap file -- through the player and the
+// selected backend, and report how fast it went. A speed of 1.0 is real time and 0 is as fast as
+// possible -- and fails if the player drops packets because it can't keep up. The SDP file gives
+// the session description for a pcap capture. Returns an exit code.
+int replay_main(const char * capture_path, const char * sdp_path, double speed);
@@ -25,10 +25,18 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for recvmmsg
+#endif
+
 #include "rtp.h"
+#include "capture.h"
 #include "common.h"
+#include "latency_histogram.h"
 #include "player.h"
 #include "rtsp.h"
+#include "trace.h"
+#include "zone.h"
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -37,6 +45,7 @@
 #include <memory.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -57,6 +66,128 @@ typedef struct Nvll nvll;
 uint64_t local_to_remote_time_jitter;
 uint64_t local_to_remote_time_jitter_count;
 
+// the receivers take up to this many datagrams from a socket each time they wake up
+#define RTP_RECEIVE_BATCH 16
+#define RTP_PACKET_SIZE   2048
+
+// wait for a datagram on fd and take up to count - 1 more, if they are already waiting.
+// Returns the number of datagrams received, with their lengths in lengths[], or -1 on error.
+static int rtp_receive_batch(int fd, uint8_t (* buffers)[RTP_PACKET_SIZE], ssize_t * lengths, int count)
+{
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr messages[RTP_RECEIVE_BATCH];
+    struct iovec iovecs[RTP_RECEIVE_BATCH];
+    int i;
+
+    if (count > RTP_RECEIVE_BATCH) count = RTP_RECEIVE_BATCH;
+
+    memset(messages, 0, sizeof(messages[0]) * count);
+
+    for (i = 0; i < count; i++)
+    {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = RTP_PACKET_SIZE;
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // MSG_WAITFORONE blocks for the first datagram only
+    int received = recvmmsg(fd, messages, count, MSG_WAITFORONE, NULL);
+
+    for (i = 0; i < received; i++)
+        lengths[i] = messages[i].msg_len;
+
+    return received;
+#else
+    // without recvmmsg, e.g. on older BSDs, drain the socket without blocking after the first
+    ssize_t nread = recv(fd, buffers[0], RTP_PACKET_SIZE, 0);
+
+    if (nread < 0) return -1;
+
+    lengths[0] = nread;
+    int received = 1;
+
+    while (received < count)
+    {
+        nread = recv(fd, buffers[received], RTP_PACKET_SIZE, MSG_DONTWAIT);
+
+        if (nread < 0) break;
+
+        lengths[received++] = nread;
+    }
+
+    return received;
+#endif
+}
+
+// ask the kernel to timestamp each datagram as it arrives on fd, so that the time a timing reply
+// spends waiting for the receiver thread to be scheduled isn't counted in its round-trip time
+static void rtp_enable_receive_timestamps(int fd)
+{
+#if defined(SO_TIMESTAMPNS) && defined(COMPILE_FOR_LINUX_AND_FREEBSD_AND_CYGWIN_AND_OPENBSD)
+    int on = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+        debug(1, "Can't enable kernel receive timestamps -- arrival times will be taken on reception.");
+
+#else
+    (void)fd;
+#endif
+}
+
+// receive a datagram from fd and the time it arrived, on the get_absolute_time_in_ns() clock.
+// The time is the kernel's timestamp if there is one, or else the time now.
+static ssize_t rtp_receive_timestamped(int fd, uint8_t * buffer, size_t size, uint64_t * arrival_time)
+{
+#if defined(SO_TIMESTAMPNS) && defined(COMPILE_FOR_LINUX_AND_FREEBSD_AND_CYGWIN_AND_OPENBSD)
+    struct iovec iov;
+    struct msghdr message;
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t nread = recvmsg(fd, &message, 0);
+
+    if (nread < 0) return nread;
+
+    uint64_t time_now = get_absolute_time_in_ns();
+    *arrival_time = time_now;
+
+    struct cmsghdr * cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+        {
+            // the kernel stamp is on CLOCK_REALTIME -- take how long ago it was on that clock
+            // and go back that far on CLOCK_MONOTONIC
+            struct timespec stamp, realtime_now;
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            clock_gettime(CLOCK_REALTIME, &realtime_now);
+            int64_t age = (int64_t)(realtime_now.tv_sec - stamp.tv_sec) * 1000000000 +
+                          (realtime_now.tv_nsec - stamp.tv_nsec);
+
+            // ignore it if the wall clock has been stepped in the meantime
+            if ((age >= 0) && (age < 1000000000)) *arrival_time = time_now - age;
+
+            break;
+        }
+    }
+
+    return nread;
+#else
+    ssize_t nread = recv(fd, buffer, size, 0);
+    *arrival_time = get_absolute_time_in_ns();
+    return nread;
+#endif
+}
+
 void rtp_initialise(rtsp_conn_info * conn)
 {
     conn->rtp_time_of_last_resend_request_error_ns = 0;
@@ -102,68 +233,90 @@ uint64_t local_to_remote_time_difference_now(rtsp_conn_info * conn)
     return result;
 }
 
-void rtp_audio_receiver_cleanup_handler(__attribute__((unused)) void * arg)
-{
-    debug(3, "Audio Receiver Cleanup Done.");
-}
-
-void * rtp_audio_receiver(void * arg)
+// the audio receiver's record of the packets it has seen
+typedef struct
 {
-    pthread_cleanup_push(rtp_audio_receiver_cleanup_handler, arg);
-    rtsp_conn_info * conn = (rtsp_conn_info *)arg;
-
-    int32_t last_seqno = -1;
-    uint8_t packet[2048], * pktp;
-
-    uint64_t time_of_previous_packet_ns = 0;
-    float longest_packet_time_interval_us = 0.0;
+    int32_t last_seqno;
+    uint64_t time_of_previous_packet_ns;
+    float longest_packet_time_interval_us;
 
     // mean and variance calculations from "online_variance" algorithm at
     // https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Online_algorithm
 
-    int32_t stat_n = 0;
-    float stat_mean = 0.0;
-    float stat_M2 = 0.0;
+    int32_t stat_n;
+    float stat_mean;
+    float stat_M2;
+
+    int frame_count;
+} rtp_audio_state;
+
+static void rtp_audio_state_init(rtp_audio_state * state)
+{
+    memset(state, 0, sizeof(*state));
+    state->last_seqno = -1;
+}
 
-    int frame_count = 0;
+// take the datagrams waiting on the audio socket
+static void rtp_audio_receive(rtsp_conn_info * conn, rtp_audio_state * state)
+{
+    uint8_t packets[RTP_RECEIVE_BATCH][RTP_PACKET_SIZE], * pktp;
+    ssize_t lengths[RTP_RECEIVE_BATCH];
+    player_packet batch[RTP_RECEIVE_BATCH];
     ssize_t nread;
 
-    while (1)
+    // take the datagram that woke us and any others that are waiting with it
+    int received = rtp_receive_batch(conn->audio_socket, packets, lengths, RTP_RECEIVE_BATCH);
+    int batched = 0;
+    int datagram;
+
+    if (received < 0)
+    {
+        debug(1, "Error receiving an audio packet.");
+        return;
+    }
+
+    // they're all taken to have arrived now -- any after the first count as arriving
+    // at no interval after it
+    uint64_t local_time_now_ns = get_absolute_time_in_ns();
+
+    for (datagram = 0; datagram < received; datagram++)
     {
-        nread = recv(conn->audio_socket, packet, sizeof(packet), 0);
+        uint8_t * packet = packets[datagram];
+        nread = lengths[datagram];
 
-        frame_count++;
+        if (conn->capture)
+            capture_datagram(conn->capture, capture_source_audio, packet, nread, local_time_now_ns);
 
-        uint64_t local_time_now_ns = get_absolute_time_in_ns();
+        state->frame_count++;
 
-        if (time_of_previous_packet_ns)
+        if (state->time_of_previous_packet_ns)
         {
-            float time_interval_us = (local_time_now_ns - time_of_previous_packet_ns) * 0.001;
-            time_of_previous_packet_ns = local_time_now_ns;
+            float time_interval_us = (local_time_now_ns - state->time_of_previous_packet_ns) * 0.001;
+            state->time_of_previous_packet_ns = local_time_now_ns;
 
-            if (time_interval_us > longest_packet_time_interval_us) longest_packet_time_interval_us = time_interval_us;
+            if (time_interval_us > state->longest_packet_time_interval_us) state->longest_packet_time_interval_us = time_interval_us;
 
-            stat_n += 1;
-            float stat_delta = time_interval_us - stat_mean;
-            stat_mean += stat_delta / stat_n;
-            stat_M2 += stat_delta * (time_interval_us - stat_mean);
+            state->stat_n += 1;
+            float stat_delta = time_interval_us - state->stat_mean;
+            state->stat_mean += stat_delta / state->stat_n;
+            state->stat_M2 += stat_delta * (time_interval_us - state->stat_mean);
 
-            if (stat_n % 2500 == 0)
+            if (state->stat_n % 2500 == 0)
             {
                 debug(2,
                       "Packet reception interval stats: mean, standard deviation and max for the last "
                       "2,500 packets in microseconds: %10.1f, %10.1f, %10.1f.",
-                      stat_mean, sqrtf(stat_M2 / (stat_n - 1)), longest_packet_time_interval_us);
-                stat_n = 0;
-                stat_mean = 0.0;
-                stat_M2 = 0.0;
-                time_of_previous_packet_ns = 0;
-                longest_packet_time_interval_us = 0.0;
+                      state->stat_mean, sqrtf(state->stat_M2 / (state->stat_n - 1)), state->longest_packet_time_interval_us);
+                state->stat_n = 0;
+                state->stat_mean = 0.0;
+                state->stat_M2 = 0.0;
+                state->time_of_previous_packet_ns = 0;
+                state->longest_packet_time_interval_us = 0.0;
             }
         }
         else
         {
-            time_of_previous_packet_ns = local_time_now_ns;
+            state->time_of_previous_packet_ns = local_time_now_ns;
         }
 
         if (nread >= 0)
@@ -182,7 +335,7 @@ void * rtp_audio_receiver(void * arg)
                 }
 
                 seq_t seqno = ntohs(*(uint16_t *)(pktp + 2));
-                // increment last_seqno and see if it's the same as the incoming seqno
+                // increment state->last_seqno and see if it's the same as the incoming seqno
 
                 if (type == 0x60) // regular audio data
                 /*
@@ -197,19 +350,15 @@ void * rtp_audio_receiver(void * arg)
                    debug(1,"Audio Packet Received: \"%s\"",obf);
                  */
                 {
-                    if (last_seqno == -1) last_seqno = seqno;
+                    if (state->last_seqno == -1) state->last_seqno = seqno;
                     else
                     {
-                        last_seqno = (last_seqno + 1) & 0xffff;
-                        // if (seqno != last_seqno)
-                        //  debug(3, "RTP: Packets out of sequence: expected: %d, got %d.", last_seqno, seqno);
-                        last_seqno = seqno; // reset warning...
+                        state->last_seqno = (state->last_seqno + 1) & 0xffff;
+                        // if (seqno != state->last_seqno)
+                        //  debug(3, "RTP: Packets out of sequence: expected: %d, got %d.", state->last_seqno, seqno);
+                        state->last_seqno = seqno; // reset warning...
                     }
                 }
-                else
-                {
-                    debug(3, "Audio Receiver -- Retransmitted Audio Data Packet %u received.", seqno);
-                }
 
                 uint32_t actual_timestamp = ntohl(*(uint32_t *)(pktp + 4));
 
@@ -226,7 +375,19 @@ void * rtp_audio_receiver(void * arg)
                 if (plen >= 16)
                 {
                     if ((config.diagnostic_drop_packet_fraction == 0.0) ||
-                        (drand48() > config.diagnostic_drop_packet_fraction)) player_put_packet(seqno, actual_timestamp, pktp, plen, conn);
+                        (drand48() > config.diagnostic_drop_packet_fraction))
+                    {
+                        batch[batched].seqno = seqno;
+                        batch[batched].timestamp = actual_timestamp;
+                        batch[batched].data = pktp;
+                        batch[batched].length = plen;
+                        batch[batched].arrival_time = local_time_now_ns;
+                        batched++;
+
+                        if ((config.adaptive_latency) && (type == 0x60))
+                            adaptive_latency_note_arrival(&conn->adaptive, actual_timestamp, local_time_now_ns);
+                        trace(TR_audio_packet, seqno, actual_timestamp, plen, type != 0x60);
+                    }
                     else debug(3, "Dropping audio packet %u to simulate a bad connection.", seqno);
 
                     continue;
@@ -244,291 +405,314 @@ void * rtp_audio_receiver(void * arg)
 
             warn("Audio receiver -- Unknown RTP packet of type 0x%02X length %d.", type, nread);
         }
+    }
+
+    // store the batch and check for missing packets with one taking of the buffer lock
+    if (batched) player_put_packets(batch, batched, conn);
+}
+
+// take the latency and the reference timestamp and time from a sync packet whose remote time,
+// in nanoseconds, has been worked out
+void rtp_sync_packet_process(rtsp_conn_info * conn, const uint8_t * packet,
+                             uint64_t remote_time_of_sync)
+{
+    uint32_t sync_rtp_timestamp = nctohl(&packet[16]);
+    uint32_t rtp_timestamp_less_latency = nctohl(&packet[4]);
+    trace(TR_sync_packet, rtp_timestamp_less_latency,
+          (uint32_t)(sync_rtp_timestamp - rtp_timestamp_less_latency), nctohs(&packet[2]), 0);
+
+    // debug(1,"Sync timestamp is %u.",ntohl(*((uint32_t *)&packet[16])));
+
+    if (config.userSuppliedLatency)
+    {
+        if (config.userSuppliedLatency != conn->latency)
+        {
+            debug(1, "Using the user-supplied latency: %" PRIu32 ".",
+                  config.userSuppliedLatency);
+        }
+
+        conn->latency = config.userSuppliedLatency;
+    }
+    else
+    {
+        // It seems that the second pair of bytes in the packet indicate whether a fixed
+        // delay of 11,025 frames should be added -- iTunes set this field to 7 and
+        // AirPlay sets it to 4.
+
+        // However, on older versions of AirPlay, the 11,025 frames seem to be necessary too
+
+        // The value of 11,025 (0.25 seconds) is a guess based on the "Audio-Latency"
+        // parameter
+        // returned by an AE.
+
+        // Sigh, it would be nice to have a published protocol...
+
+        uint16_t flags = nctohs(&packet[2]);
+        uint32_t la = sync_rtp_timestamp - rtp_timestamp_less_latency; // note, this might
+                                                                       // loop around in
+                                                                       // modulo. Not sure if
+                                                                       // you'll get an error!
+        // debug(3, "Latency derived just from the sync packet is %" PRIu32 " frames.", la);
+
+        if ((flags == 7) || ((conn->AirPlayVersion > 0) && (conn->AirPlayVersion <= 353)) ||
+            ((conn->AirPlayVersion > 0) && (conn->AirPlayVersion >= 371)))
+        {
+            la += config.fixedLatencyOffset;
+            // debug(3, "A fixed latency offset of %d frames has been added, giving a latency of
+            // "
+            //         "%" PRId64
+            //         " frames with flags: %d and AirPlay version %d (triggers if 353 or
+            //         less).",
+            //      config.fixedLatencyOffset, la, flags, conn->AirPlayVersion);
+        }
+
+        if ((conn->maximum_latency) && (conn->maximum_latency < la)) la = conn->maximum_latency;
+
+        if ((conn->minimum_latency) && (conn->minimum_latency > la)) la = conn->minimum_latency;
+
+        const uint32_t max_frames = ((3 * conn->buffer_frames * 352) / 4) - 11025;
+
+        if (la > max_frames)
+        {
+            warn("An out-of-range latency request of %" PRIu32
+                 " frames was ignored. Must be %" PRIu32
+                 " frames or less (44,100 frames per second). "
+                 "Latency remains at %" PRIu32 " frames.",
+                 la, max_frames, conn->latency);
+        }
         else
         {
-            debug(1, "Error receiving an audio packet.");
+            if (config.adaptive_latency)
+            {
+                // the player takes packets this far ahead of their time, and a
+                // missing one must be noticed and sent again before then
+                uint64_t resend_response_time =
+                    player_resend_response_time(conn, get_absolute_time_in_ns());
+                double headroom = conn->zone->audio_backend_buffer_desired_length +
+                                  config.resend_control_first_check_time +
+                                  2 * resend_response_time * 0.000000001;
+
+                if (conn->zone->audio_backend_latency_offset < 0.0)
+                    headroom -= conn->zone->audio_backend_latency_offset;
+
+                uint32_t sender_latency = la;
+                la = adaptive_latency_update(
+                    &conn->adaptive, la, conn->minimum_latency, headroom,
+                    conn->missing_packets + conn->too_late_packets,
+                    conn->late_packets + conn->resend_requests, get_absolute_time_in_ns());
+
+                if ((la > conn->latency) && (conn->latency < sender_latency))
+                    debug(2,
+                          "Connection %d: adaptive latency backing off to %" PRIu32
+                          " frames, from %" PRIu32 ", of the %" PRIu32 " asked for.",
+                          conn->connection_number, la, conn->latency, sender_latency);
+            }
+
+            if (la != conn->latency)
+            {
+                conn->latency = la;
+                debug(3,
+                      "New latency detected: %" PRIu32 ", sync latency: %" PRIu32
+                      ", minimum latency: %" PRIu32 ", maximum "
+                      "latency: %" PRIu32 ", fixed offset: %" PRIu32 ".",
+                      la, sync_rtp_timestamp - rtp_timestamp_less_latency, conn->minimum_latency,
+                      conn->maximum_latency, config.fixedLatencyOffset);
+            }
         }
     }
 
-    /*
-       debug(3, "Audio receiver -- Server RTP thread interrupted. terminating.");
-       close(conn->audio_socket);
-     */
+    debug_mutex_lock(&conn->reference_time_mutex, 1000, 0);
 
-    debug(1, "Audio receiver thread \"normal\" exit -- this can't happen. Hah!");
-    pthread_cleanup_pop(0); // don't execute anything here.
-    debug(2, "Audio receiver thread exit.");
-    pthread_exit(NULL);
-}
+    if (conn->initial_reference_time == 0)
+    {
+        if (conn->packet_count_since_flush > 0)
+        {
+            conn->initial_reference_time = remote_time_of_sync;
+            conn->initial_reference_timestamp = sync_rtp_timestamp;
+        }
+    }
+    else
+    {
+        uint64_t remote_frame_time_interval =
+            conn->remote_reference_timestamp_time -
+            conn->initial_reference_time; // here, this should never be zero
 
-void rtp_control_handler_cleanup_handler(__attribute__((unused)) void * arg)
-{
-    debug(3, "Control Receiver Cleanup Done.");
+        if (remote_frame_time_interval)
+        {
+            conn->remote_frame_rate =
+                (1.0E9 * (conn->reference_timestamp - conn->initial_reference_timestamp)) /
+                remote_frame_time_interval;
+        }
+        else
+        {
+            conn->remote_frame_rate = 0.0; // use as a flag.
+        }
+    }
+
+    // this is for debugging
+    uint64_t old_remote_reference_time = conn->remote_reference_timestamp_time;
+    uint32_t old_reference_timestamp = conn->reference_timestamp;
+    // int64_t old_latency_delayed_timestamp = conn->latency_delayed_timestamp;
+
+    conn->remote_reference_timestamp_time = remote_time_of_sync;
+    // conn->reference_timestamp_time =
+    //    remote_time_of_sync - local_to_remote_time_difference_now(conn);
+    conn->reference_timestamp = sync_rtp_timestamp;
+    conn->latency_delayed_timestamp = rtp_timestamp_less_latency;
+    debug_mutex_unlock(&conn->reference_time_mutex, 0);
+
+    conn->reference_to_previous_time_difference =
+        remote_time_of_sync - old_remote_reference_time;
+
+    if (old_reference_timestamp == 0) conn->reference_to_previous_frame_difference = 0;
+    else conn->reference_to_previous_frame_difference =
+            sync_rtp_timestamp - old_reference_timestamp;
 }
 
-void * rtp_control_receiver(void * arg)
+// take the datagrams waiting on the control socket
+static void rtp_control_receive(rtsp_conn_info * conn)
 {
-    pthread_cleanup_push(rtp_control_handler_cleanup_handler, arg);
-    rtsp_conn_info * conn = (rtsp_conn_info *)arg;
-
-    conn->reference_timestamp = 0; // nothing valid received yet
-    uint8_t packet[2048], * pktp;
-    // struct timespec tn;
+    uint8_t packets[RTP_RECEIVE_BATCH][RTP_PACKET_SIZE], * pktp;
+    ssize_t lengths[RTP_RECEIVE_BATCH];
+    player_packet batch[RTP_RECEIVE_BATCH];
     uint64_t remote_time_of_sync;
-    uint32_t sync_rtp_timestamp;
     ssize_t nread;
 
-    while (1)
+    int received = rtp_receive_batch(conn->control_socket, packets, lengths, RTP_RECEIVE_BATCH);
+    int batched = 0;
+    int datagram;
+
+    if (received < 0)
     {
-        nread = recv(conn->control_socket, packet, sizeof(packet), 0);
+        debug(1, "Control Receiver -- error receiving a packet.");
+        return;
+    }
 
-        if (nread >= 0)
+    uint64_t time_received = latency_histogram_time_now(); // only used for the histograms
+    uint64_t capture_time = conn->capture ? get_absolute_time_in_ns() : 0;
+
+    for (datagram = 0; datagram < received; datagram++)
+    {
+        uint8_t * packet = packets[datagram];
+        nread = lengths[datagram];
+
+        if (conn->capture)
+            capture_datagram(conn->capture, capture_source_control, packet, nread, capture_time);
+
+        if ((config.diagnostic_drop_packet_fraction == 0.0) ||
+            (drand48() > config.diagnostic_drop_packet_fraction))
         {
-            if ((config.diagnostic_drop_packet_fraction == 0.0) ||
-                (drand48() > config.diagnostic_drop_packet_fraction))
+            ssize_t plen = nread;
+
+            if (packet[1] == 0xd4)                 // sync data
+                                                   /*
+                                                        // the following stanza is for debugging only -- normally commented out.
+                                                        {
+                                                          char obf[4096];
+                                                          char *obfp = obf;
+                                                          int obfc;
+                                                          for (obfc = 0; obfc < plen; obfc++) {
+                                                            snprintf(obfp, 3, "%02X", packet[obfc]);
+                                                            obfp += 2;
+                                                          };
+                                                    * obfp = 0;
+
+
+                                                          // get raw timestamp information
+                                                          // I think that a good way to understand these timestamps is that
+                                                          // (1) the rtlt below is the timestamp of the frame that should be playing at the
+                                                          // client-time specified in the packet if there was no delay
+                                                          // and (2) that the rt below is the timestamp of the frame that should be playing
+                                                          // at the client-time specified in the packet on this device taking account of
+                                                          // the delay
+                                                          // Thus, (3) the latency can be calculated by subtracting the second from the
+                                                          // first.
+                                                          // There must be more to it -- there something missing.
+
+                                                          // In addition, it seems that if the value of the short represented by the second
+                                                          // pair of bytes in the packet is 7
+                                                          // then an extra time lag is expected to be added, presumably by
+                                                          // the AirPort Express.
+
+                                                          // Best guess is that this delay is 11,025 frames.
+
+                                                          uint32_t rtlt = nctohl(&packet[4]); // raw timestamp less latency
+                                                          uint32_t rt = nctohl(&packet[16]);  // raw timestamp
+
+                                                          uint32_t fl = nctohs(&packet[2]); //
+
+                                                          debug(1,"Sync Packet of %d bytes received: \"%s\", flags: %d, timestamps %u and %u,
+                                                      giving a latency of %d frames.",plen,obf,fl,rt,rtlt,rt-rtlt);
+                                                          //debug(1,"Monotonic timestamps are: %" PRId64 " and %" PRId64 "
+                                                      respectively.",monotonic_timestamp(rt, conn),monotonic_timestamp(rtlt, conn));
+                                                        }
+                                                    */
             {
-                ssize_t plen = nread;
-
-                if (packet[1] == 0xd4)                 // sync data
-                                                       /*
-                                                            // the following stanza is for debugging only -- normally commented out.
-                                                            {
-                                                              char obf[4096];
-                                                              char *obfp = obf;
-                                                              int obfc;
-                                                              for (obfc = 0; obfc < plen; obfc++) {
-                                                                snprintf(obfp, 3, "%02X", packet[obfc]);
-                                                                obfp += 2;
-                                                              };
-                                                        * obfp = 0;
-
-
-                                                              // get raw timestamp information
-                                                              // I think that a good way to understand these timestamps is that
-                                                              // (1) the rtlt below is the timestamp of the frame that should be playing at the
-                                                              // client-time specified in the packet if there was no delay
-                                                              // and (2) that the rt below is the timestamp of the frame that should be playing
-                                                              // at the client-time specified in the packet on this device taking account of
-                                                              // the delay
-                                                              // Thus, (3) the latency can be calculated by subtracting the second from the
-                                                              // first.
-                                                              // There must be more to it -- there something missing.
-
-                                                              // In addition, it seems that if the value of the short represented by the second
-                                                              // pair of bytes in the packet is 7
-                                                              // then an extra time lag is expected to be added, presumably by
-                                                              // the AirPort Express.
-
-                                                              // Best guess is that this delay is 11,025 frames.
-
-                                                              uint32_t rtlt = nctohl(&packet[4]); // raw timestamp less latency
-                                                              uint32_t rt = nctohl(&packet[16]);  // raw timestamp
-
-                                                              uint32_t fl = nctohs(&packet[2]); //
-
-                                                              debug(1,"Sync Packet of %d bytes received: \"%s\", flags: %d, timestamps %u and %u,
-                                                          giving a latency of %d frames.",plen,obf,fl,rt,rtlt,rt-rtlt);
-                                                              //debug(1,"Monotonic timestamps are: %" PRId64 " and %" PRId64 "
-                                                          respectively.",monotonic_timestamp(rt, conn),monotonic_timestamp(rtlt, conn));
-                                                            }
-                                                        */
+                if (conn->local_to_remote_time_difference) // need a time packet to be interchanged
+                                                   // first...
                 {
-                    if (conn->local_to_remote_time_difference) // need a time packet to be interchanged
-                                                       // first...
-                    {
-                        uint64_t ps, pn;
-
-                        ps = nctohl(&packet[8]);
-                        ps = ps * 1000000000; // this many nanoseconds from the whole seconds
-                        pn = nctohl(&packet[12]);
-                        pn = pn * 1000000000;
-                        pn = pn >> 32; // this many nanoseconds from the fractional part
-                        remote_time_of_sync = ps + pn;
-
-                        // debug(1,"Remote Sync Time: " PRIu64 "",remote_time_of_sync);
-
-                        sync_rtp_timestamp = nctohl(&packet[16]);
-                        uint32_t rtp_timestamp_less_latency = nctohl(&packet[4]);
-
-                        // debug(1,"Sync timestamp is %u.",ntohl(*((uint32_t *)&packet[16])));
-
-                        if (config.userSuppliedLatency)
-                        {
-                            if (config.userSuppliedLatency != conn->latency)
-                            {
-                                debug(1, "Using the user-supplied latency: %" PRIu32 ".",
-                                      config.userSuppliedLatency);
-                            }
-
-                            conn->latency = config.userSuppliedLatency;
-                        }
-                        else
-                        {
-                            // It seems that the second pair of bytes in the packet indicate whether a fixed
-                            // delay of 11,025 frames should be added -- iTunes set this field to 7 and
-                            // AirPlay sets it to 4.
-
-                            // However, on older versions of AirPlay, the 11,025 frames seem to be necessary too
-
-                            // The value of 11,025 (0.25 seconds) is a guess based on the "Audio-Latency"
-                            // parameter
-                            // returned by an AE.
-
-                            // Sigh, it would be nice to have a published protocol...
-
-                            uint16_t flags = nctohs(&packet[2]);
-                            uint32_t la = sync_rtp_timestamp - rtp_timestamp_less_latency; // note, this might
-                                                                                           // loop around in
-                                                                                           // modulo. Not sure if
-                                                                                           // you'll get an error!
-                            // debug(3, "Latency derived just from the sync packet is %" PRIu32 " frames.", la);
-
-                            if ((flags == 7) || ((conn->AirPlayVersion > 0) && (conn->AirPlayVersion <= 353)) ||
-                                ((conn->AirPlayVersion > 0) && (conn->AirPlayVersion >= 371)))
-                            {
-                                la += config.fixedLatencyOffset;
-                                // debug(3, "A fixed latency offset of %d frames has been added, giving a latency of
-                                // "
-                                //         "%" PRId64
-                                //         " frames with flags: %d and AirPlay version %d (triggers if 353 or
-                                //         less).",
-                                //      config.fixedLatencyOffset, la, flags, conn->AirPlayVersion);
-                            }
-
-                            if ((conn->maximum_latency) && (conn->maximum_latency < la)) la = conn->maximum_latency;
-
-                            if ((conn->minimum_latency) && (conn->minimum_latency > la)) la = conn->minimum_latency;
-
-                            const uint32_t max_frames = ((3 * BUFFER_FRAMES * 352) / 4) - 11025;
-
-                            if (la > max_frames)
-                            {
-                                warn("An out-of-range latency request of %" PRIu32
-                                     " frames was ignored. Must be %" PRIu32
-                                     " frames or less (44,100 frames per second). "
-                                     "Latency remains at %" PRIu32 " frames.",
-                                     la, max_frames, conn->latency);
-                            }
-                            else
-                            {
-                                if (la != conn->latency)
-                                {
-                                    conn->latency = la;
-                                    debug(3,
-                                          "New latency detected: %" PRIu32 ", sync latency: %" PRIu32
-                                          ", minimum latency: %" PRIu32 ", maximum "
-                                          "latency: %" PRIu32 ", fixed offset: %" PRIu32 ".",
-                                          la, sync_rtp_timestamp - rtp_timestamp_less_latency, conn->minimum_latency,
-                                          conn->maximum_latency, config.fixedLatencyOffset);
-                                }
-                            }
-                        }
-
-                        debug_mutex_lock(&conn->reference_time_mutex, 1000, 0);
-
-                        if (conn->initial_reference_time == 0)
-                        {
-                            if (conn->packet_count_since_flush > 0)
-                            {
-                                conn->initial_reference_time = remote_time_of_sync;
-                                conn->initial_reference_timestamp = sync_rtp_timestamp;
-                            }
-                        }
-                        else
-                        {
-                            uint64_t remote_frame_time_interval =
-                                conn->remote_reference_timestamp_time -
-                                conn->initial_reference_time; // here, this should never be zero
-
-                            if (remote_frame_time_interval)
-                            {
-                                conn->remote_frame_rate =
-                                    (1.0E9 * (conn->reference_timestamp - conn->initial_reference_timestamp)) /
-                                    remote_frame_time_interval;
-                            }
-                            else
-                            {
-                                conn->remote_frame_rate = 0.0; // use as a flag.
-                            }
-                        }
-
-                        // this is for debugging
-                        uint64_t old_remote_reference_time = conn->remote_reference_timestamp_time;
-                        uint32_t old_reference_timestamp = conn->reference_timestamp;
-                        // int64_t old_latency_delayed_timestamp = conn->latency_delayed_timestamp;
-
-                        conn->remote_reference_timestamp_time = remote_time_of_sync;
-                        // conn->reference_timestamp_time =
-                        //    remote_time_of_sync - local_to_remote_time_difference_now(conn);
-                        conn->reference_timestamp = sync_rtp_timestamp;
-                        conn->latency_delayed_timestamp = rtp_timestamp_less_latency;
-                        debug_mutex_unlock(&conn->reference_time_mutex, 0);
-
-                        conn->reference_to_previous_time_difference =
-                            remote_time_of_sync - old_remote_reference_time;
-
-                        if (old_reference_timestamp == 0) conn->reference_to_previous_frame_difference = 0;
-                        else conn->reference_to_previous_frame_difference =
-                                sync_rtp_timestamp - old_reference_timestamp;
-                    }
-                    else
-                    {
-                        debug(2, "Sync packet received before we got a timing packet back.");
-                    }
-                }
-                else if (packet[1] == 0xd6) // resent audio data in the control path -- whaale only?
-                {
-                    pktp = packet + 4;
-                    plen -= 4;
-                    seq_t seqno = ntohs(*(uint16_t *)(pktp + 2));
-                    debug(3, "Control Receiver -- Retransmitted Audio Data Packet %u received.", seqno);
+                    uint64_t ps, pn;
 
-                    uint32_t actual_timestamp = ntohl(*(uint32_t *)(pktp + 4));
+                    ps = nctohl(&packet[8]);
+                    ps = ps * 1000000000; // this many nanoseconds from the whole seconds
+                    pn = nctohl(&packet[12]);
+                    pn = pn * 1000000000;
+                    pn = pn >> 32; // this many nanoseconds from the fractional part
+                    remote_time_of_sync = ps + pn;
 
-                    pktp += 12;
-                    plen -= 12;
+                    // debug(1,"Remote Sync Time: " PRIu64 "",remote_time_of_sync);
 
-                    // check if packet contains enough content to be reasonable
-                    if (plen >= 16)
-                    {
-                        player_put_packet(seqno, actual_timestamp, pktp, plen, conn);
-                        continue;
-                    }
-                    else
-                    {
-                        debug(3, "Too-short retransmitted audio packet received in control port, ignored.");
-                    }
+                    rtp_sync_packet_process(conn, packet, remote_time_of_sync);
+                }
+                else
+                {
+                    debug(2, "Sync packet received before we got a timing packet back.");
                 }
-                else debug(1, "Control Receiver -- Unknown RTP packet of type 0x%02X length %d, ignored.",
-                           packet[1], nread);
             }
-            else
+            else if (packet[1] == 0xd6) // resent audio data in the control path -- whaale only?
             {
-                debug(3, "Control Receiver -- dropping a packet to simulate a bad network.");
+                pktp = packet + 4;
+                plen -= 4;
+                seq_t seqno = ntohs(*(uint16_t *)(pktp + 2));
+
+                uint32_t actual_timestamp = ntohl(*(uint32_t *)(pktp + 4));
+
+                pktp += 12;
+                plen -= 12;
+
+                // check if packet contains enough content to be reasonable
+                if (plen >= 16)
+                {
+                    batch[batched].seqno = seqno;
+                    batch[batched].timestamp = actual_timestamp;
+                    batch[batched].data = pktp;
+                    batch[batched].length = plen;
+                    batch[batched].arrival_time = time_received;
+                    batched++;
+                    trace(TR_retransmitted_packet, seqno, actual_timestamp, plen, 0);
+                    continue;
+                }
+                else
+                {
+                    debug(3, "Too-short retransmitted audio packet received in control port, ignored.");
+                }
             }
+            else debug(1, "Control Receiver -- Unknown RTP packet of type 0x%02X length %d, ignored.",
+                       packet[1], nread);
         }
         else
         {
-            debug(1, "Control Receiver -- error receiving a packet.");
+            debug(3, "Control Receiver -- dropping a packet to simulate a bad network.");
         }
     }
-    debug(1, "Control RTP thread \"normal\" exit -- this can't happen. Hah!");
-    pthread_cleanup_pop(0); // don't execute anything here.
-    debug(2, "Control RTP thread exit.");
-    pthread_exit(NULL);
-}
 
-void rtp_timing_sender_cleanup_handler(void * arg)
-{
-    rtsp_conn_info * conn = (rtsp_conn_info *)arg;
-
-    debug(3, "Connection %d: Timing Sender Cleanup.", conn->connection_number);
+    // resent audio packets are stored with one taking of the buffer lock, like the audio receiver's
+    if (batched) player_put_packets(batch, batched, conn);
 }
 
-void * rtp_timing_sender(void * arg)
+// send a timing request -- the reply is taken by rtp_timing_receive
+static void rtp_timing_request_send(rtsp_conn_info * conn)
 {
-    pthread_cleanup_push(rtp_timing_sender_cleanup_handler, arg);
-    rtsp_conn_info * conn = (rtsp_conn_info *)arg;
     struct timing_request
     {
         char leader;
@@ -538,71 +722,230 @@ void * rtp_timing_sender(void * arg)
         uint64_t origin, receive, transmit;
     };
 
-    uint64_t request_number = 0;
-
     struct timing_request req; // *not* a standard RTCP NACK
 
     req.leader = 0x80;
     req.type = 0xd2; // Timing request
-    req.filler = 0;
     req.seqno = htons(7);
 
-    conn->time_ping_count = 0;
+    if (!conn->rtp_running) debug(1, "rtp_timing_request_send called without active stream in RTSP conversation thread %d!",
+                                  conn->connection_number);
 
-    while (1)
-    {
-        // debug(1,"Send a timing request");
+    // debug(1, "Requesting ntp timestamp exchange.");
 
-        if (!conn->rtp_running) debug(1, "rtp_timing_sender called without active stream in RTSP conversation thread %d!",
-                                      conn->connection_number);
+    req.filler = 0;
+    req.origin = req.receive = req.transmit = 0;
 
-        // debug(1, "Requesting ntp timestamp exchange.");
+    conn->departure_time = get_absolute_time_in_ns();
+    socklen_t msgsize = sizeof(struct sockaddr_in);
+#ifdef AF_INET6
 
-        req.filler = 0;
-        req.origin = req.receive = req.transmit = 0;
+    if (conn->rtp_client_timing_socket.SAFAMILY == AF_INET6)
+    {
+        msgsize = sizeof(struct sockaddr_in6);
+    }
 
-        conn->departure_time = get_absolute_time_in_ns();
-        socklen_t msgsize = sizeof(struct sockaddr_in);
-#ifdef AF_INET6
+#endif
 
-        if (conn->rtp_client_timing_socket.SAFAMILY == AF_INET6)
+    if ((config.diagnostic_drop_packet_fraction == 0.0) ||
+        (drand48() > config.diagnostic_drop_packet_fraction))
+    {
+        if (sendto(conn->timing_socket, &req, sizeof(req), 0,
+                   (struct sockaddr *)&conn->rtp_client_timing_socket, msgsize) == -1)
         {
-            msgsize = sizeof(struct sockaddr_in6);
+            char em[1024];
+            strerror_r(errno, em, sizeof(em));
+            debug(1, "Error %d using send-to to the timing socket: \"%s\".", errno, em);
         }
+    }
+    else
+    {
+        debug(3, "Timing Sender -- dropping outgoing packet to simulate bad network.");
+    }
+}
 
-#endif
+// the timing receiver's record of the exchanges so far
+typedef struct
+{
+    uint64_t first_local_to_remote_time_difference;
+
+    // for getting mean and sd of return times
+    int32_t stat_n;
+    double stat_mean;
+    double stat_M2;
+} rtp_timing_state;
+
+static void rtp_timing_state_init(rtsp_conn_info * conn, rtp_timing_state * state)
+{
+    memset(state, 0, sizeof(*state));
 
+    // calculate diffusion factor
+
+    // at the end of the history of time pings, the diffusion factor
+    // must be diffusion_expansion_factor
+    // this, at each step, the diffusion multiplication constant must
+    // be the nth root of diffusion_expansion_factor
+    // where n is the number of records in the history
+
+    const double diffusion_expansion_factor = 10;
+    double log_of_multiplier = log10(diffusion_expansion_factor) / clock_model_history;
+    double multiplier = pow(10, log_of_multiplier);
+    clock_model_init(&conn->clock, multiplier);
+
+    local_to_remote_time_jitter = 0;
+    local_to_remote_time_jitter_count = 0;
+
+    conn->local_to_remote_time_gradient = 1.0; // initial value.
+    // walk down the list of DACP / gradient pairs, if any
+    nvll * gradients = config.gradients;
+
+    while ((gradients) && (strcasecmp((const char *)&conn->client_ip_string, gradients->name) != 0))
+        gradients = gradients->next;
+
+    // if gradients comes out of this non-null, it is pointing to the IP and it's last-known gradient
+    if (gradients)
+    {
+        conn->local_to_remote_time_gradient = gradients->value;
+        // debug(1,"Using a stored drift of %.2f ppm for \"%s\".", (conn->local_to_remote_time_gradient
+        // - 1.0)*1000000, gradients->name);
+    }
+}
+
+// take a timing reply from the timing socket and update the local-to-remote time mapping from it
+static void rtp_timing_receive(rtsp_conn_info * conn, rtp_timing_state * state)
+{
+    uint8_t packet[2048];
+    ssize_t nread;
+    uint64_t distant_receive_time, distant_transmit_time, arrival_time, return_time;
+
+    nread = rtp_receive_timestamped(conn->timing_socket, packet, sizeof(packet), &arrival_time);
+
+    if ((nread >= 0) && (conn->capture))
+        capture_datagram(conn->capture, capture_source_timing, packet, nread, arrival_time);
+
+    if (nread >= 0)
+    {
         if ((config.diagnostic_drop_packet_fraction == 0.0) ||
             (drand48() > config.diagnostic_drop_packet_fraction))
         {
-            if (sendto(conn->timing_socket, &req, sizeof(req), 0,
-                       (struct sockaddr *)&conn->rtp_client_timing_socket, msgsize) == -1)
+            // ssize_t plen = nread;
+            // debug(1,"Packet Received on Timing Port.");
+            if (packet[1] == 0xd3) // timing reply
             {
-                char em[1024];
-                strerror_r(errno, em, sizeof(em));
-                debug(1, "Error %d using send-to to the timing socket: \"%s\".", errno, em);
+                return_time = arrival_time - conn->departure_time;
+                trace(TR_timing_reply, return_time, 0, 0, 0);
+
+                if (return_time < 200000000) // must be less than 0.2 seconds
+                // distant_receive_time =
+                // ((uint64_t)ntohl(*((uint32_t*)&packet[16])))<<32+ntohl(*((uint32_t*)&packet[20]));
+                {
+                    uint64_t ps, pn;
+
+                    ps = nctohl(&packet[16]);
+                    ps = ps * 1000000000; // this many nanoseconds from the whole seconds
+                    pn = nctohl(&packet[20]);
+                    pn = pn * 1000000000;
+                    pn = pn >> 32; // this many nanoseconds from the fractional part
+                    distant_receive_time = ps + pn;
+
+                    // distant_transmit_time =
+                    // ((uint64_t)ntohl(*((uint32_t*)&packet[24])))<<32+ntohl(*((uint32_t*)&packet[28]));
+
+                    ps = nctohl(&packet[24]);
+                    ps = ps * 1000000000; // this many nanoseconds from the whole seconds
+                    pn = nctohl(&packet[28]);
+                    pn = pn * 1000000000;
+                    pn = pn >> 32; // this many nanoseconds from the fractional part
+                    distant_transmit_time = ps + pn;
+
+                    uint64_t remote_processing_time = 0;
+
+                    if (distant_transmit_time >= distant_receive_time) remote_processing_time = distant_transmit_time - distant_receive_time;
+                    else
+                    {
+                        debug(1, "Yikes: distant_transmit_time is before distant_receive_time; remote "
+                              "processing time set to zero.");
+                    }
+
+                    // debug(1,"Return trip time: %" PRIu64 " nS, remote processing time: %" PRIu64 "
+                    // nS.",return_time, remote_processing_time);
+
+                    if (remote_processing_time < return_time) return_time -= remote_processing_time;
+                    else debug(1, "Remote processing time greater than return time -- ignored.");
+
+                    clock_model_add(&conn->clock, arrival_time, distant_transmit_time + return_time / 2,
+                                    return_time);
+
+                    // here, calculate the mean and standard deviation of the return times
+
+                    // mean and variance calculations from "online_variance" algorithm at
+                    // https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Online_algorithm
+
+                    state->stat_n += 1;
+                    double stat_delta = return_time - state->stat_mean;
+                    state->stat_mean += stat_delta / state->stat_n;
+                    state->stat_M2 += stat_delta * (return_time - state->stat_mean);
+                    // debug(1, "Timing packet return time stats: current, mean and standard deviation over
+                    // %d packets: %.1f, %.1f, %.1f (nanoseconds).",
+                    //        state->stat_n,return_time,state->stat_mean, sqrtf(state->stat_M2 / (state->stat_n - 1)));
+
+                    // the difference comes from the sample with the lowest aged dispersion until
+                    // there are enough chosen samples for a line of best fit, and from the fit after that
+                    clock_estimate estimate;
+                    clock_model_estimate(&conn->clock, &estimate);
+
+                    conn->local_to_remote_time_difference = estimate.local_to_remote_time_difference;
+                    conn->local_to_remote_time_difference_measurement_time = estimate.measurement_time;
+                    conn->local_to_remote_time_difference_error = estimate.difference_error;
+                    conn->local_to_remote_time_gradient_sample_count = estimate.gradient_sample_count;
+
+                    if (state->first_local_to_remote_time_difference == 0)
+                        state->first_local_to_remote_time_difference = conn->local_to_remote_time_difference;
+
+                    if (estimate.gradient != 0.0)
+                    {
+                        conn->local_to_remote_time_gradient = estimate.gradient;
+                        debug(3,
+                              "drift is %.2f ppm +/- %.2f ppm and the time difference is good to %.1f "
+                              "microseconds, based on %d samples.",
+                              (estimate.gradient - 1.0) * 1000000, estimate.gradient_error * 1000000,
+                              estimate.difference_error * 0.001, estimate.gradient_sample_count);
+                    }
+                    else
+                    {
+                        debug(3, "not enough samples to estimate drift -- remaining at %.2f ppm.",
+                              (conn->local_to_remote_time_gradient - 1.0) * 1000000);
+                    }
+                }
+                else
+                {
+                    debug(1,
+                          "Time ping turnaround time: %" PRIu64
+                          " ns -- it looks like a timing ping was lost.",
+                          return_time);
+                }
+            }
+            else
+            {
+                debug(1, "Timing port -- Unknown RTP packet of type 0x%02X length %d.", packet[1], nread);
             }
         }
         else
         {
-            debug(3, "Timing Sender Thread -- dropping outgoing packet to simulate bad network.");
+            debug(3, "Timing Receiver -- dropping incoming packet to simulate a bad network.");
         }
-
-        request_number++;
-
-        if (request_number <= 6) usleep(300000); // these are thread cancellation points
-        else usleep(3000000);
     }
-    debug(3, "rtp_timing_sender thread interrupted. This should never happen.");
-    pthread_cleanup_pop(0); // don't execute anything here.
-    pthread_exit(NULL);
+    else
+    {
+        debug(1, "Timing receiver -- error receiving a packet.");
+    }
 }
 
-void rtp_timing_receiver_cleanup_handler(void * arg)
+static void rtp_receiver_cleanup_handler(void * arg)
 {
     rtsp_conn_info * conn = (rtsp_conn_info *)arg;
 
-    debug(3, "Timing Receiver Cleanup.");
+    debug(3, "RTP Receiver Cleanup.");
     // walk down the list of DACP / gradient pairs, if any
     nvll * gradients = config.gradients;
 
@@ -633,326 +976,80 @@ void rtp_timing_receiver_cleanup_handler(void * arg)
         }
     }
 
-    debug(3, "Cancel Timing Requester.");
-    pthread_cancel(conn->timer_requester);
-    int oldState;
+    debug(3, "RTP Receiver Cleanup Successful.");
+}
 
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
-    debug(3, "Join Timing Requester.");
-    pthread_join(conn->timer_requester, NULL);
-    debug(3, "Timing Receiver Cleanup Successful.");
-    pthread_setcancelstate(oldState, NULL);
+// the interval between timing requests -- rapid at first, to get a time mapping quickly
+static uint64_t rtp_timing_request_interval(uint64_t request_number)
+{
+    if (request_number <= 6) return 300000000;
+    else return 3000000000;
 }
 
-void * rtp_timing_receiver(void * arg)
+// one thread looks after the audio, control and timing sockets of a session and sends its
+// timing requests, waiting in poll() for a datagram or for the next request to fall due
+void * rtp_receiver(void * arg)
 {
-    pthread_cleanup_push(rtp_timing_receiver_cleanup_handler, arg);
+    pthread_cleanup_push(rtp_receiver_cleanup_handler, arg);
     rtsp_conn_info * conn = (rtsp_conn_info *)arg;
+    set_thread_scheduling(TC_rtp);
 
-    uint8_t packet[2048];
-    ssize_t nread;
-
-    pthread_create(&conn->timer_requester, NULL, &rtp_timing_sender, arg);
-    //    struct timespec att;
-    uint64_t distant_receive_time, distant_transmit_time, arrival_time, return_time;
+    rtp_audio_state audio_state;
+    rtp_timing_state timing_state;
 
-    local_to_remote_time_jitter = 0;
-    local_to_remote_time_jitter_count = 0;
-    // uint64_t first_remote_time = 0;
-    // uint64_t first_local_time = 0;
-
-    uint64_t first_local_to_remote_time_difference = 0;
-
-    conn->local_to_remote_time_gradient = 1.0; // initial value.
-    // walk down the list of DACP / gradient pairs, if any
-    nvll * gradients = config.gradients;
-
-    while ((gradients) && (strcasecmp((const char *)&conn->client_ip_string, gradients->name) != 0))
-        gradients = gradients->next;
-
-    // if gradients comes out of this non-null, it is pointing to the IP and it's last-known gradient
-    if (gradients)
-    {
-        conn->local_to_remote_time_gradient = gradients->value;
-        // debug(1,"Using a stored drift of %.2f ppm for \"%s\".", (conn->local_to_remote_time_gradient
-        // - 1.0)*1000000, gradients->name);
-    }
-
-    // calculate diffusion factor
-
-    // at the end of the array of time pings, the diffusion factor
-    // must be diffusion_expansion_factor
-    // this, at each step, the diffusion multiplication constant must
-    // be the nth root of diffusion_expansion_factor
-    // where n is the number of elements in the array
-
-    const double diffusion_expansion_factor = 10;
-    double log_of_multiplier = log10(diffusion_expansion_factor) / time_ping_history;
-    double multiplier = pow(10, log_of_multiplier);
-    uint64_t dispersion_factor = (uint64_t)(multiplier * 100);
-    // debug(1,"dispersion factor is %" PRIu64 ".", dispersion_factor);
+    conn->reference_timestamp = 0; // nothing valid received yet
+    rtp_audio_state_init(&audio_state);
+    rtp_timing_state_init(conn, &timing_state);
 
-    // uint64_t first_local_to_remote_time_difference_time;
-    // uint64_t l2rtd = 0;
-    int sequence_number = 0;
+    struct pollfd fds[3];
+    fds[0].fd = conn->audio_socket;
+    fds[1].fd = conn->control_socket;
+    fds[2].fd = conn->timing_socket;
+    fds[0].events = fds[1].events = fds[2].events = POLLIN;
 
-    // for getting mean and sd of return times
-    int32_t stat_n = 0;
-    double stat_mean = 0.0;
-    double stat_M2 = 0.0;
+    uint64_t request_number = 0;
+    uint64_t next_request_time = get_absolute_time_in_ns();
 
     while (1)
     {
-        nread = recv(conn->timing_socket, packet, sizeof(packet), 0);
+        uint64_t time_now = get_absolute_time_in_ns();
 
-        if (nread >= 0)
+        if (time_now >= next_request_time)
         {
-            if ((config.diagnostic_drop_packet_fraction == 0.0) ||
-                (drand48() > config.diagnostic_drop_packet_fraction))
-            {
-                arrival_time = get_absolute_time_in_ns();
+            rtp_timing_request_send(conn);
+            request_number++;
+            next_request_time = time_now + rtp_timing_request_interval(request_number);
+        }
 
-                // ssize_t plen = nread;
-                // debug(1,"Packet Received on Timing Port.");
-                if (packet[1] == 0xd3) // timing reply
-                {
-                    return_time = arrival_time - conn->departure_time;
-                    debug(3, "clock synchronisation request: return time is %8.3f milliseconds.",
-                          0.000001 * return_time);
+        // round up, so as not to wake just before the request is due
+        int timeout_ms = (next_request_time - time_now + 999999) / 1000000;
 
-                    if (return_time < 200000000) // must be less than 0.2 seconds
-                    // distant_receive_time =
-                    // ((uint64_t)ntohl(*((uint32_t*)&packet[16])))<<32+ntohl(*((uint32_t*)&packet[20]));
-                    {
-                        uint64_t ps, pn;
-
-                        ps = nctohl(&packet[16]);
-                        ps = ps * 1000000000; // this many nanoseconds from the whole seconds
-                        pn = nctohl(&packet[20]);
-                        pn = pn * 1000000000;
-                        pn = pn >> 32; // this many nanoseconds from the fractional part
-                        distant_receive_time = ps + pn;
-
-                        // distant_transmit_time =
-                        // ((uint64_t)ntohl(*((uint32_t*)&packet[24])))<<32+ntohl(*((uint32_t*)&packet[28]));
-
-                        ps = nctohl(&packet[24]);
-                        ps = ps * 1000000000; // this many nanoseconds from the whole seconds
-                        pn = nctohl(&packet[28]);
-                        pn = pn * 1000000000;
-                        pn = pn >> 32; // this many nanoseconds from the fractional part
-                        distant_transmit_time = ps + pn;
-
-                        uint64_t remote_processing_time = 0;
-
-                        if (distant_transmit_time >= distant_receive_time) remote_processing_time = distant_transmit_time - distant_receive_time;
-                        else
-                        {
-                            debug(1, "Yikes: distant_transmit_time is before distant_receive_time; remote "
-                                  "processing time set to zero.");
-                        }
-
-                        // debug(1,"Return trip time: %" PRIu64 " nS, remote processing time: %" PRIu64 "
-                        // nS.",return_time, remote_processing_time);
-
-                        if (remote_processing_time < return_time) return_time -= remote_processing_time;
-                        else debug(1, "Remote processing time greater than return time -- ignored.");
-
-                        int cc;
-
-                        // debug(1, "time ping history is %d entries.", time_ping_history);
-                        for (cc = time_ping_history - 1; cc > 0; cc--)
-                        {
-                            conn->time_pings[cc] = conn->time_pings[cc - 1];
-
-                            // if ((conn->time_ping_count) && (conn->time_ping_count < 10))
-                            //                conn->time_pings[cc].dispersion =
-                            //                  conn->time_pings[cc].dispersion * pow(2.14,
-                            //                  1.0/conn->time_ping_count);
-                            if (conn->time_pings[cc].dispersion > UINT64_MAX / dispersion_factor) debug(1, "dispersion factor is too large at %" PRIu64 ".");
-                            else
-                                conn->time_pings[cc].dispersion =
-                                    (conn->time_pings[cc].dispersion * dispersion_factor) /
-                                    100; // make the dispersions 'age' by this rational factor
-                        }
-
-                        // these are used for doing a least squares calculation to get the drift
-                        conn->time_pings[0].local_time = arrival_time;
-                        conn->time_pings[0].remote_time = distant_transmit_time + return_time / 2;
-                        conn->time_pings[0].sequence_number = sequence_number++;
-                        conn->time_pings[0].chosen = 0;
-                        conn->time_pings[0].dispersion = return_time;
-
-                        if (conn->time_ping_count < time_ping_history) conn->time_ping_count++;
-
-                        // here, calculate the mean and standard deviation of the return times
-
-                        // mean and variance calculations from "online_variance" algorithm at
-                        // https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Online_algorithm
-
-                        stat_n += 1;
-                        double stat_delta = return_time - stat_mean;
-                        stat_mean += stat_delta / stat_n;
-                        stat_M2 += stat_delta * (return_time - stat_mean);
-                        // debug(1, "Timing packet return time stats: current, mean and standard deviation over
-                        // %d packets: %.1f, %.1f, %.1f (nanoseconds).",
-                        //        stat_n,return_time,stat_mean, sqrtf(stat_M2 / (stat_n - 1)));
-
-                        // here, pick the record with the least dispersion, and record that it's been chosen
-
-                        // uint64_t local_time_chosen = arrival_time;
-                        // uint64_t remote_time_chosen = distant_transmit_time;
-                        // now pick the timestamp with the lowest dispersion
-                        uint64_t rt = conn->time_pings[0].remote_time;
-                        uint64_t lt = conn->time_pings[0].local_time;
-                        uint64_t tld = conn->time_pings[0].dispersion;
-                        int chosen = 0;
-
-                        for (cc = 1; cc < conn->time_ping_count; cc++)
-                        {
-                            if (conn->time_pings[cc].dispersion < tld)
-                            {
-                                chosen = cc;
-                                rt = conn->time_pings[cc].remote_time;
-                                lt = conn->time_pings[cc].local_time;
-                                tld = conn->time_pings[cc].dispersion;
-                                // local_time_chosen = conn->time_pings[cc].local_time;
-                                // remote_time_chosen = conn->time_pings[cc].remote_time;
-                            }
-                        }
-
-                        // debug(1,"Record %d has the lowest dispersion with %0.2f us
-                        // dispersion.",chosen,1.0*((tld * 1000000) >> 32));
-                        conn->time_pings[chosen].chosen = 1; // record the fact that it has been used for timing
-
-                        conn->local_to_remote_time_difference =
-                            rt - lt; // make this the new local-to-remote-time-difference
-                        conn->local_to_remote_time_difference_measurement_time = lt; // done at this time.
-
-                        if (first_local_to_remote_time_difference == 0)
-                        {
-                            first_local_to_remote_time_difference = conn->local_to_remote_time_difference;
-                            // first_local_to_remote_time_difference_time = get_absolute_time_in_fp();
-                        }
-
-                        // here, let's try to use the timing pings that were selected because of their short
-                        // return times to
-                        // estimate a figure for drift between the local clock (x) and the remote clock (y)
-
-                        // if we plug in a local interval, we will get back what that is in remote time
-
-                        // calculate the line of best fit for relating the local time and the remote time
-                        // we will calculate the slope, which is the drift
-                        // see https://www.varsitytutors.com/hotmath/hotmath_help/topics/line-of-best-fit
-
-                        uint64_t y_bar = 0; // remote timestamp average
-                        uint64_t x_bar = 0; // local timestamp average
-                        int sample_count = 0;
-
-                        // approximate time in seconds to let the system settle down
-                        const int settling_time = 60;
-                        // number of points to have for calculating a valid drift
-                        const int sample_point_minimum = 8;
-
-                        for (cc = 0; cc < conn->time_ping_count; cc++)
-                        {
-                            if ((conn->time_pings[cc].chosen) &&
-                                (conn->time_pings[cc].sequence_number >
-                                 (settling_time / 3))) // wait for a approximate settling time
-                                                       // have to scale them down so that the sum, possibly over
-                                                       // every term in the array, doesn't overflow
-                            {
-                                y_bar += (conn->time_pings[cc].remote_time >> time_ping_history_power_of_two);
-                                x_bar += (conn->time_pings[cc].local_time >> time_ping_history_power_of_two);
-                                sample_count++;
-                            }
-                        }
-
-                        conn->local_to_remote_time_gradient_sample_count = sample_count;
-
-                        if (sample_count > sample_point_minimum)
-                        {
-                            y_bar = y_bar / sample_count;
-                            x_bar = x_bar / sample_count;
-
-                            int64_t xid, yid;
-                            double mtl, mbl;
-                            mtl = 0;
-                            mbl = 0;
-
-                            for (cc = 0; cc < conn->time_ping_count; cc++)
-                            {
-                                if ((conn->time_pings[cc].chosen) &&
-                                    (conn->time_pings[cc].sequence_number > (settling_time / 3)))
-                                {
-                                    uint64_t slt = conn->time_pings[cc].local_time >> time_ping_history_power_of_two;
-
-                                    if (slt > x_bar) xid = slt - x_bar;
-                                    else xid = -(x_bar - slt);
-
-                                    uint64_t srt = conn->time_pings[cc].remote_time >> time_ping_history_power_of_two;
-
-                                    if (srt > y_bar) yid = srt - y_bar;
-                                    else yid = -(y_bar - srt);
-
-                                    mtl = mtl + (1.0 * xid) * yid;
-                                    mbl = mbl + (1.0 * xid) * xid;
-                                }
-                            }
-
-                            if (mbl) conn->local_to_remote_time_gradient = mtl / mbl;
-                            else
-                            {
-                                // conn->local_to_remote_time_gradient = 1.0;
-                                debug(1, "mbl is zero. Drift remains at %.2f ppm.",
-                                      (conn->local_to_remote_time_gradient - 1.0) * 1000000);
-                            }
-
-                            // scale the numbers back up
-                            uint64_t ybf = y_bar << time_ping_history_power_of_two;
-                            uint64_t xbf = x_bar << time_ping_history_power_of_two;
-
-                            conn->local_to_remote_time_difference =
-                                ybf - xbf; // make this the new local-to-remote-time-difference
-                            conn->local_to_remote_time_difference_measurement_time = xbf;
-                        }
-                        else
-                        {
-                            debug(3, "not enough samples to estimate drift -- remaining at %.2f ppm.",
-                                  (conn->local_to_remote_time_gradient - 1.0) * 1000000);
-                            // conn->local_to_remote_time_gradient = 1.0;
-                        }
-
-                        // debug(1,"local to remote time gradient is %12.2f ppm, based on %d
-                        // samples.",conn->local_to_remote_time_gradient*1000000,sample_count);
-                    }
-                    else
-                    {
-                        debug(1,
-                              "Time ping turnaround time: %" PRIu64
-                              " ns -- it looks like a timing ping was lost.",
-                              return_time);
-                    }
-                }
-                else
-                {
-                    debug(1, "Timing port -- Unknown RTP packet of type 0x%02X length %d.", packet[1], nread);
-                }
-            }
-            else
+        int ready = poll(fds, 3, timeout_ms); // a thread cancellation point
+
+        if (ready < 0)
+        {
+            if (errno != EINTR)
             {
-                debug(3, "Timing Receiver Thread -- dropping incoming packet to simulate a bad network.");
+                char em[1024];
+                strerror_r(errno, em, sizeof(em));
+                debug(1, "Error %d waiting for the RTP sockets: \"%s\".", errno, em);
+                usleep(10000); // don't spin
             }
         }
-        else
+        else if (ready > 0)
         {
-            debug(1, "Timing receiver -- error receiving a packet.");
+            // audio first -- the timing reply has been stamped by the kernel on arrival anyway
+            if (fds[0].revents & (POLLIN | POLLERR)) rtp_audio_receive(conn, &audio_state);
+
+            if (fds[1].revents & (POLLIN | POLLERR)) rtp_control_receive(conn);
+
+            if (fds[2].revents & (POLLIN | POLLERR)) rtp_timing_receive(conn, &timing_state);
         }
     }
 
-    debug(1, "Timing Receiver RTP thread \"normal\" exit -- this can't happen. Hah!");
+    debug(1, "RTP receiver thread \"normal\" exit -- this can't happen. Hah!");
     pthread_cleanup_pop(0); // don't execute anything here.
-    debug(2, "Timing Receiver RTP thread exit.");
+    debug(2, "RTP receiver thread exit.");
     pthread_exit(NULL);
 }
 
@@ -1163,6 +1260,7 @@ void rtp_setup(SOCKADDR * local, SOCKADDR * remote, uint16_t cport, uint16_t tpo
                                              conn->self_scope_id, &conn->control_socket);
         conn->local_timing_port = bind_port(conn->connection_ip_family, conn->self_ip_string,
                                             conn->self_scope_id, &conn->timing_socket);
+        rtp_enable_receive_timestamps(conn->timing_socket);
         conn->local_audio_port = bind_port(conn->connection_ip_family, conn->self_ip_string,
                                            conn->self_scope_id, &conn->audio_socket);
 
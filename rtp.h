@@ -8,15 +8,19 @@
 void rtp_initialise(rtsp_conn_info * conn);
 void rtp_terminate(rtsp_conn_info * conn);
 
-void * rtp_audio_receiver(void * arg);
-void * rtp_control_receiver(void * arg);
-void * rtp_timing_receiver(void * arg);
+// the thread that receives a session's audio, control and timing packets and sends its timing requests
+void * rtp_receiver(void * arg);
 
 void rtp_setup(SOCKADDR * local, SOCKADDR * remote, uint16_t controlport, uint16_t timingport,
                rtsp_conn_info * conn);
 void rtp_request_resend(seq_t first, uint32_t count, rtsp_conn_info * conn);
 void rtp_request_client_pause(rtsp_conn_info * conn); // ask the client to pause
 
+// take the latency and reference timing from a sync packet of at least 20 bytes, given its
+// remote time in nanoseconds -- used by the control receiver and by the capture replayer
+void rtp_sync_packet_process(rtsp_conn_info * conn, const uint8_t * packet,
+                             uint64_t remote_time_of_sync);
+
 void get_reference_timestamp_stuff(uint32_t * timestamp, uint64_t * timestamp_time,
                                    uint64_t * remote_timestamp_time, rtsp_conn_info * conn);
 void clear_reference_timestamp(rtsp_conn_info * conn);
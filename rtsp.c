@@ -27,6 +27,10 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for sendmmsg
+#endif
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -46,6 +50,12 @@
 
 #include "config.h"
 
+#if defined(HAVE_EPOLL_CREATE1)
+#include <sys/epoll.h>
+#elif defined(HAVE_KQUEUE)
+#include <sys/event.h>
+#endif
+
 #ifdef CONFIG_OPENSSL
 #include <openssl/md5.h>
 #endif
@@ -59,10 +69,12 @@
 #include <polarssl/md5.h>
 #endif
 
+#include "capture.h"
 #include "common.h"
 #include "player.h"
 #include "rtp.h"
 #include "rtsp.h"
+#include "zone.h"
 
 #ifdef CONFIG_METADATA_HUB
 #include "metadata_hub.h"
@@ -90,14 +102,10 @@ enum rtsp_read_request_response
     rtsp_read_request_response_error
 };
 
-rtsp_conn_info * playing_conn;
 rtsp_conn_info * * conns;
 
 int metadata_running = 0;
 
-// always lock use this when accessing the playing conn value
-static pthread_mutex_t playing_conn_lock = PTHREAD_MUTEX_INITIALIZER;
-
 // every time we want to retain or release a reference count, lock it with this
 // if a reference count is read as zero, it means the it's being deallocated.
 static pthread_mutex_t reference_counter_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -110,32 +118,34 @@ static pthread_mutex_t reference_counter_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int RTSP_connection_index = 1;
 
-#ifdef CONFIG_METADATA
-typedef struct
-{
-    pthread_mutex_t pc_queue_lock;
-    pthread_cond_t pc_queue_item_added_signal;
-    pthread_cond_t pc_queue_item_removed_signal;
-    char * name;
-    size_t item_size; // number of bytes in each item
-    uint32_t count;  // number of items in the queue
-    uint32_t capacity; // maximum number of items
-    uint32_t toq;    // first item to take
-    uint32_t eoq;    // free space at end of queue
-    void * items;    // a pointer to where the items are actually stored
-} pc_queue;          // producer-consumer queue
-#endif
-
 static int msg_indexes = 1;
 
+// The header names and values of a message are kept in its arena -- a block of memory within the
+// message itself -- rather than being allocated one by one. If a message has more than will fit,
+// further blocks are chained on, so that pointers into the arena are never invalidated.
+#define RTSP_MESSAGE_ARENA_SIZE 1024
+
+// the most a request's header section may take up before it's rejected
+#define RTSP_MAXIMUM_HEADER_SECTION_SIZE (64 * 1024)
+
+typedef struct rtsp_arena_block
+{
+    struct rtsp_arena_block * next;
+    char data[];
+} rtsp_arena_block;
+
 typedef struct
 {
     int index_number;
     uint32_t referenceCount; // we might start using this...
     unsigned int nheaders;
-    char * name[16];
+    char * name[16];  // these point into the arena
     char * value[16];
 
+    size_t arena_used;
+    rtsp_arena_block * arena_overflow;
+    char arena[RTSP_MESSAGE_ARENA_SIZE];
+
     int contentlength;
     char * content;
 
@@ -147,6 +157,14 @@ typedef struct
 } rtsp_message;
 
 #ifdef CONFIG_METADATA
+// Metadata goes to its consumers -- the pipe, multicast, the hub and MQTT, whichever are in use --
+// through a single ring. Each item is put in a package, once, with a reference for each consumer,
+// and each consumer reads the ring at its own pace, releasing its reference when it's done. The
+// last to release it frees it.
+// Producers take metadata_ring_lock, briefly, to add an item. Consumers don't take it unless they
+// have caught up and must wait. If the ring is full, the oldest item is taken from any consumer
+// that's so far behind it still hasn't read it, so a slow consumer loses items instead of holding
+// anyone up.
 typedef struct
 {
     uint32_t type;
@@ -154,180 +172,133 @@ typedef struct
     char * data;
     uint32_t length;
     rtsp_message * carrier;
+    int reference_count; // one for each consumer yet to finish with it
 } metadata_package;
 
-void pc_queue_init(pc_queue * the_queue, char * items, size_t item_size, uint32_t number_of_items,
-                   const char * name)
+typedef struct
 {
-    if (name) debug(2, "Creating metadata queue \"%s\".", name);
-    else debug(1, "Creating an unnamed metadata queue.");
+    const char * name;
+    int enabled;
+    uint64_t cursor;       // the sequence number of the next item to read
+    uint64_t items_missed; // taken by the producer because the consumer was too far behind
+} metadata_consumer;
 
-    pthread_mutex_init(&the_queue->pc_queue_lock, NULL);
-    pthread_cond_init(&the_queue->pc_queue_item_added_signal, NULL);
-    pthread_cond_init(&the_queue->pc_queue_item_removed_signal, NULL);
-    the_queue->item_size = item_size;
-    the_queue->items = items;
-    the_queue->count = 0;
-    the_queue->capacity = number_of_items;
-    the_queue->toq = 0;
-    the_queue->eoq = 0;
-
-    if (name == NULL) the_queue->name = NULL;
-    else the_queue->name = strdup(name);
-}
-
-void pc_queue_delete(pc_queue * the_queue)
+typedef enum
 {
-    if (the_queue->name) debug(2, "Deleting metadata queue \"%s\".", the_queue->name);
-    else debug(1, "Deleting an unnamed metadata queue.");
-
-    if (the_queue->name != NULL) free(the_queue->name);
-
-    // debug(2, "destroying pc_queue_item_removed_signal");
-    pthread_cond_destroy(&the_queue->pc_queue_item_removed_signal);
-    // debug(2, "destroying pc_queue_item_added_signal");
-    pthread_cond_destroy(&the_queue->pc_queue_item_added_signal);
-    // debug(2, "destroying pc_queue_lock");
-    pthread_mutex_destroy(&the_queue->pc_queue_lock);
-    // debug(2, "destroying signals and locks done");
-}
-
-int send_metadata(uint32_t type, uint32_t code, char * data, uint32_t length, rtsp_message * carrier,
-                  int block);
+    metadata_consumer_pipe,
+    metadata_consumer_multicast,
+    metadata_consumer_hub,
+    metadata_consumer_mqtt,
+    metadata_consumer_count
+} metadata_consumer_id;
+
+#define metadata_ring_size 512 // must be a power of two
+
+static metadata_package * metadata_ring[metadata_ring_size];
+static uint64_t metadata_ring_head; // the sequence number of the next item to add
+static int metadata_ring_references; // the number of enabled consumers
+static pthread_mutex_t metadata_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t metadata_ring_item_added_signal = PTHREAD_COND_INITIALIZER;
+static metadata_consumer metadata_consumers[metadata_consumer_count] = {
+    { "pipe", 0, 0, 0 }, { "multicast", 0, 0, 0 }, { "hub", 0, 0, 0 }, { "mqtt", 0, 0, 0 }
+};
 
-int send_ssnc_metadata(uint32_t code, char * data, uint32_t length, int block)
-{
-    return send_metadata('ssnc', code, data, length, NULL, block);
-}
+void msg_free(rtsp_message * * msgh);
 
-void pc_queue_cleanup_handler(void * arg)
+static void metadata_package_release(metadata_package * pack)
 {
-    // debug(1, "pc_queue_cleanup_handler called.");
-    pc_queue * the_queue = (pc_queue *)arg;
-    int rc = pthread_mutex_unlock(&the_queue->pc_queue_lock);
+    if (__atomic_sub_fetch(&pack->reference_count, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        if (pack->carrier) msg_free(&pack->carrier); // release the message
+        else if (pack->data) free(pack->data);
 
-    if (rc) debug(1, "Error unlocking for pc_queue_add_item or pc_queue_get_item.");
+        free(pack);
+    }
 }
 
-int pc_queue_add_item(pc_queue * the_queue, const void * the_stuff, int block)
+// the caller must hold metadata_ring_lock
+static void metadata_ring_add(metadata_package * pack)
 {
-    int response = 0;
-    int rc;
+    uint64_t head = metadata_ring_head;
 
-    if (the_queue)
+    if (head >= metadata_ring_size)
     {
-        if (block == 0)
-        {
-            rc = debug_mutex_lock(&the_queue->pc_queue_lock, 10000, 2);
-
-            if (rc == EBUSY) return EBUSY;
-        }
-        else rc = pthread_mutex_lock(&the_queue->pc_queue_lock);
-
-        if (rc) debug(1, "Error locking for pc_queue_add_item");
+        // the slot is to be reused, so the oldest item must be taken from any consumer yet to read it
+        uint64_t oldest = head - metadata_ring_size;
+        int i;
 
-        pthread_cleanup_push(pc_queue_cleanup_handler, (void *)the_queue);
-
-        // leave this out if you want this to return if the queue is already full
-        // irrespective of the block flag.
-        /*
-                    while (the_queue->count == the_queue->capacity) {
-                            rc = pthread_cond_wait(&the_queue->pc_queue_item_removed_signal,
-           &the_queue->pc_queue_lock); if (rc) debug(1, "Error waiting for item to be removed");
-                    }
-         */
-        if (the_queue->count < the_queue->capacity)
+        for (i = 0; i < metadata_consumer_count; i++)
         {
-            uint32_t i = the_queue->eoq;
-            void * p = the_queue->items + the_queue->item_size * i;
-            //    void * p = &the_queue->qbase + the_queue->item_size*the_queue->eoq;
-            memcpy(p, the_stuff, the_queue->item_size);
-
-            // update the pointer
-            i++;
+            metadata_consumer * consumer = &metadata_consumers[i];
+            uint64_t expected = oldest;
 
-            if (i == the_queue->capacity)
-                // fold pointer if necessary
-                i = 0;
-
-            the_queue->eoq = i;
-            the_queue->count++;
-
-            // debug(2,"metadata queue+ \"%s\" %d/%d.", the_queue->name, the_queue->count,
-            // the_queue->capacity);
-            if (the_queue->count == the_queue->capacity) debug(3, "metadata queue \"%s\": is now full with %d items in it!", the_queue->name,
-                                                               the_queue->count);
-
-            rc = pthread_cond_signal(&the_queue->pc_queue_item_added_signal);
+            if ((consumer->enabled) &&
+                (__atomic_compare_exchange_n(&consumer->cursor, &expected, oldest + 1, 0, __ATOMIC_ACQ_REL,
+                                             __ATOMIC_ACQUIRE)))
+            {
+                if (consumer->items_missed++ == 0)
+                    debug(2, "metadata consumer \"%s\" isn't keeping up -- items are being dropped.",
+                          consumer->name);
 
-            if (rc) debug(1, "metadata queue \"%s\": error signalling after pc_queue_add_item",
-                          the_queue->name);
-        }
-        else
-        {
-            response = EWOULDBLOCK; // a bit arbitrary, this.
-            debug(3,
-                  "metadata queue \"%s\": is already full with %d items in it. Not adding this item to "
-                  "the queue.",
-                  the_queue->name, the_queue->count);
+                metadata_package_release(
+                    __atomic_load_n(&metadata_ring[oldest & (metadata_ring_size - 1)], __ATOMIC_ACQUIRE));
+            }
         }
-
-        pthread_cleanup_pop(1); // unlock the queue lock.
-    }
-    else
-    {
-        debug(1, "Adding an item to a NULL queue");
     }
 
-    return response;
+    __atomic_store_n(&metadata_ring[head & (metadata_ring_size - 1)], pack, __ATOMIC_RELEASE);
+    __atomic_store_n(&metadata_ring_head, head + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&metadata_ring_item_added_signal);
 }
 
-int pc_queue_get_item(pc_queue * the_queue, void * the_stuff)
+// wait for the consumer's next item and take it -- the caller must release it
+static metadata_package * metadata_ring_get(metadata_consumer * consumer)
 {
-    int rc;
+    metadata_package * pack = NULL;
 
-    if (the_queue)
+    while (pack == NULL)
     {
-        rc = pthread_mutex_lock(&the_queue->pc_queue_lock);
+        uint64_t cursor = __atomic_load_n(&consumer->cursor, __ATOMIC_ACQUIRE);
 
-        if (rc) debug(1, "metadata queue \"%s\": error locking for pc_queue_get_item", the_queue->name);
+        if (cursor == __atomic_load_n(&metadata_ring_head, __ATOMIC_ACQUIRE))
+        {
+            pthread_mutex_lock(&metadata_ring_lock);
+            pthread_cleanup_push(pthread_cleanup_debug_mutex_unlock, (void *)&metadata_ring_lock);
 
-        pthread_cleanup_push(pc_queue_cleanup_handler, (void *)the_queue);
+            while (__atomic_load_n(&consumer->cursor, __ATOMIC_ACQUIRE) == metadata_ring_head)
+                pthread_cond_wait(&metadata_ring_item_added_signal, &metadata_ring_lock); // a cancellation point
 
-        while (the_queue->count == 0)
+            pthread_cleanup_pop(1);
+        }
+        else
         {
-            rc = pthread_cond_wait(&the_queue->pc_queue_item_added_signal, &the_queue->pc_queue_lock);
-
-            if (rc) debug(1, "metadata queue \"%s\": error waiting for item to be added", the_queue->name);
+            metadata_package * candidate =
+                __atomic_load_n(&metadata_ring[cursor & (metadata_ring_size - 1)], __ATOMIC_ACQUIRE);
+
+            // if the producer has taken this item away in the meantime, the cursor will have moved on,
+            // and the candidate mustn't be touched
+            if (__atomic_compare_exchange_n(&consumer->cursor, &cursor, cursor + 1, 0, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE))
+                pack = candidate;
         }
-        uint32_t i = the_queue->toq;
-        //    void * p = &the_queue->qbase + the_queue->item_size*the_queue->toq;
-        void * p = the_queue->items + the_queue->item_size * i;
-        memcpy(the_stuff, p, the_queue->item_size);
-
-        // update the pointer
-        i++;
-
-        if (i == the_queue->capacity)
-            // fold pointer if necessary
-            i = 0;
+    }
 
-        the_queue->toq = i;
-        the_queue->count--;
-        debug(3, "metadata queue- \"%s\" %d/%d.", the_queue->name, the_queue->count,
-              the_queue->capacity);
-        rc = pthread_cond_signal(&the_queue->pc_queue_item_removed_signal);
+    return pack;
+}
 
-        if (rc) debug(1, "metadata queue \"%s\": error signalling after pc_queue_get_item", the_queue->name);
+// true if the consumer has read everything in the ring so far
+static int metadata_ring_is_empty(metadata_consumer * consumer)
+{
+    return __atomic_load_n(&consumer->cursor, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&metadata_ring_head, __ATOMIC_ACQUIRE);
+}
 
-        pthread_cleanup_pop(1); // unlock the queue lock.
-    }
-    else
-    {
-        debug(1, "Removing an item from a NULL queue");
-    }
+int send_metadata(uint32_t type, uint32_t code, char * data, uint32_t length, rtsp_message * carrier,
+                  int block);
 
-    return 0;
+int send_ssnc_metadata(uint32_t code, char * data, uint32_t length, int block)
+{
+    return send_metadata('ssnc', code, data, length, NULL, block);
 }
 
 #endif /* ifdef CONFIG_METADATA */
@@ -336,12 +307,12 @@ int have_player(rtsp_conn_info * conn)
 {
     int response = 0;
 
-    debug_mutex_lock(&playing_conn_lock, 1000000, 3);
+    debug_mutex_lock(&conn->zone->playing_conn_lock, 1000000, 3);
 
-    if (playing_conn == conn) // this connection definitely has the play lock
+    if (conn->zone->playing_conn == conn) // this connection definitely has the play lock
         response = 1;
 
-    debug_mutex_unlock(&playing_conn_lock, 3);
+    debug_mutex_unlock(&conn->zone->playing_conn_lock, 3);
     return response;
 }
 
@@ -573,6 +544,33 @@ rtsp_message * msg_init(void)
     return msg;
 }
 
+// copy the string into the message's arena, returning a pointer to the copy
+static char * msg_arena_strdup(rtsp_message * msg, const char * str)
+{
+    size_t length = strlen(str) + 1;
+    char * p;
+
+    if (msg->arena_used + length <= sizeof(msg->arena))
+    {
+        p = msg->arena + msg->arena_used;
+        msg->arena_used += length;
+    }
+    else
+    {
+        rtsp_arena_block * block = malloc(sizeof(rtsp_arena_block) + length);
+
+        if (block == NULL) die("msg_arena_strdup -- can not allocate memory for message %d.",
+                                   msg->index_number);
+
+        block->next = msg->arena_overflow;
+        msg->arena_overflow = block;
+        p = block->data;
+    }
+
+    memcpy(p, str, length);
+    return p;
+}
+
 int msg_add_header(rtsp_message * msg, char * name, char * value)
 {
     if (msg->nheaders >= sizeof(msg->name) / sizeof(char *))
@@ -581,8 +579,8 @@ int msg_add_header(rtsp_message * msg, char * name, char * value)
         return 1;
     }
 
-    msg->name[msg->nheaders] = strdup(name);
-    msg->value[msg->nheaders] = strdup(value);
+    msg->name[msg->nheaders] = msg_arena_strdup(msg, name);
+    msg->value[msg->nheaders] = msg_arena_strdup(msg, value);
     msg->nheaders++;
 
     return 0;
@@ -647,12 +645,11 @@ void msg_free(rtsp_message * * msgh)
 
         if (msg->referenceCount == 0)
         {
-            unsigned int i;
-
-            for (i = 0; i < msg->nheaders; i++)
+            while (msg->arena_overflow)
             {
-                free(msg->name[i]);
-                free(msg->value[i]);
+                rtsp_arena_block * block = msg->arena_overflow;
+                msg->arena_overflow = block->next;
+                free(block);
             }
 
             if (msg->content) free(msg->content);
@@ -748,6 +745,54 @@ int msg_handle_line(rtsp_message * * pmsg, char * line)
     return 0;
 }
 
+static void rtsp_read_request_buffer_cleanup(void * arg)
+{
+    char * * buf = (char * *)arg;
+
+    free(*buf);
+}
+
+// Look for the end of the header section -- an empty line -- in buf, carrying on from where the
+// last look got to, so that nothing is scanned twice as more arrives. Lines may end with \r, \n
+// or \r\n. Returns the length of the header section, including the empty line, or 0 if it
+// hasn't all arrived yet.
+static ssize_t rtsp_find_end_of_header_section(const char * buf, ssize_t inbuf, ssize_t * scanned,
+                                               ssize_t * line_start)
+{
+    ssize_t i = *scanned;
+
+    while (i < inbuf)
+    {
+        if ((buf[i] == '\r') || (buf[i] == '\n'))
+        {
+            ssize_t line_length = i - *line_start;
+
+            if (buf[i] == '\r')
+            {
+                if (i + 1 == inbuf) break; // can't tell yet if a \n follows
+
+                if (buf[i + 1] == '\n') i++;
+            }
+
+            i++;
+            *line_start = i;
+
+            if (line_length == 0)
+            {
+                *scanned = i;
+                return i;
+            }
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    *scanned = i;
+    return 0;
+}
+
 enum rtsp_read_request_response rtsp_read_request(rtsp_conn_info * conn, rtsp_message * * the_packet)
 {
     *the_packet = NULL; // need this for error handling
@@ -763,13 +808,40 @@ enum rtsp_read_request_response rtsp_read_request(rtsp_conn_info * conn, rtsp_me
         return (rtsp_read_request_response_error);
     }
 
-    pthread_cleanup_push(malloc_cleanup, buf);
+    pthread_cleanup_push(rtsp_read_request_buffer_cleanup, (void *)&buf); // buf may be reallocated
     ssize_t nread;
     ssize_t inbuf = 0;
     int msg_size = -1;
+    ssize_t scanned = 0;    // how far the search for the end of the header section has got
+    ssize_t line_start = 0; // where the line being scanned starts
 
     while (msg_size < 0)
     {
+        if (inbuf == buflen)
+        {
+            // the header section hasn't ended yet, so make room for more of it
+            if (buflen >= RTSP_MAXIMUM_HEADER_SECTION_SIZE)
+            {
+                debug(1, "Connection %d: rtsp_read_request: the header section is too long.",
+                      conn->connection_number);
+                reply = rtsp_read_request_response_bad_packet;
+                goto shutdown;
+            }
+
+            char * new_buf = realloc(buf, buflen * 2 + 1);
+
+            if (!new_buf)
+            {
+                warn("Connection %d: rtsp_read_request: can't get a bigger buffer.",
+                     conn->connection_number);
+                reply = rtsp_read_request_response_error;
+                goto shutdown;
+            }
+
+            buf = new_buf;
+            buflen = buflen * 2;
+        }
+
         if (conn->stop != 0)
         {
             debug(3, "Connection %d: shutdown requested.", conn->connection_number);
@@ -822,23 +894,42 @@ enum rtsp_read_request_response rtsp_read_request(rtsp_conn_info * conn, rtsp_me
 
         inbuf += nread;
 
-        char * next;
+        ssize_t header_section_length =
+            rtsp_find_end_of_header_section(buf, inbuf, &scanned, &line_start);
 
-        while (msg_size < 0 && (next = nextline(buf, inbuf)))
+        if (header_section_length)
         {
-            msg_size = msg_handle_line(the_packet, buf);
+            // parse the lines in place, then move whatever of the content has arrived down to the
+            // start of the buffer in one go
+            char * line = buf;
+            char * next;
+
+            while (msg_size < 0 && (next = nextline(line, header_section_length - (line - buf))))
+            {
+                msg_size = msg_handle_line(the_packet, line);
 
-            if (!(*the_packet))
+                if (!(*the_packet))
+                {
+                    debug(1, "Connection %d: rtsp_read_request can't find an RTSP header.",
+                          conn->connection_number);
+                    reply = rtsp_read_request_response_bad_packet;
+                    goto shutdown;
+                }
+
+                line = next;
+            }
+
+            if (msg_size < 0)
             {
-                debug(1, "Connection %d: rtsp_read_request can't find an RTSP header.",
+                debug(1, "Connection %d: rtsp_read_request: malformed header section.",
                       conn->connection_number);
                 reply = rtsp_read_request_response_bad_packet;
                 goto shutdown;
             }
 
-            inbuf -= next - buf;
+            inbuf -= header_section_length;
 
-            if (inbuf) memmove(buf, next, inbuf);
+            if (inbuf) memmove(buf, buf + header_section_length, inbuf);
         }
     }
 
@@ -1315,12 +1406,12 @@ void handle_setup(rtsp_conn_info * conn, rtsp_message * req, rtsp_message * resp
         if (resp->respcode != 200)
         {
             debug(1, "Connection %d: SETUP error -- releasing the player lock.", conn->connection_number);
-            debug_mutex_lock(&playing_conn_lock, 1000000, 3);
+            debug_mutex_lock(&conn->zone->playing_conn_lock, 1000000, 3);
 
-            if (playing_conn == conn) // if we have the player
-                playing_conn = NULL;  // let it go
+            if (conn->zone->playing_conn == conn) // if we have the player
+                conn->zone->playing_conn = NULL;  // let it go
 
-            debug_mutex_unlock(&playing_conn_lock, 3);
+            debug_mutex_unlock(&conn->zone->playing_conn_lock, 3);
         }
     }
     else
@@ -1535,31 +1626,19 @@ char * base64_encode_so(const unsigned char * data, size_t input_length, char *
 static int fd = -1;
 // static int dirty = 0;
 
-pc_queue metadata_queue;
-#define metadata_queue_size      500
-metadata_package metadata_queue_items[metadata_queue_size];
 pthread_t metadata_thread;
 
 #ifdef CONFIG_METADATA_HUB
-pc_queue metadata_hub_queue;
-#define metadata_hub_queue_size  500
-metadata_package metadata_hub_queue_items[metadata_hub_queue_size];
 pthread_t metadata_hub_thread;
 #endif
 
 #ifdef CONFIG_MQTT
-pc_queue metadata_mqtt_queue;
-#define metadata_mqtt_queue_size 500
-metadata_package metadata_mqtt_queue_items[metadata_mqtt_queue_size];
 pthread_t metadata_mqtt_thread;
 #endif
 
 static int metadata_sock = -1;
 static struct sockaddr_in metadata_sockaddr;
 static char * metadata_sockmsg;
-pc_queue metadata_multicast_queue;
-#define metadata_multicast_queue_size 500
-metadata_package metadata_multicast_queue_items[metadata_queue_size];
 pthread_t metadata_multicast_thread;
 
 void metadata_create_multicast_socket(void)
@@ -1630,43 +1709,101 @@ static void metadata_close(void)
     fd = -1;
 }
 
-void metadata_multicast_process(uint32_t type, uint32_t code, char * data, uint32_t length)
+// Metadata multicast.
+// An item that fits in a datagram is sent in one, and a bigger one, such as cover art, is sent in
+// numbered chunks using the protocol:
+// ("ssnc", "chnk", packet_ix, packet_counts, packet_tag, packet_type, chunked_data)
+// The chunks of an item are handed to the kernel in batches, using sendmmsg() where available.
+// If metadata.socket_pack_items is set, small items that arrive together are packed into a
+// single datagram:
+// ("ssnc", "pack", then, for each item, type, code, length, data)
+// If metadata.socket_maximum_rate is set, sending is paced to that many kilobytes per second,
+// so that a burst of metadata doesn't crowd out the audio on a constrained network.
+
+#define METADATA_MULTICAST_BATCH 32              // chunks per sendmmsg() call
+#define METADATA_MULTICAST_PACED_BURST (16 * 1024) // most bytes in a batch when pacing
+
+static size_t metadata_sockmsg_packed = 0; // bytes in metadata_sockmsg waiting to be sent as a pack
+static uint64_t metadata_multicast_next_send_time = 0;
+
+// wait until bytes may be sent without exceeding the maximum rate, and account for them
+static void metadata_multicast_pace(size_t bytes)
 {
-    // debug(1, "Process multicast metadata with type %x, code %x and length %u.", type, code,
-    // length);
-    if (metadata_sock >= 0 && length < config.metadata_sockmsglength - 8)
+    if (config.metadata_socket_maximum_rate == 0) return;
+
+    uint64_t time_now = get_absolute_time_in_ns();
+
+    if (metadata_multicast_next_send_time > time_now)
+        usleep((metadata_multicast_next_send_time - time_now) / 1000);
+    else metadata_multicast_next_send_time = time_now;
+
+    // the rate is in kilobytes (1000 bytes) per second
+    metadata_multicast_next_send_time +=
+        ((uint64_t)bytes * 1000000) / config.metadata_socket_maximum_rate;
+}
+
+static void metadata_multicast_send(char * buffer, size_t length)
+{
+    metadata_multicast_pace(length);
+    sendto(metadata_sock, buffer, length, 0, (struct sockaddr *)&metadata_sockaddr,
+           sizeof(metadata_sockaddr));
+}
+
+// send any items packed into metadata_sockmsg
+static void metadata_multicast_flush(void)
+{
+    if ((metadata_sock >= 0) && (metadata_sockmsg_packed))
     {
-        char * ptr = metadata_sockmsg;
-        uint32_t v;
-        v = htonl(type);
-        memcpy(ptr, &v, 4);
-        ptr += 4;
-        v = htonl(code);
-        memcpy(ptr, &v, 4);
-        ptr += 4;
-        memcpy(ptr, data, length);
-        sendto(metadata_sock, metadata_sockmsg, length + 8, 0, (struct sockaddr *)&metadata_sockaddr,
-               sizeof(metadata_sockaddr));
+        metadata_multicast_send(metadata_sockmsg, metadata_sockmsg_packed);
+        metadata_sockmsg_packed = 0;
     }
-    else if (metadata_sock >= 0)
+}
+
+static void metadata_multicast_send_chunks(uint32_t type, uint32_t code, char * data,
+                                           uint32_t length)
+{
+    size_t chunk_size = config.metadata_sockmsglength - 24;
+    uint32_t chunk_total = length / chunk_size;
+
+    if (chunk_total * chunk_size < length)
     {
-        // send metadata in numbered chunks using the protocol:
-        // ("ssnc", "chnk", packet_ix, packet_counts, packet_tag, packet_type, chunked_data)
+        chunk_total++;
+    }
+
+    // each datagram is its 24-byte header followed by its part of the data, straight from the item
+    char headers[METADATA_MULTICAST_BATCH][24];
+    struct iovec iovecs[METADATA_MULTICAST_BATCH][2];
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr messages[METADATA_MULTICAST_BATCH];
+#else
+    struct msghdr messages[METADATA_MULTICAST_BATCH];
+#endif
 
-        uint32_t chunk_ix = 0;
-        uint32_t chunk_total = length / (config.metadata_sockmsglength - 24);
+    int batch_limit = METADATA_MULTICAST_BATCH;
 
-        if (chunk_total * (config.metadata_sockmsglength - 24) < length)
-        {
-            chunk_total++;
-        }
+    if (config.metadata_socket_maximum_rate)
+    {
+        batch_limit = METADATA_MULTICAST_PACED_BURST / config.metadata_sockmsglength;
 
-        uint32_t remaining = length;
-        uint32_t v;
-        char * data_crsr = data;
-        do
+        if (batch_limit < 1) batch_limit = 1;
+        else if (batch_limit > METADATA_MULTICAST_BATCH) batch_limit = METADATA_MULTICAST_BATCH;
+    }
+
+    uint32_t chunk_ix = 0;
+    uint32_t remaining = length;
+    uint32_t v;
+    char * data_crsr = data;
+
+    while (chunk_ix < chunk_total)
+    {
+        int batch = 0;
+        size_t batch_bytes = 0;
+
+        memset(messages, 0, sizeof(messages));
+
+        while ((batch < batch_limit) && (chunk_ix < chunk_total))
         {
-            char * ptr = metadata_sockmsg;
+            char * ptr = headers[batch];
             memcpy(ptr, "ssncchnk", 8);
             ptr += 8;
             v = htonl(chunk_ix);
@@ -1680,24 +1817,112 @@ void metadata_multicast_process(uint32_t type, uint32_t code, char * data, uint3
             ptr += 4;
             v = htonl(code);
             memcpy(ptr, &v, 4);
-            ptr += 4;
             size_t datalen = remaining;
 
-            if (datalen > config.metadata_sockmsglength - 24)
+            if (datalen > chunk_size)
             {
-                datalen = config.metadata_sockmsglength - 24;
+                datalen = chunk_size;
             }
 
-            memcpy(ptr, data_crsr, datalen);
+            iovecs[batch][0].iov_base = headers[batch];
+            iovecs[batch][0].iov_len = 24;
+            iovecs[batch][1].iov_base = data_crsr;
+            iovecs[batch][1].iov_len = datalen;
+#ifdef HAVE_SENDMMSG
+            struct msghdr * hdr = &messages[batch].msg_hdr;
+#else
+            struct msghdr * hdr = &messages[batch];
+#endif
+            hdr->msg_name = &metadata_sockaddr;
+            hdr->msg_namelen = sizeof(metadata_sockaddr);
+            hdr->msg_iov = iovecs[batch];
+            hdr->msg_iovlen = 2;
+
             data_crsr += datalen;
-            sendto(metadata_sock, metadata_sockmsg, datalen + 24, 0,
-                   (struct sockaddr *)&metadata_sockaddr, sizeof(metadata_sockaddr));
-            chunk_ix++;
             remaining -= datalen;
+            batch_bytes += datalen + 24;
+            chunk_ix++;
+            batch++;
+        }
+
+        metadata_multicast_pace(batch_bytes);
+
+        int sent = 0;
+#ifdef HAVE_SENDMMSG
+        while (sent < batch)
+        {
+            int r = sendmmsg(metadata_sock, &messages[sent], batch - sent, 0);
+
+            if (r <= 0)
+            {
+                debug(2, "metadata multicast: error %d sending chunks.", errno);
+                break;
+            }
 
-            if (remaining == 0) break;
+            sent += r;
         }
-        while (1);
+#else
+        for (sent = 0; sent < batch; sent++)
+            sendmsg(metadata_sock, &messages[sent], 0);
+#endif
+    }
+}
+
+void metadata_multicast_process(uint32_t type, uint32_t code, char * data, uint32_t length)
+{
+    // debug(1, "Process multicast metadata with type %x, code %x and length %u.", type, code,
+    // length);
+    if (metadata_sock < 0) return;
+
+    uint32_t v;
+
+    if ((config.metadata_socket_pack_items) && (length + 12 <= config.metadata_sockmsglength - 8))
+    {
+        // it can be packed -- but if there isn't room for it, send what's been packed so far
+        if (metadata_sockmsg_packed + length + 12 > config.metadata_sockmsglength)
+            metadata_multicast_flush();
+
+        if (metadata_sockmsg_packed == 0)
+        {
+            memcpy(metadata_sockmsg, "ssncpack", 8);
+            metadata_sockmsg_packed = 8;
+        }
+
+        char * ptr = metadata_sockmsg + metadata_sockmsg_packed;
+        v = htonl(type);
+        memcpy(ptr, &v, 4);
+        ptr += 4;
+        v = htonl(code);
+        memcpy(ptr, &v, 4);
+        ptr += 4;
+        v = htonl(length);
+        memcpy(ptr, &v, 4);
+        ptr += 4;
+
+        if (length) memcpy(ptr, data, length);
+
+        metadata_sockmsg_packed += length + 12;
+        return;
+    }
+
+    // keep everything in order
+    metadata_multicast_flush();
+
+    if (length < config.metadata_sockmsglength - 8)
+    {
+        char * ptr = metadata_sockmsg;
+        v = htonl(type);
+        memcpy(ptr, &v, 4);
+        ptr += 4;
+        v = htonl(code);
+        memcpy(ptr, &v, 4);
+        ptr += 4;
+        memcpy(ptr, data, length);
+        metadata_multicast_send(metadata_sockmsg, length + 8);
+    }
+    else
+    {
+        metadata_multicast_send_chunks(type, code, data, length);
     }
 }
 
@@ -1796,11 +2021,7 @@ void metadata_process(uint32_t type, uint32_t code, char * data, uint32_t length
 void metadata_pack_cleanup_function(void * arg)
 {
     // debug(1, "metadata_pack_cleanup_function called");
-    metadata_package * pack = (metadata_package *)arg;
-
-    if (pack->carrier) msg_free(&pack->carrier); // release the message
-    else if (pack->data) free(pack->data);
-
+    metadata_package_release((metadata_package *)arg);
     // debug(1, "metadata_pack_cleanup_function exit");
 }
 
@@ -1808,37 +2029,34 @@ void metadata_thread_cleanup_function(__attribute__((unused)) void * arg)
 {
     // debug(2, "metadata_thread_cleanup_function called");
     metadata_close();
-    pc_queue_delete(&metadata_queue);
 }
 
 void * metadata_thread_function(__attribute__((unused)) void * ignore)
 {
-    // create a pc_queue for passing information to a threaded metadata handler
-    pc_queue_init(&metadata_queue, (char *)&metadata_queue_items, sizeof(metadata_package),
-                  metadata_queue_size, "pipe");
+    set_thread_scheduling(TC_metadata);
     metadata_create_multicast_socket();
-    metadata_package pack;
+    metadata_package * pack;
 
     pthread_cleanup_push(metadata_thread_cleanup_function, NULL);
 
     while (1)
     {
-        pc_queue_get_item(&metadata_queue, &pack);
-        pthread_cleanup_push(metadata_pack_cleanup_function, (void *)&pack);
+        pack = metadata_ring_get(&metadata_consumers[metadata_consumer_pipe]);
+        pthread_cleanup_push(metadata_pack_cleanup_function, (void *)pack);
 
         if (config.metadata_enabled)
         {
-            if (pack.carrier)
+            if (pack->carrier)
             {
-                debug(3, "     pipe: type %x, code %x, length %u, message %d.", pack.type, pack.code,
-                      pack.length, pack.carrier->index_number);
+                debug(3, "     pipe: type %x, code %x, length %u, message %d.", pack->type, pack->code,
+                      pack->length, pack->carrier->index_number);
             }
             else
             {
-                debug(3, "     pipe: type %x, code %x, length %u.", pack.type, pack.code, pack.length);
+                debug(3, "     pipe: type %x, code %x, length %u.", pack->type, pack->code, pack->length);
             }
 
-            metadata_process(pack.type, pack.code, pack.data, pack.length);
+            metadata_process(pack->type, pack->code, pack->data, pack->length);
             debug(3, "     pipe: done.");
         }
 
@@ -1852,47 +2070,48 @@ void metadata_multicast_thread_cleanup_function(__attribute__((unused)) void * a
 {
     // debug(2, "metadata_multicast_thread_cleanup_function called");
     metadata_delete_multicast_socket();
-    pc_queue_delete(&metadata_multicast_queue);
 }
 
 void * metadata_multicast_thread_function(__attribute__((unused)) void * ignore)
 {
-    // create a pc_queue for passing information to a threaded metadata handler
-    pc_queue_init(&metadata_multicast_queue, (char *)&metadata_multicast_queue_items,
-                  sizeof(metadata_package), metadata_multicast_queue_size, "multicast");
+    set_thread_scheduling(TC_metadata);
     metadata_create_multicast_socket();
-    metadata_package pack;
+    metadata_package * pack;
 
     pthread_cleanup_push(metadata_multicast_thread_cleanup_function, NULL);
 
     while (1)
     {
-        pc_queue_get_item(&metadata_multicast_queue, &pack);
-        pthread_cleanup_push(metadata_pack_cleanup_function, (void *)&pack);
+        pack = metadata_ring_get(&metadata_consumers[metadata_consumer_multicast]);
+        pthread_cleanup_push(metadata_pack_cleanup_function, (void *)pack);
 
         if (config.metadata_enabled)
         {
-            if (pack.carrier)
+            if (pack->carrier)
             {
                 debug(3,
                       "                                                                    multicast: type "
                       "%x, code %x, length %u, message %d.",
-                      pack.type, pack.code, pack.length, pack.carrier->index_number);
+                      pack->type, pack->code, pack->length, pack->carrier->index_number);
             }
             else
             {
                 debug(3,
                       "                                                                    multicast: type "
                       "%x, code %x, length %u.",
-                      pack.type, pack.code, pack.length);
+                      pack->type, pack->code, pack->length);
             }
 
-            metadata_multicast_process(pack.type, pack.code, pack.data, pack.length);
+            metadata_multicast_process(pack->type, pack->code, pack->data, pack->length);
             debug(3,
                   "                                                                    multicast: done.");
         }
 
         pthread_cleanup_pop(1);
+
+        // nothing more has arrived, so send anything packed rather than wait for more
+        if (metadata_ring_is_empty(&metadata_consumers[metadata_consumer_multicast]))
+            metadata_multicast_flush();
     }
     pthread_cleanup_pop(1); // will never happen
     pthread_exit(NULL);
@@ -1907,35 +2126,32 @@ void metadata_hub_thread_cleanup_function(__attribute__((unused)) void * arg)
 {
     // debug(2, "metadata_hub_thread_cleanup_function called");
     metadata_hub_close();
-    pc_queue_delete(&metadata_hub_queue);
 }
 
 void * metadata_hub_thread_function(__attribute__((unused)) void * ignore)
 {
-    // create a pc_queue for passing information to a threaded metadata handler
-    pc_queue_init(&metadata_hub_queue, (char *)&metadata_hub_queue_items, sizeof(metadata_package),
-                  metadata_hub_queue_size, "hub");
-    metadata_package pack;
+    set_thread_scheduling(TC_metadata);
+    metadata_package * pack;
 
     pthread_cleanup_push(metadata_hub_thread_cleanup_function, NULL);
 
     while (1)
     {
-        pc_queue_get_item(&metadata_hub_queue, &pack);
-        pthread_cleanup_push(metadata_pack_cleanup_function, (void *)&pack);
+        pack = metadata_ring_get(&metadata_consumers[metadata_consumer_hub]);
+        pthread_cleanup_push(metadata_pack_cleanup_function, (void *)pack);
 
-        if (pack.carrier)
+        if (pack->carrier)
         {
-            debug(3, "                    hub: type %x, code %x, length %u, message %d.", pack.type,
-                  pack.code, pack.length, pack.carrier->index_number);
+            debug(3, "                    hub: type %x, code %x, length %u, message %d.", pack->type,
+                  pack->code, pack->length, pack->carrier->index_number);
         }
         else
         {
-            debug(3, "                    hub: type %x, code %x, length %u.", pack.type, pack.code,
-                  pack.length);
+            debug(3, "                    hub: type %x, code %x, length %u.", pack->type, pack->code,
+                  pack->length);
         }
 
-        metadata_hub_process_metadata(pack.type, pack.code, pack.data, pack.length);
+        metadata_hub_process_metadata(pack->type, pack->code, pack->data, pack->length);
         debug(3, "                    hub: done.");
         pthread_cleanup_pop(1);
     }
@@ -1954,40 +2170,37 @@ void metadata_mqtt_thread_cleanup_function(__attribute__((unused)) void * arg)
 {
     // debug(2, "metadata_mqtt_thread_cleanup_function called");
     metadata_mqtt_close();
-    pc_queue_delete(&metadata_mqtt_queue);
     // debug(2, "metadata_mqtt_thread_cleanup_function done");
 }
 
 void * metadata_mqtt_thread_function(__attribute__((unused)) void * ignore)
 {
-    // create a pc_queue for passing information to a threaded metadata handler
-    pc_queue_init(&metadata_mqtt_queue, (char *)&metadata_mqtt_queue_items, sizeof(metadata_package),
-                  metadata_mqtt_queue_size, "mqtt");
-    metadata_package pack;
+    set_thread_scheduling(TC_metadata);
+    metadata_package * pack;
 
     pthread_cleanup_push(metadata_mqtt_thread_cleanup_function, NULL);
 
     while (1)
     {
-        pc_queue_get_item(&metadata_mqtt_queue, &pack);
-        pthread_cleanup_push(metadata_pack_cleanup_function, (void *)&pack);
+        pack = metadata_ring_get(&metadata_consumers[metadata_consumer_mqtt]);
+        pthread_cleanup_push(metadata_pack_cleanup_function, (void *)pack);
 
         if (config.mqtt_enabled)
         {
-            if (pack.carrier)
+            if (pack->carrier)
             {
                 debug(3,
                       "                                        mqtt: type %x, code %x, length %u, message "
                       "%d.",
-                      pack.type, pack.code, pack.length, pack.carrier->index_number);
+                      pack->type, pack->code, pack->length, pack->carrier->index_number);
             }
             else
             {
                 debug(3, "                                        mqtt: type %x, code %x, length %u.",
-                      pack.type, pack.code, pack.length);
+                      pack->type, pack->code, pack->length);
             }
 
-            mqtt_process_metadata(pack.type, pack.code, pack.data, pack.length);
+            mqtt_process_metadata(pack->type, pack->code, pack->data, pack->length);
             debug(3, "                                        mqtt: done.");
         }
 
@@ -2003,6 +2216,20 @@ void metadata_init(void)
 {
     int ret;
 
+    // the consumers must be known before anything is added to the ring
+    metadata_consumers[metadata_consumer_pipe].enabled = config.metadata_enabled;
+    metadata_consumers[metadata_consumer_multicast].enabled = config.metadata_enabled;
+#ifdef CONFIG_METADATA_HUB
+    metadata_consumers[metadata_consumer_hub].enabled = 1;
+#endif
+#ifdef CONFIG_MQTT
+    metadata_consumers[metadata_consumer_mqtt].enabled = 1;
+#endif
+    int i;
+
+    for (i = 0; i < metadata_consumer_count; i++)
+        if (metadata_consumers[i].enabled) metadata_ring_references++;
+
     if (config.metadata_enabled)
     {
         // create the metadata pipe, if necessary
@@ -2098,8 +2325,8 @@ void metadata_stop(void)
     }
 }
 
-int send_metadata_to_queue(pc_queue * queue, uint32_t type, uint32_t code, char * data,
-                           uint32_t length, rtsp_message * carrier, int block)
+int send_metadata(uint32_t type, uint32_t code, char * data, uint32_t length, rtsp_message * carrier,
+                  int block)
 {
     // parameters: type, code, pointer to data or NULL, length of data or NULL,
     // the rtsp_message or
@@ -2108,92 +2335,64 @@ int send_metadata_to_queue(pc_queue * queue, uint32_t type, uint32_t code, char
     // and must not be
     // freed until the data has been read. So, it is passed to send_metadata to be
     // retained,
-    // sent to the thread where metadata is processed and released (and probably
-    // freed).
+    // sent to the threads where metadata is processed and released (and probably
+    // freed) when the last of them is done with it.
 
     // The rtsp_message is also sent for certain non-'core' messages.
 
     // The reading of the parameters is a bit complex
     // If the rtsp_message field is non-null, then it represents an rtsp_message
     // and the data pointer is assumed to point to something within it.
-    // The reference counter of the rtsp_message is incremented here and
-    // should be decremented by the metadata handler when finished.
+    // The reference counter of the rtsp_message is incremented here, once, and
+    // is decremented when the package carrying it is released by its last consumer.
     // If the reference count reduces to zero, the message will be freed.
 
     // If the rtsp_message is NULL, then if the pointer is non-null then the data it
-    // points to, of the length specified, is memcpy'd and passed to the metadata
-    // handler. The handler should free it when done.
+    // points to, of the length specified, is memcpy'd into the package, once. It's
+    // freed with the package.
     // If the rtsp_message is NULL and the pointer is also NULL, nothing further
     // is done.
 
-    metadata_package pack;
+    if (metadata_ring_references == 0) return 0; // no consumers
 
-    pack.type = type;
-    pack.code = code;
-    pack.length = length;
-    pack.carrier = carrier;
-    pack.data = data;
+    int rc;
 
-    if (pack.carrier)
+    if (block == 0)
     {
-        msg_retain(pack.carrier);
+        rc = debug_mutex_lock(&metadata_ring_lock, 10000, 2);
+
+        if (rc == EBUSY) return EBUSY;
     }
     else
     {
-        if (data) pack.data = memdup(data, length); // only if it's not a null
+        rc = pthread_mutex_lock(&metadata_ring_lock);
     }
 
-    int rc = pc_queue_add_item(queue, &pack, block);
+    if (rc) debug(1, "Error locking the metadata ring.");
 
-    if (rc != 0)
-    {
-        if (pack.carrier)
-        {
-            if (rc == EWOULDBLOCK)
-                debug(2,
-                      "metadata queue \"%s\" full, dropping message item: type %x, code %x, data %x, "
-                      "length %u, message %d.",
-                      queue->name, pack.type, pack.code, pack.data, pack.length,
-                      pack.carrier->index_number);
+    metadata_package * pack = malloc(sizeof(metadata_package));
 
-            msg_free(&pack.carrier);
-        }
-        else
-        {
-            if (rc == EWOULDBLOCK)
-                debug(
-                    2,
-                    "metadata queue \"%s\" full, dropping data item: type %x, code %x, data %x, length %u.",
-                    queue->name, pack.type, pack.code, pack.data, pack.length);
+    if (pack == NULL) die("Can't allocate a metadata package.");
 
-            if (pack.data) free(pack.data);
-        }
-    }
-
-    return rc;
-}
+    pack->type = type;
+    pack->code = code;
+    pack->length = length;
+    pack->carrier = carrier;
+    pack->data = data;
+    pack->reference_count = metadata_ring_references;
 
-int send_metadata(uint32_t type, uint32_t code, char * data, uint32_t length, rtsp_message * carrier,
-                  int block)
-{
-    int rc;
-
-    if (config.metadata_enabled)
+    if (pack->carrier)
     {
-        rc = send_metadata_to_queue(&metadata_queue, type, code, data, length, carrier, block);
-        rc =
-            send_metadata_to_queue(&metadata_multicast_queue, type, code, data, length, carrier, block);
+        msg_retain(pack->carrier);
+    }
+    else
+    {
+        if (data) pack->data = memdup(data, length); // only if it's not a null
     }
 
-#ifdef CONFIG_METADATA_HUB
-    rc = send_metadata_to_queue(&metadata_hub_queue, type, code, data, length, carrier, block);
-#endif
-
-#ifdef CONFIG_MQTT
-    rc = send_metadata_to_queue(&metadata_mqtt_queue, type, code, data, length, carrier, block);
-#endif
-
-    return rc;
+    metadata_ring_add(pack);
+    pthread_mutex_unlock(&metadata_ring_lock);
+    return 0;
 }
 
 static void handle_set_parameter_metadata(__attribute__((unused)) rtsp_conn_info * conn,
@@ -2359,6 +2558,178 @@ static void handle_set_parameter(rtsp_conn_info * conn, rtsp_message * req, rtsp
     resp->respcode = 200;
 }
 
+// take the stream parameters from an ANNOUNCE's SDP, which is modified in the process -- each line
+// is NUL-terminated. Returns 0 if all is well, -1 if the key is bad or -2 if the stream is unknown
+int rtsp_parse_announce_sdp(rtsp_conn_info * conn, char * sdp, int length)
+{
+    conn->stream.type = ast_unknown;
+    char * pssid = NULL;
+    char * paesiv = NULL;
+    char * prsaaeskey = NULL;
+    char * pfmtp = NULL;
+    char * pminlatency = NULL;
+    char * pmaxlatency = NULL;
+    //    char *pAudioMediaInfo = NULL;
+    char * pUncompressedCDAudio = NULL;
+    char * cp = sdp;
+    int cp_left = length;
+    char * next;
+
+    while (cp_left && cp)
+    {
+        next = nextline(cp, cp_left);
+        cp_left -= next - cp;
+
+        if (!strncmp(cp, "a=rtpmap:96 L16/44100/2", strlen("a=rtpmap:96 L16/44100/2"))) pUncompressedCDAudio = cp + strlen("a=rtpmap:96 L16/44100/2");
+
+        //      if (!strncmp(cp, "m=audio", strlen("m=audio")))
+        //        pAudioMediaInfo = cp + strlen("m=audio");
+
+        if (!strncmp(cp, "o=iTunes", strlen("o=iTunes"))) pssid = cp + strlen("o=iTunes");
+
+        if (!strncmp(cp, "a=fmtp:", strlen("a=fmtp:"))) pfmtp = cp + strlen("a=fmtp:");
+
+        if (!strncmp(cp, "a=aesiv:", strlen("a=aesiv:"))) paesiv = cp + strlen("a=aesiv:");
+
+        if (!strncmp(cp, "a=rsaaeskey:", strlen("a=rsaaeskey:"))) prsaaeskey = cp + strlen("a=rsaaeskey:");
+
+        if (!strncmp(cp, "a=min-latency:", strlen("a=min-latency:"))) pminlatency = cp + strlen("a=min-latency:");
+
+        if (!strncmp(cp, "a=max-latency:", strlen("a=max-latency:"))) pmaxlatency = cp + strlen("a=max-latency:");
+
+        cp = next;
+    }
+
+    if (pUncompressedCDAudio)
+    {
+        debug(2, "An uncompressed PCM stream has been detected.");
+        conn->stream.type = ast_uncompressed;
+        conn->max_frames_per_packet = 352; // number of audio frames per packet.
+        conn->input_rate = 44100;
+        conn->input_num_channels = 2;
+        conn->input_bit_depth = 16;
+        conn->input_bytes_per_frame = conn->input_num_channels * ((conn->input_bit_depth + 7) / 8);
+
+        /*
+           int y = strlen(pAudioMediaInfo);
+           if (y > 0) {
+           char obf[4096];
+           if (y > 4096)
+            y = 4096;
+           char *p = pAudioMediaInfo;
+           char *obfp = obf;
+           int obfc;
+           for (obfc = 0; obfc < y; obfc++) {
+            snprintf(obfp, 3, "%02X", (unsigned int)*p);
+            p++;
+            obfp += 2;
+           };
+         * obfp = 0;
+           debug(1, "AudioMediaInfo: \"%s\".", obf);
+           }
+         */
+    }
+
+    if (pssid)
+    {
+        uint32_t ssid = uatoi(pssid);
+        debug(3, "Synchronisation Source Identifier: %08X,%u", ssid, ssid);
+    }
+
+    if (pminlatency)
+    {
+        conn->minimum_latency = atoi(pminlatency);
+        debug(3, "Minimum latency %d specified", conn->minimum_latency);
+    }
+
+    if (pmaxlatency)
+    {
+        conn->maximum_latency = atoi(pmaxlatency);
+        debug(3, "Maximum latency %d specified", conn->maximum_latency);
+    }
+
+    if ((paesiv == NULL) && (prsaaeskey == NULL))
+    {
+        // debug(1,"Unencrypted session requested?");
+        conn->stream.encrypted = 0;
+    }
+    else
+    {
+        conn->stream.encrypted = 1;
+        // debug(1,"Encrypted session requested");
+    }
+
+    if (conn->stream.encrypted)
+    {
+        int len, keylen;
+        uint8_t * aesiv = base64_dec(paesiv, &len);
+
+        if (len != 16)
+        {
+            warn("client announced aeskey of %d bytes, wanted 16", len);
+            free(aesiv);
+            return -1;
+        }
+
+        memcpy(conn->stream.aesiv, aesiv, 16);
+        free(aesiv);
+
+        uint8_t * rsaaeskey = base64_dec(prsaaeskey, &len);
+        uint8_t * aeskey = rsa_apply(rsaaeskey, len, &keylen, RSA_MODE_KEY);
+        free(rsaaeskey);
+
+        if (keylen != 16)
+        {
+            warn("client announced rsaaeskey of %d bytes, wanted 16", keylen);
+            free(aeskey);
+            return -1;
+        }
+
+        memcpy(conn->stream.aeskey, aeskey, 16);
+        free(aeskey);
+    }
+
+    if (pfmtp)
+    {
+        conn->stream.type = ast_apple_lossless;
+        debug(3, "An ALAC stream has been detected.");
+
+        // Set reasonable connection defaults
+        conn->stream.fmtp[0] = 96;
+        conn->stream.fmtp[1] = 352;
+        conn->stream.fmtp[2] = 0;
+        conn->stream.fmtp[3] = 16;
+        conn->stream.fmtp[4] = 40;
+        conn->stream.fmtp[5] = 10;
+        conn->stream.fmtp[6] = 14;
+        conn->stream.fmtp[7] = 2;
+        conn->stream.fmtp[8] = 255;
+        conn->stream.fmtp[9] = 0;
+        conn->stream.fmtp[10] = 0;
+        conn->stream.fmtp[11] = 44100;
+
+        unsigned int i = 0;
+        unsigned int max_param = sizeof(conn->stream.fmtp) / sizeof(conn->stream.fmtp[0]);
+        char * found;
+
+        while ((found = strsep(&pfmtp, " \t")) != NULL && i < max_param)
+            conn->stream.fmtp[i++] = atoi(found);
+        // here we should check the sanity of the fmtp values
+        // for (i = 0; i < sizeof(conn->stream.fmtp) / sizeof(conn->stream.fmtp[0]); i++)
+        //  debug(1,"  fmtp[%2d] is: %10d",i,conn->stream.fmtp[i]);
+
+        // set the parameters of the player (as distinct from the parameters of the decoder -- that's
+        // done later).
+        conn->max_frames_per_packet = conn->stream.fmtp[1]; // number of audio frames per packet.
+        conn->input_rate = conn->stream.fmtp[11];
+        conn->input_num_channels = conn->stream.fmtp[7];
+        conn->input_bit_depth = conn->stream.fmtp[3];
+        conn->input_bytes_per_frame = conn->input_num_channels * ((conn->input_bit_depth + 7) / 8);
+    }
+
+    return conn->stream.type == ast_unknown ? -2 : 0;
+}
+
 static void handle_announce(rtsp_conn_info * conn, rtsp_message * req, rtsp_message * resp)
 {
     debug(3, "Connection %d: ANNOUNCE", conn->connection_number);
@@ -2367,37 +2738,37 @@ static void handle_announce(rtsp_conn_info * conn, rtsp_message * req, rtsp_mess
     int should_wait = 0; // this will be true if you're trying to break in to the current session
     int interrupting_current_session = 0;
 
-    // try to become the current playing_conn
+    // try to become the zone's playing_conn
 
-    debug_mutex_lock(&playing_conn_lock, 1000000, 3); // get it
+    debug_mutex_lock(&conn->zone->playing_conn_lock, 1000000, 3); // get it
 
-    if (playing_conn == NULL)
+    if (conn->zone->playing_conn == NULL)
     {
-        playing_conn = conn;
+        conn->zone->playing_conn = conn;
         have_the_player = 1;
     }
-    else if (playing_conn == conn)
+    else if (conn->zone->playing_conn == conn)
     {
         have_the_player = 1;
         warn("Duplicate ANNOUNCE, by the look of it!");
     }
-    else if (playing_conn->stop)
+    else if (conn->zone->playing_conn->stop)
     {
         debug(1, "Connection %d ANNOUNCE is waiting for connection %d to shut down.",
-              conn->connection_number, playing_conn->connection_number);
+              conn->connection_number, conn->zone->playing_conn->connection_number);
         should_wait = 1;
     }
     else if (config.allow_session_interruption == 1)
     {
         debug(2, "Connection %d: ANNOUNCE: asking playing connection %d to shut down.",
-              conn->connection_number, playing_conn->connection_number);
-        playing_conn->stop = 1;
+              conn->connection_number, conn->zone->playing_conn->connection_number);
+        conn->zone->playing_conn->stop = 1;
         interrupting_current_session = 1;
         should_wait = 1;
-        pthread_cancel(playing_conn->thread); // asking the RTSP thread to exit
+        pthread_cancel(conn->zone->playing_conn->thread); // asking the RTSP thread to exit
     }
 
-    debug_mutex_unlock(&playing_conn_lock, 3);
+    debug_mutex_unlock(&conn->zone->playing_conn_lock, 3);
 
     if (should_wait)
     {
@@ -2405,15 +2776,15 @@ static void handle_announce(rtsp_conn_info * conn, rtsp_message * req, rtsp_mess
 
         while ((time_remaining > 0) && (have_the_player == 0))
         {
-            debug_mutex_lock(&playing_conn_lock, 1000000, 3); // get it
+            debug_mutex_lock(&conn->zone->playing_conn_lock, 1000000, 3); // get it
 
-            if (playing_conn == NULL)
+            if (conn->zone->playing_conn == NULL)
             {
-                playing_conn = conn;
+                conn->zone->playing_conn = conn;
                 have_the_player = 1;
             }
 
-            debug_mutex_unlock(&playing_conn_lock, 3);
+            debug_mutex_unlock(&conn->zone->playing_conn_lock, 3);
 
             if (have_the_player == 0)
             {
@@ -2457,171 +2828,18 @@ static void handle_announce(rtsp_conn_info * conn, rtsp_message * req, rtsp_mess
            }
          */
 
-        conn->stream.type = ast_unknown;
         resp->respcode = 456; // 456 - Header Field Not Valid for Resource
-        char * pssid = NULL;
-        char * paesiv = NULL;
-        char * prsaaeskey = NULL;
-        char * pfmtp = NULL;
-        char * pminlatency = NULL;
-        char * pmaxlatency = NULL;
-        //    char *pAudioMediaInfo = NULL;
-        char * pUncompressedCDAudio = NULL;
-        char * cp = req->content;
-        int cp_left = req->contentlength;
-        char * next;
 
-        while (cp_left && cp)
+        // the SDP is parsed in place, so it's captured first, as it came
+        if (config.capture_directory)
         {
-            next = nextline(cp, cp_left);
-            cp_left -= next - cp;
-
-            if (!strncmp(cp, "a=rtpmap:96 L16/44100/2", strlen("a=rtpmap:96 L16/44100/2"))) pUncompressedCDAudio = cp + strlen("a=rtpmap:96 L16/44100/2");
-
-            //      if (!strncmp(cp, "m=audio", strlen("m=audio")))
-            //        pAudioMediaInfo = cp + strlen("m=audio");
-
-            if (!strncmp(cp, "o=iTunes", strlen("o=iTunes"))) pssid = cp + strlen("o=iTunes");
-
-            if (!strncmp(cp, "a=fmtp:", strlen("a=fmtp:"))) pfmtp = cp + strlen("a=fmtp:");
-
-            if (!strncmp(cp, "a=aesiv:", strlen("a=aesiv:"))) paesiv = cp + strlen("a=aesiv:");
-
-            if (!strncmp(cp, "a=rsaaeskey:", strlen("a=rsaaeskey:"))) prsaaeskey = cp + strlen("a=rsaaeskey:");
+            if (conn->capture) capture_stop(conn->capture);
 
-            if (!strncmp(cp, "a=min-latency:", strlen("a=min-latency:"))) pminlatency = cp + strlen("a=min-latency:");
-
-            if (!strncmp(cp, "a=max-latency:", strlen("a=max-latency:"))) pmaxlatency = cp + strlen("a=max-latency:");
-
-            cp = next;
-        }
-
-        if (pUncompressedCDAudio)
-        {
-            debug(2, "An uncompressed PCM stream has been detected.");
-            conn->stream.type = ast_uncompressed;
-            conn->max_frames_per_packet = 352; // number of audio frames per packet.
-            conn->input_rate = 44100;
-            conn->input_num_channels = 2;
-            conn->input_bit_depth = 16;
-            conn->input_bytes_per_frame = conn->input_num_channels * ((conn->input_bit_depth + 7) / 8);
-
-            /*
-               int y = strlen(pAudioMediaInfo);
-               if (y > 0) {
-               char obf[4096];
-               if (y > 4096)
-                y = 4096;
-               char *p = pAudioMediaInfo;
-               char *obfp = obf;
-               int obfc;
-               for (obfc = 0; obfc < y; obfc++) {
-                snprintf(obfp, 3, "%02X", (unsigned int)*p);
-                p++;
-                obfp += 2;
-               };
-             * obfp = 0;
-               debug(1, "AudioMediaInfo: \"%s\".", obf);
-               }
-             */
-        }
-
-        if (pssid)
-        {
-            uint32_t ssid = uatoi(pssid);
-            debug(3, "Synchronisation Source Identifier: %08X,%u", ssid, ssid);
-        }
-
-        if (pminlatency)
-        {
-            conn->minimum_latency = atoi(pminlatency);
-            debug(3, "Minimum latency %d specified", conn->minimum_latency);
-        }
-
-        if (pmaxlatency)
-        {
-            conn->maximum_latency = atoi(pmaxlatency);
-            debug(3, "Maximum latency %d specified", conn->maximum_latency);
+            conn->capture = capture_start(config.capture_directory, conn->connection_number,
+                                          req->content, req->contentlength);
         }
 
-        if ((paesiv == NULL) && (prsaaeskey == NULL))
-        {
-            // debug(1,"Unencrypted session requested?");
-            conn->stream.encrypted = 0;
-        }
-        else
-        {
-            conn->stream.encrypted = 1;
-            // debug(1,"Encrypted session requested");
-        }
-
-        if (conn->stream.encrypted)
-        {
-            int len, keylen;
-            uint8_t * aesiv = base64_dec(paesiv, &len);
-
-            if (len != 16)
-            {
-                warn("client announced aeskey of %d bytes, wanted 16", len);
-                free(aesiv);
-                goto out;
-            }
-
-            memcpy(conn->stream.aesiv, aesiv, 16);
-            free(aesiv);
-
-            uint8_t * rsaaeskey = base64_dec(prsaaeskey, &len);
-            uint8_t * aeskey = rsa_apply(rsaaeskey, len, &keylen, RSA_MODE_KEY);
-            free(rsaaeskey);
-
-            if (keylen != 16)
-            {
-                warn("client announced rsaaeskey of %d bytes, wanted 16", keylen);
-                free(aeskey);
-                goto out;
-            }
-
-            memcpy(conn->stream.aeskey, aeskey, 16);
-            free(aeskey);
-        }
-
-        if (pfmtp)
-        {
-            conn->stream.type = ast_apple_lossless;
-            debug(3, "An ALAC stream has been detected.");
-
-            // Set reasonable connection defaults
-            conn->stream.fmtp[0] = 96;
-            conn->stream.fmtp[1] = 352;
-            conn->stream.fmtp[2] = 0;
-            conn->stream.fmtp[3] = 16;
-            conn->stream.fmtp[4] = 40;
-            conn->stream.fmtp[5] = 10;
-            conn->stream.fmtp[6] = 14;
-            conn->stream.fmtp[7] = 2;
-            conn->stream.fmtp[8] = 255;
-            conn->stream.fmtp[9] = 0;
-            conn->stream.fmtp[10] = 0;
-            conn->stream.fmtp[11] = 44100;
-
-            unsigned int i = 0;
-            unsigned int max_param = sizeof(conn->stream.fmtp) / sizeof(conn->stream.fmtp[0]);
-            char * found;
-
-            while ((found = strsep(&pfmtp, " \t")) != NULL && i < max_param)
-                conn->stream.fmtp[i++] = atoi(found);
-            // here we should check the sanity of the fmtp values
-            // for (i = 0; i < sizeof(conn->stream.fmtp) / sizeof(conn->stream.fmtp[0]); i++)
-            //  debug(1,"  fmtp[%2d] is: %10d",i,conn->stream.fmtp[i]);
-
-            // set the parameters of the player (as distinct from the parameters of the decoder -- that's
-            // done later).
-            conn->max_frames_per_packet = conn->stream.fmtp[1]; // number of audio frames per packet.
-            conn->input_rate = conn->stream.fmtp[11];
-            conn->input_num_channels = conn->stream.fmtp[7];
-            conn->input_bit_depth = conn->stream.fmtp[3];
-            conn->input_bytes_per_frame = conn->input_num_channels * ((conn->input_bit_depth + 7) / 8);
-        }
+        if (rtsp_parse_announce_sdp(conn, req->content, req->contentlength) == -1) goto out;
 
         if (conn->stream.type == ast_unknown)
         {
@@ -2682,6 +2900,7 @@ static void handle_announce(rtsp_conn_info * conn, rtsp_message * req, rtsp_mess
         }
 
         resp->respcode = 200;
+        player_prepare(conn); // get the output device ready while the session is being set up
     }
     else
     {
@@ -2696,12 +2915,12 @@ static void handle_announce(rtsp_conn_info * conn, rtsp_message * req, rtsp_mess
     {
         debug(1, "Connection %d: Error in handling ANNOUNCE. Unlocking the play lock.",
               conn->connection_number);
-        debug_mutex_lock(&playing_conn_lock, 1000000, 3); // get it
+        debug_mutex_lock(&conn->zone->playing_conn_lock, 1000000, 3); // get it
 
-        if (playing_conn == conn)                     // if we managed to acquire it
-            playing_conn = NULL;                      // let it go
+        if (conn->zone->playing_conn == conn) // if we managed to acquire it
+            conn->zone->playing_conn = NULL;  // let it go
 
-        debug_mutex_unlock(&playing_conn_lock, 3);
+        debug_mutex_unlock(&conn->zone->playing_conn_lock, 3);
     }
 }
 
@@ -2719,7 +2938,7 @@ static struct method_handler
                         { "RECORD",        handle_record        },
                         { NULL,            NULL                 } };
 
-static void apple_challenge(int fd, rtsp_message * req, rtsp_message * resp)
+static void apple_challenge(int fd, const uint8_t * hw_addr, rtsp_message * req, rtsp_message * resp)
 {
     char * hdr = msg_get_header(req, "Apple-Challenge");
 
@@ -2769,7 +2988,7 @@ static void apple_challenge(int fd, rtsp_message * req, rtsp_message * resp)
 
     for (i = 0; i < 6; i++)
     {
-        *bp++ = config.hw_addr[i];
+        *bp++ = hw_addr[i];
     }
 
     int buflen, resplen;
@@ -3025,6 +3244,13 @@ void rtsp_conversation_thread_cleanup_function(void * arg)
 
     if (conn->player_thread) player_stop(conn);
 
+    // the receivers have been stopped with the player
+    if (conn->capture)
+    {
+        capture_stop(conn->capture);
+        conn->capture = NULL;
+    }
+
     debug(3, "Closing timing, control and audio sockets...");
 
     if (conn->control_socket) close(conn->control_socket);
@@ -3087,15 +3313,15 @@ void rtsp_conversation_thread_cleanup_function(void * arg)
     pthread_mutex_destroy(&conn->watchdog_mutex);
 
     debug(3, "Connection %d: Checking play lock.", conn->connection_number);
-    debug_mutex_lock(&playing_conn_lock, 1000000, 3); // get it
+    debug_mutex_lock(&conn->zone->playing_conn_lock, 1000000, 3); // get it
 
-    if (playing_conn == conn)                       // if it's ours
+    if (conn->zone->playing_conn == conn) // if it's ours
     {
         debug(3, "Connection %d: Unlocking play lock.", conn->connection_number);
-        playing_conn = NULL; // let it go
+        conn->zone->playing_conn = NULL; // let it go
     }
 
-    debug_mutex_unlock(&playing_conn_lock, 3);
+    debug_mutex_unlock(&conn->zone->playing_conn_lock, 3);
 
     debug(2, "Connection %d: terminated.", conn->connection_number);
     conn->running = 0;
@@ -3108,15 +3334,9 @@ void msg_cleanup_function(void * arg)
     msg_free((rtsp_message * *)arg);
 }
 
-static void * rtsp_conversation_thread_func(void * pconn)
+// create the locks and the condition variable the player uses
+void rtsp_conn_initialise_locks(rtsp_conn_info * conn)
 {
-    rtsp_conn_info * conn = pconn;
-
-    // create the watchdog mutex, initialise the watchdog time and start the watchdog thread;
-    conn->watchdog_bark_time = get_absolute_time_in_ns();
-    pthread_mutex_init(&conn->watchdog_mutex, NULL);
-    pthread_create(&conn->player_watchdog_thread, NULL, &player_watchdog_thread_code, (void *)conn);
-
     int rc = pthread_mutex_init(&conn->flush_mutex, NULL);
 
     if (rc) die("Connection %d: error %d initialising flush_mutex.", conn->connection_number, rc);
@@ -3142,6 +3362,18 @@ static void * rtsp_conversation_thread_func(void * pconn)
     rc = pthread_mutex_init(&conn->volume_control_mutex, NULL);
 
     if (rc) die("Connection %d: error %d initialising volume_control_mutex.", conn->connection_number, rc);
+}
+
+static void * rtsp_conversation_thread_func(void * pconn)
+{
+    rtsp_conn_info * conn = pconn;
+
+    // create the watchdog mutex, initialise the watchdog time and start the watchdog thread;
+    conn->watchdog_bark_time = get_absolute_time_in_ns();
+    pthread_mutex_init(&conn->watchdog_mutex, NULL);
+    pthread_create(&conn->player_watchdog_thread, NULL, &player_watchdog_thread_code, (void *)conn);
+
+    rtsp_conn_initialise_locks(conn);
 
     // nothing before this is cancellable
     pthread_cleanup_push(rtsp_conversation_thread_cleanup_function, (void *)conn);
@@ -3175,7 +3407,7 @@ static void * rtsp_conversation_thread_func(void * pconn)
                   req->method),
             debug_print_msg_headers(debug_level, req);
 
-            apple_challenge(conn->fd, req, resp);
+            apple_challenge(conn->fd, conn->zone->hw_addr, req, resp);
             hdr = msg_get_header(req, "CSeq");
 
             if (hdr) msg_add_header(resp, "CSeq", hdr);
@@ -3359,41 +3591,376 @@ static void * rtsp_conversation_thread_func(void * pconn)
    }
  */
 
-void rtsp_listen_loop_cleanup_handler(__attribute__((unused)) void * arg)
+// The listener waits for activity on its listening sockets, and on connections that have been
+// accepted but haven't sent anything yet, using epoll or kqueue where available, or otherwise
+// poll(), which, unlike select(), isn't limited to FD_SETSIZE descriptors.
+// A conversation thread is only started when a connection has something to say, so clients that
+// connect just to see if we're there and then close again don't cost a thread each time.
+
+#define RTSP_LISTEN_EVENTS        16
+#define RTSP_LISTEN_WAIT_MS       5000
+#define RTSP_SILENT_CONNECTION_TIMEOUT_NS ((uint64_t)60000000000) // close after this long
+
+typedef struct rtsp_event_source
+{
+    int fd;
+    rtsp_conn_info * conn; // NULL for a listening socket
+    zone * zone;            // the zone a listening socket is for
+    uint64_t accepted_time;
+    struct rtsp_event_source * next; // in the list of silent connections
+} rtsp_event_source;
+
+static int rtsp_event_queue = -1;
+static rtsp_event_source * rtsp_silent_connections = NULL;
+
+#if !defined(HAVE_EPOLL_CREATE1) && !defined(HAVE_KQUEUE)
+static struct pollfd * rtsp_pollfds = NULL;
+static rtsp_event_source * * rtsp_poll_sources = NULL;
+static int rtsp_poll_count = 0;
+#endif
+
+static int rtsp_event_queue_open(void)
+{
+#if defined(HAVE_EPOLL_CREATE1)
+    rtsp_event_queue = epoll_create1(EPOLL_CLOEXEC);
+#elif defined(HAVE_KQUEUE)
+    rtsp_event_queue = kqueue();
+
+    if (rtsp_event_queue >= 0) fcntl(rtsp_event_queue, F_SETFD, FD_CLOEXEC);
+#else
+    rtsp_event_queue = 0; // nothing to open for poll()
+#endif
+    return rtsp_event_queue;
+}
+
+static void rtsp_event_queue_close(void)
+{
+#if defined(HAVE_EPOLL_CREATE1) || defined(HAVE_KQUEUE)
+
+    if (rtsp_event_queue >= 0) close(rtsp_event_queue);
+
+#else
+    free(rtsp_pollfds);
+    free(rtsp_poll_sources);
+    rtsp_pollfds = NULL;
+    rtsp_poll_sources = NULL;
+    rtsp_poll_count = 0;
+#endif
+    rtsp_event_queue = -1;
+}
+
+static int rtsp_event_queue_add(rtsp_event_source * source)
+{
+#if defined(HAVE_EPOLL_CREATE1)
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = source;
+    return epoll_ctl(rtsp_event_queue, EPOLL_CTL_ADD, source->fd, &event);
+#elif defined(HAVE_KQUEUE)
+    struct kevent event;
+    EV_SET(&event, source->fd, EVFILT_READ, EV_ADD, 0, 0, source);
+    return kevent(rtsp_event_queue, &event, 1, NULL, 0, NULL);
+#else
+    struct pollfd * pollfds = realloc(rtsp_pollfds, (rtsp_poll_count + 1) * sizeof(struct pollfd));
+
+    if (pollfds == NULL) return -1;
+
+    rtsp_pollfds = pollfds;
+    rtsp_event_source * * sources =
+        realloc(rtsp_poll_sources, (rtsp_poll_count + 1) * sizeof(rtsp_event_source *));
+
+    if (sources == NULL) return -1;
+
+    rtsp_poll_sources = sources;
+    rtsp_pollfds[rtsp_poll_count].fd = source->fd;
+    rtsp_pollfds[rtsp_poll_count].events = POLLIN;
+    rtsp_pollfds[rtsp_poll_count].revents = 0;
+    rtsp_poll_sources[rtsp_poll_count] = source;
+    rtsp_poll_count++;
+    return 0;
+#endif
+}
+
+static void rtsp_event_queue_remove(rtsp_event_source * source)
+{
+#if defined(HAVE_EPOLL_CREATE1)
+    struct epoll_event event; // ignored, but must be non-NULL on older kernels
+    epoll_ctl(rtsp_event_queue, EPOLL_CTL_DEL, source->fd, &event);
+#elif defined(HAVE_KQUEUE)
+    struct kevent event;
+    EV_SET(&event, source->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+    kevent(rtsp_event_queue, &event, 1, NULL, 0, NULL);
+#else
+    int i;
+
+    for (i = 0; i < rtsp_poll_count; i++)
+    {
+        if (rtsp_poll_sources[i] == source)
+        {
+            rtsp_poll_count--;
+            rtsp_pollfds[i] = rtsp_pollfds[rtsp_poll_count];
+            rtsp_poll_sources[i] = rtsp_poll_sources[rtsp_poll_count];
+            break;
+        }
+    }
+
+#endif
+}
+
+// wait for sources to become readable, returning how many are in ready[], or -1 on error
+static int rtsp_event_queue_wait(rtsp_event_source * * ready, int timeout_ms)
+{
+    int i, n;
+
+#if defined(HAVE_EPOLL_CREATE1)
+    struct epoll_event events[RTSP_LISTEN_EVENTS];
+    n = epoll_wait(rtsp_event_queue, events, RTSP_LISTEN_EVENTS, timeout_ms); // a cancellation point
+
+    for (i = 0; i < n; i++)
+        ready[i] = events[i].data.ptr;
+#elif defined(HAVE_KQUEUE)
+    struct kevent events[RTSP_LISTEN_EVENTS];
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000;
+    pthread_testcancel(); // kevent isn't a cancellation point
+    n = kevent(rtsp_event_queue, NULL, 0, events, RTSP_LISTEN_EVENTS, &timeout);
+
+    for (i = 0; i < n; i++)
+        ready[i] = events[i].udata;
+#else
+    n = poll(rtsp_pollfds, rtsp_poll_count, timeout_ms); // a cancellation point
+
+    if (n > 0)
+    {
+        n = 0;
+
+        for (i = 0; (i < rtsp_poll_count) && (n < RTSP_LISTEN_EVENTS); i++)
+        {
+            if (rtsp_pollfds[i].revents) ready[n++] = rtsp_poll_sources[i];
+        }
+    }
+
+#endif
+    return n;
+}
+
+static void rtsp_silent_connection_discard(rtsp_event_source * source, int close_it)
+{
+    rtsp_event_source * * p = &rtsp_silent_connections;
+
+    while ((*p) && (*p != source))
+        p = &(*p)->next;
+
+    if (*p) *p = source->next;
+
+    rtsp_event_queue_remove(source);
+
+    if (close_it)
+    {
+        close(source->fd);
+        free(source->conn);
+    }
+
+    free(source);
+}
+
+static void rtsp_start_conversation_thread(rtsp_conn_info * conn)
+{
+    //      usleep(500000);
+    //      pthread_t rtsp_conversation_thread;
+    //      conn->thread = rtsp_conversation_thread;
+    //      conn->stop = 0; // record's memory has been zeroed
+    //      conn->authorized = 0; // record's memory has been zeroed
+    // fcntl(conn->fd, F_SETFL, O_NONBLOCK);
+
+    int ret = pthread_create(&conn->thread, NULL, rtsp_conversation_thread_func,
+                             conn); // also acts as a memory barrier
+
+    if (ret)
+    {
+        char errorstring[1024];
+        strerror_r(ret, (char *)errorstring, sizeof(errorstring));
+        die("Connection %d: cannot create an RTSP conversation thread. Error %d: \"%s\".",
+            conn->connection_number, ret, (char *)errorstring);
+    }
+
+    debug(3, "Successfully created RTSP receiver thread %d.", conn->connection_number);
+    conn->running = 1; // this must happen before the thread is tracked
+    track_thread(conn);
+}
+
+// a silent connection has become readable -- either it has something to say, or it has closed
+static void rtsp_silent_connection_ready(rtsp_event_source * source)
+{
+    char c;
+    ssize_t r = recv(source->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    if (r > 0)
+    {
+        rtsp_conn_info * conn = source->conn;
+        rtsp_silent_connection_discard(source, 0);
+        rtsp_start_conversation_thread(conn);
+    }
+    else if ((r == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
+    {
+        debug(2, "Connection %d: closed without a request.", source->conn->connection_number);
+        rtsp_silent_connection_discard(source, 1);
+    }
+}
+
+static void rtsp_expire_silent_connections(void)
+{
+    uint64_t time_now = get_absolute_time_in_ns();
+    rtsp_event_source * source = rtsp_silent_connections;
+
+    while (source)
+    {
+        rtsp_event_source * next = source->next;
+
+        if (time_now - source->accepted_time > RTSP_SILENT_CONNECTION_TIMEOUT_NS)
+        {
+            debug(1, "Connection %d: closed, as nothing was received on it.",
+                  source->conn->connection_number);
+            rtsp_silent_connection_discard(source, 1);
+        }
+
+        source = next;
+    }
+}
+
+static void rtsp_accept_connection(int acceptfd, zone * z)
+{
+    rtsp_conn_info * conn = malloc(sizeof(rtsp_conn_info));
+
+    if (conn == 0) die("Couldn't allocate memory for an rtsp_conn_info record.");
+
+    memset(conn, 0, sizeof(rtsp_conn_info));
+    conn->connection_number = RTSP_connection_index++;
+    conn->zone = z;
+    socklen_t slen = sizeof(conn->remote);
+
+    conn->fd = accept(acceptfd, (struct sockaddr *)&conn->remote, &slen);
+
+    if (conn->fd < 0)
+    {
+        debug(1, "Connection %d: New connection on port %d not accepted:", conn->connection_number,
+              z->port);
+        perror("failed to accept connection");
+        free(conn);
+    }
+    else
+    {
+        SOCKADDR * local_info = (SOCKADDR *)&conn->local;
+        socklen_t size_of_reply = sizeof(*local_info);
+        memset(local_info, 0, sizeof(SOCKADDR));
+
+        if (getsockname(conn->fd, (struct sockaddr *)local_info, &size_of_reply) == 0)
+        {
+            // IPv4:
+            if (local_info->SAFAMILY == AF_INET)
+            {
+                char ip4[INET_ADDRSTRLEN]; // space to hold the IPv4 string
+                char remote_ip4[INET_ADDRSTRLEN]; // space to hold the IPv4 string
+                struct sockaddr_in * sa = (struct sockaddr_in *)local_info;
+                inet_ntop(AF_INET, &(sa->sin_addr), ip4, INET_ADDRSTRLEN);
+                unsigned short int tport = ntohs(sa->sin_port);
+                sa = (struct sockaddr_in *)&conn->remote;
+                inet_ntop(AF_INET, &(sa->sin_addr), remote_ip4, INET_ADDRSTRLEN);
+                unsigned short int rport = ntohs(sa->sin_port);
+                debug(2, "Connection %d: new connection from %s:%u to self at %s:%u.",
+                      conn->connection_number, remote_ip4, rport, ip4, tport);
+            }
+
+#ifdef AF_INET6
+
+            if (local_info->SAFAMILY == AF_INET6)
+            {
+                // IPv6:
+
+                char ip6[INET6_ADDRSTRLEN]; // space to hold the IPv6 string
+                char remote_ip6[INET6_ADDRSTRLEN]; // space to hold the IPv6 string
+                struct sockaddr_in6 * sa6 =
+                    (struct sockaddr_in6 *)local_info; // pretend this is loaded with something
+                inet_ntop(AF_INET6, &(sa6->sin6_addr), ip6, INET6_ADDRSTRLEN);
+                u_int16_t tport = ntohs(sa6->sin6_port);
+
+                sa6 = (struct sockaddr_in6 *)&conn->remote; // pretend this is loaded with something
+                inet_ntop(AF_INET6, &(sa6->sin6_addr), remote_ip6, INET6_ADDRSTRLEN);
+                u_int16_t rport = ntohs(sa6->sin6_port);
+                debug(2, "Connection %d: new connection from [%s]:%u to self at [%s]:%u.",
+                      conn->connection_number, remote_ip6, rport, ip6, tport);
+            }
+
+#endif
+        }
+        else
+        {
+            debug(1, "Error figuring out Shairport Sync's own IP number.");
+        }
+
+        // wait for it to say something before giving it a thread
+        rtsp_event_source * source = malloc(sizeof(rtsp_event_source));
+
+        if (source == NULL) die("Couldn't allocate memory for an rtsp_event_source record.");
+
+        source->fd = conn->fd;
+        source->conn = conn;
+        source->zone = z;
+        source->accepted_time = get_absolute_time_in_ns();
+
+        if (rtsp_event_queue_add(source) == 0)
+        {
+            source->next = rtsp_silent_connections;
+            rtsp_silent_connections = source;
+        }
+        else
+        {
+            debug(1, "Connection %d: can't wait for a request, so starting its thread now.",
+                  conn->connection_number);
+            free(source);
+            rtsp_start_conversation_thread(conn);
+        }
+    }
+}
+
+void rtsp_listen_loop_cleanup_handler(void * arg)
 {
     int oldState;
 
     pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
     debug(2, "rtsp_listen_loop_cleanup_handler called.");
     cancel_all_RTSP_threads();
-    int * sockfd = (int *)arg;
+
+    while (rtsp_silent_connections)
+        rtsp_silent_connection_discard(rtsp_silent_connections, 1);
+
+    rtsp_event_queue_close();
+    rtsp_event_source * listeners = (rtsp_event_source *)arg;
 
     mdns_unregister();
 
-    if (sockfd) free(sockfd);
+    if (listeners) free(listeners);
 
     pthread_setcancelstate(oldState, NULL);
 }
 
-void rtsp_listen_loop(void)
+// open the listening sockets for a zone's port, adding them to sockfd and sockzone, and return
+// how many there are
+static int rtsp_open_listeners(zone * z, int * * sockfd, zone * * * sockzone, int * nsock)
 {
-    int oldState;
-
-    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
     struct addrinfo hints, * info, * p;
     char portstr[6];
-    int * sockfd = NULL;
-    int nsock = 0;
-    int i, ret;
-
-    playing_conn = NULL; // the data structure representing the connection that has the player.
+    int count = 0;
+    int ret;
 
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
 
-    snprintf(portstr, 6, "%d", config.port);
+    snprintf(portstr, 6, "%d", z->port);
 
     // debug(1,"listen socket port request is \"%s\".",portstr);
 
@@ -3469,48 +4036,82 @@ void rtsp_listen_loop(void)
             else
 #endif
             family = "IPv4";
-            debug(1, "unable to listen on %s port %d. The error is: \"%s\".", family, config.port,
+            debug(1, "unable to listen on %s port %d. The error is: \"%s\".", family, z->port,
                   strerror(errno));
             continue;
         }
 
         listen(fd, 5);
-        nsock++;
-        sockfd = realloc(sockfd, nsock * sizeof(int));
-        sockfd[nsock - 1] = fd;
+        (*nsock)++;
+        *sockfd = realloc(*sockfd, *nsock * sizeof(int));
+        *sockzone = realloc(*sockzone, *nsock * sizeof(zone *));
+
+        if ((*sockfd == NULL) || (*sockzone == NULL)) die("Couldn't allocate memory for the RTSP listeners.");
+
+        (*sockfd)[*nsock - 1] = fd;
+        (*sockzone)[*nsock - 1] = z;
+        count++;
     }
 
     freeaddrinfo(info);
+    return count;
+}
+
+void rtsp_listen_loop(void)
+{
+    int oldState;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
+    int * sockfd = NULL;
+    zone * * sockzone = NULL;
+    int nsock = 0;
+    int i, ret;
+
+    for (i = 0; i < zone_count; i++)
+    {
+        if (rtsp_open_listeners(&zones[i], &sockfd, &sockzone, &nsock) == 0)
+        {
+            if (i == 0) break; // nothing is open -- see below
+
+            die("could not establish a service for zone \"%s\" on port %d -- program terminating.",
+                zones[i].name, zones[i].port);
+        }
+    }
 
     if (nsock)
     {
-        int maxfd = -1;
-        fd_set fds;
-        FD_ZERO(&fds);
+        if (rtsp_event_queue_open() < 0) die("Can't create the RTSP listener's event queue.");
+
+        rtsp_event_source * listeners = malloc(nsock * sizeof(rtsp_event_source));
+
+        if (listeners == NULL) die("Couldn't allocate memory for the RTSP listeners.");
 
         for (i = 0; i < nsock; i++)
         {
-            if (sockfd[i] > maxfd) maxfd = sockfd[i];
+            listeners[i].fd = sockfd[i];
+            listeners[i].conn = NULL;
+            listeners[i].zone = sockzone[i];
+            listeners[i].accepted_time = 0;
+            listeners[i].next = NULL;
+
+            if (rtsp_event_queue_add(&listeners[i]) != 0)
+                die("Can't add a listening socket to the RTSP listener's event queue.");
         }
 
+        free(sockfd);
+        free(sockzone);
+
         mdns_register();
 
         pthread_setcancelstate(oldState, NULL);
-        int acceptfd;
-        struct timeval tv;
-        pthread_cleanup_push(rtsp_listen_loop_cleanup_handler, (void *)sockfd);
+        pthread_cleanup_push(rtsp_listen_loop_cleanup_handler, (void *)listeners);
         do
         {
-            pthread_testcancel();
-            tv.tv_sec = 60;
-            tv.tv_usec = 0;
+            rtsp_event_source * ready[RTSP_LISTEN_EVENTS];
 
-            for (i = 0; i < nsock; i++)
-            {
-                FD_SET(sockfd[i], &fds);
-            }
+            pthread_testcancel();
 
-            ret = select(maxfd + 1, &fds, 0, 0, &tv);
+            ret = rtsp_event_queue_wait(ready, RTSP_LISTEN_WAIT_MS);
 
             if (ret < 0)
             {
@@ -3521,109 +4122,13 @@ void rtsp_listen_loop(void)
 
             cleanup_threads();
 
-            acceptfd = -1;
-
-            for (i = 0; i < nsock; i++)
-            {
-                if (FD_ISSET(sockfd[i], &fds))
-                {
-                    acceptfd = sockfd[i];
-                    break;
-                }
-            }
-
-            if (acceptfd < 0) // timeout
-                continue;
-
-            rtsp_conn_info * conn = malloc(sizeof(rtsp_conn_info));
-
-            if (conn == 0) die("Couldn't allocate memory for an rtsp_conn_info record.");
-
-            memset(conn, 0, sizeof(rtsp_conn_info));
-            conn->connection_number = RTSP_connection_index++;
-            socklen_t slen = sizeof(conn->remote);
-
-            conn->fd = accept(acceptfd, (struct sockaddr *)&conn->remote, &slen);
-
-            if (conn->fd < 0)
+            for (i = 0; i < ret; i++)
             {
-                debug(1, "Connection %d: New connection on port %d not accepted:", conn->connection_number,
-                      config.port);
-                perror("failed to accept connection");
-                free(conn);
+                if (ready[i]->conn == NULL) rtsp_accept_connection(ready[i]->fd, ready[i]->zone);
+                else rtsp_silent_connection_ready(ready[i]);
             }
-            else
-            {
-                SOCKADDR * local_info = (SOCKADDR *)&conn->local;
-                socklen_t size_of_reply = sizeof(*local_info);
-                memset(local_info, 0, sizeof(SOCKADDR));
 
-                if (getsockname(conn->fd, (struct sockaddr *)local_info, &size_of_reply) == 0)
-                {
-                    // IPv4:
-                    if (local_info->SAFAMILY == AF_INET)
-                    {
-                        char ip4[INET_ADDRSTRLEN]; // space to hold the IPv4 string
-                        char remote_ip4[INET_ADDRSTRLEN]; // space to hold the IPv4 string
-                        struct sockaddr_in * sa = (struct sockaddr_in *)local_info;
-                        inet_ntop(AF_INET, &(sa->sin_addr), ip4, INET_ADDRSTRLEN);
-                        unsigned short int tport = ntohs(sa->sin_port);
-                        sa = (struct sockaddr_in *)&conn->remote;
-                        inet_ntop(AF_INET, &(sa->sin_addr), remote_ip4, INET_ADDRSTRLEN);
-                        unsigned short int rport = ntohs(sa->sin_port);
-                        debug(2, "Connection %d: new connection from %s:%u to self at %s:%u.",
-                              conn->connection_number, remote_ip4, rport, ip4, tport);
-                    }
-
-#ifdef AF_INET6
-
-                    if (local_info->SAFAMILY == AF_INET6)
-                    {
-                        // IPv6:
-
-                        char ip6[INET6_ADDRSTRLEN]; // space to hold the IPv6 string
-                        char remote_ip6[INET6_ADDRSTRLEN]; // space to hold the IPv6 string
-                        struct sockaddr_in6 * sa6 =
-                            (struct sockaddr_in6 *)local_info; // pretend this is loaded with something
-                        inet_ntop(AF_INET6, &(sa6->sin6_addr), ip6, INET6_ADDRSTRLEN);
-                        u_int16_t tport = ntohs(sa6->sin6_port);
-
-                        sa6 = (struct sockaddr_in6 *)&conn->remote; // pretend this is loaded with something
-                        inet_ntop(AF_INET6, &(sa6->sin6_addr), remote_ip6, INET6_ADDRSTRLEN);
-                        u_int16_t rport = ntohs(sa6->sin6_port);
-                        debug(2, "Connection %d: new connection from [%s]:%u to self at [%s]:%u.",
-                              conn->connection_number, remote_ip6, rport, ip6, tport);
-                    }
-
-#endif
-                }
-                else
-                {
-                    debug(1, "Error figuring out Shairport Sync's own IP number.");
-                }
-
-                //      usleep(500000);
-                //      pthread_t rtsp_conversation_thread;
-                //      conn->thread = rtsp_conversation_thread;
-                //      conn->stop = 0; // record's memory has been zeroed
-                //      conn->authorized = 0; // record's memory has been zeroed
-                // fcntl(conn->fd, F_SETFL, O_NONBLOCK);
-
-                ret = pthread_create(&conn->thread, NULL, rtsp_conversation_thread_func,
-                                     conn); // also acts as a memory barrier
-
-                if (ret)
-                {
-                    char errorstring[1024];
-                    strerror_r(ret, (char *)errorstring, sizeof(errorstring));
-                    die("Connection %d: cannot create an RTSP conversation thread. Error %d: \"%s\".",
-                        conn->connection_number, ret, (char *)errorstring);
-                }
-
-                debug(3, "Successfully created RTSP receiver thread %d.", conn->connection_number);
-                conn->running = 1; // this must happen before the thread is tracked
-                track_thread(conn);
-            }
+            rtsp_expire_silent_connections();
         }
         while (1);
         pthread_cleanup_pop(1); // should never happen
@@ -3,7 +3,6 @@
 
 #include "player.h"
 
-extern rtsp_conn_info * playing_conn;
 extern rtsp_conn_info * * conns;
 
 void rtsp_listen_loop(void);
@@ -12,6 +11,10 @@ void rtsp_request_shutdown_stream(void);
 
 void cancel_all_RTSP_threads(void);
 
+// these let a session be set up without an RTSP conversation, e.g. to replay a capture
+void rtsp_conn_initialise_locks(rtsp_conn_info * conn);
+int rtsp_parse_announce_sdp(rtsp_conn_info * conn, char * sdp, int length);
+
 // initialise and completely delete the metadata stuff
 
 void metadata_init(void);
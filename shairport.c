@@ -35,6 +35,7 @@
 #include <popt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -63,8 +64,21 @@
 #include "activity_monitor.h"
 #include "audio.h"
 #include "common.h"
+#include "latency_histogram.h"
+#include "metrics.h"
+#include "pipeline_profile.h"
 #include "rtp.h"
 #include "rtsp.h"
+#include "trace.h"
+#include "zone.h"
+
+#ifdef CONFIG_REPLAY
+#include "replay.h"
+#endif
+
+#ifdef CONFIG_BENCH
+#include "bench.h"
+#endif
 
 #if defined(CONFIG_DACP_CLIENT)
 #include "dacp.h"
@@ -114,6 +128,13 @@ int killOption = 0;
 int daemonisewith = 0;
 int daemonisewithout = 0;
 
+#ifdef CONFIG_REPLAY
+// the replay harness is built as a separate program -- see replay.c
+static char * replay_path = NULL;
+static char * replay_sdp_path = NULL;
+static double replay_speed = 1.0;
+#endif
+
 // static int shutting_down = 0;
 char configuration_file_path[4096 + 1];
 char actual_configuration_file_path[4096 + 1];
@@ -135,87 +156,6 @@ void print_version(void)
     }
 }
 
-#ifdef CONFIG_SOXR
-pthread_t soxr_time_check_thread;
-void * soxr_time_check(__attribute__((unused)) void * arg)
-{
-    const int buffer_length = 352;
-    int32_t inbuffer[buffer_length * 2];
-    int32_t outbuffer[(buffer_length + 1) * 2];
-
-    // int32_t *outbuffer = (int32_t*)malloc((buffer_length+1)*2*sizeof(int32_t));
-    // int32_t *inbuffer = (int32_t*)malloc((buffer_length)*2*sizeof(int32_t));
-
-    // generate a sample signal
-    const double frequency = 440; //
-
-    int i;
-
-    int number_of_iterations = 0;
-    uint64_t soxr_start_time = get_absolute_time_in_ns();
-    uint64_t loop_until_time =
-        (uint64_t)1500000000 + soxr_start_time; // loop for a second and a half, max -- no need to be
-
-    // able to cancel it, do _don't even try_!
-    while (get_absolute_time_in_ns() < loop_until_time)
-    {
-        number_of_iterations++;
-
-        for (i = 0; i < buffer_length; i++)
-        {
-            double w = sin(i * (frequency + number_of_iterations * 2) * 2 * M_PI / 44100);
-            int32_t wint = (int32_t)(w * INT32_MAX);
-            inbuffer[i * 2] = wint;
-            inbuffer[i * 2 + 1] = wint;
-        }
-
-        soxr_io_spec_t io_spec;
-        io_spec.itype = SOXR_INT32_I;
-        io_spec.otype = SOXR_INT32_I;
-        io_spec.scale = 1.0; // this seems to crash if not = 1.0
-        io_spec.e = NULL;
-        io_spec.flags = 0;
-
-        size_t odone;
-
-        soxr_oneshot(buffer_length, buffer_length + 1, 2, // Rates and # of chans.
-                     inbuffer, buffer_length, NULL,    // Input.
-                     outbuffer, buffer_length + 1, &odone, // Output.
-                     &io_spec,                         // Input, output and transfer spec.
-                     NULL, NULL);                      // Default configuration.
-
-        io_spec.itype = SOXR_INT32_I;
-        io_spec.otype = SOXR_INT32_I;
-        io_spec.scale = 1.0; // this seems to crash if not = 1.0
-        io_spec.e = NULL;
-        io_spec.flags = 0;
-
-        soxr_oneshot(buffer_length, buffer_length - 1, 2, // Rates and # of chans.
-                     inbuffer, buffer_length, NULL,    // Input.
-                     outbuffer, buffer_length - 1, &odone, // Output.
-                     &io_spec,                         // Input, output and transfer spec.
-                     NULL, NULL);                      // Default configuration.
-    }
-
-    double soxr_execution_time_ns = (get_absolute_time_in_ns() - soxr_start_time) * 1.0;
-
-    // free(outbuffer);
-    // free(inbuffer);
-    config.soxr_delay_index = (int)(0.9 + soxr_execution_time_ns / (number_of_iterations * 1000000));
-    debug(2, "soxr_delay_index: %d.", config.soxr_delay_index);
-
-    if ((config.packet_stuffing == ST_soxr) &&
-        (config.soxr_delay_index > config.soxr_delay_threshold)) inform("Note: this device may be too slow for \"soxr\" interpolation. Consider choosing the "
-                                                                        "\"basic\" or \"auto\" interpolation setting.");
-
-    if (config.packet_stuffing == ST_auto) debug(1, "\"%s\" interpolation has been chosen.",
-                                                 config.soxr_delay_index <= config.soxr_delay_threshold ? "soxr" : "basic");
-
-    pthread_exit(NULL);
-}
-
-#endif /* ifdef CONFIG_SOXR */
-
 void usage(char * progname)
 {
     printf("Usage: %s [options...]\n", progname);
@@ -244,7 +184,9 @@ void usage(char * progname)
     printf("    -S, --stuffing=MODE set how to adjust current latency to match desired latency, "
            "where \n");
     printf("                            \"basic\" inserts or deletes audio frames from "
-           "packet frames with low processor overhead, and \n");
+           "packet frames with low processor overhead, \n");
+    printf("                            \"polyphase\" stretches or squeezes packet frames with a "
+           "cubic resampler -- low processor overhead, and \n");
     printf("                            \"soxr\" uses libsoxr to minimally resample packet frames -- "
            "moderate processor overhead.\n");
     printf(
@@ -328,6 +270,11 @@ int parse_options(int argc, char * * argv)
         { "metadata-enable",        'M', POPT_ARG_NONE,   &config.metadata_enabled,     'M', NULL, NULL },
         { "metadata-pipename",      0,   POPT_ARG_STRING, &config.metadata_pipename,    0,   NULL, NULL },
         { "get-coverart",           'g', POPT_ARG_NONE,   &config.get_coverart,         'g', NULL, NULL },
+#endif
+#ifdef CONFIG_REPLAY
+        { "replay",                 0,   POPT_ARG_STRING, &replay_path,                 0,   NULL, NULL },
+        { "replay-sdp",             0,   POPT_ARG_STRING, &replay_sdp_path,             0,   NULL, NULL },
+        { "replay-speed",           0,   POPT_ARG_DOUBLE, &replay_speed,                0,   NULL, NULL },
 #endif
         POPT_AUTOHELP { NULL,                     0,   0,               NULL,                         0,   NULL, NULL }
     };
@@ -433,9 +380,11 @@ int parse_options(int argc, char * * argv)
     config.fixedLatencyOffset = 11025; // this sounds like it works properly.
     config.diagnostic_drop_packet_fraction = 0.0;
     config.active_state_timeout = 10.0;
-    config.soxr_delay_threshold = 30; // the soxr measurement time (milliseconds) of two oneshots must
-                                 // not exceed this if soxr interpolation is to be chosen
+    config.soxr_delay_threshold = 30; // the soxr measurement time (milliseconds) of two streamed packets
+                                 // must not exceed this if soxr interpolation is to be chosen
                                  // automatically.
+    config.soxr_cpu_budget = 0.5;     // stop using soxr if it takes more than half of each packet's time
+    config.pipeline_cpu_budget = 0.5; // warn if the audio path takes more than half of each packet's time
     config.volume_range_hw_priority =
         0; // if combining software and hardware volume control, give the software priority
            // i.e. when reducing volume, reduce the sw first before reducing the software.
@@ -450,6 +399,7 @@ int parse_options(int argc, char * * argv)
     config.missing_port_dacp_scan_interval_seconds =
         2.0; // check at this interval if no DACP port number is known
 
+    config.packet_buffer_size = BUFFER_FRAMES;
     config.minimum_free_buffer_headroom = 125; // leave approximately one second's worth of buffers
                                                // free after calculating the effective latency.
     // e.g. if we have 1024 buffers or 352 frames = 8.17 seconds and we have a nominal latency of 2.0
@@ -464,11 +414,14 @@ int parse_options(int argc, char * * argv)
 
 #ifdef CONFIG_CONVOLUTION
     config.convolution_max_length = 8192;
+    config.convolution_ir_cache_dir = "/tmp/shairport-sync/.cache/impulse-responses";
 #endif
     config.loudness_reference_volume_db = -20;
 
 #ifdef CONFIG_METADATA_HUB
     config.cover_art_cache_dir = "/tmp/shairport-sync/.cache/coverart";
+    config.cover_art_cache_maximum_files = 16;
+    config.cover_art_cache_maximum_size = 8 * 1024 * 1024;
     config.scan_interval_when_active =
         1; // number of seconds between DACP server scans when playing something
     config.scan_interval_when_inactive =
@@ -566,6 +519,7 @@ int parse_options(int argc, char * * argv)
             {
                 if (strcasecmp(str, "basic") == 0) config.packet_stuffing = ST_basic;
                 else if (strcasecmp(str, "auto") == 0) config.packet_stuffing = ST_auto;
+                else if (strcasecmp(str, "polyphase") == 0) config.packet_stuffing = ST_polyphase;
                 else if (strcasecmp(str, "soxr") == 0)
 #ifdef CONFIG_SOXR
                     config.packet_stuffing = ST_soxr;
@@ -575,7 +529,14 @@ int parse_options(int argc, char * * argv)
                          "without libsoxr "
                          "support. Change the \"general/interpolation\" setting in the configuration file.");
 #endif
-                else die("Invalid interpolation option choice. It should be \"auto\", \"basic\" or \"soxr\"");
+                else die("Invalid interpolation option choice. It should be \"auto\", \"basic\", \"polyphase\" or \"soxr\"");
+            }
+
+            if (config_lookup_string(config.cfg, "general.drift_correction", &str))
+            {
+                if (strcasecmp(str, "pi") == 0) config.drift_correction = DC_pi;
+                else if (strcasecmp(str, "threshold") == 0) config.drift_correction = DC_threshold;
+                else die("Invalid drift_correction option choice. It should be \"pi\" or \"threshold\"");
             }
 
 #ifdef CONFIG_SOXR
@@ -591,8 +552,47 @@ int parse_options(int argc, char * * argv)
                          value, config.soxr_delay_threshold);
             }
 
+            /* Get the soxr_cpu_budget setting. */
+            if (config_lookup_float(config.cfg, "general.soxr_cpu_budget", &dvalue))
+            {
+                if ((dvalue >= 0.0) && (dvalue <= 1.0)) config.soxr_cpu_budget = dvalue;
+                else
+                    warn("Invalid general soxr_cpu_budget setting \"%f\". It should be between 0.0 and 1.0, "
+                         "inclusive. Default is %.2f.",
+                         dvalue, config.soxr_cpu_budget);
+            }
+
 #endif
 
+            /* Get the pipeline_cpu_budget setting. */
+            if (config_lookup_float(config.cfg, "general.pipeline_cpu_budget", &dvalue))
+            {
+                if ((dvalue >= 0.0) && (dvalue <= 1.0)) config.pipeline_cpu_budget = dvalue;
+                else
+                    warn("Invalid general pipeline_cpu_budget setting \"%f\". It should be between 0.0 and "
+                         "1.0, inclusive. Default is %.2f.",
+                         dvalue, config.pipeline_cpu_budget);
+            }
+
+            /* Get the pipeline_over_budget setting. */
+            if (config_lookup_string(config.cfg, "general.pipeline_over_budget", &str))
+            {
+                if (strcasecmp(str, "warn") == 0) config.pipeline_degrade = 0;
+                else if (strcasecmp(str, "degrade") == 0) config.pipeline_degrade = 1;
+                else die("Invalid pipeline_over_budget option choice \"%s\". It should be \"warn\" or "
+                         "\"degrade\"", str);
+            }
+
+            /* Get the packet buffer size. */
+            if (config_lookup_int(config.cfg, "general.packet_buffer_size", &value))
+            {
+                if ((value >= 512) && (value <= 16384) && ((value & (value - 1)) == 0)) config.packet_buffer_size = value;
+                else
+                    warn("Invalid general packet_buffer_size setting \"%d\". It should be a power of two "
+                         "from 512 to 16384, inclusive. Default is %d (packets).",
+                         value, config.packet_buffer_size);
+            }
+
             /* Get the statistics setting. */
             if (config_set_lookup_bool(config.cfg, "general.statistics",
                                        &(config.statistics_requested)))
@@ -623,6 +623,63 @@ int parse_options(int argc, char * * argv)
             /* Get the resync setting. */
             if (config_lookup_float(config.cfg, "general.resync_threshold_in_seconds", &dvalue)) config.resyncthreshold = dvalue;
 
+            /* Get the adaptive_latency setting. */
+            if (config_lookup_string(config.cfg, "general.adaptive_latency", &str))
+            {
+                if (strcasecmp(str, "no") == 0) config.adaptive_latency = 0;
+                else if (strcasecmp(str, "yes") == 0) config.adaptive_latency = 1;
+                else die("Invalid general adaptive_latency option choice \"%s\". It should be \"yes\" or "
+                         "\"no\"", str);
+            }
+
+            /* Get the scheduling settings and the memory locking setting. */
+            if (config_lookup_string(config.cfg, "scheduling.lock_memory", &str))
+            {
+                if (strcasecmp(str, "no") == 0) config.lock_memory = 0;
+                else if (strcasecmp(str, "yes") == 0) config.lock_memory = 1;
+                else die("Invalid scheduling lock_memory option choice \"%s\". It should be \"yes\" or "
+                         "\"no\"", str);
+            }
+
+            {
+                int tc;
+
+                for (tc = 0; tc < TC_number_of_classes; tc++)
+                {
+                    char setting[64];
+                    thread_scheduling_t * ts = &config.thread_scheduling[tc];
+
+                    snprintf(setting, sizeof(setting), "scheduling.%s_policy", thread_class_names[tc]);
+
+                    if (config_lookup_string(config.cfg, setting, &str))
+                    {
+                        if (strcasecmp(str, "other") == 0) ts->policy = TP_other;
+                        else if (strcasecmp(str, "fifo") == 0) ts->policy = TP_fifo;
+                        else if (strcasecmp(str, "rr") == 0) ts->policy = TP_rr;
+                        else die("Invalid scheduling %s_policy option choice \"%s\". It should be \"other\", "
+                                 "\"fifo\" or \"rr\"", thread_class_names[tc], str);
+                    }
+
+                    snprintf(setting, sizeof(setting), "scheduling.%s_priority", thread_class_names[tc]);
+
+                    if (config_lookup_int(config.cfg, setting, &value))
+                    {
+                        if ((value >= 1) && (value <= 99)) ts->priority = value;
+                        else die("Invalid scheduling %s_priority setting \"%d\". It should be between 1 and 99, "
+                                 "inclusive.", thread_class_names[tc], value);
+                    }
+
+                    if ((ts->policy != TP_other) && (ts->priority == 0))
+                        die("A scheduling %s_priority setting is needed with the \"%s\" policy.",
+                            thread_class_names[tc], ts->policy == TP_fifo ? "fifo" : "rr");
+
+                    snprintf(setting, sizeof(setting), "scheduling.%s_cpus", thread_class_names[tc]);
+
+                    if ((config_lookup_string(config.cfg, setting, &str)) && (str[0] != '\0'))
+                        ts->cpus = (char *)str;
+                }
+            }
+
             /* Get the verbosity setting. */
             if (config_lookup_int(config.cfg, "general.log_verbosity", &value))
             {
@@ -683,6 +740,15 @@ int parse_options(int argc, char * * argv)
                          "\"no\"");
             }
 
+            /* Get the latency_histograms setting. */
+            if (config_lookup_string(config.cfg, "diagnostics.latency_histograms", &str))
+            {
+                if (strcasecmp(str, "no") == 0) latency_histograms_enabled = 0;
+                else if (strcasecmp(str, "yes") == 0) latency_histograms_enabled = 1;
+                else die("Invalid diagnostics latency_histograms option choice \"%s\". It should be "
+                         "\"yes\" or \"no\"", str);
+            }
+
             /* Get the disable_resend_requests setting. */
             if (config_lookup_string(config.cfg, "diagnostics.disable_resend_requests", &str))
             {
@@ -696,6 +762,27 @@ int parse_options(int argc, char * * argv)
                         "or \"no\"");
             }
 
+            /* Get the capture_directory setting. */
+            if (config_lookup_string(config.cfg, "diagnostics.capture_directory", &str))
+                config.capture_directory = (char *)str;
+
+            /* Get the metrics_port and metrics_address settings. */
+            if (config_lookup_int(config.cfg, "diagnostics.metrics_port", &value))
+            {
+                if ((value < 0) || (value > 65535))
+                    die("Invalid diagnostics metrics_port \"%d\". It should be between 0 and 65535, "
+                        "where 0 means the metrics listener is off.",
+                        value);
+                else config.metrics_port = value;
+            }
+
+            if ((config_lookup_string(config.cfg, "diagnostics.metrics_address", &str)) && (str[0] != '\0'))
+                config.metrics_address = (char *)str;
+
+            /* Get the trace_file setting. */
+            if ((config_lookup_string(config.cfg, "diagnostics.trace_file", &str)) && (str[0] != '\0'))
+                config.trace_file = (char *)str;
+
             /* Get the drop packets setting. */
             if (config_lookup_float(config.cfg, "diagnostics.drop_this_fraction_of_audio_packets",
                                     &dvalue))
@@ -729,6 +816,15 @@ int parse_options(int argc, char * * argv)
                 }
             }
 
+            /* Get the log_asynchronously setting. */
+            if (config_lookup_string(config.cfg, "diagnostics.log_asynchronously", &str))
+            {
+                if (strcasecmp(str, "no") == 0) config.log_asynchronously = 0;
+                else if (strcasecmp(str, "yes") == 0) config.log_asynchronously = 1;
+                else die("Invalid diagnostics log_asynchronously option choice \"%s\". It should be "
+                         "\"yes\" or \"no\"", str);
+            }
+
             /* Get the ignore_volume_control setting. */
             if (config_lookup_string(config.cfg, "general.ignore_volume_control", &str))
             {
@@ -934,6 +1030,17 @@ int parse_options(int argc, char * * argv)
                 config.metadata_sockmsglength = value < 500 ? 500 : value > 65000 ? 65000 : value;
             }
 
+            config_set_lookup_bool(config.cfg, "metadata.socket_pack_items",
+                                   &config.metadata_socket_pack_items);
+
+            if (config_lookup_int(config.cfg, "metadata.socket_maximum_rate", &value))
+            {
+                if (value < 0)
+                    die("Invalid metadata socket_maximum_rate \"%d\". It should be 0 or more, in kilobytes per second; the default is 0, meaning no limit.",
+                        value);
+                else config.metadata_socket_maximum_rate = value;
+            }
+
 #endif /* ifdef CONFIG_METADATA */
 
 #ifdef CONFIG_METADATA_HUB
@@ -943,6 +1050,22 @@ int parse_options(int argc, char * * argv)
                 config.cover_art_cache_dir = (char *)str;
             }
 
+            if (config_lookup_int(config.cfg, "metadata.cover_art_cache_maximum_files", &value))
+            {
+                if (value < 1) warn("Invalid metadata cover_art_cache_maximum_files setting \"%d\". It must be "
+                                    "at least 1. The default of %d is used instead.",
+                                    value, config.cover_art_cache_maximum_files);
+                else config.cover_art_cache_maximum_files = value;
+            }
+
+            if (config_lookup_int(config.cfg, "metadata.cover_art_cache_maximum_size", &value))
+            {
+                if (value < 1) warn("Invalid metadata cover_art_cache_maximum_size setting \"%d\". It must be "
+                                    "at least 1 kilobyte. The default of %zu kilobytes is used instead.",
+                                    value, config.cover_art_cache_maximum_size / 1024);
+                else config.cover_art_cache_maximum_size = (size_t)value * 1024;
+            }
+
             if (config_lookup_string(config.cfg, "diagnostics.retain_cover_art", &str))
             {
                 if (strcasecmp(str, "no") == 0) config.retain_coverart = 0;
@@ -1051,6 +1174,19 @@ int parse_options(int argc, char * * argv)
                 if (value < 1 || value > 200000) die("dsp.convolution_max_length must be within 1 and 200000");
             }
 
+            if (config_lookup_string(config.cfg, "dsp.convolution_parallel", &str))
+            {
+                if (strcasecmp(str, "no") == 0) config.convolution_parallel = 0;
+                else if (strcasecmp(str, "yes") == 0) config.convolution_parallel = 1;
+                else die("Invalid dsp.convolution_parallel. It should be \"yes\" or \"no\"");
+                convolver_set_parallel(config.convolution_parallel);
+            }
+
+            if (config_lookup_string(config.cfg, "dsp.convolution_ir_cache_directory", &str))
+                config.convolution_ir_cache_dir = (char *)str;
+
+            convolver_set_cache_directory(config.convolution_ir_cache_dir);
+
             if (config_lookup_string(config.cfg, "dsp.convolution_ir_file", &str))
             {
                 config.convolution_ir_file = strdup(str);
@@ -1199,6 +1335,18 @@ int parse_options(int argc, char * * argv)
         config_set_lookup_bool(config.cfg, "mqtt.publish_raw", &config.mqtt_publish_raw);
         config_set_lookup_bool(config.cfg, "mqtt.publish_parsed", &config.mqtt_publish_parsed);
         config_set_lookup_bool(config.cfg, "mqtt.publish_cover", &config.mqtt_publish_cover);
+        config_set_lookup_bool(config.cfg, "mqtt.publish_asynchronously",
+                               &config.mqtt_publish_asynchronously);
+
+        config.mqtt_publish_interval = 0.25;
+
+        if (config_lookup_float(config.cfg, "mqtt.publish_interval_in_seconds", &dvalue))
+        {
+            if ((dvalue < 0.0) || (dvalue > 10.0))
+                die("Invalid mqtt publish_interval_in_seconds \"%f\". It should be between 0.0 and 10.0, default is 0.25",
+                    dvalue);
+            else config.mqtt_publish_interval = dvalue;
+        }
 
         if (config.mqtt_publish_cover && !config.get_coverart)
         {
@@ -1278,6 +1426,7 @@ int parse_options(int argc, char * * argv)
 
                 if (strcmp(stuffing, "basic") == 0) config.packet_stuffing = ST_basic;
                 else if (strcmp(stuffing, "auto") == 0) config.packet_stuffing = ST_auto;
+                else if (strcmp(stuffing, "polyphase") == 0) config.packet_stuffing = ST_polyphase;
                 else if (strcmp(stuffing, "soxr") == 0)
 #ifdef CONFIG_SOXR
                     config.packet_stuffing = ST_soxr;
@@ -1400,6 +1549,7 @@ static GMainLoop * g_main_loop = NULL;
 pthread_t dbus_thread;
 void * dbus_thread_func(__attribute__((unused)) void * arg)
 {
+    set_thread_scheduling(TC_metadata);
     g_main_loop = g_main_loop_new(NULL, FALSE);
     g_main_loop_run(g_main_loop);
     debug(2, "g_main_loop thread exit");
@@ -1487,10 +1637,7 @@ void exit_function()
             config.output->deinit();
         }
 
-#ifdef CONFIG_SOXR
-        // be careful -- not sure if the thread can be cancelled cleanly, so wait for it to shut down
-        pthread_join(soxr_time_check_thread, NULL);
-#endif
+        zones_deinit();
 
         if (conns) free(conns); // make sure the connections have been deleted first
 
@@ -1566,6 +1713,41 @@ void main_thread_cleanup_handler(__attribute__((unused)) void * arg)
     exit(EXIT_SUCCESS);
 }
 
+// the device ID is made from the service name, so that it's the same each time
+static void hw_addr_for_name(const char * name, uint8_t * hw_addr)
+{
+    uint8_t ap_md5[16];
+
+#ifdef CONFIG_OPENSSL
+    MD5_CTX ctx;
+    MD5_Init(&ctx);
+    MD5_Update(&ctx, name, strlen(name));
+    MD5_Final(ap_md5, &ctx);
+#endif
+
+#ifdef CONFIG_MBEDTLS
+#if MBEDTLS_VERSION_MINOR >= 7
+    mbedtls_md5_context tctx;
+    mbedtls_md5_starts_ret(&tctx);
+    mbedtls_md5_update_ret(&tctx, (unsigned char *)name, strlen(name));
+    mbedtls_md5_finish_ret(&tctx, ap_md5);
+#else
+    mbedtls_md5_context tctx;
+    mbedtls_md5_starts(&tctx);
+    mbedtls_md5_update(&tctx, (unsigned char *)name, strlen(name));
+    mbedtls_md5_finish(&tctx, ap_md5);
+#endif
+#endif
+
+#ifdef CONFIG_POLARSSL
+    md5_context tctx;
+    md5_starts(&tctx);
+    md5_update(&tctx, (unsigned char *)name, strlen(name));
+    md5_finish(&tctx, ap_md5);
+#endif
+    memcpy(hw_addr, ap_md5, 6);
+}
+
 int main(int argc, char * * argv)
 {
     /* Check if we are called with -V or --version parameter */
@@ -1600,6 +1782,11 @@ int main(int argc, char * * argv)
 
     free(basec);
 
+#ifdef CONFIG_BENCH
+    // the benchmarks need nothing more than the default settings
+    exit(bench_main(argc, argv));
+#endif
+
 //  debug(1,"startup");
 #ifdef CONFIG_LIBDAEMON
     daemon_set_verbosity(LOG_DEBUG);
@@ -1664,6 +1851,7 @@ int main(int argc, char * * argv)
     config.timeout = 120; // this number of seconds to wait for [more] audio before switching to idle.
     config.tolerance =
         0.002; // this number of seconds of timing error before attempting to correct it.
+    config.drift_correction = DC_pi; // spread the corrections out evenly
     config.buffer_start_fill = 220;
     config.port = 5000;
 
@@ -1881,6 +2069,10 @@ int main(int argc, char * * argv)
     }
 
 #endif /* ifdef CONFIG_LIBDAEMON */
+
+    // after daemonising, which the logger thread wouldn't survive
+    if (config.log_asynchronously) log_queue_start();
+
     debug(1, "Started!");
 
     // stop a pipe signal from killing the program
@@ -1930,7 +2122,7 @@ int main(int argc, char * * argv)
             config.output_name == NULL ? "<unspecified>" : config.output_name);
     }
 
-    config.output->init(argc - audio_arg, argv + audio_arg);
+    zones_init(argc - audio_arg, argv + audio_arg);
 
     pthread_cleanup_push(main_thread_cleanup_handler, NULL);
 
@@ -1969,10 +2161,10 @@ int main(int argc, char * * argv)
 
         if ((config.userSuppliedLatency != 0) &&
             ((config.userSuppliedLatency < 4410) ||
-             (config.userSuppliedLatency > BUFFER_FRAMES * 352 - 22050)))
+             (config.userSuppliedLatency > (uint32_t)config.packet_buffer_size * 352 - 22050)))
             die("An out-of-range fixed latency has been specified. It must be between 4410 and %d (at "
                 "44100 frames per second).",
-                BUFFER_FRAMES * 352 - 22050);
+                config.packet_buffer_size * 352 - 22050);
     }
 
     /* Print out options */
@@ -2003,9 +2195,23 @@ int main(int argc, char * * argv)
     debug(2, "userSuppliedLatency is %d.", config.userSuppliedLatency);
     debug(1, "interpolation setting is \"%s\".",
           config.packet_stuffing == ST_basic ? "basic"
-                                           : config.packet_stuffing == ST_soxr ? "soxr" : "auto");
+                                           : config.packet_stuffing == ST_soxr ? "soxr"
+                                           : config.packet_stuffing == ST_polyphase ? "polyphase" : "auto");
     debug(1, "interpolation soxr_delay_threshold is %d.", config.soxr_delay_threshold);
+    debug(1, "interpolation soxr_cpu_budget is %.2f.", config.soxr_cpu_budget);
+    debug(1, "pipeline_cpu_budget is %.2f.", config.pipeline_cpu_budget);
+    debug(1, "pipeline_over_budget is \"%s\".", config.pipeline_degrade ? "degrade" : "warn");
     debug(1, "resync time is %f seconds.", config.resyncthreshold);
+    debug(1, "adaptive latency is %s.", config.adaptive_latency ? "on" : "off");
+    debug(1, "lock memory is %d.", config.lock_memory);
+    {
+        int tc;
+
+        for (tc = 0; tc < TC_number_of_classes; tc++)
+            debug(1, "%s thread scheduling: policy %d, priority %d, cpus \"%s\".", thread_class_names[tc],
+                  config.thread_scheduling[tc].policy, config.thread_scheduling[tc].priority,
+                  config.thread_scheduling[tc].cpus ? config.thread_scheduling[tc].cpus : "");
+    }
     debug(1, "allow a session to be interrupted: %d.", config.allow_session_interruption);
     debug(1, "busy timeout time is %d.", config.timeout);
     debug(1, "drift tolerance is %f seconds.", config.tolerance);
@@ -2035,6 +2241,7 @@ int main(int argc, char * * argv)
 
     if (config.output_rate_auto_requested == 0) debug(1, "output_rate is %d.", config.output_rate);
 
+    debug(1, "latency profile is \"%s\".", config.latency_profile == LP_low ? "low" : "standard");
     debug(1, "audio backend desired buffer length is %f seconds.",
           config.audio_backend_buffer_desired_length);
     debug(1, "audio_backend_buffer_interpolation_threshold_in_seconds is %f seconds.",
@@ -2072,6 +2279,9 @@ int main(int argc, char * * argv)
     debug(1, "metadata socket address is \"%s\" port %d.", config.metadata_sockaddr,
           config.metadata_sockport);
     debug(1, "metadata socket packet size is \"%d\".", config.metadata_sockmsglength);
+    debug(1, "metadata socket items are%s packed.", config.metadata_socket_pack_items ? "" : " not");
+    debug(1, "metadata socket maximum rate is %d kilobytes per second.",
+          config.metadata_socket_maximum_rate);
     debug(1, "get-coverart is %d.", config.get_coverart);
 #endif
 #ifdef CONFIG_MQTT
@@ -2081,6 +2291,8 @@ int main(int argc, char * * argv)
     debug(1, "mqtt will%s publish raw metadata.", config.mqtt_publish_raw ? "" : " not");
     debug(1, "mqtt will%s publish parsed metadata.", config.mqtt_publish_parsed ? "" : " not");
     debug(1, "mqtt will%s publish cover Art.", config.mqtt_publish_cover ? "" : " not");
+    debug(1, "mqtt will%s publish asynchronously, with an interval of %f seconds.",
+          config.mqtt_publish_asynchronously ? "" : " not", config.mqtt_publish_interval);
     debug(1, "mqtt remote control is %sabled.", config.mqtt_enable_remote ? "en" : "dis");
 #endif
 
@@ -2088,45 +2300,43 @@ int main(int argc, char * * argv)
     debug(1, "convolution is %d.", config.convolution);
     debug(1, "convolution IR file is \"%s\"", config.convolution_ir_file);
     debug(1, "convolution max length %d", config.convolution_max_length);
+    debug(1, "convolution IR cache directory is \"%s\"", config.convolution_ir_cache_dir);
     debug(1, "convolution gain is %f", config.convolution_gain);
 #endif
     debug(1, "loudness is %d.", config.loudness);
     debug(1, "loudness reference level is %f", config.loudness_reference_volume_db);
 
-    uint8_t ap_md5[16];
+    if (config.lock_memory)
+    {
+        // lock what's mapped now and whatever is mapped later, e.g. session buffers and thread stacks
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        {
+            char em[1024];
+            strerror_r(errno, em, sizeof(em));
+            warn("Can't lock memory: \"%s\". It may need the CAP_IPC_LOCK capability or a higher "
+                 "RLIMIT_MEMLOCK.",
+                 em);
+        }
+        else
+        {
+            debug(1, "memory locked.");
+        }
+    }
 
-#ifdef CONFIG_SOXR
-    pthread_create(&soxr_time_check_thread, NULL, &soxr_time_check, NULL);
-#endif
+    // this decides whether "auto" interpolation can use soxr, so it must finish before a session
+    // can start
+    pipeline_profile_run();
 
-#ifdef CONFIG_OPENSSL
-    MD5_CTX ctx;
-    MD5_Init(&ctx);
-    MD5_Update(&ctx, config.service_name, strlen(config.service_name));
-    MD5_Final(ap_md5, &ctx);
-#endif
+    hw_addr_for_name(config.service_name, config.hw_addr);
+    memcpy(zones[0].hw_addr, config.hw_addr, sizeof(zones[0].hw_addr));
 
-#ifdef CONFIG_MBEDTLS
-#if MBEDTLS_VERSION_MINOR >= 7
-    mbedtls_md5_context tctx;
-    mbedtls_md5_starts_ret(&tctx);
-    mbedtls_md5_update_ret(&tctx, (unsigned char *)config.service_name, strlen(config.service_name));
-    mbedtls_md5_finish_ret(&tctx, ap_md5);
-#else
-    mbedtls_md5_context tctx;
-    mbedtls_md5_starts(&tctx);
-    mbedtls_md5_update(&tctx, (unsigned char *)config.service_name, strlen(config.service_name));
-    mbedtls_md5_finish(&tctx, ap_md5);
-#endif
-#endif
+    int zone_index;
+
+    for (zone_index = 1; zone_index < zone_count; zone_index++)
+    {
+        hw_addr_for_name(zones[zone_index].name, zones[zone_index].hw_addr);
+    }
 
-#ifdef CONFIG_POLARSSL
-    md5_context tctx;
-    md5_starts(&tctx);
-    md5_update(&tctx, (unsigned char *)config.service_name, strlen(config.service_name));
-    md5_finish(&tctx, ap_md5);
-#endif
-    memcpy(config.hw_addr, ap_md5, sizeof(config.hw_addr));
 #ifdef CONFIG_METADATA
     metadata_init(); // create the metadata pipe if necessary
 #endif
@@ -2160,6 +2370,17 @@ int main(int argc, char * * argv)
         initialise_mqtt();
     }
 
+#endif
+
+    if (config.metrics_port) metrics_start(config.metrics_address, config.metrics_port);
+
+    if (config.trace_file) trace_start(config.trace_file);
+
+#ifdef CONFIG_REPLAY
+
+    if (replay_path == NULL) die("Give the capture to replay with --replay.");
+
+    exit(replay_main(replay_path, replay_sdp_path, replay_speed));
 #endif
 
     activity_monitor_start();
@@ -0,0 +1,120 @@
+/*
+ * Preformatted silence. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A session's silence is formatted, and dithered if need be, in advance -- see silence.h.
+
+#include <stdlib.h>
+
+#include "common.h"
+#include "process_block.h"
+#include "silence.h"
+
+void silence_pool_init(silence_pool * pool)
+{
+    pool->frames = NULL;
+    pool->frame_count = 0;
+    pool->bytes_per_frame = 0;
+    pool->position = 0;
+    pool->writer = NULL;
+    pool->dither = 0;
+}
+
+int silence_pool_prepare(silence_pool * pool, size_t frame_count,
+                         const process_block_writer * writer, int dither,
+                         int64_t * previous_random_number)
+{
+    if ((pool->frames == NULL) || (pool->writer != writer) || (pool->frame_count != frame_count))
+    {
+        free(pool->frames);
+        pool->writer = NULL;
+        pool->frame_count = 0;
+        pool->bytes_per_frame = writer->bytes_per_sample * 2;
+        pool->frames = malloc(pool->bytes_per_frame * frame_count);
+
+        if (pool->frames == NULL)
+        {
+            debug(1, "Failed to allocate a silence pool of %zu frames.", frame_count);
+            return -1;
+        }
+
+        pool->frame_count = frame_count;
+    }
+    else if (pool->dither == dither)
+    {
+        return 0; // already made
+    }
+
+    process_block_silence(frame_count * 2, pool->frames, writer, dither, previous_random_number);
+    pool->writer = writer;
+    pool->dither = dither;
+    pool->position = 0;
+    return 0;
+}
+
+int silence_pool_play_with_context(silence_pool * pool, size_t number_of_frames,
+                                   silence_pool_context_player play, void * context)
+{
+    int response = 0;
+
+    if (pool->writer == NULL)
+    {
+        debug(1, "Silence requested from a silence pool that hasn't been prepared.");
+        return 0;
+    }
+
+    while (number_of_frames)
+    {
+        size_t n = pool->frame_count - pool->position;
+
+        if (n > number_of_frames) n = number_of_frames;
+
+        response = play(context, pool->frames + pool->position * pool->bytes_per_frame, n);
+        pool->position += n;
+
+        if (pool->position == pool->frame_count) pool->position = 0;
+
+        number_of_frames -= n;
+    }
+
+    return response;
+}
+
+static int silence_pool_call_player(void * context, void * buf, int samples)
+{
+    silence_pool_player * play = context;
+    return (*play)(buf, samples);
+}
+
+int silence_pool_play(silence_pool * pool, size_t number_of_frames, silence_pool_player play)
+{
+    return silence_pool_play_with_context(pool, number_of_frames, &silence_pool_call_player, &play);
+}
+
+void silence_pool_free(silence_pool * pool)
+{
+    free(pool->frames);
+    silence_pool_init(pool);
+}
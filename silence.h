@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct process_block_writer; // see process_block.h
+
+// A silence pool is a buffer of silence, formatted and, where needed, dithered in advance,
+// from which gaps, prefills and sync adjustments of any length can be played without
+// allocating or formatting anything at the time.
+// Successive plays carry on through the buffer, wrapping round, so that the dither isn't
+// restarted on every call.
+
+typedef struct silence_pool
+{
+    char * frames;                       // frame_count frames of preformatted silence
+    size_t frame_count;
+    size_t bytes_per_frame;
+    size_t position;                     // the frame the next play starts at
+    const struct process_block_writer * writer; // NULL if the pool hasn't been prepared
+    int dither;
+} silence_pool;
+
+// the play function of an audio backend, or anything with the same signature
+typedef int (* silence_pool_player)(void * buf, int samples);
+// likewise, for a player that needs to be passed its own state
+typedef int (* silence_pool_context_player)(void * context, void * buf, int samples);
+
+void silence_pool_init(silence_pool * pool);
+
+// make sure the pool holds frame_count frames of silence for this writer, with or without dither.
+// The pool is only reallocated if the writer or size changes and only refilled if the
+// dither setting changes as well, so this is cheap enough to call before every use.
+// The dither state is carried in *previous_random_number. It returns 0 on success.
+int silence_pool_prepare(silence_pool * pool, size_t frame_count,
+                         const struct process_block_writer * writer, int dither,
+                         int64_t * previous_random_number);
+
+// play number_of_frames frames of silence in pieces no bigger than the pool.
+// It returns the value returned by the last call of play, or 0 if nothing was played.
+int silence_pool_play(silence_pool * pool, size_t number_of_frames, silence_pool_player play);
+// the same, passing context to play each time
+int silence_pool_play_with_context(silence_pool * pool, size_t number_of_frames,
+                                   silence_pool_context_player play, void * context);
+
+void silence_pool_free(silence_pool * pool);
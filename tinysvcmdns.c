@@ -1350,6 +1350,21 @@ size_t mdns_encode_pkt(struct mdns_pkt * answer, uint8_t * pkt_buf, size_t pkt_l
 
 #define SERVICES_DNS_SD_NLABEL ((uint8_t *)"\x09_services\x07_dns-sd\x04_udp\x05local")
 
+// replies to simple queries -- one question, no known answers -- are kept, already encoded,
+// keyed by the raw bytes of the question, so that repeats can be answered without parsing or
+// encoding anything. Entries go stale whenever the records change.
+#define MDNS_RESPONSE_CACHE_SIZE    32
+#define MDNS_CACHED_QUESTION_LENGTH 272 // a name of up to 255 bytes, type and class, and a bit
+
+struct mdns_cached_response
+{
+    uint32_t generation; // of the records it was made from; 0 means the entry is empty
+    size_t question_length;
+    uint8_t question[MDNS_CACHED_QUESTION_LENGTH];
+    size_t reply_length; // 0 if there was nothing to send
+    uint8_t * reply;
+};
+
 struct mdnsd
 {
     pthread_mutex_t data_lock;
@@ -1361,6 +1376,10 @@ struct mdnsd
     struct rr_list * announce;
     struct rr_list * services;
     uint8_t * hostname;
+
+    uint32_t records_generation; // incremented, under data_lock, whenever the records change
+    struct mdns_cached_response response_cache[MDNS_RESPONSE_CACHE_SIZE]; // main loop only
+    int response_cache_next;                                              // next one to replace
 };
 
 struct mdns_service
@@ -1731,6 +1750,108 @@ int close_pipe(int s)
 #endif
 }
 
+// the records have changed, so any cached replies are out of date
+static void records_changed(struct mdnsd * svr)
+{
+    // the caller must hold data_lock
+    svr->records_generation++;
+
+    if (svr->records_generation == 0) svr->records_generation = 1; // 0 marks an empty entry
+}
+
+// if the packet is a simple query, return the length of its question section, otherwise 0
+static size_t simple_query_question_length(const uint8_t * pkt_buf, ssize_t pkt_len)
+{
+    if ((pkt_len <= 12) || (pkt_len - 12 > MDNS_CACHED_QUESTION_LENGTH)) return 0;
+
+    uint16_t flags = mdns_read_u16(pkt_buf + 2);
+
+    if ((flags & MDNS_FLAG_RESP) || (MDNS_FLAG_GET_OPCODE(flags) != 0)) return 0;
+
+    // exactly one question and no known answers, authorities or additional records
+    if ((mdns_read_u16(pkt_buf + 4) != 1) || (mdns_read_u16(pkt_buf + 6) != 0) ||
+        (mdns_read_u16(pkt_buf + 8) != 0) || (mdns_read_u16(pkt_buf + 10) != 0))
+        return 0;
+
+    return pkt_len - 12;
+}
+
+static struct mdns_cached_response * find_cached_response(struct mdnsd * svr,
+                                                          const uint8_t * question,
+                                                          size_t question_length,
+                                                          uint32_t generation)
+{
+    int i;
+
+    for (i = 0; i < MDNS_RESPONSE_CACHE_SIZE; i++)
+    {
+        struct mdns_cached_response * c = &svr->response_cache[i];
+
+        if ((c->generation == generation) && (c->question_length == question_length) &&
+            (memcmp(c->question, question, question_length) == 0))
+            return c;
+    }
+
+    return NULL;
+}
+
+static void cache_response(struct mdnsd * svr, const uint8_t * question, size_t question_length,
+                           uint32_t generation, const uint8_t * reply, size_t reply_length)
+{
+    struct mdns_cached_response * c = NULL;
+    int i;
+
+    // prefer an empty or stale entry to evicting a current one
+    for (i = 0; (i < MDNS_RESPONSE_CACHE_SIZE) && (c == NULL); i++)
+    {
+        if (svr->response_cache[i].generation != generation) c = &svr->response_cache[i];
+    }
+
+    if (c == NULL)
+    {
+        c = &svr->response_cache[svr->response_cache_next];
+        svr->response_cache_next = (svr->response_cache_next + 1) % MDNS_RESPONSE_CACHE_SIZE;
+    }
+
+    uint8_t * copy = NULL;
+
+    if (reply_length)
+    {
+        copy = realloc(c->reply, reply_length);
+
+        if (copy == NULL)
+        {
+            // not worth dying for -- just don't cache it
+            free(c->reply);
+            memset(c, 0, sizeof(struct mdns_cached_response));
+            return;
+        }
+
+        memcpy(copy, reply, reply_length);
+    }
+    else
+    {
+        free(c->reply);
+    }
+
+    c->reply = copy;
+    c->reply_length = reply_length;
+    memcpy(c->question, question, question_length);
+    c->question_length = question_length;
+    c->generation = generation;
+}
+
+static void free_response_cache(struct mdnsd * svr)
+{
+    int i;
+
+    for (i = 0; i < MDNS_RESPONSE_CACHE_SIZE; i++)
+    {
+        free(svr->response_cache[i].reply);
+        memset(&svr->response_cache[i], 0, sizeof(struct mdns_cached_response));
+    }
+}
+
 // main loop to receive, process and send out MDNS replies
 // also handles MDNS service announces
 void * main_loop(struct mdnsd * svr)
@@ -1774,13 +1895,50 @@ void * main_loop(struct mdnsd * svr)
             }
 
             DEBUG_PRINTF("data from=%s size=%ld\n", inet_ntoa(fromaddr.sin_addr), (long)recvsize);
-            struct mdns_pkt * mdns = mdns_parse_pkt(pkt_buffer, recvsize);
+
+            uint8_t * question = (uint8_t *)pkt_buffer + 12;
+            size_t question_length = simple_query_question_length(pkt_buffer, recvsize);
+            uint32_t generation = 0;
+            struct mdns_cached_response * cached = NULL;
+
+            if (question_length)
+            {
+                pthread_mutex_lock(&svr->data_lock);
+                generation = svr->records_generation;
+                pthread_mutex_unlock(&svr->data_lock);
+                cached = find_cached_response(svr, question, question_length, generation);
+            }
+
+            struct mdns_pkt * mdns = NULL;
+
+            if (cached)
+            {
+                DEBUG_PRINTF("answered from the response cache\n\n");
+
+                if (cached->reply_length)
+                {
+                    // the reply carries the query's transaction ID
+                    memcpy(cached->reply, pkt_buffer, sizeof(uint16_t));
+                    send_packet(svr->sockfd, cached->reply, cached->reply_length);
+                }
+            }
+            else
+            {
+                mdns = mdns_parse_pkt(pkt_buffer, recvsize);
+            }
 
             if (mdns != NULL)
             {
+                uint8_t question_copy[MDNS_CACHED_QUESTION_LENGTH];
+
+                // the reply is encoded into pkt_buffer, over the query
+                if (question_length) memcpy(question_copy, question, question_length);
+
+                size_t replylen = 0;
+
                 if (process_mdns_pkt(svr, mdns, mdns_reply))
                 {
-                    size_t replylen = mdns_encode_pkt(mdns_reply, pkt_buffer, PACKET_SIZE);
+                    replylen = mdns_encode_pkt(mdns_reply, pkt_buffer, PACKET_SIZE);
                     send_packet(svr->sockfd, pkt_buffer, replylen);
                 }
                 else if (mdns->num_qn == 0)
@@ -1788,6 +1946,11 @@ void * main_loop(struct mdnsd * svr)
                     DEBUG_PRINTF("(no questions in packet)\n\n");
                 }
 
+                // remember the reply, or that there wasn't one, for the next time it's asked
+                if (question_length)
+                    cache_response(svr, question_copy, question_length, generation,
+                                   pkt_buffer, replylen);
+
                 mdns_pkt_destroy(mdns);
             }
         }
@@ -1847,6 +2010,7 @@ void * main_loop(struct mdnsd * svr)
     free(mdns_reply);
 
     free(pkt_buffer);
+    free_response_cache(svr);
 
     close_pipe(svr->sockfd);
 
@@ -1874,6 +2038,7 @@ void mdnsd_set_hostname(struct mdnsd * svr, const char * hostname, uint32_t ip)
     svr->hostname = create_nlabel(hostname);
     rr_group_add(&svr->group, a_e);
     rr_group_add(&svr->group, nsec_e);
+    records_changed(svr);
     pthread_mutex_unlock(&svr->data_lock);
 }
 
@@ -1895,6 +2060,7 @@ void mdnsd_set_hostname_v6(struct mdnsd * svr, const char * hostname, struct in6
     svr->hostname = create_nlabel(hostname);
     rr_group_add(&svr->group, aaaa_e);
     rr_group_add(&svr->group, nsec_e);
+    records_changed(svr);
     pthread_mutex_unlock(&svr->data_lock);
 }
 
@@ -1902,6 +2068,7 @@ void mdnsd_add_rr(struct mdnsd * svr, struct rr_entry * rr)
 {
     pthread_mutex_lock(&svr->data_lock);
     rr_group_add(&svr->group, rr);
+    records_changed(svr);
     pthread_mutex_unlock(&svr->data_lock);
 }
 
@@ -1969,6 +2136,7 @@ struct mdns_service * mdnsd_register_svc(struct mdnsd * svr, const char * instan
     // append PTR entry to announce list
     rr_list_append(&svr->announce, ptr_e);
     rr_list_append(&svr->services, ptr_e);
+    records_changed(svr);
 
     pthread_mutex_unlock(&svr->data_lock);
 
@@ -2017,6 +2185,7 @@ struct mdnsd * mdnsd_start()
     }
 
     pthread_mutex_init(&server->data_lock, NULL);
+    server->records_generation = 1; // 0 marks an empty response cache entry
 
     // init thread
     pthread_attr_init(&attr);
@@ -0,0 +1,292 @@
+/*
+ * Binary trace rings. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Each recording thread has a ring of its own, with one reader, the dumper thread, which
+// merges the rings in time order and writes them out as text.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "trace.h"
+
+#define TRACE_RING_SIZE 4096        // records, a power of two -- over ten seconds of packets
+#define TRACE_BATCH_SIZE 32768      // the most records the dumper takes in one go
+#define TRACE_DUMP_INTERVAL 100000  // microseconds
+
+typedef struct
+{
+    uint64_t time;
+    uint32_t event;
+    int64_t args[4];
+} trace_record_t;
+
+typedef struct trace_ring
+{
+    struct trace_ring * next;
+    int id;
+    uint64_t head, tail; // records written and read since the start
+    uint64_t dropped, dropped_reported;
+    int finished;        // set when the thread has exited
+    trace_record_t records[TRACE_RING_SIZE];
+} trace_ring;
+
+typedef struct
+{
+    const char * name;
+    const char * arg_names[4]; // NULL for an argument that isn't used
+} trace_event_description;
+
+static const trace_event_description trace_events[TR_event_count] = {
+    {"audio_packet", {"seqno", "timestamp", "length", "retransmitted"}},
+    {"retransmitted_packet", {"seqno", "timestamp", "length", NULL}},
+    {"sync_packet", {"timestamp", "latency", "flags", NULL}},
+    {"timing_reply", {"return_time_ns", NULL, NULL, NULL}},
+    {"frame_missing", {"seqno", "ab_read", "ab_write", NULL}},
+    {"resend_request", {"seqno", "count", NULL, NULL}},
+    {"player_frame", {"seqno", "occupancy", "sync_error", "stuff"}},
+    {"dac_delay", {"delay", "resampler_delay", NULL, NULL}},
+};
+
+int trace_enabled = 0;
+
+static FILE * trace_file;
+static char * trace_path;
+static pthread_t trace_thread;
+static pthread_key_t trace_ring_key;
+static pthread_mutex_t trace_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring * trace_rings;
+static int trace_ring_count;
+static __thread trace_ring * trace_thread_ring;
+
+// called when a thread with a ring exits
+static void trace_ring_release(void * arg)
+{
+    trace_ring * ring = (trace_ring *)arg;
+    __atomic_store_n(&ring->finished, 1, __ATOMIC_RELEASE);
+}
+
+static trace_ring * trace_ring_create(void)
+{
+    trace_ring * ring = calloc(1, sizeof(trace_ring));
+
+    if (ring == NULL) return NULL;
+
+    pthread_mutex_lock(&trace_rings_lock);
+    ring->id = trace_ring_count++;
+    ring->next = trace_rings;
+    trace_rings = ring;
+    pthread_mutex_unlock(&trace_rings_lock);
+
+    pthread_setspecific(trace_ring_key, ring);
+    return ring;
+}
+
+void trace_record(trace_event event, int64_t a, int64_t b, int64_t c, int64_t d)
+{
+    trace_ring * ring = trace_thread_ring;
+
+    if (ring == NULL)
+    {
+        ring = trace_ring_create();
+
+        if (ring == NULL) return;
+
+        trace_thread_ring = ring;
+    }
+
+    uint64_t head = ring->head; // only this thread writes it
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= TRACE_RING_SIZE)
+    {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    trace_record_t * r = &ring->records[head & (TRACE_RING_SIZE - 1)];
+    r->time = get_absolute_time_in_ns();
+    r->event = event;
+    r->args[0] = a;
+    r->args[1] = b;
+    r->args[2] = c;
+    r->args[3] = d;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+typedef struct
+{
+    int ring;
+    trace_record_t record;
+} trace_batch_entry;
+
+static int trace_batch_compare(const void * a, const void * b)
+{
+    uint64_t ta = ((const trace_batch_entry *)a)->record.time;
+    uint64_t tb = ((const trace_batch_entry *)b)->record.time;
+
+    return (ta > tb) - (ta < tb);
+}
+
+static void trace_write_entry(const trace_batch_entry * entry)
+{
+    const trace_record_t * r = &entry->record;
+    const trace_event_description * e = &trace_events[r->event];
+    int i;
+
+    fprintf(trace_file, "%.9f %d %s", 1.0E-9 * (r->time - ns_time_at_startup), entry->ring, e->name);
+
+    for (i = 0; i < 4; i++)
+        if (e->arg_names[i]) fprintf(trace_file, " %s=%" PRId64, e->arg_names[i], r->args[i]);
+
+    fputc('\n', trace_file);
+}
+
+// take what's there from every ring, write it out in time order, and free the rings of threads
+// that have exited once they are empty
+static void trace_dump(trace_batch_entry * batch)
+{
+    size_t count = 0;
+    trace_ring ** link;
+
+    pthread_mutex_lock(&trace_rings_lock);
+
+    link = &trace_rings;
+
+    while (*link)
+    {
+        trace_ring * ring = *link;
+        int finished = __atomic_load_n(&ring->finished, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+
+        while ((tail != head) && (count < TRACE_BATCH_SIZE))
+        {
+            batch[count].ring = ring->id;
+            batch[count].record = ring->records[tail & (TRACE_RING_SIZE - 1)];
+            count++;
+            tail++;
+        }
+
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+
+        if (dropped != ring->dropped_reported)
+        {
+            fprintf(trace_file, "# ring %d: %" PRIu64 " records dropped because the ring was full\n",
+                    ring->id, dropped - ring->dropped_reported);
+            ring->dropped_reported = dropped;
+        }
+
+        if ((finished) && (tail == head))
+        {
+            *link = ring->next;
+            free(ring);
+        }
+        else
+        {
+            link = &ring->next;
+        }
+    }
+
+    pthread_mutex_unlock(&trace_rings_lock);
+
+    qsort(batch, count, sizeof(trace_batch_entry), trace_batch_compare);
+
+    size_t i;
+
+    for (i = 0; i < count; i++) trace_write_entry(&batch[i]);
+
+    if (fflush(trace_file) != 0)
+    {
+        char errorstring[1024];
+        strerror_r(errno, (char *)errorstring, sizeof(errorstring));
+        warn("Error writing the trace file \"%s\": \"%s\". Tracing has been stopped.", trace_path,
+             errorstring);
+        trace_enabled = 0;
+    }
+}
+
+static void * trace_thread_code(void * arg)
+{
+    trace_batch_entry * batch = (trace_batch_entry *)arg;
+
+    while (trace_enabled)
+    {
+        usleep(TRACE_DUMP_INTERVAL);
+        trace_dump(batch);
+    }
+
+    free(batch);
+    pthread_exit(NULL);
+}
+
+void trace_start(const char * path)
+{
+    trace_batch_entry * batch = malloc(TRACE_BATCH_SIZE * sizeof(trace_batch_entry));
+
+    if (batch == NULL)
+    {
+        warn("Can't allocate memory for tracing.");
+        return;
+    }
+
+    trace_file = fopen(path, "w");
+
+    if (trace_file == NULL)
+    {
+        char errorstring[1024];
+        strerror_r(errno, (char *)errorstring, sizeof(errorstring));
+        warn("Can't open the trace file \"%s\": \"%s\".", path, errorstring);
+        free(batch);
+        return;
+    }
+
+    trace_path = strdup(path);
+    pthread_key_create(&trace_ring_key, trace_ring_release);
+    fprintf(trace_file, "# seconds since startup, ring, event, arguments\n");
+
+    trace_enabled = 1;
+
+    if (pthread_create(&trace_thread, NULL, &trace_thread_code, batch) != 0)
+    {
+        warn("Can't start the trace thread.");
+        trace_enabled = 0;
+        fclose(trace_file);
+        free(batch);
+        return;
+    }
+
+    pthread_detach(trace_thread);
+    inform("Tracing the audio path to \"%s\".", path);
+}
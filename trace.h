@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+// A per-thread ring of fixed binary records -- an event, a timestamp and four integers -- for
+// the player and RTP threads' per-packet paths, where a formatted debug() message costs enough
+// to change the timing being looked at. A background thread decodes the records and writes
+// them to diagnostics.trace_file. Recording never blocks: if a ring is full, the record is
+// dropped and counted.
+
+typedef enum
+{
+    TR_audio_packet = 0,     // seqno, timestamp, length, retransmitted
+    TR_retransmitted_packet, // seqno, timestamp, length
+    TR_sync_packet,          // rtp timestamp less latency, latency, flags
+    TR_timing_reply,         // return time in ns
+    TR_frame_missing,        // seqno, ab_read, ab_write
+    TR_resend_request,       // first seqno, count
+    TR_player_frame,         // seqno, buffer occupancy, sync error, amount to stuff
+    TR_dac_delay,            // delay in frames, resampler delay in frames
+    TR_event_count,
+} trace_event;
+
+extern int trace_enabled; // set when diagnostics.trace_file is
+
+void trace_record(trace_event event, int64_t a, int64_t b, int64_t c, int64_t d);
+
+#define trace(event, a, b, c, d)                                                                \
+    do                                                                                          \
+    {                                                                                           \
+        if (trace_enabled) trace_record(event, a, b, c, d);                                     \
+    } while (0)
+
+void trace_start(const char * path);
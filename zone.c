@@ -0,0 +1,287 @@
+/*
+ * Zones. This file is part of Shairport Sync.
+ * Copyright (c) agent 2026
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// A backend serves one zone unless it has new_instance(), as alsa does. The backends are
+// initialised one at a time, the first zone's last, so config is left with its settings.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "zone.h"
+
+zone zones[ZONE_MAXIMUM];
+int zone_count = 0;
+
+#ifdef CONFIG_FANOUT
+extern audio_output audio_fanout;
+#endif
+
+static void zone_take_output_settings(zone * z)
+{
+    z->output_format = config.output_format;
+    z->output_rate = config.output_rate;
+    z->audio_backend_buffer_desired_length = config.audio_backend_buffer_desired_length;
+    z->audio_backend_buffer_interpolation_threshold_in_seconds =
+        config.audio_backend_buffer_interpolation_threshold_in_seconds;
+    z->audio_backend_latency_offset = config.audio_backend_latency_offset;
+    z->audio_backend_silent_lead_in_time_auto = config.audio_backend_silent_lead_in_time_auto;
+    z->audio_backend_silent_lead_in_time = config.audio_backend_silent_lead_in_time;
+    z->no_sync = config.no_sync;
+}
+
+static void zone_give_output_settings(const zone * z)
+{
+    config.output_format = z->output_format;
+    config.output_rate = z->output_rate;
+    config.audio_backend_buffer_desired_length = z->audio_backend_buffer_desired_length;
+    config.audio_backend_buffer_interpolation_threshold_in_seconds =
+        z->audio_backend_buffer_interpolation_threshold_in_seconds;
+    config.audio_backend_latency_offset = z->audio_backend_latency_offset;
+    config.audio_backend_silent_lead_in_time_auto = z->audio_backend_silent_lead_in_time_auto;
+    config.audio_backend_silent_lead_in_time = z->audio_backend_silent_lead_in_time;
+    config.no_sync = z->no_sync;
+}
+
+// whether the first zone's fanout backend, if that's what it is, plays on this backend
+static int zone_is_fanout_member(const char * name)
+{
+#ifdef CONFIG_FANOUT
+    config_setting_t * backends = NULL;
+    int i;
+
+    if (config.output != &audio_fanout) return 0;
+
+    if (config.cfg != NULL) backends = config_lookup(config.cfg, "fanout.backends");
+
+    if (backends == NULL) return 0;
+
+    for (i = 0; i < config_setting_length(backends); i++)
+    {
+        const char * member = config_setting_get_string_elem(backends, i);
+
+        if ((member) && (strcmp(member, name) == 0)) return 1;
+    }
+
+#else
+    (void)name;
+#endif
+    return 0;
+}
+
+static void zones_read_settings(void)
+{
+    config_setting_t * list = NULL;
+    int i, j;
+
+    if (config.cfg != NULL) list = config_lookup(config.cfg, "zones");
+
+    if (list == NULL) return;
+
+    if (config_setting_is_list(list) == 0)
+        die("The zones setting must be a list, e.g. zones = ( { name = \"Kitchen\"; port = 5001; "
+            "output_backend = \"pipe\"; } );");
+
+    if (config_setting_length(list) + 1 > ZONE_MAXIMUM)
+        die("At most %d zones, including the first, can be used.", ZONE_MAXIMUM);
+
+    for (i = 0; i < config_setting_length(list); i++)
+    {
+        config_setting_t * setting = config_setting_get_elem(list, i);
+        zone * z = &zones[zone_count];
+        const char * str;
+        const char * section;
+        int value;
+        int in_use;
+
+        if ((config_setting_lookup_string(setting, "name", &str) == CONFIG_FALSE) || (str[0] == '\0'))
+            die("Zone %d has no name setting.", i + 1);
+
+        z->name = strdup(str);
+
+        if (strlen(z->name) > 50)
+        {
+            warn("Zone name \"%s\" is too long (max 50 characters) and has been truncated.", z->name);
+            z->name[50] = '\0';
+        }
+
+        if ((config_setting_lookup_int(setting, "port", &value) == CONFIG_FALSE) || (value < 1) ||
+            (value > 65535))
+            die("Zone \"%s\" needs a port setting from 1 to 65535.", z->name);
+
+        z->port = value;
+
+        if (config_setting_lookup_string(setting, "output_backend", &str) == CONFIG_FALSE)
+            die("Zone \"%s\" has no output_backend setting.", z->name);
+
+        z->output = audio_get_output(str);
+
+        if (z->output == NULL) die("Invalid audio backend \"%s\" for zone \"%s\".", str, z->name);
+
+#ifdef CONFIG_FANOUT
+
+        if (z->output == &audio_fanout) die("Only the first zone can use the fanout backend.");
+
+#endif
+
+        // the section the backend's settings are read from
+        if (config_setting_lookup_string(setting, "output_section", &section) == CONFIG_FALSE)
+            section = z->output->name;
+
+        in_use = ((z->output == config.output) || (zone_is_fanout_member(str)));
+
+        for (j = 0; j < zone_count; j++)
+        {
+            if (zones[j].port == z->port)
+                die("Zones \"%s\" and \"%s\" can't both use port %d.", zones[j].name, z->name, z->port);
+
+            if ((j != 0) && (zones[j].output == z->output)) in_use = 1;
+
+            if ((zones[j].output_section) && (strcmp(zones[j].output_section, section) == 0))
+                die("Zones \"%s\" and \"%s\" can't both use the \"%s\" settings.", zones[j].name,
+                    z->name, section);
+
+            if (strcmp(zones[j].name, z->name) == 0) die("There are two zones called \"%s\".", z->name);
+        }
+
+        // a backend in use already, or asked to read its settings from elsewhere, needs a new instance
+        if ((in_use) || (strcmp(section, z->output->name) != 0))
+        {
+            if ((z->output->new_instance == NULL) && (in_use))
+                die("Zone \"%s\" can't use the \"%s\" backend -- it's used by another zone.", z->name, str);
+
+            if (z->output->new_instance == NULL)
+                die("Zone \"%s\" can't have an output_section setting -- the \"%s\" backend can't read its "
+                    "settings from anywhere else.", z->name, str);
+
+            if (strcmp(section, z->output->name) == 0)
+                die("Zone \"%s\" needs an output_section setting for its own \"%s\" settings -- the \"%s\" "
+                    "backend is used by another zone.", z->name, section, str);
+
+            z->output = z->output->new_instance(section);
+
+            if (z->output == NULL) die("Too many zones are using the \"%s\" backend.", str);
+        }
+
+        z->output_section = strdup(section);
+
+        zone_count++;
+    }
+}
+
+void zones_init(int argc, char * * argv)
+{
+    zone defaults;
+    int i;
+
+    zone_take_output_settings(&defaults);
+
+    memset(zones, 0, sizeof(zones));
+    zones[0].name = config.service_name;
+    zones[0].port = config.port;
+    zones[0].output = config.output;
+    zone_count = 1;
+
+    zones_read_settings();
+
+    for (i = 0; i < zone_count; i++)
+    {
+        zones[i].index = i;
+        pthread_mutex_init(&zones[i].playing_conn_lock, NULL);
+    }
+
+    // only the first zone's backend gets the command-line arguments
+    for (i = zone_count - 1; i >= 1; i--)
+    {
+        zone_give_output_settings(&defaults);
+        zones[i].output->init(0, argv);
+        zone_take_output_settings(&zones[i]);
+        debug(1, "zone \"%s\" is on port %d, playing through the \"%s\" backend.", zones[i].name,
+              zones[i].port, zones[i].output->name);
+    }
+
+    zone_give_output_settings(&defaults);
+    config.output->init(argc, argv);
+    config.output = audio_output_with_rate_measurement(config.output);
+    zones[0].output = config.output;
+    zone_take_output_settings(&zones[0]);
+}
+
+// A backend's prepare() may choose the output format and rate -- e.g. alsa's "auto" settings.
+// If it can say what it chose, that's kept in the zone. Otherwise it's left in config, so zones
+// are prepared one at a time, each starting from its own settings. config is left with the first
+// zone's.
+static pthread_mutex_t zone_prepare_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void zone_prepare_output(zone * z)
+{
+    if (z->output->output_format)
+    {
+        int format;
+        unsigned int rate;
+
+        z->output->prepare();
+        z->output->output_format(&format, &rate);
+        z->output_format = format;
+        z->output_rate = rate;
+
+        if (z->index == 0)
+        {
+            config.output_format = z->output_format;
+            config.output_rate = z->output_rate;
+        }
+
+        return;
+    }
+
+    pthread_cleanup_debug_mutex_lock(&zone_prepare_lock, 50000, 1);
+    config.output_format = z->output_format;
+    config.output_rate = z->output_rate;
+    z->output->prepare();
+    z->output_format = config.output_format;
+    z->output_rate = config.output_rate;
+    config.output_format = zones[0].output_format;
+    config.output_rate = zones[0].output_rate;
+    pthread_cleanup_pop(1);
+}
+
+void zones_deinit(void)
+{
+    int i;
+
+    for (i = 1; i < zone_count; i++)
+    {
+        if (zones[i].output->deinit)
+        {
+            debug(2, "Deinitialise the \"%s\" zone's audio backend.", zones[i].name);
+            zones[i].output->deinit();
+        }
+
+        free(zones[i].name);
+        zones[i].name = NULL;
+        free(zones[i].output_section);
+        zones[i].output_section = NULL;
+    }
+}
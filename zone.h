@@ -0,0 +1,50 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "audio.h"
+#include "common.h"
+#include "player.h"
+
+// A zone is an AirPlay service of its own -- a name, an RTSP port, a device ID and an output
+// backend -- so that one process can play separate sessions, each in its own zone, at once.
+// The first zone is the service described by the general settings; others are listed in the
+// zones setting. A zone plays one session at a time, as the single service always has.
+
+#define ZONE_MAXIMUM 16
+
+typedef struct zone
+{
+    int index;         // 0 for the first zone
+    char * name;       // the service name, as advertised
+    int port;          // for RTSP
+    uint8_t hw_addr[6]; // the device ID, advertised and used to answer the Apple-Challenge
+
+    audio_output * output;
+    char * output_section; // where the backend's settings are read from -- NULL for the first zone
+    // what the backend's init() left in config -- the zone's sessions use these instead
+    sps_format_t output_format;
+    unsigned int output_rate;
+    double audio_backend_buffer_desired_length;
+    double audio_backend_buffer_interpolation_threshold_in_seconds;
+    double audio_backend_latency_offset;
+    int audio_backend_silent_lead_in_time_auto;
+    double audio_backend_silent_lead_in_time;
+    int no_sync;
+
+    pthread_mutex_t playing_conn_lock; // always hold this when accessing playing_conn
+    rtsp_conn_info * playing_conn;     // the session that has the zone's player, if any
+} zone;
+
+extern zone zones[ZONE_MAXIMUM];
+extern int zone_count;
+
+// initialise config.output, with the command-line arguments, as the first zone's backend, and
+// the backends of any other zones in the zones setting, each starting from the defaults.
+// config is left with the first zone's settings. The device IDs are set afterwards
+void zones_init(int argc, char * * argv);
+void zones_deinit(void);
+
+// call the zone's backend's prepare(), keeping any output format and rate it chooses in the zone
+void zone_prepare_output(zone * z);